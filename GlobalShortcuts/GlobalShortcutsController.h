@@ -19,6 +19,9 @@
     NSButton *editButton;
     NSTextField *statusLabel;
     BOOL isDaemonRunning;
+    NSFileHandle *daemonConnection;     // Subscribed to the daemon's control socket, nil when not connected
+    NSMutableData *daemonBuffer;        // Bytes of an incomplete event line
+    NSTimer *reconnectTimer;            // Only runs while the pane is visible and the daemon is not
 }
 
 - (id)init;
@@ -34,6 +37,14 @@
 - (BOOL)saveShortcutsToDefaults;
 - (BOOL)isDaemonRunningCheck;
 - (void)updateDaemonStatus;
+- (void)startMonitoring;
+- (void)stopMonitoring;
+- (BOOL)connectToDaemon;
+- (void)disconnectFromDaemon;
+- (void)reconnectTimerFired:(NSTimer *)timer;
+- (void)daemonDataAvailable:(NSNotification *)notification;
+- (NSArray *)sendDaemonRequest:(NSArray *)fields;
+- (void)applyChangeToDaemon:(NSArray *)request;
 - (void)showAddEditShortcutSheet:(NSMutableDictionary *)shortcut isEditing:(BOOL)editing;
 - (BOOL)isValidKeyCombo:(NSString *)keyCombo;
 
@@ -5,6 +5,13 @@
  */
 
 #import "GlobalShortcutsController.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 // Helper function to parse key combinations with both + and - separators
 NSArray *parseKeyComboInPrefPane(NSString *keyCombo) {
@@ -28,6 +35,68 @@ NSArray *parseKeyComboInPrefPane(NSString *keyCombo) {
     return [NSArray arrayWithObject:keyCombo];
 }
 
+// Where globalshortcutsd's control socket listens; keep in sync with
+// +[ControlSocket defaultPath] in the daemon
+static NSString *daemonSocketPath(void)
+{
+    const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+    if (runtimeDir && *runtimeDir) {
+        return [[NSString stringWithUTF8String:runtimeDir] stringByAppendingPathComponent:@"globalshortcutsd.sock"];
+    }
+    return [NSString stringWithFormat:@"/tmp/globalshortcutsd-%u.sock", (unsigned int)getuid()];
+}
+
+// Returns a connected socket, or -1 if the daemon is not running
+static int connectToDaemonSocket(void)
+{
+    struct sockaddr_un address;
+    const char *path = [daemonSocketPath() fileSystemRepresentation];
+    
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    
+    // The daemon answers from its event loop; never hang the pane on a stuck one
+    struct timeval timeout = { 2, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static BOOL writeDaemonLine(int fd, NSArray *fields)
+{
+    NSString *line = [[fields componentsJoinedByString:@"\t"] stringByAppendingString:@"\n"];
+    const char *bytes = [line UTF8String];
+    size_t length = strlen(bytes);
+    
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return NO;
+        }
+        bytes += written;
+        length -= written;
+    }
+    return YES;
+}
+
 @interface ShortcutEditController : NSObject
 {
     NSWindow *editWindow;
@@ -55,12 +124,17 @@ NSArray *parseKeyComboInPrefPane(NSString *keyCombo) {
     if (self) {
         shortcuts = [[NSMutableArray alloc] init];
         isDaemonRunning = NO;
+        daemonConnection = nil;
+        daemonBuffer = [[NSMutableData alloc] init];
+        reconnectTimer = nil;
     }
     return self;
 }
 
 - (void)dealloc
 {
+    [self stopMonitoring];
+    [daemonBuffer release];
     [mainView release];
     [shortcuts release];
     [super dealloc];
@@ -216,32 +290,217 @@ NSArray *parseKeyComboInPrefPane(NSString *keyCombo) {
     [defaults setPersistentDomain:globalShortcuts forName:@"GlobalShortcuts"];
     [defaults synchronize];
     
-    // Send SIGHUP to daemon to reload configuration
-    if (isDaemonRunning) {
-        system("killall -HUP globalshortcutsd 2>/dev/null");
-    }
-    
+    // The daemon is told about the edit itself, see applyChangeToDaemon:
     return YES;
 }
 
 - (BOOL)isDaemonRunningCheck
 {
-    // Check if globalshortcutsd is running
-    FILE *pipe = popen("pgrep -x globalshortcutsd", "r");
-    if (!pipe) {
+    NSArray *reply = [self sendDaemonRequest:[NSArray arrayWithObject:@"status"]];
+    return reply && [[reply objectAtIndex:0] isEqualToString:@"ok"];
+}
+
+- (void)updateDaemonStatus
+{
+    if (!daemonConnection) {
+        [self connectToDaemon];
+    }
+    isDaemonRunning = (daemonConnection != nil);
+}
+
+- (void)startMonitoring
+{
+    if (!daemonConnection && ![self connectToDaemon] && !reconnectTimer) {
+        // A connect() every few seconds is all a stopped daemon costs
+        reconnectTimer = [[NSTimer scheduledTimerWithTimeInterval:2.0
+                                                           target:self
+                                                         selector:@selector(reconnectTimerFired:)
+                                                         userInfo:nil
+                                                          repeats:YES] retain];
+    }
+}
+
+- (void)stopMonitoring
+{
+    [reconnectTimer invalidate];
+    [reconnectTimer release];
+    reconnectTimer = nil;
+    [self disconnectFromDaemon];
+}
+
+- (void)reconnectTimerFired:(NSTimer *)timer
+{
+    if ([self connectToDaemon]) {
+        [reconnectTimer invalidate];
+        [reconnectTimer release];
+        reconnectTimer = nil;
+        [self refreshShortcuts:nil];
+    }
+}
+
+- (BOOL)connectToDaemon
+{
+    if (daemonConnection) {
+        return YES;
+    }
+    
+    int fd = connectToDaemonSocket();
+    if (fd < 0) {
+        isDaemonRunning = NO;
+        return NO;
+    }
+    if (!writeDaemonLine(fd, [NSArray arrayWithObject:@"subscribe"])) {
+        close(fd);
+        isDaemonRunning = NO;
         return NO;
     }
     
-    char buffer[128];
-    BOOL found = (fgets(buffer, sizeof(buffer), pipe) != NULL);
-    pclose(pipe);
+    daemonConnection = [[NSFileHandle alloc] initWithFileDescriptor:fd closeOnDealloc:YES];
+    [daemonBuffer setLength:0];
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(daemonDataAvailable:)
+                                                 name:NSFileHandleReadCompletionNotification
+                                               object:daemonConnection];
+    [daemonConnection readInBackgroundAndNotify];
+    isDaemonRunning = YES;
+    return YES;
+}
+
+- (void)disconnectFromDaemon
+{
+    if (!daemonConnection) {
+        return;
+    }
+    [[NSNotificationCenter defaultCenter] removeObserver:self
+                                                    name:NSFileHandleReadCompletionNotification
+                                                  object:daemonConnection];
+    [daemonConnection release];
+    daemonConnection = nil;
+    isDaemonRunning = NO;
+}
+
+- (void)daemonDataAvailable:(NSNotification *)notification
+{
+    NSData *data = [[notification userInfo] objectForKey:NSFileHandleNotificationDataItem];
+    
+    if ([data length] == 0) {
+        // The daemon exited; wait for it to come back
+        [self disconnectFromDaemon];
+        [self startMonitoring];
+        return;
+    }
+    
+    [daemonBuffer appendData:data];
+    BOOL changed = NO;
     
-    return found;
+    for (;;) {
+        const char *bytes = [daemonBuffer bytes];
+        const char *newline = memchr(bytes, '\n', [daemonBuffer length]);
+        if (!newline) {
+            break;
+        }
+        NSUInteger lineLength = newline - bytes;
+        NSString *line = [[[NSString alloc] initWithBytes:bytes length:lineLength
+                                                 encoding:NSUTF8StringEncoding] autorelease];
+        [daemonBuffer replaceBytesInRange:NSMakeRange(0, lineLength + 1) withBytes:NULL length:0];
+        
+        NSArray *fields = [line componentsSeparatedByString:@"\t"];
+        if ([fields count] < 2 || ![[fields objectAtIndex:0] isEqualToString:@"event"]) {
+            continue;
+        }
+        
+        // Events describe the daemon's live state, which may include edits from
+        // other clients; our own edits arrive here too and change nothing
+        NSString *event = [fields objectAtIndex:1];
+        if ([event isEqualToString:@"reloaded"]) {
+            [self loadShortcutsFromDefaults];
+            changed = YES;
+        } else if (([event isEqualToString:@"added"] && [fields count] == 4) ||
+                   ([event isEqualToString:@"removed"] && [fields count] == 3)) {
+            NSString *keyCombo = [fields objectAtIndex:2];
+            NSMutableDictionary *existing = nil;
+            for (NSMutableDictionary *shortcut in shortcuts) {
+                if ([[shortcut objectForKey:@"keyCombo"] isEqualToString:keyCombo]) {
+                    existing = shortcut;
+                    break;
+                }
+            }
+            
+            if ([event isEqualToString:@"removed"]) {
+                if (existing) {
+                    [shortcuts removeObjectIdenticalTo:existing];
+                    changed = YES;
+                }
+            } else if (existing) {
+                if (![[existing objectForKey:@"command"] isEqualToString:[fields objectAtIndex:3]]) {
+                    [existing setObject:[fields objectAtIndex:3] forKey:@"command"];
+                    changed = YES;
+                }
+            } else {
+                [shortcuts addObject:[NSMutableDictionary dictionaryWithObjectsAndKeys:
+                    keyCombo, @"keyCombo",
+                    [fields objectAtIndex:3], @"command",
+                    nil]];
+                changed = YES;
+            }
+        }
+    }
+    
+    if (changed) {
+        [shortcutsTable reloadData];
+        [self tableViewSelectionDidChange:nil];
+    }
+    [daemonConnection readInBackgroundAndNotify];
 }
 
-- (void)updateDaemonStatus
+// Sends one request on its own connection, so replies never interleave with
+// events; returns the fields of the final reply line, nil if the daemon is gone
+- (NSArray *)sendDaemonRequest:(NSArray *)fields
 {
-    isDaemonRunning = [self isDaemonRunningCheck];
+    int fd = connectToDaemonSocket();
+    if (fd < 0) {
+        return nil;
+    }
+    
+    NSMutableData *reply = [NSMutableData data];
+    NSArray *result = nil;
+    
+    if (writeDaemonLine(fd, fields)) {
+        char buffer[1024];
+        ssize_t count;
+        
+        // Replies end with their ok or error line
+        while (!result && (count = read(fd, buffer, sizeof(buffer))) > 0) {
+            [reply appendBytes:buffer length:count];
+            NSString *text = [[[NSString alloc] initWithData:reply encoding:NSUTF8StringEncoding] autorelease];
+            for (NSString *line in [text componentsSeparatedByString:@"\n"]) {
+                if ([line hasPrefix:@"ok"] || [line hasPrefix:@"error"]) {
+                    result = [line componentsSeparatedByString:@"\t"];
+                    break;
+                }
+            }
+        }
+    }
+    
+    close(fd);
+    return result;
+}
+
+// Applies one add, remove or replace to the running daemon, which then only
+// regrabs that key; falls back to a full reload if the daemon disagrees
+- (void)applyChangeToDaemon:(NSArray *)request
+{
+    NSArray *reply = [self sendDaemonRequest:request];
+    if (!reply) {
+        [self updateDaemonStatus];
+        return;
+    }
+    
+    if (![[reply objectAtIndex:0] isEqualToString:@"ok"]) {
+        NSLog(@"GlobalShortcutsController: Daemon rejected %@ (%@), reloading",
+              [request objectAtIndex:0], [reply count] > 1 ? [reply objectAtIndex:1] : @"no reason");
+        [self sendDaemonRequest:[NSArray arrayWithObject:@"reload"]];
+    }
 }
 
 - (void)addShortcut:(id)sender
@@ -266,8 +525,10 @@ NSArray *parseKeyComboInPrefPane(NSString *keyCombo) {
 {
     NSInteger selectedRow = [shortcutsTable selectedRow];
     if (selectedRow >= 0 && selectedRow < (NSInteger)[shortcuts count]) {
+        NSString *keyCombo = [[[[shortcuts objectAtIndex:selectedRow] objectForKey:@"keyCombo"] retain] autorelease];
         [shortcuts removeObjectAtIndex:selectedRow];
         [self saveShortcutsToDefaults];
+        [self applyChangeToDaemon:[NSArray arrayWithObjects:@"remove", keyCombo, nil]];
         [shortcutsTable reloadData];
         [self tableViewSelectionDidChange:nil];
     }
@@ -295,34 +556,53 @@ NSArray *parseKeyComboInPrefPane(NSString *keyCombo) {
         return NO;
     }
     
-    NSArray *parts = parseKeyComboInPrefPane(keyCombo);
-    if (!parts || [parts count] < 1) {
+    // Key sequences ("mod4+x t") are strokes separated by spaces
+    NSMutableArray *strokes = [NSMutableArray array];
+    for (NSString *stroke in [keyCombo componentsSeparatedByCharactersInSet:
+                              [NSCharacterSet whitespaceCharacterSet]]) {
+        if ([stroke length] > 0) {
+            [strokes addObject:stroke];
+        }
+    }
+    if ([strokes count] < 1) {
         return NO;
     }
     
-    BOOL hasModifier = NO;
-    BOOL hasKey = NO;
-    
-    for (NSString *part in parts) {
-        NSString *cleanPart = [[part stringByTrimmingCharactersInSet:
-            [NSCharacterSet whitespaceCharacterSet]] lowercaseString];
-        
-        if ([cleanPart length] == 0) {
+    for (NSUInteger i = 0; i < [strokes count]; i++) {
+        NSArray *parts = parseKeyComboInPrefPane([strokes objectAtIndex:i]);
+        if (!parts || [parts count] < 1) {
             return NO;
         }
         
-        if ([cleanPart isEqualToString:@"ctrl"] || [cleanPart isEqualToString:@"control"] ||
-            [cleanPart isEqualToString:@"shift"] || [cleanPart isEqualToString:@"alt"] ||
-            [cleanPart isEqualToString:@"mod1"] || [cleanPart isEqualToString:@"mod2"] ||
-            [cleanPart isEqualToString:@"mod3"] || [cleanPart isEqualToString:@"mod4"] ||
-            [cleanPart isEqualToString:@"mod5"]) {
-            hasModifier = YES;
-        } else {
-            hasKey = YES;
+        BOOL hasModifier = NO;
+        BOOL hasKey = NO;
+        
+        for (NSString *part in parts) {
+            NSString *cleanPart = [[part stringByTrimmingCharactersInSet:
+                [NSCharacterSet whitespaceCharacterSet]] lowercaseString];
+            
+            if ([cleanPart length] == 0) {
+                return NO;
+            }
+            
+            if ([cleanPart isEqualToString:@"ctrl"] || [cleanPart isEqualToString:@"control"] ||
+                [cleanPart isEqualToString:@"shift"] || [cleanPart isEqualToString:@"alt"] ||
+                [cleanPart isEqualToString:@"mod1"] || [cleanPart isEqualToString:@"mod2"] ||
+                [cleanPart isEqualToString:@"mod3"] || [cleanPart isEqualToString:@"mod4"] ||
+                [cleanPart isEqualToString:@"mod5"]) {
+                hasModifier = YES;
+            } else {
+                hasKey = YES;
+            }
+        }
+        
+        // Like the daemon: the first stroke needs a modifier, the rest may be plain keys
+        if (!hasKey || (i == 0 && !hasModifier)) {
+            return NO;
         }
     }
     
-    return hasModifier && hasKey;
+    return YES;
 }
 
 // Table view data source methods
@@ -454,7 +734,7 @@ NSArray *parseKeyComboInPrefPane(NSString *keyCombo) {
                                          defaultButton:@"OK"
                                        alternateButton:nil
                                            otherButton:nil
-                             informativeTextWithFormat:@"Key combination format is invalid. Use format: modifier+modifier+key (e.g., ctrl+shift+t).\n\nSupported modifiers: ctrl, shift, alt, mod1-mod5\nSupported keys: a-z, 0-9, f1-f24, special keys, multimedia keys"];
+                             informativeTextWithFormat:@"Key combination format is invalid. Use format: modifier+modifier+key (e.g., ctrl+shift+t), or several strokes separated by spaces for a key sequence (e.g., mod4+x t).\n\nSupported modifiers: ctrl, shift, alt, mod1-mod5\nSupported keys: a-z, 0-9, f1-f24, special keys, multimedia keys"];
         [alert runModal];
         return;
     }
@@ -469,6 +749,8 @@ NSArray *parseKeyComboInPrefPane(NSString *keyCombo) {
         return;
     }
     
+    NSString *oldKeyCombo = [[[currentShortcut objectForKey:@"keyCombo"] retain] autorelease];
+    
     [currentShortcut setObject:keyCombo forKey:@"keyCombo"];
     [currentShortcut setObject:command forKey:@"command"];
     
@@ -477,6 +759,11 @@ NSArray *parseKeyComboInPrefPane(NSString *keyCombo) {
     }
     
     [parentController saveShortcutsToDefaults];
+    if (isEditing) {
+        [parentController applyChangeToDaemon:[NSArray arrayWithObjects:@"replace", oldKeyCombo, keyCombo, command, nil]];
+    } else {
+        [parentController applyChangeToDaemon:[NSArray arrayWithObjects:@"add", keyCombo, command, nil]];
+    }
     [parentController->shortcutsTable reloadData];
     
     [NSApp endSheet:editWindow];
@@ -11,7 +11,6 @@
 @interface GlobalShortcutsPane : NSPreferencePane
 {
     GlobalShortcutsController *shortcutsController;
-    NSTimer *refreshTimer;
 }
 
 @end
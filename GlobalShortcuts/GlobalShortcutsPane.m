@@ -20,32 +20,11 @@
 
 - (void)dealloc
 {
-    [self stopRefreshTimer];
+    [shortcutsController stopMonitoring];
     [shortcutsController release];
     [super dealloc];
 }
 
-- (void)startRefreshTimer
-{
-    if (!refreshTimer) {
-        refreshTimer = [NSTimer scheduledTimerWithTimeInterval:2.0 
-                                                        target:shortcutsController 
-                                                      selector:@selector(refreshShortcuts:) 
-                                                      userInfo:nil 
-                                                       repeats:YES];
-        [refreshTimer retain];
-    }
-}
-
-- (void)stopRefreshTimer
-{
-    if (refreshTimer) {
-        [refreshTimer invalidate];
-        [refreshTimer release];
-        refreshTimer = nil;
-    }
-}
-
 - (NSView *)loadMainView
 {
     if (!_mainView) {
@@ -68,16 +47,16 @@
 - (void)didSelect
 {
     [super didSelect];
-    // Refresh data when the pane is selected and start polling
+    // Refresh data when the pane is selected, then follow the daemon's change events
     [shortcutsController refreshShortcuts:nil];
-    [self startRefreshTimer];
+    [shortcutsController startMonitoring];
 }
 
 - (void)didUnselect
 {
     [super didUnselect];
-    // Stop polling when the pane is not visible
-    [self stopRefreshTimer];
+    // Drop the daemon connection when the pane is not visible
+    [shortcutsController stopMonitoring];
 }
 
 - (BOOL)autoSaveTextFields
@@ -10,6 +10,8 @@
     MenuProtocolManager *_protocolManager;
     NSMenuView *_menuView;
     NSString *_currentApplicationName;
+    NSAttributedString *_titleLayout;   // Application name with its drawing attributes
+    NSSize _titleLayoutSize;            // Measured once per title, not per redraw
     unsigned long _currentWindowId;
     NSMenu *_currentMenu;
     NSTimer *_updateTimer;
@@ -5,6 +5,10 @@
 #import "GTKActionHandler.h"
 #import "DBusMenuActionHandler.h"
 #import "MenuCacheManager.h"
+#import "MenuDiskCache.h"
+#import "X11DisplayService.h"
+#import "MenuPreWarmScheduler.h"
+#import "MenuTrace.h"
 #import <X11/Xlib.h>
 #import <X11/Xutil.h>
 #import <X11/Xatom.h>
@@ -36,34 +40,23 @@
         return;
     }
     
-    // Get the active window using X11
-    Display *display = XOpenDisplay(NULL);
-    if (!display) {
+    // Get the active window from the shared X11 connection (cached until
+    // _NET_ACTIVE_WINDOW changes, so usually no round-trip at all)
+    X11DisplayService *x11 = [X11DisplayService sharedService];
+    if (![x11 display]) {
         NSLog(@"AppMenuWidget: Cannot open X11 display");
         return;
     }
-    
-    Window root = DefaultRootWindow(display);
-    Window activeWindow = 0;
-    Atom actualType;
-    int actualFormat;
-    unsigned long nitems, bytesAfter;
-    unsigned char *prop = NULL;
-    
-    // Get _NET_ACTIVE_WINDOW property
-    Atom activeWindowAtom = XInternAtom(display, "_NET_ACTIVE_WINDOW", False);
-    if (XGetWindowProperty(display, root, activeWindowAtom,
-                          0, 1, False, AnyPropertyType,
-                          &actualType, &actualFormat, &nitems, &bytesAfter,
-                          &prop) == Success && prop) {
-        activeWindow = *(Window*)prop;
-        XFree(prop);
-    }
-    
-    XCloseDisplay(display);
+    NSUInteger roundTripsBefore = [x11 roundTrips];
+    MenuTraceTime traceStart = MenuTraceBegin();
+    Window activeWindow = (Window)[x11 activeWindow];
+    MenuTraceEnd("X11DisplayService.activeWindow", "x11", traceStart, activeWindow);
     
     if (activeWindow != _currentWindowId) {
         NSLog(@"AppMenuWidget: Active window changed from %lu to %lu", _currentWindowId, activeWindow);
+        if (activeWindow != 0) {
+            MenuTraceActivationBegan(activeWindow);
+        }
         
         // Notify cache manager about window changes
         MenuCacheManager *cacheManager = [MenuCacheManager sharedManager];
@@ -75,7 +68,9 @@
         }
         
         // Check if this is a different application by comparing application names
+        traceStart = MenuTraceBegin();
         NSString *newAppName = [MenuUtils getApplicationNameForWindow:activeWindow];
+        MenuTraceEnd("MenuUtils.applicationName", "x11", traceStart, activeWindow);
         BOOL isDifferentApp = !_currentApplicationName || 
                              ![_currentApplicationName isEqualToString:newAppName];
         
@@ -85,13 +80,20 @@
         }
         
         _currentWindowId = activeWindow;
+        traceStart = MenuTraceBegin();
         [self displayMenuForWindow:activeWindow isDifferentApp:isDifferentApp];
+        MenuTraceEnd("AppMenuWidget.displayMenuForWindow", "ui", traceStart, activeWindow);
         
-        // For complex applications, try to pre-warm cache for other windows of same app
+        NSLog(@"AppMenuWidget: Activation of window %lu took %lu X round-trips", activeWindow,
+              (unsigned long)([x11 roundTrips] - roundTripsBefore));
+        
+        // For complex applications, pre-warm the other windows of the same app on the
+        // background worker; any other switch cancels what is still queued
         if (newAppName && [cacheManager isComplexApplication:newAppName]) {
-            [self performSelector:@selector(preWarmCacheForApplication:) 
-                       withObject:newAppName 
-                       afterDelay:0.5]; // Delay to avoid blocking current menu load
+            [[MenuPreWarmScheduler sharedScheduler] requestPreWarmForApplication:newAppName
+                                                                 excludingWindow:activeWindow];
+        } else {
+            [[MenuPreWarmScheduler sharedScheduler] cancelPendingWork];
         }
     }
 }
@@ -165,6 +167,26 @@
         }
     }
     
+    // First activation since a restart (of Menu.app or the application): show the
+    // menu persisted for this application right away and revalidate it afterwards
+    NSString *appIdentity = nil;
+    if (![[MenuCacheManager sharedManager] hasCachedMenuForWindow:windowId]) {
+        MenuTraceTime traceStart = MenuTraceBegin();
+        appIdentity = [MenuUtils getApplicationIdentityForWindow:windowId];
+        NSMenu *persistedMenu = [[MenuDiskCache sharedCache] menuForApplicationIdentity:appIdentity
+                                                                           serviceName:[_protocolManager getMenuServiceForWindow:windowId]];
+        MenuTraceEnd("MenuDiskCache.lookup", "cache", traceStart, windowId);
+        if (persistedMenu) {
+            NSLog(@"AppMenuWidget: Showing persisted menu for window %lu (%@), revalidating", windowId, appIdentity);
+            [self loadMenu:persistedMenu forWindow:windowId];
+            [self performSelectorOnMainThread:@selector(revalidatePersistedMenu:)
+                                   withObject:@{@"windowId": [NSNumber numberWithUnsignedLong:windowId],
+                                                @"identity": appIdentity}
+                                waitUntilDone:NO];
+            return;
+        }
+    }
+    
     NSLog(@"AppMenuWidget: ===== LOADING MENU FROM PROTOCOL MANAGER =====");
     NSLog(@"AppMenuWidget: This is where AboutToShow events should be triggered for submenus");
     
@@ -193,11 +215,43 @@
     if (isPlaceholder) {
         NSLog(@"AppMenuWidget: Replacing placeholder menu with File menu containing Close for window %lu", windowId);
         menu = [self createFileMenuWithClose:windowId];
+    } else if (appIdentity) {
+        // Persist before loadMenu: retargets top-level items to this widget
+        [[MenuDiskCache sharedCache] storeMenu:menu forApplicationIdentity:appIdentity];
     }
     
     [self loadMenu:menu forWindow:windowId];
 }
 
+- (void)revalidatePersistedMenu:(NSDictionary *)info
+{
+    unsigned long windowId = [[info objectForKey:@"windowId"] unsignedLongValue];
+    NSString *identity = [info objectForKey:@"identity"];
+    
+    // Fetching the live menu also wires up actions and shortcuts for the items shown
+    NSMenu *liveMenu = [_protocolManager getMenuForWindow:windowId];
+    if (!liveMenu || [self isPlaceholderMenu:liveMenu]) {
+        NSLog(@"AppMenuWidget: Live menu for window %lu unavailable, dropping persisted menu for %@", windowId, identity);
+        [[MenuDiskCache sharedCache] removeMenuForApplicationIdentity:identity];
+        if (_currentWindowId == windowId) {
+            [self displayMenuForWindow:windowId isDifferentApp:NO];
+        }
+        return;
+    }
+    
+    // The hash only decides whether the cache file is rewritten; the live menu
+    // always replaces the snapshot, since Changed and LayoutUpdated edit it in place
+    BOOL changed = [[MenuDiskCache sharedCache] storeMenu:liveMenu forApplicationIdentity:identity];
+    NSLog(@"AppMenuWidget: Swapping live menu in for window %lu (persisted menu %@)",
+          windowId, changed ? @"rewritten" : @"is current");
+    if (_currentWindowId == windowId) {
+        [self startAntiFlickerProtection];
+        [_currentMenu release];
+        _currentMenu = nil;
+        [self loadMenu:liveMenu forWindow:windowId];
+    }
+}
+
 - (void)setupMenuViewWithMenu:(NSMenu *)menu
 {
     NSLog(@"AppMenuWidget: Setting up menu view with menu: %@", [menu title]);
@@ -246,54 +300,46 @@
 
 - (void)drawRect:(NSRect)dirtyRect
 {
+    static NSDictionary *titleAttributes = nil;
+    static NSColor *shadowColor = nil;
+    if (!titleAttributes) {
+        titleAttributes = [[NSDictionary alloc] initWithObjectsAndKeys:
+                           [NSFont boldSystemFontOfSize:11.0], NSFontAttributeName,
+                           [NSColor colorWithCalibratedWhite:0.3 alpha:1.0], NSForegroundColorAttributeName,
+                           nil];
+        shadowColor = [[NSColor colorWithCalibratedWhite:0.0 alpha:0.18] retain];
+    }
+    
     // Draw application name if we have one
     if (_currentApplicationName && [_currentApplicationName length] > 0) {
-        NSDictionary *attributes = [NSDictionary dictionaryWithObjectsAndKeys:
-                                   [NSFont boldSystemFontOfSize:11.0], NSFontAttributeName,
-                                   [NSColor colorWithCalibratedWhite:0.3 alpha:1.0], NSForegroundColorAttributeName,
-                                   nil];
-        
-        NSSize textSize = [_currentApplicationName sizeWithAttributes:attributes];
-        NSPoint textPoint = NSMakePoint(4, ([self bounds].size.height - textSize.height) / 2);
+        // Lay the title out again only when the application changes
+        if (!_titleLayout || ![[_titleLayout string] isEqualToString:_currentApplicationName]) {
+            [_titleLayout release];
+            _titleLayout = [[NSAttributedString alloc] initWithString:_currentApplicationName
+                                                           attributes:titleAttributes];
+            _titleLayoutSize = [_titleLayout size];
+        }
         
-        [_currentApplicationName drawAtPoint:textPoint withAttributes:attributes];
+        NSPoint textPoint = NSMakePoint(4, ([self bounds].size.height - _titleLayoutSize.height) / 2);
+        NSRect textRect = NSMakeRect(textPoint.x, textPoint.y, _titleLayoutSize.width, _titleLayoutSize.height);
+        if (NSIntersectsRect(textRect, dirtyRect)) {
+            [_titleLayout drawAtPoint:textPoint];
+        }
     }
     
     // Draw drop shadow below the menu bar (GNUstep compatible)
-    NSRect shadowRect = NSMakeRect(0, [self bounds].size.height - 2, [self bounds].size.width, 6);
-    NSColor *shadowColor = [NSColor colorWithCalibratedWhite:0.0 alpha:0.18];
-    [shadowColor set];
-    NSRectFillUsingOperation(shadowRect, NSCompositeSourceOver);
+    NSRect shadowRect = NSIntersectionRect(dirtyRect, NSMakeRect(0, [self bounds].size.height - 2, [self bounds].size.width, 6));
+    if (!NSIsEmptyRect(shadowRect)) {
+        [shadowColor set];
+        NSRectFillUsingOperation(shadowRect, NSCompositeSourceOver);
+    }
 
 }
 
 - (void)checkAndDisplayMenuForNewlyRegisteredWindow:(unsigned long)windowId
 {
     // Get the currently active window using X11
-    Display *display = XOpenDisplay(NULL);
-    if (!display) {
-        NSLog(@"AppMenuWidget: Cannot open X11 display for checking active window");
-        return;
-    }
-    
-    Window root = DefaultRootWindow(display);
-    Window activeWindow = 0;
-    Atom actualType;
-    int actualFormat;
-    unsigned long nitems, bytesAfter;
-    unsigned char *prop = NULL;
-    
-    // Get _NET_ACTIVE_WINDOW property
-    Atom activeWindowAtom = XInternAtom(display, "_NET_ACTIVE_WINDOW", False);
-    if (XGetWindowProperty(display, root, activeWindowAtom,
-                          0, 1, False, AnyPropertyType,
-                          &actualType, &actualFormat, &nitems, &bytesAfter,
-                          &prop) == Success && prop) {
-        activeWindow = *(Window*)prop;
-        XFree(prop);
-    }
-    
-    XCloseDisplay(display);
+    Window activeWindow = (Window)[[X11DisplayService sharedService] activeWindow];
     
     // If the newly registered window is the currently active window, display its menu immediately
     if (activeWindow == windowId) {
@@ -574,14 +620,16 @@
 
 - (void)sendAltF4ToWindow:(unsigned long)windowId
 {
-    Display *display = XOpenDisplay(NULL);
+    X11DisplayService *x11 = [X11DisplayService sharedService];
+    Display *display = [x11 display];
     if (!display) {
         NSLog(@"AppMenuWidget: Failed to open X11 display for window close");
         return;
     }
     
     Window window = (Window)windowId;
-    Window root = DefaultRootWindow(display);
+    Window root = [x11 rootWindow];
+    [x11 lock];
     
     // Send Alt+F4 key event to the window
     // We use the root window to ensure the window manager can intercept it
@@ -619,78 +667,7 @@
     NSLog(@"AppMenuWidget: Sent Alt+F4 key event to window %lu", windowId);
     
     XFlush(display);
-    XCloseDisplay(display);
-}
-
-- (void)preWarmCacheForApplication:(NSString *)applicationName
-{
-    NSLog(@"AppMenuWidget: Pre-warming cache for complex application: %@", applicationName);
-    
-    // Find all windows belonging to this application that aren't cached yet
-    Display *display = XOpenDisplay(NULL);
-    if (!display) {
-        NSLog(@"AppMenuWidget: Cannot open X11 display for cache pre-warming");
-        return;
-    }
-    
-    Window root = DefaultRootWindow(display);
-    Atom clientListAtom = XInternAtom(display, "_NET_CLIENT_LIST", False);
-    
-    Atom actualType;
-    int actualFormat;
-    unsigned long numWindows, bytesAfter;
-    Window *windows = NULL;
-    
-    if (XGetWindowProperty(display, root, clientListAtom, 0, 1024, False, XA_WINDOW,
-                          &actualType, &actualFormat, &numWindows, &bytesAfter,
-                          (unsigned char**)&windows) == Success && windows) {
-        
-        NSUInteger warmedCount = 0;
-        MenuCacheManager *cacheManager = [MenuCacheManager sharedManager];
-        
-        for (unsigned long i = 0; i < numWindows && warmedCount < 3; i++) {
-            Window window = windows[i];
-            
-            // Skip current window (already loaded)
-            if (window == _currentWindowId) {
-                continue;
-            }
-            
-            // Check if this window belongs to the same application
-            NSString *windowAppName = [MenuUtils getApplicationNameForWindow:(unsigned long)window];
-            if (!windowAppName || ![windowAppName isEqualToString:applicationName]) {
-                continue;
-            }
-            
-            // Check if we already have this window cached
-            if ([cacheManager getCachedMenuForWindow:(unsigned long)window]) {
-                continue;
-            }
-            
-            // Check if protocol manager has a menu for this window
-            if ([_protocolManager hasMenuForWindow:(unsigned long)window]) {
-                NSLog(@"AppMenuWidget: Pre-warming cache for window %lu (%@)", 
-                      (unsigned long)window, applicationName);
-                
-                // Load menu in background (this will cache it)
-                NSMenu *menu = [_protocolManager getMenuForWindow:(unsigned long)window];
-                if (menu) {
-                    warmedCount++;
-                    NSLog(@"AppMenuWidget: Successfully pre-warmed cache for window %lu", 
-                          (unsigned long)window);
-                } else {
-                    NSLog(@"AppMenuWidget: Failed to pre-warm cache for window %lu", 
-                          (unsigned long)window);
-                }
-            }
-        }
-        
-        XFree(windows);
-        NSLog(@"AppMenuWidget: Pre-warmed cache for %lu windows of application %@", 
-              (unsigned long)warmedCount, applicationName);
-    }
-    
-    XCloseDisplay(display);
+    [x11 unlock];
 }
 
 - (void)loadMenu:(NSMenu *)menu forWindow:(unsigned long)windowId
@@ -716,10 +693,15 @@
               [item hasSubmenu] ? (unsigned long)[[[item submenu] itemArray] count] : 0);
     }
     
+    MenuTraceTime traceStart = MenuTraceBegin();
     [self setupMenuViewWithMenu:menu];
+    MenuTraceEnd("AppMenuWidget.setupMenuView", "ui", traceStart, windowId);
+    MenuTraceMenuInstalled(windowId);
     
     // Re-register shortcuts for this menu since we cleared them in clearMenu
+    traceStart = MenuTraceBegin();
     [self reregisterShortcutsForMenu:menu];
+    MenuTraceEnd("AppMenuWidget.reregisterShortcuts", "shortcuts", traceStart, windowId);
     
     NSLog(@"AppMenuWidget: Successfully loaded fallback menu with %lu items", (unsigned long)[[menu itemArray] count]);
     
@@ -746,30 +728,7 @@
 - (void)closeActiveWindow:(NSMenuItem *)sender
 {
     // Get the currently active window using X11
-    Display *display = XOpenDisplay(NULL);
-    if (!display) {
-        NSLog(@"AppMenuWidget: Cannot open X11 display for active window detection");
-        return;
-    }
-    
-    Window root = DefaultRootWindow(display);
-    Window activeWindow = 0;
-    Atom actualType;
-    int actualFormat;
-    unsigned long nitems, bytesAfter;
-    unsigned char *prop = NULL;
-    
-    // Get _NET_ACTIVE_WINDOW property
-    Atom activeWindowAtom = XInternAtom(display, "_NET_ACTIVE_WINDOW", False);
-    if (XGetWindowProperty(display, root, activeWindowAtom,
-                          0, 1, False, AnyPropertyType,
-                          &actualType, &actualFormat, &nitems, &bytesAfter,
-                          &prop) == Success && prop) {
-        activeWindow = *(Window*)prop;
-        XFree(prop);
-    }
-    
-    XCloseDisplay(display);
+    Window activeWindow = (Window)[[X11DisplayService sharedService] activeWindow];
     
     if (activeWindow == 0) {
         NSLog(@"AppMenuWidget: Could not determine active window for Alt+W close");
@@ -905,6 +864,7 @@
     }
     
     [_currentApplicationName release];
+    [_titleLayout release];
     [_currentMenu release];
     [_menuView release];
     [super dealloc];
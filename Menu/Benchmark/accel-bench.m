@@ -0,0 +1,136 @@
+/*
+ * accel-bench - times menu accelerator parsing with and without
+ * MenuAcceleratorCache
+ *
+ *   accel-bench [-n ROUNDS] [CORPUS]
+ *
+ * The corpus (default accelerators.txt) holds one accelerator per line,
+ * prefixed with its syntax: "gtk <Primary>s" or "combo ctrl+shift+z".
+ * Every round parses the whole corpus once, which is what loading that many
+ * menu items costs; the cached pass also checks that both parses agree.
+ */
+
+#import <Foundation/Foundation.h>
+#import "../MenuAcceleratorCache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static double nowSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: accel-bench [-n ROUNDS] [CORPUS]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    int rounds = 1000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n') {
+            rounds = atoi(optarg);
+        } else {
+            usage();
+        }
+    }
+    if (argc - optind > 1 || rounds <= 0) {
+        usage();
+    }
+    NSString *path = (optind < argc) ? [NSString stringWithUTF8String:argv[optind]] : @"accelerators.txt";
+
+    NSString *corpus = [NSString stringWithContentsOfFile:path encoding:NSUTF8StringEncoding error:NULL];
+    if (!corpus) {
+        fprintf(stderr, "accel-bench: cannot read %s\n", [path UTF8String]);
+        return 1;
+    }
+
+    NSMutableArray *accelerators = [NSMutableArray array];
+    NSMutableArray *syntaxes = [NSMutableArray array];
+    for (NSString *line in [corpus componentsSeparatedByString:@"\n"]) {
+        if ([line length] == 0 || [line hasPrefix:@"#"]) {
+            continue;
+        }
+        NSRange space = [line rangeOfString:@" "];
+        if (space.location == NSNotFound) {
+            continue;
+        }
+        NSString *syntax = [line substringToIndex:space.location];
+        if ([syntax isEqualToString:@"gtk"]) {
+            [syntaxes addObject:@(MenuAcceleratorSyntaxGTK)];
+        } else if ([syntax isEqualToString:@"combo"]) {
+            [syntaxes addObject:@(MenuAcceleratorSyntaxKeyCombo)];
+        } else {
+            continue;
+        }
+        [accelerators addObject:[line substringFromIndex:space.location + 1]];
+    }
+
+    NSUInteger count = [accelerators count];
+    if (count == 0) {
+        fprintf(stderr, "accel-bench: no accelerators in %s\n", [path UTF8String]);
+        return 1;
+    }
+    MenuAcceleratorSyntax *syntaxTable = malloc(sizeof(MenuAcceleratorSyntax) * count);
+    for (NSUInteger i = 0; i < count; i++) {
+        syntaxTable[i] = [[syntaxes objectAtIndex:i] intValue];
+    }
+
+    MenuAccelerator parsed;
+    MenuAccelerator cached;
+    unsigned long mismatches = 0;
+
+    double start = nowSeconds();
+    for (int r = 0; r < rounds; r++) {
+        NSAutoreleasePool *roundPool = [[NSAutoreleasePool alloc] init];
+        for (NSUInteger i = 0; i < count; i++) {
+            MenuAcceleratorParseUncached([accelerators objectAtIndex:i], syntaxTable[i], &parsed);
+        }
+        [roundPool release];
+    }
+    double uncachedSeconds = nowSeconds() - start;
+
+    start = nowSeconds();
+    for (int r = 0; r < rounds; r++) {
+        NSAutoreleasePool *roundPool = [[NSAutoreleasePool alloc] init];
+        for (NSUInteger i = 0; i < count; i++) {
+            MenuAcceleratorParse([accelerators objectAtIndex:i], syntaxTable[i], &cached);
+        }
+        [roundPool release];
+    }
+    double cachedSeconds = nowSeconds() - start;
+
+    for (NSUInteger i = 0; i < count; i++) {
+        MenuAcceleratorParseUncached([accelerators objectAtIndex:i], syntaxTable[i], &parsed);
+        MenuAcceleratorParse([accelerators objectAtIndex:i], syntaxTable[i], &cached);
+        if (![parsed.keyEquivalent isEqualToString:cached.keyEquivalent] ||
+            parsed.modifierMask != cached.modifierMask || parsed.keysym != cached.keysym) {
+            fprintf(stderr, "accel-bench: cached parse differs for '%s'\n",
+                    [[accelerators objectAtIndex:i] UTF8String]);
+            mismatches++;
+        }
+    }
+
+    NSUInteger hits, misses, entries;
+    MenuAcceleratorCacheStatistics(&hits, &misses, &entries);
+    double lookups = (double)count * rounds;
+
+    printf("%lu accelerators x %d rounds\n", (unsigned long)count, rounds);
+    printf("uncached  %8.1f ns/accelerator\n", uncachedSeconds * 1e9 / lookups);
+    printf("cached    %8.1f ns/accelerator\n", cachedSeconds * 1e9 / lookups);
+    printf("cache     %lu hits, %lu misses, %lu entries\n",
+           (unsigned long)hits, (unsigned long)misses, (unsigned long)entries);
+
+    free(syntaxTable);
+    [pool release];
+    return mismatches ? 1 : 0;
+}
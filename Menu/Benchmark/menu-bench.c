@@ -0,0 +1,1411 @@
+/*
+ * menu-bench - replays recorded application menus to Menu.app
+ *
+ * Records the menu an application exports (com.canonical.dbusmenu GetLayout,
+ * or org.gtk.Menus plus org.gtk.Actions) into a file, then serves any number
+ * of recordings from fake X11 windows on a headless display and switches
+ * _NET_ACTIVE_WINDOW between them, so menu-load latency can be measured
+ * without the original applications. Time-to-menu itself is measured inside
+ * Menu.app (--trace); see run-benchmark.sh.
+ *
+ *   menu-bench record-dbusmenu SERVICE PATH FILE
+ *   menu-bench record-gtk SERVICE MENUPATH ACTIONPATH FILE
+ *   menu-bench synth-dbusmenu [-i ICONS] MENUS ITEMS FILE
+ *   menu-bench synth-gtk MENUS ITEMS FILE
+ *   menu-bench serve [-n SWITCHES] [-i INTERVAL_MS] [-w WINDOWS] [-s SETTLE_MS] [-S] [-D CHANGES] FILE...
+ *
+ * serve gives every window its own export path unless -S is given; then
+ * windows replaying the same recording share one menu object, as most GTK
+ * and Qt applications do for all their windows.
+ *
+ * With -D, after the switches serve activates the first GTK window and sends
+ * CHANGES org.gtk.Menus.Changed signals, INTERVAL_MS apart, each splicing its
+ * largest submenu: in turn an item is relabelled, a copy of one inserted and
+ * one removed, so the submenu keeps its size. Menu.app applies them to the
+ * live model (the GTKMenuModel.applyChanges span) instead of re-fetching it.
+ *
+ * A recording file holds marshalled D-Bus messages whose arguments are the
+ * recorded replies, so every property keeps its exact wire type:
+ *   uint32 magic, uint32 version, uint32 protocol, uint32 blob count,
+ *   blobs (uint32 length + dbus_message_marshal() bytes)
+ * dbusmenu: one blob, the GetLayout reply (u, (ia{sv}av)).
+ * gtk: two blobs, every menu group as a(uaa{sv}) and the DescribeAll reply a{s(bgav)}.
+ *
+ * synth-gtk makes every fourth action a stateful toggle, the kind Menu.app
+ * once asked about with a DescribeAction call per item. serve reports the
+ * org.gtk.Actions calls it answered per GTK menu load.
+ *
+ * serve maps its windows one at a time and adds each to _NET_CLIENT_LIST as a
+ * window manager would. Before mapping, before the switches and when done it
+ * interns a _MENU_BENCH_MARK_MAP, _SWITCH or _DONE atom, so an X protocol
+ * trace of the session (run-benchmark.sh -X) can be split into phases.
+ *
+ * synth-dbusmenu -i gives the first ICONS items an icon-data PNG, 32x32 so
+ * Menu.app scales it down, drawn in one of ICON_VARIANTS colours: like a
+ * real application, many items share an icon.
+ */
+
+#include <dbus/dbus.h>
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RECORDING_MAGIC 0x4352424d      /* "MBRC" */
+#define RECORDING_VERSION 1
+#define MAX_GROUPS 256
+#define MAX_WINDOWS 256
+#define CALL_TIMEOUT_MS 5000
+#define ICON_SIZE 32
+#define ICON_VARIANTS 100
+
+#define BENCH_PATH "/org/gershwin/MenuBench"
+#define BENCH_INTERFACE "org.gershwin.MenuBench"
+
+enum {
+    ProtocolDBusMenu = 1,
+    ProtocolGTK = 2
+};
+
+enum {
+    ExportDBusMenu,
+    ExportGTKMenus,
+    ExportGTKActions
+};
+
+typedef struct {
+    char name[64];              /* WM_CLASS, from the file name */
+    uint32_t protocol;
+    DBusMessage *layout;        /* dbusmenu: u, (ia{sv}av) */
+    DBusMessage *menus;         /* gtk: a(uaa{sv}) */
+    DBusMessage *actions;       /* gtk: a{s(bgav)} */
+} Recording;
+
+typedef struct {
+    char path[128];
+    int kind;
+    Recording *recording;
+} Export;
+
+static Export exports[MAX_WINDOWS * 2];
+static int exportCount = 0;
+static unsigned long callsServed = 0;
+static unsigned long callsRejected = 0;
+static unsigned long gtkMenuLoads = 0;          /* Start calls asking for group 0 */
+static unsigned long describeAllCalls = 0;
+static unsigned long describeActionCalls = 0;
+
+static void die(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "menu-bench: ");
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    exit(1);
+}
+
+static uint64_t nowMillis(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+/* Message copying */
+
+static void copyValues(DBusMessageIter *from, DBusMessageIter *to);
+
+/* Copies the single value at from, keeping its exact type */
+static void copyValue(DBusMessageIter *from, DBusMessageIter *to)
+{
+    int type = dbus_message_iter_get_arg_type(from);
+
+    if (dbus_type_is_basic(type)) {
+        DBusBasicValue value;
+        dbus_message_iter_get_basic(from, &value);
+        dbus_message_iter_append_basic(to, type, &value);
+        return;
+    }
+
+    DBusMessageIter subFrom, subTo;
+    char *signature = NULL;
+    const char *contained = NULL;
+
+    if (type == DBUS_TYPE_ARRAY) {
+        signature = dbus_message_iter_get_signature(from);
+        contained = signature + 1;
+    } else if (type == DBUS_TYPE_VARIANT) {
+        dbus_message_iter_recurse(from, &subFrom);
+        signature = dbus_message_iter_get_signature(&subFrom);
+        contained = signature;
+    }
+
+    dbus_message_iter_recurse(from, &subFrom);
+    dbus_message_iter_open_container(to, type, contained, &subTo);
+    copyValues(&subFrom, &subTo);
+    dbus_message_iter_close_container(to, &subTo);
+    dbus_free(signature);
+}
+
+static void copyValues(DBusMessageIter *from, DBusMessageIter *to)
+{
+    while (dbus_message_iter_get_arg_type(from) != DBUS_TYPE_INVALID) {
+        copyValue(from, to);
+        dbus_message_iter_next(from);
+    }
+}
+
+static DBusMessage *newContainer(void)
+{
+    DBusMessage *message = dbus_message_new_signal(BENCH_PATH, BENCH_INTERFACE, "Recording");
+    if (!message) {
+        die("out of memory");
+    }
+    return message;
+}
+
+/* Recording files */
+
+static void writeRecording(const char *path, uint32_t protocol, DBusMessage **blobs, uint32_t count)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        die("cannot create %s: %s", path, strerror(errno));
+    }
+
+    uint32_t header[4] = { RECORDING_MAGIC, RECORDING_VERSION, protocol, count };
+    fwrite(header, sizeof(header), 1, file);
+
+    for (uint32_t i = 0; i < count; i++) {
+        char *bytes = NULL;
+        int length = 0;
+        if (!dbus_message_marshal(blobs[i], &bytes, &length)) {
+            die("cannot marshal recording");
+        }
+        uint32_t blobLength = (uint32_t)length;
+        fwrite(&blobLength, sizeof(blobLength), 1, file);
+        fwrite(bytes, 1, blobLength, file);
+        dbus_free(bytes);
+    }
+
+    if (fclose(file) != 0) {
+        die("cannot write %s: %s", path, strerror(errno));
+    }
+}
+
+static DBusMessage *readBlob(FILE *file, const char *path)
+{
+    uint32_t length;
+    if (fread(&length, sizeof(length), 1, file) != 1 || length == 0 || length > 64 * 1024 * 1024) {
+        die("%s: truncated recording", path);
+    }
+
+    char *bytes = malloc(length);
+    if (!bytes || fread(bytes, 1, length, file) != length) {
+        die("%s: truncated recording", path);
+    }
+
+    DBusError error;
+    dbus_error_init(&error);
+    DBusMessage *message = dbus_message_demarshal(bytes, (int)length, &error);
+    free(bytes);
+    if (!message) {
+        die("%s: %s", path, error.message);
+    }
+    return message;
+}
+
+static Recording *loadRecording(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        die("cannot open %s: %s", path, strerror(errno));
+    }
+
+    uint32_t header[4];
+    if (fread(header, sizeof(header), 1, file) != 1 ||
+        header[0] != RECORDING_MAGIC || header[1] != RECORDING_VERSION) {
+        die("%s: not a menu-bench recording", path);
+    }
+
+    Recording *recording = calloc(1, sizeof(Recording));
+    recording->protocol = header[2];
+
+    if (recording->protocol == ProtocolDBusMenu && header[3] == 1) {
+        recording->layout = readBlob(file, path);
+    } else if (recording->protocol == ProtocolGTK && header[3] == 2) {
+        recording->menus = readBlob(file, path);
+        recording->actions = readBlob(file, path);
+    } else {
+        die("%s: unsupported recording (protocol %u, %u blobs)", path, header[2], header[3]);
+    }
+    fclose(file);
+
+    /* The file name without directory and extension becomes the WM_CLASS */
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    snprintf(recording->name, sizeof(recording->name), "%s", base);
+    char *dot = strrchr(recording->name, '.');
+    if (dot && dot != recording->name) {
+        *dot = '\0';
+    }
+    return recording;
+}
+
+/* Recording from live applications */
+
+static DBusConnection *connectSessionBus(void)
+{
+    DBusError error;
+    dbus_error_init(&error);
+    DBusConnection *connection = dbus_bus_get(DBUS_BUS_SESSION, &error);
+    if (!connection) {
+        die("cannot connect to the session bus: %s", error.message);
+    }
+    return connection;
+}
+
+static DBusMessage *callBlocking(DBusConnection *connection, DBusMessage *call, int required)
+{
+    DBusError error;
+    dbus_error_init(&error);
+    DBusMessage *reply = dbus_connection_send_with_reply_and_block(connection, call, CALL_TIMEOUT_MS, &error);
+    dbus_message_unref(call);
+    if (!reply && required) {
+        die("%s: %s", error.name, error.message);
+    }
+    dbus_error_free(&error);
+    return reply;
+}
+
+static int recordDBusMenu(const char *service, const char *path, const char *file)
+{
+    DBusConnection *connection = connectSessionBus();
+
+    DBusMessage *call = dbus_message_new_method_call(service, path, "com.canonical.dbusmenu", "GetLayout");
+    dbus_int32_t parentId = 0, depth = -1;
+    DBusMessageIter args, names;
+    dbus_message_iter_init_append(call, &args);
+    dbus_message_iter_append_basic(&args, DBUS_TYPE_INT32, &parentId);
+    dbus_message_iter_append_basic(&args, DBUS_TYPE_INT32, &depth);
+    dbus_message_iter_open_container(&args, DBUS_TYPE_ARRAY, "s", &names);
+    dbus_message_iter_close_container(&args, &names);
+
+    DBusMessage *reply = callBlocking(connection, call, 1);
+    if (strcmp(dbus_message_get_signature(reply), "u(ia{sv}av)") != 0) {
+        die("unexpected GetLayout reply signature %s", dbus_message_get_signature(reply));
+    }
+
+    writeRecording(file, ProtocolDBusMenu, &reply, 1);
+    printf("Recorded dbusmenu layout of %s%s to %s\n", service, path, file);
+    dbus_message_unref(reply);
+    return 0;
+}
+
+static int containsGroup(const uint32_t *groups, int count, uint32_t group)
+{
+    for (int i = 0; i < count; i++) {
+        if (groups[i] == group) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Adds the groups referenced by :section and :submenu links in a Start reply */
+static void collectLinkedGroups(DBusMessage *reply, uint32_t *groups, int *count)
+{
+    DBusMessageIter args, menus;
+    if (!dbus_message_iter_init(reply, &args) || dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_ARRAY) {
+        return;
+    }
+
+    dbus_message_iter_recurse(&args, &menus);
+    for (; dbus_message_iter_get_arg_type(&menus) == DBUS_TYPE_STRUCT; dbus_message_iter_next(&menus)) {
+        DBusMessageIter fields, items;
+        dbus_message_iter_recurse(&menus, &fields);
+        dbus_message_iter_next(&fields);    /* group */
+        dbus_message_iter_next(&fields);    /* menu */
+        dbus_message_iter_recurse(&fields, &items);
+
+        for (; dbus_message_iter_get_arg_type(&items) == DBUS_TYPE_ARRAY; dbus_message_iter_next(&items)) {
+            DBusMessageIter entries;
+            dbus_message_iter_recurse(&items, &entries);
+            for (; dbus_message_iter_get_arg_type(&entries) == DBUS_TYPE_DICT_ENTRY; dbus_message_iter_next(&entries)) {
+                DBusMessageIter entry, variant, link;
+                const char *key;
+                dbus_message_iter_recurse(&entries, &entry);
+                dbus_message_iter_get_basic(&entry, &key);
+                if (strcmp(key, ":section") != 0 && strcmp(key, ":submenu") != 0) {
+                    continue;
+                }
+                dbus_message_iter_next(&entry);
+                dbus_message_iter_recurse(&entry, &variant);
+                if (dbus_message_iter_get_arg_type(&variant) != DBUS_TYPE_STRUCT) {
+                    continue;
+                }
+                dbus_message_iter_recurse(&variant, &link);
+                dbus_uint32_t group;
+                dbus_message_iter_get_basic(&link, &group);
+                if (!containsGroup(groups, *count, group) && *count < MAX_GROUPS) {
+                    groups[(*count)++] = group;
+                }
+            }
+        }
+    }
+}
+
+static DBusMessage *gtkMenusCall(const char *service, const char *path, const char *method,
+                                 const uint32_t *groups, int count)
+{
+    DBusMessage *call = dbus_message_new_method_call(service, path, "org.gtk.Menus", method);
+    DBusMessageIter args, array;
+    dbus_message_iter_init_append(call, &args);
+    dbus_message_iter_open_container(&args, DBUS_TYPE_ARRAY, "u", &array);
+    for (int i = 0; i < count; i++) {
+        dbus_message_iter_append_basic(&array, DBUS_TYPE_UINT32, &groups[i]);
+    }
+    dbus_message_iter_close_container(&args, &array);
+    return call;
+}
+
+static int recordGTK(const char *service, const char *menuPath, const char *actionPath, const char *file)
+{
+    DBusConnection *connection = connectSessionBus();
+
+    /* Subscribe to group 0, then to every group it links to, until closed */
+    uint32_t groups[MAX_GROUPS];
+    int groupCount = 1, startedCount = 0;
+    groups[0] = 0;
+
+    DBusMessage *menus = newContainer();
+    DBusMessageIter out, outArray;
+    dbus_message_iter_init_append(menus, &out);
+    dbus_message_iter_open_container(&out, DBUS_TYPE_ARRAY, "(uaa{sv})", &outArray);
+
+    while (startedCount < groupCount) {
+        int first = startedCount;
+        startedCount = groupCount;
+        DBusMessage *reply = callBlocking(connection,
+                                          gtkMenusCall(service, menuPath, "Start", &groups[first], groupCount - first), 1);
+        if (strcmp(dbus_message_get_signature(reply), "a(uaa{sv})") != 0) {
+            die("unexpected Start reply signature %s", dbus_message_get_signature(reply));
+        }
+
+        DBusMessageIter args, entries;
+        dbus_message_iter_init(reply, &args);
+        dbus_message_iter_recurse(&args, &entries);
+        copyValues(&entries, &outArray);
+
+        collectLinkedGroups(reply, groups, &groupCount);
+        dbus_message_unref(reply);
+    }
+    dbus_message_iter_close_container(&out, &outArray);
+
+    DBusMessage *ended = callBlocking(connection, gtkMenusCall(service, menuPath, "End", groups, groupCount), 0);
+    if (ended) {
+        dbus_message_unref(ended);
+    }
+
+    /* Applications without an action group still get an (empty) actions blob */
+    DBusMessage *actions = newContainer();
+    DBusMessage *call = dbus_message_new_method_call(service, actionPath, "org.gtk.Actions", "DescribeAll");
+    DBusMessage *reply = callBlocking(connection, call, 0);
+    DBusMessageIter actionArgs;
+    dbus_message_iter_init_append(actions, &actionArgs);
+    if (reply && strcmp(dbus_message_get_signature(reply), "a{s(bgav)}") == 0) {
+        DBusMessageIter in;
+        dbus_message_iter_init(reply, &in);
+        copyValues(&in, &actionArgs);
+    } else {
+        DBusMessageIter empty;
+        fprintf(stderr, "menu-bench: no action group at %s, recording none\n", actionPath);
+        dbus_message_iter_open_container(&actionArgs, DBUS_TYPE_ARRAY, "{s(bgav)}", &empty);
+        dbus_message_iter_close_container(&actionArgs, &empty);
+    }
+    if (reply) {
+        dbus_message_unref(reply);
+    }
+
+    DBusMessage *blobs[2] = { menus, actions };
+    writeRecording(file, ProtocolGTK, blobs, 2);
+    printf("Recorded %d GTK menu groups of %s%s to %s\n", groupCount, service, menuPath, file);
+    dbus_message_unref(menus);
+    dbus_message_unref(actions);
+    return 0;
+}
+
+/* Synthetic recordings */
+
+static void appendStringEntry(DBusMessageIter *dict, const char *key, const char *value)
+{
+    DBusMessageIter entry, variant;
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "s", &variant);
+    dbus_message_iter_append_basic(&variant, DBUS_TYPE_STRING, &value);
+    dbus_message_iter_close_container(&entry, &variant);
+    dbus_message_iter_close_container(dict, &entry);
+}
+
+static void appendBoolEntry(DBusMessageIter *dict, const char *key, dbus_bool_t value)
+{
+    DBusMessageIter entry, variant;
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "b", &variant);
+    dbus_message_iter_append_basic(&variant, DBUS_TYPE_BOOLEAN, &value);
+    dbus_message_iter_close_container(&entry, &variant);
+    dbus_message_iter_close_container(dict, &entry);
+}
+
+/* PNG encoding for synthetic icons: stored (uncompressed) deflate, so no zlib is needed */
+
+static uint32_t crc32Update(uint32_t crc, const unsigned char *bytes, size_t length)
+{
+    static uint32_t table[256];
+    if (table[1] == 0) {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static unsigned char *putBigEndian32(unsigned char *out, uint32_t value)
+{
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
+    return out + 4;
+}
+
+static unsigned char *putPNGChunk(unsigned char *out, const char *type, const unsigned char *data, uint32_t length)
+{
+    out = putBigEndian32(out, length);
+    memcpy(out, type, 4);
+    memcpy(out + 4, data, length);
+    uint32_t crc = crc32Update(0, out, length + 4);
+    return putBigEndian32(out + length + 4, crc);
+}
+
+/* An ICON_SIZE RGBA disc in the variant's colour; returns the PNG's length */
+static size_t makeIconPNG(int variant, unsigned char *png)
+{
+    enum { RowBytes = 1 + ICON_SIZE * 4, RawBytes = ICON_SIZE * RowBytes };
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    unsigned char header[13], raw[RawBytes], idat[2 + 5 + RawBytes + 4];
+
+    putBigEndian32(header, ICON_SIZE);
+    putBigEndian32(header + 4, ICON_SIZE);
+    header[8] = 8;      /* bits per sample */
+    header[9] = 6;      /* RGBA */
+    header[10] = header[11] = header[12] = 0;
+
+    for (int y = 0; y < ICON_SIZE; y++) {
+        unsigned char *row = raw + y * RowBytes;
+        row[0] = 0;     /* no filter */
+        for (int x = 0; x < ICON_SIZE; x++) {
+            int dx = 2 * x + 1 - ICON_SIZE, dy = 2 * y + 1 - ICON_SIZE;
+            unsigned char *pixel = row + 1 + x * 4;
+            pixel[0] = (unsigned char)(variant * 37 + x * 4);
+            pixel[1] = (unsigned char)(variant * 91 + y * 4);
+            pixel[2] = (unsigned char)(variant * 53);
+            pixel[3] = (dx * dx + dy * dy <= ICON_SIZE * ICON_SIZE) ? 0xff : 0;
+        }
+    }
+
+    /* zlib stream holding one stored block, then the Adler-32 of the raw bytes */
+    uint32_t a = 1, b = 0;
+    for (size_t i = 0; i < sizeof(raw); i++) {
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    uint16_t stored = RawBytes, complement = (uint16_t)~stored;
+    unsigned char *p = idat;
+    *p++ = 0x78;
+    *p++ = 0x01;
+    *p++ = 1;           /* final block, stored */
+    *p++ = (unsigned char)(stored & 0xff);
+    *p++ = (unsigned char)(stored >> 8);
+    *p++ = (unsigned char)(complement & 0xff);
+    *p++ = (unsigned char)(complement >> 8);
+    memcpy(p, raw, sizeof(raw));
+    putBigEndian32(p + sizeof(raw), (b << 16) | a);
+
+    unsigned char *out = png;
+    memcpy(out, signature, sizeof(signature));
+    out += sizeof(signature);
+    out = putPNGChunk(out, "IHDR", header, sizeof(header));
+    out = putPNGChunk(out, "IDAT", idat, sizeof(idat));
+    out = putPNGChunk(out, "IEND", header, 0);
+    return (size_t)(out - png);
+}
+
+static void appendIconEntry(DBusMessageIter *dict, int variant)
+{
+    static unsigned char png[ICON_VARIANTS][8 + 3 * 12 + 13 + 2 + 5 + ICON_SIZE * (1 + ICON_SIZE * 4) + 4];
+    static size_t pngLength[ICON_VARIANTS];
+    const char *name = "icon-data";
+    const unsigned char *bytes = png[variant];
+    DBusMessageIter entry, variantIter, array;
+
+    if (pngLength[variant] == 0) {
+        pngLength[variant] = makeIconPNG(variant, png[variant]);
+    }
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &name);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "ay", &variantIter);
+    dbus_message_iter_open_container(&variantIter, DBUS_TYPE_ARRAY, "y", &array);
+    dbus_message_iter_append_fixed_array(&array, DBUS_TYPE_BYTE, &bytes, (int)pngLength[variant]);
+    dbus_message_iter_close_container(&variantIter, &array);
+    dbus_message_iter_close_container(&entry, &variantIter);
+    dbus_message_iter_close_container(dict, &entry);
+}
+
+static void appendShortcutEntry(DBusMessageIter *dict, const char *modifier, const char *key)
+{
+    const char *name = "shortcut";
+    DBusMessageIter entry, variant, outer, inner;
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &name);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "aas", &variant);
+    dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "as", &outer);
+    dbus_message_iter_open_container(&outer, DBUS_TYPE_ARRAY, "s", &inner);
+    dbus_message_iter_append_basic(&inner, DBUS_TYPE_STRING, &modifier);
+    dbus_message_iter_append_basic(&inner, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_close_container(&outer, &inner);
+    dbus_message_iter_close_container(&variant, &outer);
+    dbus_message_iter_close_container(&entry, &variant);
+    dbus_message_iter_close_container(dict, &entry);
+}
+
+/* One (ia{sv}av) item; children is filled by the caller between open and close */
+static void openLayoutItem(DBusMessageIter *parent, dbus_int32_t itemId, DBusMessageIter *item,
+                           DBusMessageIter *props)
+{
+    dbus_message_iter_open_container(parent, DBUS_TYPE_STRUCT, NULL, item);
+    dbus_message_iter_append_basic(item, DBUS_TYPE_INT32, &itemId);
+    dbus_message_iter_open_container(item, DBUS_TYPE_ARRAY, "{sv}", props);
+}
+
+static int synthDBusMenu(int menuCount, int itemCount, int iconCount, const char *file)
+{
+    static const char *keys[] = { "n", "o", "s", "w", "q", "z", "x", "c", "v", "f" };
+    DBusMessage *layout = newContainer();
+    DBusMessageIter args, root, rootProps, rootChildren;
+    dbus_uint32_t revision = 1;
+    dbus_int32_t nextId = 1;
+    int icons = 0;
+    char label[64];
+
+    dbus_message_iter_init_append(layout, &args);
+    dbus_message_iter_append_basic(&args, DBUS_TYPE_UINT32, &revision);
+    openLayoutItem(&args, 0, &root, &rootProps);
+    appendStringEntry(&rootProps, "children-display", "submenu");
+    dbus_message_iter_close_container(&root, &rootProps);
+    dbus_message_iter_open_container(&root, DBUS_TYPE_ARRAY, "v", &rootChildren);
+
+    for (int m = 0; m < menuCount; m++) {
+        DBusMessageIter variant, menu, menuProps, menuChildren;
+        dbus_message_iter_open_container(&rootChildren, DBUS_TYPE_VARIANT, "(ia{sv}av)", &variant);
+        openLayoutItem(&variant, nextId++, &menu, &menuProps);
+        snprintf(label, sizeof(label), "_Menu %d", m + 1);
+        appendStringEntry(&menuProps, "label", label);
+        appendStringEntry(&menuProps, "children-display", "submenu");
+        dbus_message_iter_close_container(&menu, &menuProps);
+        dbus_message_iter_open_container(&menu, DBUS_TYPE_ARRAY, "v", &menuChildren);
+
+        for (int i = 0; i < itemCount; i++) {
+            DBusMessageIter itemVariant, item, itemProps, itemChildren;
+            dbus_message_iter_open_container(&menuChildren, DBUS_TYPE_VARIANT, "(ia{sv}av)", &itemVariant);
+            openLayoutItem(&itemVariant, nextId++, &item, &itemProps);
+            if (i % 6 == 5) {
+                appendStringEntry(&itemProps, "type", "separator");
+            } else {
+                snprintf(label, sizeof(label), "Item %d.%d", m + 1, i + 1);
+                appendStringEntry(&itemProps, "label", label);
+                appendBoolEntry(&itemProps, "enabled", i % 7 != 3);
+                if (m == 0 && i < (int)(sizeof(keys) / sizeof(keys[0]))) {
+                    appendShortcutEntry(&itemProps, "Control", keys[i]);
+                }
+                if (icons < iconCount) {
+                    appendIconEntry(&itemProps, icons++ % ICON_VARIANTS);
+                }
+            }
+            dbus_message_iter_close_container(&item, &itemProps);
+            dbus_message_iter_open_container(&item, DBUS_TYPE_ARRAY, "v", &itemChildren);
+            dbus_message_iter_close_container(&item, &itemChildren);
+            dbus_message_iter_close_container(&itemVariant, &item);
+            dbus_message_iter_close_container(&menuChildren, &itemVariant);
+        }
+
+        dbus_message_iter_close_container(&menu, &menuChildren);
+        dbus_message_iter_close_container(&variant, &menu);
+        dbus_message_iter_close_container(&rootChildren, &variant);
+    }
+
+    dbus_message_iter_close_container(&root, &rootChildren);
+    dbus_message_iter_close_container(&args, &root);
+
+    writeRecording(file, ProtocolDBusMenu, &layout, 1);
+    printf("Wrote synthetic dbusmenu layout (%d menus of %d items, %d with icons) to %s\n",
+           menuCount, itemCount, icons, file);
+    dbus_message_unref(layout);
+    return 0;
+}
+
+static void appendGTKLink(DBusMessageIter *dict, const char *key, dbus_uint32_t group, dbus_uint32_t menu)
+{
+    DBusMessageIter entry, variant, link;
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "(uu)", &variant);
+    dbus_message_iter_open_container(&variant, DBUS_TYPE_STRUCT, NULL, &link);
+    dbus_message_iter_append_basic(&link, DBUS_TYPE_UINT32, &group);
+    dbus_message_iter_append_basic(&link, DBUS_TYPE_UINT32, &menu);
+    dbus_message_iter_close_container(&variant, &link);
+    dbus_message_iter_close_container(&entry, &variant);
+    dbus_message_iter_close_container(dict, &entry);
+}
+
+static int synthGTK(int menuCount, int itemCount, const char *file)
+{
+    DBusMessage *menus = newContainer();
+    DBusMessage *actions = newContainer();
+    DBusMessageIter args, array, actionArgs, actionArray;
+    char label[64], action[64];
+
+    dbus_message_iter_init_append(menus, &args);
+    dbus_message_iter_open_container(&args, DBUS_TYPE_ARRAY, "(uaa{sv})", &array);
+    dbus_message_iter_init_append(actions, &actionArgs);
+    dbus_message_iter_open_container(&actionArgs, DBUS_TYPE_ARRAY, "{s(bgav)}", &actionArray);
+
+    /* Group 0 menu 0 is the menubar; menu N (N >= 1) of group 0 is its Nth submenu */
+    for (int m = 0; m <= menuCount; m++) {
+        DBusMessageIter menu, items;
+        dbus_uint32_t group = 0, menuId = (dbus_uint32_t)m;
+        dbus_message_iter_open_container(&array, DBUS_TYPE_STRUCT, NULL, &menu);
+        dbus_message_iter_append_basic(&menu, DBUS_TYPE_UINT32, &group);
+        dbus_message_iter_append_basic(&menu, DBUS_TYPE_UINT32, &menuId);
+        dbus_message_iter_open_container(&menu, DBUS_TYPE_ARRAY, "a{sv}", &items);
+
+        int count = (m == 0) ? menuCount : itemCount;
+        for (int i = 0; i < count; i++) {
+            DBusMessageIter dict;
+            dbus_message_iter_open_container(&items, DBUS_TYPE_ARRAY, "{sv}", &dict);
+            if (m == 0) {
+                snprintf(label, sizeof(label), "_Menu %d", i + 1);
+                appendStringEntry(&dict, "label", label);
+                appendGTKLink(&dict, ":submenu", 0, (dbus_uint32_t)(i + 1));
+            } else {
+                int toggle = (i % 4 == 3);
+                snprintf(label, sizeof(label), "Item %d.%d", m, i + 1);
+                snprintf(action, sizeof(action), toggle ? "win.toggle-%d-%d" : "win.item-%d-%d", m, i + 1);
+                appendStringEntry(&dict, "label", label);
+                appendStringEntry(&dict, "action", action);
+                if (m == 1 && i < 10) {
+                    char accel[32];
+                    snprintf(accel, sizeof(accel), "<Control>%c", 'a' + i);
+                    appendStringEntry(&dict, "accel", accel);
+                }
+
+                DBusMessageIter entry, description, state;
+                const char *name = action + 4;
+                dbus_bool_t enabled = (i % 7 != 3);
+                const char *parameterType = "";
+                dbus_message_iter_open_container(&actionArray, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+                dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &name);
+                dbus_message_iter_open_container(&entry, DBUS_TYPE_STRUCT, NULL, &description);
+                dbus_message_iter_append_basic(&description, DBUS_TYPE_BOOLEAN, &enabled);
+                dbus_message_iter_append_basic(&description, DBUS_TYPE_SIGNATURE, &parameterType);
+                dbus_message_iter_open_container(&description, DBUS_TYPE_ARRAY, "v", &state);
+                if (toggle) {
+                    DBusMessageIter value;
+                    dbus_bool_t on = (i % 8 == 3);
+                    dbus_message_iter_open_container(&state, DBUS_TYPE_VARIANT, "b", &value);
+                    dbus_message_iter_append_basic(&value, DBUS_TYPE_BOOLEAN, &on);
+                    dbus_message_iter_close_container(&state, &value);
+                }
+                dbus_message_iter_close_container(&description, &state);
+                dbus_message_iter_close_container(&entry, &description);
+                dbus_message_iter_close_container(&actionArray, &entry);
+            }
+            dbus_message_iter_close_container(&items, &dict);
+        }
+
+        dbus_message_iter_close_container(&menu, &items);
+        dbus_message_iter_close_container(&array, &menu);
+    }
+
+    dbus_message_iter_close_container(&args, &array);
+    dbus_message_iter_close_container(&actionArgs, &actionArray);
+
+    DBusMessage *blobs[2] = { menus, actions };
+    writeRecording(file, ProtocolGTK, blobs, 2);
+    printf("Wrote synthetic GTK menu (%d menus of %d items) to %s\n", menuCount, itemCount, file);
+    dbus_message_unref(menus);
+    dbus_message_unref(actions);
+    return 0;
+}
+
+/* Serving */
+
+static const char *introspectionFor(int kind)
+{
+    switch (kind) {
+        case ExportDBusMenu:
+            return "<node><interface name=\"com.canonical.dbusmenu\">"
+                   "<method name=\"GetLayout\"><arg type=\"i\" direction=\"in\"/><arg type=\"i\" direction=\"in\"/>"
+                   "<arg type=\"as\" direction=\"in\"/><arg type=\"u\" direction=\"out\"/>"
+                   "<arg type=\"(ia{sv}av)\" direction=\"out\"/></method>"
+                   "<method name=\"AboutToShow\"><arg type=\"i\" direction=\"in\"/><arg type=\"b\" direction=\"out\"/></method>"
+                   "<method name=\"Event\"><arg type=\"i\" direction=\"in\"/><arg type=\"s\" direction=\"in\"/>"
+                   "<arg type=\"v\" direction=\"in\"/><arg type=\"u\" direction=\"in\"/></method>"
+                   "</interface></node>";
+        case ExportGTKMenus:
+            return "<node><interface name=\"org.gtk.Menus\">"
+                   "<method name=\"Start\"><arg type=\"au\" direction=\"in\"/><arg type=\"a(uaa{sv})\" direction=\"out\"/></method>"
+                   "<method name=\"End\"><arg type=\"au\" direction=\"in\"/></method>"
+                   "<signal name=\"Changed\"><arg type=\"a(uuuuaa{sv})\"/></signal>"
+                   "</interface></node>";
+        default:
+            return "<node><interface name=\"org.gtk.Actions\">"
+                   "<method name=\"DescribeAll\"><arg type=\"a{s(bgav)}\" direction=\"out\"/></method>"
+                   "<method name=\"DescribeAction\"><arg type=\"s\" direction=\"in\"/><arg type=\"(bgav)\" direction=\"out\"/></method>"
+                   "<method name=\"Activate\"><arg type=\"s\" direction=\"in\"/><arg type=\"av\" direction=\"in\"/>"
+                   "<arg type=\"a{sv}\" direction=\"in\"/></method>"
+                   "</interface></node>";
+    }
+}
+
+static int nameRequested(DBusMessageIter *names, const char *name)
+{
+    DBusMessageIter iter = *names;
+    int any = 0;
+    for (; dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_STRING; dbus_message_iter_next(&iter)) {
+        const char *requested;
+        dbus_message_iter_get_basic(&iter, &requested);
+        if (strcmp(requested, name) == 0) {
+            return 1;
+        }
+        any = 1;
+    }
+    return !any;    /* An empty list asks for every property */
+}
+
+/* Copies one (ia{sv}av) item, keeping only the requested properties and depth levels */
+static void copyLayoutItem(DBusMessageIter *from, DBusMessageIter *to, int depth, DBusMessageIter *names)
+{
+    DBusMessageIter fields, item;
+    dbus_message_iter_recurse(from, &fields);
+    dbus_message_iter_open_container(to, DBUS_TYPE_STRUCT, NULL, &item);
+
+    copyValue(&fields, &item);      /* id */
+    dbus_message_iter_next(&fields);
+
+    DBusMessageIter props, outProps;
+    dbus_message_iter_recurse(&fields, &props);
+    dbus_message_iter_open_container(&item, DBUS_TYPE_ARRAY, "{sv}", &outProps);
+    for (; dbus_message_iter_get_arg_type(&props) == DBUS_TYPE_DICT_ENTRY; dbus_message_iter_next(&props)) {
+        DBusMessageIter entry;
+        const char *key;
+        dbus_message_iter_recurse(&props, &entry);
+        dbus_message_iter_get_basic(&entry, &key);
+        if (nameRequested(names, key)) {
+            copyValue(&props, &outProps);
+        }
+    }
+    dbus_message_iter_close_container(&item, &outProps);
+    dbus_message_iter_next(&fields);
+
+    DBusMessageIter children, outChildren;
+    dbus_message_iter_recurse(&fields, &children);
+    dbus_message_iter_open_container(&item, DBUS_TYPE_ARRAY, "v", &outChildren);
+    if (depth != 0) {
+        for (; dbus_message_iter_get_arg_type(&children) == DBUS_TYPE_VARIANT; dbus_message_iter_next(&children)) {
+            DBusMessageIter child, variant;
+            dbus_message_iter_recurse(&children, &child);
+            dbus_message_iter_open_container(&outChildren, DBUS_TYPE_VARIANT, "(ia{sv}av)", &variant);
+            copyLayoutItem(&child, &variant, depth - 1, names);
+            dbus_message_iter_close_container(&outChildren, &variant);
+        }
+    }
+    dbus_message_iter_close_container(&item, &outChildren);
+
+    dbus_message_iter_close_container(to, &item);
+}
+
+static int findLayoutItem(DBusMessageIter *item, dbus_int32_t itemId, DBusMessageIter *found)
+{
+    DBusMessageIter fields, children;
+    dbus_int32_t currentId;
+    dbus_message_iter_recurse(item, &fields);
+    dbus_message_iter_get_basic(&fields, &currentId);
+    if (currentId == itemId) {
+        *found = *item;
+        return 1;
+    }
+
+    dbus_message_iter_next(&fields);
+    dbus_message_iter_next(&fields);
+    dbus_message_iter_recurse(&fields, &children);
+    for (; dbus_message_iter_get_arg_type(&children) == DBUS_TYPE_VARIANT; dbus_message_iter_next(&children)) {
+        DBusMessageIter child;
+        dbus_message_iter_recurse(&children, &child);
+        if (findLayoutItem(&child, itemId, found)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static DBusMessage *replyGetLayout(DBusMessage *call, Recording *recording)
+{
+    dbus_int32_t parentId = 0, depth = -1;
+    DBusMessageIter args, names;
+    if (!dbus_message_iter_init(call, &args)) {
+        return NULL;
+    }
+    dbus_message_iter_get_basic(&args, &parentId);
+    dbus_message_iter_next(&args);
+    dbus_message_iter_get_basic(&args, &depth);
+    dbus_message_iter_next(&args);
+    dbus_message_iter_recurse(&args, &names);
+
+    DBusMessageIter recorded, root, item;
+    dbus_message_iter_init(recording->layout, &recorded);
+    dbus_uint32_t revision;
+    dbus_message_iter_get_basic(&recorded, &revision);
+    dbus_message_iter_next(&recorded);
+    root = recorded;
+    if (!findLayoutItem(&root, parentId, &item)) {
+        return dbus_message_new_error(call, DBUS_ERROR_INVALID_ARGS, "Unknown menu item");
+    }
+
+    DBusMessage *reply = dbus_message_new_method_return(call);
+    DBusMessageIter out;
+    dbus_message_iter_init_append(reply, &out);
+    dbus_message_iter_append_basic(&out, DBUS_TYPE_UINT32, &revision);
+    copyLayoutItem(&item, &out, depth, &names);
+    return reply;
+}
+
+static DBusMessage *replyStart(DBusMessage *call, Recording *recording)
+{
+    DBusMessageIter args, requested;
+    const dbus_uint32_t *groups = NULL;
+    int count = 0;
+    if (dbus_message_iter_init(call, &args) && dbus_message_iter_get_arg_type(&args) == DBUS_TYPE_ARRAY) {
+        dbus_message_iter_recurse(&args, &requested);
+        dbus_message_iter_get_fixed_array(&requested, &groups, &count);
+    }
+    if (containsGroup(groups, count, 0)) {
+        gtkMenuLoads++;
+    }
+
+    DBusMessage *reply = dbus_message_new_method_return(call);
+    DBusMessageIter out, outArray, recorded, menus;
+    dbus_message_iter_init_append(reply, &out);
+    dbus_message_iter_open_container(&out, DBUS_TYPE_ARRAY, "(uaa{sv})", &outArray);
+
+    dbus_message_iter_init(recording->menus, &recorded);
+    dbus_message_iter_recurse(&recorded, &menus);
+    for (; dbus_message_iter_get_arg_type(&menus) == DBUS_TYPE_STRUCT; dbus_message_iter_next(&menus)) {
+        DBusMessageIter fields;
+        dbus_uint32_t group;
+        dbus_message_iter_recurse(&menus, &fields);
+        dbus_message_iter_get_basic(&fields, &group);
+        if (containsGroup(groups, count, group)) {
+            copyValue(&menus, &outArray);
+        }
+    }
+
+    dbus_message_iter_close_container(&out, &outArray);
+    return reply;
+}
+
+static DBusMessage *replyDescribeAction(DBusMessage *call, Recording *recording)
+{
+    const char *name = NULL;
+    if (!dbus_message_get_args(call, NULL, DBUS_TYPE_STRING, &name, DBUS_TYPE_INVALID)) {
+        return NULL;
+    }
+    /* Importers sometimes ask with the "win."/"app." prefix still attached */
+    const char *dot = strchr(name, '.');
+
+    DBusMessageIter recorded, entries;
+    dbus_message_iter_init(recording->actions, &recorded);
+    dbus_message_iter_recurse(&recorded, &entries);
+    for (; dbus_message_iter_get_arg_type(&entries) == DBUS_TYPE_DICT_ENTRY; dbus_message_iter_next(&entries)) {
+        DBusMessageIter entry;
+        const char *key;
+        dbus_message_iter_recurse(&entries, &entry);
+        dbus_message_iter_get_basic(&entry, &key);
+        if (strcmp(key, name) == 0 || (dot && strcmp(key, dot + 1) == 0)) {
+            DBusMessage *reply = dbus_message_new_method_return(call);
+            DBusMessageIter out;
+            dbus_message_iter_init_append(reply, &out);
+            dbus_message_iter_next(&entry);
+            copyValue(&entry, &out);
+            return reply;
+        }
+    }
+    return dbus_message_new_error(call, DBUS_ERROR_INVALID_ARGS, "Unknown action");
+}
+
+static DBusMessage *replyRecorded(DBusMessage *call, DBusMessage *recorded)
+{
+    DBusMessage *reply = dbus_message_new_method_return(call);
+    DBusMessageIter in, out;
+    dbus_message_iter_init_append(reply, &out);
+    if (dbus_message_iter_init(recorded, &in)) {
+        copyValues(&in, &out);
+    }
+    return reply;
+}
+
+static DBusHandlerResult handleMessage(DBusConnection *connection, DBusMessage *message, void *data)
+{
+    (void)data;
+    if (dbus_message_get_type(message) != DBUS_MESSAGE_TYPE_METHOD_CALL) {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+
+    const char *path = dbus_message_get_path(message);
+    Export *export = NULL;
+    for (int i = 0; path && i < exportCount; i++) {
+        if (strcmp(exports[i].path, path) == 0) {
+            export = &exports[i];
+            break;
+        }
+    }
+    if (!export) {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+
+    const char *member = dbus_message_get_member(message);
+    Recording *recording = export->recording;
+    DBusMessage *reply = NULL;
+
+    if (dbus_message_is_method_call(message, DBUS_INTERFACE_INTROSPECTABLE, "Introspect")) {
+        const char *xml = introspectionFor(export->kind);
+        reply = dbus_message_new_method_return(message);
+        dbus_message_append_args(reply, DBUS_TYPE_STRING, &xml, DBUS_TYPE_INVALID);
+    } else if (export->kind == ExportDBusMenu) {
+        if (strcmp(member, "GetLayout") == 0) {
+            reply = replyGetLayout(message, recording);
+        } else if (strcmp(member, "AboutToShow") == 0) {
+            dbus_bool_t needsUpdate = FALSE;
+            reply = dbus_message_new_method_return(message);
+            dbus_message_append_args(reply, DBUS_TYPE_BOOLEAN, &needsUpdate, DBUS_TYPE_INVALID);
+        } else if (strcmp(member, "Event") == 0) {
+            reply = dbus_message_new_method_return(message);
+        }
+    } else if (export->kind == ExportGTKMenus) {
+        if (strcmp(member, "Start") == 0) {
+            reply = replyStart(message, recording);
+        } else if (strcmp(member, "End") == 0) {
+            reply = dbus_message_new_method_return(message);
+        }
+    } else {
+        if (strcmp(member, "DescribeAll") == 0) {
+            describeAllCalls++;
+            reply = replyRecorded(message, recording->actions);
+        } else if (strcmp(member, "DescribeAction") == 0 || strcmp(member, "Describe") == 0) {
+            describeActionCalls++;
+            reply = replyDescribeAction(message, recording);
+        } else if (strcmp(member, "Activate") == 0) {
+            reply = dbus_message_new_method_return(message);
+        }
+    }
+
+    if (reply) {
+        callsServed++;
+    } else {
+        callsRejected++;
+        reply = dbus_message_new_error(message, DBUS_ERROR_UNKNOWN_METHOD, "Not served by menu-bench");
+    }
+    if (!dbus_message_get_no_reply(message)) {
+        dbus_connection_send(connection, reply, NULL);
+    }
+    dbus_message_unref(reply);
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static void serveFor(DBusConnection *connection, unsigned int milliseconds)
+{
+    uint64_t deadline = nowMillis() + milliseconds;
+    uint64_t now;
+    while ((now = nowMillis()) < deadline) {
+        if (!dbus_connection_read_write_dispatch(connection, (int)(deadline - now))) {
+            die("lost the session bus");
+        }
+        while (dbus_connection_dispatch(connection) == DBUS_DISPATCH_DATA_REMAINS) {
+        }
+    }
+}
+
+/* Changed deltas */
+
+/* Finds the submenu of group 0 with the most items, leaving *items at its aa{sv}; returns the count */
+static int findDeltaMenu(Recording *recording, dbus_uint32_t *menuId, DBusMessageIter *items)
+{
+    DBusMessageIter recorded, menus;
+    int most = -1;
+    dbus_message_iter_init(recording->menus, &recorded);
+    dbus_message_iter_recurse(&recorded, &menus);
+    for (; dbus_message_iter_get_arg_type(&menus) == DBUS_TYPE_STRUCT; dbus_message_iter_next(&menus)) {
+        DBusMessageIter fields, list;
+        dbus_uint32_t group, menu;
+        dbus_message_iter_recurse(&menus, &fields);
+        dbus_message_iter_get_basic(&fields, &group);
+        dbus_message_iter_next(&fields);
+        dbus_message_iter_get_basic(&fields, &menu);
+        dbus_message_iter_next(&fields);
+        if (group != 0 || menu == 0) {
+            continue;
+        }
+
+        int count = 0;
+        dbus_message_iter_recurse(&fields, &list);
+        for (; dbus_message_iter_get_arg_type(&list) == DBUS_TYPE_ARRAY; dbus_message_iter_next(&list)) {
+            count++;
+        }
+        if (count > most) {
+            most = count;
+            *menuId = menu;
+            *items = fields;
+        }
+    }
+    return most;
+}
+
+/* Sends one splice of menu (0, menuId), whose items are now *itemCount long */
+static void emitChanged(DBusConnection *connection, const char *path, dbus_uint32_t menuId,
+                        DBusMessageIter *recordedItems, int recordedCount, int *itemCount, unsigned int change)
+{
+    dbus_uint32_t group = 0;
+    dbus_uint32_t position = (dbus_uint32_t)((change * 7919u) % (unsigned int)*itemCount);
+    dbus_uint32_t removed = (change % 3 == 1) ? 0 : 1;      /* relabel, insert, remove */
+    int adding = (change % 3 != 2);
+
+    DBusMessage *signal = dbus_message_new_signal(path, "org.gtk.Menus", "Changed");
+    DBusMessageIter args, changes, splice, added;
+    dbus_message_iter_init_append(signal, &args);
+    dbus_message_iter_open_container(&args, DBUS_TYPE_ARRAY, "(uuuuaa{sv})", &changes);
+    dbus_message_iter_open_container(&changes, DBUS_TYPE_STRUCT, NULL, &splice);
+    dbus_message_iter_append_basic(&splice, DBUS_TYPE_UINT32, &group);
+    dbus_message_iter_append_basic(&splice, DBUS_TYPE_UINT32, &menuId);
+    dbus_message_iter_append_basic(&splice, DBUS_TYPE_UINT32, &position);
+    dbus_message_iter_append_basic(&splice, DBUS_TYPE_UINT32, &removed);
+    dbus_message_iter_open_container(&splice, DBUS_TYPE_ARRAY, "a{sv}", &added);
+
+    if (adding) {
+        /* A recorded item with a new label, so its action and accelerator stay real */
+        DBusMessageIter source, props, dict;
+        dbus_message_iter_recurse(recordedItems, &source);
+        for (unsigned int i = 0; i < position % (unsigned int)recordedCount; i++) {
+            dbus_message_iter_next(&source);
+        }
+        dbus_message_iter_recurse(&source, &props);
+        dbus_message_iter_open_container(&added, DBUS_TYPE_ARRAY, "{sv}", &dict);
+        for (; dbus_message_iter_get_arg_type(&props) == DBUS_TYPE_DICT_ENTRY; dbus_message_iter_next(&props)) {
+            DBusMessageIter entry;
+            const char *key;
+            dbus_message_iter_recurse(&props, &entry);
+            dbus_message_iter_get_basic(&entry, &key);
+            if (strcmp(key, "label") != 0) {
+                copyValue(&props, &dict);
+            }
+        }
+        char label[64];
+        snprintf(label, sizeof(label), "Changed %u", change + 1);
+        appendStringEntry(&dict, "label", label);
+        dbus_message_iter_close_container(&added, &dict);
+    }
+
+    dbus_message_iter_close_container(&splice, &added);
+    dbus_message_iter_close_container(&changes, &splice);
+    dbus_message_iter_close_container(&args, &changes);
+    dbus_connection_send(connection, signal, NULL);
+    dbus_message_unref(signal);
+
+    *itemCount += adding - (int)removed;
+}
+
+static void setStringProperty(Display *display, Window window, const char *name, const char *value)
+{
+    XChangeProperty(display, window, XInternAtom(display, name, False), XInternAtom(display, "UTF8_STRING", False),
+                    8, PropModeReplace, (const unsigned char *)value, (int)strlen(value));
+}
+
+/* A request that shows up in an X protocol trace; see the header comment */
+static void markPhase(Display *display, const char *phase)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "_MENU_BENCH_MARK_%s", phase);
+    XInternAtom(display, name, False);
+}
+
+static void addExport(const char *path, int kind, Recording *recording)
+{
+    Export *export = &exports[exportCount++];
+    snprintf(export->path, sizeof(export->path), "%s", path);
+    export->kind = kind;
+    export->recording = recording;
+}
+
+static void registerWithRegistrar(DBusConnection *connection, Window window, const char *path)
+{
+    DBusMessage *call = dbus_message_new_method_call("com.canonical.AppMenu.Registrar",
+                                                     "/com/canonical/AppMenu/Registrar",
+                                                     "com.canonical.AppMenu.Registrar", "RegisterWindow");
+    dbus_uint32_t windowId = (dbus_uint32_t)window;
+    dbus_message_append_args(call, DBUS_TYPE_UINT32, &windowId, DBUS_TYPE_OBJECT_PATH, &path, DBUS_TYPE_INVALID);
+
+    /* Menu.app calls back into us while registering, so do not block on the reply */
+    dbus_message_set_no_reply(call, TRUE);
+    dbus_connection_send(connection, call, NULL);
+    dbus_message_unref(call);
+}
+
+static void waitForRegistrar(DBusConnection *connection, unsigned int timeoutMillis)
+{
+    uint64_t deadline = nowMillis() + timeoutMillis;
+    while (nowMillis() < deadline) {
+        if (dbus_bus_name_has_owner(connection, "com.canonical.AppMenu.Registrar", NULL)) {
+            return;
+        }
+        usleep(100 * 1000);
+    }
+    die("com.canonical.AppMenu.Registrar did not appear; is Menu.app running on this bus?");
+}
+
+static int serve(int argc, char **argv)
+{
+    unsigned int switches = 200, interval = 150, settle = 2000, deltas = 0;
+    int windowCount = 0;
+    int sharedExports = 0;
+    int option;
+
+    while ((option = getopt(argc, argv, "n:i:w:s:SD:")) != -1) {
+        switch (option) {
+            case 'n': switches = (unsigned int)strtoul(optarg, NULL, 10); break;
+            case 'i': interval = (unsigned int)strtoul(optarg, NULL, 10); break;
+            case 'w': windowCount = atoi(optarg); break;
+            case 's': settle = (unsigned int)strtoul(optarg, NULL, 10); break;
+            case 'S': sharedExports = 1; break;
+            case 'D': deltas = (unsigned int)strtoul(optarg, NULL, 10); break;
+            default: die("unknown serve option");
+        }
+    }
+    int recordingCount = argc - optind;
+    if (recordingCount <= 0) {
+        die("serve needs at least one recording");
+    }
+    if (windowCount <= 0) {
+        windowCount = recordingCount;
+    }
+    if (windowCount > MAX_WINDOWS) {
+        die("at most %d windows", MAX_WINDOWS);
+    }
+
+    Recording **recordings = calloc((size_t)recordingCount, sizeof(Recording *));
+    for (int i = 0; i < recordingCount; i++) {
+        recordings[i] = loadRecording(argv[optind + i]);
+    }
+
+    Display *display = XOpenDisplay(NULL);
+    if (!display) {
+        die("cannot open X display");
+    }
+    Window root = DefaultRootWindow(display);
+    DBusConnection *connection = connectSessionBus();
+    if (!dbus_connection_add_filter(connection, handleMessage, NULL, NULL)) {
+        die("out of memory");
+    }
+    const char *uniqueName = dbus_bus_get_unique_name(connection);
+
+    waitForRegistrar(connection, 30000);
+
+    /* There is no window manager under Xvfb; maintain the EWMH root properties ourselves */
+    Atom activeAtom = XInternAtom(display, "_NET_ACTIVE_WINDOW", False);
+    Atom clientListAtom = XInternAtom(display, "_NET_CLIENT_LIST", False);
+    long clientList[MAX_WINDOWS];
+
+    /* One fake window per slot; windows sharing a recording look like one application */
+    Window windows[MAX_WINDOWS];
+    pid_t pid = getpid();
+    markPhase(display, "MAP");
+    for (int i = 0; i < windowCount; i++) {
+        Recording *recording = recordings[i % recordingCount];
+        Window window = XCreateSimpleWindow(display, root, 0, 0, 320, 200, 0, 0, 0);
+        windows[i] = window;
+
+        XClassHint hint = { "menu-bench", recording->name };
+        XSetClassHint(display, window, &hint);
+        XStoreName(display, window, recording->name);
+        XChangeProperty(display, window, XInternAtom(display, "_NET_WM_PID", False), XA_CARDINAL, 32,
+                        PropModeReplace, (const unsigned char *)&(long){ pid }, 1);
+
+        /* With -S the first window of each recording exports, the others reuse its paths */
+        int slot = sharedExports ? i % recordingCount : i;
+        char menuPath[128], actionPath[128];
+        if (recording->protocol == ProtocolDBusMenu) {
+            snprintf(menuPath, sizeof(menuPath), "/MenuBar/%d", slot + 1);
+            if (slot == i) {
+                addExport(menuPath, ExportDBusMenu, recording);
+            }
+            setStringProperty(display, window, "_KDE_NET_WM_APPMENU_SERVICE_NAME", uniqueName);
+            setStringProperty(display, window, "_KDE_NET_WM_APPMENU_OBJECT_PATH", menuPath);
+        } else {
+            /* Menu.app derives the action path by swapping /org/gtk/Menus for /org/gtk/Actions */
+            snprintf(menuPath, sizeof(menuPath), "/org/gtk/Menus/bench/%d", slot + 1);
+            snprintf(actionPath, sizeof(actionPath), "/org/gtk/Actions/bench/%d", slot + 1);
+            if (slot == i) {
+                addExport(menuPath, ExportGTKMenus, recording);
+                addExport(actionPath, ExportGTKActions, recording);
+            }
+            setStringProperty(display, window, "_GTK_UNIQUE_BUS_NAME", uniqueName);
+            setStringProperty(display, window, "_GTK_MENUBAR_OBJECT_PATH", menuPath);
+        }
+        XMapWindow(display, window);
+
+        clientList[i] = (long)window;
+        XChangeProperty(display, root, clientListAtom, XA_WINDOW, 32,
+                        PropModeReplace, (const unsigned char *)clientList, i + 1);
+        XFlush(display);
+    }
+
+    for (int i = 0; i < windowCount; i++) {
+        if (recordings[i % recordingCount]->protocol == ProtocolDBusMenu) {
+            char menuPath[128];
+            snprintf(menuPath, sizeof(menuPath), "/MenuBar/%d", (sharedExports ? i % recordingCount : i) + 1);
+            registerWithRegistrar(connection, windows[i], menuPath);
+        }
+    }
+    dbus_connection_flush(connection);
+
+    fprintf(stderr, "menu-bench: %d windows from %d recordings (%s exports) as %s, settling for %u ms\n",
+            windowCount, recordingCount, sharedExports ? "shared" : "per-window", uniqueName, settle);
+    serveFor(connection, settle);
+
+    markPhase(display, "SWITCH");
+    for (unsigned int s = 0; s < switches; s++) {
+        long active = (long)windows[s % (unsigned int)windowCount];
+        XChangeProperty(display, root, activeAtom, XA_WINDOW, 32, PropModeReplace,
+                        (const unsigned char *)&active, 1);
+        XFlush(display);
+        serveFor(connection, interval);
+    }
+
+    markPhase(display, "DONE");
+    fprintf(stderr, "menu-bench: %u switches done, %lu calls served, %lu rejected\n",
+            switches, callsServed, callsRejected);
+    if (gtkMenuLoads > 0) {
+        fprintf(stderr, "menu-bench: %lu GTK menu loads made %lu DescribeAll and %lu DescribeAction calls "
+                "(%.1f org.gtk.Actions round trips per load)\n",
+                gtkMenuLoads, describeAllCalls, describeActionCalls,
+                (double)(describeAllCalls + describeActionCalls) / (double)gtkMenuLoads);
+    }
+
+    if (deltas > 0) {
+        int target = 0;
+        while (target < windowCount && recordings[target % recordingCount]->protocol != ProtocolGTK) {
+            target++;
+        }
+        if (target == windowCount) {
+            die("-D needs a GTK recording");
+        }
+
+        Recording *recording = recordings[target % recordingCount];
+        dbus_uint32_t menuId = 0;
+        DBusMessageIter recordedItems;
+        int recordedCount = findDeltaMenu(recording, &menuId, &recordedItems);
+        if (recordedCount <= 0) {
+            die("%s has no submenu items to change", recording->name);
+        }
+        char menuPath[128];
+        snprintf(menuPath, sizeof(menuPath), "/org/gtk/Menus/bench/%d",
+                 (sharedExports ? target % recordingCount : target) + 1);
+
+        /* Menu.app subscribes and builds the menu on activation; Changed reaches only live menus */
+        long active = (long)windows[target];
+        XChangeProperty(display, root, activeAtom, XA_WINDOW, 32, PropModeReplace,
+                        (const unsigned char *)&active, 1);
+        XFlush(display);
+        serveFor(connection, settle);
+
+        int itemCount = recordedCount;
+        for (unsigned int c = 0; c < deltas; c++) {
+            emitChanged(connection, menuPath, menuId, &recordedItems, recordedCount, &itemCount, c);
+            dbus_connection_flush(connection);
+            serveFor(connection, interval);
+        }
+        fprintf(stderr, "menu-bench: %u Changed signals sent to %s menu %u (%d items)\n",
+                deltas, menuPath, menuId, recordedCount);
+    }
+
+    long none = 0;
+    XChangeProperty(display, root, activeAtom, XA_WINDOW, 32, PropModeReplace, (const unsigned char *)&none, 1);
+    XDeleteProperty(display, root, clientListAtom);
+    for (int i = 0; i < windowCount; i++) {
+        XDestroyWindow(display, windows[i]);
+    }
+    XCloseDisplay(display);
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: menu-bench record-dbusmenu SERVICE PATH FILE\n"
+            "       menu-bench record-gtk SERVICE MENUPATH ACTIONPATH FILE\n"
+            "       menu-bench synth-dbusmenu [-i ICONS] MENUS ITEMS FILE\n"
+            "       menu-bench synth-gtk MENUS ITEMS FILE\n"
+            "       menu-bench serve [-n SWITCHES] [-i INTERVAL_MS] [-w WINDOWS] [-s SETTLE_MS] [-S] [-D CHANGES] FILE...\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        usage();
+    }
+    const char *command = argv[1];
+
+    if (strcmp(command, "record-dbusmenu") == 0 && argc == 5) {
+        return recordDBusMenu(argv[2], argv[3], argv[4]);
+    } else if (strcmp(command, "record-gtk") == 0 && argc == 6) {
+        return recordGTK(argv[2], argv[3], argv[4], argv[5]);
+    } else if (strcmp(command, "synth-dbusmenu") == 0 && argc == 5) {
+        return synthDBusMenu(atoi(argv[2]), atoi(argv[3]), 0, argv[4]);
+    } else if (strcmp(command, "synth-dbusmenu") == 0 && argc == 7 && strcmp(argv[2], "-i") == 0) {
+        return synthDBusMenu(atoi(argv[4]), atoi(argv[5]), atoi(argv[3]), argv[6]);
+    } else if (strcmp(command, "synth-gtk") == 0 && argc == 5) {
+        return synthGTK(atoi(argv[2]), atoi(argv[3]), argv[4]);
+    } else if (strcmp(command, "serve") == 0) {
+        return serve(argc - 1, argv + 1);
+    }
+    usage();
+    return 2;
+}
@@ -0,0 +1,295 @@
+#!/bin/sh
+# Headless menu-load benchmark: runs Menu.app with tracing on a private Xvfb
+# display and session bus, replays recorded menus with menu-bench and reports
+# time-to-menu percentiles from the trace.
+#
+# Usage: run-benchmark.sh [-n switches] [-i interval_ms] [-w windows] [-S] [-D changes] [-C] [-R] [-X] [-P] [-d display] recording...
+#
+# -S makes windows replaying the same recording share one exported menu, as
+# most applications do; compare the menu loads and cache memory with and
+# without it (e.g. -w 30 -S with a single recording for a 30-window app).
+#
+# -D sends that many org.gtk.Menus.Changed splices to the first GTK window's
+# menu after the switches and reports the time Menu.app takes to apply each
+# (e.g. -D 500 with "menu-bench synth-gtk 1 1500" for a 1,500-item submenu).
+#
+# -C starts Menu.app with --no-icon-cache, decoding every item's icon while
+# the menu is built; compare DBusMenuParser.materialize with and without it
+# on a recording from "menu-bench synth-dbusmenu -i ICONS".
+#
+# -R runs the whole session twice against the same HOME, restarting Menu.app
+# in between, so the second run starts from the menus the first one
+# persisted; it reports the cold time-to-menu of both runs side by side.
+#
+# -X runs the session three times through an xtrace proxy and counts the X
+# requests Menu.app makes to read window state (GetProperty,
+# GetWindowAttributes, QueryTree, InternAtom, ChangeWindowAttributes) and the
+# round trips spent waiting for their replies, per window mapped and per
+# switch: with --rescan-windows --uncached-x11 (a full rescan on every client
+# list change, one blocking request per read), with --uncached-x11 only
+# (X11WindowRegistry) and as is (plus X11DisplayService's cache and batches).
+#
+# -P runs the session twice, with Menu.app --no-prewarm and as is, and
+# reports how long foreground menu loads waited for the load lock
+# (MenuProtocolManager.waitForLoadLock) in each; pre-warm only runs for
+# windows of one application, so use -w with fewer recordings than windows.
+#
+# Recordings come from "menu-bench record-dbusmenu" / "record-gtk" against real
+# applications, or from "menu-bench synth-dbusmenu" / "synth-gtk".
+
+SWITCHES=200
+INTERVAL=150
+WINDOWS=
+SHARED=
+DELTAS=
+ICON_CACHE=
+RESTART=
+XREQUESTS=
+PREWARM=
+XDISPLAY=:97
+
+while getopts "n:i:w:SD:CRXPd:" opt; do
+    case $opt in
+        n) SWITCHES=$OPTARG ;;
+        i) INTERVAL=$OPTARG ;;
+        w) WINDOWS=$OPTARG ;;
+        S) SHARED=-S ;;
+        D) DELTAS=$OPTARG ;;
+        C) ICON_CACHE=--no-icon-cache ;;
+        R) RESTART=1 ;;
+        X) XREQUESTS=1 ;;
+        P) PREWARM=1 ;;
+        d) XDISPLAY=$OPTARG ;;
+        *) echo "Usage: $0 [-n switches] [-i interval_ms] [-w windows] [-S] [-D changes] [-C] [-R] [-X] [-P] [-d display] recording..."; exit 2 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -eq 0 ] || [ "$RESTART$XREQUESTS$PREWARM" = 11 ] || [ "$RESTART$XREQUESTS$PREWARM" = 111 ]; then
+    echo "Usage: $0 [-n switches] [-i interval_ms] [-w windows] [-S] [-D changes] [-C] [-R] [-X] [-P] [-d display] recording..."
+    exit 2
+fi
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+MENU_APP=${MENU_APP:-$HERE/../Menu.app/Menu}
+MENU_BENCH=${MENU_BENCH:-$HERE/obj/menu-bench}
+
+for tool in Xvfb dbus-run-session "$MENU_APP" "$MENU_BENCH" ${XREQUESTS:+xtrace}; do
+    if ! command -v "$tool" >/dev/null 2>&1; then
+        echo "Missing $tool (build Menu and Benchmark with make first)"
+        exit 1
+    fi
+done
+
+# Absolute recording paths; the session below runs in a scratch directory
+RECORDINGS=
+for recording in "$@"; do
+    RECORDINGS="$RECORDINGS $(cd "$(dirname "$recording")" && pwd)/$(basename "$recording")"
+done
+
+# Fresh HOME so the persistent menu cache starts empty on every run (with -R,
+# the restarted session reuses it)
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/menu-bench.XXXXXX")
+mkdir -p "$WORK/home"
+TRACE=$WORK/trace.json
+
+echo "Starting Xvfb on $XDISPLAY..."
+Xvfb "$XDISPLAY" -screen 0 1280x800x24 -nolisten tcp >"$WORK/xvfb.log" 2>&1 &
+XVFB_PID=$!
+sleep 1
+
+export DISPLAY=$XDISPLAY
+export HOME=$WORK/home
+export MENU_APP MENU_BENCH SWITCHES INTERVAL WINDOWS SHARED DELTAS ICON_CACHE RECORDINGS WORK
+
+# One Menu.app session replaying the recordings; $1 is its trace, $2 its log,
+# and any further arguments go to Menu.app
+session() {
+    SESSION_TRACE=$1 SESSION_LOG=$2 SESSION_ARGS="$3" dbus-run-session -- sh -c '
+    "$MENU_APP" --trace "$SESSION_TRACE" $ICON_CACHE $SESSION_ARGS >"$SESSION_LOG" 2>&1 &
+    MENU_PID=$!
+    "$MENU_BENCH" serve -n "$SWITCHES" -i "$INTERVAL" ${WINDOWS:+-w "$WINDOWS"} $SHARED ${DELTAS:+-D "$DELTAS"} $RECORDINGS
+    STATUS=$?
+    # SIGTERM runs Menu.app'\''s exit cleanup, which writes the trace
+    kill -TERM $MENU_PID 2>/dev/null
+    wait $MENU_PID
+    exit $STATUS
+'
+}
+
+# A session with its X connections going through xtrace; $1 names the run,
+# $2 and $3 are session's, $4 the Menu.app arguments
+XTRACE_DISPLAY=:$((${XDISPLAY#:} + 100))
+xsession() {
+    xtrace -n -k -d "$XDISPLAY" -D "$XTRACE_DISPLAY" -o "$WORK/xtrace-$1.log" >"$WORK/xtrace-$1.err" 2>&1 &
+    XTRACE_PID=$!
+    sleep 1
+    DISPLAY=$XTRACE_DISPLAY
+    session "$2" "$3" "$4"
+    xstatus=$?
+    DISPLAY=$XDISPLAY
+    kill $XTRACE_PID 2>/dev/null
+    wait $XTRACE_PID 2>/dev/null
+    return $xstatus
+}
+
+STATUS=0
+if [ -n "$XREQUESTS" ]; then
+    echo "Baseline run: full rescans, uncached X11 reads..."
+    xsession rescan "$WORK/trace-rescan.json" "$WORK/menu-rescan.log" "--rescan-windows --uncached-x11" || STATUS=1
+    if [ $STATUS -eq 0 ]; then
+        echo "X11WindowRegistry run, uncached X11 reads..."
+        xsession registry "$WORK/trace-registry.json" "$WORK/menu-registry.log" "--uncached-x11" || STATUS=1
+    fi
+    if [ $STATUS -eq 0 ]; then
+        echo "Current run..."
+        xsession current "$TRACE" "$WORK/menu.log" || STATUS=1
+    fi
+elif [ -n "$RESTART" ]; then
+    EMPTY_TRACE=$WORK/trace-empty.json
+    echo "First run, empty menu cache..."
+    session "$EMPTY_TRACE" "$WORK/menu-empty.log" || STATUS=1
+    if [ $STATUS -eq 0 ] && [ ! -s "$EMPTY_TRACE" ]; then
+        STATUS=1
+    fi
+    echo "Restarting Menu.app with the persisted menus..."
+elif [ -n "$PREWARM" ]; then
+    NOPREWARM_TRACE=$WORK/trace-noprewarm.json
+    echo "Run without pre-warming..."
+    session "$NOPREWARM_TRACE" "$WORK/menu-noprewarm.log" "--no-prewarm" || STATUS=1
+    if [ $STATUS -eq 0 ] && [ ! -s "$NOPREWARM_TRACE" ]; then
+        STATUS=1
+    fi
+    echo "Run with pre-warming..."
+fi
+if [ $STATUS -eq 0 ] && [ -z "$XREQUESTS" ]; then
+    session "$TRACE" "$WORK/menu.log" || STATUS=1
+fi
+
+kill $XVFB_PID 2>/dev/null
+wait $XVFB_PID 2>/dev/null
+
+if [ $STATUS -ne 0 ] || [ ! -s "$TRACE" ]; then
+    echo "Benchmark failed; logs are in $WORK"
+    exit 1
+fi
+
+# The trace has one span per line; the first activation of each window is a
+# cold load (protocol round-trips), later ones are served from the menu cache
+activations() {
+    grep '"name":"time-to-menu"' "$1" | \
+        sed 's/.*"dur":\([0-9]*\).*"window":\([0-9]*\).*/\2 \1/' | \
+        awk '{ print (seen[$1]++ ? "warm" : "cold"), $2 }'
+}
+activations "$TRACE" >"$WORK/activations"
+
+report() {
+    label=$1
+    shift
+    "$@" <"$WORK/activations" | awk '{ print $2 }' | sort -n | awk -v label="$label" '
+        { v[NR] = $1 }
+        END {
+            if (NR == 0) { printf "%-6s no activations\n", label; exit }
+            p50 = v[int(NR * 0.50 + 0.999999)]; p95 = v[int(NR * 0.95 + 0.999999)]
+            printf "%-6s n=%-5d p50=%8.2f ms  p95=%8.2f ms  max=%8.2f ms\n", label, NR, p50 / 1000, p95 / 1000, v[NR] / 1000
+        }'
+}
+
+echo "Time to menu ($SWITCHES switches, ${INTERVAL} ms apart):"
+report all cat
+report cold grep '^cold'
+report warm grep '^warm'
+
+# First activations with nothing persisted against the same windows' apps
+# restored from disk and revalidated in the background
+if [ -n "$RESTART" ]; then
+    activations "$EMPTY_TRACE" >"$WORK/activations"
+    echo "Cold time to menu, empty menu cache vs. persisted menus after a restart:"
+    report empty grep '^cold'
+    activations "$TRACE" >"$WORK/activations"
+    report disk grep '^cold'
+    echo "  persisted menus shown: $(grep -c 'Showing persisted menu' "$WORK/menu.log")"
+fi
+
+# Per-name percentiles of the spans in one trace category, of $2 or $TRACE
+spans() {
+    grep "\"cat\":\"$1\"" "${2:-$TRACE}" | \
+        sed 's/.*"name":"\([^"]*\)".*"dur":\([0-9]*\).*/\1 \2/' | sort -k1,1 -k2,2n | awk '
+        function flush() {
+            if (n == 0) return
+            printf "  %-28s n=%-5d p50=%8.2f ms  p95=%8.2f ms\n", name, n, v[int(n * 0.50 + 0.999999)] / 1000, v[int(n * 0.95 + 0.999999)] / 1000
+        }
+        $1 != name { flush(); name = $1; n = 0 }
+        { v[++n] = $2 }
+        END { flush() }'
+}
+
+# Foreground loads waiting behind a pre-warm load; the worker starts none
+# while one is pending, so a wait is at most the load already running
+if [ -n "$PREWARM" ]; then
+    echo "Foreground waits for the menu load lock, pre-warm off vs. on:"
+    printf "  off"
+    spans menu "$NOPREWARM_TRACE" | grep 'waitForLoadLock' | sed 's/^ *MenuProtocolManager.waitForLoadLock */ /' || echo " no loads"
+    printf "  on "
+    spans menu | grep 'waitForLoadLock' | sed 's/^ *MenuProtocolManager.waitForLoadLock */ /' || echo " no loads"
+    grep 'MenuPreWarmScheduler: Jobs:' "$WORK/menu.log" | tail -n 1 | sed 's/.*MenuPreWarmScheduler: /  pre-warm /'
+fi
+
+# Parse phases: building the MenuLayout model and materializing the NSMenus
+echo "Parse phases:"
+spans parse
+
+# Changed splices applied to the live GTK model and its NSMenus
+if [ -n "$DELTAS" ]; then
+    echo "Changed deltas ($DELTAS sent):"
+    spans delta
+fi
+
+# Window-state requests and the round trips that waited on them, from the
+# xtrace log of one run, split at menu-bench's marker atoms. A round trip is
+# a run of replies on one connection after it sent a request, so a pipelined
+# batch counts once and a blocking read every time. menu-bench's own
+# connection is left out.
+xrequests() {
+    awk -v windows="$1" -v switches="$SWITCHES" '
+        BEGIN { phase = "startup" }
+        {
+            conn = substr($0, 1, 3)
+            direction = substr($0, 5, 1)
+        }
+        direction == "<" && /InternAtom/ && match($0, /_MENU_BENCH_MARK_[A-Z]+/) {
+            bench = conn
+            phase = tolower(substr($0, RSTART + 17, RLENGTH - 17))
+            next
+        }
+        conn == bench { next }
+        direction == "<" && / Request\([0-9]+\): (GetProperty|GetWindowAttributes|QueryTree|InternAtom|ChangeWindowAttributes) / {
+            requests[phase]++
+            waiting[conn] = 1
+        }
+        direction == ">" && (/ Reply to (GetProperty|GetWindowAttributes|QueryTree|InternAtom)/ || /[: ]Error/) && waiting[conn] {
+            roundTrips[phase]++
+            waiting[conn] = 0
+        }
+        END {
+            printf "%10.1f %10.1f %10.1f %10.1f\n",
+                requests["map"] / windows, roundTrips["map"] / windows,
+                requests["switch"] / switches, roundTrips["switch"] / switches
+        }' "$2"
+}
+
+if [ -n "$XREQUESTS" ]; then
+    MAPPED=${WINDOWS:-$#}
+    echo "X11 window-state requests and round trips ($MAPPED windows mapped, $SWITCHES switches):"
+    echo "                       req/window  rt/window req/switch  rt/switch"
+    printf "  %-18s %s\n" "rescan, uncached" "$(xrequests "$MAPPED" "$WORK/xtrace-rescan.log")"
+    printf "  %-18s %s\n" "registry, uncached" "$(xrequests "$MAPPED" "$WORK/xtrace-registry.log")"
+    printf "  %-18s %s\n" "registry, cached" "$(xrequests "$MAPPED" "$WORK/xtrace-current.log")"
+fi
+
+# Loads from the applications and the menu cache as Menu.app exited
+LOADS=$(grep -c '"name":"[A-Za-z]*Importer.loadMenu"' "$TRACE")
+echo "Menu loads: $LOADS"
+grep -E 'MenuCacheManager: (Memory|Windows):' "$WORK/menu.log" | tail -n 2 | sed 's/.*MenuCacheManager: /  /'
+grep 'MenuIconCache: Icons:' "$WORK/menu.log" | tail -n 1 | sed 's/.*MenuIconCache: /  /'
+echo "Trace (open in chrome://tracing or ui.perfetto.dev): $TRACE"
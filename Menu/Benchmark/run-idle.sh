@@ -0,0 +1,111 @@
+#!/bin/sh
+# Idle menu bar benchmark: shows one recorded menu in Menu.app on a private
+# Xvfb display and session bus, leaves it alone, and reports the CPU time
+# Menu.app uses and the redraws it makes while nothing happens.
+#
+# Usage: run-idle.sh [-t idle_seconds] [-d display] recording
+#
+# The clock redraws once a minute, so measure for a few minutes (the default
+# is 300 s) to see its cost next to everything else.
+
+IDLE=300
+XDISPLAY=:96
+SETTLE=2000     # ms menu-bench waits for Menu.app before activating its window
+WARM=5          # s allowed for the menu to load and draw before measuring
+
+while getopts "t:d:" opt; do
+    case $opt in
+        t) IDLE=$OPTARG ;;
+        d) XDISPLAY=$OPTARG ;;
+        *) echo "Usage: $0 [-t idle_seconds] [-d display] recording"; exit 2 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 [-t idle_seconds] [-d display] recording"
+    exit 2
+fi
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+MENU_APP=${MENU_APP:-$HERE/../Menu.app/Menu}
+MENU_BENCH=${MENU_BENCH:-$HERE/obj/menu-bench}
+
+for tool in Xvfb dbus-run-session "$MENU_APP" "$MENU_BENCH"; do
+    if ! command -v "$tool" >/dev/null 2>&1; then
+        echo "Missing $tool (build Menu and Benchmark with make first)"
+        exit 1
+    fi
+done
+
+RECORDING=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/menu-idle.XXXXXX")
+mkdir -p "$WORK/home"
+TRACE=$WORK/trace.json
+
+echo "Starting Xvfb on $XDISPLAY..."
+Xvfb "$XDISPLAY" -screen 0 1280x800x24 -nolisten tcp >"$WORK/xvfb.log" 2>&1 &
+XVFB_PID=$!
+sleep 1
+
+export DISPLAY=$XDISPLAY
+export HOME=$WORK/home
+export MENU_APP MENU_BENCH IDLE SETTLE WARM TRACE RECORDING WORK
+
+dbus-run-session -- sh -c '
+    # CPU time (user + system) of a process in ms
+    cpu_ms() {
+        if [ -r "/proc/$1/stat" ]; then
+            # Fields after the command name, which may hold spaces: utime and stime are the 12th and 13th
+            sed "s/.*) //" "/proc/$1/stat" | awk -v hz="$(getconf CLK_TCK)" "{ print int((\$12 + \$13) * 1000 / hz) }"
+        else
+            ps -o time= -p "$1" | awk -F: "{ s = 0; for (i = 1; i <= NF; i++) s = s * 60 + \$i; print int(s * 1000) }"
+        fi
+    }
+
+    "$MENU_APP" --trace "$TRACE" >"$WORK/menu.log" 2>&1 &
+    MENU_PID=$!
+    # One activation, then the window stays active and its menu is served until the end
+    "$MENU_BENCH" serve -s "$SETTLE" -n 1 -i $(((WARM + IDLE + 10) * 1000)) "$RECORDING" 2>"$WORK/bench.log" &
+    BENCH_PID=$!
+
+    sleep $((SETTLE / 1000 + WARM))
+    START=$(cpu_ms $MENU_PID)
+    sleep "$IDLE"
+    END=$(cpu_ms $MENU_PID)
+    echo "$START $END" >"$WORK/cpu"
+
+    # SIGTERM runs Menu.app'\''s exit cleanup, which writes the trace
+    kill -TERM $MENU_PID 2>/dev/null
+    wait $MENU_PID
+    kill $BENCH_PID 2>/dev/null
+    wait $BENCH_PID 2>/dev/null
+    exit 0
+'
+
+kill $XVFB_PID 2>/dev/null
+wait $XVFB_PID 2>/dev/null
+
+if [ ! -s "$WORK/cpu" ] || [ ! -s "$TRACE" ] || ! grep -q '"name":"time-to-menu"' "$TRACE"; then
+    grep '^menu-bench' "$WORK/bench.log"
+    echo "Benchmark failed; logs are in $WORK"
+    exit 1
+fi
+
+read START END <"$WORK/cpu"
+echo "Idle for $IDLE s with the menu of $(basename "$RECORDING") shown:"
+awk -v start="$START" -v end="$END" -v idle="$IDLE" 'BEGIN {
+    printf "  CPU %d ms (%.3f%% of a core, %.1f ms per minute)\n", end - start, (end - start) / (idle * 10), (end - start) * 60 / idle
+}'
+
+# Redraws once the menu had been drawn and the warm-up was over, i.e. in the idle period
+SETTLED=$(grep '"name":"time-to-menu"' "$TRACE" | head -n 1 | \
+    sed 's/.*"ts":\([0-9]*\),"dur":\([0-9]*\).*/\1 \2/' | awk -v warm="$WARM" '{ print $1 + $2 + warm * 1000000 }')
+for span in MenuBarView.drawRect NSMenuView.drawRect; do
+    grep "\"name\":\"$span\"" "$TRACE" | sed 's/.*"ts":\([0-9]*\),"dur":\([0-9]*\).*/\1 \2/' | \
+        awk -v settled="$SETTLED" -v idle="$IDLE" -v span="$span" '
+        $1 >= settled { n++; total += $2 }
+        END { printf "  %-22s %5d redraws (%.1f per minute, %.2f ms drawing)\n", span, n, n * 60 / idle, total / 1000 }'
+done
+echo "Trace (open in chrome://tracing or ui.perfetto.dev): $TRACE"
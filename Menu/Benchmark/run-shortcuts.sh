@@ -0,0 +1,53 @@
+#!/bin/sh
+# Global shortcut switch benchmark: runs shortcut-bench on a private Xvfb
+# display, switching between two menus of 200 shortcuts each that share 40,
+# and reports the time per switch on the main thread and until the new keys
+# are grabbed.
+#
+# Usage: run-shortcuts.sh [-n switches] [-s shortcuts] [-o shared] [-d display]
+
+SWITCHES=200
+SHORTCUTS=200
+SHARED=40
+XDISPLAY=:98
+
+while getopts "n:s:o:d:" opt; do
+    case $opt in
+        n) SWITCHES=$OPTARG ;;
+        s) SHORTCUTS=$OPTARG ;;
+        o) SHARED=$OPTARG ;;
+        d) XDISPLAY=$OPTARG ;;
+        *) echo "Usage: $0 [-n switches] [-s shortcuts] [-o shared] [-d display]"; exit 2 ;;
+    esac
+done
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+SHORTCUT_BENCH=${SHORTCUT_BENCH:-$HERE/obj/shortcut-bench}
+
+for tool in Xvfb "$SHORTCUT_BENCH"; do
+    if ! command -v "$tool" >/dev/null 2>&1; then
+        echo "Missing $tool (build Benchmark with make first)"
+        exit 1
+    fi
+done
+
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/shortcut-bench.XXXXXX")
+
+echo "Starting Xvfb on $XDISPLAY..."
+Xvfb "$XDISPLAY" -screen 0 1280x800x24 -nolisten tcp >"$WORK/xvfb.log" 2>&1 &
+XVFB_PID=$!
+sleep 1
+
+# X11ShortcutManager logs every registration, so stderr is kept aside
+DISPLAY=$XDISPLAY "$SHORTCUT_BENCH" -n "$SWITCHES" -s "$SHORTCUTS" -o "$SHARED" 2>"$WORK/bench.log"
+STATUS=$?
+
+kill $XVFB_PID 2>/dev/null
+wait $XVFB_PID 2>/dev/null
+
+if [ $STATUS -ne 0 ]; then
+    grep '^shortcut-bench' "$WORK/bench.log"
+    echo "Benchmark failed; logs are in $WORK"
+    exit 1
+fi
+rm -rf "$WORK"
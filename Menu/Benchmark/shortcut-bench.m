@@ -0,0 +1,242 @@
+/*
+ * shortcut-bench - cost of moving the global shortcuts from one application's
+ * menu to another's
+ *
+ *   shortcut-bench [-n SWITCHES] [-s SHORTCUTS] [-o SHARED]
+ *
+ * Registers the SHORTCUTS shortcuts of one menu with X11ShortcutManager, then
+ * switches to a second menu and back, SWITCHES times in all. SHARED of the
+ * shortcuts are in both menus (Close, Quit, Copy, ...) and stay grabbed
+ * across a switch. A switch is timed from unregistering the old menu until
+ * the manager's event thread has applied the new grabs, and the time spent
+ * on the main thread is reported separately. At the end a second X
+ * connection checks that the last menu's shortcuts are grabbed and the
+ * other menu's are free again.
+ *
+ * Needs an X display; run-shortcuts.sh starts a private Xvfb.
+ */
+
+#import <Foundation/Foundation.h>
+#import <AppKit/AppKit.h>
+#import "../X11ShortcutManager.h"
+#import "../MenuAcceleratorCache.h"
+#import <X11/Xlib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *keys[] = {
+    "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m",
+    "n", "o", "p", "q", "r", "s", "t", "u", "v", "w", "x", "y", "z",
+    "0", "1", "2", "3", "4", "5", "6", "7", "8", "9",
+    "F1", "F2", "F3", "F4", "F5", "F6", "F7", "F8", "F9", "F10", "F11", "F12"
+};
+
+// Registered as direct shortcuts, so each one is grabbed with exactly these modifiers
+static const char *modifiers[] = {
+    "Control", "Control+Shift", "Alt", "Alt+Shift", "Super", "Super+Shift", "Control+Alt", "Control+Super"
+};
+
+#define KEY_COUNT (sizeof(keys) / sizeof(keys[0]))
+#define COMBINATION_COUNT (KEY_COUNT * (sizeof(modifiers) / sizeof(modifiers[0])))
+
+static BOOL grabFailed = NO;
+
+static double nowMilliseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: shortcut-bench [-n SWITCHES] [-s SHORTCUTS] [-o SHARED]\n");
+    exit(2);
+}
+
+static int recordGrabError(Display *display, XErrorEvent *event)
+{
+    (void)display;
+    (void)event;
+    grabFailed = YES;
+    return 0;
+}
+
+@interface ShortcutBenchTarget : NSObject
+- (void)shortcutTriggered:(id)sender;
+@end
+
+@implementation ShortcutBenchTarget
+- (void)shortcutTriggered:(id)sender
+{
+    (void)sender;
+}
+@end
+
+// Menu items for combinations [first, first + count)
+static NSArray *menuItems(NSUInteger first, NSUInteger count)
+{
+    NSMutableArray *items = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = first; i < first + count; i++) {
+        NSString *combo = [NSString stringWithFormat:@"%s+%s", modifiers[i / KEY_COUNT], keys[i % KEY_COUNT]];
+        MenuAccelerator accelerator;
+        if (!MenuAcceleratorParse(combo, MenuAcceleratorSyntaxKeyCombo, &accelerator)) {
+            fprintf(stderr, "shortcut-bench: cannot parse %s\n", [combo UTF8String]);
+            exit(1);
+        }
+        NSMenuItem *item = [[NSMenuItem alloc] initWithTitle:combo
+                                                      action:@selector(shortcutTriggered:)
+                                               keyEquivalent:accelerator.keyEquivalent];
+        [item setKeyEquivalentModifierMask:accelerator.modifierMask];
+        [items addObject:item];
+        [item release];
+    }
+    return items;
+}
+
+// Whether another client can grab the item's shortcut, i.e. the manager has not
+static BOOL isFree(Display *display, NSMenuItem *item)
+{
+    NSUInteger mask = [item keyEquivalentModifierMask];
+    unsigned int modifier = ((mask & NSControlKeyMask) ? ControlMask : 0) |
+                            ((mask & NSAlternateKeyMask) ? Mod1Mask : 0) |
+                            ((mask & NSShiftKeyMask) ? ShiftMask : 0) |
+                            ((mask & NSCommandKeyMask) ? Mod4Mask : 0);
+    KeyCode keycode = XKeysymToKeycode(display, (KeySym)MenuAcceleratorKeysym([item keyEquivalent]));
+    Window root = DefaultRootWindow(display);
+
+    grabFailed = NO;
+    XGrabKey(display, keycode, modifier, root, False, GrabModeAsync, GrabModeAsync);
+    XSync(display, False);
+    BOOL available = !grabFailed;
+    if (available) {
+        XUngrabKey(display, keycode, modifier, root);
+        XSync(display, False);
+    }
+    return available;
+}
+
+static void report(const char *what, double *times, int count)
+{
+    qsort(times, count, sizeof(double), compareDoubles);
+    printf("%-9s n=%-5d p50=%8.3f ms  p95=%8.3f ms  max=%8.3f ms\n", what, count,
+           times[(count - 1) / 2], times[(int)((count - 1) * 0.95)], times[count - 1]);
+}
+
+int main(int argc, char **argv)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    int switches = 200;
+    int shortcuts = 200;
+    int shared = 40;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:o:")) != -1) {
+        if (opt == 'n') {
+            switches = atoi(optarg);
+        } else if (opt == 's') {
+            shortcuts = atoi(optarg);
+        } else if (opt == 'o') {
+            shared = atoi(optarg);
+        } else {
+            usage();
+        }
+    }
+    if (argc - optind != 0 || switches <= 0 || shortcuts <= 0 || shared < 0 || shared > shortcuts) {
+        usage();
+    }
+    if ((NSUInteger)(2 * shortcuts - shared) > COMBINATION_COUNT) {
+        fprintf(stderr, "shortcut-bench: two menus of %d shortcuts sharing %d need more than %lu combinations\n",
+                shortcuts, shared, (unsigned long)COMBINATION_COUNT);
+        return 2;
+    }
+
+    Display *checkDisplay = XOpenDisplay(NULL);
+    if (!checkDisplay) {
+        fprintf(stderr, "shortcut-bench: cannot open the X display\n");
+        return 1;
+    }
+
+    // The second menu starts where the first one's own shortcuts end
+    NSArray *menus[2];
+    menus[0] = menuItems(0, shortcuts);
+    menus[1] = menuItems(shortcuts - shared, shortcuts);
+    ShortcutBenchTarget *target = [[ShortcutBenchTarget alloc] init];
+    X11ShortcutManager *manager = [X11ShortcutManager sharedManager];
+
+    double *mainThread = malloc(sizeof(double) * switches);
+    double *applied = malloc(sizeof(double) * switches);
+    int status = 0;
+    for (int i = 0; i <= switches && status == 0; i++) {
+        NSAutoreleasePool *switchPool = [[NSAutoreleasePool alloc] init];
+        double start = nowMilliseconds();
+
+        [manager unregisterAllShortcuts];
+        for (NSMenuItem *item in menus[i % 2]) {
+            [manager registerDirectShortcutForMenuItem:item target:target action:@selector(shortcutTriggered:)];
+        }
+        [manager applyPendingShortcutChanges];
+        double handedOff = nowMilliseconds();
+        if (![manager waitForShortcutChangesWithTimeout:10.0]) {
+            fprintf(stderr, "shortcut-bench: switch %d was not applied within 10 s\n", i);
+            status = 1;
+        }
+        double done = nowMilliseconds();
+
+        // The first pass grabs a whole menu from nothing; it is not a switch
+        if (i > 0) {
+            mainThread[i - 1] = handedOff - start;
+            applied[i - 1] = done - start;
+        }
+
+        // Run the apply the registrations queued on the main run loop, which
+        // finds nothing left to do, outside the timing
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.001]];
+        [manager waitForShortcutChangesWithTimeout:10.0];
+        [switchPool release];
+    }
+
+    if (status == 0) {
+        NSArray *current = menus[switches % 2];
+        NSArray *other = menus[(switches + 1) % 2];
+        XSetErrorHandler(recordGrabError);
+        for (NSUInteger i = 0; i < (NSUInteger)shortcuts && status == 0; i++) {
+            if (isFree(checkDisplay, [current objectAtIndex:i])) {
+                fprintf(stderr, "shortcut-bench: %s is not grabbed after the last switch\n",
+                        [[[current objectAtIndex:i] title] UTF8String]);
+                status = 1;
+            }
+            // The other menu's own shortcuts come first in the first menu and last in the second
+            NSUInteger own = (switches % 2) ? i : i + shared;
+            if (i < (NSUInteger)(shortcuts - shared) && !isFree(checkDisplay, [other objectAtIndex:own])) {
+                fprintf(stderr, "shortcut-bench: %s is still grabbed after the last switch\n",
+                        [[[other objectAtIndex:own] title] UTF8String]);
+                status = 1;
+            }
+        }
+    }
+
+    if (status == 0) {
+        printf("switches=%d shortcuts=%d shared=%d\n", switches, shortcuts, shared);
+        report("main", mainThread, switches);
+        report("applied", applied, switches);
+        printf("grabs checked ok\n");
+    }
+
+    [manager cleanup];
+    XCloseDisplay(checkDisplay);
+    free(mainThread);
+    free(applied);
+    [target release];
+    [pool release];
+    return status;
+}
@@ -0,0 +1,257 @@
+/*
+ * teardown-bench - builds and releases imported menus, checking that their
+ * routing descriptors go with them
+ *
+ *   teardown-bench [-n MENUS] [-m SUBMENUS] [-i ITEMS] [-a APPS]
+ *
+ * Every menu is a menubar of SUBMENUS submenus of ITEMS items, set up the way
+ * the importers do it: half through DBusMenuActionHandler (dbusmenu item IDs)
+ * and half through GTKActionHandler (org.gtk.Actions names), so each item
+ * carries a MenuItemAction. The menus come from APPS applications in turn,
+ * each with its own bus name and paths. Each menu is released as soon as it
+ * has been built and its descriptors checked, as a rebuilt menu is.
+ *
+ * Reports the time to build and to release a menu, resident memory as the
+ * run goes, and the live NSMenu, NSMenuItem and MenuItemAction instances
+ * before and after; any left over fail the run.
+ *
+ * The handlers get a GNUDBusConnection that was never connected, so nothing
+ * goes to a bus; NSMenu needs an X display, which run-teardown.sh provides.
+ */
+
+#import <Foundation/Foundation.h>
+#import <Foundation/NSDebug.h>
+#import <AppKit/AppKit.h>
+#import "../DBusConnection.h"
+#import "../DBusMenuActionHandler.h"
+#import "../GTKActionHandler.h"
+#import "../MenuItemAction.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__FreeBSD__)
+#include <sys/types.h>
+#include <sys/sysctl.h>
+#include <sys/user.h>
+#endif
+
+#define WARMUP_MENUS 100
+
+static double nowMilliseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: teardown-bench [-n MENUS] [-m SUBMENUS] [-i ITEMS] [-a APPS]\n");
+    exit(2);
+}
+
+// Current resident set size in KiB, 0 if unknown
+static unsigned long residentKilobytes(void)
+{
+#if defined(__FreeBSD__)
+    int mib[4] = {CTL_KERN, KERN_PROC, KERN_PROC_PID, getpid()};
+    struct kinfo_proc proc;
+    size_t size = sizeof(proc);
+    if (sysctl(mib, 4, &proc, &size, NULL, 0) != 0) {
+        return 0;
+    }
+    return (unsigned long)proc.ki_rssize * (unsigned long)(getpagesize() / 1024);
+#else
+    unsigned long pages = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (!statm) {
+        return 0;
+    }
+    if (fscanf(statm, "%lu %lu", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(statm);
+    return resident * (unsigned long)(getpagesize() / 1024);
+#endif
+}
+
+static void countLive(unsigned long counts[3])
+{
+    counts[0] = (unsigned long)GSDebugAllocationCount([NSMenu class]);
+    counts[1] = (unsigned long)GSDebugAllocationCount([NSMenuItem class]);
+    counts[2] = (unsigned long)GSDebugAllocationCount([MenuItemAction class]);
+}
+
+static NSString *serviceNameForApp(int app)
+{
+    return [NSString stringWithFormat:@":1.%d", 100 + app];
+}
+
+// The menubar of application app, built through the handlers as the importers do
+static NSMenu *buildMenu(int app, int submenus, int items, GNUDBusConnection *connection)
+{
+    NSString *serviceName = serviceNameForApp(app);
+    NSString *menuPath = [NSString stringWithFormat:@"/MenuBar/%d", app + 1];
+    NSString *actionPath = [NSString stringWithFormat:@"/org/gtk/Actions/bench/%d", app + 1];
+    BOOL gtk = (app % 2 == 1);
+
+    NSMenu *menubar = [[NSMenu alloc] initWithTitle:@"Menubar"];
+    for (int s = 0; s < submenus; s++) {
+        NSString *title = [NSString stringWithFormat:@"Menu %d", s + 1];
+        NSMenu *submenu = [[NSMenu alloc] initWithTitle:title];
+        for (int i = 0; i < items; i++) {
+            NSMenuItem *item = [[NSMenuItem alloc] initWithTitle:[NSString stringWithFormat:@"Item %d.%d", s + 1, i + 1]
+                                                          action:NULL
+                                                   keyEquivalent:@""];
+            if (gtk) {
+                [GTKActionHandler setupActionForMenuItem:item
+                                              actionName:[NSString stringWithFormat:@"item-%d-%d", s + 1, i + 1]
+                                             serviceName:serviceName
+                                              actionPath:actionPath
+                                          dbusConnection:connection];
+            } else {
+                [item setTag:s * items + i + 1];
+                [DBusMenuActionHandler setupActionForMenuItem:item
+                                                  serviceName:serviceName
+                                                   objectPath:menuPath
+                                               dbusConnection:connection];
+            }
+            [submenu addItem:item];
+            [item release];
+        }
+
+        NSMenuItem *submenuItem = [[NSMenuItem alloc] initWithTitle:title action:NULL keyEquivalent:@""];
+        [submenuItem setSubmenu:submenu];
+        [menubar addItem:submenuItem];
+        [submenuItem release];
+        [submenu release];
+    }
+    return menubar;
+}
+
+// Whether every item of the menu routes to application app
+static BOOL routesToApp(NSMenu *menubar, int app)
+{
+    NSString *serviceName = serviceNameForApp(app);
+    MenuItemActionKind kind = (app % 2 == 1) ? MenuItemActionKindGTK : MenuItemActionKindCanonical;
+
+    for (NSMenuItem *submenuItem in [menubar itemArray]) {
+        for (NSMenuItem *item in [[submenuItem submenu] itemArray]) {
+            MenuItemAction *action = [MenuItemAction actionForMenuItem:item];
+            if (!action || [action kind] != kind || ![[action serviceName] isEqualToString:serviceName] ||
+                (kind == MenuItemActionKindCanonical && [action itemId] != [item tag])) {
+                fprintf(stderr, "teardown-bench: %s routes to %s\n", [[item title] UTF8String],
+                        action ? [[action description] UTF8String] : "nothing");
+                return NO;
+            }
+        }
+    }
+    return YES;
+}
+
+static void report(const char *what, double *times, int count)
+{
+    qsort(times, count, sizeof(double), compareDoubles);
+    printf("%-8s n=%-6d p50=%8.3f ms  p95=%8.3f ms  max=%8.3f ms\n", what, count,
+           times[(count - 1) / 2], times[(int)((count - 1) * 0.95)], times[count - 1]);
+}
+
+int main(int argc, char **argv)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    int menus = 10000;
+    int submenus = 5;
+    int items = 20;
+    int apps = 50;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:m:i:a:")) != -1) {
+        if (opt == 'n') {
+            menus = atoi(optarg);
+        } else if (opt == 'm') {
+            submenus = atoi(optarg);
+        } else if (opt == 'i') {
+            items = atoi(optarg);
+        } else if (opt == 'a') {
+            apps = atoi(optarg);
+        } else {
+            usage();
+        }
+    }
+    if (argc - optind != 0 || menus <= 0 || submenus <= 0 || items <= 0 || apps <= 0) {
+        usage();
+    }
+
+    [NSApplication sharedApplication];
+    GNUDBusConnection *connection = [[GNUDBusConnection alloc] init];
+    GSDebugAllocationActive(YES);
+
+    // Let per-application state, autorelease pools and the allocator settle first
+    for (int i = 0; i < WARMUP_MENUS; i++) {
+        NSAutoreleasePool *menuPool = [[NSAutoreleasePool alloc] init];
+        [buildMenu(i % apps, submenus, items, connection) release];
+        [menuPool release];
+    }
+
+    unsigned long before[3], after[3];
+    countLive(before);
+    unsigned long residentBefore = residentKilobytes();
+    printf("menus=%d submenus=%d items=%d apps=%d (%d items per menu)\n",
+           menus, submenus, items, apps, submenus * (items + 1));
+    printf("rss %8lu KiB after %d warm-up menus\n", residentBefore, WARMUP_MENUS);
+
+    double *built = malloc(sizeof(double) * menus);
+    double *released = malloc(sizeof(double) * menus);
+    int status = 0;
+    double start = nowMilliseconds();
+    for (int i = 0; i < menus && status == 0; i++) {
+        NSAutoreleasePool *menuPool = [[NSAutoreleasePool alloc] init];
+        int app = i % apps;
+
+        double t0 = nowMilliseconds();
+        NSMenu *menubar = buildMenu(app, submenus, items, connection);
+        double t1 = nowMilliseconds();
+        if (!routesToApp(menubar, app)) {
+            status = 1;
+        }
+        double t2 = nowMilliseconds();
+        [menubar release];
+        [menuPool release];
+        double t3 = nowMilliseconds();
+
+        built[i] = t1 - t0;
+        released[i] = t3 - t2;
+        if ((i + 1) % (menus >= 10 ? menus / 10 : 1) == 0) {
+            printf("rss %8lu KiB after %d menus\n", residentKilobytes(), i + 1);
+        }
+    }
+    double elapsed = nowMilliseconds() - start;
+    countLive(after);
+
+    if (status == 0) {
+        report("build", built, menus);
+        report("release", released, menus);
+        printf("throughput %.0f menus/s\n", menus / (elapsed / 1e3));
+        printf("rss growth %ld KiB\n", (long)residentKilobytes() - (long)residentBefore);
+        printf("live NSMenu %lu -> %lu, NSMenuItem %lu -> %lu, MenuItemAction %lu -> %lu\n",
+               before[0], after[0], before[1], after[1], before[2], after[2]);
+        if (after[0] > before[0] || after[1] > before[1] || after[2] > before[2]) {
+            fprintf(stderr, "teardown-bench: released menus left objects behind\n");
+            status = 1;
+        }
+    }
+
+    free(built);
+    free(released);
+    [connection release];
+    [pool release];
+    return status;
+}
@@ -7,6 +7,7 @@
     void *_connection; // DBusConnection pointer (opaque)
     BOOL _connected;
     NSMutableDictionary *_messageHandlers;
+    NSMutableDictionary *_signalHandlers;   // "interface.member" -> handler
 }
 
 + (GNUDBusConnection *)sessionBus;
@@ -17,6 +18,13 @@
 - (BOOL)registerObjectPath:(NSString *)objectPath 
                  interface:(NSString *)interfaceName 
                    handler:(id)handler;
+// Signal subscription: adds a bus match rule and routes matching signals
+// to handler's -handleDBusSignal: with sender/path/interface/member/arguments
+- (BOOL)addMatchRule:(NSString *)matchRule;
+- (void)removeMatchRule:(NSString *)matchRule;
+- (BOOL)registerSignalHandler:(id)handler
+                 forInterface:(NSString *)interfaceName
+                       member:(NSString *)member;
 - (id)callMethod:(NSString *)method
       onService:(NSString *)serviceName
     objectPath:(NSString *)objectPath
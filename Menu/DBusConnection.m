@@ -31,12 +31,16 @@ static GNUDBusConnection *sharedSessionBus = nil;
         _connection = NULL;
         _connected = NO;
         _messageHandlers = [[NSMutableDictionary alloc] init];
+        _signalHandlers = [[NSMutableDictionary alloc] init];
     }
     return self;
 }
 
 - (BOOL)connect
 {
+    // The connection is used from the main, X11 monitor and pre-warm threads
+    dbus_threads_init_default();
+    
     DBusError error;
     dbus_error_init(&error);
     
@@ -137,6 +141,51 @@ static GNUDBusConnection *sharedSessionBus = nil;
     return YES;
 }
 
+- (BOOL)addMatchRule:(NSString *)matchRule
+{
+    if (!_connected || !_connection || !matchRule) {
+        return NO;
+    }
+    
+    DBusError error;
+    dbus_error_init(&error);
+    
+    dbus_bus_add_match((DBusConnectionStruct *)_connection, [matchRule UTF8String], &error);
+    if (dbus_error_is_set(&error)) {
+        NSLog(@"DBusConnection: Failed to add match rule '%@': %s", matchRule, error.message);
+        dbus_error_free(&error);
+        return NO;
+    }
+    
+    NSLog(@"DBusConnection: Added match rule: %@", matchRule);
+    return YES;
+}
+
+- (void)removeMatchRule:(NSString *)matchRule
+{
+    if (!_connected || !_connection || !matchRule) {
+        return;
+    }
+    
+    // Passing NULL for the error makes the call asynchronous; we don't care about the reply
+    dbus_bus_remove_match((DBusConnectionStruct *)_connection, [matchRule UTF8String], NULL);
+}
+
+- (BOOL)registerSignalHandler:(id)handler
+                 forInterface:(NSString *)interfaceName
+                       member:(NSString *)member
+{
+    if (!handler || !interfaceName || !member) {
+        return NO;
+    }
+    
+    NSString *key = [NSString stringWithFormat:@"%@.%@", interfaceName, member];
+    [_signalHandlers setObject:handler forKey:key];
+    
+    NSLog(@"DBusConnection: Registered signal handler for %@", key);
+    return YES;
+}
+
 - (id)callMethod:(NSString *)method
       onService:(NSString *)serviceName
     objectPath:(NSString *)objectPath
@@ -582,6 +631,16 @@ static GNUDBusConnection *sharedSessionBus = nil;
             DBusMessageIter subIter;
             dbus_message_iter_recurse(iter, &subIter);
             
+            // Byte arrays (e.g. dbusmenu icon-data PNGs) are copied out in one piece
+            if (dbus_message_iter_get_element_type(iter) == DBUS_TYPE_BYTE) {
+                const unsigned char *bytes = NULL;
+                int length = 0;
+                dbus_message_iter_get_fixed_array(&subIter, &bytes, &length);
+                NSData *result = [NSData dataWithBytes:bytes length:(length > 0 ? (NSUInteger)length : 0)];
+                NSLog(@"DBusConnection: Parsed byte array of %lu bytes", (unsigned long)[result length]);
+                return result;
+            }
+            
             NSMutableArray *array = [NSMutableArray array];
             do {
                 int subType = dbus_message_iter_get_arg_type(&subIter);
@@ -732,6 +791,11 @@ static GNUDBusConnection *sharedSessionBus = nil;
     NSString *interfaceStr = [NSString stringWithUTF8String:interface];
     NSString *methodStr = [NSString stringWithUTF8String:method];
     
+    if (dbus_message_get_type(message) == DBUS_MESSAGE_TYPE_SIGNAL) {
+        [self handleIncomingSignal:message path:pathStr interface:interfaceStr member:methodStr];
+        return;
+    }
+    
     NSLog(@"DBusConnection: Received method call: %@.%@ on %@", interfaceStr, methodStr, pathStr);
     
     // Handle introspection requests
@@ -758,6 +822,44 @@ static GNUDBusConnection *sharedSessionBus = nil;
     }
 }
 
+- (void)handleIncomingSignal:(DBusMessage*)message
+                        path:(NSString *)pathStr
+                   interface:(NSString *)interfaceStr
+                      member:(NSString *)memberStr
+{
+    NSString *key = [NSString stringWithFormat:@"%@.%@", interfaceStr, memberStr];
+    id handler = [_signalHandlers objectForKey:key];
+    
+    if (!handler || ![handler respondsToSelector:@selector(handleDBusSignal:)]) {
+        // Bus housekeeping signals (NameAcquired etc.) end up here; nothing to do
+        return;
+    }
+    
+    NSMutableArray *arguments = [NSMutableArray array];
+    DBusMessageIter iter;
+    if (dbus_message_iter_init(message, &iter)) {
+        do {
+            if (dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_INVALID) {
+                break;
+            }
+            id value = [self parseDBusMessageIterator:&iter];
+            [arguments addObject:value ? value : [NSNull null]];
+        } while (dbus_message_iter_next(&iter));
+    }
+    
+    const char *sender = dbus_message_get_sender(message);
+    NSDictionary *signalInfo = @{
+        @"sender": sender ? [NSString stringWithUTF8String:sender] : @"",
+        @"path": pathStr,
+        @"interface": interfaceStr,
+        @"member": memberStr,
+        @"arguments": arguments
+    };
+    
+    NSLog(@"DBusConnection: Received signal %@ from %@ on %@", key, [signalInfo objectForKey:@"sender"], pathStr);
+    [handler performSelector:@selector(handleDBusSignal:) withObject:signalInfo];
+}
+
 - (void)handleIntrospectRequest:(DBusMessage*)message
 {
     const char *path = dbus_message_get_path(message);
@@ -826,6 +928,7 @@ static GNUDBusConnection *sharedSessionBus = nil;
 {
     [self disconnect];
     [_messageHandlers release];
+    [_signalHandlers release];
     [super dealloc];
 }
 
@@ -1,9 +1,16 @@
 #import <Foundation/Foundation.h>
 #import <AppKit/AppKit.h>
+#import "MenuCacheManager.h"
 
 @class GNUDBusConnection;
 
-@interface DBusMenuActionHandler : NSObject
+/**
+ * DBusMenuActionHandler
+ *
+ * Activates com.canonical.dbusmenu items. Routing info is stored on each
+ * item as a MenuItemAction, so menus survive snapshotting and persistence.
+ */
+@interface DBusMenuActionHandler : NSObject <MenuSnapshotRestorable>
 
 // Set up action handling for a menu item
 + (void)setupActionForMenuItem:(NSMenuItem *)menuItem
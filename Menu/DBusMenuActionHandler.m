@@ -1,23 +1,10 @@
 #import "DBusMenuActionHandler.h"
 #import "DBusConnection.h"
+#import "MenuItemAction.h"
 #import "X11ShortcutManager.h"
 
-// Static variables to store DBus connection info for menu actions
-static NSMutableDictionary *menuItemToServiceMap = nil;
-static NSMutableDictionary *menuItemToObjectPathMap = nil;
-static NSMutableDictionary *menuItemToConnectionMap = nil;
-
 @implementation DBusMenuActionHandler
 
-+ (void)initialize
-{
-    if (self == [DBusMenuActionHandler class]) {
-        menuItemToServiceMap = [[NSMutableDictionary alloc] init];
-        menuItemToObjectPathMap = [[NSMutableDictionary alloc] init];
-        menuItemToConnectionMap = [[NSMutableDictionary alloc] init];
-    }
-}
-
 + (void)setupActionForMenuItem:(NSMenuItem *)menuItem
                    serviceName:(NSString *)serviceName
                     objectPath:(NSString *)objectPath
@@ -31,11 +18,10 @@ static NSMutableDictionary *menuItemToConnectionMap = nil;
     [menuItem setTarget:[DBusMenuActionHandler class]];
     [menuItem setAction:@selector(menuItemAction:)];
     
-    // Store DBus connection info for this menu item
-    NSString *menuItemKey = [NSString stringWithFormat:@"%p", menuItem];
-    [menuItemToServiceMap setObject:serviceName forKey:menuItemKey];
-    [menuItemToObjectPathMap setObject:objectPath forKey:menuItemKey];
-    [menuItemToConnectionMap setObject:dbusConnection forKey:menuItemKey];
+    // The routing info travels with the item (the tag holds the dbusmenu item ID)
+    [menuItem setRepresentedObject:[MenuItemAction canonicalActionWithItemId:[menuItem tag]
+                                                                 serviceName:serviceName
+                                                                  objectPath:objectPath]];
     
     NSLog(@"DBusMenuActionHandler: Set up action for menu item '%@' (ID=%ld, service=%@, path=%@)", 
           [menuItem title], (long)[menuItem tag], serviceName, objectPath);
@@ -62,20 +48,20 @@ static NSMutableDictionary *menuItemToConnectionMap = nil;
 + (void)menuItemAction:(id)sender
 {
     NSMenuItem *menuItem = (NSMenuItem *)sender;
-    NSString *menuItemKey = [NSString stringWithFormat:@"%p", menuItem];
     
-    // Retrieve DBus connection info for this menu item
-    NSString *serviceName = [menuItemToServiceMap objectForKey:menuItemKey];
-    NSString *objectPath = [menuItemToObjectPathMap objectForKey:menuItemKey];
-    GNUDBusConnection *dbusConnection = [menuItemToConnectionMap objectForKey:menuItemKey];
+    // Retrieve DBus routing info for this menu item
+    MenuItemAction *action = [MenuItemAction actionForMenuItem:menuItem];
+    NSString *serviceName = [action serviceName];
+    NSString *objectPath = [action objectPath];
+    GNUDBusConnection *dbusConnection = [GNUDBusConnection sessionBus];
     
-    if (!serviceName || !objectPath || !dbusConnection) {
+    if (!action || [action kind] != MenuItemActionKindCanonical || !serviceName || !objectPath || !dbusConnection) {
         NSLog(@"DBusMenuActionHandler: ERROR: Missing DBus info for menu item '%@'", [menuItem title]);
-        NSLog(@"DBusMenuActionHandler: Service: %@, Path: %@, Connection: %@", serviceName, objectPath, dbusConnection);
+        NSLog(@"DBusMenuActionHandler: Action: %@, Connection: %@", action, dbusConnection);
         return;
     }
     
-    int menuItemId = [menuItem tag];
+    int menuItemId = (int)[action itemId];
     NSLog(@"DBusMenuActionHandler: Triggering action for menu item '%@' (ID=%d, service=%@, path=%@)", 
           [menuItem title], menuItemId, serviceName, objectPath);
     
@@ -131,11 +117,6 @@ static NSMutableDictionary *menuItemToConnectionMap = nil;
 {
     NSLog(@"DBusMenuActionHandler: Performing cleanup...");
     [[X11ShortcutManager sharedManager] cleanup];
-    
-    // Clean up static dictionaries
-    [menuItemToServiceMap removeAllObjects];
-    [menuItemToObjectPathMap removeAllObjects];
-    [menuItemToConnectionMap removeAllObjects];
 }
 
 @end
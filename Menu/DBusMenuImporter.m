@@ -4,6 +4,8 @@
 #import "MenuUtils.h"
 #import "AppMenuWidget.h"
 #import "MenuCacheManager.h"
+#import "X11DisplayService.h"
+#import "MenuTrace.h"
 #import <dbus/dbus.h>
 
 // Forward declare the sendReply method to avoid header issues
@@ -11,6 +13,11 @@
 - (BOOL)sendReply:(void *)reply;
 @end
 
+@interface DBusMenuImporter (LayoutUpdates)
+- (void)subscribeToLayoutUpdates;
+- (void)applyLayoutUpdatedSignal:(NSDictionary *)signalInfo;
+@end
+
 @implementation DBusMenuImporter
 
 @synthesize appMenuWidget = _appMenuWidget;
@@ -63,6 +70,7 @@
         }
         
         NSLog(@"DBusMenuImporter: Successfully connected to DBus and registered service");
+        [self subscribeToLayoutUpdates];
         [self scanForExistingMenuServices];
         return YES;
     } else {
@@ -72,6 +80,7 @@
         
         // Even if we can't register as the primary service, we can still monitor
         // and display menus by watching for applications that export menus
+        [self subscribeToLayoutUpdates];
         [self scanForExistingMenuServices];
         return YES; // Return YES to continue operating
     }
@@ -93,13 +102,17 @@
     
     // Check enhanced cache first
     MenuCacheManager *cacheManager = [MenuCacheManager sharedManager];
+    MenuTraceTime traceStart = MenuTraceBegin();
     NSMenu *cachedMenu = [cacheManager getCachedMenuForWindow:windowId];
+    MenuTraceEnd("MenuCacheManager.lookup", "cache", traceStart, windowId);
     if (cachedMenu) {
         NSLog(@"DBusMenuImporter: Returning enhanced cached menu for window %lu - re-registering shortcuts", windowId);
         
         // Re-register shortcuts for cached menu since they may have been unregistered
         // when the window lost focus
+        traceStart = MenuTraceBegin();
         [self reregisterShortcutsForMenu:cachedMenu windowId:windowId];
+        MenuTraceEnd("DBusMenuImporter.reregisterShortcuts", "shortcuts", traceStart, windowId);
         
         // Notify cache manager that window became active
         [cacheManager windowBecameActive:windowId];
@@ -150,6 +163,13 @@
             [self registerWindow:windowId serviceName:x11Service objectPath:x11Path];
             serviceName = x11Service;
             objectPath = x11Path;
+            
+            // Another window of the application may have loaded the same export already
+            NSMenu *sharedMenu = [cacheManager getCachedMenuForWindow:windowId];
+            if (sharedMenu) {
+                [self reregisterShortcutsForMenu:sharedMenu windowId:windowId];
+                return sharedMenu;
+            }
         } else {
             NSLog(@"DBusMenuImporter: No service/path found for window %lu (checked both DBus registry and X11 properties)", windowId);
 
@@ -159,7 +179,9 @@
     NSLog(@"DBusMenuImporter: Loading menu for window %lu from %@%@", windowId, serviceName, objectPath);
     
     // Get the menu layout from DBus
+    traceStart = MenuTraceBegin();
     NSMenu *menu = [self loadMenuFromDBus:serviceName objectPath:objectPath];
+    MenuTraceEnd("DBusMenuImporter.loadMenu", "dbus", traceStart, windowId);
     if (menu) {
         // Get application name for enhanced caching
         NSString *appName = [MenuUtils getApplicationNameForWindow:windowId];
@@ -188,11 +210,13 @@
     NSLog(@"DBusMenuImporter: Attempting to load menu from service=%@ path=%@", serviceName, objectPath);
     
     // First, try to introspect the service to see what interfaces it supports
+    MenuTraceTime traceStart = MenuTraceBegin();
     id introspectResult = [_dbusConnection callMethod:@"Introspect"
                                             onService:serviceName
                                            objectPath:objectPath
                                             interface:@"org.freedesktop.DBus.Introspectable"
                                             arguments:nil];
+    MenuTraceEnd("dbus.Introspect", "dbus", traceStart, 0);
     
     if (introspectResult) {
         NSLog(@"DBusMenuImporter: Service introspection successful");
@@ -210,11 +234,13 @@
     
     NSLog(@"DBusMenuImporter: Calling GetLayout with parentId=0, recursionDepth=-1, propertyNames=[]");
     
+    traceStart = MenuTraceBegin();
     id result = [_dbusConnection callMethod:@"GetLayout"
                                   onService:serviceName
                                  objectPath:objectPath
                                   interface:@"com.canonical.dbusmenu"
                                   arguments:arguments];
+    MenuTraceEnd("dbus.GetLayout", "dbus", traceStart, 0);
     
     if (!result) {
         NSLog(@"DBusMenuImporter: Failed to get menu layout from %@%@ - DBus call failed", serviceName, objectPath);
@@ -223,28 +249,17 @@
         return nil;
     }
     
-    NSLog(@"DBusMenuImporter: Received menu layout from %@%@", serviceName, objectPath);
-    NSLog(@"DBusMenuImporter: Raw result object: %@", result);
-    NSLog(@"DBusMenuImporter: Raw result class: %@", [result class]);
-    NSLog(@"DBusMenuImporter: Raw result description: %@", [result description]);
-    
-    // Log the result in detail
-    if ([result respondsToSelector:@selector(count)]) {
-        NSLog(@"DBusMenuImporter: Result has count: %lu", (unsigned long)[result count]);
-    }
-    if ([result respondsToSelector:@selector(objectAtIndex:)] && [result count] > 0) {
-        for (NSUInteger i = 0; i < [result count]; i++) {
-            id item = [result objectAtIndex:i];
-            NSLog(@"DBusMenuImporter: Result[%lu]: %@ (%@)", i, item, [item class]);
-        }
-    }
+    // The reply is not logged: formatting a large layout costs more than parsing it
+    NSLog(@"DBusMenuImporter: Received menu layout from %@%@ (%@)", serviceName, objectPath, [result class]);
     
     // Parse the menu structure and create NSMenu
     // The result should be a structure containing menu items with their properties
+    traceStart = MenuTraceBegin();
     NSMenu *menu = [DBusMenuParser parseMenuFromDBusResult:result 
                                                serviceName:serviceName 
                                                 objectPath:objectPath 
                                             dbusConnection:_dbusConnection];
+    MenuTraceEnd("DBusMenuParser.parse", "parse", traceStart, 0);
     
     if (!menu) {
         // Fallback: create a simple placeholder menu if parsing fails
@@ -312,9 +327,11 @@
     [_registeredWindows setObject:serviceName forKey:windowKey];
     [_windowMenuPaths setObject:objectPath forKey:windowKey];
     
-    // Clear cached menu for this window in both legacy and enhanced cache
+    // Clear cached menu for this window in both legacy and enhanced cache, then
+    // point it at the export's menu, which other windows may have loaded already
     [_menuCache removeObjectForKey:windowKey];
     [[MenuCacheManager sharedManager] invalidateCacheForWindow:windowId];
+    [[MenuCacheManager sharedManager] attachWindow:windowId serviceName:serviceName objectPath:objectPath];
     
     // Set X11 properties for Chrome/Firefox compatibility
     // This is the key fix that was missing - these properties tell applications
@@ -533,6 +550,12 @@
     NSArray *allWindows = [MenuUtils getAllWindows];
     int foundMenus = 0;
     
+    // Fetch both menu properties of every window in one pipelined batch
+    [[X11DisplayService sharedService] prefetchProperties:[NSArray arrayWithObjects:
+                                                           @"_KDE_NET_WM_APPMENU_SERVICE_NAME",
+                                                           @"_KDE_NET_WM_APPMENU_OBJECT_PATH", nil]
+                                               forWindows:allWindows];
+    
     for (NSNumber *windowIdNum in allWindows) {
         unsigned long windowId = [windowIdNum unsignedLongValue];
         
@@ -695,6 +718,37 @@
     }
 }
 
+#pragma mark - com.canonical.dbusmenu.LayoutUpdated
+
+- (void)subscribeToLayoutUpdates
+{
+    // Windows of one application usually share an export; a root layout change
+    // drops its cached menu once for all of them
+    [_dbusConnection addMatchRule:@"type='signal',interface='com.canonical.dbusmenu',member='LayoutUpdated'"];
+    [_dbusConnection registerSignalHandler:self forInterface:@"com.canonical.dbusmenu" member:@"LayoutUpdated"];
+}
+
+- (void)handleDBusSignal:(NSDictionary *)signalInfo
+{
+    // Delivered on the thread pumping the bus; the cache is invalidated on the main thread
+    [self performSelectorOnMainThread:@selector(applyLayoutUpdatedSignal:)
+                           withObject:signalInfo
+                        waitUntilDone:NO];
+}
+
+- (void)applyLayoutUpdatedSignal:(NSDictionary *)signalInfo
+{
+    // LayoutUpdated(u revision, i parent): submenus (parent != 0) are refreshed
+    // on AboutToShow anyway, only a changed root invalidates the cached menu
+    NSArray *arguments = [signalInfo objectForKey:@"arguments"];
+    if ([arguments count] >= 2 && [[arguments objectAtIndex:1] intValue] != 0) {
+        return;
+    }
+    
+    [[MenuCacheManager sharedManager] invalidateCacheForService:[signalInfo objectForKey:@"sender"]
+                                                     objectPath:[signalInfo objectForKey:@"path"]];
+}
+
 - (void)dealloc
 {
     [_cleanupTimer invalidate];
@@ -2,6 +2,7 @@
 #import <AppKit/AppKit.h>
 
 @class GNUDBusConnection;
+@class MenuLayout;
 
 @interface DBusMenuParser : NSObject
 
@@ -27,6 +28,17 @@
                                   objectPath:(NSString *)objectPath 
                               dbusConnection:(GNUDBusConnection *)dbusConnection;
 
+// Materialize NSMenus from a layout built by MenuLayout (main thread)
++ (NSMenu *)menuFromLayout:(MenuLayout *)layout 
+               serviceName:(NSString *)serviceName 
+                objectPath:(NSString *)objectPath 
+            dbusConnection:(GNUDBusConnection *)dbusConnection;
++ (NSMenuItem *)menuItemAtIndex:(uint32_t)index 
+                       ofLayout:(MenuLayout *)layout 
+                    serviceName:(NSString *)serviceName 
+                     objectPath:(NSString *)objectPath 
+                 dbusConnection:(GNUDBusConnection *)dbusConnection;
+
 // Convert DBus properties array to NSDictionary
 + (NSDictionary *)convertPropertiesToDictionary:(id)propertiesObj;
 
@@ -2,6 +2,7 @@
 #import <AppKit/AppKit.h>
 
 @class GNUDBusConnection;
+@class MenuLayout;
 
 // MARK: - DBusSubmenuDelegate Interface
 
@@ -11,6 +12,7 @@
     NSString *_objectPath;
     GNUDBusConnection *_dbusConnection;
     NSNumber *_itemId;
+    MenuLayout *_layout;            // Children as of the last refresh, to diff the next one against
 }
 
 - (id)initWithServiceName:(NSString *)serviceName 
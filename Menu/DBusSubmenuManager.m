@@ -1,6 +1,7 @@
 #import "DBusSubmenuManager.h"
 #import "DBusConnection.h"
 #import "DBusMenuParser.h"
+#import "MenuLayout.h"
 
 // Static variables for submenu management
 static NSMutableDictionary *submenuDelegates = nil;
@@ -111,6 +112,7 @@ static NSMutableSet *refreshedByAboutToShow = nil;
     [_objectPath release];
     [_dbusConnection release];
     [_itemId release];
+    [_layout release];
     [super dealloc];
 }
 
@@ -234,7 +236,9 @@ static NSMutableSet *refreshedByAboutToShow = nil;
     NSLog(@"DBusSubmenuDelegate: DBus connection: %@", _dbusConnection);
     
     // Call GetLayout specifically for this submenu item with optimized property filtering
-    NSArray *essentialProperties = [NSArray arrayWithObjects:@"label", @"enabled", @"visible", @"type", nil];
+    // Icons are included so refreshed items keep them; MenuIconCache makes repeats free to decode
+    NSArray *essentialProperties = [NSArray arrayWithObjects:@"label", @"enabled", @"visible", @"type",
+                                    @"icon-name", @"icon-data", nil];
     NSArray *arguments = [NSArray arrayWithObjects:
                          _itemId,                   // parentId (this submenu's ID)
                          [NSNumber numberWithInt:2], // recursionDepth (2 levels for lazy loading)
@@ -262,7 +266,7 @@ static NSMutableSet *refreshedByAboutToShow = nil;
         return;
     }
     
-    NSLog(@"DBusSubmenuDelegate: Received updated submenu layout: %@ (%@)", result, [result class]);
+    NSLog(@"DBusSubmenuDelegate: Received updated submenu layout for item ID %@", _itemId);
     
     // Parse the result and update the submenu
     if ([result isKindOfClass:[NSArray class]] && [result count] >= 2) {
@@ -274,78 +278,48 @@ static NSMutableSet *refreshedByAboutToShow = nil;
         id layoutItem = [resultArray objectAtIndex:1];
         
         NSLog(@"DBusSubmenuDelegate: GetLayout revision: %@", revision);
-        NSLog(@"DBusSubmenuDelegate: GetLayout layout item: %@ (%@)", layoutItem, [layoutItem class]);
         
-        // Parse the layout item to get the children
-        if ([layoutItem isKindOfClass:[NSArray class]] && [layoutItem count] >= 3) {
-            NSArray *layoutArray = (NSArray *)layoutItem;
-            NSLog(@"DBusSubmenuDelegate: Layout item is array with %lu elements", (unsigned long)[layoutArray count]);
-            
-            NSNumber *layoutItemId = [layoutArray objectAtIndex:0];
-            id layoutProperties = [layoutArray objectAtIndex:1];
-            id childrenObj = [layoutArray objectAtIndex:2];
-            
-            NSLog(@"DBusSubmenuDelegate: Layout item ID: %@", layoutItemId);
-            NSLog(@"DBusSubmenuDelegate: Layout properties: %@ (%@)", layoutProperties, [layoutProperties class]);
-            NSLog(@"DBusSubmenuDelegate: Children object: %@ (%@)", childrenObj, [childrenObj class]);
-            
-            NSArray *children = nil;
-            if ([childrenObj isKindOfClass:[NSArray class]]) {
-                children = (NSArray *)childrenObj;
-            } else {
-                NSLog(@"DBusSubmenuDelegate: ERROR: Children object is not an array: %@ (%@)", 
-                      childrenObj, [childrenObj class]);
-                children = [NSArray array];
+        // Parse the layout item to get the children, then compare with what the submenu shows
+        MenuLayout *layout = [MenuLayout layoutWithDBusMenuItem:layoutItem];
+        if (layout) {
+            const MenuLayoutItem *root = [layout root];
+            NSIndexSet *changed = nil;
+            if ((NSUInteger)[submenu numberOfItems] == root->childCount) {
+                changed = [layout changedTopLevelItemsFromLayout:_layout];
             }
             
-            NSLog(@"DBusSubmenuDelegate: ===== UPDATING SUBMENU WITH %lu CHILDREN =====", (unsigned long)[children count]);
-            
-            // Store current items count for comparison
-            NSUInteger oldItemCount = [[submenu itemArray] count];
-            NSLog(@"DBusSubmenuDelegate: Clearing %lu existing submenu items", oldItemCount);
-            
-            // Clear existing submenu items
-            [submenu removeAllItems];
-            NSLog(@"DBusSubmenuDelegate: Submenu cleared, now has %lu items", (unsigned long)[[submenu itemArray] count]);
-            
-            // Create menu items from the updated children
-            NSUInteger newItemCount = 0;
-            NSUInteger failedItems = 0;
-            for (NSUInteger childIndex = 0; childIndex < [children count]; childIndex++) {
-                id childItem = [children objectAtIndex:childIndex];
-                NSLog(@"DBusSubmenuDelegate: Processing refreshed child %lu: %@ (%@)", 
-                      childIndex, childItem, [childItem class]);
-                
-                NSMenuItem *childMenuItem = [DBusMenuParser createMenuItemFromLayoutItem:childItem 
-                                                                             serviceName:_serviceName 
-                                                                              objectPath:_objectPath 
-                                                                          dbusConnection:_dbusConnection];
-                if (childMenuItem) {
-                    [submenu addItem:childMenuItem];
-                    newItemCount++;
-                    NSLog(@"DBusSubmenuDelegate: Successfully added refreshed child menu item '%@' (total: %lu)", 
-                          [childMenuItem title], newItemCount);
-                } else {
-                    failedItems++;
-                    NSLog(@"DBusSubmenuDelegate: ERROR: Failed to create child menu item %lu from layout", childIndex);
+            if (changed && [changed count] == 0) {
+                NSLog(@"DBusSubmenuDelegate: Submenu %@ unchanged (%u items), keeping existing items", 
+                      _itemId, root->childCount);
+            } else if (changed) {
+                // Same items in the same places; only replace the ones that changed
+                NSUInteger index = [changed firstIndex];
+                while (index != NSNotFound) {
+                    NSMenuItem *childMenuItem = [DBusMenuParser menuItemAtIndex:root->firstChild + (uint32_t)index 
+                                                                       ofLayout:layout 
+                                                                    serviceName:_serviceName 
+                                                                     objectPath:_objectPath 
+                                                                 dbusConnection:_dbusConnection];
+                    [submenu removeItemAtIndex:index];
+                    [submenu insertItem:childMenuItem atIndex:index];
+                    index = [changed indexGreaterThanIndex:index];
                 }
-            }
-            
-            NSLog(@"DBusSubmenuDelegate: ===== SUBMENU REFRESH SUMMARY =====");
-            NSLog(@"DBusSubmenuDelegate: %lu old items -> %lu new items", oldItemCount, newItemCount);
-            NSLog(@"DBusSubmenuDelegate: %lu items created successfully, %lu failed", newItemCount, failedItems);
-            NSLog(@"DBusSubmenuDelegate: Final submenu item count: %lu", (unsigned long)[[submenu itemArray] count]);
-            
-            // Log the final menu items
-            if (newItemCount > 0) {
-                NSLog(@"DBusSubmenuDelegate: Final submenu items:");
-                NSArray *finalItems = [submenu itemArray];
-                for (NSUInteger i = 0; i < [finalItems count]; i++) {
-                    NSMenuItem *item = [finalItems objectAtIndex:i];
-                    NSLog(@"DBusSubmenuDelegate:   [%lu] '%@' (submenu: %@)", 
-                          i, [item title], [item submenu] ? @"YES" : @"NO");
+                NSLog(@"DBusSubmenuDelegate: Replaced %lu of %u items in submenu %@", 
+                      (unsigned long)[changed count], root->childCount, _itemId);
+            } else {
+                [submenu removeAllItems];
+                for (uint32_t i = 0; i < root->childCount; i++) {
+                    [submenu addItem:[DBusMenuParser menuItemAtIndex:root->firstChild + i 
+                                                            ofLayout:layout 
+                                                         serviceName:_serviceName 
+                                                          objectPath:_objectPath 
+                                                      dbusConnection:_dbusConnection]];
                 }
+                NSLog(@"DBusSubmenuDelegate: Rebuilt submenu %@ with %u items", _itemId, root->childCount);
             }
+            
+            [_layout release];
+            _layout = [layout retain];
         } else {
             NSLog(@"DBusSubmenuDelegate: ERROR: Invalid layout item structure: %@ (count: %lu)", 
                   layoutItem, [layoutItem isKindOfClass:[NSArray class]] ? (unsigned long)[layoutItem count] : 0UL);
@@ -1,5 +1,6 @@
 #import <Foundation/Foundation.h>
 #import <AppKit/AppKit.h>
+#import "MenuCacheManager.h"
 
 @class GNUDBusConnection;
 
@@ -8,8 +9,9 @@
  * 
  * Handles GTK-style action activation using org.gtk.Actions interface.
  * This is separate from the Canonical dbusmenu action handling.
+ * Routing info is stored on each item as a MenuItemAction, so menus survive snapshotting.
  */
-@interface GTKActionHandler : NSObject
+@interface GTKActionHandler : NSObject <MenuSnapshotRestorable>
 
 // Set up action handling for a GTK menu item (full method)
 + (void)setupActionForMenuItem:(NSMenuItem *)menuItem
@@ -30,6 +32,15 @@
                       actionPath:(NSString *)actionPath
                   dbusConnection:(GNUDBusConnection *)dbusConnection;
 
+// Per-service action table (one DescribeAll per action group, kept current via Actions.Changed)
++ (NSDictionary *)actionTableForService:(NSString *)serviceName
+                             actionPath:(NSString *)actionPath
+                         dbusConnection:(GNUDBusConnection *)dbusConnection;
++ (void)forgetActionTableForService:(NSString *)serviceName actionPath:(NSString *)actionPath;
+
+// org.gtk.Actions.Changed handling (delivered by GNUDBusConnection)
++ (void)handleDBusSignal:(NSDictionary *)signalInfo;
+
 // Cleanup method
 + (void)cleanup;
 
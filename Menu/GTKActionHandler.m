@@ -1,12 +1,12 @@
 #import "GTKActionHandler.h"
 #import "DBusConnection.h"
+#import "MenuItemAction.h"
 #import "X11ShortcutManager.h"
 
-// Static storage for GTK action information
-static NSMutableDictionary *gtkMenuItemToActionMap = nil;
-static NSMutableDictionary *gtkMenuItemToServiceMap = nil;
-static NSMutableDictionary *gtkMenuItemToActionPathMap = nil;
-static NSMutableDictionary *gtkMenuItemToConnectionMap = nil;
+// Action tables: "service|actionPath" -> immutable (action name -> @{enabled, parameter_type, state})
+static NSMutableDictionary *gtkActionTables = nil;
+static NSMutableSet *gtkActionGroupsWithoutDescribeAll = nil;
+static BOOL gtkActionsChangedSubscribed = NO;
 
 @implementation GTKActionHandler
 
@@ -19,10 +19,8 @@ static NSMutableSet *_servicesWithoutDescribeAction = nil;
     if (self == [GTKActionHandler class]) {
         _servicesWithDescribeAction = [[NSMutableSet alloc] init];
         _servicesWithoutDescribeAction = [[NSMutableSet alloc] init];
-        gtkMenuItemToActionMap = [[NSMutableDictionary alloc] init];
-        gtkMenuItemToServiceMap = [[NSMutableDictionary alloc] init];
-        gtkMenuItemToActionPathMap = [[NSMutableDictionary alloc] init];
-        gtkMenuItemToConnectionMap = [[NSMutableDictionary alloc] init];
+        gtkActionTables = [[NSMutableDictionary alloc] init];
+        gtkActionGroupsWithoutDescribeAll = [[NSMutableSet alloc] init];
         
         NSLog(@"GTKActionHandler: Initialized GTK action handler");
     }
@@ -42,16 +40,10 @@ static NSMutableSet *_servicesWithoutDescribeAction = nil;
     [menuItem setTarget:[GTKActionHandler class]];
     [menuItem setAction:@selector(gtkMenuItemAction:)];
     
-    // Store the action name in the menu item for later retrieval during re-registration
-    [menuItem setRepresentedObject:actionName];
-    
-    // Store GTK action information for this menu item using a stable key
-    // Use both title and action name to create a unique identifier
-    NSString *menuItemKey = [NSString stringWithFormat:@"%@|%@", [menuItem title], actionName];
-    [gtkMenuItemToActionMap setObject:actionName forKey:menuItemKey];
-    [gtkMenuItemToServiceMap setObject:serviceName forKey:menuItemKey];
-    [gtkMenuItemToActionPathMap setObject:actionPath forKey:menuItemKey];
-    [gtkMenuItemToConnectionMap setObject:dbusConnection forKey:menuItemKey];
+    // The routing info travels with the item (also read back during shortcut re-registration)
+    [menuItem setRepresentedObject:[MenuItemAction gtkActionWithName:actionName
+                                                         serviceName:serviceName
+                                                          actionPath:actionPath]];
     
     NSLog(@"GTKActionHandler: Set up GTK action for menu item '%@' (action=%@, service=%@, path=%@)", 
           [menuItem title], actionName, serviceName, actionPath);
@@ -100,6 +92,20 @@ static NSMutableSet *_servicesWithoutDescribeAction = nil;
         }
     }
     
+    // Prefer the cached action table: one DescribeAll per action group covers every item
+    NSDictionary *actionTable = [self actionTableForService:serviceName
+                                                 actionPath:actionPath
+                                             dbusConnection:dbusConnection];
+    if (actionTable) {
+        NSDictionary *actionDesc = [self describeAction:actionName inTable:actionTable];
+        if (actionDesc) {
+            [self applyActionDescription:actionDesc toMenuItem:menuItem];
+        } else {
+            [menuItem setEnabled:YES];
+        }
+        return;
+    }
+    
     // Only query action state for known stateful actions to reduce D-Bus calls
     // and prevent unity-gtk-action-group warnings
     BOOL isKnownStatefulAction = [actionName containsString:@"toggle"] || 
@@ -153,40 +159,14 @@ static NSMutableSet *_servicesWithoutDescribeAction = nil;
     
     NSLog(@"GTKActionHandler: Menu item action triggered for '%@'", [menuItem title]);
     
-    // Try to find the action by searching through stored actions
-    NSString *actionName = nil;
-    NSString *serviceName = nil;
-    NSString *actionPath = nil;
-    GNUDBusConnection *dbusConnection = nil;
-    
-    // Search through all stored actions to find one that matches this menu item
-    for (NSString *key in [gtkMenuItemToActionMap allKeys]) {
-        NSArray *keyParts = [key componentsSeparatedByString:@"|"];
-        if ([keyParts count] == 2) {
-            NSString *storedTitle = [keyParts objectAtIndex:0];
-            
-            // Match by title (remove underscore accelerators for comparison)
-            NSString *cleanMenuTitle = [[menuItem title] stringByReplacingOccurrencesOfString:@"_" withString:@""];
-            NSString *cleanStoredTitle = [storedTitle stringByReplacingOccurrencesOfString:@"_" withString:@""];
-            
-            if ([cleanMenuTitle isEqualToString:cleanStoredTitle]) {
-                actionName = [gtkMenuItemToActionMap objectForKey:key];
-                serviceName = [gtkMenuItemToServiceMap objectForKey:key];
-                actionPath = [gtkMenuItemToActionPathMap objectForKey:key];
-                dbusConnection = [gtkMenuItemToConnectionMap objectForKey:key];
-                NSLog(@"GTKActionHandler: Found matching action '%@' for menu item '%@'", actionName, [menuItem title]);
-                break;
-            }
-        }
-    }
+    MenuItemAction *action = [MenuItemAction actionForMenuItem:menuItem];
+    NSString *actionName = [action actionName];
+    NSString *serviceName = [action serviceName];
+    NSString *actionPath = [action objectPath];
+    GNUDBusConnection *dbusConnection = [GNUDBusConnection sessionBus];
     
     if (!actionName || !serviceName || !actionPath || !dbusConnection) {
-        NSLog(@"GTKActionHandler: ERROR: Missing GTK action info for menu item '%@'", [menuItem title]);
-        NSLog(@"GTKActionHandler: actionName=%@, serviceName=%@, actionPath=%@, dbusConnection=%@", 
-              actionName, serviceName, actionPath, dbusConnection);
-        
-        // Debug: show all stored keys
-        NSLog(@"GTKActionHandler: Available stored keys: %@", [gtkMenuItemToActionMap allKeys]);
+        NSLog(@"GTKActionHandler: ERROR: Missing GTK action info for menu item '%@' (%@)", [menuItem title], action);
         return;
     }
     
@@ -308,6 +288,15 @@ static NSMutableSet *_servicesWithoutDescribeAction = nil;
         return nil;
     }
     
+    // Served from the action table when the group supports DescribeAll
+    NSDictionary *actionTable = [self actionTableForService:serviceName
+                                                 actionPath:actionPath
+                                             dbusConnection:dbusConnection];
+    if (actionTable) {
+        NSDictionary *actionDesc = [self describeAction:actionName inTable:actionTable];
+        return actionDesc ?: @{@"enabled": @YES};
+    }
+    
     // Check if we already know this service doesn't support action queries
     @synchronized(_servicesWithoutDescribeAction) {
         if ([_servicesWithoutDescribeAction containsObject:serviceName]) {
@@ -388,21 +377,276 @@ static NSMutableSet *_servicesWithoutDescribeAction = nil;
     return @{@"enabled": @YES};
 }
 
+#pragma mark - Action tables
+
++ (NSString *)actionTableKeyForService:(NSString *)serviceName actionPath:(NSString *)actionPath
+{
+    return [NSString stringWithFormat:@"%@|%@", serviceName, actionPath];
+}
+
+// Convert a (bgav) action description into @{enabled, parameter_type, state}
++ (NSDictionary *)actionDescriptionFromStruct:(id)descStruct
+{
+    if (![descStruct isKindOfClass:[NSArray class]] || [descStruct count] < 3) {
+        return nil;
+    }
+    
+    NSMutableDictionary *actionDesc = [NSMutableDictionary dictionary];
+    id enabled = [descStruct objectAtIndex:0];
+    [actionDesc setObject:([enabled isKindOfClass:[NSNumber class]] ? enabled : @YES) forKey:@"enabled"];
+    
+    id paramType = [descStruct objectAtIndex:1];
+    if ([paramType isKindOfClass:[NSString class]]) {
+        [actionDesc setObject:paramType forKey:@"parameter_type"];
+    }
+    
+    id stateArray = [descStruct objectAtIndex:2];
+    if ([stateArray isKindOfClass:[NSArray class]] && [stateArray count] > 0) {
+        [actionDesc setObject:[stateArray objectAtIndex:0] forKey:@"state"];
+    }
+    
+    return actionDesc;
+}
+
+// D-Bus dictionaries arrive either as an NSDictionary or as an array of single-entry dictionaries
++ (NSDictionary *)dictionaryFromDBusDictionary:(id)dict
+{
+    if ([dict isKindOfClass:[NSDictionary class]]) {
+        return (NSDictionary *)dict;
+    }
+    
+    NSMutableDictionary *flattened = [NSMutableDictionary dictionary];
+    if ([dict isKindOfClass:[NSArray class]]) {
+        for (id entry in (NSArray *)dict) {
+            if ([entry isKindOfClass:[NSDictionary class]]) {
+                [flattened addEntriesFromDictionary:(NSDictionary *)entry];
+            }
+        }
+    }
+    return flattened;
+}
+
++ (NSDictionary *)describeAction:(NSString *)actionName inTable:(NSDictionary *)actionTable
+{
+    NSDictionary *actionDesc = [actionTable objectForKey:actionName];
+    if (!actionDesc) {
+        // Menus reference actions with a group prefix ("app.", "win.", "unity.")
+        // while the exported group itself uses the bare name
+        NSRange dot = [actionName rangeOfString:@"."];
+        if (dot.location != NSNotFound) {
+            actionDesc = [actionTable objectForKey:[actionName substringFromIndex:NSMaxRange(dot)]];
+        }
+    }
+    return actionDesc;
+}
+
++ (void)applyActionDescription:(NSDictionary *)actionDesc toMenuItem:(NSMenuItem *)menuItem
+{
+    NSNumber *enabled = [actionDesc objectForKey:@"enabled"];
+    if (enabled) {
+        [menuItem setEnabled:[enabled boolValue]];
+    }
+    
+    // Boolean state means a toggle; other state types (radio targets) are left alone
+    id state = [actionDesc objectForKey:@"state"];
+    if (state && [state isKindOfClass:[NSNumber class]]) {
+        [menuItem setState:[state boolValue] ? NSOnState : NSOffState];
+    }
+}
+
++ (NSDictionary *)actionTableForService:(NSString *)serviceName
+                             actionPath:(NSString *)actionPath
+                         dbusConnection:(GNUDBusConnection *)dbusConnection
+{
+    if (!serviceName || !actionPath || !dbusConnection) {
+        return nil;
+    }
+    
+    NSString *tableKey = [self actionTableKeyForService:serviceName actionPath:actionPath];
+    @synchronized(gtkActionTables) {
+        NSDictionary *actionTable = [gtkActionTables objectForKey:tableKey];
+        if (actionTable) {
+            return [[actionTable retain] autorelease];
+        }
+        if ([gtkActionGroupsWithoutDescribeAll containsObject:tableKey]) {
+            return nil;
+        }
+    }
+    
+    // Subscribe before fetching so no change between the reply and the match rule is lost
+    @synchronized(gtkActionTables) {
+        if (!gtkActionsChangedSubscribed) {
+            [dbusConnection addMatchRule:@"type='signal',interface='org.gtk.Actions',member='Changed'"];
+            [dbusConnection registerSignalHandler:[GTKActionHandler class]
+                                     forInterface:@"org.gtk.Actions"
+                                           member:@"Changed"];
+            gtkActionsChangedSubscribed = YES;
+        }
+    }
+    
+    // DescribeAll() -> a{s(bgav)}
+    id result = nil;
+    @try {
+        result = [dbusConnection callMethod:@"DescribeAll"
+                                  onService:serviceName
+                                 objectPath:actionPath
+                                  interface:@"org.gtk.Actions"
+                                  arguments:nil];
+    }
+    @catch (NSException *exception) {
+        result = nil;
+    }
+    
+    if (!result || !([result isKindOfClass:[NSArray class]] || [result isKindOfClass:[NSDictionary class]])) {
+        NSLog(@"GTKActionHandler: DescribeAll not available on %@%@, using per-action queries",
+              serviceName, actionPath);
+        @synchronized(gtkActionTables) {
+            [gtkActionGroupsWithoutDescribeAll addObject:tableKey];
+        }
+        return nil;
+    }
+    
+    NSMutableDictionary *actionTable = [NSMutableDictionary dictionary];
+    NSDictionary *descriptions = [self dictionaryFromDBusDictionary:result];
+    for (id actionName in descriptions) {
+        NSDictionary *actionDesc = [self actionDescriptionFromStruct:[descriptions objectForKey:actionName]];
+        if ([actionName isKindOfClass:[NSString class]] && actionDesc) {
+            [actionTable setObject:actionDesc forKey:actionName];
+        }
+    }
+    
+    NSLog(@"GTKActionHandler: Cached %lu actions from %@%@ with one DescribeAll call",
+          (unsigned long)[actionTable count], serviceName, actionPath);
+    
+    // Tables are immutable snapshots; Actions.Changed swaps in a new one, so readers never copy
+    NSDictionary *snapshot = [[actionTable copy] autorelease];
+    @synchronized(gtkActionTables) {
+        [gtkActionTables setObject:snapshot forKey:tableKey];
+    }
+    return snapshot;
+}
+
++ (void)forgetActionTableForService:(NSString *)serviceName actionPath:(NSString *)actionPath
+{
+    if (!serviceName || !actionPath) {
+        return;
+    }
+    
+    NSString *tableKey = [self actionTableKeyForService:serviceName actionPath:actionPath];
+    @synchronized(gtkActionTables) {
+        [gtkActionTables removeObjectForKey:tableKey];
+        [gtkActionGroupsWithoutDescribeAll removeObject:tableKey];
+    }
+}
+
++ (void)handleDBusSignal:(NSDictionary *)signalInfo
+{
+    // org.gtk.Actions.Changed(as removals, a{sb} enable_changes, a{sv} state_changes, a{s(bgav)} additions)
+    NSArray *arguments = [signalInfo objectForKey:@"arguments"];
+    if ([arguments count] < 4) {
+        return;
+    }
+    
+    NSString *tableKey = [self actionTableKeyForService:[signalInfo objectForKey:@"sender"]
+                                             actionPath:[signalInfo objectForKey:@"path"]];
+    
+    @synchronized(gtkActionTables) {
+        NSDictionary *currentTable = [gtkActionTables objectForKey:tableKey];
+        if (!currentTable) {
+            return;
+        }
+        NSMutableDictionary *actionTable = [[currentTable mutableCopy] autorelease];
+        
+        id removals = [arguments objectAtIndex:0];
+        if ([removals isKindOfClass:[NSArray class]]) {
+            for (id actionName in (NSArray *)removals) {
+                if ([actionName isKindOfClass:[NSString class]]) {
+                    [actionTable removeObjectForKey:actionName];
+                }
+            }
+        }
+        
+        NSDictionary *enableChanges = [self dictionaryFromDBusDictionary:[arguments objectAtIndex:1]];
+        for (id actionName in enableChanges) {
+            NSDictionary *actionDesc = [actionTable objectForKey:actionName];
+            id enabled = [enableChanges objectForKey:actionName];
+            if (actionDesc && [enabled isKindOfClass:[NSNumber class]]) {
+                NSMutableDictionary *updated = [[actionDesc mutableCopy] autorelease];
+                [updated setObject:enabled forKey:@"enabled"];
+                [actionTable setObject:updated forKey:actionName];
+            }
+        }
+        
+        NSDictionary *stateChanges = [self dictionaryFromDBusDictionary:[arguments objectAtIndex:2]];
+        for (id actionName in stateChanges) {
+            NSDictionary *actionDesc = [actionTable objectForKey:actionName];
+            if (actionDesc) {
+                NSMutableDictionary *updated = [[actionDesc mutableCopy] autorelease];
+                [updated setObject:[stateChanges objectForKey:actionName] forKey:@"state"];
+                [actionTable setObject:updated forKey:actionName];
+            }
+        }
+        
+        NSDictionary *additions = [self dictionaryFromDBusDictionary:[arguments objectAtIndex:3]];
+        for (id actionName in additions) {
+            NSDictionary *actionDesc = [self actionDescriptionFromStruct:[additions objectForKey:actionName]];
+            if ([actionName isKindOfClass:[NSString class]] && actionDesc) {
+                [actionTable setObject:actionDesc forKey:actionName];
+            }
+        }
+        
+        [gtkActionTables setObject:[[actionTable copy] autorelease] forKey:tableKey];
+        
+        NSLog(@"GTKActionHandler: Applied org.gtk.Actions.Changed to %@ (%lu actions)",
+              tableKey, (unsigned long)[actionTable count]);
+    }
+}
+
+// Menu items target this class, so NSMenu validation reads enabled/state from the action table
+// each time a menu is updated; Actions.Changed therefore reaches already-built items too
++ (BOOL)validateMenuItem:(NSMenuItem *)menuItem
+{
+    MenuItemAction *action = [MenuItemAction actionForMenuItem:menuItem];
+    NSString *actionName = [action actionName];
+    NSString *serviceName = [action serviceName];
+    NSString *actionPath = [action objectPath];
+    if (!actionName || !serviceName || !actionPath) {
+        return YES;
+    }
+    
+    NSDictionary *actionDesc = nil;
+    @synchronized(gtkActionTables) {
+        NSDictionary *actionTable = [gtkActionTables objectForKey:[self actionTableKeyForService:serviceName
+                                                                                     actionPath:actionPath]];
+        actionDesc = [[[self describeAction:actionName inTable:actionTable] retain] autorelease];
+    }
+    if (!actionDesc) {
+        return YES;
+    }
+    
+    id state = [actionDesc objectForKey:@"state"];
+    if (state && [state isKindOfClass:[NSNumber class]]) {
+        [menuItem setState:[state boolValue] ? NSOnState : NSOffState];
+    }
+    
+    NSNumber *enabled = [actionDesc objectForKey:@"enabled"];
+    return enabled ? [enabled boolValue] : YES;
+}
+
 + (void)cleanup
 {
     NSLog(@"GTKActionHandler: Cleaning up GTK action handler...");
     
-    [gtkMenuItemToActionMap removeAllObjects];
-    [gtkMenuItemToServiceMap removeAllObjects];
-    [gtkMenuItemToActionPathMap removeAllObjects];
-    [gtkMenuItemToConnectionMap removeAllObjects];
-    
     @synchronized(_servicesWithDescribeAction) {
         [_servicesWithDescribeAction removeAllObjects];
     }
     @synchronized(_servicesWithoutDescribeAction) {
         [_servicesWithoutDescribeAction removeAllObjects];
     }
+    @synchronized(gtkActionTables) {
+        [gtkActionTables removeAllObjects];
+        [gtkActionGroupsWithoutDescribeAll removeAllObjects];
+    }
 }
 
 @end
@@ -21,6 +21,8 @@
     NSMutableDictionary *_windowActionPaths;    // windowId -> action group object path
     NSMutableDictionary *_menuCache;            // windowId -> NSMenu
     NSMutableDictionary *_actionGroupCache;     // windowId -> action group info
+    NSMutableDictionary *_menuModels;           // "service|menuPath" -> GTKMenuModel (live org.gtk.Menus subscription)
+    NSMutableDictionary *_windowModelKeys;      // windowId -> "service|menuPath"
     NSTimer *_cleanupTimer;
     AppMenuWidget *_appMenuWidget;
 }
@@ -48,4 +50,7 @@
                        menuPath:(NSString *)menuPath 
                      actionPath:(NSString *)actionPath;
 
+// org.gtk.Menus.Changed handling (delivered by GNUDBusConnection)
+- (void)handleDBusSignal:(NSDictionary *)signalInfo;
+
 @end
@@ -2,10 +2,14 @@
 #import "GTKMenuParser.h"
 #import "GTKSubmenuManager.h"
 #import "GTKActionHandler.h"
+#import "MenuItemAction.h"
 #import "DBusConnection.h"
 #import "AppMenuWidget.h"
 #import "MenuUtils.h"
 #import "MenuCacheManager.h"
+#import "GTKMenuModel.h"
+#import "X11DisplayService.h"
+#import "MenuTrace.h"
 
 @implementation GTKMenuImporter
 
@@ -21,6 +25,8 @@
         _windowActionPaths = [[NSMutableDictionary alloc] init];
         _menuCache = [[NSMutableDictionary alloc] init];
         _actionGroupCache = [[NSMutableDictionary alloc] init];
+        _menuModels = [[NSMutableDictionary alloc] init];
+        _windowModelKeys = [[NSMutableDictionary alloc] init];
         
         // Set up cleanup timer
         _cleanupTimer = [NSTimer scheduledTimerWithTimeInterval:30.0
@@ -42,6 +48,8 @@
     [_windowActionPaths release];
     [_menuCache release];
     [_actionGroupCache release];
+    [_menuModels release];
+    [_windowModelKeys release];
     if (_cleanupTimer) {
         [_cleanupTimer invalidate];
         _cleanupTimer = nil;
@@ -67,6 +75,10 @@
     // Note: GTK applications don't require us to register as a specific service
     // They expose their menus directly via org.gtk.Menus and org.gtk.Actions
     
+    // Subscribed menus push org.gtk.Menus.Changed deltas; receive them instead of re-fetching
+    [_dbusConnection addMatchRule:@"type='signal',interface='org.gtk.Menus',member='Changed'"];
+    [_dbusConnection registerSignalHandler:self forInterface:@"org.gtk.Menus" member:@"Changed"];
+    
     return YES;
 }
 
@@ -94,15 +106,28 @@
     
     NSLog(@"GTKMenuImporter: Getting GTK menu for window %lu", windowId);
     
+    // A live subscription is the source of truth; its menu is kept current by Changed
+    // deltas, so never serve a cached (possibly snapshotted) copy in its place
+    GTKMenuModel *model = [_menuModels objectForKey:[_windowModelKeys objectForKey:windowKey]];
+    MenuTraceTime traceStart = MenuTraceBegin();
+    if ([model rootMenu]) {
+        [self reregisterShortcutsForMenu:[model rootMenu] windowId:windowId];
+        MenuTraceEnd("GTKMenuImporter.reregisterShortcuts", "shortcuts", traceStart, windowId);
+        return [model rootMenu];
+    }
+    
     // Check enhanced cache first
     MenuCacheManager *cacheManager = [MenuCacheManager sharedManager];
     NSMenu *cachedMenu = [cacheManager getCachedMenuForWindow:windowId];
+    MenuTraceEnd("MenuCacheManager.lookup", "cache", traceStart, windowId);
     if (cachedMenu) {
         NSLog(@"GTKMenuImporter: Returning enhanced cached GTK menu for window %lu - re-registering shortcuts", windowId);
         
         // Re-register shortcuts for cached menu since they may have been unregistered
         // when the window lost focus
+        traceStart = MenuTraceBegin();
         [self reregisterShortcutsForMenu:cachedMenu windowId:windowId];
+        MenuTraceEnd("GTKMenuImporter.reregisterShortcuts", "shortcuts", traceStart, windowId);
         
         // Notify cache manager that window became active
         [cacheManager windowBecameActive:windowId];
@@ -160,7 +185,9 @@
           windowId, serviceName, menuPath, actionPath ?: @"none");
     
     // Load the menu using GTK protocol
+    traceStart = MenuTraceBegin();
     NSMenu *menu = [self loadGTKMenuFromDBus:serviceName menuPath:menuPath actionPath:actionPath];
+    MenuTraceEnd("GTKMenuImporter.loadMenu", "dbus", traceStart, windowId);
     if (menu) {
         // Get application name for enhanced caching
         NSString *appName = [MenuUtils getApplicationNameForWindow:windowId];
@@ -195,10 +222,10 @@
     }
     
     // In GTK protocol, we need to:
-    // 1. Get the action name from the menu item (stored in representedObject or tag)
+    // 1. Get the action name from the menu item (its MenuItemAction descriptor or tag)
     // 2. Call the Activate method on org.gtk.Actions interface
     
-    NSString *actionName = [menuItem representedObject];
+    NSString *actionName = [[MenuItemAction actionForMenuItem:menuItem] actionName];
     if (!actionName && [menuItem tag] != 0) {
         // Fallback: use tag as action identifier
         actionName = [NSString stringWithFormat:@"action_%ld", (long)[menuItem tag]];
@@ -238,9 +265,25 @@
 {
     NSNumber *windowKey = [NSNumber numberWithUnsignedLong:windowId];
     
+    // Periodic scans re-register every GTK window; keep the live subscription
+    // and cached menu when nothing about the export changed
+    if ([[_registeredWindows objectForKey:windowKey] isEqualToString:serviceName] &&
+        [[_windowMenuPaths objectForKey:windowKey] isEqualToString:objectPath]) {
+        return;
+    }
+    
+    // Export changed under the same window: drop the old subscription first
+    if ([_registeredWindows objectForKey:windowKey]) {
+        [self detachWindowFromModel:windowId];
+    }
+    
     [_registeredWindows setObject:serviceName forKey:windowKey];
     [_windowMenuPaths setObject:objectPath forKey:windowKey];
     
+    NSString *modelKey = [NSString stringWithFormat:@"%@|%@", serviceName, objectPath];
+    [_windowModelKeys setObject:modelKey forKey:windowKey];
+    [[_menuModels objectForKey:modelKey] addWindow:windowId];
+    
     // For GTK, try to determine the action group path
     // Typically it's the same as menu path but on org.gtk.Actions interface
     // Some applications use /org/gtk/Actions/... paths
@@ -251,10 +294,12 @@
     }
     [_windowActionPaths setObject:actionPath forKey:windowKey];
     
-    // Clear cached menu for this window in both legacy and enhanced cache
+    // Clear cached menu for this window in both legacy and enhanced cache, then
+    // point it at the export's menu, which other windows may have loaded already
     [_menuCache removeObjectForKey:windowKey];
     [_actionGroupCache removeObjectForKey:windowKey];
     [[MenuCacheManager sharedManager] invalidateCacheForWindow:windowId];
+    [[MenuCacheManager sharedManager] attachWindow:windowId serviceName:serviceName objectPath:objectPath];
     
     NSLog(@"GTKMenuImporter: Registered GTK window %lu with service=%@ menuPath=%@ actionPath=%@", 
           windowId, serviceName, objectPath, actionPath);
@@ -264,6 +309,8 @@
 {
     NSNumber *windowKey = [NSNumber numberWithUnsignedLong:windowId];
     
+    [self detachWindowFromModel:windowId];
+    
     [_registeredWindows removeObjectForKey:windowKey];
     [_windowMenuPaths removeObjectForKey:windowKey];
     [_windowActionPaths removeObjectForKey:windowKey];
@@ -274,59 +321,46 @@
     NSLog(@"GTKMenuImporter: Unregistered GTK window %lu", windowId);
 }
 
-- (void)scanSpecificWindow:(unsigned long)windowId
+- (void)detachWindowFromModel:(unsigned long)windowId
 {
-    NSLog(@"GTKMenuImporter: Performing immediate scan for window %lu", windowId);
-    
-    Display *display = XOpenDisplay(NULL);
-    if (!display) {
-        NSLog(@"GTKMenuImporter: Cannot open X11 display for immediate window scan");
+    NSNumber *windowKey = [NSNumber numberWithUnsignedLong:windowId];
+    NSString *modelKey = [_windowModelKeys objectForKey:windowKey];
+    if (!modelKey) {
         return;
     }
     
-    Window window = (Window)windowId;
+    GTKMenuModel *model = [_menuModels objectForKey:modelKey];
+    [model removeWindow:windowId];
+    if (model && [model windowCount] == 0) {
+        // Last window sharing this export is gone - release the subscription with End
+        [model unsubscribeWithConnection:_dbusConnection];
+        [GTKActionHandler forgetActionTableForService:[model serviceName] actionPath:[model actionPath]];
+        [_menuModels removeObjectForKey:modelKey];
+    }
+    [_windowModelKeys removeObjectForKey:windowKey];
+}
+
+- (void)scanSpecificWindow:(unsigned long)windowId
+{
+    NSLog(@"GTKMenuImporter: Performing immediate scan for window %lu", windowId);
     
-    // Create atoms for GTK menu properties
-    Atom busNameAtom = XInternAtom(display, "_GTK_UNIQUE_BUS_NAME", False);
-    Atom objectPathAtom = XInternAtom(display, "_GTK_MENUBAR_OBJECT_PATH", False);
+    X11DisplayService *x11 = [X11DisplayService sharedService];
+    [x11 prefetchProperties:[NSArray arrayWithObjects:@"_GTK_UNIQUE_BUS_NAME", @"_GTK_MENUBAR_OBJECT_PATH", nil]
+                 forWindows:[NSArray arrayWithObject:[NSNumber numberWithUnsignedLong:windowId]]];
     
-    unsigned char *busNameProp = NULL;
-    unsigned char *objectPathProp = NULL;
+    NSString *busName = [x11 stringProperty:@"_GTK_UNIQUE_BUS_NAME" ofWindow:windowId];
+    NSString *objectPath = [x11 stringProperty:@"_GTK_MENUBAR_OBJECT_PATH" ofWindow:windowId];
     
-    // Get bus name property
-    Atom propType;
-    int propFormat;
-    unsigned long propItems, propBytesAfter;
-    if (XGetWindowProperty(display, window, busNameAtom, 0, 1024, False, AnyPropertyType,
-                          &propType, &propFormat, &propItems, &propBytesAfter, &busNameProp) == Success && busNameProp) {
+    if (busName && objectPath) {
+        NSLog(@"GTKMenuImporter: Immediate scan found GTK window %lu with bus=%@ path=%@", windowId, busName, objectPath);
         
-        NSLog(@"GTKMenuImporter: Window %lu has _GTK_UNIQUE_BUS_NAME: %s", windowId, busNameProp);
-        
-        // Get object path property
-        if (XGetWindowProperty(display, window, objectPathAtom, 0, 1024, False, AnyPropertyType,
-                              &propType, &propFormat, &propItems, &propBytesAfter, &objectPathProp) == Success && objectPathProp) {
-            
-            NSLog(@"GTKMenuImporter: Window %lu has _GTK_MENUBAR_OBJECT_PATH: %s", windowId, objectPathProp);
-            
-            NSString *busName = [NSString stringWithUTF8String:(char *)busNameProp];
-            NSString *objectPath = [NSString stringWithUTF8String:(char *)objectPathProp];
-            
-            NSLog(@"GTKMenuImporter: Immediate scan found GTK window %lu with bus=%@ path=%@", windowId, busName, objectPath);
-            
-            // Register this window immediately
-            [self registerWindow:windowId serviceName:busName objectPath:objectPath];
-            
-            XFree(objectPathProp);
-        } else {
-            NSLog(@"GTKMenuImporter: Window %lu has bus name but no object path", windowId);
-        }
-        
-        XFree(busNameProp);
+        // Register this window immediately
+        [self registerWindow:windowId serviceName:busName objectPath:objectPath];
+    } else if (busName) {
+        NSLog(@"GTKMenuImporter: Window %lu has bus name but no object path", windowId);
     } else {
         NSLog(@"GTKMenuImporter: Window %lu has no GTK menu properties", windowId);
     }
-    
-    XCloseDisplay(display);
 }
 
 - (void)scanForExistingMenuServices
@@ -340,9 +374,8 @@
     }
     
     // GTK applications set X11 properties when they export menus
-    // Use a more comprehensive scanning approach
-    Display *display = XOpenDisplay(NULL);
-    if (!display) {
+    X11DisplayService *x11 = [X11DisplayService sharedService];
+    if (![x11 display]) {
         if (gtkScans <= 2) {
             NSLog(@"GTKMenuImporter: Cannot open X11 display for scanning");
         }
@@ -351,137 +384,60 @@
     
     NSUInteger gtkWindows = 0;
     NSUInteger newWindows = 0;
-    
-    // Create atoms once for efficiency
-    Atom busNameAtom = XInternAtom(display, "_GTK_UNIQUE_BUS_NAME", False);
-    Atom objectPathAtom = XInternAtom(display, "_GTK_MENUBAR_OBJECT_PATH", False);
+    NSMutableSet *seenWindows = [NSMutableSet set];
     
     // Get all windows on the display using _NET_CLIENT_LIST
-    Window root = DefaultRootWindow(display);
-    Atom clientListAtom = XInternAtom(display, "_NET_CLIENT_LIST", False);
-    
-    Atom actualType;
-    int actualFormat;
-    unsigned long numClientWindows, bytesAfter;
-    Window *clientWindows = NULL;
-    
-    if (XGetWindowProperty(display, root, clientListAtom, 0, 1024, False, XA_WINDOW,
-                          &actualType, &actualFormat, &numClientWindows, &bytesAfter,
-                          (unsigned char**)&clientWindows) == Success && clientWindows) {
-        
+    NSArray *windows = [x11 clientWindows];
+    if (windows) {
         if (gtkScans <= 2) {
-            NSLog(@"GTKMenuImporter: Found %lu client windows to scan", numClientWindows);
+            NSLog(@"GTKMenuImporter: Found %lu client windows to scan", (unsigned long)[windows count]);
         }
-        
-        for (unsigned long i = 0; i < numClientWindows; i++) {
-            Window window = clientWindows[i];
-            
-            // Debug: log the window ID we're checking (only for first few scans)
-            if (gtkScans <= 2) {
-                NSLog(@"GTKMenuImporter: Checking client window %lu (0x%lx)", (unsigned long)window, (unsigned long)window);
-            }
-            
-            // Check this window for GTK menu properties
-            unsigned char *busNameProp = NULL;
-            unsigned char *objectPathProp = NULL;
-            
-            // Get bus name property (use separate variables to avoid overwriting numClientWindows)
-            Atom propType;
-            int propFormat;
-            unsigned long propItems, propBytesAfter;
-            if (XGetWindowProperty(display, window, busNameAtom, 0, 1024, False, AnyPropertyType,
-                                  &propType, &propFormat, &propItems, &propBytesAfter, &busNameProp) == Success && busNameProp) {
-                
-                if (gtkScans <= 2) {
-                    NSLog(@"GTKMenuImporter: Window %lu has _GTK_UNIQUE_BUS_NAME: %s", (unsigned long)window, busNameProp);
-                }
-                
-                // Get object path property  
-                if (XGetWindowProperty(display, window, objectPathAtom, 0, 1024, False, AnyPropertyType,
-                                      &propType, &propFormat, &propItems, &propBytesAfter, &objectPathProp) == Success && objectPathProp) {
-                    
-                    if (gtkScans <= 2) {
-                        NSLog(@"GTKMenuImporter: Window %lu has _GTK_MENUBAR_OBJECT_PATH: %s", (unsigned long)window, objectPathProp);
-                    }
-                    
-                    NSString *busName = [NSString stringWithUTF8String:(char *)busNameProp];
-                    NSString *objectPath = [NSString stringWithUTF8String:(char *)objectPathProp];
-                    
-                    // Check if this is a new window
-                    NSNumber *windowKey = [NSNumber numberWithUnsignedLong:(unsigned long)window];
-                    if (![_registeredWindows objectForKey:windowKey]) {
-                        NSLog(@"GTKMenuImporter: Found GTK window %lu with bus=%@ path=%@", (unsigned long)window, busName, objectPath);
-                        newWindows++;
-                    } else {
-                        // Only log this on first few scans to show what we have
-                        if (gtkScans <= 2) {
-                            NSLog(@"GTKMenuImporter: Registered GTK window %lu with service=%@ menuPath=%@ actionPath=%@", 
-                                  (unsigned long)window, busName, objectPath, objectPath);
-                        }
-                    }
-                    
-                    // Register this window
-                    [self registerWindow:(unsigned long)window serviceName:busName objectPath:objectPath];
-                    gtkWindows++;
-                    
-                    XFree(objectPathProp);
-                }
-                XFree(busNameProp);
-            }
-        }
-        XFree(clientWindows);
     } else {
         // Fallback to root window children if _NET_CLIENT_LIST is not available
         if (gtkScans <= 2) {
             NSLog(@"GTKMenuImporter: _NET_CLIENT_LIST not available, falling back to root children");
         }
+        windows = [x11 topLevelWindows];
+    }
+    
+    // Both properties of every window in one pipelined batch; windows seen in
+    // earlier scans are answered from the property cache
+    [x11 prefetchProperties:[NSArray arrayWithObjects:@"_GTK_UNIQUE_BUS_NAME", @"_GTK_MENUBAR_OBJECT_PATH", nil]
+                 forWindows:windows];
+    
+    for (NSNumber *windowKey in windows) {
+        unsigned long window = [windowKey unsignedLongValue];
         
-        Window parent, *children;
-        unsigned int numChildren;
+        NSString *busName = [x11 stringProperty:@"_GTK_UNIQUE_BUS_NAME" ofWindow:window];
+        NSString *objectPath = busName ? [x11 stringProperty:@"_GTK_MENUBAR_OBJECT_PATH" ofWindow:window] : nil;
+        if (!busName || !objectPath) {
+            continue;
+        }
         
-        if (XQueryTree(display, root, &root, &parent, &children, &numChildren) == Success && children) {
-            for (unsigned int i = 0; i < numChildren; i++) {
-                Window window = children[i];
-                
-                // Check for GTK menu properties
-                unsigned char *busNameProp = NULL;
-                unsigned char *objectPathProp = NULL;
-                
-                // Get bus name property (use separate variables)
-                Atom propType;
-                int propFormat;
-                unsigned long propItems, propBytesAfter;
-                if (XGetWindowProperty(display, window, busNameAtom, 0, 1024, False, AnyPropertyType,
-                                      &propType, &propFormat, &propItems, &propBytesAfter, &busNameProp) == Success && busNameProp) {
-                    
-                    // Get object path property  
-                    if (XGetWindowProperty(display, window, objectPathAtom, 0, 1024, False, AnyPropertyType,
-                                          &propType, &propFormat, &propItems, &propBytesAfter, &objectPathProp) == Success && objectPathProp) {
-                        
-                        NSString *busName = [NSString stringWithUTF8String:(char *)busNameProp];
-                        NSString *objectPath = [NSString stringWithUTF8String:(char *)objectPathProp];
-                        
-                        // Check if this is a new window
-                        NSNumber *windowKey = [NSNumber numberWithUnsignedLong:(unsigned long)window];
-                        if (![_registeredWindows objectForKey:windowKey]) {
-                            NSLog(@"GTKMenuImporter: Found GTK window %lu with bus=%@ path=%@", (unsigned long)window, busName, objectPath);
-                            newWindows++;
-                        }
-                        
-                        // Register this window
-                        [self registerWindow:(unsigned long)window serviceName:busName objectPath:objectPath];
-                        gtkWindows++;
-                        
-                        XFree(objectPathProp);
-                    }
-                    XFree(busNameProp);
-                }
-            }
-            XFree(children);
+        // Check if this is a new window
+        if (![_registeredWindows objectForKey:windowKey]) {
+            NSLog(@"GTKMenuImporter: Found GTK window %lu with bus=%@ path=%@", window, busName, objectPath);
+            newWindows++;
+        } else if (gtkScans <= 2) {
+            // Only log this on first few scans to show what we have
+            NSLog(@"GTKMenuImporter: Registered GTK window %lu with service=%@ menuPath=%@ actionPath=%@", 
+                  window, busName, objectPath, objectPath);
         }
+        
+        // Register this window
+        [self registerWindow:window serviceName:busName objectPath:objectPath];
+        [seenWindows addObject:windowKey];
+        gtkWindows++;
     }
     
-    XCloseDisplay(display);
+    // Windows that vanished since the last scan: unregister them so their
+    // org.gtk.Menus subscriptions are ended instead of leaking in the exporter
+    for (NSNumber *windowKey in [_registeredWindows allKeys]) {
+        if (![seenWindows containsObject:windowKey]) {
+            NSLog(@"GTKMenuImporter: GTK window %lu is gone, unregistering", [windowKey unsignedLongValue]);
+            [self unregisterWindow:[windowKey unsignedLongValue]];
+        }
+    }
     
     // Only log when we find new windows or on initial scans
     if (gtkScans <= 3 || newWindows > 0) {
@@ -505,6 +461,12 @@
 {
     NSLog(@"GTKMenuImporter: Cleaning up GTK menu protocol handler...");
     
+    for (GTKMenuModel *model in [_menuModels allValues]) {
+        [model unsubscribeWithConnection:_dbusConnection];
+    }
+    [_menuModels removeAllObjects];
+    [_windowModelKeys removeAllObjects];
+    
     [_registeredWindows removeAllObjects];
     [_windowMenuPaths removeAllObjects];
     [_windowActionPaths removeAllObjects];
@@ -569,27 +531,63 @@
           serviceName, menuPath, actionPath);
     
     // First, introspect the menu path to see what's available
+    MenuTraceTime traceStart = MenuTraceBegin();
     id introspectResult = [_dbusConnection callMethod:@"Introspect"
                                             onService:serviceName
                                            objectPath:menuPath
                                             interface:@"org.freedesktop.DBus.Introspectable"
                                             arguments:nil];
+    MenuTraceEnd("dbus.Introspect", "dbus", traceStart, 0);
     
     if (!introspectResult) {
         NSLog(@"GTKMenuImporter: Failed to introspect GTK menu service");
         return nil;
     }
     
+    // Reuse the live subscription for this export if we already hold one; otherwise
+    // subscribe once (group 0 plus every group it references) and keep it open so
+    // org.gtk.Menus.Changed deltas can be applied instead of re-fetching the menu
+    NSString *modelKey = [NSString stringWithFormat:@"%@|%@", serviceName, menuPath];
+    GTKMenuModel *model = [_menuModels objectForKey:modelKey];
+    if (!model) {
+        model = [[GTKMenuModel alloc] initWithServiceName:serviceName menuPath:menuPath actionPath:actionPath];
+        traceStart = MenuTraceBegin();
+        BOOL subscribed = [model subscribeWithConnection:_dbusConnection];
+        MenuTraceEnd("GTKMenuModel.subscribe", "dbus", traceStart, 0);
+        if (subscribed) {
+            [_menuModels setObject:model forKey:modelKey];
+            for (NSNumber *windowKey in [_windowModelKeys allKeysForObject:modelKey]) {
+                [model addWindow:[windowKey unsignedLongValue]];
+            }
+        }
+        [model release];
+        model = [_menuModels objectForKey:modelKey];
+    }
+    
+    if (model) {
+        traceStart = MenuTraceBegin();
+        NSMenu *modelMenu = [model materializeMenuWithConnection:_dbusConnection];
+        MenuTraceEnd("GTKMenuModel.materialize", "parse", traceStart, 0);
+        if (modelMenu) {
+            NSLog(@"GTKMenuImporter: Materialized GTK menu from subscribed model (%lu menus)",
+                  (unsigned long)[[model menus] count]);
+            return [[modelMenu retain] autorelease];
+        }
+        NSLog(@"GTKMenuImporter: Subscribed model has no menubar, falling back to one-shot Start");
+    }
+    
     // Try to call Start method on org.gtk.Menus interface
     // This method returns the menu structure: Start(au subscription_ids) -> (uaa{sv})
     // For menubar, typically subscribe to group 0 only
     NSArray *subscriptionIds = @[[NSNumber numberWithUnsignedInt:0]]; // Group 0 is the main menubar (unsigned int)
     
+    traceStart = MenuTraceBegin();
     id menuResult = [_dbusConnection callMethod:@"Start"
                                       onService:serviceName
                                      objectPath:menuPath
                                       interface:@"org.gtk.Menus"
                                       arguments:@[subscriptionIds]];
+    MenuTraceEnd("dbus.Start", "dbus", traceStart, 0);
     
     if (!menuResult) {
         NSLog(@"GTKMenuImporter: Failed to get GTK menu structure via Start method");
@@ -612,10 +610,12 @@
     
     // Parse the GTK menu structure
     // The format is different from canonical dbusmenu - it's a GMenuModel serialization
+    traceStart = MenuTraceBegin();
     NSMenu *menu = [GTKMenuParser parseGTKMenuFromDBusResult:menuResult 
                                                  serviceName:serviceName 
                                                   actionPath:actionPath 
                                               dbusConnection:_dbusConnection];
+    MenuTraceEnd("GTKMenuParser.parse", "parse", traceStart, 0);
     
     if (!menu) {
         NSLog(@"GTKMenuImporter: Failed to parse GTK menu structure, creating placeholder");
@@ -674,8 +674,8 @@
             BOOL hasNoModifiers = (modifierMask == 0);
             
             if (!hasNoModifiers && !hasShiftOnly) {
-                // Get the action name from the menu item's representedObject or title
-                NSString *actionName = [item representedObject];
+                // Get the action name from the menu item's MenuItemAction descriptor or title
+                NSString *actionName = [[MenuItemAction actionForMenuItem:item] actionName];
                 if (!actionName) {
                     // Fallback to generating action name from title
                     actionName = [[item title] lowercaseString];
@@ -702,6 +702,39 @@
     }
 }
 
+#pragma mark - org.gtk.Menus.Changed
+
+- (void)handleDBusSignal:(NSDictionary *)signalInfo
+{
+    // Delivered on the thread pumping the bus; NSMenu edits belong on the main thread
+    [self performSelectorOnMainThread:@selector(applyMenuChangedSignal:)
+                           withObject:signalInfo
+                        waitUntilDone:NO];
+}
+
+- (void)applyMenuChangedSignal:(NSDictionary *)signalInfo
+{
+    NSString *sender = [signalInfo objectForKey:@"sender"];
+    NSString *path = [signalInfo objectForKey:@"path"];
+    NSArray *arguments = [signalInfo objectForKey:@"arguments"];
+    
+    GTKMenuModel *model = [_menuModels objectForKey:[NSString stringWithFormat:@"%@|%@", sender, path]];
+    if (!model) {
+        // Not one of ours (or already ended); the exporter stops once End is processed
+        return;
+    }
+    
+    if ([arguments count] < 1 || ![[arguments objectAtIndex:0] isKindOfClass:[NSArray class]]) {
+        NSLog(@"GTKMenuImporter: Malformed org.gtk.Menus.Changed from %@%@", sender, path);
+        return;
+    }
+    
+    NSUInteger updated = [model applyChanges:[arguments objectAtIndex:0] withConnection:_dbusConnection];
+    if (updated > 0 && _appMenuWidget) {
+        [_appMenuWidget setNeedsDisplay:YES];
+    }
+}
+
 #pragma mark - Private Methods
 
 - (void)cleanupStaleEntries:(NSTimer *)timer
@@ -0,0 +1,70 @@
+#import <Foundation/Foundation.h>
+#import <AppKit/AppKit.h>
+
+@class GNUDBusConnection;
+
+/**
+ * GTKMenuModel
+ *
+ * Client-side mirror of a GMenuModel exported over org.gtk.Menus.
+ * Holds every subscribed group as (group, menu) -> array of merged item
+ * dictionaries, keeps the subscription open with Start/End, and applies
+ * org.gtk.Menus.Changed splice deltas in place to both the model and the
+ * NSMenu tree that was materialized from it.
+ */
+@interface GTKMenuModel : NSObject
+{
+    NSString *_serviceName;
+    NSString *_menuPath;
+    NSString *_actionPath;
+    NSMutableDictionary *_menus;            // @[group, menu] -> NSMutableArray of item dictionaries
+    NSMutableSet *_subscribedGroups;        // NSNumber group ids we hold a Start subscription for
+    NSMutableDictionary *_bindings;         // @[group, menu] -> @{menu: NSMenu, owner: @[group, menu], labels: NSArray}
+    NSMutableSet *_windows;                 // windowIds sharing this export
+    NSMenu *_rootMenu;
+}
+
+@property (nonatomic, readonly) NSString *serviceName;
+@property (nonatomic, readonly) NSString *menuPath;
+@property (nonatomic, readonly) NSString *actionPath;
+@property (nonatomic, readonly) NSMutableDictionary *menus;
+@property (nonatomic, readonly) NSMenu *rootMenu;
+
+- (id)initWithServiceName:(NSString *)serviceName
+                 menuPath:(NSString *)menuPath
+               actionPath:(NSString *)actionPath;
+
+// Model key for a (group, menu) pair
++ (NSArray *)keyForGroup:(NSNumber *)group menu:(NSNumber *)menu;
+
+// Merge a GMenuModel item ({...} or ({...}, {...}, ...)) into a single dictionary
++ (NSDictionary *)mergedItemFromData:(id)itemData;
+
+// Subscription management (org.gtk.Menus Start/End)
+- (BOOL)subscribeWithConnection:(GNUDBusConnection *)connection;
+- (BOOL)subscribeGroups:(NSArray *)groups withConnection:(GNUDBusConnection *)connection;
+- (void)unsubscribeWithConnection:(GNUDBusConnection *)connection;
+- (BOOL)isSubscribed;
+- (NSSet *)subscribedGroups;
+
+// Window sharing
+- (void)addWindow:(unsigned long)windowId;
+- (void)removeWindow:(unsigned long)windowId;
+- (NSUInteger)windowCount;
+
+// Feed a Start reply (a(uuaa{sv})) into the model
+- (void)mergeStartResult:(id)result;
+
+// Groups referenced through :section/:submenu links that are not yet subscribed
+- (NSSet *)missingReferencedGroups;
+
+// Materialization
+- (NSMenu *)materializeMenuWithConnection:(GNUDBusConnection *)connection;
+- (void)bindMenu:(NSMenu *)menu forKey:(NSArray *)key owner:(NSArray *)ownerKey labels:(NSArray *)labels;
+- (void)rebindMenu:(NSMenu *)fromMenu toMenu:(NSMenu *)toMenu owner:(NSArray *)ownerKey;
+
+// Apply an org.gtk.Menus.Changed payload: a(uuuuaa{sv})
+// Returns the number of NSMenus that were updated
+- (NSUInteger)applyChanges:(NSArray *)changes withConnection:(GNUDBusConnection *)connection;
+
+@end
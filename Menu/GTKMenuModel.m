@@ -0,0 +1,451 @@
+#import "GTKMenuModel.h"
+#import "GTKMenuParser.h"
+#import "DBusConnection.h"
+#import "MenuTrace.h"
+
+@implementation GTKMenuModel
+
+@synthesize serviceName = _serviceName;
+@synthesize menuPath = _menuPath;
+@synthesize actionPath = _actionPath;
+@synthesize menus = _menus;
+@synthesize rootMenu = _rootMenu;
+
++ (NSArray *)keyForGroup:(NSNumber *)group menu:(NSNumber *)menu
+{
+    return @[group, menu];
+}
+
++ (NSDictionary *)mergedItemFromData:(id)itemData
+{
+    // Menu items can be either:
+    // 1. Direct dictionary: {":section" = (0, 1); }
+    // 2. Array containing multiple dictionaries: ({action = "unity.-File"; }, {label = "_File"; }, ...)
+    if ([itemData isKindOfClass:[NSDictionary class]]) {
+        return (NSDictionary *)itemData;
+    }
+
+    NSMutableDictionary *merged = [NSMutableDictionary dictionary];
+    if ([itemData isKindOfClass:[NSArray class]]) {
+        for (id dictItem in (NSArray *)itemData) {
+            if ([dictItem isKindOfClass:[NSDictionary class]]) {
+                [merged addEntriesFromDictionary:(NSDictionary *)dictItem];
+            }
+        }
+    }
+    return merged;
+}
+
+- (id)initWithServiceName:(NSString *)serviceName
+                 menuPath:(NSString *)menuPath
+               actionPath:(NSString *)actionPath
+{
+    self = [super init];
+    if (self) {
+        _serviceName = [serviceName copy];
+        _menuPath = [menuPath copy];
+        _actionPath = [actionPath copy];
+        _menus = [[NSMutableDictionary alloc] init];
+        _subscribedGroups = [[NSMutableSet alloc] init];
+        _bindings = [[NSMutableDictionary alloc] init];
+        _windows = [[NSMutableSet alloc] init];
+        _rootMenu = nil;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [_serviceName release];
+    [_menuPath release];
+    [_actionPath release];
+    [_menus release];
+    [_subscribedGroups release];
+    [_bindings release];
+    [_windows release];
+    [_rootMenu release];
+    [super dealloc];
+}
+
+#pragma mark - Subscription
+
+- (BOOL)subscribeWithConnection:(GNUDBusConnection *)connection
+{
+    @synchronized(self) {
+        if ([self isSubscribed]) {
+            return YES;
+        }
+
+        // Group 0 is the menubar; everything else is discovered from :section/:submenu links.
+        // Each round subscribes to all newly referenced groups in a single Start call.
+        NSArray *groups = @[[NSNumber numberWithUnsignedInt:0]];
+        NSUInteger rounds = 0;
+        while ([groups count] > 0 && rounds < 16) {
+            if (![self subscribeGroups:groups withConnection:connection]) {
+                break;
+            }
+            groups = [[self missingReferencedGroups] allObjects];
+            rounds++;
+        }
+
+        NSLog(@"GTKMenuModel: Subscribed to %lu groups (%lu menus) on %@%@ in %lu Start calls",
+              (unsigned long)[_subscribedGroups count], (unsigned long)[_menus count],
+              _serviceName, _menuPath, (unsigned long)rounds);
+
+        return [self isSubscribed];
+    }
+}
+
+- (BOOL)subscribeGroups:(NSArray *)groups withConnection:(GNUDBusConnection *)connection
+{
+    @synchronized(self) {
+        NSMutableArray *newGroups = [NSMutableArray array];
+        for (NSNumber *group in groups) {
+            if (![_subscribedGroups containsObject:group]) {
+                [newGroups addObject:[NSNumber numberWithUnsignedInt:[group unsignedIntValue]]];
+            }
+        }
+
+        if ([newGroups count] == 0) {
+            return YES;
+        }
+
+        // Start(au groups) -> a(uuaa{sv})
+        id result = [connection callMethod:@"Start"
+                                 onService:_serviceName
+                                objectPath:_menuPath
+                                 interface:@"org.gtk.Menus"
+                                 arguments:@[newGroups]];
+
+        if (!result || ![result isKindOfClass:[NSArray class]]) {
+            NSLog(@"GTKMenuModel: Start failed for groups %@ on %@%@", newGroups, _serviceName, _menuPath);
+            return NO;
+        }
+
+        // The exporter now counts us as a subscriber for these groups, even if they are empty
+        [_subscribedGroups addObjectsFromArray:newGroups];
+        [self mergeStartResult:result];
+        return YES;
+    }
+}
+
+- (void)unsubscribeWithConnection:(GNUDBusConnection *)connection
+{
+    @synchronized(self) {
+        if ([_subscribedGroups count] > 0) {
+            NSArray *groups = [_subscribedGroups allObjects];
+            NSLog(@"GTKMenuModel: Ending subscription to %lu groups on %@%@",
+                  (unsigned long)[groups count], _serviceName, _menuPath);
+
+            // End(au groups); the exporter may already be gone, so failures are harmless
+            [connection callMethod:@"End"
+                         onService:_serviceName
+                        objectPath:_menuPath
+                         interface:@"org.gtk.Menus"
+                         arguments:@[groups]];
+        }
+
+        [_subscribedGroups removeAllObjects];
+        [_menus removeAllObjects];
+        [_bindings removeAllObjects];
+        [_rootMenu release];
+        _rootMenu = nil;
+    }
+}
+
+- (BOOL)isSubscribed
+{
+    return [_subscribedGroups count] > 0;
+}
+
+- (NSSet *)subscribedGroups
+{
+    return [[_subscribedGroups copy] autorelease];
+}
+
+#pragma mark - Windows
+
+- (void)addWindow:(unsigned long)windowId
+{
+    [_windows addObject:[NSNumber numberWithUnsignedLong:windowId]];
+}
+
+- (void)removeWindow:(unsigned long)windowId
+{
+    [_windows removeObject:[NSNumber numberWithUnsignedLong:windowId]];
+}
+
+- (NSUInteger)windowCount
+{
+    return [_windows count];
+}
+
+#pragma mark - Model
+
+- (void)mergeStartResult:(id)result
+{
+    if (![result isKindOfClass:[NSArray class]]) {
+        return;
+    }
+
+    for (id entry in (NSArray *)result) {
+        if (![entry isKindOfClass:[NSArray class]] || [entry count] < 3) {
+            continue;
+        }
+
+        NSArray *key = [GTKMenuModel keyForGroup:[entry objectAtIndex:0] menu:[entry objectAtIndex:1]];
+        id itemsData = [entry objectAtIndex:2];
+
+        NSMutableArray *items = [NSMutableArray array];
+        if ([itemsData isKindOfClass:[NSArray class]]) {
+            for (id itemData in (NSArray *)itemsData) {
+                [items addObject:[GTKMenuModel mergedItemFromData:itemData]];
+            }
+        }
+
+        [_menus setObject:items forKey:key];
+    }
+}
+
+- (void)collectReferencedGroupsFromItems:(NSArray *)items into:(NSMutableSet *)groups
+{
+    for (NSDictionary *item in items) {
+        id refs[2] = { [item objectForKey:@":section"], [item objectForKey:@":submenu"] };
+        for (int i = 0; i < 2; i++) {
+            if ([refs[i] isKindOfClass:[NSArray class]] && [refs[i] count] >= 2) {
+                NSNumber *group = [refs[i] objectAtIndex:0];
+                if (![_subscribedGroups containsObject:group]) {
+                    [groups addObject:group];
+                }
+            }
+        }
+    }
+}
+
+- (NSSet *)missingReferencedGroups
+{
+    NSMutableSet *missing = [NSMutableSet set];
+    for (NSArray *key in _menus) {
+        [self collectReferencedGroupsFromItems:[_menus objectForKey:key] into:missing];
+    }
+    return missing;
+}
+
+#pragma mark - Materialization
+
+- (NSMenu *)materializeMenuWithConnection:(GNUDBusConnection *)connection
+{
+    @synchronized(self) {
+        if (_rootMenu) {
+            return _rootMenu;
+        }
+
+        [_bindings removeAllObjects];
+        NSArray *rootKey = [GTKMenuModel keyForGroup:@0 menu:@0];
+        NSMenu *menu = [GTKMenuParser exploreGTKMenu:rootKey
+                                          withLabels:@[]
+                                            menuDict:_menus
+                                         serviceName:_serviceName
+                                          actionPath:_actionPath
+                                      dbusConnection:connection
+                                               model:self];
+        _rootMenu = [menu retain];
+        return _rootMenu;
+    }
+}
+
+- (void)bindMenu:(NSMenu *)menu forKey:(NSArray *)key owner:(NSArray *)ownerKey labels:(NSArray *)labels
+{
+    if (!menu || !key) {
+        return;
+    }
+    [_bindings setObject:@{@"menu": menu, @"owner": ownerKey ?: key, @"labels": labels ?: @[]}
+                  forKey:key];
+}
+
+- (void)rebindMenu:(NSMenu *)fromMenu toMenu:(NSMenu *)toMenu owner:(NSArray *)ownerKey
+{
+    for (NSArray *key in [_bindings allKeys]) {
+        NSDictionary *binding = [_bindings objectForKey:key];
+        if ([binding objectForKey:@"menu"] == fromMenu) {
+            [_bindings setObject:@{@"menu": toMenu, @"owner": ownerKey, @"labels": [binding objectForKey:@"labels"]}
+                          forKey:key];
+        }
+    }
+}
+
+#pragma mark - Changed deltas
+
+static BOOL itemIsRendered(NSDictionary *item)
+{
+    return [item objectForKey:@"label"] != nil && [item objectForKey:@":section"] == nil;
+}
+
+static BOOL itemsContainSection(NSArray *items)
+{
+    for (NSDictionary *item in items) {
+        if ([item objectForKey:@":section"]) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
+static NSUInteger renderedCount(NSArray *items, NSRange range)
+{
+    NSUInteger count = 0;
+    for (NSUInteger i = range.location; i < NSMaxRange(range) && i < [items count]; i++) {
+        if (itemIsRendered([items objectAtIndex:i])) {
+            count++;
+        }
+    }
+    return count;
+}
+
+- (NSUInteger)applyChanges:(NSArray *)changes withConnection:(GNUDBusConnection *)connection
+{
+    @synchronized(self) {
+        MenuTraceTime traceStart = MenuTraceBegin();
+
+        // Normalize the payload first so that newly referenced groups can be
+        // subscribed to with a single Start call before any NSMenuItem is built
+        NSMutableArray *splices = [NSMutableArray array];
+        NSMutableSet *newGroups = [NSMutableSet set];
+
+        for (id change in changes) {
+            if (![change isKindOfClass:[NSArray class]] || [change count] < 5) {
+                NSLog(@"GTKMenuModel: Ignoring malformed change entry: %@", change);
+                continue;
+            }
+
+            NSMutableArray *added = [NSMutableArray array];
+            id addedData = [change objectAtIndex:4];
+            if ([addedData isKindOfClass:[NSArray class]]) {
+                for (id itemData in (NSArray *)addedData) {
+                    [added addObject:[GTKMenuModel mergedItemFromData:itemData]];
+                }
+            }
+            [self collectReferencedGroupsFromItems:added into:newGroups];
+
+            [splices addObject:@[[GTKMenuModel keyForGroup:[change objectAtIndex:0] menu:[change objectAtIndex:1]],
+                                 [change objectAtIndex:2],
+                                 [change objectAtIndex:3],
+                                 added]];
+        }
+
+        if ([newGroups count] > 0) {
+            [self subscribeGroups:[newGroups allObjects] withConnection:connection];
+        }
+
+        NSMutableArray *ownersToRebuild = [NSMutableArray array];
+        NSUInteger updatedMenus = 0;
+
+        for (NSArray *splice in splices) {
+            NSArray *key = [splice objectAtIndex:0];
+            NSUInteger position = [[splice objectAtIndex:1] unsignedIntegerValue];
+            NSUInteger removed = [[splice objectAtIndex:2] unsignedIntegerValue];
+            NSArray *added = [splice objectAtIndex:3];
+
+            NSMutableArray *items = [_menus objectForKey:key];
+            if (!items) {
+                if (![_subscribedGroups containsObject:[key objectAtIndex:0]]) {
+                    continue;
+                }
+                items = [NSMutableArray array];
+                [_menus setObject:items forKey:key];
+            }
+
+            if (position > [items count]) {
+                position = [items count];
+            }
+            if (position + removed > [items count]) {
+                removed = [items count] - position;
+            }
+
+            NSDictionary *binding = [_bindings objectForKey:key];
+            NSMenu *menu = [binding objectForKey:@"menu"];
+            BOOL direct = (menu != nil &&
+                           [[binding objectForKey:@"owner"] isEqual:key] &&
+                           !itemsContainSection(items) &&
+                           !itemsContainSection(added));
+
+            NSUInteger menuIndex = 0;
+            NSUInteger menuRemoved = 0;
+            if (direct) {
+                menuIndex = renderedCount(items, NSMakeRange(0, position));
+                menuRemoved = renderedCount(items, NSMakeRange(position, removed));
+                if (menuIndex + menuRemoved > (NSUInteger)[menu numberOfItems]) {
+                    // The NSMenu diverged from the model; fall back to rebuilding it
+                    direct = NO;
+                }
+            }
+
+            // Splice the model
+            [items replaceObjectsInRange:NSMakeRange(position, removed) withObjectsFromArray:added];
+
+            if (direct) {
+                for (NSUInteger i = 0; i < menuRemoved; i++) {
+                    [menu removeItemAtIndex:menuIndex];
+                }
+                for (NSDictionary *item in added) {
+                    NSMenuItem *menuItem = [GTKMenuParser menuItemFromGTKItem:item
+                                                                   withLabels:[binding objectForKey:@"labels"]
+                                                                     menuDict:_menus
+                                                                  serviceName:_serviceName
+                                                                   actionPath:_actionPath
+                                                               dbusConnection:connection
+                                                                        model:self];
+                    if (menuItem) {
+                        [menu insertItem:menuItem atIndex:menuIndex++];
+                    }
+                }
+                updatedMenus++;
+            } else if (binding) {
+                NSArray *owner = [binding objectForKey:@"owner"];
+                if (![ownersToRebuild containsObject:owner]) {
+                    [ownersToRebuild addObject:owner];
+                }
+            }
+        }
+
+        // Menus that flatten sections get rebuilt from the model, but only those menus
+        for (NSArray *owner in ownersToRebuild) {
+            NSDictionary *binding = [[[_bindings objectForKey:owner] retain] autorelease];
+            NSMenu *menu = [binding objectForKey:@"menu"];
+            if (!menu) {
+                continue;
+            }
+
+            NSMenu *fresh = [GTKMenuParser exploreGTKMenu:owner
+                                               withLabels:[binding objectForKey:@"labels"]
+                                                 menuDict:_menus
+                                              serviceName:_serviceName
+                                               actionPath:_actionPath
+                                           dbusConnection:connection
+                                                    model:self];
+
+            while ([menu numberOfItems] > 0) {
+                [menu removeItemAtIndex:0];
+            }
+            NSArray *freshItems = [[[fresh itemArray] copy] autorelease];
+            for (NSMenuItem *item in freshItems) {
+                [item retain];
+                [fresh removeItem:item];
+                [menu addItem:item];
+                [item release];
+            }
+            [self rebindMenu:fresh toMenu:menu owner:owner];
+            updatedMenus++;
+        }
+
+        MenuTraceEnd("GTKMenuModel.applyChanges", "delta", traceStart, 0);
+
+        NSLog(@"GTKMenuModel: Applied %lu changes to %@%@ (%lu menus updated, %lu rebuilt)",
+              (unsigned long)[splices count], _serviceName, _menuPath,
+              (unsigned long)updatedMenus, (unsigned long)[ownersToRebuild count]);
+
+        return updatedMenus;
+    }
+}
+
+@end
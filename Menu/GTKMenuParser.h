@@ -2,6 +2,7 @@
 #import <AppKit/AppKit.h>
 
 @class GNUDBusConnection;
+@class GTKMenuModel;
 
 /**
  * GTKMenuParser
@@ -41,6 +42,26 @@
                 actionPath:(NSString *)actionPath
             dbusConnection:(GNUDBusConnection *)dbusConnection;
 
+// Model-aware variant: records (group, menu) -> NSMenu bindings in the model
+// so org.gtk.Menus.Changed deltas can be applied to the materialized menus
++ (NSMenu *)exploreGTKMenu:(NSArray *)menuId
+                withLabels:(NSArray *)labelList
+                  menuDict:(NSMutableDictionary *)menuDict
+               serviceName:(NSString *)serviceName
+                actionPath:(NSString *)actionPath
+            dbusConnection:(GNUDBusConnection *)dbusConnection
+                     model:(GTKMenuModel *)model;
+
+// Create a single NSMenuItem (with its submenu, if any) from a merged GMenuModel item.
+// Returns nil for items that are not rendered (no label, or sections).
++ (NSMenuItem *)menuItemFromGTKItem:(NSDictionary *)menuItem
+                         withLabels:(NSArray *)labelList
+                           menuDict:(NSMutableDictionary *)menuDict
+                        serviceName:(NSString *)serviceName
+                         actionPath:(NSString *)actionPath
+                     dbusConnection:(GNUDBusConnection *)dbusConnection
+                              model:(GTKMenuModel *)model;
+
 // Helper method to parse additional menu data into existing dictionary
 + (void)parseMenuData:(NSArray *)menuData intoDict:(NSMutableDictionary *)menuDict;
 
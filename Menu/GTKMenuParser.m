@@ -2,6 +2,48 @@
 #import "DBusConnection.h"
 #import "GTKActionHandler.h"
 #import "GTKSubmenuManager.h"
+#import "GTKMenuModel.h"
+#import "MenuAcceleratorCache.h"
+#import "MenuLayout.h"
+#import "MenuTrace.h"
+
+// The org.gtk.Menus path that belongs to an action path
+static NSString *menuPathForActionPath(NSString *actionPath, GTKMenuModel *model)
+{
+    if (model) {
+        return [model menuPath];
+    }
+    if ([actionPath containsString:@"/org/gtk/Actions"]) {
+        return [actionPath stringByReplacingOccurrencesOfString:@"/org/gtk/Actions"
+                                                     withString:@"/org/gtk/Menus"];
+    }
+    // Otherwise this is likely already a menu path
+    return actionPath;
+}
+
+@interface GTKMenuParser (Private)
+
+// Materialization of a MenuLayout built from GTK menus (main thread)
++ (NSMenu *)menuForContainerAtIndex:(uint32_t)index
+                           ofLayout:(MenuLayout *)layout
+                         withLabels:(NSArray *)labelList
+                           menuDict:(NSMutableDictionary *)menuDict
+                        serviceName:(NSString *)serviceName
+                         actionPath:(NSString *)actionPath
+                           menuPath:(NSString *)menuPath
+                     dbusConnection:(GNUDBusConnection *)dbusConnection
+                              model:(GTKMenuModel *)model;
++ (NSMenuItem *)menuItemAtIndex:(uint32_t)index
+                       ofLayout:(MenuLayout *)layout
+                     withLabels:(NSArray *)labelList
+                       menuDict:(NSMutableDictionary *)menuDict
+                    serviceName:(NSString *)serviceName
+                     actionPath:(NSString *)actionPath
+                       menuPath:(NSString *)menuPath
+                 dbusConnection:(GNUDBusConnection *)dbusConnection
+                          model:(GTKMenuModel *)model;
+
+@end
 
 @implementation GTKMenuParser
 
@@ -14,7 +56,6 @@
     NSLog(@"GTKMenuParser: Service: %@", serviceName);
     NSLog(@"GTKMenuParser: Action path: %@", actionPath);
     NSLog(@"GTKMenuParser: Result type: %@", [result class]);
-    NSLog(@"GTKMenuParser: Result: %@", result);
     
     if (![result isKindOfClass:[NSArray class]]) {
         NSLog(@"GTKMenuParser: ERROR: Expected array but got %@", [result class]);
@@ -74,224 +115,109 @@
                 actionPath:(NSString *)actionPath
             dbusConnection:(GNUDBusConnection *)dbusConnection
 {
-    NSLog(@"GTKMenuParser: Exploring GTK menu %@ with labels %@", menuId, labelList);
+    return [self exploreGTKMenu:menuId
+                     withLabels:labelList
+                       menuDict:menuDict
+                    serviceName:serviceName
+                     actionPath:actionPath
+                 dbusConnection:dbusConnection
+                          model:nil];
+}
+
++ (NSMenu *)exploreGTKMenu:(NSArray *)menuId
+                withLabels:(NSArray *)labelList
+                  menuDict:(NSMutableDictionary *)menuDict
+               serviceName:(NSString *)serviceName
+                actionPath:(NSString *)actionPath
+            dbusConnection:(GNUDBusConnection *)dbusConnection
+                     model:(GTKMenuModel *)model
+{
+    NSString *menuTitle = ([labelList count] > 0) ? [labelList lastObject] : @"GTK Menu";
     
-    NSArray *menuItems = [menuDict objectForKey:menuId];
-    if (!menuItems) {
+    // Phase 1: everything reachable from menuId, sections flattened, as an immutable layout
+    MenuLayout *layout = [MenuLayout layoutWithGTKMenus:menuDict root:menuId title:menuTitle];
+    if (!layout) {
         NSLog(@"GTKMenuParser: No menu items found for menu ID %@", menuId);
         return nil;
     }
     
-    NSString *menuTitle = ([labelList count] > 0) ? [labelList lastObject] : @"GTK Menu";
-    NSMenu *menu = [[NSMenu alloc] initWithTitle:menuTitle];
-    
-    NSLog(@"GTKMenuParser: Processing %lu menu items for menu %@", 
-          (unsigned long)[menuItems count], menuId);
-
-    for (id menuItemData in menuItems) {
-        NSMutableDictionary *menuItem = [NSMutableDictionary dictionary];
-        
-        // Menu items can be either:
-        // 1. Direct dictionary: {":section" = (0, 1); }
-        // 2. Array containing multiple dictionaries: ({action = "unity.-File"; }, {label = "_File"; }, ...)
-        if ([menuItemData isKindOfClass:[NSDictionary class]]) {
-            [menuItem addEntriesFromDictionary:(NSDictionary *)menuItemData];
-        } else if ([menuItemData isKindOfClass:[NSArray class]]) {
-            NSArray *itemArray = (NSArray *)menuItemData;
-            // Merge all dictionaries in the array into one complete menu item
-            for (id dictItem in itemArray) {
-                if ([dictItem isKindOfClass:[NSDictionary class]]) {
-                    [menuItem addEntriesFromDictionary:(NSDictionary *)dictItem];
-                }
+    NSString *menuPath = menuPathForActionPath(actionPath, model);
+    
+    // Submenu groups that were not in the replies are requested together with one
+    // Start, then the layout is rebuilt. When a model is present the subscription is
+    // recorded there so that it is released again with End.
+    NSSet *unloadedGroups = [layout unloadedGroups];
+    if ([unloadedGroups count] > 0 && dbusConnection) {
+        NSArray *groups = [unloadedGroups allObjects];
+        BOOL loaded = NO;
+        if (model) {
+            loaded = [model subscribeGroups:groups withConnection:dbusConnection];
+        } else {
+            id additionalResult = [dbusConnection callMethod:@"Start"
+                                                   onService:serviceName
+                                                  objectPath:menuPath
+                                                   interface:@"org.gtk.Menus"
+                                                   arguments:@[groups]];
+            if (additionalResult && [additionalResult isKindOfClass:[NSArray class]]) {
+                [self parseMenuData:(NSArray *)additionalResult intoDict:menuDict];
+                loaded = YES;
             }
         }
         
-        if ([menuItem count] == 0) {
-            NSLog(@"GTKMenuParser: Skipping invalid menu item: %@ (class: %@)", 
-                  menuItemData, [menuItemData class]);
-            continue;
-        }
-        
-        NSLog(@"GTKMenuParser: Processing merged menu item: %@", menuItem);
-        NSString *label = [menuItem objectForKey:@"label"];
-        NSString *action = [menuItem objectForKey:@"action"];
-        NSString *accel = [menuItem objectForKey:@"accel"];
-        if (!accel) {
-            accel = [menuItem objectForKey:@"x-canonical-accel"];
-        }
-        
-        // Handle sections - these don't create menu items but contain other items
-        id sectionData = [menuItem objectForKey:@":section"];
-        id submenuData = [menuItem objectForKey:@":submenu"];
-        if (sectionData && [sectionData isKindOfClass:[NSArray class]]) {
-            NSArray *sectionArray = (NSArray *)sectionData;
-            if ([sectionArray count] >= 2) {
-                NSArray *sectionMenuId = @[[sectionArray objectAtIndex:0], [sectionArray objectAtIndex:1]];
-                NSLog(@"GTKMenuParser: Following section reference from %@ to %@", menuId, sectionMenuId);
-                NSMenu *sectionMenu = [self exploreGTKMenu:sectionMenuId
-                                                withLabels:labelList
-                                                  menuDict:menuDict
-                                               serviceName:serviceName
-                                                actionPath:actionPath
-                                            dbusConnection:dbusConnection];
-                
-                if (sectionMenu) {
-                    NSLog(@"GTKMenuParser: Section menu %@ has %lu items, adding to parent", 
-                          sectionMenuId, (unsigned long)[[sectionMenu itemArray] count]);
-                    
-                    // Add a separator before this section if there are already items in the menu
-                    if ([menu numberOfItems] > 0) {
-                        [menu addItem:[NSMenuItem separatorItem]];
-                        NSLog(@"GTKMenuParser: Added separator before section %@", sectionMenuId);
-                    }
-                    
-                    // Add all items from the section to our menu
-                    for (NSMenuItem *item in [sectionMenu itemArray]) {
-                        [menu addItem:[[item copy] autorelease]];
-                    }
-                } else {
-                    NSLog(@"GTKMenuParser: Section menu %@ not found", sectionMenuId);
-                }
-            }
-            continue;
-        }
-        
-        // Handle regular menu items
-        if (label) {
-            // Remove mnemonic underscores from label (all occurrences, not just leading)
-            NSString *displayLabel = label;
-            if ([displayLabel containsString:@"_"]) {
-                displayLabel = [displayLabel stringByReplacingOccurrencesOfString:@"_" withString:@""];
-                NSLog(@"GTKMenuParser: Transformed label '%@' -> '%@' (removed mnemonics)", label, displayLabel);
-            }
-            
-            NSMenuItem *item = [[NSMenuItem alloc] initWithTitle:displayLabel action:nil keyEquivalent:@""];
-            
-            // Add keyboard shortcut if available
-            if (accel && [accel length] > 0) {
-                NSString *keyEquivalent = [self parseKeyboardShortcut:accel];
-                if (keyEquivalent && [keyEquivalent length] > 0) {
-                    [item setKeyEquivalent:keyEquivalent];
-                    NSUInteger modifierMask = [self parseKeyboardModifiers:accel];
-                    [item setKeyEquivalentModifierMask:modifierMask];
-                    NSLog(@"GTKMenuParser: Added shortcut '%@' to menu item '%@'", accel, displayLabel);
-                }
-            }
-            
-            if (action) {
-                [GTKActionHandler setupActionForMenuItem:item
-                                             actionName:action
-                                            serviceName:serviceName
-                                             actionPath:actionPath
-                                         dbusConnection:dbusConnection];
-            }
-            
-            // Handle submenus if present
-            if (submenuData && [submenuData isKindOfClass:[NSArray class]]) {
-                NSArray *submenuArray = (NSArray *)submenuData;
-                if ([submenuArray count] >= 2) {
-                    NSArray *submenuMenuId = @[[submenuArray objectAtIndex:0], [submenuArray objectAtIndex:1]];
-                    NSArray *newLabelList = [labelList arrayByAddingObject:displayLabel];
-                    
-                    // Check if we already have the submenu data in our menuDict
-                    if ([menuDict objectForKey:submenuMenuId]) {
-                        // Data is already available - create submenu immediately (not lazy)
-                        NSLog(@"GTKMenuParser: Submenu data for '%@' already available, creating immediately", displayLabel);
-                        
-                        NSMenu *submenu = [self exploreGTKMenu:submenuMenuId
-                                                    withLabels:newLabelList
-                                                      menuDict:menuDict
-                                                   serviceName:serviceName
-                                                    actionPath:actionPath
-                                                dbusConnection:dbusConnection];
-                        
-                        if (submenu) {
-                            [item setSubmenu:submenu];
-                            NSLog(@"GTKMenuParser: Added immediate submenu to item '%@'", displayLabel);
-                        } else {
-                            NSLog(@"GTKMenuParser: Failed to create immediate submenu for item '%@'", displayLabel);
-                        }
-                    } else {
-                        // Data not available - try to load it, then decide on lazy loading
-                        NSNumber *groupId = [submenuArray objectAtIndex:0];
-                        NSLog(@"GTKMenuParser: Submenu data for '%@' not available, attempting to load group %@", displayLabel, groupId);
-                        
-                        // Use the actual menu path for loading
-                        NSString *menuPath = actionPath;
-                        if ([actionPath containsString:@"/org/gtk/Actions"]) {
-                            // Convert from action path back to menu path
-                            menuPath = [actionPath stringByReplacingOccurrencesOfString:@"/org/gtk/Actions" 
-                                                                             withString:@"/org/gtk/Menus"];
-                        } else if ([actionPath hasSuffix:@"/menubar"]) {
-                            // This is likely already a menu path
-                            menuPath = actionPath;
-                        }
-                        
-                        // Try to load the additional group immediately
-                        id additionalResult = [dbusConnection callMethod:@"Start"
-                                                               onService:serviceName
-                                                             objectPath:menuPath
-                                                              interface:@"org.gtk.Menus"
-                                                              arguments:@[@[groupId]]];
-                        
-                        if (additionalResult && [additionalResult isKindOfClass:[NSArray class]]) {
-                            NSLog(@"GTKMenuParser: Successfully loaded additional menu group %@", groupId);
-                            // Parse and add the new menu data to menuDict
-                            [self parseMenuData:(NSArray *)additionalResult intoDict:menuDict];
-                            
-                            // Now try to create the submenu immediately
-                            NSMenu *submenu = [self exploreGTKMenu:submenuMenuId
-                                                        withLabels:newLabelList
-                                                          menuDict:menuDict
-                                                       serviceName:serviceName
-                                                        actionPath:actionPath
-                                                    dbusConnection:dbusConnection];
-                            
-                            if (submenu) {
-                                [item setSubmenu:submenu];
-                                NSLog(@"GTKMenuParser: Added loaded submenu to item '%@'", displayLabel);
-                            } else {
-                                NSLog(@"GTKMenuParser: Failed to create loaded submenu for item '%@', falling back to lazy loading", displayLabel);
-                                // Fall back to lazy loading
-                                NSMenu *lazySubmenu = [[NSMenu alloc] initWithTitle:displayLabel];
-                                [GTKSubmenuManager setupSubmenu:lazySubmenu
-                                                     forMenuItem:item
-                                                     serviceName:serviceName
-                                                        menuPath:menuPath
-                                                      actionPath:actionPath
-                                                  dbusConnection:dbusConnection
-                                                         groupId:groupId
-                                                        menuDict:menuDict];
-                                [lazySubmenu release];
-                            }
-                        } else {
-                            NSLog(@"GTKMenuParser: Failed to load additional menu group %@, setting up lazy loading", groupId);
-                            // Set up lazy loading as fallback
-                            NSMenu *lazySubmenu = [[NSMenu alloc] initWithTitle:displayLabel];
-                            [GTKSubmenuManager setupSubmenu:lazySubmenu
-                                                 forMenuItem:item
-                                                 serviceName:serviceName
-                                                    menuPath:menuPath
-                                                  actionPath:actionPath
-                                              dbusConnection:dbusConnection
-                                                     groupId:groupId
-                                                    menuDict:menuDict];
-                            [lazySubmenu release];
-                            NSLog(@"GTKMenuParser: Set up lazy-loaded submenu for item '%@'", displayLabel);
-                        }
-                    }
-                }
-            }
-            
-            [menu addItem:item];
-            [item release];
-            
-            NSLog(@"GTKMenuParser: Added GTK menu item: '%@' (action: %@)", displayLabel, action ?: @"none");
+        if (loaded) {
+            NSLog(@"GTKMenuParser: Loaded submenu groups %@ for menu %@", groups, menuId);
+            layout = [MenuLayout layoutWithGTKMenus:menuDict root:menuId title:menuTitle];
+        } else {
+            NSLog(@"GTKMenuParser: Could not load submenu groups %@, their submenus load lazily", groups);
         }
     }
     
-    NSLog(@"GTKMenuParser: Created GTK menu '%@' with %lu items", menuTitle, (unsigned long)[menu numberOfItems]);
-    return [menu autorelease];
+    // Phase 2: NSMenus, actions and model bindings
+    MenuTraceTime traceStart = MenuTraceBegin();
+    NSMenu *menu = [self menuForContainerAtIndex:0
+                                        ofLayout:layout
+                                      withLabels:labelList
+                                        menuDict:menuDict
+                                     serviceName:serviceName
+                                      actionPath:actionPath
+                                        menuPath:menuPath
+                                  dbusConnection:dbusConnection
+                                           model:model];
+    MenuTraceEnd("GTKMenuParser.materialize", "parse", traceStart, 0);
+    
+    NSLog(@"GTKMenuParser: Created GTK menu '%@' with %lu items (%u in the whole tree)", 
+          menuTitle, (unsigned long)[menu numberOfItems], [layout layoutItemCount] - 1);
+    return menu;
+}
+
++ (NSMenuItem *)menuItemFromGTKItem:(NSDictionary *)menuItem
+                         withLabels:(NSArray *)labelList
+                           menuDict:(NSMutableDictionary *)menuDict
+                        serviceName:(NSString *)serviceName
+                         actionPath:(NSString *)actionPath
+                     dbusConnection:(GNUDBusConnection *)dbusConnection
+                              model:(GTKMenuModel *)model
+{
+    // Only labelled items become menu items; sections are handled by the caller
+    if (![menuItem objectForKey:@"label"] || [menuItem objectForKey:@":section"]) {
+        return nil;
+    }
+    
+    MenuLayout *layout = [MenuLayout layoutWithGTKItems:@[menuItem] menus:menuDict];
+    const MenuLayoutItem *root = [layout root];
+    if (root->childCount != 1) {
+        return nil;
+    }
+    
+    return [self menuItemAtIndex:root->firstChild
+                        ofLayout:layout
+                      withLabels:labelList
+                        menuDict:menuDict
+                     serviceName:serviceName
+                      actionPath:actionPath
+                        menuPath:menuPathForActionPath(actionPath, model)
+                  dbusConnection:dbusConnection
+                           model:model];
 }
 
 + (void)parseMenuData:(NSArray *)menuData intoDict:(NSMutableDictionary *)menuDict
@@ -524,65 +450,129 @@
 
 + (NSString *)parseKeyboardShortcut:(NSString *)accel
 {
-    if (!accel || [accel length] == 0) {
-        return @"";
-    }
-    
     // GTK accelerator format: <Control>o, <Primary><Shift>n, <Alt>F4, etc.
-    // Convert to NSMenuItem key equivalent (just the key part)
-    NSString *key = accel;
-    
-    // Remove modifier prefixes
-    key = [key stringByReplacingOccurrencesOfString:@"<Control>" withString:@""];
-    key = [key stringByReplacingOccurrencesOfString:@"<Primary>" withString:@""];
-    key = [key stringByReplacingOccurrencesOfString:@"<Shift>" withString:@""];
-    key = [key stringByReplacingOccurrencesOfString:@"<Alt>" withString:@""];
-    key = [key stringByReplacingOccurrencesOfString:@"<Meta>" withString:@""];
-    key = [key stringByReplacingOccurrencesOfString:@"<Super>" withString:@""];
-    
-    // Convert special keys
-    if ([key isEqualToString:@"Return"]) return @"\r";
-    if ([key isEqualToString:@"Tab"]) return @"\t";
-    if ([key isEqualToString:@"BackSpace"]) return @"\b";
-    if ([key isEqualToString:@"Delete"]) return @"\x7f";
-    if ([key isEqualToString:@"Escape"]) return @"\x1b";
-    if ([key isEqualToString:@"Space"]) return @" ";
-    
-    // Function keys
-    if ([key hasPrefix:@"F"]) {
-        NSString *fNumber = [key substringFromIndex:1];
-        if ([fNumber intValue] >= 1 && [fNumber intValue] <= 24) {
-            // NSMenuItem uses NSF1FunctionKey, etc. but for simplicity, return empty for now
-            return @"";
+    // Parsed once per distinct string, see MenuAcceleratorCache
+    MenuAccelerator accelerator;
+    MenuAcceleratorParse(accel, MenuAcceleratorSyntaxGTK, &accelerator);
+    return accelerator.keyEquivalent;
+}
+
++ (NSUInteger)parseKeyboardModifiers:(NSString *)accel
+{
+    MenuAccelerator accelerator;
+    MenuAcceleratorParse(accel, MenuAcceleratorSyntaxGTK, &accelerator);
+    return accelerator.modifierMask;
+}
+
+@end
+
+@implementation GTKMenuParser (Private)
+
++ (NSMenu *)menuForContainerAtIndex:(uint32_t)index
+                           ofLayout:(MenuLayout *)layout
+                         withLabels:(NSArray *)labelList
+                           menuDict:(NSMutableDictionary *)menuDict
+                        serviceName:(NSString *)serviceName
+                         actionPath:(NSString *)actionPath
+                           menuPath:(NSString *)menuPath
+                     dbusConnection:(GNUDBusConnection *)dbusConnection
+                              model:(GTKMenuModel *)model
+{
+    const MenuLayoutItem *container = [layout layoutItemAtIndex:index];
+    NSString *menuTitle = ([labelList count] > 0) ? [labelList lastObject] : @"GTK Menu";
+    NSMenu *menu = [[NSMenu alloc] initWithTitle:menuTitle];
+    
+    // Record which NSMenu renders each (group, menu), the flattened sections included,
+    // so Changed deltas can find it; the container's own key owns them all
+    if (model && container->keyCount > 0) {
+        const MenuLayoutKey *keys = [layout keysForItem:container];
+        NSArray *ownerKey = nil;
+        for (uint32_t k = 0; k < container->keyCount; k++) {
+            NSArray *key = [GTKMenuModel keyForGroup:[NSNumber numberWithUnsignedInt:keys[k].group]
+                                                menu:[NSNumber numberWithUnsignedInt:keys[k].menu]];
+            if (!ownerKey) {
+                ownerKey = key;
+            }
+            [model bindMenu:menu forKey:key owner:ownerKey labels:labelList];
         }
     }
     
-    // Return lowercase key for normal keys
-    return [key lowercaseString];
+    for (uint32_t i = 0; i < container->childCount; i++) {
+        [menu addItem:[self menuItemAtIndex:container->firstChild + i
+                                   ofLayout:layout
+                                 withLabels:labelList
+                                   menuDict:menuDict
+                                serviceName:serviceName
+                                 actionPath:actionPath
+                                   menuPath:menuPath
+                             dbusConnection:dbusConnection
+                                      model:model]];
+    }
+    
+    return [menu autorelease];
 }
 
-+ (NSUInteger)parseKeyboardModifiers:(NSString *)accel
++ (NSMenuItem *)menuItemAtIndex:(uint32_t)index
+                       ofLayout:(MenuLayout *)layout
+                     withLabels:(NSArray *)labelList
+                       menuDict:(NSMutableDictionary *)menuDict
+                    serviceName:(NSString *)serviceName
+                     actionPath:(NSString *)actionPath
+                       menuPath:(NSString *)menuPath
+                 dbusConnection:(GNUDBusConnection *)dbusConnection
+                          model:(GTKMenuModel *)model
 {
-    if (!accel || [accel length] == 0) {
-        return 0;
+    const MenuLayoutItem *layoutItem = [layout layoutItemAtIndex:index];
+    
+    // Separators stand between flattened sections
+    if (layoutItem->flags & MenuLayoutItemSeparator) {
+        return (NSMenuItem *)[NSMenuItem separatorItem];
     }
     
-    NSUInteger modifiers = 0;
+    NSString *displayLabel = [layout stringAtIndex:layoutItem->label] ?: @"";
+    NSMenuItem *item = [[NSMenuItem alloc] initWithTitle:displayLabel action:nil keyEquivalent:@""];
     
-    if ([accel containsString:@"<Control>"] || [accel containsString:@"<Primary>"]) {
-        modifiers |= NSControlKeyMask;  // Primary/Control maps to Control for cross-platform shortcuts
-    }
-    if ([accel containsString:@"<Shift>"]) {
-        modifiers |= NSEventModifierFlagShift;
+    if (layoutItem->keyEquivalent) {
+        [item setKeyEquivalent:[layout stringAtIndex:layoutItem->keyEquivalent]];
+        [item setKeyEquivalentModifierMask:layoutItem->modifierMask];
     }
-    if ([accel containsString:@"<Alt>"]) {
-        modifiers |= NSEventModifierFlagOption;
+    
+    NSString *action = [layout stringAtIndex:layoutItem->action];
+    if (action) {
+        [GTKActionHandler setupActionForMenuItem:item
+                                     actionName:action
+                                    serviceName:serviceName
+                                     actionPath:actionPath
+                                 dbusConnection:dbusConnection];
     }
-    if ([accel containsString:@"<Meta>"] || [accel containsString:@"<Super>"]) {
-        modifiers |= NSEventModifierFlagCommand;  // Meta/Super maps to Cmd key
+    
+    if (layoutItem->flags & MenuLayoutItemUnloaded) {
+        // The group could not be loaded up front; try again when the submenu opens
+        NSNumber *groupId = [NSNumber numberWithUnsignedInt:[layout keysForItem:layoutItem][0].group];
+        NSMenu *lazySubmenu = [[NSMenu alloc] initWithTitle:displayLabel];
+        [GTKSubmenuManager setupSubmenu:lazySubmenu
+                             forMenuItem:item
+                             serviceName:serviceName
+                                menuPath:menuPath
+                              actionPath:actionPath
+                          dbusConnection:dbusConnection
+                                 groupId:groupId
+                                menuDict:menuDict];
+        [lazySubmenu release];
+    } else if (layoutItem->flags & MenuLayoutItemSubmenu) {
+        NSMenu *submenu = [self menuForContainerAtIndex:index
+                                               ofLayout:layout
+                                             withLabels:[labelList arrayByAddingObject:displayLabel]
+                                               menuDict:menuDict
+                                            serviceName:serviceName
+                                             actionPath:actionPath
+                                               menuPath:menuPath
+                                         dbusConnection:dbusConnection
+                                                  model:model];
+        [item setSubmenu:submenu];
     }
     
-    return modifiers;
+    return [item autorelease];
 }
 
 @end
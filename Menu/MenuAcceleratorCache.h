@@ -0,0 +1,44 @@
+#import <Foundation/Foundation.h>
+
+/**
+ * MenuAcceleratorCache
+ *
+ * Parse cache for menu accelerator strings, shared by DBusMenuShortcutParser,
+ * GTKMenuParser, MenuLayout and X11ShortcutManager. Applications repeat the
+ * same few hundred accelerators (<Primary>s, Control+Shift+Z, ...) on every
+ * item of every menu load, so each distinct string is parsed once into its
+ * key equivalent, modifier mask and X11 keysym, and later lookups are a
+ * single hash probe under a read lock.
+ *
+ * The accelerators common across GTK, Qt and KDE applications are parsed
+ * when the cache is first used. Key equivalents are interned and live as
+ * long as the process. The cache stops growing at a fixed number of
+ * entries; strings parsed after that are not remembered.
+ *
+ * All functions are thread-safe.
+ */
+
+typedef enum {
+    MenuAcceleratorSyntaxGTK,       // <Primary><Shift>z (org.gtk.Menus accel, x-canonical-accel)
+    MenuAcceleratorSyntaxKeyCombo   // Control+Shift+Z (dbusmenu accel properties, parsed shortcut arrays)
+} MenuAcceleratorSyntax;
+
+typedef struct {
+    NSString *keyEquivalent;        // Interned NSMenuItem key equivalent, @"" if none
+    NSUInteger modifierMask;        // NSEventModifierFlags
+    unsigned long keysym;           // X11 KeySym of keyEquivalent, 0 (NoSymbol) if none
+} MenuAccelerator;
+
+// Fills result and returns YES if the accelerator has a key equivalent
+BOOL MenuAcceleratorParse(NSString *accelerator, MenuAcceleratorSyntax syntax, MenuAccelerator *result);
+
+// The uncached parse, for comparison in benchmarks
+BOOL MenuAcceleratorParseUncached(NSString *accelerator, MenuAcceleratorSyntax syntax, MenuAccelerator *result);
+
+// dbusmenu key name ("Return", "F5", "s") to NSMenuItem key equivalent
+NSString *MenuAcceleratorNormalizeKeyName(NSString *keyName);
+
+// X11 keysym for an NSMenuItem key equivalent, NoSymbol (0) if there is none
+unsigned long MenuAcceleratorKeysym(NSString *keyEquivalent);
+
+void MenuAcceleratorCacheStatistics(NSUInteger *hits, NSUInteger *misses, NSUInteger *entries);
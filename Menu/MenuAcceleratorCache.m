@@ -0,0 +1,341 @@
+#import "MenuAcceleratorCache.h"
+#import <AppKit/AppKit.h>
+#import <X11/Xlib.h>
+#import <X11/keysym.h>
+#include <pthread.h>
+
+#define MENU_ACCELERATOR_CACHE_LIMIT 2048   // Entries per process; later misses are parsed every time
+
+// Accelerators found across GTK, Qt and KDE applications, parsed when the
+// cache is first used
+static const char *const commonGTKAccelerators[] = {
+    "<Primary>n", "<Primary>o", "<Primary>s", "<Primary><Shift>s", "<Primary>w", "<Primary>q",
+    "<Primary>p", "<Primary><Shift>p", "<Primary>z", "<Primary><Shift>z", "<Primary>y",
+    "<Primary>x", "<Primary>c", "<Primary>v", "<Primary><Shift>v", "<Primary>a", "<Primary><Shift>a",
+    "<Primary>f", "<Primary>g", "<Primary><Shift>g", "<Primary>h", "<Primary>r", "<Primary>t",
+    "<Primary><Shift>t", "<Primary>l", "<Primary>d", "<Primary>b", "<Primary>i", "<Primary>u",
+    "<Primary>e", "<Primary>k", "<Primary>m", "<Primary>j", "<Primary>plus", "<Primary>minus",
+    "<Primary>equal", "<Primary>0", "<Primary>comma", "<Primary>period", "<Primary>slash",
+    "<Primary>Page_Up", "<Primary>Page_Down", "<Primary>Tab", "<Primary><Shift>Tab",
+    "<Primary><Shift>n", "<Primary><Shift>o", "<Primary><Shift>w", "<Primary><Shift>i",
+    "<Control>n", "<Control>o", "<Control>s", "<Control>q", "<Control>w", "<Control>z",
+    "<Control>x", "<Control>c", "<Control>v", "<Control>a", "<Control>f", "<Control>p",
+    "<Shift><Control>z", "<Shift><Control>s", "<Alt>Left", "<Alt>Right", "<Alt>Home", "<Alt>F4",
+    "<Alt>Return", "F1", "F2", "F3", "F5", "F6", "F7", "F9", "F10", "F11", "F12",
+    "<Shift>F3", "<Shift>F10", "Delete", "<Shift>Delete", "Escape", "Return", "BackSpace"
+};
+
+static const char *const commonKeyCombos[] = {
+    "ctrl+n", "ctrl+o", "ctrl+s", "ctrl+shift+s", "ctrl+w", "ctrl+q", "ctrl+p", "ctrl+z",
+    "ctrl+shift+z", "ctrl+y", "ctrl+x", "ctrl+c", "ctrl+v", "ctrl+a", "ctrl+shift+a", "ctrl+f",
+    "ctrl+r", "ctrl+g", "ctrl+shift+g", "ctrl+h", "ctrl+t", "ctrl+shift+t", "ctrl+l", "ctrl+d",
+    "ctrl+b", "ctrl+i", "ctrl+u", "ctrl+e", "ctrl+k", "ctrl+m", "ctrl+j", "ctrl+0", "ctrl+tab",
+    "ctrl+shift+tab", "ctrl+shift+n", "ctrl+shift+o", "ctrl+shift+w", "ctrl+return",
+    "alt+f4", "alt+left", "alt+right", "alt+home", "alt+return", "shift+delete", "shift+f3",
+    "f1", "f2", "f3", "f5", "f6", "f7", "f9", "f10", "f11", "f12", "delete", "escape", "return",
+    "Ctrl+N", "Ctrl+O", "Ctrl+S", "Ctrl+Shift+S", "Ctrl+W", "Ctrl+Q", "Ctrl+P", "Ctrl+Z",
+    "Ctrl+Shift+Z", "Ctrl+Y", "Ctrl+X", "Ctrl+C", "Ctrl+V", "Ctrl+A", "Ctrl+F", "Ctrl+R",
+    "Control+S", "Control+Shift+Z", "Alt+F4", "Shift+Del", "Del", "F1", "F5", "F11"
+};
+
+static pthread_once_t cacheOnce = PTHREAD_ONCE_INIT;
+static pthread_rwlock_t cacheLock = PTHREAD_RWLOCK_INITIALIZER;
+static NSMapTable *cacheTables[2] = { NULL, NULL };     // Per syntax: accelerator -> MenuAccelerator *
+static MenuAccelerator *cacheEntries = NULL;            // MENU_ACCELERATOR_CACHE_LIMIT slots, never moved
+static NSUInteger cacheCount = 0;
+static NSMutableSet *internedKeys = nil;                // Key equivalents handed out in results
+
+static pthread_mutex_t keysymMutex = PTHREAD_MUTEX_INITIALIZER;
+static NSMapTable *keysymTable = NULL;                  // Key equivalent -> keysym + 1
+
+static volatile NSUInteger cacheHits = 0;
+static volatile NSUInteger cacheMisses = 0;
+
+#pragma mark - Parsing
+
+// GTK accelerator format: <Control>o, <Primary><Shift>n, <Alt>F4, etc.
+static void parseGTKAccelerator(NSString *accel, MenuAccelerator *result)
+{
+    // Convert to NSMenuItem key equivalent (just the key part)
+    NSString *key = accel;
+    key = [key stringByReplacingOccurrencesOfString:@"<Control>" withString:@""];
+    key = [key stringByReplacingOccurrencesOfString:@"<Primary>" withString:@""];
+    key = [key stringByReplacingOccurrencesOfString:@"<Shift>" withString:@""];
+    key = [key stringByReplacingOccurrencesOfString:@"<Alt>" withString:@""];
+    key = [key stringByReplacingOccurrencesOfString:@"<Meta>" withString:@""];
+    key = [key stringByReplacingOccurrencesOfString:@"<Super>" withString:@""];
+
+    if ([key isEqualToString:@"Return"]) {
+        key = @"\r";
+    } else if ([key isEqualToString:@"Tab"]) {
+        key = @"\t";
+    } else if ([key isEqualToString:@"BackSpace"]) {
+        key = @"\b";
+    } else if ([key isEqualToString:@"Delete"]) {
+        key = @"\x7f";
+    } else if ([key isEqualToString:@"Escape"]) {
+        key = @"\x1b";
+    } else if ([key isEqualToString:@"Space"]) {
+        key = @" ";
+    } else if ([key hasPrefix:@"F"] && [[key substringFromIndex:1] intValue] >= 1 &&
+               [[key substringFromIndex:1] intValue] <= 24) {
+        // NSMenuItem uses NSF1FunctionKey, etc. but for simplicity, no key equivalent for now
+        key = @"";
+    } else {
+        key = [key lowercaseString];
+    }
+
+    NSUInteger modifiers = 0;
+    if ([accel containsString:@"<Control>"] || [accel containsString:@"<Primary>"]) {
+        modifiers |= NSControlKeyMask;  // Primary/Control maps to Control for cross-platform shortcuts
+    }
+    if ([accel containsString:@"<Shift>"]) {
+        modifiers |= NSEventModifierFlagShift;
+    }
+    if ([accel containsString:@"<Alt>"]) {
+        modifiers |= NSEventModifierFlagOption;
+    }
+    if ([accel containsString:@"<Meta>"] || [accel containsString:@"<Super>"]) {
+        modifiers |= NSEventModifierFlagCommand;  // Meta/Super maps to Cmd key
+    }
+
+    result->keyEquivalent = key;
+    result->modifierMask = modifiers;
+}
+
+// "+"-separated modifiers and key: ctrl+shift+z, Control+Shift+Z, alt+F4
+static void parseKeyCombo(NSString *keyCombo, MenuAccelerator *result)
+{
+    NSUInteger modifierMask = 0;
+    NSString *key = @"";
+
+    for (NSString *part in [keyCombo componentsSeparatedByString:@"+"]) {
+        NSString *cleanPart = [part stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+        NSString *name = [cleanPart lowercaseString];
+
+        if ([name isEqualToString:@"cmd"] || [name isEqualToString:@"command"] ||
+            [name isEqualToString:@"meta"] || [name isEqualToString:@"super"]) {
+            modifierMask |= NSCommandKeyMask;
+        } else if ([name isEqualToString:@"shift"]) {
+            modifierMask |= NSShiftKeyMask;
+        } else if ([name isEqualToString:@"alt"] || [name isEqualToString:@"option"]) {
+            modifierMask |= NSAlternateKeyMask;
+        } else if ([name isEqualToString:@"ctrl"] || [name isEqualToString:@"control"]) {
+            modifierMask |= NSControlKeyMask;
+        } else {
+            // This should be the key
+            key = MenuAcceleratorNormalizeKeyName(cleanPart);
+        }
+    }
+
+    result->keyEquivalent = key;
+    result->modifierMask = modifierMask;
+}
+
+NSString *MenuAcceleratorNormalizeKeyName(NSString *keyName)
+{
+    if ([keyName length] == 0) {
+        return @"";
+    }
+
+    // Convert common key names to single characters for NSMenuItem
+    NSString *normalized = [keyName lowercaseString];
+
+    if ([normalized isEqualToString:@"return"] || [normalized isEqualToString:@"enter"]) {
+        return @"\r";
+    } else if ([normalized isEqualToString:@"tab"]) {
+        return @"\t";
+    } else if ([normalized isEqualToString:@"space"]) {
+        return @" ";
+    } else if ([normalized isEqualToString:@"escape"] || [normalized isEqualToString:@"esc"]) {
+        return @"\033";
+    } else if ([normalized isEqualToString:@"backspace"]) {
+        return @"\b";
+    } else if ([normalized isEqualToString:@"delete"]) {
+        return @"\177";
+    } else if ([normalized hasPrefix:@"f"] && [normalized length] <= 3) {
+        // Function keys - return as is for now, NSMenuItem will handle
+        return normalized;
+    } else if ([normalized length] == 1) {
+        return normalized;
+    }
+
+    // For other keys, use the first character
+    return [normalized substringToIndex:1];
+}
+
+// Mirrors globalshortcutsd's key names
+static KeySym keysymForKeyEquivalent(NSString *keyStr)
+{
+    if ([keyStr length] == 0) {
+        return NoSymbol;
+    }
+
+    if ([keyStr length] == 1) {
+        return XStringToKeysym([keyStr UTF8String]);
+    }
+
+    if ([keyStr isEqualToString:@"space"]) return XK_space;
+    if ([keyStr isEqualToString:@"return"] || [keyStr isEqualToString:@"enter"]) return XK_Return;
+    if ([keyStr isEqualToString:@"tab"]) return XK_Tab;
+    if ([keyStr isEqualToString:@"escape"] || [keyStr isEqualToString:@"esc"]) return XK_Escape;
+    if ([keyStr isEqualToString:@"backspace"]) return XK_BackSpace;
+    if ([keyStr isEqualToString:@"delete"]) return XK_Delete;
+
+    if ([keyStr hasPrefix:@"f"] && [keyStr length] <= 3) {
+        int fNum = [[keyStr substringFromIndex:1] intValue];
+        if (fNum >= 1 && fNum <= 24) {
+            return XK_F1 + (fNum - 1);
+        }
+    }
+
+    return XStringToKeysym([keyStr UTF8String]);
+}
+
+unsigned long MenuAcceleratorKeysym(NSString *keyEquivalent)
+{
+    if ([keyEquivalent length] == 0) {
+        return NoSymbol;
+    }
+
+    // XStringToKeysym loads its database lazily and is not safe to call from
+    // several threads at once, so lookups are serialized along with the table
+    pthread_mutex_lock(&keysymMutex);
+    if (!keysymTable) {
+        keysymTable = NSCreateMapTable(NSObjectMapKeyCallBacks, NSIntegerMapValueCallBacks, 64);
+    }
+    uintptr_t stored = (uintptr_t)NSMapGet(keysymTable, keyEquivalent);
+    KeySym keysym;
+    if (stored != 0) {
+        keysym = (KeySym)(stored - 1);
+    } else {
+        keysym = keysymForKeyEquivalent(keyEquivalent);
+        NSString *key = [keyEquivalent copy];
+        NSMapInsert(keysymTable, key, (void *)(uintptr_t)(keysym + 1));
+        [key release];
+    }
+    pthread_mutex_unlock(&keysymMutex);
+    return keysym;
+}
+
+// Fills in everything but the keysym
+static void parseAccelerator(NSString *accelerator, MenuAcceleratorSyntax syntax, MenuAccelerator *result)
+{
+    result->keyEquivalent = @"";
+    result->modifierMask = 0;
+    result->keysym = NoSymbol;
+    if (![accelerator isKindOfClass:[NSString class]] || [accelerator length] == 0) {
+        return;
+    }
+
+    if (syntax == MenuAcceleratorSyntaxGTK) {
+        parseGTKAccelerator(accelerator, result);
+    } else {
+        parseKeyCombo(accelerator, result);
+    }
+}
+
+BOOL MenuAcceleratorParseUncached(NSString *accelerator, MenuAcceleratorSyntax syntax, MenuAccelerator *result)
+{
+    parseAccelerator(accelerator, syntax, result);
+    result->keysym = keysymForKeyEquivalent(result->keyEquivalent);
+    return [result->keyEquivalent length] > 0;
+}
+
+#pragma mark - Cache
+
+// Called with cacheLock held for writing
+static NSString *internKey(NSString *key)
+{
+    NSString *interned = [internedKeys member:key];
+    if (!interned) {
+        [internedKeys addObject:key];
+        interned = [internedKeys member:key];
+    }
+    return interned;
+}
+
+// Called with cacheLock held for writing; result gets the interned key equivalent
+static void cacheStore(NSString *accelerator, MenuAcceleratorSyntax syntax, MenuAccelerator *result)
+{
+    result->keyEquivalent = internKey(result->keyEquivalent);
+
+    NSMapTable *table = cacheTables[syntax];
+    if (cacheCount >= MENU_ACCELERATOR_CACHE_LIMIT || NSMapGet(table, accelerator)) {
+        return;
+    }
+
+    MenuAccelerator *entry = &cacheEntries[cacheCount++];
+    *entry = *result;
+    NSString *key = [accelerator copy];
+    NSMapInsert(table, key, entry);
+    [key release];
+}
+
+static void cacheParseAndStore(NSString *accelerator, MenuAcceleratorSyntax syntax, MenuAccelerator *result)
+{
+    parseAccelerator(accelerator, syntax, result);
+    result->keysym = MenuAcceleratorKeysym(result->keyEquivalent);
+
+    pthread_rwlock_wrlock(&cacheLock);
+    cacheStore(accelerator, syntax, result);
+    pthread_rwlock_unlock(&cacheLock);
+}
+
+static void cacheInit(void)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+
+    cacheTables[MenuAcceleratorSyntaxGTK] = NSCreateMapTable(NSObjectMapKeyCallBacks,
+                                                             NSNonOwnedPointerMapValueCallBacks, 256);
+    cacheTables[MenuAcceleratorSyntaxKeyCombo] = NSCreateMapTable(NSObjectMapKeyCallBacks,
+                                                                  NSNonOwnedPointerMapValueCallBacks, 256);
+    cacheEntries = calloc(MENU_ACCELERATOR_CACHE_LIMIT, sizeof(MenuAccelerator));
+    internedKeys = [[NSMutableSet alloc] initWithCapacity:128];
+
+    MenuAccelerator parsed;
+    for (size_t i = 0; i < sizeof(commonGTKAccelerators) / sizeof(commonGTKAccelerators[0]); i++) {
+        cacheParseAndStore([NSString stringWithUTF8String:commonGTKAccelerators[i]],
+                           MenuAcceleratorSyntaxGTK, &parsed);
+    }
+    for (size_t i = 0; i < sizeof(commonKeyCombos) / sizeof(commonKeyCombos[0]); i++) {
+        cacheParseAndStore([NSString stringWithUTF8String:commonKeyCombos[i]],
+                           MenuAcceleratorSyntaxKeyCombo, &parsed);
+    }
+
+    [pool release];
+}
+
+BOOL MenuAcceleratorParse(NSString *accelerator, MenuAcceleratorSyntax syntax, MenuAccelerator *result)
+{
+    if (![accelerator isKindOfClass:[NSString class]] || [accelerator length] == 0) {
+        parseAccelerator(nil, syntax, result);
+        return NO;
+    }
+
+    pthread_once(&cacheOnce, cacheInit);
+
+    pthread_rwlock_rdlock(&cacheLock);
+    MenuAccelerator *entry = NSMapGet(cacheTables[syntax], accelerator);
+    if (entry) {
+        *result = *entry;
+    }
+    pthread_rwlock_unlock(&cacheLock);
+
+    if (entry) {
+        __sync_fetch_and_add(&cacheHits, 1);
+    } else {
+        __sync_fetch_and_add(&cacheMisses, 1);
+        cacheParseAndStore(accelerator, syntax, result);
+    }
+    return [result->keyEquivalent length] > 0;
+}
+
+void MenuAcceleratorCacheStatistics(NSUInteger *hits, NSUInteger *misses, NSUInteger *entries)
+{
+    pthread_rwlock_rdlock(&cacheLock);
+    if (hits) *hits = cacheHits;
+    if (misses) *misses = cacheMisses;
+    if (entries) *entries = cacheCount;
+    pthread_rwlock_unlock(&cacheLock);
+}
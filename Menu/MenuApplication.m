@@ -4,6 +4,11 @@
 #import "DBusMenuParser.h"
 #import "DBusConnection.h"
 #import "MenuCacheManager.h"
+#import "MenuTrace.h"
+#import "MenuIconCache.h"
+#import "X11DisplayService.h"
+#import "X11WindowRegistry.h"
+#import "MenuPreWarmScheduler.h"
 #import <signal.h>
 #import <unistd.h>
 #import <objc/runtime.h>
@@ -21,6 +26,9 @@ static void cleanup_on_exit(void)
     
     // Log final cache statistics
     [[MenuCacheManager sharedManager] logCacheStatistics];
+    
+    // Signal handlers exit() too, so this covers every way out
+    [MenuTrace writeTrace];
 }
 
 // Signal handler for graceful shutdown
@@ -53,6 +61,9 @@ static void signalHandler(int sig)
 // Forward declare our custom drawRect function
 id menu_drawRectWithoutBottomLine(id self, SEL _cmd, NSRect dirtyRect);
 
+// NSMenuView's own drawRect:, called directly so the real dirty rect reaches it
+static void (*original_menuViewDrawRect)(id, SEL, NSRect) = NULL;
+
 @implementation MenuApplication
 
 // Method swizzling to remove bottom line from menus
@@ -90,6 +101,7 @@ id menu_drawRectWithoutBottomLine(id self, SEL _cmd, NSRect dirtyRect);
     
     // Add the original implementation under a new name
     class_addMethod(menuViewClass, originalSelector, originalIMP, typeEncoding);
+    original_menuViewDrawRect = (void (*)(id, SEL, NSRect))originalIMP;
     
     // Replace the original drawRect: with our custom implementation
     method_setImplementation(originalMethod, (IMP)menu_drawRectWithoutBottomLine);
@@ -100,9 +112,13 @@ id menu_drawRectWithoutBottomLine(id self, SEL _cmd, NSRect dirtyRect);
 // Custom drawRect implementation that removes bottom line
 id menu_drawRectWithoutBottomLine(id self, SEL cmd __attribute__((unused)), NSRect dirtyRect)
 {
-    // Call the original drawRect implementation
-    if ([self respondsToSelector:@selector(original_drawRect:)]) {
-        [self performSelector:@selector(original_drawRect:) withObject:[NSValue valueWithRect:dirtyRect]];
+    // Call the original drawRect implementation. performSelector:withObject: cannot
+    // pass an NSRect, so the view used to get a garbage rect and repaint everything.
+    if (original_menuViewDrawRect) {
+        MenuTraceTime traceStart = MenuTraceBegin();
+        original_menuViewDrawRect(self, @selector(drawRect:), dirtyRect);
+        MenuTraceEnd("NSMenuView.drawRect", "ui", traceStart, 0);
+        MenuTraceMenuDrawn();
     }
     /*
     // Now override any bottom line drawing by drawing over it with background color
@@ -319,6 +335,9 @@ id menu_drawRectWithoutBottomLine(id self, SEL cmd __attribute__((unused)), NSRe
     MenuCacheManager *cacheManager = [MenuCacheManager sharedManager];
     NSArray *arguments = [[NSProcessInfo processInfo] arguments];
     
+    // Menu-load tracing; --trace below takes precedence over the environment
+    NSString *traceFile = [[[NSProcessInfo processInfo] environment] objectForKey:@"MENU_TRACE_FILE"];
+    
     // Parse command line arguments for cache configuration
     for (NSUInteger i = 1; i < [arguments count]; i++) {
         NSString *arg = [arguments objectAtIndex:i];
@@ -347,6 +366,35 @@ id menu_drawRectWithoutBottomLine(id self, SEL cmd __attribute__((unused)), NSRe
                 }
                 i++; // Skip next argument
             }
+        } else if ([arg isEqualToString:@"--cache-memory"]) {
+            if (i + 1 < [arguments count]) {
+                NSString *kbStr = [arguments objectAtIndex:i + 1];
+                NSUInteger kilobytes = [kbStr integerValue];
+                if (kilobytes >= 64 && kilobytes <= 262144) {
+                    [cacheManager setMaxCacheBytes:kilobytes * 1024];
+                    NSLog(@"MenuApplication: Set cache memory budget to %lu KB", (unsigned long)kilobytes);
+                } else {
+                    NSLog(@"MenuApplication: Invalid cache memory %@, must be 64-262144 KB", kbStr);
+                }
+                i++; // Skip next argument
+            }
+        } else if ([arg isEqualToString:@"--trace"]) {
+            if (i + 1 < [arguments count]) {
+                traceFile = [arguments objectAtIndex:i + 1];
+                i++; // Skip next argument
+            }
+        } else if ([arg isEqualToString:@"--no-icon-cache"]) {
+            [[MenuIconCache sharedCache] setDecodesInline:YES];
+            NSLog(@"MenuApplication: Decoding menu icons inline, without MenuIconCache");
+        } else if ([arg isEqualToString:@"--no-prewarm"]) {
+            [[MenuPreWarmScheduler sharedScheduler] setMaxJobs:0];
+            NSLog(@"MenuApplication: Pre-warming of sibling windows' menus is off");
+        } else if ([arg isEqualToString:@"--rescan-windows"]) {
+            [X11WindowRegistry setRescansClientList:YES];
+            NSLog(@"MenuApplication: Rescanning every window on client list changes, without X11WindowRegistry");
+        } else if ([arg isEqualToString:@"--uncached-x11"]) {
+            [[X11DisplayService sharedService] setCachesProperties:NO];
+            NSLog(@"MenuApplication: Reading X11 properties one blocking request at a time, without caching");
         } else if ([arg isEqualToString:@"--cache-stats"]) {
             // Enable periodic cache statistics logging
             NSLog(@"MenuApplication: Enabled cache statistics logging");
@@ -355,15 +403,25 @@ id menu_drawRectWithoutBottomLine(id self, SEL cmd __attribute__((unused)), NSRe
             NSLog(@"MenuApplication: Usage: Menu.app [options]");
             NSLog(@"MenuApplication:   --cache-size N    Set max cache size (1-100 windows, default: 20)");
             NSLog(@"MenuApplication:   --cache-age N     Set max cache age (1-3600 seconds, default: 300)");
+            NSLog(@"MenuApplication:   --cache-memory N  Set cache memory budget (64-262144 KB, default: 8192)");
             NSLog(@"MenuApplication:   --cache-stats     Enable periodic cache statistics logging");
+            NSLog(@"MenuApplication:   --trace FILE      Write menu-load spans to FILE as Chrome trace JSON on exit");
+            NSLog(@"MenuApplication:   --no-icon-cache   Decode menu icons while building menus (for comparison)");
+            NSLog(@"MenuApplication:   --no-prewarm      Do not load sibling windows' menus in the background");
+            NSLog(@"MenuApplication:   --rescan-windows  Rescan every window when the client list changes (for comparison)");
+            NSLog(@"MenuApplication:   --uncached-x11    Read X11 properties uncached, one request at a time (for comparison)");
             NSLog(@"MenuApplication:   --help            Show this help");
         }
     }
     
+    if ([traceFile length] > 0) {
+        [MenuTrace startTracingToFile:traceFile];
+    }
+    
     // Log current cache configuration
     NSDictionary *stats = [cacheManager getCacheStatistics];
-    NSLog(@"MenuApplication: Cache configured - size: %@, max age: %.1fs", 
-          stats[@"maxCacheSize"], [stats[@"maxCacheAge"] doubleValue]);
+    NSLog(@"MenuApplication: Cache configured - size: %@, max age: %.1fs, memory budget: %@ bytes", 
+          stats[@"maxCacheSize"], [stats[@"maxCacheAge"] doubleValue], stats[@"maxCacheBytes"]);
 }
 
 @end
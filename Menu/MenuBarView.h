@@ -5,6 +5,7 @@
 @interface MenuBarView : NSView
 {
     NSColor *_backgroundColor;
+    NSColor *_borderColor;
 }
 
 - (void)drawRect:(NSRect)dirtyRect;
@@ -1,4 +1,5 @@
 #import "MenuBarView.h"
+#import "MenuTrace.h"
 
 @implementation MenuBarView
 
@@ -8,32 +9,37 @@
     if (self) {
         // Use the theme's menubar background color instead of hardcoded values
         _backgroundColor = [[[GSTheme theme] menuItemBackgroundColor] retain];
+        if (!_backgroundColor) {
+            // Fallback to light gray if theme color is unavailable
+            NSLog(@"MenuBarView: Warning - using fallback background color");
+            _backgroundColor = [[NSColor colorWithCalibratedWhite:0.95 alpha:1.0] retain];
+        }
+        _borderColor = [[NSColor colorWithCalibratedWhite:0.5 alpha:1.0] retain];
     }
     return self;
 }
 
 - (void)drawRect:(NSRect)dirtyRect
 {
-    NSLog(@"MenuBarView: drawRect called with rect: %.0f,%.0f %.0fx%.0f", 
-          dirtyRect.origin.x, dirtyRect.origin.y, dirtyRect.size.width, dirtyRect.size.height);
+    // Subviews (clock, app menu) are not opaque, so their redraws land here too;
+    // only repaint the part that is actually dirty
+    NSRect fillRect = NSIntersectionRect(dirtyRect, [self bounds]);
+    if (NSIsEmptyRect(fillRect)) {
+        return;
+    }
+    MenuTraceTime traceStart = MenuTraceBegin();
     
     // Fill with theme background color (no gradient)
-    if (_backgroundColor) {
-        [_backgroundColor set];
-        NSRectFill([self bounds]);
-        NSLog(@"MenuBarView: Drew theme background color: %@", _backgroundColor);
-    } else {
-        // Fallback to light gray if theme color is unavailable
-        [[NSColor colorWithCalibratedWhite:0.95 alpha:1.0] set];
-        NSRectFill([self bounds]);
-        NSLog(@"MenuBarView: Warning - used fallback background color");
-    }
+    [_backgroundColor set];
+    NSRectFill(fillRect);
     
     // Draw bottom border
-    NSRect borderRect = NSMakeRect(0, 0, [self bounds].size.width, 1);
-    [[NSColor colorWithCalibratedWhite:0.5 alpha:1.0] set];
-    NSRectFill(borderRect);
-    NSLog(@"MenuBarView: Drew bottom border");
+    NSRect borderRect = NSIntersectionRect(fillRect, NSMakeRect(0, 0, [self bounds].size.width, 1));
+    if (!NSIsEmptyRect(borderRect)) {
+        [_borderColor set];
+        NSRectFill(borderRect);
+    }
+    MenuTraceEnd("MenuBarView.drawRect", "ui", traceStart, 0);
 }
 
 - (BOOL)isOpaque
@@ -44,6 +50,7 @@
 - (void)dealloc
 {
     [_backgroundColor release];
+    [_borderColor release];
     [super dealloc];
 }
 
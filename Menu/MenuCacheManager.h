@@ -1,9 +1,77 @@
 #import <Foundation/Foundation.h>
 #import <AppKit/AppKit.h>
 
+/**
+ * MenuSnapshotRestorable
+ *
+ * Marker protocol for menu item targets that keep no per-NSMenuItem-instance
+ * state (everything they need travels with the item's title, tag and
+ * representedObject). Only menus whose item targets conform can be demoted
+ * to a MenuSnapshot and materialized again later.
+ */
+@protocol MenuSnapshotRestorable
+@end
+
+// One flattened menu item inside a MenuSnapshot
+typedef struct {
+    NSString *title;
+    NSString *keyEquivalent;
+    id representedObject;
+    id target;                      // not retained, same as NSMenuItem
+    SEL action;
+    id submenu;                     // MenuSnapshot, or nil
+    NSInteger tag;
+    NSUInteger modifierMask;
+    NSInteger state;
+    BOOL enabled;
+    BOOL separator;
+} MenuSnapshotItem;
+
+/**
+ * MenuSnapshot
+ *
+ * Compact immutable copy of an NSMenu tree: one C array of items per level,
+ * no views, no delegates. NSMenus are materialized from it on demand.
+ */
+@interface MenuSnapshot : NSObject
+{
+    NSString *_title;
+    MenuSnapshotItem *_items;
+    NSUInteger _count;
+    NSUInteger _totalItemCount;     // including submenus
+    NSUInteger _byteSize;
+}
+
+@property (nonatomic, readonly) NSUInteger count;
+@property (nonatomic, readonly) NSUInteger totalItemCount;
+@property (nonatomic, readonly) NSUInteger byteSize;
+
+// Returns nil if the menu cannot be restored faithfully (lazy submenus, images,
+// or targets that do not adopt MenuSnapshotRestorable)
++ (MenuSnapshot *)snapshotOfMenu:(NSMenu *)menu;
+- (NSMenu *)materializeMenu;
+
+@end
+
+/**
+ * MenuCacheEntry
+ *
+ * One cached menu, keyed by the (service, object path) that exports it and
+ * shared by every window showing that export. Most GTK and Qt applications
+ * export a single menubar object for all their windows, so those windows
+ * share one NSMenu tree and one D-Bus load. The entry lives while at least
+ * one window references it (or until it is evicted or invalidated).
+ */
 @interface MenuCacheEntry : NSObject
 {
-    NSMenu *_menu;
+    NSMenu *_menu;                  // live menu, nil while demoted to a snapshot
+    MenuSnapshot *_snapshot;
+    NSUInteger _estimatedBytes;
+    NSUInteger _itemCount;
+    NSString *_menuKey;             // "service|path", or "window|id" for menus without an export
+    NSMutableSet *_windowKeys;      // windows sharing this menu; the entry's reference count
+    MenuCacheEntry *_lruPrev;       // intrusive LRU links, not retained (the cache owns entries)
+    MenuCacheEntry *_lruNext;
     NSTimeInterval _lastAccessed;
     NSTimeInterval _cached;
     NSUInteger _accessCount;
@@ -13,6 +81,13 @@
 }
 
 @property (nonatomic, retain) NSMenu *menu;
+@property (nonatomic, retain) MenuSnapshot *snapshot;
+@property (nonatomic, assign) NSUInteger estimatedBytes;
+@property (nonatomic, assign) NSUInteger itemCount;
+@property (nonatomic, retain) NSString *menuKey;
+@property (nonatomic, readonly) NSMutableSet *windowKeys;
+@property (nonatomic, assign) MenuCacheEntry *lruPrev;
+@property (nonatomic, assign) MenuCacheEntry *lruNext;
 @property (nonatomic, assign) NSTimeInterval lastAccessed;
 @property (nonatomic, assign) NSTimeInterval cached;
 @property (nonatomic, assign) NSUInteger accessCount;
@@ -27,14 +102,23 @@
 - (void)touch;
 - (NSTimeInterval)age;
 - (BOOL)isStale:(NSTimeInterval)maxAge;
+- (BOOL)isLive;
+
+// Rough resident cost of a live NSMenu tree
++ (NSUInteger)estimatedBytesForMenu:(NSMenu *)menu itemCount:(NSUInteger *)itemCount;
 
 @end
 
 @interface MenuCacheManager : NSObject
 {
-    NSMutableDictionary *_cache;               // windowId -> MenuCacheEntry
-    NSMutableArray *_lruOrder;                 // Array of window IDs in LRU order
+    NSMutableDictionary *_cache;               // menu key -> MenuCacheEntry
+    NSMutableDictionary *_windowMenuKeys;      // windowId -> menu key of the export it shows
+    NSMutableDictionary *_accessHistory;       // "service|path" -> NSNumber accessCount of removed entries
+    MenuCacheEntry *_lruHead;                  // most recently used
+    MenuCacheEntry *_lruTail;                  // least recently used
     NSUInteger _maxCacheSize;
+    NSUInteger _maxCacheBytes;                 // byte budget across all entries
+    NSUInteger _totalBytes;
     NSTimeInterval _maxCacheAge;
     NSTimer *_cleanupTimer;
     
@@ -42,24 +126,38 @@
     NSUInteger _cacheHits;
     NSUInteger _cacheMisses;
     NSUInteger _cacheEvictions;
+    NSUInteger _snapshotDemotions;
+    NSUInteger _snapshotMaterializations;
+    NSUInteger _menuLoads;                     // menus handed to cacheMenu:, i.e. loaded from the application
+    NSUInteger _sharedHits;                    // hits on a menu another window loaded
 }
 
 + (MenuCacheManager *)sharedManager;
 
 // Cache operations
 - (NSMenu *)getCachedMenuForWindow:(unsigned long)windowId;
+- (BOOL)hasCachedMenuForWindow:(unsigned long)windowId;
+// Records which export a window shows, so it shares any menu already cached
+// for that export (and later loads of it); called when the window registers
+- (void)attachWindow:(unsigned long)windowId serviceName:(NSString *)serviceName objectPath:(NSString *)objectPath;
+// Highest access count seen for a menu, including entries evicted since (pre-warm priority)
+- (NSUInteger)accessCountForService:(NSString *)serviceName objectPath:(NSString *)objectPath;
 - (void)cacheMenu:(NSMenu *)menu 
         forWindow:(unsigned long)windowId 
       serviceName:(NSString *)serviceName 
        objectPath:(NSString *)objectPath
   applicationName:(NSString *)applicationName;
+// Detaches the window; its menu is dropped once no window shares it
 - (void)invalidateCacheForWindow:(unsigned long)windowId;
+// Drops the menu of an export for all windows sharing it (layout change signals)
+- (void)invalidateCacheForService:(NSString *)serviceName objectPath:(NSString *)objectPath;
 - (void)invalidateCacheForApplication:(NSString *)applicationName;
 - (void)clearCache;
 
 // Cache management
 - (void)setMaxCacheSize:(NSUInteger)maxSize;
 - (void)setMaxCacheAge:(NSTimeInterval)maxAge;
+- (void)setMaxCacheBytes:(NSUInteger)maxBytes;
 - (void)performMaintenance;
 
 // Statistics
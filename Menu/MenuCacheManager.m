@@ -1,9 +1,155 @@
 #import "MenuCacheManager.h"
 #import "MenuUtils.h"
 
+// Rough per-object costs used for cache accounting; NSMenuItem carries a cell and
+// attributed title state, NSMenu its item array and (once shown) a menu representation
+static const NSUInteger kLiveMenuBytes = 512;
+static const NSUInteger kLiveMenuItemBytes = 384;
+static const NSUInteger kSnapshotBytes = 64;
+
+@implementation MenuSnapshot
+
+@synthesize count = _count;
+@synthesize totalItemCount = _totalItemCount;
+@synthesize byteSize = _byteSize;
+
++ (MenuSnapshot *)snapshotOfMenu:(NSMenu *)menu
+{
+    if (!menu) {
+        return nil;
+    }
+    
+    NSArray *itemArray = [menu itemArray];
+    NSUInteger count = [itemArray count];
+    MenuSnapshotItem *items = calloc(count > 0 ? count : 1, sizeof(MenuSnapshotItem));
+    if (!items) {
+        return nil;
+    }
+    
+    NSUInteger totalItemCount = count;
+    NSUInteger byteSize = kSnapshotBytes + count * sizeof(MenuSnapshotItem) + [[menu title] length];
+    NSUInteger filled = 0;
+    BOOL restorable = YES;
+    
+    for (NSUInteger i = 0; i < count && restorable; i++) {
+        NSMenuItem *item = [itemArray objectAtIndex:i];
+        MenuSnapshotItem *entry = &items[i];
+        
+        if ([item isSeparatorItem]) {
+            entry->separator = YES;
+            filled++;
+            continue;
+        }
+        
+        id target = [item target];
+        if ((target && ![target conformsToProtocol:@protocol(MenuSnapshotRestorable)]) || [item image]) {
+            restorable = NO;
+            break;
+        }
+        
+        MenuSnapshot *submenuSnapshot = nil;
+        if ([item hasSubmenu]) {
+            // Lazily populated submenus live in their delegate and cannot be copied
+            if ([[item submenu] delegate]) {
+                restorable = NO;
+                break;
+            }
+            submenuSnapshot = [MenuSnapshot snapshotOfMenu:[item submenu]];
+            if (!submenuSnapshot) {
+                restorable = NO;
+                break;
+            }
+            totalItemCount += [submenuSnapshot totalItemCount];
+            byteSize += [submenuSnapshot byteSize];
+        }
+        
+        entry->title = [[item title] copy];
+        entry->keyEquivalent = [[item keyEquivalent] copy];
+        entry->representedObject = [[item representedObject] retain];
+        entry->target = target;
+        entry->action = [item action];
+        entry->submenu = [submenuSnapshot retain];
+        entry->tag = [item tag];
+        entry->modifierMask = [item keyEquivalentModifierMask];
+        entry->state = [item state];
+        entry->enabled = [item isEnabled];
+        byteSize += [entry->title length] + [entry->keyEquivalent length];
+        filled++;
+    }
+    
+    MenuSnapshot *snapshot = [[MenuSnapshot alloc] init];
+    snapshot->_title = [[menu title] copy];
+    snapshot->_items = items;
+    snapshot->_count = filled;
+    snapshot->_totalItemCount = totalItemCount;
+    snapshot->_byteSize = byteSize;
+    
+    if (!restorable) {
+        [snapshot release];
+        return nil;
+    }
+    return [snapshot autorelease];
+}
+
+- (void)dealloc
+{
+    for (NSUInteger i = 0; i < _count; i++) {
+        [_items[i].title release];
+        [_items[i].keyEquivalent release];
+        [_items[i].representedObject release];
+        [_items[i].submenu release];
+    }
+    free(_items);
+    [_title release];
+    [super dealloc];
+}
+
+- (NSMenu *)materializeMenu
+{
+    NSMenu *menu = [[NSMenu alloc] initWithTitle:_title ?: @""];
+    
+    for (NSUInteger i = 0; i < _count; i++) {
+        MenuSnapshotItem *entry = &_items[i];
+        
+        if (entry->separator) {
+            [menu addItem:[NSMenuItem separatorItem]];
+            continue;
+        }
+        
+        NSMenuItem *item = [[NSMenuItem alloc] initWithTitle:entry->title
+                                                      action:entry->action
+                                               keyEquivalent:entry->keyEquivalent ?: @""];
+        [item setKeyEquivalentModifierMask:entry->modifierMask];
+        [item setTarget:entry->target];
+        [item setRepresentedObject:entry->representedObject];
+        [item setTag:entry->tag];
+        [item setState:entry->state];
+        [item setEnabled:entry->enabled];
+        
+        if (entry->submenu) {
+            NSMenu *submenu = [(MenuSnapshot *)entry->submenu materializeMenu];
+            [item setSubmenu:submenu];
+        }
+        
+        [menu addItem:item];
+        [item release];
+    }
+    
+    return [menu autorelease];
+}
+
+@end
+
 @implementation MenuCacheEntry
 
 @synthesize menu = _menu;
+@synthesize snapshot = _snapshot;
+@synthesize estimatedBytes = _estimatedBytes;
+@synthesize itemCount = _itemCount;
+@synthesize menuKey = _menuKey;
+@synthesize windowKeys = _windowKeys;
+@synthesize lruPrev = _lruPrev;
+@synthesize lruNext = _lruNext;
 @synthesize lastAccessed = _lastAccessed;
 @synthesize cached = _cached;
 @synthesize accessCount = _accessCount;
@@ -25,13 +171,43 @@
         _serviceName = [serviceName retain];
         _objectPath = [objectPath retain];
         _applicationName = [applicationName retain];
+        _snapshot = nil;
+        _menuKey = nil;
+        _windowKeys = [[NSMutableSet alloc] init];
+        _lruPrev = nil;
+        _lruNext = nil;
+        _estimatedBytes = [MenuCacheEntry estimatedBytesForMenu:menu itemCount:&_itemCount];
     }
     return self;
 }
 
++ (NSUInteger)estimatedBytesForMenu:(NSMenu *)menu itemCount:(NSUInteger *)itemCount
+{
+    NSUInteger bytes = kLiveMenuBytes + [[menu title] length] * sizeof(unichar);
+    NSUInteger items = 0;
+    
+    for (NSMenuItem *item in [menu itemArray]) {
+        bytes += kLiveMenuItemBytes + ([[item title] length] + [[item keyEquivalent] length]) * sizeof(unichar);
+        items++;
+        if ([item hasSubmenu]) {
+            NSUInteger subItems = 0;
+            bytes += [self estimatedBytesForMenu:[item submenu] itemCount:&subItems];
+            items += subItems;
+        }
+    }
+    
+    if (itemCount) {
+        *itemCount = items;
+    }
+    return bytes;
+}
+
 - (void)dealloc
 {
     [_menu release];
+    [_snapshot release];
+    [_menuKey release];
+    [_windowKeys release];
     [_serviceName release];
     [_objectPath release];
     [_applicationName release];
@@ -66,16 +242,35 @@
     return YES;
 }
 
+- (BOOL)isLive
+{
+    return _menu != nil;
+}
+
 @end
 
 @implementation MenuCacheManager
 
 static MenuCacheManager *sharedInstance = nil;
 
+// Menus whose access counts are remembered after their entries are removed
+static const NSUInteger kMaxAccessHistory = 256;
+
+// Windows showing the same export share one entry; menus without one stay per window
+static NSString *menuKeyForExport(NSString *serviceName, NSString *objectPath, unsigned long windowId)
+{
+    if (serviceName && objectPath) {
+        return [NSString stringWithFormat:@"%@|%@", serviceName, objectPath];
+    }
+    return [NSString stringWithFormat:@"window|%lu", windowId];
+}
+
 + (MenuCacheManager *)sharedManager
 {
-    if (!sharedInstance) {
-        sharedInstance = [[MenuCacheManager alloc] init];
+    @synchronized(self) {
+        if (!sharedInstance) {
+            sharedInstance = [[MenuCacheManager alloc] init];
+        }
     }
     return sharedInstance;
 }
@@ -85,14 +280,23 @@ static MenuCacheManager *sharedInstance = nil;
     self = [super init];
     if (self) {
         _cache = [[NSMutableDictionary alloc] init];
-        _lruOrder = [[NSMutableArray alloc] init];
+        _windowMenuKeys = [[NSMutableDictionary alloc] init];
+        _accessHistory = [[NSMutableDictionary alloc] init];
+        _lruHead = nil;
+        _lruTail = nil;
         _maxCacheSize = 50;    // Increased cache size for complex apps like GIMP
         _maxCacheAge = 1800.0; // 30 minutes cache age for better persistence
+        _maxCacheBytes = 8 * 1024 * 1024;
+        _totalBytes = 0;
         
         // Initialize statistics
         _cacheHits = 0;
         _cacheMisses = 0;
         _cacheEvictions = 0;
+        _snapshotDemotions = 0;
+        _snapshotMaterializations = 0;
+        _menuLoads = 0;
+        _sharedHits = 0;
         
         // Set up periodic maintenance (less frequent to avoid disruption)
         _cleanupTimer = [NSTimer scheduledTimerWithTimeInterval:120.0  // Every 2 minutes
@@ -101,8 +305,8 @@ static MenuCacheManager *sharedInstance = nil;
                                                       userInfo:nil
                                                        repeats:YES];
         
-        NSLog(@"MenuCacheManager: Initialized with maxSize=%lu maxAge=%.1fs", 
-              (unsigned long)_maxCacheSize, _maxCacheAge);
+        NSLog(@"MenuCacheManager: Initialized with maxSize=%lu maxAge=%.1fs maxBytes=%lu", 
+              (unsigned long)_maxCacheSize, _maxCacheAge, (unsigned long)_maxCacheBytes);
     }
     return self;
 }
@@ -111,41 +315,186 @@ static MenuCacheManager *sharedInstance = nil;
 {
     [_cleanupTimer invalidate];
     [_cache release];
-    [_lruOrder release];
+    [_windowMenuKeys release];
+    [_accessHistory release];
     [super dealloc];
 }
 
-#pragma mark - Cache Operations
+#pragma mark - LRU List
 
-- (NSMenu *)getCachedMenuForWindow:(unsigned long)windowId
+- (void)unlinkEntry:(MenuCacheEntry *)entry
 {
-    NSNumber *windowKey = [NSNumber numberWithUnsignedLong:windowId];
-    MenuCacheEntry *entry = [_cache objectForKey:windowKey];
+    MenuCacheEntry *prev = [entry lruPrev];
+    MenuCacheEntry *next = [entry lruNext];
     
-    if (!entry) {
-        _cacheMisses++;
-        NSLog(@"MenuCacheManager: Cache MISS for window %lu", windowId);
-        return nil;
+    if (prev) {
+        [prev setLruNext:next];
+    } else if (_lruHead == entry) {
+        _lruHead = next;
+    }
+    if (next) {
+        [next setLruPrev:prev];
+    } else if (_lruTail == entry) {
+        _lruTail = prev;
     }
     
-    // Check if entry is stale
-    if ([entry isStale:_maxCacheAge]) {
-        NSLog(@"MenuCacheManager: Cache entry for window %lu is stale (age: %.1fs), removing", 
-              windowId, [entry age]);
-        [self invalidateCacheForWindow:windowId];
-        _cacheMisses++;
-        return nil;
+    [entry setLruPrev:nil];
+    [entry setLruNext:nil];
+}
+
+- (void)linkEntryAtFront:(MenuCacheEntry *)entry
+{
+    [entry setLruPrev:nil];
+    [entry setLruNext:_lruHead];
+    if (_lruHead) {
+        [_lruHead setLruPrev:entry];
     }
+    _lruHead = entry;
+    if (!_lruTail) {
+        _lruTail = entry;
+    }
+}
+
+- (void)removeEntry:(MenuCacheEntry *)entry
+{
+    // Remember how often this menu was used so it can be pre-warmed first next time
+    if ([entry serviceName] && [entry objectPath]) {
+        if ([_accessHistory count] >= kMaxAccessHistory) {
+            [_accessHistory removeAllObjects];
+        }
+        NSUInteger previous = [[_accessHistory objectForKey:[entry menuKey]] unsignedIntegerValue];
+        [_accessHistory setObject:[NSNumber numberWithUnsignedInteger:MAX(previous, [entry accessCount])]
+                           forKey:[entry menuKey]];
+    }
+    
+    // Windows stay attached to the export; the next load for any of them
+    // creates a new shared entry
+    [self unlinkEntry:entry];
+    _totalBytes -= MIN(_totalBytes, [entry estimatedBytes]);
+    // The dictionary holds the last reference to entry (and thereby to its key)
+    NSString *menuKey = [[[entry menuKey] retain] autorelease];
+    [_cache removeObjectForKey:menuKey];
+}
+
+- (MenuCacheEntry *)entryForWindow:(unsigned long)windowId
+{
+    NSString *menuKey = [_windowMenuKeys objectForKey:[NSNumber numberWithUnsignedLong:windowId]];
+    return menuKey ? [_cache objectForKey:menuKey] : nil;
+}
+
+// Points the window at menuKey, leaving the entry of any other export it showed
+- (void)attachWindowKey:(NSNumber *)windowKey toMenuKey:(NSString *)menuKey
+{
+    NSString *previousKey = [_windowMenuKeys objectForKey:windowKey];
+    if ([previousKey isEqualToString:menuKey]) {
+        [[[_cache objectForKey:menuKey] windowKeys] addObject:windowKey];
+        return;
+    }
+    
+    if (previousKey) {
+        MenuCacheEntry *previous = [_cache objectForKey:previousKey];
+        [[previous windowKeys] removeObject:windowKey];
+        if (previous && [[previous windowKeys] count] == 0) {
+            [self removeEntry:previous];
+        }
+    }
+    
+    [_windowMenuKeys setObject:menuKey forKey:windowKey];
+    [[[_cache objectForKey:menuKey] windowKeys] addObject:windowKey];
+}
+
+#pragma mark - Cache Operations
+
+- (NSMenu *)getCachedMenuForWindow:(unsigned long)windowId
+{
+    @synchronized(self) {
+        MenuCacheEntry *entry = [self entryForWindow:windowId];
+    
+        if (!entry) {
+            _cacheMisses++;
+            NSLog(@"MenuCacheManager: Cache MISS for window %lu", windowId);
+            return nil;
+        }
+    
+        // Check if entry is stale
+        if ([entry isStale:_maxCacheAge]) {
+            NSLog(@"MenuCacheManager: Cache entry for window %lu is stale (age: %.1fs), removing", 
+                  windowId, [entry age]);
+            [self removeEntry:entry];
+            _cacheMisses++;
+            return nil;
+        }
+    
+        // Demoted entries are materialized back into a live NSMenu on demand
+        if (![entry isLive]) {
+            NSMenu *menu = [[entry snapshot] materializeMenu];
+            if (!menu) {
+                [self removeEntry:entry];
+                _cacheMisses++;
+                return nil;
+            }
+        
+            NSUInteger itemCount = 0;
+            NSUInteger liveBytes = [MenuCacheEntry estimatedBytesForMenu:menu itemCount:&itemCount];
+            _totalBytes = _totalBytes - MIN(_totalBytes, [entry estimatedBytes]) + liveBytes;
+            [entry setMenu:menu];
+            [entry setSnapshot:nil];
+            [entry setEstimatedBytes:liveBytes];
+            _snapshotMaterializations++;
+            NSLog(@"MenuCacheManager: Materialized menu for window %lu from snapshot (%lu items)", 
+                  windowId, (unsigned long)itemCount);
+        }
+    
+        // Update access tracking
+        [entry touch];
+        [self moveToFront:entry];
+        [self enforceBudget];
     
-    // Update access tracking
-    [entry touch];
-    [self moveToFront:windowKey];
+        _cacheHits++;
+        if ([[entry windowKeys] count] > 1) {
+            _sharedHits++;
+        }
+        NSLog(@"MenuCacheManager: Cache HIT for window %lu (accessed %lu times, age: %.1fs, shared by %lu windows)", 
+              windowId, (unsigned long)[entry accessCount], [entry age], (unsigned long)[[entry windowKeys] count]);
     
-    _cacheHits++;
-    NSLog(@"MenuCacheManager: Cache HIT for window %lu (accessed %lu times, age: %.1fs)", 
-          windowId, (unsigned long)[entry accessCount], [entry age]);
+        // Another thread may evict the entry as soon as the lock is released
+        return [[[entry menu] retain] autorelease];
+    }
+}
+
+- (NSUInteger)accessCountForService:(NSString *)serviceName objectPath:(NSString *)objectPath
+{
+    if (!serviceName || !objectPath) {
+        return 0;
+    }
     
-    return [entry menu];
+    @synchronized(self) {
+        NSString *menuKey = menuKeyForExport(serviceName, objectPath, 0);
+        NSUInteger accessCount = [[_cache objectForKey:menuKey] accessCount];
+        return MAX(accessCount, [[_accessHistory objectForKey:menuKey] unsignedIntegerValue]);
+    }
+}
+
+- (BOOL)hasCachedMenuForWindow:(unsigned long)windowId
+{
+    @synchronized(self) {
+        MenuCacheEntry *entry = [self entryForWindow:windowId];
+        return entry != nil && ![entry isStale:_maxCacheAge];
+    }
+}
+
+- (void)attachWindow:(unsigned long)windowId serviceName:(NSString *)serviceName objectPath:(NSString *)objectPath
+{
+    @synchronized(self) {
+        NSString *menuKey = menuKeyForExport(serviceName, objectPath, windowId);
+        [self attachWindowKey:[NSNumber numberWithUnsignedLong:windowId] toMenuKey:menuKey];
+        
+        MenuCacheEntry *entry = [_cache objectForKey:menuKey];
+        if (entry) {
+            NSLog(@"MenuCacheManager: Window %lu shares the cached menu of %@ (%lu windows)",
+                  windowId, menuKey, (unsigned long)[[entry windowKeys] count]);
+        }
+    }
 }
 
 - (void)cacheMenu:(NSMenu *)menu 
@@ -154,96 +503,151 @@ static MenuCacheManager *sharedInstance = nil;
        objectPath:(NSString *)objectPath
   applicationName:(NSString *)applicationName
 {
-    if (!menu) {
-        NSLog(@"MenuCacheManager: Cannot cache nil menu for window %lu", windowId);
-        return;
-    }
+    @synchronized(self) {
+        if (!menu) {
+            NSLog(@"MenuCacheManager: Cannot cache nil menu for window %lu", windowId);
+            return;
+        }
     
-    NSNumber *windowKey = [NSNumber numberWithUnsignedLong:windowId];
+        NSNumber *windowKey = [NSNumber numberWithUnsignedLong:windowId];
+        NSString *menuKey = menuKeyForExport(serviceName, objectPath, windowId);
+        _menuLoads++;
     
-    // Remove existing entry if present
-    [self invalidateCacheForWindow:windowId];
+        // A fresh load replaces the shared menu for every window of the export
+        MenuCacheEntry *existing = [_cache objectForKey:menuKey];
+        if (existing) {
+            [self removeEntry:existing];
+        }
     
-    // Ensure we don't exceed cache size limit
-    while ([_cache count] >= _maxCacheSize && [_lruOrder count] > 0) {
-        [self evictLRUEntry];
-    }
+        // Ensure we don't exceed cache size limit
+        while ([_cache count] >= _maxCacheSize && _lruTail) {
+            [self evictLRUEntry];
+        }
     
-    // Create new cache entry
-    MenuCacheEntry *entry = [[MenuCacheEntry alloc] initWithMenu:menu
-                                                     serviceName:serviceName
-                                                      objectPath:objectPath
-                                                 applicationName:applicationName];
+        // Create new cache entry
+        MenuCacheEntry *entry = [[MenuCacheEntry alloc] initWithMenu:menu
+                                                         serviceName:serviceName
+                                                          objectPath:objectPath
+                                                     applicationName:applicationName];
+        [entry setMenuKey:menuKey];
+    
+        [_cache setObject:entry forKey:menuKey];
+        [self linkEntryAtFront:entry];  // Add to front (most recent)
+        _totalBytes += [entry estimatedBytes];
+    
+        // Every window already attached to the export shares the new menu
+        [self attachWindowKey:windowKey toMenuKey:menuKey];
+        for (NSNumber *otherKey in _windowMenuKeys) {
+            if ([[_windowMenuKeys objectForKey:otherKey] isEqualToString:menuKey]) {
+                [[entry windowKeys] addObject:otherKey];
+            }
+        }
     
-    [_cache setObject:entry forKey:windowKey];
-    [_lruOrder insertObject:windowKey atIndex:0];  // Add to front (most recent)
+        NSLog(@"MenuCacheManager: Cached menu for window %lu (%@ - %@) with %lu items (~%lu bytes), shared by %lu windows", 
+              windowId, applicationName ?: @"Unknown App", serviceName, 
+              (unsigned long)[entry itemCount], (unsigned long)[entry estimatedBytes],
+              (unsigned long)[[entry windowKeys] count]);
     
-    NSLog(@"MenuCacheManager: Cached menu for window %lu (%@ - %@) with %lu items", 
-          windowId, applicationName ?: @"Unknown App", serviceName, 
-          (unsigned long)[[menu itemArray] count]);
+        [entry release];
     
-    [entry release];
+        [self enforceBudget];
+    }
 }
 
 - (void)invalidateCacheForWindow:(unsigned long)windowId
 {
-    NSNumber *windowKey = [NSNumber numberWithUnsignedLong:windowId];
-    MenuCacheEntry *entry = [_cache objectForKey:windowKey];
+    @synchronized(self) {
+        NSNumber *windowKey = [NSNumber numberWithUnsignedLong:windowId];
+        NSString *menuKey = [_windowMenuKeys objectForKey:windowKey];
+        if (!menuKey) {
+            return;
+        }
     
-    if (entry) {
-        NSLog(@"MenuCacheManager: Invalidating cache for window %lu (%@)", 
-              windowId, [entry applicationName] ?: @"Unknown App");
-        
-        [_cache removeObjectForKey:windowKey];
-        [_lruOrder removeObject:windowKey];
+        MenuCacheEntry *entry = [[[_cache objectForKey:menuKey] retain] autorelease];
+        [_windowMenuKeys removeObjectForKey:windowKey];
+        if (!entry) {
+            return;
+        }
+    
+        [[entry windowKeys] removeObject:windowKey];
+        if ([[entry windowKeys] count] == 0) {
+            NSLog(@"MenuCacheManager: Invalidating cache for window %lu (%@)", 
+                  windowId, [entry applicationName] ?: @"Unknown App");
+            [self removeEntry:entry];
+        } else {
+            NSLog(@"MenuCacheManager: Detached window %lu from %@ (still shared by %lu windows)", 
+                  windowId, menuKey, (unsigned long)[[entry windowKeys] count]);
+        }
     }
 }
 
-- (void)invalidateCacheForApplication:(NSString *)applicationName
+- (void)invalidateCacheForService:(NSString *)serviceName objectPath:(NSString *)objectPath
 {
-    if (!applicationName) {
+    if (!serviceName || !objectPath) {
         return;
     }
     
-    NSLog(@"MenuCacheManager: Invalidating cache for application: %@", applicationName);
+    @synchronized(self) {
+        MenuCacheEntry *entry = [_cache objectForKey:menuKeyForExport(serviceName, objectPath, 0)];
+        if (entry) {
+            NSLog(@"MenuCacheManager: Invalidating menu of %@%@ shared by %lu windows", 
+                  serviceName, objectPath, (unsigned long)[[entry windowKeys] count]);
+            [self removeEntry:entry];
+        }
+    }
+}
+
+- (void)invalidateCacheForApplication:(NSString *)applicationName
+{
+    @synchronized(self) {
+        if (!applicationName) {
+            return;
+        }
+    
+        NSLog(@"MenuCacheManager: Invalidating cache for application: %@", applicationName);
     
-    NSMutableArray *windowsToRemove = [NSMutableArray array];
+        NSMutableArray *entriesToRemove = [NSMutableArray array];
     
-    for (NSNumber *windowKey in [_cache allKeys]) {
-        MenuCacheEntry *entry = [_cache objectForKey:windowKey];
-        if ([[entry applicationName] isEqualToString:applicationName]) {
-            [windowsToRemove addObject:windowKey];
+        for (MenuCacheEntry *entry = _lruHead; entry; entry = [entry lruNext]) {
+            if ([[entry applicationName] isEqualToString:applicationName]) {
+                [entriesToRemove addObject:entry];
+            }
         }
-    }
     
-    for (NSNumber *windowKey in windowsToRemove) {
-        unsigned long windowId = [windowKey unsignedLongValue];
-        [self invalidateCacheForWindow:windowId];
-    }
+        for (MenuCacheEntry *entry in entriesToRemove) {
+            [self removeEntry:entry];
+        }
     
-    NSLog(@"MenuCacheManager: Invalidated %lu cached menus for application %@", 
-          (unsigned long)[windowsToRemove count], applicationName);
+        NSLog(@"MenuCacheManager: Invalidated %lu cached menus for application %@", 
+              (unsigned long)[entriesToRemove count], applicationName);
+    }
 }
 
 - (void)clearCache
 {
-    NSUInteger count = [_cache count];
-    [_cache removeAllObjects];
-    [_lruOrder removeAllObjects];
-    
-    NSLog(@"MenuCacheManager: Cleared entire cache (%lu entries)", (unsigned long)count);
+    @synchronized(self) {
+        NSUInteger count = [_cache count];
+        [_cache removeAllObjects];
+        _lruHead = nil;
+        _lruTail = nil;
+        _totalBytes = 0;
+    
+        NSLog(@"MenuCacheManager: Cleared entire cache (%lu entries)", (unsigned long)count);
+    }
 }
 
 #pragma mark - Cache Management
 
 - (void)setMaxCacheSize:(NSUInteger)maxSize
 {
-    _maxCacheSize = maxSize;
-    NSLog(@"MenuCacheManager: Set max cache size to %lu", (unsigned long)maxSize);
+    @synchronized(self) {
+        _maxCacheSize = maxSize;
+        NSLog(@"MenuCacheManager: Set max cache size to %lu", (unsigned long)maxSize);
     
-    // Evict entries if we're now over the limit
-    while ([_cache count] > _maxCacheSize && [_lruOrder count] > 0) {
-        [self evictLRUEntry];
+        // Evict entries if we're now over the limit
+        while ([_cache count] > _maxCacheSize && _lruTail) {
+            [self evictLRUEntry];
+        }
     }
 }
 
@@ -253,118 +657,187 @@ static MenuCacheManager *sharedInstance = nil;
     NSLog(@"MenuCacheManager: Set max cache age to %.1fs", maxAge);
 }
 
-- (void)performMaintenance
+- (void)setMaxCacheBytes:(NSUInteger)maxBytes
+{
+    @synchronized(self) {
+        _maxCacheBytes = maxBytes;
+        NSLog(@"MenuCacheManager: Set max cache bytes to %lu", (unsigned long)maxBytes);
+        [self enforceBudget];
+    }
+}
+
+- (void)enforceBudget
 {
-    NSMutableArray *staleWindows = [NSMutableArray array];
+    if (_totalBytes <= _maxCacheBytes) {
+        return;
+    }
     
-    // Find stale entries
-    for (NSNumber *windowKey in [_cache allKeys]) {
-        MenuCacheEntry *entry = [_cache objectForKey:windowKey];
-        if ([entry isStale:_maxCacheAge]) {
-            [staleWindows addObject:windowKey];
+    // First demote live menus (least recent first) to compact snapshots; the
+    // most recently used entry always stays live since it is likely on screen
+    for (MenuCacheEntry *entry = _lruTail; entry && entry != _lruHead && _totalBytes > _maxCacheBytes;
+         entry = [entry lruPrev]) {
+        if (![entry isLive]) {
+            continue;
         }
+        
+        MenuSnapshot *snapshot = [MenuSnapshot snapshotOfMenu:[entry menu]];
+        if (!snapshot) {
+            continue;
+        }
+        
+        _totalBytes = _totalBytes - MIN(_totalBytes, [entry estimatedBytes]) + [snapshot byteSize];
+        NSLog(@"MenuCacheManager: Demoted %@ to snapshot (%lu -> %lu bytes)", 
+              [entry menuKey], (unsigned long)[entry estimatedBytes], (unsigned long)[snapshot byteSize]);
+        [entry setSnapshot:snapshot];
+        [entry setMenu:nil];
+        [entry setEstimatedBytes:[snapshot byteSize]];
+        _snapshotDemotions++;
     }
     
-    // Remove stale entries
-    for (NSNumber *windowKey in staleWindows) {
-        unsigned long windowId = [windowKey unsignedLongValue];
-        NSLog(@"MenuCacheManager: Removing stale cache entry for window %lu", windowId);
-        [self invalidateCacheForWindow:windowId];
+    // Still over budget: evict from the cold end
+    while (_totalBytes > _maxCacheBytes && _lruTail && _lruTail != _lruHead) {
+        [self evictLRUEntry];
     }
+}
+
+- (void)performMaintenance
+{
+    @synchronized(self) {
+        NSMutableArray *staleEntries = [NSMutableArray array];
+    
+        // Find stale entries
+        for (MenuCacheEntry *entry = _lruHead; entry; entry = [entry lruNext]) {
+            if ([entry isStale:_maxCacheAge]) {
+                [staleEntries addObject:entry];
+            }
+        }
     
-    if ([staleWindows count] > 0) {
-        NSLog(@"MenuCacheManager: Maintenance removed %lu stale entries", 
-              (unsigned long)[staleWindows count]);
-    }
+        // Remove stale entries
+        for (MenuCacheEntry *entry in staleEntries) {
+            NSLog(@"MenuCacheManager: Removing stale cache entry for %@", [entry menuKey]);
+            [self removeEntry:entry];
+        }
+    
+        if ([staleEntries count] > 0) {
+            NSLog(@"MenuCacheManager: Maintenance removed %lu stale entries", 
+                  (unsigned long)[staleEntries count]);
+        }
     
-    // Log statistics periodically (every 10 minutes)
-    static NSUInteger maintenanceCount = 0;
-    maintenanceCount++;
-    if (maintenanceCount % 10 == 0) {
-        [self logCacheStatistics];
+        // Log statistics periodically (every 10 minutes)
+        static NSUInteger maintenanceCount = 0;
+        maintenanceCount++;
+        if (maintenanceCount % 10 == 0) {
+            [self logCacheStatistics];
+        }
     }
 }
 
 - (void)evictLRUEntry
 {
-    if ([_lruOrder count] == 0) {
+    MenuCacheEntry *entry = _lruTail;
+    if (!entry) {
         return;
     }
     
-    NSNumber *lruWindowKey = [_lruOrder lastObject];
-    unsigned long windowId = [lruWindowKey unsignedLongValue];
-    
-    MenuCacheEntry *entry = [_cache objectForKey:lruWindowKey];
-    NSLog(@"MenuCacheManager: Evicting LRU entry for window %lu (%@)", 
-          windowId, [entry applicationName] ?: @"Unknown App");
+    NSLog(@"MenuCacheManager: Evicting LRU entry for %@ (%@)", 
+          [entry menuKey], [entry applicationName] ?: @"Unknown App");
     
-    [_cache removeObjectForKey:lruWindowKey];
-    [_lruOrder removeLastObject];
+    [self removeEntry:entry];
     _cacheEvictions++;
 }
 
-- (void)moveToFront:(NSNumber *)windowKey
+- (void)moveToFront:(MenuCacheEntry *)entry
 {
-    [_lruOrder removeObject:windowKey];
-    [_lruOrder insertObject:windowKey atIndex:0];
+    if (!entry || entry == _lruHead) {
+        return;
+    }
+    [self unlinkEntry:entry];
+    [self linkEntryAtFront:entry];
 }
 
 #pragma mark - Statistics
 
 - (NSDictionary *)getCacheStatistics
 {
-    NSUInteger totalRequests = _cacheHits + _cacheMisses;
-    double hitRatio = (totalRequests > 0) ? ((double)_cacheHits / totalRequests) * 100.0 : 0.0;
+    @synchronized(self) {
+        NSUInteger totalRequests = _cacheHits + _cacheMisses;
+        double hitRatio = (totalRequests > 0) ? ((double)_cacheHits / totalRequests) * 100.0 : 0.0;
+    
+        NSUInteger liveEntries = 0;
+        for (MenuCacheEntry *entry = _lruHead; entry; entry = [entry lruNext]) {
+            if ([entry isLive]) {
+                liveEntries++;
+            }
+        }
     
-    return @{
-        @"cacheSize": @([_cache count]),
-        @"maxCacheSize": @(_maxCacheSize),
-        @"maxCacheAge": @(_maxCacheAge),
-        @"cacheHits": @(_cacheHits),
-        @"cacheMisses": @(_cacheMisses),
-        @"cacheEvictions": @(_cacheEvictions),
-        @"hitRatio": @(hitRatio),
-        @"totalRequests": @(totalRequests)
-    };
+        return @{
+            @"cacheSize": @([_cache count]),
+            @"attachedWindows": @([_windowMenuKeys count]),
+            @"menuLoads": @(_menuLoads),
+            @"sharedHits": @(_sharedHits),
+            @"maxCacheSize": @(_maxCacheSize),
+            @"cacheBytes": @(_totalBytes),
+            @"maxCacheBytes": @(_maxCacheBytes),
+            @"liveEntries": @(liveEntries),
+            @"snapshotEntries": @([_cache count] - liveEntries),
+            @"snapshotDemotions": @(_snapshotDemotions),
+            @"snapshotMaterializations": @(_snapshotMaterializations),
+            @"hitRate": @(totalRequests > 0 ? (double)_cacheHits / totalRequests : 0.0),
+            @"maxCacheAge": @(_maxCacheAge),
+            @"cacheHits": @(_cacheHits),
+            @"cacheMisses": @(_cacheMisses),
+            @"cacheEvictions": @(_cacheEvictions),
+            @"hitRatio": @(hitRatio),
+            @"totalRequests": @(totalRequests)
+        };
+    }
 }
 
 - (void)logCacheStatistics
 {
-    NSDictionary *stats = [self getCacheStatistics];
-    
-    NSLog(@"MenuCacheManager: === CACHE STATISTICS ===");
-    NSLog(@"MenuCacheManager: Cache size: %@ / %@", stats[@"cacheSize"], stats[@"maxCacheSize"]);
-    NSLog(@"MenuCacheManager: Cache hits: %@, misses: %@, evictions: %@", 
-          stats[@"cacheHits"], stats[@"cacheMisses"], stats[@"cacheEvictions"]);
-    NSLog(@"MenuCacheManager: Hit ratio: %.1f%% (%@ total requests)", 
-          [stats[@"hitRatio"] doubleValue], stats[@"totalRequests"]);
-    NSLog(@"MenuCacheManager: Max cache age: %.1fs", [stats[@"maxCacheAge"] doubleValue]);
-    
-    // Log current cache contents
-    if ([_cache count] > 0) {
-        NSLog(@"MenuCacheManager: Cached windows:");
-        for (NSNumber *windowKey in _lruOrder) {
-            MenuCacheEntry *entry = [_cache objectForKey:windowKey];
-            NSLog(@"MenuCacheManager:   Window %@ (%@): %lu items, age %.1fs, accessed %lu times",
-                  windowKey, [entry applicationName] ?: @"Unknown",
-                  (unsigned long)[[entry menu] numberOfItems],
-                  [entry age], (unsigned long)[entry accessCount]);
+    @synchronized(self) {
+        NSDictionary *stats = [self getCacheStatistics];
+    
+        NSLog(@"MenuCacheManager: === CACHE STATISTICS ===");
+        NSLog(@"MenuCacheManager: Cache size: %@ / %@", stats[@"cacheSize"], stats[@"maxCacheSize"]);
+        NSLog(@"MenuCacheManager: Cache hits: %@, misses: %@, evictions: %@", 
+              stats[@"cacheHits"], stats[@"cacheMisses"], stats[@"cacheEvictions"]);
+        NSLog(@"MenuCacheManager: Hit ratio: %.1f%% (%@ total requests)", 
+              [stats[@"hitRatio"] doubleValue], stats[@"totalRequests"]);
+        NSLog(@"MenuCacheManager: Memory: %@ / %@ bytes (%@ live, %@ snapshots; %@ demotions, %@ materializations)", 
+              stats[@"cacheBytes"], stats[@"maxCacheBytes"], stats[@"liveEntries"], stats[@"snapshotEntries"],
+              stats[@"snapshotDemotions"], stats[@"snapshotMaterializations"]);
+        NSLog(@"MenuCacheManager: Windows: %@ sharing %@ cached menus (%@ loads, %@ hits on another window's load)", 
+              stats[@"attachedWindows"], stats[@"cacheSize"], stats[@"menuLoads"], stats[@"sharedHits"]);
+        NSLog(@"MenuCacheManager: Max cache age: %.1fs", [stats[@"maxCacheAge"] doubleValue]);
+    
+        // Log current cache contents
+        if ([_cache count] > 0) {
+            NSLog(@"MenuCacheManager: Cached menus:");
+            for (MenuCacheEntry *entry = _lruHead; entry; entry = [entry lruNext]) {
+                NSLog(@"MenuCacheManager:   %@ (%@): %lu windows, %lu items, %lu bytes%@, age %.1fs, accessed %lu times",
+                      [entry menuKey], [entry applicationName] ?: @"Unknown", (unsigned long)[[entry windowKeys] count],
+                      (unsigned long)[entry itemCount], (unsigned long)[entry estimatedBytes],
+                      [entry isLive] ? @"" : @" (snapshot)",
+                      [entry age], (unsigned long)[entry accessCount]);
+            }
         }
+        NSLog(@"MenuCacheManager: ========================");
     }
-    NSLog(@"MenuCacheManager: ========================");
 }
 
 #pragma mark - Window Lifecycle
 
 - (void)windowBecameActive:(unsigned long)windowId
 {
-    NSNumber *windowKey = [NSNumber numberWithUnsignedLong:windowId];
-    MenuCacheEntry *entry = [_cache objectForKey:windowKey];
+    @synchronized(self) {
+        MenuCacheEntry *entry = [self entryForWindow:windowId];
     
-    if (entry) {
-        [entry touch];
-        [self moveToFront:windowKey];
-        NSLog(@"MenuCacheManager: Window %lu became active, moved to cache front", windowId);
+        if (entry) {
+            [entry touch];
+            [self moveToFront:entry];
+            NSLog(@"MenuCacheManager: Window %lu became active, moved to cache front", windowId);
+        }
     }
 }
 
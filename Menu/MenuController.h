@@ -8,6 +8,7 @@
 @class AppMenuWidget;
 @class MenuProtocolManager;
 @class RoundedCornersView;
+@class X11WindowRegistry;
 
 @interface MenuController : NSObject <NSApplicationDelegate>
 {
@@ -30,6 +31,7 @@
     Window _rootWindow;
     Atom _netActiveWindowAtom;
     Atom _netClientListAtom;
+    X11WindowRegistry *_windowRegistry;   // Owned by the X11 monitor thread
     NSThread *_x11Thread;
     BOOL _shouldStopMonitoring;
     int _dbusFileDescriptor;
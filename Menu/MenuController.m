@@ -6,6 +6,11 @@
 #import "GTKMenuImporter.h"
 #import "RoundedCornersView.h"
 #import "X11ShortcutManager.h"
+#import "X11WindowRegistry.h"
+#import "X11DisplayService.h"
+#import "MenuPreWarmScheduler.h"
+#import "MenuIconCache.h"
+#import "MenuTrace.h"
 #import "GNUstepGUI/GSTheme.h"
 #import <X11/Xlib.h>
 #import <X11/Xatom.h>
@@ -54,6 +59,17 @@
     NSLog(@"MenuController: Cleaning up global shortcuts...");
     [[X11ShortcutManager sharedManager] cleanup];
     
+    // Stop background menu pre-warming before the protocol handlers go away
+    [[MenuPreWarmScheduler sharedScheduler] stop];
+    NSDictionary *preWarmStats = [[MenuPreWarmScheduler sharedScheduler] statistics];
+    NSLog(@"MenuPreWarmScheduler: Jobs: %@ completed, %@ yielded, %@ cancelled, %@ deduplicated, %@ dropped",
+          preWarmStats[@"completed"], preWarmStats[@"yielded"], preWarmStats[@"cancelled"],
+          preWarmStats[@"deduplicated"], preWarmStats[@"dropped"]);
+    [[MenuIconCache sharedCache] stop];
+    NSDictionary *iconStats = [[MenuIconCache sharedCache] statistics];
+    NSLog(@"MenuIconCache: Icons: %@ decoded, %@ failed, %@ hits, %@ coalesced, %@ cached",
+          iconStats[@"decoded"], iconStats[@"failed"], iconStats[@"hits"], iconStats[@"coalesced"], iconStats[@"cached"]);
+    
     // Signal the X11 monitoring thread to stop
     _shouldStopMonitoring = YES;
     
@@ -287,13 +303,15 @@
     
     // Set X11 root window properties to announce that we support global menus
     // This is essential for applications to know they should export their menus
-    Display *display = XOpenDisplay(NULL);
+    X11DisplayService *x11 = [X11DisplayService sharedService];
+    Display *display = [x11 display];
     if (!display) {
         NSLog(@"MenuController: Cannot open X11 display to announce global menu support");
         return;
     }
     
-    Window root = DefaultRootWindow(display);
+    Window root = [x11 rootWindow];
+    [x11 lock];
     
     // Set _NET_SUPPORTING_WM property to identify ourselves as the window manager
     // that supports global menus (even though we're not actually a WM)
@@ -345,7 +363,7 @@
     NSLog(@"MenuController: Set _UNITY_SUPPORTED property");
     
     XSync(display, False);
-    XCloseDisplay(display);
+    [x11 unlock];
     
     NSLog(@"MenuController: Global menu support announcement complete");
 }
@@ -377,6 +395,16 @@
     // Do initial scan once when thread starts
     [[MenuProtocolManager sharedManager] scanForExistingMenuServices];
     
+    // From here on, client list and menu property changes are applied
+    // incrementally by the registry instead of rescanning every window
+    // Without a registry (--rescan-windows) every client list change is a full scan
+    if (![X11WindowRegistry rescansClientList]) {
+        _windowRegistry = [[X11WindowRegistry alloc] initWithDisplay:_display rootWindow:_rootWindow];
+    }
+    if (![_windowRegistry seedFromClientList]) {
+        NSLog(@"MenuController: _NET_CLIENT_LIST unavailable, client list changes will trigger full scans");
+    }
+    
     // Get X11 connection file descriptor
     int x11_fd = ConnectionNumber(_display);
     NSLog(@"MenuController: X11 file descriptor: %d, DBus file descriptor: %d", x11_fd, _dbusFileDescriptor);
@@ -393,10 +421,13 @@
                 event.xproperty.atom == _netActiveWindowAtom) {
                 
                 NSLog(@"MenuController: _NET_ACTIVE_WINDOW property changed - active window changed");
+                MenuTraceActiveWindowEvent();
                 
                 // Update the app menu widget for the new active window
                 if (_appMenuWidget) {
+                    MenuTraceTime traceStart = MenuTraceBegin();
                     [_appMenuWidget updateForActiveWindow];
+                    MenuTraceEnd("MenuController.activeWindowChanged", "ui", traceStart, 0);
                 }
             }
             // Check if this is a PropertyNotify event for _NET_CLIENT_LIST (new windows)
@@ -404,10 +435,15 @@
                      event.xproperty.window == _rootWindow &&
                      event.xproperty.atom == _netClientListAtom) {
                 
-                NSLog(@"MenuController: _NET_CLIENT_LIST property changed - new window created/destroyed");
-                
-                // Scan for new GTK menu services when windows are created/destroyed
-                [[MenuProtocolManager sharedManager] scanForExistingMenuServices];
+                // Register/unregister only the windows that were added or removed
+                if (![_windowRegistry synchronizeClientList]) {
+                    NSLog(@"MenuController: _NET_CLIENT_LIST property changed - falling back to full scan");
+                    [[MenuProtocolManager sharedManager] scanForExistingMenuServices];
+                }
+            }
+            // Menu properties set or changed on a client window after it was mapped
+            else if (event.type == PropertyNotify) {
+                [_windowRegistry handlePropertyEvent:&event.xproperty];
             }
         } else {
             // No events pending, sleep briefly to avoid busy waiting
@@ -423,7 +459,10 @@
         }
     }
     
-    NSLog(@"MenuController: X11 monitor thread exiting");
+    NSLog(@"MenuController: X11 monitor thread exiting (%lu window registry round-trips)",
+          (unsigned long)[_windowRegistry roundTrips]);
+    [_windowRegistry release];
+    _windowRegistry = nil;
     [pool release];
 }
 
@@ -460,12 +499,16 @@
     [_timeMenuView setHorizontal:YES];
     [_timeMenuView setAutoresizingMask:NSViewMinXMargin | NSViewMaxYMargin | NSViewMinYMargin];
 
-    // Start timer to update time
-    _timeUpdateTimer = [[NSTimer scheduledTimerWithTimeInterval:1.0
-                                                        target:self
-                                                      selector:@selector(updateTimeMenu)
-                                                      userInfo:nil
-                                                       repeats:YES] retain];
+    // The clock shows minutes, so tick once per minute, just after each minute boundary
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    NSDate *nextMinute = [NSDate dateWithTimeIntervalSinceReferenceDate:(floor(now / 60.0) + 1.0) * 60.0 + 0.05];
+    _timeUpdateTimer = [[NSTimer alloc] initWithFireDate:nextMinute
+                                                interval:60.0
+                                                  target:self
+                                                selector:@selector(updateTimeMenu)
+                                                userInfo:nil
+                                                 repeats:YES];
+    [[NSRunLoop currentRunLoop] addTimer:_timeUpdateTimer forMode:NSDefaultRunLoopMode];
     [self updateTimeMenu];
 }
 
@@ -473,9 +516,16 @@
 {
     NSDate *now = [NSDate date];
     NSString *timeString = [_timeFormatter stringFromDate:now];
-    [_timeMenuItem setTitle:timeString];
-    NSString *dateString = [_dateFormatter stringFromDate:now];
-    [_dateMenuItem setTitle:dateString];
+    // Setting a title relayouts and redraws the clock view, so skip no-op updates
+    if (![timeString isEqualToString:[_timeMenuItem title]]) {
+        [_timeMenuItem setTitle:timeString];
+    }
+    if (_dateMenuItem) {
+        NSString *dateString = [_dateFormatter stringFromDate:now];
+        if (![dateString isEqualToString:[_dateMenuItem title]]) {
+            [_dateMenuItem setTitle:dateString];
+        }
+    }
 }
 
 - (void)dealloc
@@ -0,0 +1,39 @@
+#import <Foundation/Foundation.h>
+#import <AppKit/AppKit.h>
+
+@class MenuSnapshot;
+
+/**
+ * MenuDiskCache
+ *
+ * Persistent store of the last-seen menu tree per application, keyed by
+ * application identity (WM_CLASS plus executable path, see
+ * +[MenuUtils getApplicationIdentityForWindow:]). Each file holds a flat
+ * binary serialization of a MenuSnapshot that is read back through a
+ * memory-mapped NSData, plus a content hash used to tell whether a freshly
+ * fetched menu differs from the stored one. Bus names are not stored, so
+ * neither the file nor its hash depends on which connection owned the menu.
+ */
+@interface MenuDiskCache : NSObject
+{
+    NSString *_directory;
+    NSMutableDictionary *_contentHashes;    // identity -> NSNumber (uint64 content hash)
+    NSUInteger _reads;
+    NSUInteger _readMisses;
+    NSUInteger _writes;
+}
+
++ (MenuDiskCache *)sharedCache;
+
+// Materialize the stored menu for an application, or nil. Its actions are
+// routed to serviceName, the bus name that owns the window's menu now.
+- (NSMenu *)menuForApplicationIdentity:(NSString *)identity serviceName:(NSString *)serviceName;
+
+// Store a menu; returns YES if it differed from what was stored (and was written)
+- (BOOL)storeMenu:(NSMenu *)menu forApplicationIdentity:(NSString *)identity;
+
+- (void)removeMenuForApplicationIdentity:(NSString *)identity;
+
+- (NSDictionary *)statistics;
+
+@end
@@ -0,0 +1,463 @@
+#import "MenuDiskCache.h"
+#import "MenuCacheManager.h"
+#import "MenuItemAction.h"
+
+// File layout (native byte order; the cache never leaves this machine):
+//   uint32 magic, uint32 version, uint64 content hash, uint32 body length,
+//   uint32 identity length, identity bytes, body
+// Body is one menu record:
+//   string title, uint32 item count, items
+// Item record:
+//   uint8 flags, uint8 represented object kind, uint16 reserved, int32 state,
+//   uint32 modifier mask, int64 tag, string title, string key equivalent,
+//   string target class, string action, [represented object], [submenu record]
+// A MenuItemAction represented object is stored as:
+//   uint8 action kind, int64 item ID, string object path, string action name
+// without its service: the unique bus name (:1.N) changes whenever the
+// application restarts, so restored actions are bound to the owner the
+// window has now, and the content hash only changes when the menu does.
+// Strings are uint32 length + UTF-8 bytes.
+
+static const uint32_t kMenuDiskCacheMagic = 0x53554e4d;   // "MNUS"
+static const uint32_t kMenuDiskCacheVersion = 3;
+
+enum {
+    MenuDiskItemSeparator = 1 << 0,
+    MenuDiskItemEnabled   = 1 << 1,
+    MenuDiskItemSubmenu   = 1 << 2
+};
+
+enum {
+    MenuDiskRepresentedNone   = 0,
+    MenuDiskRepresentedString = 1,
+    MenuDiskRepresentedNumber = 2,
+    MenuDiskRepresentedAction = 3
+};
+
+static uint64_t fnv1a64(const void *bytes, NSUInteger length)
+{
+    const uint8_t *p = bytes;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (NSUInteger i = 0; i < length; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+#pragma mark - Writer
+
+static void appendString(NSMutableData *data, NSString *string)
+{
+    const char *utf8 = string ? [string UTF8String] : "";
+    uint32_t length = (uint32_t)strlen(utf8);
+    [data appendBytes:&length length:sizeof(length)];
+    [data appendBytes:utf8 length:length];
+}
+
+static BOOL appendMenuRecord(NSMutableData *data, NSString *title, MenuSnapshotItem *items, NSUInteger count);
+
+@interface MenuSnapshot (MenuDiskCacheSerialization)
+- (BOOL)appendToData:(NSMutableData *)data;
++ (MenuSnapshot *)snapshotFromBytes:(const uint8_t **)cursor end:(const uint8_t *)end
+                        serviceName:(NSString *)serviceName;
+@end
+
+static BOOL appendMenuRecord(NSMutableData *data, NSString *title, MenuSnapshotItem *items, NSUInteger count)
+{
+    appendString(data, title);
+    uint32_t itemCount = (uint32_t)count;
+    [data appendBytes:&itemCount length:sizeof(itemCount)];
+
+    for (NSUInteger i = 0; i < count; i++) {
+        MenuSnapshotItem *item = &items[i];
+
+        // Only class targets can be named on disk; instance targets make the menu non-persistable
+        NSString *targetClass = nil;
+        if (item->target) {
+            if (item->target != (id)[item->target class]) {
+                return NO;
+            }
+            targetClass = NSStringFromClass((Class)item->target);
+        }
+
+        uint8_t flags = 0;
+        if (item->separator) flags |= MenuDiskItemSeparator;
+        if (item->enabled) flags |= MenuDiskItemEnabled;
+        if (item->submenu) flags |= MenuDiskItemSubmenu;
+
+        uint8_t representedKind = MenuDiskRepresentedNone;
+        if ([item->representedObject isKindOfClass:[NSString class]]) {
+            representedKind = MenuDiskRepresentedString;
+        } else if ([item->representedObject isKindOfClass:[NSNumber class]]) {
+            representedKind = MenuDiskRepresentedNumber;
+        } else if ([item->representedObject isKindOfClass:[MenuItemAction class]]) {
+            representedKind = MenuDiskRepresentedAction;
+        } else if (item->representedObject) {
+            return NO;
+        }
+
+        uint16_t reserved = 0;
+        int32_t state = (int32_t)item->state;
+        uint32_t modifierMask = (uint32_t)item->modifierMask;
+        int64_t tag = (int64_t)item->tag;
+
+        [data appendBytes:&flags length:sizeof(flags)];
+        [data appendBytes:&representedKind length:sizeof(representedKind)];
+        [data appendBytes:&reserved length:sizeof(reserved)];
+        [data appendBytes:&state length:sizeof(state)];
+        [data appendBytes:&modifierMask length:sizeof(modifierMask)];
+        [data appendBytes:&tag length:sizeof(tag)];
+        appendString(data, item->title);
+        appendString(data, item->keyEquivalent);
+        appendString(data, targetClass);
+        appendString(data, item->action ? NSStringFromSelector(item->action) : nil);
+
+        if (representedKind == MenuDiskRepresentedString) {
+            appendString(data, item->representedObject);
+        } else if (representedKind == MenuDiskRepresentedNumber) {
+            int64_t value = [item->representedObject longLongValue];
+            [data appendBytes:&value length:sizeof(value)];
+        } else if (representedKind == MenuDiskRepresentedAction) {
+            MenuItemAction *menuItemAction = item->representedObject;
+            uint8_t actionKind = (uint8_t)[menuItemAction kind];
+            int64_t itemId = (int64_t)[menuItemAction itemId];
+            [data appendBytes:&actionKind length:sizeof(actionKind)];
+            [data appendBytes:&itemId length:sizeof(itemId)];
+            appendString(data, [menuItemAction objectPath]);
+            appendString(data, [menuItemAction actionName]);
+        }
+
+        if (item->submenu && ![(MenuSnapshot *)item->submenu appendToData:data]) {
+            return NO;
+        }
+    }
+
+    return YES;
+}
+
+#pragma mark - Reader
+
+static BOOL readBytes(const uint8_t **cursor, const uint8_t *end, void *out, size_t length)
+{
+    if ((size_t)(end - *cursor) < length) {
+        return NO;
+    }
+    memcpy(out, *cursor, length);
+    *cursor += length;
+    return YES;
+}
+
+static NSString *readString(const uint8_t **cursor, const uint8_t *end, BOOL *ok)
+{
+    uint32_t length = 0;
+    if (!readBytes(cursor, end, &length, sizeof(length)) || (size_t)(end - *cursor) < length) {
+        *ok = NO;
+        return nil;
+    }
+    NSString *string = [[[NSString alloc] initWithBytes:*cursor
+                                                 length:length
+                                               encoding:NSUTF8StringEncoding] autorelease];
+    *cursor += length;
+    if (!string) {
+        *ok = NO;
+    }
+    return string;
+}
+
+@implementation MenuSnapshot (MenuDiskCacheSerialization)
+
+- (BOOL)appendToData:(NSMutableData *)data
+{
+    return appendMenuRecord(data, _title, _items, _count);
+}
+
++ (MenuSnapshot *)snapshotFromBytes:(const uint8_t **)cursor end:(const uint8_t *)end
+                        serviceName:(NSString *)serviceName
+{
+    BOOL ok = YES;
+    NSString *title = readString(cursor, end, &ok);
+    uint32_t count = 0;
+    if (!ok || !readBytes(cursor, end, &count, sizeof(count))) {
+        return nil;
+    }
+    // Every item record is at least 24 bytes; reject counts the file cannot hold
+    if ((size_t)(end - *cursor) / 24 < count) {
+        return nil;
+    }
+
+    MenuSnapshot *snapshot = [[[MenuSnapshot alloc] init] autorelease];
+    snapshot->_title = [title copy];
+    snapshot->_items = calloc(count > 0 ? count : 1, sizeof(MenuSnapshotItem));
+    snapshot->_count = 0;
+    snapshot->_totalItemCount = count;
+    snapshot->_byteSize = 64 + count * sizeof(MenuSnapshotItem) + [title length];
+    if (!snapshot->_items) {
+        return nil;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        MenuSnapshotItem *item = &snapshot->_items[i];
+        uint8_t flags = 0, representedKind = 0;
+        uint16_t reserved = 0;
+        int32_t state = 0;
+        uint32_t modifierMask = 0;
+        int64_t tag = 0;
+
+        if (!readBytes(cursor, end, &flags, sizeof(flags)) ||
+            !readBytes(cursor, end, &representedKind, sizeof(representedKind)) ||
+            !readBytes(cursor, end, &reserved, sizeof(reserved)) ||
+            !readBytes(cursor, end, &state, sizeof(state)) ||
+            !readBytes(cursor, end, &modifierMask, sizeof(modifierMask)) ||
+            !readBytes(cursor, end, &tag, sizeof(tag))) {
+            return nil;
+        }
+
+        NSString *itemTitle = readString(cursor, end, &ok);
+        NSString *keyEquivalent = readString(cursor, end, &ok);
+        NSString *targetClass = readString(cursor, end, &ok);
+        NSString *actionName = readString(cursor, end, &ok);
+        if (!ok) {
+            return nil;
+        }
+
+        id representedObject = nil;
+        if (representedKind == MenuDiskRepresentedString) {
+            representedObject = readString(cursor, end, &ok);
+        } else if (representedKind == MenuDiskRepresentedNumber) {
+            int64_t value = 0;
+            ok = ok && readBytes(cursor, end, &value, sizeof(value));
+            representedObject = [NSNumber numberWithLongLong:value];
+        } else if (representedKind == MenuDiskRepresentedAction) {
+            uint8_t actionKind = 0;
+            int64_t itemId = 0;
+            ok = ok && readBytes(cursor, end, &actionKind, sizeof(actionKind));
+            ok = ok && readBytes(cursor, end, &itemId, sizeof(itemId));
+            NSString *objectPath = readString(cursor, end, &ok);
+            NSString *menuItemActionName = readString(cursor, end, &ok);
+            if (ok && actionKind != MenuItemActionKindCanonical && actionKind != MenuItemActionKindGTK) {
+                ok = NO;
+            }
+            if (ok) {
+                representedObject = [[[MenuItemAction alloc] initWithKind:(MenuItemActionKind)actionKind
+                                                                   itemId:(NSInteger)itemId
+                                                              serviceName:serviceName
+                                                               objectPath:objectPath
+                                                               actionName:([menuItemActionName length] > 0 ? menuItemActionName : nil)] autorelease];
+            }
+        } else if (representedKind != MenuDiskRepresentedNone) {
+            ok = NO;
+        }
+        if (!ok) {
+            return nil;
+        }
+
+        // Only targets that are safe to re-attach by name are restored
+        id target = nil;
+        if ([targetClass length] > 0) {
+            Class cls = NSClassFromString(targetClass);
+            if (!cls || ![cls conformsToProtocol:@protocol(MenuSnapshotRestorable)]) {
+                return nil;
+            }
+            target = cls;
+        }
+
+        MenuSnapshot *submenu = nil;
+        if (flags & MenuDiskItemSubmenu) {
+            submenu = [self snapshotFromBytes:cursor end:end serviceName:serviceName];
+            if (!submenu) {
+                return nil;
+            }
+            snapshot->_totalItemCount += [submenu totalItemCount];
+            snapshot->_byteSize += [submenu byteSize];
+        }
+
+        item->separator = (flags & MenuDiskItemSeparator) != 0;
+        item->enabled = (flags & MenuDiskItemEnabled) != 0;
+        item->title = [itemTitle copy];
+        item->keyEquivalent = [keyEquivalent copy];
+        item->representedObject = [representedObject retain];
+        item->target = target;
+        item->action = [actionName length] > 0 ? NSSelectorFromString(actionName) : NULL;
+        item->submenu = [submenu retain];
+        item->tag = (NSInteger)tag;
+        item->modifierMask = modifierMask;
+        item->state = state;
+        snapshot->_count++;
+        snapshot->_byteSize += [itemTitle length] + [keyEquivalent length];
+    }
+
+    return snapshot;
+}
+
+@end
+
+#pragma mark - MenuDiskCache
+
+@implementation MenuDiskCache
+
+static MenuDiskCache *sharedDiskCache = nil;
+
++ (MenuDiskCache *)sharedCache
+{
+    if (!sharedDiskCache) {
+        sharedDiskCache = [[MenuDiskCache alloc] init];
+    }
+    return sharedDiskCache;
+}
+
+- (id)init
+{
+    self = [super init];
+    if (self) {
+        NSArray *paths = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES);
+        NSString *base = [paths count] > 0 ? [paths objectAtIndex:0] : NSTemporaryDirectory();
+        _directory = [[[base stringByAppendingPathComponent:@"Menu"]
+                        stringByAppendingPathComponent:@"MenuSnapshots"] retain];
+        _contentHashes = [[NSMutableDictionary alloc] init];
+        _reads = 0;
+        _readMisses = 0;
+        _writes = 0;
+
+        [[NSFileManager defaultManager] createDirectoryAtPath:_directory
+                                  withIntermediateDirectories:YES
+                                                   attributes:nil
+                                                        error:NULL];
+
+        NSLog(@"MenuDiskCache: Using snapshot directory %@", _directory);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [_directory release];
+    [_contentHashes release];
+    [super dealloc];
+}
+
+- (NSString *)pathForIdentity:(NSString *)identity
+{
+    const char *utf8 = [identity UTF8String];
+    uint64_t hash = fnv1a64(utf8, strlen(utf8));
+    return [_directory stringByAppendingPathComponent:
+            [NSString stringWithFormat:@"%016llx.menusnapshot", (unsigned long long)hash]];
+}
+
+- (NSMenu *)menuForApplicationIdentity:(NSString *)identity serviceName:(NSString *)serviceName
+{
+    if ([identity length] == 0 || [serviceName length] == 0) {
+        return nil;
+    }
+
+    @synchronized(self) {
+        NSData *data = [NSData dataWithContentsOfMappedFile:[self pathForIdentity:identity]];
+        const uint8_t *cursor = [data bytes];
+        const uint8_t *end = cursor + [data length];
+
+        uint32_t magic = 0, version = 0, bodyLength = 0;
+        uint64_t contentHash = 0;
+        if (!data ||
+            !readBytes(&cursor, end, &magic, sizeof(magic)) || magic != kMenuDiskCacheMagic ||
+            !readBytes(&cursor, end, &version, sizeof(version)) || version != kMenuDiskCacheVersion ||
+            !readBytes(&cursor, end, &contentHash, sizeof(contentHash)) ||
+            !readBytes(&cursor, end, &bodyLength, sizeof(bodyLength))) {
+            _readMisses++;
+            return nil;
+        }
+
+        // Guard against file name hash collisions and truncated writes
+        BOOL ok = YES;
+        NSString *storedIdentity = readString(&cursor, end, &ok);
+        if (!ok || ![storedIdentity isEqualToString:identity] ||
+            (size_t)(end - cursor) != bodyLength ||
+            fnv1a64(cursor, bodyLength) != contentHash) {
+            NSLog(@"MenuDiskCache: Discarding invalid snapshot for %@", identity);
+            _readMisses++;
+            return nil;
+        }
+
+        MenuSnapshot *snapshot = [MenuSnapshot snapshotFromBytes:&cursor end:end serviceName:serviceName];
+        if (!snapshot) {
+            NSLog(@"MenuDiskCache: Snapshot for %@ could not be decoded", identity);
+            _readMisses++;
+            return nil;
+        }
+
+        [_contentHashes setObject:[NSNumber numberWithUnsignedLongLong:contentHash] forKey:identity];
+        _reads++;
+        NSLog(@"MenuDiskCache: Loaded persisted menu for %@ (%lu items, %lu bytes), bound to %@",
+              identity, (unsigned long)[snapshot totalItemCount], (unsigned long)[data length], serviceName);
+
+        return [snapshot materializeMenu];
+    }
+}
+
+- (BOOL)storeMenu:(NSMenu *)menu forApplicationIdentity:(NSString *)identity
+{
+    if (!menu || [identity length] == 0) {
+        return NO;
+    }
+
+    MenuSnapshot *snapshot = [MenuSnapshot snapshotOfMenu:menu];
+    NSMutableData *body = [NSMutableData data];
+    if (!snapshot || ![snapshot appendToData:body]) {
+        // Menus bound to per-instance state (lazy submenus, instance targets) are not persisted
+        return NO;
+    }
+
+    uint64_t contentHash = fnv1a64([body bytes], [body length]);
+
+    @synchronized(self) {
+        NSNumber *storedHash = [_contentHashes objectForKey:identity];
+        if (storedHash && [storedHash unsignedLongLongValue] == contentHash) {
+            return NO;
+        }
+
+        NSMutableData *file = [NSMutableData dataWithCapacity:[body length] + 64];
+        uint32_t magic = kMenuDiskCacheMagic;
+        uint32_t version = kMenuDiskCacheVersion;
+        uint32_t bodyLength = (uint32_t)[body length];
+        [file appendBytes:&magic length:sizeof(magic)];
+        [file appendBytes:&version length:sizeof(version)];
+        [file appendBytes:&contentHash length:sizeof(contentHash)];
+        [file appendBytes:&bodyLength length:sizeof(bodyLength)];
+        appendString(file, identity);
+        [file appendData:body];
+
+        if (![file writeToFile:[self pathForIdentity:identity] atomically:YES]) {
+            NSLog(@"MenuDiskCache: Failed to write snapshot for %@", identity);
+            return NO;
+        }
+
+        [_contentHashes setObject:[NSNumber numberWithUnsignedLongLong:contentHash] forKey:identity];
+        _writes++;
+        NSLog(@"MenuDiskCache: Persisted menu for %@ (%lu bytes)", identity, (unsigned long)[file length]);
+        return YES;
+    }
+}
+
+- (void)removeMenuForApplicationIdentity:(NSString *)identity
+{
+    if ([identity length] == 0) {
+        return;
+    }
+
+    @synchronized(self) {
+        [[NSFileManager defaultManager] removeItemAtPath:[self pathForIdentity:identity] error:NULL];
+        [_contentHashes removeObjectForKey:identity];
+    }
+}
+
+- (NSDictionary *)statistics
+{
+    @synchronized(self) {
+        return @{
+            @"reads": @(_reads),
+            @"readMisses": @(_readMisses),
+            @"writes": @(_writes)
+        };
+    }
+}
+
+@end
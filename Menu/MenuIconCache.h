@@ -0,0 +1,55 @@
+#import <Foundation/Foundation.h>
+#import <AppKit/AppKit.h>
+
+/**
+ * MenuIconCache
+ *
+ * Decodes dbusmenu item icons (icon-data PNG blobs and icon-name theme
+ * lookups) on a small pool of worker threads, so building a menu never
+ * waits for an image decoder.
+ *
+ * Decoded images are downscaled to menu size and keyed by content (a hash
+ * of the PNG bytes, or the icon name), so the same icon is decoded once no
+ * matter how many items, windows or applications use it. An item whose icon
+ * is not decoded yet gets a transparent placeholder of the final size; the
+ * real image is swapped in on the main thread when its decode finishes.
+ */
+@interface MenuIconCache : NSObject
+{
+    NSMutableDictionary *_images;       // Content key -> menu-sized NSImage, or NSNull if undecodable
+    NSMutableArray *_imageOrder;        // Content keys, oldest first, for eviction
+    NSMutableDictionary *_waitingItems; // Content key -> NSMutableArray of NSMenuItems showing the placeholder
+    NSMutableArray *_jobs;              // Pending decodes, NSDictionary with key and data or name
+    NSCondition *_condition;            // Guards everything above
+    NSMutableArray *_workerThreads;
+    NSImage *_placeholder;
+    NSArray *_iconDirectories;          // Searched in order for icon-name lookups
+    NSUInteger _maxImages;
+    BOOL _shouldStop;
+    BOOL _decodesInline;                // Decode on the caller and keep nothing (benchmark baseline)
+
+    // Statistics
+    NSUInteger _hits;
+    NSUInteger _misses;
+    NSUInteger _coalesced;
+    NSUInteger _decoded;
+    NSUInteger _failed;
+}
+
++ (MenuIconCache *)sharedCache;
+
+// Attach the icon to the item: immediately on a cache hit, otherwise a
+// placeholder now and the decoded image later. Safe to call from any thread.
+- (void)applyIconData:(NSData *)pngData toMenuItem:(NSMenuItem *)menuItem;
+- (void)applyIconNamed:(NSString *)iconName toMenuItem:(NSMenuItem *)menuItem;
+
+- (void)setMaxImages:(NSUInteger)maxImages;
+
+// Decode every icon on the thread building the menu, without caching or
+// coalescing, as if there were no MenuIconCache (Menu.app --no-icon-cache)
+- (void)setDecodesInline:(BOOL)decodesInline;
+- (void)stop;
+
+- (NSDictionary *)statistics;
+
+@end
@@ -0,0 +1,420 @@
+#import "MenuIconCache.h"
+
+static MenuIconCache *sharedCache = nil;
+
+static const NSInteger kMenuIconSize = 16;
+static const NSUInteger kMenuIconWorkerCount = 2;
+
+static uint64_t fnv1a64(const void *bytes, NSUInteger length)
+{
+    const uint8_t *p = bytes;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (NSUInteger i = 0; i < length; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Fit width x height into the menu icon box, keeping the aspect ratio
+static NSSize menuIconSize(NSInteger width, NSInteger height)
+{
+    if (width <= 0 || height <= 0) {
+        return NSMakeSize(kMenuIconSize, kMenuIconSize);
+    }
+    if (width >= height) {
+        return NSMakeSize(kMenuIconSize, MAX(1, height * kMenuIconSize / width));
+    }
+    return NSMakeSize(MAX(1, width * kMenuIconSize / height), kMenuIconSize);
+}
+
+// Box-filter 8-bit meshed bitmaps down to menu size so the cache holds
+// 1 KB per icon instead of the full decoded PNG; other layouts are kept as-is
+static NSBitmapImageRep *menuSizedRep(NSBitmapImageRep *source)
+{
+    NSInteger width = [source pixelsWide];
+    NSInteger height = [source pixelsHigh];
+    NSInteger samples = [source samplesPerPixel];
+
+    if (width <= kMenuIconSize && height <= kMenuIconSize) {
+        return source;
+    }
+    if ([source bitsPerSample] != 8 || [source isPlanar] || (samples != 3 && samples != 4) ||
+        [source bitsPerPixel] != samples * 8 || ![source bitmapData]) {
+        return source;
+    }
+
+    NSSize size = menuIconSize(width, height);
+    NSInteger scaledWidth = (NSInteger)size.width;
+    NSInteger scaledHeight = (NSInteger)size.height;
+    NSBitmapImageRep *scaled = [[[NSBitmapImageRep alloc] initWithBitmapDataPlanes:NULL
+                                                                        pixelsWide:scaledWidth
+                                                                        pixelsHigh:scaledHeight
+                                                                     bitsPerSample:8
+                                                                   samplesPerPixel:samples
+                                                                          hasAlpha:[source hasAlpha]
+                                                                          isPlanar:NO
+                                                                    colorSpaceName:[source colorSpaceName]
+                                                                       bytesPerRow:0
+                                                                      bitsPerPixel:0] autorelease];
+    if (!scaled || ![scaled bitmapData]) {
+        return source;
+    }
+
+    const unsigned char *src = [source bitmapData];
+    unsigned char *dst = [scaled bitmapData];
+    NSInteger srcRowBytes = [source bytesPerRow];
+    NSInteger dstRowBytes = [scaled bytesPerRow];
+
+    for (NSInteger y = 0; y < scaledHeight; y++) {
+        NSInteger y0 = y * height / scaledHeight;
+        NSInteger y1 = MAX(y0 + 1, (y + 1) * height / scaledHeight);
+        for (NSInteger x = 0; x < scaledWidth; x++) {
+            NSInteger x0 = x * width / scaledWidth;
+            NSInteger x1 = MAX(x0 + 1, (x + 1) * width / scaledWidth);
+            NSUInteger sums[4] = {0, 0, 0, 0};
+            for (NSInteger sy = y0; sy < y1; sy++) {
+                const unsigned char *p = src + sy * srcRowBytes + x0 * samples;
+                for (NSInteger sx = x0; sx < x1; sx++, p += samples) {
+                    for (NSInteger s = 0; s < samples; s++) {
+                        sums[s] += p[s];
+                    }
+                }
+            }
+            NSUInteger count = (NSUInteger)((y1 - y0) * (x1 - x0));
+            unsigned char *out = dst + y * dstRowBytes + x * samples;
+            for (NSInteger s = 0; s < samples; s++) {
+                out[s] = (unsigned char)(sums[s] / count);
+            }
+        }
+    }
+
+    return scaled;
+}
+
+@interface MenuIconCache (Private)
+- (void)applyIconForKey:(NSString *)key job:(NSDictionary *)job toMenuItem:(NSMenuItem *)menuItem;
+- (void)workerMain;
+- (NSImage *)decodeJob:(NSDictionary *)job;
+- (NSData *)iconDataForName:(NSString *)iconName;
+- (void)deliverImage:(NSDictionary *)delivery;
+@end
+
+@implementation MenuIconCache
+
++ (MenuIconCache *)sharedCache
+{
+    @synchronized(self) {
+        if (!sharedCache) {
+            sharedCache = [[MenuIconCache alloc] init];
+        }
+    }
+    return sharedCache;
+}
+
+- (id)init
+{
+    self = [super init];
+    if (self) {
+        _images = [[NSMutableDictionary alloc] init];
+        _imageOrder = [[NSMutableArray alloc] init];
+        _waitingItems = [[NSMutableDictionary alloc] init];
+        _jobs = [[NSMutableArray alloc] init];
+        _condition = [[NSCondition alloc] init];
+        _maxImages = 512;
+        _shouldStop = NO;
+
+        // Transparent, so items keep their final width while the icon decodes
+        NSBitmapImageRep *blank = [[NSBitmapImageRep alloc] initWithBitmapDataPlanes:NULL
+                                                                          pixelsWide:kMenuIconSize
+                                                                          pixelsHigh:kMenuIconSize
+                                                                       bitsPerSample:8
+                                                                     samplesPerPixel:4
+                                                                            hasAlpha:YES
+                                                                            isPlanar:NO
+                                                                      colorSpaceName:NSDeviceRGBColorSpace
+                                                                         bytesPerRow:0
+                                                                        bitsPerPixel:0];
+        memset([blank bitmapData], 0, [blank bytesPerRow] * kMenuIconSize);
+        _placeholder = [[NSImage alloc] initWithSize:NSMakeSize(kMenuIconSize, kMenuIconSize)];
+        [_placeholder addRepresentation:blank];
+        [blank release];
+
+        NSMutableArray *directories = [NSMutableArray array];
+        NSArray *prefixes = [NSArray arrayWithObjects:
+                             [NSHomeDirectory() stringByAppendingPathComponent:@".local/share/icons"],
+                             @"/usr/local/share/icons", @"/usr/share/icons", nil];
+        NSArray *themes = [NSArray arrayWithObjects:@"hicolor", @"Adwaita", nil];
+        NSArray *contexts = [NSArray arrayWithObjects:@"actions", @"apps", @"places", @"status",
+                             @"devices", @"mimetypes", nil];
+        for (NSString *prefix in prefixes) {
+            for (NSString *theme in themes) {
+                for (NSString *context in contexts) {
+                    [directories addObject:[NSString stringWithFormat:@"%@/%@/16x16/%@", prefix, theme, context]];
+                }
+            }
+        }
+        [directories addObject:@"/usr/local/share/pixmaps"];
+        [directories addObject:@"/usr/share/pixmaps"];
+        _iconDirectories = [directories copy];
+
+        _workerThreads = [[NSMutableArray alloc] init];
+        for (NSUInteger i = 0; i < kMenuIconWorkerCount; i++) {
+            NSThread *thread = [[NSThread alloc] initWithTarget:self
+                                                       selector:@selector(workerMain)
+                                                         object:nil];
+            [thread setName:[NSString stringWithFormat:@"MenuIconDecode%lu", (unsigned long)i]];
+            [_workerThreads addObject:thread];
+            [thread start];
+            [thread release];
+        }
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [self stop];
+    [_workerThreads release];
+    [_images release];
+    [_imageOrder release];
+    [_waitingItems release];
+    [_jobs release];
+    [_condition release];
+    [_placeholder release];
+    [_iconDirectories release];
+    [super dealloc];
+}
+
+- (void)applyIconData:(NSData *)pngData toMenuItem:(NSMenuItem *)menuItem
+{
+    if (!menuItem || [pngData length] == 0) {
+        return;
+    }
+
+    NSString *key = [NSString stringWithFormat:@"png:%016llx:%lu",
+                     (unsigned long long)fnv1a64([pngData bytes], [pngData length]),
+                     (unsigned long)[pngData length]];
+    [self applyIconForKey:key
+                      job:[NSDictionary dictionaryWithObjectsAndKeys:key, @"key", pngData, @"data", nil]
+               toMenuItem:menuItem];
+}
+
+- (void)applyIconNamed:(NSString *)iconName toMenuItem:(NSMenuItem *)menuItem
+{
+    if (!menuItem || [iconName length] == 0) {
+        return;
+    }
+
+    NSString *key = [@"name:" stringByAppendingString:iconName];
+    [self applyIconForKey:key
+                      job:[NSDictionary dictionaryWithObjectsAndKeys:key, @"key", iconName, @"name", nil]
+               toMenuItem:menuItem];
+}
+
+- (void)setMaxImages:(NSUInteger)maxImages
+{
+    [_condition lock];
+    _maxImages = maxImages;
+    while ([_imageOrder count] > _maxImages) {
+        [_images removeObjectForKey:[_imageOrder objectAtIndex:0]];
+        [_imageOrder removeObjectAtIndex:0];
+    }
+    [_condition unlock];
+}
+
+- (void)setDecodesInline:(BOOL)decodesInline
+{
+    [_condition lock];
+    _decodesInline = decodesInline;
+    [_condition unlock];
+}
+
+- (void)stop
+{
+    [_condition lock];
+    _shouldStop = YES;
+    [_condition broadcast];
+    [_condition unlock];
+}
+
+- (NSDictionary *)statistics
+{
+    [_condition lock];
+    NSDictionary *stats = [NSDictionary dictionaryWithObjectsAndKeys:
+        [NSNumber numberWithUnsignedInteger:_hits], @"hits",
+        [NSNumber numberWithUnsignedInteger:_misses], @"misses",
+        [NSNumber numberWithUnsignedInteger:_coalesced], @"coalesced",
+        [NSNumber numberWithUnsignedInteger:_decoded], @"decoded",
+        [NSNumber numberWithUnsignedInteger:_failed], @"failed",
+        [NSNumber numberWithUnsignedInteger:[_images count]], @"cached",
+        [NSNumber numberWithUnsignedInteger:[_jobs count]], @"queued",
+        nil];
+    [_condition unlock];
+    return stats;
+}
+
+@end
+
+@implementation MenuIconCache (Private)
+
+- (void)applyIconForKey:(NSString *)key job:(NSDictionary *)job toMenuItem:(NSMenuItem *)menuItem
+{
+    [_condition lock];
+
+    if (_decodesInline) {
+        [_condition unlock];
+        NSImage *image = [self decodeJob:job];
+        [menuItem setImage:image];
+        [_condition lock];
+        if (image) {
+            _decoded++;
+        } else {
+            _failed++;
+        }
+        [_condition unlock];
+        return;
+    }
+
+    id cached = [_images objectForKey:key];
+    if (cached) {
+        _hits++;
+        [_condition unlock];
+        if (cached != [NSNull null]) {
+            [menuItem setImage:cached];
+        }
+        return;
+    }
+
+    _misses++;
+    // Set before the item becomes visible to the workers, so a fast decode
+    // delivered from another thread is never overwritten by the placeholder
+    [menuItem setImage:_placeholder];
+
+    NSMutableArray *waiting = [_waitingItems objectForKey:key];
+    if (waiting) {
+        // Same icon already queued or decoding (e.g. the same action in several windows)
+        _coalesced++;
+        [waiting addObject:menuItem];
+    } else {
+        [_waitingItems setObject:[NSMutableArray arrayWithObject:menuItem] forKey:key];
+        [_jobs addObject:job];
+        [_condition signal];
+    }
+
+    [_condition unlock];
+}
+
+- (void)workerMain
+{
+    [NSThread setThreadPriority:0.3];
+
+    while (YES) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+
+        [_condition lock];
+        while (!_shouldStop && [_jobs count] == 0) {
+            [_condition wait];
+        }
+        if (_shouldStop) {
+            [_condition unlock];
+            [pool release];
+            break;
+        }
+        NSDictionary *job = [[[_jobs objectAtIndex:0] retain] autorelease];
+        [_jobs removeObjectAtIndex:0];
+        [_condition unlock];
+
+        NSString *key = [job objectForKey:@"key"];
+        NSImage *image = [self decodeJob:job];
+
+        [_condition lock];
+        // Undecodable icons are remembered too, so they are not retried for every item
+        [_images setObject:(image ? (id)image : (id)[NSNull null]) forKey:key];
+        [_imageOrder addObject:key];
+        while ([_imageOrder count] > _maxImages) {
+            [_images removeObjectForKey:[_imageOrder objectAtIndex:0]];
+            [_imageOrder removeObjectAtIndex:0];
+        }
+        if (image) {
+            _decoded++;
+        } else {
+            _failed++;
+        }
+        NSArray *items = [[[_waitingItems objectForKey:key] retain] autorelease];
+        [_waitingItems removeObjectForKey:key];
+        [_condition unlock];
+
+        if (!image) {
+            NSLog(@"MenuIconCache: Could not decode icon %@", key);
+        }
+
+        if ([items count] > 0) {
+            NSDictionary *delivery = [NSDictionary dictionaryWithObjectsAndKeys:
+                                      items, @"items",
+                                      (image ? (id)image : (id)[NSNull null]), @"image",
+                                      nil];
+            [self performSelectorOnMainThread:@selector(deliverImage:)
+                                   withObject:delivery
+                                waitUntilDone:NO];
+        }
+
+        [pool release];
+    }
+}
+
+- (NSImage *)decodeJob:(NSDictionary *)job
+{
+    NSData *data = [job objectForKey:@"data"];
+    if (!data) {
+        data = [self iconDataForName:[job objectForKey:@"name"]];
+    }
+    if ([data length] == 0) {
+        return nil;
+    }
+
+    NSBitmapImageRep *rep = [NSBitmapImageRep imageRepWithData:data];
+    if (!rep) {
+        return nil;
+    }
+    rep = menuSizedRep(rep);
+
+    NSImage *image = [[[NSImage alloc] initWithSize:menuIconSize([rep pixelsWide], [rep pixelsHigh])] autorelease];
+    [image addRepresentation:rep];
+    return image;
+}
+
+- (NSData *)iconDataForName:(NSString *)iconName
+{
+    if ([iconName isAbsolutePath]) {
+        return [NSData dataWithContentsOfFile:iconName];
+    }
+
+    NSString *fileName = [[iconName pathExtension] length] > 0
+        ? iconName
+        : [iconName stringByAppendingPathExtension:@"png"];
+    for (NSString *directory in _iconDirectories) {
+        NSData *data = [NSData dataWithContentsOfFile:[directory stringByAppendingPathComponent:fileName]];
+        if (data) {
+            return data;
+        }
+    }
+    return nil;
+}
+
+- (void)deliverImage:(NSDictionary *)delivery
+{
+    id image = [delivery objectForKey:@"image"];
+    if (image == [NSNull null]) {
+        image = nil;
+    }
+
+    for (NSMenuItem *menuItem in [delivery objectForKey:@"items"]) {
+        // The item may have been given a different icon since it was queued
+        if ([menuItem image] == _placeholder) {
+            [menuItem setImage:image];
+        }
+    }
+}
+
+@end
@@ -0,0 +1,49 @@
+#import <Foundation/Foundation.h>
+#import <AppKit/AppKit.h>
+
+typedef NS_ENUM(NSInteger, MenuItemActionKind) {
+    MenuItemActionKindCanonical = 0,    // com.canonical.dbusmenu Event on an item ID
+    MenuItemActionKindGTK = 1           // org.gtk.Actions Activate on an action name
+};
+
+/**
+ * MenuItemAction
+ *
+ * Immutable routing descriptor for an imported menu item, stored as the
+ * item's representedObject. It lives and dies with the NSMenuItem, so
+ * activating an item needs no global lookup table, and a rebuilt menu
+ * leaves nothing behind. Because the descriptor is self-contained,
+ * imported menus can also be snapshotted and persisted (see MenuSnapshot).
+ */
+@interface MenuItemAction : NSObject <NSCopying>
+{
+    MenuItemActionKind _kind;
+    NSInteger _itemId;          // dbusmenu item ID (canonical)
+    NSString *_serviceName;
+    NSString *_objectPath;      // Menu object path (canonical) or action group path (GTK)
+    NSString *_actionName;      // GTK action name, nil for canonical items
+}
+
++ (MenuItemAction *)canonicalActionWithItemId:(NSInteger)itemId
+                                  serviceName:(NSString *)serviceName
+                                   objectPath:(NSString *)objectPath;
++ (MenuItemAction *)gtkActionWithName:(NSString *)actionName
+                          serviceName:(NSString *)serviceName
+                           actionPath:(NSString *)actionPath;
+
+- (id)initWithKind:(MenuItemActionKind)kind
+            itemId:(NSInteger)itemId
+       serviceName:(NSString *)serviceName
+        objectPath:(NSString *)objectPath
+        actionName:(NSString *)actionName;
+
+// The item's descriptor, or nil if it has none
++ (MenuItemAction *)actionForMenuItem:(NSMenuItem *)menuItem;
+
+- (MenuItemActionKind)kind;
+- (NSInteger)itemId;
+- (NSString *)serviceName;
+- (NSString *)objectPath;
+- (NSString *)actionName;
+
+@end
@@ -0,0 +1,117 @@
+#import "MenuItemAction.h"
+
+@implementation MenuItemAction
+
++ (MenuItemAction *)canonicalActionWithItemId:(NSInteger)itemId
+                                  serviceName:(NSString *)serviceName
+                                   objectPath:(NSString *)objectPath
+{
+    return [[[self alloc] initWithKind:MenuItemActionKindCanonical
+                                itemId:itemId
+                           serviceName:serviceName
+                            objectPath:objectPath
+                            actionName:nil] autorelease];
+}
+
++ (MenuItemAction *)gtkActionWithName:(NSString *)actionName
+                          serviceName:(NSString *)serviceName
+                           actionPath:(NSString *)actionPath
+{
+    return [[[self alloc] initWithKind:MenuItemActionKindGTK
+                                itemId:0
+                           serviceName:serviceName
+                            objectPath:actionPath
+                            actionName:actionName] autorelease];
+}
+
+- (id)initWithKind:(MenuItemActionKind)kind
+            itemId:(NSInteger)itemId
+       serviceName:(NSString *)serviceName
+        objectPath:(NSString *)objectPath
+        actionName:(NSString *)actionName
+{
+    self = [super init];
+    if (self) {
+        _kind = kind;
+        _itemId = itemId;
+        _serviceName = [serviceName copy];
+        _objectPath = [objectPath copy];
+        _actionName = [actionName copy];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [_serviceName release];
+    [_objectPath release];
+    [_actionName release];
+    [super dealloc];
+}
+
++ (MenuItemAction *)actionForMenuItem:(NSMenuItem *)menuItem
+{
+    id representedObject = [menuItem representedObject];
+    return [representedObject isKindOfClass:[MenuItemAction class]] ? representedObject : nil;
+}
+
+// Immutable
+- (id)copyWithZone:(NSZone *)zone
+{
+    return [self retain];
+}
+
+- (BOOL)isEqual:(id)other
+{
+    if (other == self) {
+        return YES;
+    }
+    if (![other isKindOfClass:[MenuItemAction class]]) {
+        return NO;
+    }
+    MenuItemAction *action = other;
+    return _kind == [action kind] && _itemId == [action itemId] &&
+           (_serviceName == [action serviceName] || [_serviceName isEqualToString:[action serviceName]]) &&
+           (_objectPath == [action objectPath] || [_objectPath isEqualToString:[action objectPath]]) &&
+           (_actionName == [action actionName] || [_actionName isEqualToString:[action actionName]]);
+}
+
+- (NSUInteger)hash
+{
+    return (NSUInteger)_itemId ^ [_actionName hash] ^ [_objectPath hash];
+}
+
+- (NSString *)description
+{
+    if (_kind == MenuItemActionKindGTK) {
+        return [NSString stringWithFormat:@"<GTK action %@ on %@%@>", _actionName, _serviceName, _objectPath];
+    }
+    return [NSString stringWithFormat:@"<dbusmenu item %ld on %@%@>", (long)_itemId, _serviceName, _objectPath];
+}
+
+- (MenuItemActionKind)kind
+{
+    return _kind;
+}
+
+- (NSInteger)itemId
+{
+    return _itemId;
+}
+
+- (NSString *)serviceName
+{
+    return _serviceName;
+}
+
+- (NSString *)objectPath
+{
+    return _objectPath;
+}
+
+- (NSString *)actionName
+{
+    return _actionName;
+}
+
+@end
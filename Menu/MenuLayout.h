@@ -0,0 +1,99 @@
+#import <Foundation/Foundation.h>
+#include <stdint.h>
+
+/**
+ * MenuLayout
+ *
+ * Immutable, AppKit-free model of an imported menu, built from a dbusmenu
+ * GetLayout reply or from org.gtk.Menus Start replies before any NSMenu
+ * exists. Parsing is split in two phases:
+ *
+ *   1. MenuLayout walks the D-Bus reply once and stores every rendered item
+ *      as a fixed-size C struct in one arena. Labels, key equivalents, action
+ *      and icon names are interned into a per-layout string table. This
+ *      phase touches no AppKit object and no shared manager, so it may run on
+ *      any thread; large dbusmenu trees are split by top-level submenu across
+ *      a pair of parse worker threads.
+ *   2. The protocol parsers (DBusMenuParser, GTKMenuParser) materialize the
+ *      NSMenu tree from the layout and wire up actions, submenu delegates,
+ *      icons and shortcuts.
+ *
+ * Every item carries a hash of its whole subtree, so two versions of a menu
+ * can be compared without building either of them.
+ */
+
+enum {
+    MenuLayoutItemSeparator  = 1 << 0,
+    MenuLayoutItemSubmenu    = 1 << 1,  // Renders a submenu (which may be empty, see children-display)
+    MenuLayoutItemHasEnabled = 1 << 2,  // The exporter set "enabled"; otherwise the NSMenuItem default applies
+    MenuLayoutItemEnabled    = 1 << 3,
+    MenuLayoutItemUnloaded   = 1 << 4   // GTK submenu whose group was not in the replies
+};
+
+typedef uint32_t MenuLayoutString;      // Index into the layout's string table, 0 = none
+
+// A GTK (group, menu) pair
+typedef struct {
+    uint32_t group;
+    uint32_t menu;
+} MenuLayoutKey;
+
+typedef struct {
+    uint64_t hash;                  // Content hash of the item and its whole subtree
+    MenuLayoutString label;         // Mnemonic underscores already removed
+    MenuLayoutString keyEquivalent;
+    MenuLayoutString action;        // GTK action name
+    MenuLayoutString iconName;
+    uint32_t iconData;              // 1-based index into the icon blobs, 0 = none
+    uint32_t modifierMask;
+    int32_t itemId;                 // dbusmenu item id
+    uint32_t firstChild;            // Children are contiguous: [firstChild, firstChild + childCount)
+    uint32_t childCount;
+    uint32_t firstKey;              // GTK: keys rendered into this submenu, its own first, then flattened
+    uint32_t keyCount;              //      sections; for unloaded submenus the one key to load
+    uint32_t flags;
+} MenuLayoutItem;
+
+@interface MenuLayout : NSObject
+{
+    MenuLayoutItem *_items;         // _items[0] is the root; its children are the top-level items
+    uint32_t _count;
+    NSString **_strings;            // Interned and retained; _strings[0] is nil
+    uint32_t _stringCount;
+    MenuLayoutKey *_keys;
+    uint32_t _keyCount;
+    NSArray *_icons;                // icon-data PNG blobs
+}
+
+// dbusmenu: a layout node (ia{sv}av); its children become the top-level items
+// and its label the root title. Returns nil if the node is malformed.
++ (MenuLayout *)layoutWithDBusMenuItem:(id)layoutItem;
+
+// dbusmenu: the given nodes become the top-level items
++ (MenuLayout *)layoutWithDBusMenuItems:(NSArray *)layoutItems;
+
+// GTK: walks (group, menu) -> items from rootKey, flattening sections into
+// their parent. Returns nil if rootKey has no items.
++ (MenuLayout *)layoutWithGTKMenus:(NSDictionary *)menus root:(NSArray *)rootKey title:(NSString *)title;
+
+// GTK: the given items (merged dictionaries or raw item data) become the
+// top-level items; submenus are resolved through menus
++ (MenuLayout *)layoutWithGTKItems:(NSArray *)items menus:(NSDictionary *)menus;
+
+- (uint32_t)layoutItemCount;    // All items, the root included
+- (const MenuLayoutItem *)root;
+- (const MenuLayoutItem *)layoutItemAtIndex:(uint32_t)index;
+- (NSString *)stringAtIndex:(MenuLayoutString)index;
+- (NSData *)iconDataForItem:(const MenuLayoutItem *)item;
+- (const MenuLayoutKey *)keysForItem:(const MenuLayoutItem *)item;
+
+// GTK groups of unloaded submenus, as NSNumbers
+- (NSSet *)unloadedGroups;
+
+// Diffing
+- (BOOL)isEqualToLayout:(MenuLayout *)other;
+// Top-level items that differ from the item at the same position in older,
+// or nil if top-level items were added or removed
+- (NSIndexSet *)changedTopLevelItemsFromLayout:(MenuLayout *)older;
+
+@end
@@ -0,0 +1,868 @@
+#import "MenuLayout.h"
+#import "DBusMenuShortcutParser.h"
+#import "MenuAcceleratorCache.h"
+#import "MenuTrace.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MENU_LAYOUT_PARALLEL_MIN_ITEMS 512     // Items in the first two levels before top-level subtrees are parsed in parallel
+#define MENU_LAYOUT_WORKER_COUNT 2
+#define MENU_LAYOUT_MAX_GTK_DEPTH 32            // Submenu/section links are followed at most this deep (broken exports can cycle)
+
+#define MENU_LAYOUT_HASH_SEED 0xcbf29ce484222325ULL
+
+// Growable arena the layout is built in; handed over to MenuLayout when done
+typedef struct {
+    MenuLayoutItem *items;
+    uint32_t count;
+    uint32_t capacity;
+    NSString **strings;             // Interned, retained; strings[0] is nil
+    NSUInteger *stringHashes;       // Content hash per string, so item hashes do not depend on indexes
+    uint32_t stringCount;
+    uint32_t stringCapacity;
+    NSMapTable *stringIndex;        // NSString -> index into strings
+    MenuLayoutKey *keys;
+    uint32_t keyCount;
+    uint32_t keyCapacity;
+    NSMutableArray *icons;
+} MenuLayoutBuilder;
+
+static inline uint64_t hashMix(uint64_t hash, uint64_t value)
+{
+    // FNV-1a over 64-bit words
+    return (hash ^ value) * 0x100000001b3ULL;
+}
+
+static uint64_t dataHash(NSData *data)
+{
+    const uint8_t *bytes = [data bytes];
+    uint64_t hash = MENU_LAYOUT_HASH_SEED;
+    for (NSUInteger i = 0; i < [data length]; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static void builderInit(MenuLayoutBuilder *b, uint32_t capacity)
+{
+    memset(b, 0, sizeof(*b));
+    b->capacity = capacity > 0 ? capacity : 16;
+    b->items = malloc(sizeof(MenuLayoutItem) * b->capacity);
+    b->stringCapacity = 64;
+    b->strings = malloc(sizeof(NSString *) * b->stringCapacity);
+    b->stringHashes = malloc(sizeof(NSUInteger) * b->stringCapacity);
+    b->strings[0] = nil;
+    b->stringHashes[0] = 0;
+    b->stringCount = 1;
+    b->stringIndex = NSCreateMapTable(NSNonRetainedObjectMapKeyCallBacks, NSIntegerMapValueCallBacks, 64);
+    b->icons = [[NSMutableArray alloc] init];
+}
+
+static void builderFree(MenuLayoutBuilder *b)
+{
+    for (uint32_t i = 1; i < b->stringCount; i++) {
+        [b->strings[i] release];
+    }
+    free(b->items);
+    free(b->strings);
+    free(b->stringHashes);
+    free(b->keys);
+    if (b->stringIndex) {
+        NSFreeMapTable(b->stringIndex);
+    }
+    [b->icons release];
+    memset(b, 0, sizeof(*b));
+}
+
+// Appends n zeroed items and returns the index of the first. Item pointers
+// taken before this call are invalid afterwards.
+static uint32_t builderReserve(MenuLayoutBuilder *b, uint32_t n)
+{
+    if (b->count + n > b->capacity) {
+        while (b->count + n > b->capacity) {
+            b->capacity *= 2;
+        }
+        b->items = realloc(b->items, sizeof(MenuLayoutItem) * b->capacity);
+    }
+    uint32_t first = b->count;
+    memset(&b->items[first], 0, sizeof(MenuLayoutItem) * n);
+    b->count += n;
+    return first;
+}
+
+static MenuLayoutString builderIntern(MenuLayoutBuilder *b, NSString *string)
+{
+    if (![string isKindOfClass:[NSString class]] || [string length] == 0) {
+        return 0;
+    }
+
+    uintptr_t index = (uintptr_t)NSMapGet(b->stringIndex, string);
+    if (index != 0) {
+        return (MenuLayoutString)index;
+    }
+
+    if (b->stringCount == b->stringCapacity) {
+        b->stringCapacity *= 2;
+        b->strings = realloc(b->strings, sizeof(NSString *) * b->stringCapacity);
+        b->stringHashes = realloc(b->stringHashes, sizeof(NSUInteger) * b->stringCapacity);
+    }
+    index = b->stringCount++;
+    b->strings[index] = [string copy];
+    b->stringHashes[index] = [string hash];
+    NSMapInsertKnownAbsent(b->stringIndex, b->strings[index], (void *)index);
+    return (MenuLayoutString)index;
+}
+
+static uint32_t builderAddKey(MenuLayoutBuilder *b, uint32_t group, uint32_t menu)
+{
+    if (b->keyCount == b->keyCapacity) {
+        b->keyCapacity = b->keyCapacity ? b->keyCapacity * 2 : 16;
+        b->keys = realloc(b->keys, sizeof(MenuLayoutKey) * b->keyCapacity);
+    }
+    b->keys[b->keyCount].group = group;
+    b->keys[b->keyCount].menu = menu;
+    return b->keyCount++;
+}
+
+static uint64_t itemContentHash(MenuLayoutBuilder *b, const MenuLayoutItem *item, NSData *iconData)
+{
+    uint64_t hash = hashMix(MENU_LAYOUT_HASH_SEED, (uint32_t)item->itemId);
+    hash = hashMix(hash, item->flags);
+    hash = hashMix(hash, b->stringHashes[item->label]);
+    hash = hashMix(hash, b->stringHashes[item->keyEquivalent]);
+    hash = hashMix(hash, item->modifierMask);
+    hash = hashMix(hash, b->stringHashes[item->action]);
+    hash = hashMix(hash, b->stringHashes[item->iconName]);
+    return hashMix(hash, iconData ? dataHash(iconData) : 0);
+}
+
+// Copies a subtree built in its own arena (its item 0 goes to slot) into b,
+// re-indexing children, strings and icons
+static void builderAppendSubtree(MenuLayoutBuilder *b, uint32_t slot, MenuLayoutBuilder *sub)
+{
+    MenuLayoutString *strings = malloc(sizeof(MenuLayoutString) * sub->stringCount);
+    strings[0] = 0;
+    for (uint32_t i = 1; i < sub->stringCount; i++) {
+        strings[i] = builderIntern(b, sub->strings[i]);
+    }
+
+    uint32_t iconBase = (uint32_t)[b->icons count];
+    [b->icons addObjectsFromArray:sub->icons];
+
+    // Sub item i (i >= 1) lands at base + i
+    uint32_t base = sub->count > 1 ? builderReserve(b, sub->count - 1) - 1 : 0;
+    for (uint32_t i = 0; i < sub->count; i++) {
+        MenuLayoutItem *item = &b->items[i == 0 ? slot : base + i];
+        *item = sub->items[i];
+        item->label = strings[item->label];
+        item->keyEquivalent = strings[item->keyEquivalent];
+        item->action = strings[item->action];
+        item->iconName = strings[item->iconName];
+        if (item->iconData) {
+            item->iconData += iconBase;
+        }
+        if (item->childCount) {
+            item->firstChild += base;
+        }
+    }
+
+    free(strings);
+}
+
+// a{sv} arrives either as one dictionary or as an array of dictionaries;
+// look a property up without merging them (later dictionaries win)
+static id propertyValue(id properties, NSString *key)
+{
+    if ([properties isKindOfClass:[NSDictionary class]]) {
+        return [(NSDictionary *)properties objectForKey:key];
+    }
+    if ([properties isKindOfClass:[NSArray class]]) {
+        NSArray *list = (NSArray *)properties;
+        for (NSUInteger i = [list count]; i > 0; i--) {
+            id element = [list objectAtIndex:i - 1];
+            if ([element isKindOfClass:[NSDictionary class]]) {
+                id value = [(NSDictionary *)element objectForKey:key];
+                if (value) {
+                    return value;
+                }
+            }
+        }
+    }
+    return nil;
+}
+
+static NSString *labelWithoutMnemonics(NSString *label)
+{
+    if (![label isKindOfClass:[NSString class]]) {
+        return nil;
+    }
+    if ([label rangeOfString:@"_"].location == NSNotFound) {
+        return label;
+    }
+    return [label stringByReplacingOccurrencesOfString:@"_" withString:@""];
+}
+
+#pragma mark - dbusmenu
+
+// Fills slot from a layout node (ia{sv}av). Returns NO for malformed and
+// invisible nodes, which are not rendered.
+static BOOL dbusFillItem(MenuLayoutBuilder *b, uint32_t slot, id node, NSArray **children)
+{
+    *children = nil;
+    if (![node isKindOfClass:[NSArray class]] || [node count] < 3) {
+        return NO;
+    }
+
+    id properties = [node objectAtIndex:1];
+    NSNumber *visible = propertyValue(properties, @"visible");
+    if (visible && ![visible boolValue]) {
+        return NO;
+    }
+
+    MenuLayoutItem *item = &b->items[slot];
+    memset(item, 0, sizeof(*item));
+    item->itemId = [[node objectAtIndex:0] intValue];
+
+    NSString *type = propertyValue(properties, @"type");
+    if ([type isKindOfClass:[NSString class]] && [type isEqualToString:@"separator"]) {
+        item->flags = MenuLayoutItemSeparator;
+        item->hash = itemContentHash(b, item, nil);
+        return YES;
+    }
+
+    item->label = builderIntern(b, labelWithoutMnemonics(propertyValue(properties, @"label")));
+
+    // Shortcut: a keysym array, or one of the string accelerator spellings
+    NSString *keyCombo = nil;
+    id shortcutArray = propertyValue(properties, @"shortcut");
+    if ([shortcutArray isKindOfClass:[NSArray class]] && [shortcutArray count] > 0) {
+        keyCombo = [DBusMenuShortcutParser parseShortcutArray:shortcutArray];
+    } else {
+        static NSString *const accelProperties[] = { @"accel", @"accelerator", @"key-binding" };
+        for (int i = 0; i < 3; i++) {
+            id accel = propertyValue(properties, accelProperties[i]);
+            if ([accel isKindOfClass:[NSString class]] && [accel length] > 0) {
+                keyCombo = accel;
+                break;
+            }
+        }
+    }
+    if (keyCombo) {
+        MenuAccelerator shortcut;
+        MenuAcceleratorParse(keyCombo, MenuAcceleratorSyntaxKeyCombo, &shortcut);
+        item->keyEquivalent = builderIntern(b, shortcut.keyEquivalent);
+        item->modifierMask = (uint32_t)shortcut.modifierMask;
+    }
+
+    NSNumber *enabled = propertyValue(properties, @"enabled");
+    if (enabled) {
+        item->flags |= MenuLayoutItemHasEnabled;
+        if ([enabled boolValue]) {
+            item->flags |= MenuLayoutItemEnabled;
+        }
+    }
+
+    NSData *iconData = propertyValue(properties, @"icon-data");
+    if ([iconData isKindOfClass:[NSData class]] && [iconData length] > 0) {
+        [b->icons addObject:iconData];
+        item->iconData = (uint32_t)[b->icons count];
+    } else {
+        iconData = nil;
+        item->iconName = builderIntern(b, propertyValue(properties, @"icon-name"));
+    }
+
+    id childrenObj = [node objectAtIndex:2];
+    NSArray *nodeChildren = [childrenObj isKindOfClass:[NSArray class]] ? (NSArray *)childrenObj : nil;
+    NSString *childrenDisplay = propertyValue(properties, @"children-display");
+    if ([nodeChildren count] > 0 ||
+        ([childrenDisplay isKindOfClass:[NSString class]] && [childrenDisplay isEqualToString:@"submenu"])) {
+        item->flags |= MenuLayoutItemSubmenu;
+        *children = nodeChildren;
+    }
+
+    item->hash = itemContentHash(b, item, iconData);
+    return YES;
+}
+
+// Children of one parent are stored next to each other; grandchildren are
+// appended after the whole sibling run
+static void dbusBuildChildren(MenuLayoutBuilder *b, uint32_t parent, NSArray *nodes)
+{
+    uint32_t n = (uint32_t)[nodes count];
+    if (n == 0) {
+        return;
+    }
+
+    uint32_t first = builderReserve(b, n);
+    NSArray **grandchildren = malloc(sizeof(NSArray *) * n);
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (dbusFillItem(b, first + kept, [nodes objectAtIndex:i], &grandchildren[kept])) {
+            kept++;
+        }
+    }
+    // Give back the slots of skipped nodes
+    b->count = first + kept;
+    b->items[parent].firstChild = first;
+    b->items[parent].childCount = kept;
+
+    for (uint32_t k = 0; k < kept; k++) {
+        if (grandchildren[k]) {
+            dbusBuildChildren(b, first + k, grandchildren[k]);
+        }
+    }
+
+    uint64_t hash = b->items[parent].hash;
+    for (uint32_t k = 0; k < kept; k++) {
+        hash = hashMix(hash, b->items[first + k].hash);
+    }
+    b->items[parent].hash = hash;
+    free(grandchildren);
+}
+
+// One top-level subtree, parsed into its own arena on a parse worker
+@interface MenuLayoutSubtreeJob : NSObject
+{
+@public
+    id _node;
+    MenuLayoutBuilder _builder;
+    BOOL _kept;
+    BOOL _claimed;                  // Guarded by parseCondition
+    BOOL _done;                     // Guarded by parseCondition
+}
+- (id)initWithNode:(id)node;
+- (void)run;
+@end
+
+@implementation MenuLayoutSubtreeJob
+
+- (id)initWithNode:(id)node
+{
+    self = [super init];
+    if (self) {
+        _node = [node retain];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    builderFree(&_builder);
+    [_node release];
+    [super dealloc];
+}
+
+- (void)run
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    MenuTraceTime traceStart = MenuTraceBegin();
+
+    builderInit(&_builder, 64);
+    builderReserve(&_builder, 1);
+    NSArray *children = nil;
+    _kept = dbusFillItem(&_builder, 0, _node, &children);
+    if (_kept && children) {
+        dbusBuildChildren(&_builder, 0, children);
+    }
+
+    MenuTraceEnd("MenuLayout.subtree", "parse", traceStart, 0);
+    [pool release];
+}
+
+@end
+
+static NSCondition *parseCondition = nil;
+static NSMutableArray *parseQueue = nil;           // MenuLayoutSubtreeJobs not yet claimed
+static BOOL parseWorkersStarted = NO;
+
+#pragma mark - GTK
+
+// An item dictionary, or item data still split over several dictionaries
+static id gtkProperty(id itemData, NSString *key)
+{
+    return propertyValue(itemData, key);
+}
+
+static NSArray *gtkLinkKey(id link)
+{
+    if ([link isKindOfClass:[NSArray class]] && [link count] >= 2) {
+        return @[[link objectAtIndex:0], [link objectAtIndex:1]];
+    }
+    return nil;
+}
+
+// Collects the rendered (labelled) items of a GTK menu, splicing in its
+// :section menus with a separator in front of each that follows other items.
+// NSNull stands for a separator. Every menu key visited is added to keys.
+static void gtkFlattenItems(NSDictionary *menus, NSArray *items, NSMutableArray *flat,
+                            NSMutableArray *keys, uint32_t depth)
+{
+    for (id itemData in items) {
+        id section = gtkProperty(itemData, @":section");
+        NSArray *sectionKey = gtkLinkKey(section);
+        if (sectionKey) {
+            NSArray *sectionItems = [menus objectForKey:sectionKey];
+            if (sectionItems && depth < MENU_LAYOUT_MAX_GTK_DEPTH) {
+                if ([flat count] > 0) {
+                    [flat addObject:[NSNull null]];
+                }
+                [keys addObject:sectionKey];
+                gtkFlattenItems(menus, sectionItems, flat, keys, depth + 1);
+            }
+            continue;
+        }
+        if (gtkProperty(itemData, @"label")) {
+            [flat addObject:itemData];
+        }
+    }
+}
+
+static void gtkFillItem(MenuLayoutBuilder *b, uint32_t slot, id itemData, NSDictionary *menus,
+                        NSArray **submenuKey)
+{
+    *submenuKey = nil;
+    MenuLayoutItem *item = &b->items[slot];
+
+    if (itemData == [NSNull null]) {
+        item->flags = MenuLayoutItemSeparator;
+        item->hash = itemContentHash(b, item, nil);
+        return;
+    }
+
+    item->label = builderIntern(b, labelWithoutMnemonics(gtkProperty(itemData, @"label")));
+    item->action = builderIntern(b, gtkProperty(itemData, @"action"));
+
+    NSString *accel = gtkProperty(itemData, @"accel");
+    if (!accel) {
+        accel = gtkProperty(itemData, @"x-canonical-accel");
+    }
+    if ([accel isKindOfClass:[NSString class]] && [accel length] > 0) {
+        MenuAccelerator shortcut;
+        if (MenuAcceleratorParse(accel, MenuAcceleratorSyntaxGTK, &shortcut)) {
+            item->keyEquivalent = builderIntern(b, shortcut.keyEquivalent);
+            item->modifierMask = (uint32_t)shortcut.modifierMask;
+        }
+    }
+
+    uint64_t linkHash = 0;
+    NSArray *key = gtkLinkKey(gtkProperty(itemData, @":submenu"));
+    if (key) {
+        item->flags |= MenuLayoutItemSubmenu;
+        if ([menus objectForKey:key]) {
+            *submenuKey = key;
+        } else {
+            // Loaded on demand, or by the parser before materializing
+            item->flags |= MenuLayoutItemUnloaded;
+            item->firstKey = builderAddKey(b, [[key objectAtIndex:0] unsignedIntValue],
+                                           [[key objectAtIndex:1] unsignedIntValue]);
+            item->keyCount = 1;
+            linkHash = ((uint64_t)[[key objectAtIndex:0] unsignedIntValue] << 32) | [[key objectAtIndex:1] unsignedIntValue];
+        }
+    }
+
+    item->hash = hashMix(itemContentHash(b, item, nil), linkHash);
+}
+
+// Builds the items rendered into one container (root or submenu item): the
+// items of ownKey, or the given items, with sections flattened in
+static void gtkBuildContainer(MenuLayoutBuilder *b, uint32_t container, NSDictionary *menus,
+                              NSArray *items, NSArray *ownKey, uint32_t depth)
+{
+    NSMutableArray *flat = [NSMutableArray array];
+    NSMutableArray *keys = [NSMutableArray array];
+    if (ownKey) {
+        [keys addObject:ownKey];
+    }
+    gtkFlattenItems(menus, items, flat, keys, depth);
+
+    uint64_t hash = b->items[container].hash;
+    uint32_t firstKey = b->keyCount;
+    for (NSArray *key in keys) {
+        uint32_t group = [[key objectAtIndex:0] unsignedIntValue];
+        uint32_t menu = [[key objectAtIndex:1] unsignedIntValue];
+        builderAddKey(b, group, menu);
+        hash = hashMix(hash, ((uint64_t)group << 32) | menu);
+    }
+    b->items[container].firstKey = firstKey;
+    b->items[container].keyCount = (uint32_t)[keys count];
+
+    uint32_t n = (uint32_t)[flat count];
+    if (n > 0) {
+        uint32_t first = builderReserve(b, n);
+        NSArray **submenuKeys = malloc(sizeof(NSArray *) * n);
+        for (uint32_t i = 0; i < n; i++) {
+            gtkFillItem(b, first + i, [flat objectAtIndex:i], menus, &submenuKeys[i]);
+        }
+        b->items[container].firstChild = first;
+        b->items[container].childCount = n;
+
+        for (uint32_t i = 0; i < n; i++) {
+            if (submenuKeys[i] && depth < MENU_LAYOUT_MAX_GTK_DEPTH) {
+                gtkBuildContainer(b, first + i, menus, [menus objectForKey:submenuKeys[i]],
+                                  submenuKeys[i], depth + 1);
+            }
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            hash = hashMix(hash, b->items[first + i].hash);
+        }
+        free(submenuKeys);
+    }
+
+    b->items[container].hash = hash;
+}
+
+static BOOL stringsEqual(NSString *a, NSString *b)
+{
+    return a == b || (a != nil && b != nil && [a isEqualToString:b]);
+}
+
+@interface MenuLayout (Private)
+- (id)initWithBuilder:(MenuLayoutBuilder *)builder;
++ (void)buildDBusMenuTopLevel:(NSArray *)nodes intoBuilder:(MenuLayoutBuilder *)b;
++ (void)parseWorkerMain;
+- (BOOL)item:(const MenuLayoutItem *)item isEqualToItem:(const MenuLayoutItem *)other ofLayout:(MenuLayout *)layout;
+@end
+
+@implementation MenuLayout
+
++ (void)initialize
+{
+    if (self == [MenuLayout class]) {
+        parseCondition = [[NSCondition alloc] init];
+        parseQueue = [[NSMutableArray alloc] init];
+    }
+}
+
++ (MenuLayout *)layoutWithDBusMenuItem:(id)layoutItem
+{
+    if (![layoutItem isKindOfClass:[NSArray class]] || [layoutItem count] < 3) {
+        return nil;
+    }
+
+    id children = [layoutItem objectAtIndex:2];
+    if (![children isKindOfClass:[NSArray class]]) {
+        children = [NSArray array];
+    }
+
+    MenuTraceTime traceStart = MenuTraceBegin();
+    MenuLayoutBuilder b;
+    builderInit(&b, (uint32_t)[children count] * 8 + 1);
+    builderReserve(&b, 1);
+    b.items[0].flags = MenuLayoutItemSubmenu;
+    b.items[0].label = builderIntern(&b, propertyValue([layoutItem objectAtIndex:1], @"label"));
+    b.items[0].hash = itemContentHash(&b, &b.items[0], nil);
+
+    [self buildDBusMenuTopLevel:children intoBuilder:&b];
+
+    MenuLayout *layout = [[MenuLayout alloc] initWithBuilder:&b];
+    builderFree(&b);
+    MenuTraceEnd("MenuLayout.dbusmenu", "parse", traceStart, 0);
+    return [layout autorelease];
+}
+
++ (MenuLayout *)layoutWithDBusMenuItems:(NSArray *)layoutItems
+{
+    MenuLayoutBuilder b;
+    builderInit(&b, (uint32_t)[layoutItems count] * 8 + 1);
+    builderReserve(&b, 1);
+    b.items[0].flags = MenuLayoutItemSubmenu;
+    b.items[0].hash = itemContentHash(&b, &b.items[0], nil);
+
+    [self buildDBusMenuTopLevel:layoutItems intoBuilder:&b];
+
+    MenuLayout *layout = [[MenuLayout alloc] initWithBuilder:&b];
+    builderFree(&b);
+    return [layout autorelease];
+}
+
++ (MenuLayout *)layoutWithGTKMenus:(NSDictionary *)menus root:(NSArray *)rootKey title:(NSString *)title
+{
+    NSArray *items = [menus objectForKey:rootKey];
+    if (!items) {
+        return nil;
+    }
+
+    MenuTraceTime traceStart = MenuTraceBegin();
+    MenuLayoutBuilder b;
+    builderInit(&b, 64);
+    builderReserve(&b, 1);
+    b.items[0].flags = MenuLayoutItemSubmenu;
+    b.items[0].label = builderIntern(&b, title);
+    b.items[0].hash = itemContentHash(&b, &b.items[0], nil);
+
+    gtkBuildContainer(&b, 0, menus, items, rootKey, 0);
+
+    MenuLayout *layout = [[MenuLayout alloc] initWithBuilder:&b];
+    builderFree(&b);
+    MenuTraceEnd("MenuLayout.gtk", "parse", traceStart, 0);
+    return [layout autorelease];
+}
+
++ (MenuLayout *)layoutWithGTKItems:(NSArray *)items menus:(NSDictionary *)menus
+{
+    MenuLayoutBuilder b;
+    builderInit(&b, 16);
+    builderReserve(&b, 1);
+    b.items[0].flags = MenuLayoutItemSubmenu;
+    b.items[0].hash = itemContentHash(&b, &b.items[0], nil);
+
+    gtkBuildContainer(&b, 0, menus, items, nil, 0);
+
+    MenuLayout *layout = [[MenuLayout alloc] initWithBuilder:&b];
+    builderFree(&b);
+    return [layout autorelease];
+}
+
+- (void)dealloc
+{
+    for (uint32_t i = 1; i < _stringCount; i++) {
+        [_strings[i] release];
+    }
+    free(_strings);
+    free(_items);
+    free(_keys);
+    [_icons release];
+    [super dealloc];
+}
+
+- (uint32_t)layoutItemCount
+{
+    return _count;
+}
+
+- (const MenuLayoutItem *)root
+{
+    return &_items[0];
+}
+
+- (const MenuLayoutItem *)layoutItemAtIndex:(uint32_t)index
+{
+    return index < _count ? &_items[index] : NULL;
+}
+
+- (NSString *)stringAtIndex:(MenuLayoutString)index
+{
+    return index < _stringCount ? _strings[index] : nil;
+}
+
+- (NSData *)iconDataForItem:(const MenuLayoutItem *)item
+{
+    return item->iconData ? [_icons objectAtIndex:item->iconData - 1] : nil;
+}
+
+- (const MenuLayoutKey *)keysForItem:(const MenuLayoutItem *)item
+{
+    return item->keyCount ? &_keys[item->firstKey] : NULL;
+}
+
+- (NSSet *)unloadedGroups
+{
+    NSMutableSet *groups = [NSMutableSet set];
+    for (uint32_t i = 1; i < _count; i++) {
+        if (_items[i].flags & MenuLayoutItemUnloaded) {
+            [groups addObject:[NSNumber numberWithUnsignedInt:_keys[_items[i].firstKey].group]];
+        }
+    }
+    return groups;
+}
+
+- (BOOL)isEqualToLayout:(MenuLayout *)other
+{
+    if (other == self) {
+        return YES;
+    }
+    return other != nil && [self item:[self root] isEqualToItem:[other root] ofLayout:other];
+}
+
+- (NSIndexSet *)changedTopLevelItemsFromLayout:(MenuLayout *)older
+{
+    const MenuLayoutItem *root = [self root];
+    if (!older || [older root]->childCount != root->childCount) {
+        return nil;
+    }
+
+    NSMutableIndexSet *changed = [NSMutableIndexSet indexSet];
+    const MenuLayoutItem *olderRoot = [older root];
+    for (uint32_t i = 0; i < root->childCount; i++) {
+        if (![self item:&_items[root->firstChild + i]
+          isEqualToItem:[older layoutItemAtIndex:olderRoot->firstChild + i]
+               ofLayout:older]) {
+            [changed addIndex:i];
+        }
+    }
+    return changed;
+}
+
+@end
+
+@implementation MenuLayout (Private)
+
+- (id)initWithBuilder:(MenuLayoutBuilder *)builder
+{
+    self = [super init];
+    if (self) {
+        // Take the arena over and trim it; builderFree() releases the rest
+        _count = builder->count;
+        _items = realloc(builder->items, sizeof(MenuLayoutItem) * (_count ? _count : 1));
+        _stringCount = builder->stringCount;
+        _strings = realloc(builder->strings, sizeof(NSString *) * _stringCount);
+        _keyCount = builder->keyCount;
+        _keys = builder->keys;
+        _icons = [builder->icons copy];
+
+        builder->items = NULL;
+        builder->strings = NULL;
+        builder->stringCount = 0;
+        builder->keys = NULL;
+    }
+    return self;
+}
+
++ (void)buildDBusMenuTopLevel:(NSArray *)nodes intoBuilder:(MenuLayoutBuilder *)b
+{
+    // Only split when there is enough work to pay for the hand-off
+    NSUInteger estimate = [nodes count];
+    for (id node in nodes) {
+        if ([node isKindOfClass:[NSArray class]] && [node count] >= 3 &&
+            [[node objectAtIndex:2] isKindOfClass:[NSArray class]]) {
+            estimate += [[node objectAtIndex:2] count];
+        }
+    }
+    if ([nodes count] < 2 || estimate < MENU_LAYOUT_PARALLEL_MIN_ITEMS) {
+        dbusBuildChildren(b, 0, nodes);
+        return;
+    }
+
+    NSMutableArray *jobs = [NSMutableArray arrayWithCapacity:[nodes count]];
+    for (id node in nodes) {
+        MenuLayoutSubtreeJob *job = [[MenuLayoutSubtreeJob alloc] initWithNode:node];
+        [jobs addObject:job];
+        [job release];
+    }
+
+    [parseCondition lock];
+    if (!parseWorkersStarted) {
+        for (NSUInteger i = 0; i < MENU_LAYOUT_WORKER_COUNT; i++) {
+            NSThread *thread = [[NSThread alloc] initWithTarget:self
+                                                       selector:@selector(parseWorkerMain)
+                                                         object:nil];
+            [thread setName:[NSString stringWithFormat:@"MenuLayoutParse%lu", (unsigned long)i]];
+            [thread start];
+            [thread release];
+        }
+        parseWorkersStarted = YES;
+    }
+    [parseQueue addObjectsFromArray:jobs];
+    [parseCondition broadcast];
+    [parseCondition unlock];
+
+    // The calling thread works through its own jobs from the back while the workers take the front
+    for (NSUInteger i = [jobs count]; i > 0; i--) {
+        MenuLayoutSubtreeJob *job = [jobs objectAtIndex:i - 1];
+        [parseCondition lock];
+        BOOL claimed = !job->_claimed;
+        if (claimed) {
+            job->_claimed = YES;
+            [parseQueue removeObjectIdenticalTo:job];
+        }
+        [parseCondition unlock];
+
+        if (claimed) {
+            [job run];
+            [parseCondition lock];
+            job->_done = YES;
+            [parseCondition unlock];
+        }
+    }
+
+    [parseCondition lock];
+    for (MenuLayoutSubtreeJob *job in jobs) {
+        while (!job->_done) {
+            [parseCondition wait];
+        }
+    }
+    [parseCondition unlock];
+
+    uint32_t kept = 0;
+    for (MenuLayoutSubtreeJob *job in jobs) {
+        if (job->_kept) {
+            kept++;
+        }
+    }
+
+    uint32_t first = builderReserve(b, kept);
+    b->items[0].firstChild = first;
+    b->items[0].childCount = kept;
+    uint64_t hash = b->items[0].hash;
+    uint32_t slot = first;
+    for (MenuLayoutSubtreeJob *job in jobs) {
+        if (job->_kept) {
+            builderAppendSubtree(b, slot, &job->_builder);
+            hash = hashMix(hash, b->items[slot].hash);
+            slot++;
+        }
+    }
+    b->items[0].hash = hash;
+}
+
++ (void)parseWorkerMain
+{
+    while (YES) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+
+        [parseCondition lock];
+        while ([parseQueue count] == 0) {
+            [parseCondition wait];
+        }
+        MenuLayoutSubtreeJob *job = [[[parseQueue objectAtIndex:0] retain] autorelease];
+        [parseQueue removeObjectAtIndex:0];
+        job->_claimed = YES;
+        [parseCondition unlock];
+
+        [job run];
+
+        [parseCondition lock];
+        job->_done = YES;
+        [parseCondition broadcast];
+        [parseCondition unlock];
+
+        [pool release];
+    }
+}
+
+- (BOOL)item:(const MenuLayoutItem *)item isEqualToItem:(const MenuLayoutItem *)other ofLayout:(MenuLayout *)layout
+{
+    if (item->hash != other->hash || item->flags != other->flags || item->itemId != other->itemId ||
+        item->modifierMask != other->modifierMask || item->childCount != other->childCount ||
+        item->keyCount != other->keyCount) {
+        return NO;
+    }
+    if (!stringsEqual([self stringAtIndex:item->label], [layout stringAtIndex:other->label]) ||
+        !stringsEqual([self stringAtIndex:item->keyEquivalent], [layout stringAtIndex:other->keyEquivalent]) ||
+        !stringsEqual([self stringAtIndex:item->action], [layout stringAtIndex:other->action]) ||
+        !stringsEqual([self stringAtIndex:item->iconName], [layout stringAtIndex:other->iconName])) {
+        return NO;
+    }
+
+    NSData *icon = [self iconDataForItem:item];
+    NSData *otherIcon = [layout iconDataForItem:other];
+    if (icon != otherIcon && ![icon isEqualToData:otherIcon]) {
+        return NO;
+    }
+
+    if (item->keyCount &&
+        memcmp([self keysForItem:item], [layout keysForItem:other], sizeof(MenuLayoutKey) * item->keyCount) != 0) {
+        return NO;
+    }
+
+    for (uint32_t i = 0; i < item->childCount; i++) {
+        if (![self item:&_items[item->firstChild + i]
+          isEqualToItem:[layout layoutItemAtIndex:other->firstChild + i]
+               ofLayout:layout]) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+@end
@@ -0,0 +1,54 @@
+#import <Foundation/Foundation.h>
+
+/**
+ * MenuPreWarmScheduler
+ *
+ * Loads the menus of sibling windows of the active application on a
+ * low-priority worker thread, so an app switch never waits for pre-warming.
+ *
+ * A request only records the application and wakes the worker; the worker
+ * walks _NET_CLIENT_LIST, skips windows that are already cached, collapses
+ * windows that share a menu (same service and object path) into one job,
+ * orders jobs by the menu's past MenuCacheEntry access count and keeps at
+ * most a bounded number of them. Every request (and -cancelPendingWork)
+ * starts a new generation: jobs of older generations are dropped before
+ * they run, so switching again cancels pre-warming for the previous app.
+ * A job gives way to foreground loads: it does not start while one is
+ * pending and goes back to the head of the queue if one arrives first.
+ */
+@interface MenuPreWarmScheduler : NSObject
+{
+    NSThread *_workerThread;
+    NSCondition *_condition;            // Guards everything below
+    NSString *_pendingApplication;      // Discovery request not yet picked up by the worker
+    unsigned long _pendingExcludedWindow;
+    NSMutableArray *_jobs;              // NSDictionary jobs, highest priority first
+    NSMutableSet *_queuedMenuKeys;      // "service|path" of queued or running jobs
+    NSUInteger _maxJobs;
+    NSUInteger _generation;
+    BOOL _shouldStop;
+
+    // Statistics
+    NSUInteger _requests;
+    NSUInteger _completed;
+    NSUInteger _deduplicated;
+    NSUInteger _cancelled;
+    NSUInteger _dropped;
+    NSUInteger _yielded;                // Jobs requeued because a foreground load was pending
+}
+
++ (MenuPreWarmScheduler *)sharedScheduler;
+
+// Returns immediately; the discovery and loads happen on the worker thread
+- (void)requestPreWarmForApplication:(NSString *)applicationName excludingWindow:(unsigned long)windowId;
+
+// Drop all queued work (the job currently loading, if any, still completes)
+- (void)cancelPendingWork;
+
+// 0 turns pre-warming off (Menu.app --no-prewarm)
+- (void)setMaxJobs:(NSUInteger)maxJobs;
+- (void)stop;
+
+- (NSDictionary *)statistics;
+
+@end
@@ -0,0 +1,335 @@
+#import "MenuPreWarmScheduler.h"
+#import "MenuProtocolManager.h"
+#import "MenuCacheManager.h"
+#import "MenuUtils.h"
+#import "X11DisplayService.h"
+#import "X11ShortcutManager.h"
+
+static MenuPreWarmScheduler *sharedScheduler = nil;
+
+@interface MenuPreWarmScheduler (Private)
+- (void)workerMain;
+- (NSArray *)discoverJobsForApplication:(NSString *)applicationName
+                        excludingWindow:(unsigned long)excludedWindow
+                             generation:(NSUInteger)generation;
+- (void)enqueueJobs:(NSArray *)jobs generation:(NSUInteger)generation;
+- (void)runJob:(NSDictionary *)job;
+@end
+
+@implementation MenuPreWarmScheduler
+
++ (MenuPreWarmScheduler *)sharedScheduler
+{
+    @synchronized(self) {
+        if (!sharedScheduler) {
+            sharedScheduler = [[MenuPreWarmScheduler alloc] init];
+        }
+    }
+    return sharedScheduler;
+}
+
+- (id)init
+{
+    self = [super init];
+    if (self) {
+        _condition = [[NSCondition alloc] init];
+        _jobs = [[NSMutableArray alloc] init];
+        _queuedMenuKeys = [[NSMutableSet alloc] init];
+        _maxJobs = 3;
+        _generation = 0;
+        _shouldStop = NO;
+
+        _workerThread = [[NSThread alloc] initWithTarget:self
+                                                selector:@selector(workerMain)
+                                                  object:nil];
+        [_workerThread setName:@"MenuPreWarm"];
+        [_workerThread start];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [self stop];
+    [_workerThread release];
+    [_pendingApplication release];
+    [_jobs release];
+    [_queuedMenuKeys release];
+    [_condition release];
+    [super dealloc];
+}
+
+- (void)requestPreWarmForApplication:(NSString *)applicationName excludingWindow:(unsigned long)windowId
+{
+    if (!applicationName) {
+        return;
+    }
+
+    [_condition lock];
+    if (_maxJobs == 0) {
+        [_condition unlock];
+        return;
+    }
+    _generation++;
+    _cancelled += [_jobs count];
+    [_jobs removeAllObjects];
+    [_queuedMenuKeys removeAllObjects];
+
+    [_pendingApplication release];
+    _pendingApplication = [applicationName copy];
+    _pendingExcludedWindow = windowId;
+    _requests++;
+
+    [_condition signal];
+    [_condition unlock];
+}
+
+- (void)cancelPendingWork
+{
+    [_condition lock];
+    _generation++;
+    _cancelled += [_jobs count];
+    [_jobs removeAllObjects];
+    [_queuedMenuKeys removeAllObjects];
+    [_pendingApplication release];
+    _pendingApplication = nil;
+    [_condition unlock];
+}
+
+- (void)setMaxJobs:(NSUInteger)maxJobs
+{
+    [_condition lock];
+    _maxJobs = maxJobs;
+    while ([_jobs count] > _maxJobs) {
+        [_jobs removeLastObject];
+        _dropped++;
+    }
+    [_condition unlock];
+}
+
+- (void)stop
+{
+    [_condition lock];
+    _shouldStop = YES;
+    [_condition signal];
+    [_condition unlock];
+}
+
+- (NSDictionary *)statistics
+{
+    [_condition lock];
+    NSDictionary *stats = [NSDictionary dictionaryWithObjectsAndKeys:
+        [NSNumber numberWithUnsignedInteger:_requests], @"requests",
+        [NSNumber numberWithUnsignedInteger:_completed], @"completed",
+        [NSNumber numberWithUnsignedInteger:_deduplicated], @"deduplicated",
+        [NSNumber numberWithUnsignedInteger:_cancelled], @"cancelled",
+        [NSNumber numberWithUnsignedInteger:_dropped], @"dropped",
+        [NSNumber numberWithUnsignedInteger:_yielded], @"yielded",
+        [NSNumber numberWithUnsignedInteger:[_jobs count]], @"queued",
+        nil];
+    [_condition unlock];
+    return stats;
+}
+
+@end
+
+@implementation MenuPreWarmScheduler (Private)
+
+- (void)workerMain
+{
+    [NSThread setThreadPriority:0.1];
+    // Pre-warmed menus are not on screen; their shortcuts are registered when they are shown
+    [[X11ShortcutManager sharedManager] ignoreRegistrationsFromCurrentThread];
+    NSLog(@"MenuPreWarmScheduler: Worker thread started");
+
+    while (YES) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+
+        [_condition lock];
+        while (!_shouldStop && !_pendingApplication && [_jobs count] == 0) {
+            [_condition wait];
+        }
+        if (_shouldStop) {
+            [_condition unlock];
+            [pool release];
+            break;
+        }
+
+        NSUInteger generation = _generation;
+        NSString *applicationName = nil;
+        unsigned long excludedWindow = 0;
+        NSDictionary *job = nil;
+
+        if (_pendingApplication) {
+            applicationName = [_pendingApplication autorelease];
+            _pendingApplication = nil;
+            excludedWindow = _pendingExcludedWindow;
+        } else {
+            job = [[[_jobs objectAtIndex:0] retain] autorelease];
+            [_jobs removeObjectAtIndex:0];
+        }
+        [_condition unlock];
+
+        if (applicationName) {
+            NSArray *jobs = [self discoverJobsForApplication:applicationName
+                                             excludingWindow:excludedWindow
+                                                  generation:generation];
+            [self enqueueJobs:jobs generation:generation];
+        } else if (job) {
+            [self runJob:job];
+        }
+
+        [pool release];
+    }
+
+    NSLog(@"MenuPreWarmScheduler: Worker thread exiting");
+}
+
+- (NSArray *)discoverJobsForApplication:(NSString *)applicationName
+                        excludingWindow:(unsigned long)excludedWindow
+                             generation:(NSUInteger)generation
+{
+    X11DisplayService *x11 = [X11DisplayService sharedService];
+    NSArray *windows = [x11 clientWindows];
+    if ([windows count] == 0) {
+        return [NSArray array];
+    }
+
+    [x11 prefetchProperties:[NSArray arrayWithObjects:@"WM_CLASS", @"WM_NAME", nil] forWindows:windows];
+
+    MenuProtocolManager *protocolManager = [MenuProtocolManager sharedManager];
+    MenuCacheManager *cacheManager = [MenuCacheManager sharedManager];
+    NSMutableArray *jobs = [NSMutableArray array];
+    NSMutableSet *menuKeys = [NSMutableSet set];
+    NSUInteger deduplicated = 0;
+
+    for (NSNumber *windowKey in windows) {
+        unsigned long window = [windowKey unsignedLongValue];
+        if (window == excludedWindow) {
+            continue;
+        }
+
+        NSString *windowAppName = [MenuUtils getApplicationNameForWindow:window];
+        if (![windowAppName isEqualToString:applicationName]) {
+            continue;
+        }
+        if ([cacheManager hasCachedMenuForWindow:window] || ![protocolManager hasMenuForWindow:window]) {
+            continue;
+        }
+
+        NSString *serviceName = [protocolManager getMenuServiceForWindow:window];
+        NSString *objectPath = [protocolManager getMenuObjectPathForWindow:window];
+        NSString *menuKey = (serviceName && objectPath)
+            ? [NSString stringWithFormat:@"%@|%@", serviceName, objectPath]
+            : [windowKey stringValue];
+
+        // Sibling windows exporting the same menu only need one load
+        if ([menuKeys containsObject:menuKey]) {
+            deduplicated++;
+            continue;
+        }
+
+        NSUInteger priority = [cacheManager accessCountForService:serviceName objectPath:objectPath];
+        NSDictionary *job = [NSDictionary dictionaryWithObjectsAndKeys:
+            windowKey, @"window",
+            menuKey, @"menuKey",
+            applicationName, @"application",
+            [NSNumber numberWithUnsignedInteger:priority], @"priority",
+            [NSNumber numberWithUnsignedInteger:[jobs count]], @"order",
+            [NSNumber numberWithUnsignedInteger:generation], @"generation",
+            nil];
+        [jobs addObject:job];
+        [menuKeys addObject:menuKey];
+    }
+
+    [_condition lock];
+    _deduplicated += deduplicated;
+    [_condition unlock];
+
+    // Most used menus first; equal priorities keep _NET_CLIENT_LIST order
+    NSArray *ordering = [NSArray arrayWithObjects:
+                         [NSSortDescriptor sortDescriptorWithKey:@"priority" ascending:NO],
+                         [NSSortDescriptor sortDescriptorWithKey:@"order" ascending:YES],
+                         nil];
+    return [jobs sortedArrayUsingDescriptors:ordering];
+}
+
+- (void)enqueueJobs:(NSArray *)jobs generation:(NSUInteger)generation
+{
+    [_condition lock];
+    if (generation != _generation) {
+        // The user switched again while we were discovering
+        _cancelled += [jobs count];
+        [_condition unlock];
+        return;
+    }
+
+    for (NSDictionary *job in jobs) {
+        NSString *menuKey = [job objectForKey:@"menuKey"];
+        if ([_queuedMenuKeys containsObject:menuKey]) {
+            _deduplicated++;
+            continue;
+        }
+        if ([_jobs count] >= _maxJobs) {
+            _dropped++;
+            continue;
+        }
+        [_jobs addObject:job];
+        [_queuedMenuKeys addObject:menuKey];
+    }
+
+    NSLog(@"MenuPreWarmScheduler: %lu pre-warm jobs queued (%lu discovered)",
+          (unsigned long)[_jobs count], (unsigned long)[jobs count]);
+    [_condition unlock];
+}
+
+- (void)runJob:(NSDictionary *)job
+{
+    unsigned long window = [[job objectForKey:@"window"] unsignedLongValue];
+    NSUInteger generation = [[job objectForKey:@"generation"] unsignedIntegerValue];
+
+    [_condition lock];
+    BOOL stale = (generation != _generation);
+    if (stale) {
+        _cancelled++;
+    }
+    [_condition unlock];
+
+    // May have been loaded by the foreground in the meantime
+    if (stale || [[MenuCacheManager sharedManager] hasCachedMenuForWindow:window]) {
+        [_condition lock];
+        [_queuedMenuKeys removeObject:[job objectForKey:@"menuKey"]];
+        [_condition unlock];
+        return;
+    }
+
+    NSDate *start = [NSDate date];
+    BOOL yielded = NO;
+    NSMenu *menu = [[MenuProtocolManager sharedManager] preWarmMenuForWindow:window yielded:&yielded];
+
+    [_condition lock];
+    if (yielded) {
+        // A foreground load came first; run this job again after it unless
+        // a newer switch has replaced the queue
+        _yielded++;
+        if (generation == _generation) {
+            [_jobs insertObject:job atIndex:0];
+        } else {
+            [_queuedMenuKeys removeObject:[job objectForKey:@"menuKey"]];
+            _cancelled++;
+        }
+        [_condition unlock];
+        return;
+    }
+    [_queuedMenuKeys removeObject:[job objectForKey:@"menuKey"]];
+    if (menu) {
+        _completed++;
+    }
+    [_condition unlock];
+
+    NSLog(@"MenuPreWarmScheduler: %@ pre-warm of window %lu (%@) in %.1f ms",
+          menu ? @"Finished" : @"Failed", window, [job objectForKey:@"application"],
+          -[start timeIntervalSinceNow] * 1000.0);
+}
+
+@end
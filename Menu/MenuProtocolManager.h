@@ -39,6 +39,9 @@ typedef NS_ENUM(NSInteger, MenuProtocolType) {
     NSMutableArray *_protocolHandlers;  // Array of protocol handlers
     AppMenuWidget *_appMenuWidget;      // Reference to the menu widget
     NSMutableDictionary *_windowToProtocolMap; // windowId -> protocol type that handles it
+    NSRecursiveLock *_menuLoadLock;     // Serializes menu loads (foreground and pre-warm worker)
+    NSCondition *_foregroundCondition;  // Guards _foregroundLoads
+    NSUInteger _foregroundLoads;        // getMenuForWindow: calls waiting for or holding _menuLoadLock
 }
 
 @property (nonatomic, assign) AppMenuWidget *appMenuWidget;
@@ -57,10 +60,22 @@ typedef NS_ENUM(NSInteger, MenuProtocolType) {
 - (void)activateMenuItem:(NSMenuItem *)menuItem forWindow:(unsigned long)windowId;
 - (void)scanForExistingMenuServices;
 
+// For the pre-warm worker: waits while foreground loads are pending and
+// loads only if none arrived before it got the load lock. Sets *yielded
+// and returns nil if it gave way, so the worker can requeue the job.
+- (NSMenu *)preWarmMenuForWindow:(unsigned long)windowId yielded:(BOOL *)yielded;
+- (NSString *)getMenuServiceForWindow:(unsigned long)windowId;
+- (NSString *)getMenuObjectPathForWindow:(unsigned long)windowId;
+
 // Window registration (auto-detects protocol type)
 - (void)registerWindow:(unsigned long)windowId 
            serviceName:(NSString *)serviceName 
             objectPath:(NSString *)objectPath;
+// Window registration with a protocol already known from the window's X11 properties
+- (void)registerWindow:(unsigned long)windowId
+           serviceName:(NSString *)serviceName
+            objectPath:(NSString *)objectPath
+          protocolType:(MenuProtocolType)protocolType;
 - (void)unregisterWindow:(unsigned long)windowId;
 
 // Protocol detection
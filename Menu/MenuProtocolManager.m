@@ -1,6 +1,7 @@
 #import "MenuProtocolManager.h"
 #import "AppMenuWidget.h"
 #import "DBusConnection.h"
+#import "MenuTrace.h"
 
 @implementation MenuProtocolManager
 
@@ -20,6 +21,9 @@ static MenuProtocolManager *sharedInstance = nil;
     if (self) {
         _protocolHandlers = [[NSMutableArray alloc] initWithCapacity:2];
         _windowToProtocolMap = [[NSMutableDictionary alloc] init];
+        _menuLoadLock = [[NSRecursiveLock alloc] init];
+        _foregroundCondition = [[NSCondition alloc] init];
+        _foregroundLoads = 0;
         _appMenuWidget = nil;
         
         NSLog(@"MenuProtocolManager: Initialized protocol manager");
@@ -32,6 +36,8 @@ static MenuProtocolManager *sharedInstance = nil;
     [self cleanup];
     [_protocolHandlers release];
     [_windowToProtocolMap release];
+    [_menuLoadLock release];
+    [_foregroundCondition release];
     [super dealloc];
 }
 
@@ -131,6 +137,59 @@ static MenuProtocolManager *sharedInstance = nil;
 }
 
 - (NSMenu *)getMenuForWindow:(unsigned long)windowId
+{
+    // The pre-warm worker loads menus too; one load at a time on the shared D-Bus
+    // connection. It starts no load while this one is pending, so the wait is at
+    // most the one pre-warm load already running.
+    [_foregroundCondition lock];
+    _foregroundLoads++;
+    [_foregroundCondition unlock];
+    
+    MenuTraceTime traceStart = MenuTraceBegin();
+    [_menuLoadLock lock];
+    MenuTraceEnd("MenuProtocolManager.waitForLoadLock", "menu", traceStart, windowId);
+    traceStart = MenuTraceBegin();
+    NSMenu *menu = [[self loadMenuForWindow:windowId] retain];
+    MenuTraceEnd("MenuProtocolManager.getMenuForWindow", "menu", traceStart, windowId);
+    [_menuLoadLock unlock];
+    
+    [_foregroundCondition lock];
+    _foregroundLoads--;
+    [_foregroundCondition broadcast];
+    [_foregroundCondition unlock];
+    return [menu autorelease];
+}
+
+- (NSMenu *)preWarmMenuForWindow:(unsigned long)windowId yielded:(BOOL *)yielded
+{
+    *yielded = NO;
+    
+    [_foregroundCondition lock];
+    while (_foregroundLoads > 0) {
+        [_foregroundCondition wait];
+    }
+    [_foregroundCondition unlock];
+    
+    [_menuLoadLock lock];
+    
+    // A foreground load that arrived meanwhile goes first
+    [_foregroundCondition lock];
+    BOOL foregroundPending = (_foregroundLoads > 0);
+    [_foregroundCondition unlock];
+    if (foregroundPending) {
+        [_menuLoadLock unlock];
+        *yielded = YES;
+        return nil;
+    }
+    
+    MenuTraceTime traceStart = MenuTraceBegin();
+    NSMenu *menu = [[self loadMenuForWindow:windowId] retain];
+    MenuTraceEnd("MenuProtocolManager.preWarmMenuForWindow", "prewarm", traceStart, windowId);
+    [_menuLoadLock unlock];
+    return [menu autorelease];
+}
+
+- (NSMenu *)loadMenuForWindow:(unsigned long)windowId
 {
     NSNumber *windowKey = [NSNumber numberWithUnsignedLong:windowId];
     NSNumber *protocolTypeNum = [_windowToProtocolMap objectForKey:windowKey];
@@ -162,6 +221,32 @@ static MenuProtocolManager *sharedInstance = nil;
     return nil;
 }
 
+- (id<MenuProtocolHandler>)handlerForWindow:(unsigned long)windowId
+{
+    NSNumber *protocolTypeNum = [_windowToProtocolMap objectForKey:[NSNumber numberWithUnsignedLong:windowId]];
+    if (protocolTypeNum) {
+        return [self handlerForType:[protocolTypeNum integerValue]];
+    }
+    
+    for (NSUInteger i = 0; i < [_protocolHandlers count]; i++) {
+        id handler = [_protocolHandlers objectAtIndex:i];
+        if (![handler isKindOfClass:[NSNull class]] && [handler hasMenuForWindow:windowId]) {
+            return handler;
+        }
+    }
+    return nil;
+}
+
+- (NSString *)getMenuServiceForWindow:(unsigned long)windowId
+{
+    return [[self handlerForWindow:windowId] getMenuServiceForWindow:windowId];
+}
+
+- (NSString *)getMenuObjectPathForWindow:(unsigned long)windowId
+{
+    return [[self handlerForWindow:windowId] getMenuObjectPathForWindow:windowId];
+}
+
 - (void)activateMenuItem:(NSMenuItem *)menuItem forWindow:(unsigned long)windowId
 {
     NSNumber *windowKey = [NSNumber numberWithUnsignedLong:windowId];
@@ -216,6 +301,19 @@ static MenuProtocolManager *sharedInstance = nil;
     // Detect which protocol this service uses
     MenuProtocolType protocolType = [self detectProtocolTypeForService:serviceName objectPath:objectPath];
     
+    [self registerWindow:windowId serviceName:serviceName objectPath:objectPath protocolType:protocolType];
+}
+
+- (void)registerWindow:(unsigned long)windowId
+           serviceName:(NSString *)serviceName
+            objectPath:(NSString *)objectPath
+          protocolType:(MenuProtocolType)protocolType
+{
+    if (!serviceName || !objectPath) {
+        NSLog(@"MenuProtocolManager: ERROR: Invalid service name or object path");
+        return;
+    }
+    
     id<MenuProtocolHandler> handler = [self handlerForType:protocolType];
     if (!handler) {
         NSLog(@"MenuProtocolManager: ERROR: No handler available for protocol type %ld", (long)protocolType);
@@ -0,0 +1,48 @@
+#import <Foundation/Foundation.h>
+#include <stdint.h>
+
+/**
+ * MenuTrace
+ *
+ * Span tracing for the path from a _NET_ACTIVE_WINDOW change to the menu
+ * being drawn: X property reads, cache lookups, D-Bus round-trips, parsing,
+ * NSMenu construction, shortcut registration and the first NSMenuView draw,
+ * and the org.gtk.Menus.Changed deltas applied to menus already built.
+ *
+ * Tracing is off unless MENU_TRACE_FILE is set or Menu.app is started with
+ * --trace FILE. When off, MenuTraceBegin() returns 0 and MenuTraceEnd()
+ * returns immediately, so the instrumentation costs a branch. When on, spans
+ * go into a fixed-size in-memory ring (oldest overwritten) and are written as
+ * Chrome trace JSON (chrome://tracing, ui.perfetto.dev) on termination, with
+ * a count/p50/p95 summary per span name in the log.
+ *
+ * Every activation produces a "time-to-menu" span from the PropertyNotify
+ * (or the widget update, if there was none) to the first draw after the
+ * menu view for that window is installed.
+ *
+ * Span names and categories are stored by pointer and must be string literals.
+ * All functions are thread-safe.
+ */
+
+typedef uint64_t MenuTraceTime;     // Microseconds since tracing started, 0 = not tracing
+
+MenuTraceTime MenuTraceBegin(void);
+void MenuTraceEnd(const char *name, const char *category, MenuTraceTime start, unsigned long windowId);
+
+// Activation bracketing for time-to-menu: the active window event, the
+// window it resolved to, its menu view being installed, and the next draw
+void MenuTraceActiveWindowEvent(void);
+void MenuTraceActivationBegan(unsigned long windowId);
+void MenuTraceMenuInstalled(unsigned long windowId);
+void MenuTraceMenuDrawn(void);
+
+@interface MenuTrace : NSObject
+
+// Starts recording; later calls are ignored. Returns NO if the file cannot be created.
++ (BOOL)startTracingToFile:(NSString *)path;
++ (BOOL)isEnabled;
+
+// Writes the trace file and logs the per-span summary
++ (BOOL)writeTrace;
+
+@end
@@ -0,0 +1,297 @@
+#import "MenuTrace.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MENU_TRACE_CAPACITY 65536       // Spans kept in the ring
+#define MENU_TRACE_MAX_THREADS 64
+
+typedef struct {
+    const char *name;
+    const char *category;
+    MenuTraceTime start;
+    MenuTraceTime duration;
+    unsigned long windowId;
+    int thread;
+} MenuTraceSpan;
+
+static volatile BOOL traceEnabled = NO;
+static char *tracePath = NULL;
+static struct timespec traceEpoch;
+static pthread_mutex_t traceMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static MenuTraceSpan *traceSpans = NULL;
+static uint64_t traceSpanCount = 0;     // Total recorded; the ring holds the last MENU_TRACE_CAPACITY
+
+static char *traceThreadNames[MENU_TRACE_MAX_THREADS + 1];
+static int traceThreadCount = 0;
+static __thread int traceThreadIndex = 0;
+
+// Pending activation: the PropertyNotify time, then the window it resolved to.
+// Only armed activations complete on draw, so a redraw of the previous menu
+// while the new one is still loading does not count.
+static MenuTraceTime traceEventTime = 0;
+static MenuTraceTime traceActivationStart = 0;
+static unsigned long traceActivationWindow = 0;
+static BOOL traceActivationArmed = NO;
+
+static MenuTraceTime traceNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t micros = (int64_t)(now.tv_sec - traceEpoch.tv_sec) * 1000000 +
+                     (now.tv_nsec - traceEpoch.tv_nsec) / 1000;
+    // 0 means "not tracing"; the first microsecond is not worth special-casing
+    return micros > 0 ? (MenuTraceTime)micros : 1;
+}
+
+// Small stable thread numbers for the trace viewer, named after the NSThread
+static int traceCurrentThread(void)
+{
+    if (traceThreadIndex != 0) {
+        return traceThreadIndex;
+    }
+
+    NSString *name = [NSThread isMainThread] ? @"main" : [[NSThread currentThread] name];
+    if ([name length] == 0) {
+        name = @"thread";
+    }
+
+    pthread_mutex_lock(&traceMutex);
+    if (traceThreadCount < MENU_TRACE_MAX_THREADS) {
+        traceThreadCount++;
+        traceThreadNames[traceThreadCount] = strdup([name UTF8String]);
+        traceThreadIndex = traceThreadCount;
+    } else {
+        traceThreadIndex = MENU_TRACE_MAX_THREADS;
+    }
+    pthread_mutex_unlock(&traceMutex);
+    return traceThreadIndex;
+}
+
+static void traceRecord(const char *name, const char *category, MenuTraceTime start,
+                        MenuTraceTime end, unsigned long windowId)
+{
+    int thread = traceCurrentThread();
+
+    pthread_mutex_lock(&traceMutex);
+    MenuTraceSpan *span = &traceSpans[traceSpanCount % MENU_TRACE_CAPACITY];
+    span->name = name;
+    span->category = category;
+    span->start = start;
+    span->duration = end > start ? end - start : 0;
+    span->windowId = windowId;
+    span->thread = thread;
+    traceSpanCount++;
+    pthread_mutex_unlock(&traceMutex);
+}
+
+MenuTraceTime MenuTraceBegin(void)
+{
+    return traceEnabled ? traceNow() : 0;
+}
+
+void MenuTraceEnd(const char *name, const char *category, MenuTraceTime start, unsigned long windowId)
+{
+    if (start == 0) {
+        return;
+    }
+    traceRecord(name, category, start, traceNow(), windowId);
+}
+
+void MenuTraceActiveWindowEvent(void)
+{
+    if (!traceEnabled) {
+        return;
+    }
+    MenuTraceTime now = traceNow();
+    pthread_mutex_lock(&traceMutex);
+    traceEventTime = now;
+    pthread_mutex_unlock(&traceMutex);
+}
+
+void MenuTraceActivationBegan(unsigned long windowId)
+{
+    if (!traceEnabled) {
+        return;
+    }
+    MenuTraceTime now = traceNow();
+    pthread_mutex_lock(&traceMutex);
+    // An activation superseded before its menu was drawn is simply dropped
+    traceActivationStart = traceEventTime ? traceEventTime : now;
+    traceActivationWindow = windowId;
+    traceActivationArmed = NO;
+    traceEventTime = 0;
+    pthread_mutex_unlock(&traceMutex);
+}
+
+void MenuTraceMenuInstalled(unsigned long windowId)
+{
+    if (!traceEnabled) {
+        return;
+    }
+    pthread_mutex_lock(&traceMutex);
+    if (traceActivationStart != 0 && traceActivationWindow == windowId) {
+        traceActivationArmed = YES;
+    }
+    pthread_mutex_unlock(&traceMutex);
+}
+
+void MenuTraceMenuDrawn(void)
+{
+    if (!traceEnabled) {
+        return;
+    }
+    pthread_mutex_lock(&traceMutex);
+    MenuTraceTime start = traceActivationArmed ? traceActivationStart : 0;
+    unsigned long windowId = traceActivationWindow;
+    if (traceActivationArmed) {
+        traceActivationStart = 0;
+        traceActivationArmed = NO;
+    }
+    pthread_mutex_unlock(&traceMutex);
+
+    if (start != 0) {
+        traceRecord("time-to-menu", "activation", start, traceNow(), windowId);
+    }
+}
+
+static void traceWriteEscaped(FILE *file, const char *string)
+{
+    for (const char *p = string; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            fputc('\\', file);
+            fputc(*p, file);
+        } else if ((unsigned char)*p >= 0x20) {
+            fputc(*p, file);
+        }
+    }
+}
+
+static int compareDurations(const void *a, const void *b)
+{
+    MenuTraceTime x = *(const MenuTraceTime *)a;
+    MenuTraceTime y = *(const MenuTraceTime *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static double percentile(MenuTraceTime *sorted, NSUInteger count, double fraction)
+{
+    NSUInteger rank = (NSUInteger)(fraction * count + 0.999999);
+    if (rank == 0) {
+        rank = 1;
+    }
+    return sorted[rank - 1] / 1000.0;
+}
+
+@implementation MenuTrace
+
++ (BOOL)startTracingToFile:(NSString *)path
+{
+    if (traceEnabled || [path length] == 0) {
+        return traceEnabled;
+    }
+
+    const char *fsPath = [path fileSystemRepresentation];
+    FILE *probe = fopen(fsPath, "w");
+    if (!probe) {
+        NSLog(@"MenuTrace: Cannot create trace file %@", path);
+        return NO;
+    }
+    fclose(probe);
+
+    traceSpans = calloc(MENU_TRACE_CAPACITY, sizeof(MenuTraceSpan));
+    if (!traceSpans) {
+        return NO;
+    }
+    tracePath = strdup(fsPath);
+    clock_gettime(CLOCK_MONOTONIC, &traceEpoch);
+    traceEnabled = YES;
+
+    NSLog(@"MenuTrace: Tracing menu loads to %@", path);
+    return YES;
+}
+
++ (BOOL)isEnabled
+{
+    return traceEnabled;
+}
+
++ (BOOL)writeTrace
+{
+    if (!traceEnabled) {
+        return NO;
+    }
+
+    // Snapshot the ring so the file is written without holding the lock
+    pthread_mutex_lock(&traceMutex);
+    NSUInteger count = (NSUInteger)(traceSpanCount < MENU_TRACE_CAPACITY ? traceSpanCount : MENU_TRACE_CAPACITY);
+    NSUInteger first = (NSUInteger)(traceSpanCount - count);
+    MenuTraceSpan *spans = malloc(sizeof(MenuTraceSpan) * (count ? count : 1));
+    for (NSUInteger i = 0; i < count; i++) {
+        spans[i] = traceSpans[(first + i) % MENU_TRACE_CAPACITY];
+    }
+    int threadCount = traceThreadCount;
+    uint64_t dropped = traceSpanCount - count;
+    pthread_mutex_unlock(&traceMutex);
+
+    FILE *file = fopen(tracePath, "w");
+    if (!file) {
+        NSLog(@"MenuTrace: Cannot write trace file %s", tracePath);
+        free(spans);
+        return NO;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"Menu\"}}",
+            (int)getpid());
+    for (int t = 1; t <= threadCount; t++) {
+        fprintf(file, ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"",
+                (int)getpid(), t);
+        traceWriteEscaped(file, traceThreadNames[t]);
+        fprintf(file, "\"}}");
+    }
+    for (NSUInteger i = 0; i < count; i++) {
+        MenuTraceSpan *span = &spans[i];
+        fprintf(file, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"cat\":\"%s\",\"ts\":%llu,\"dur\":%llu,"
+                      "\"pid\":%d,\"tid\":%d,\"args\":{\"window\":%lu}}",
+                span->name, span->category, (unsigned long long)span->start,
+                (unsigned long long)span->duration, (int)getpid(), span->thread, span->windowId);
+    }
+    fprintf(file, "\n]}\n");
+    BOOL ok = (fclose(file) == 0);
+
+    // Per-name summary; span names are literals, so pointer equality groups them
+    NSMutableArray *names = [NSMutableArray array];
+    NSMutableDictionary *durations = [NSMutableDictionary dictionary];
+    for (NSUInteger i = 0; i < count; i++) {
+        NSValue *key = [NSValue valueWithPointer:spans[i].name];
+        NSMutableData *list = [durations objectForKey:key];
+        if (!list) {
+            list = [NSMutableData data];
+            [durations setObject:list forKey:key];
+            [names addObject:key];
+        }
+        [list appendBytes:&spans[i].duration length:sizeof(MenuTraceTime)];
+    }
+
+    NSLog(@"MenuTrace: Wrote %lu spans to %s%@", (unsigned long)count, tracePath,
+          dropped ? [NSString stringWithFormat:@" (%llu oldest dropped)", (unsigned long long)dropped] : @"");
+    for (NSValue *key in names) {
+        NSMutableData *list = [durations objectForKey:key];
+        NSUInteger n = [list length] / sizeof(MenuTraceTime);
+        MenuTraceTime *values = [list mutableBytes];
+        qsort(values, n, sizeof(MenuTraceTime), compareDurations);
+        NSLog(@"MenuTrace: %-40s n=%-6lu p50=%8.2f ms  p95=%8.2f ms  max=%8.2f ms",
+              (const char *)[key pointerValue], (unsigned long)n,
+              percentile(values, n, 0.50), percentile(values, n, 0.95), values[n - 1] / 1000.0);
+    }
+
+    free(spans);
+    return ok;
+}
+
+@end
@@ -3,6 +3,7 @@
 @interface MenuUtils : NSObject
 
 + (NSString *)getApplicationNameForWindow:(unsigned long)windowId;
++ (NSString *)getApplicationIdentityForWindow:(unsigned long)windowId;
 + (BOOL)isWindowValid:(unsigned long)windowId;
 + (NSArray *)getAllWindows;
 + (unsigned long)getActiveWindow;
@@ -1,4 +1,5 @@
 #import "MenuUtils.h"
+#import "X11DisplayService.h"
 #import <X11/Xlib.h>
 #import <X11/Xutil.h>
 #import <X11/Xatom.h>
@@ -7,177 +8,101 @@
 
 + (NSString *)getApplicationNameForWindow:(unsigned long)windowId
 {
-    Display *display = XOpenDisplay(NULL);
-    if (!display) {
-        return nil;
-    }
+    X11DisplayService *x11 = [X11DisplayService sharedService];
     
     // Try to get the application name from WM_CLASS first
-    XClassHint classHint;
-    if (XGetClassHint(display, (Window)windowId, &classHint) == Success) {
-        NSString *className = nil;
-        if (classHint.res_class) {
-            className = [NSString stringWithUTF8String:classHint.res_class];
-            XFree(classHint.res_class);
-        }
-        if (classHint.res_name) {
-            XFree(classHint.res_name);
-        }
-        XCloseDisplay(display);
-        if (className && [className length] > 0) {
-            // Normalize application names for better cache consistency
-            NSString *normalizedName = [className lowercaseString];
-            if ([normalizedName isEqualToString:@"gimp"] || 
-                [normalizedName hasPrefix:@"gimp-"]) {
-                return @"GIMP";
-            } else if ([normalizedName isEqualToString:@"inkscape"]) {
-                return @"Inkscape";
-            } else if ([normalizedName isEqualToString:@"libreoffice"]) {
-                return @"LibreOffice";
-            }
-            return className;
+    NSArray *classHint = [x11 classHintForWindow:windowId];
+    NSString *className = ([classHint count] > 1) ? [classHint objectAtIndex:1] : nil;
+    if (className && [className length] > 0) {
+        // Normalize application names for better cache consistency
+        NSString *normalizedName = [className lowercaseString];
+        if ([normalizedName isEqualToString:@"gimp"] || 
+            [normalizedName hasPrefix:@"gimp-"]) {
+            return @"GIMP";
+        } else if ([normalizedName isEqualToString:@"inkscape"]) {
+            return @"Inkscape";
+        } else if ([normalizedName isEqualToString:@"libreoffice"]) {
+            return @"LibreOffice";
         }
+        return className;
     }
     
     // Fallback to window title, try to extract application name
-    XTextProperty windowName;
-    if (XGetWMName(display, (Window)windowId, &windowName) == Success) {
-        NSString *title = nil;
-        if (windowName.value) {
-            title = [NSString stringWithUTF8String:(char *)windowName.value];
-            XFree(windowName.value);
+    NSString *title = [x11 stringProperty:@"WM_NAME" ofWindow:windowId];
+    
+    // Extract application name from window title
+    if (title && [title length] > 0) {
+        // Special handling for GIMP windows
+        if ([title containsString:@"GIMP"] || [title containsString:@"GNU Image Manipulation Program"]) {
+            return @"GIMP";
         }
-        XCloseDisplay(display);
         
-        // Extract application name from window title
-        if (title && [title length] > 0) {
-            // Special handling for GIMP windows
-            if ([title containsString:@"GIMP"] || [title containsString:@"GNU Image Manipulation Program"]) {
-                return @"GIMP";
+        // Look for patterns like "Document - AppName" or "Title - AppName"
+        NSRange dashRange = [title rangeOfString:@" - " options:NSBackwardsSearch];
+        if (dashRange.location != NSNotFound) {
+            NSString *appName = [title substringFromIndex:dashRange.location + 3];
+            if ([appName length] > 0) {
+                return appName;
             }
-            
-            // Look for patterns like "Document - AppName" or "Title - AppName"
-            NSRange dashRange = [title rangeOfString:@" - " options:NSBackwardsSearch];
-            if (dashRange.location != NSNotFound) {
-                NSString *appName = [title substringFromIndex:dashRange.location + 3];
-                if ([appName length] > 0) {
-                    return appName;
-                }
-            }
-            // If no dash pattern, return the whole title as fallback
-            return title;
         }
+        // If no dash pattern, return the whole title as fallback
+        return title;
     }
     
-    XCloseDisplay(display);
     return nil;
 }
 
-+ (BOOL)isWindowValid:(unsigned long)windowId
++ (NSString *)getApplicationIdentityForWindow:(unsigned long)windowId
 {
-    Display *display = XOpenDisplay(NULL);
-    if (!display) {
-        return NO;
+    // Stable across restarts of both Menu.app and the application:
+    // WM_CLASS (instance.class) plus the executable behind _NET_WM_PID
+    X11DisplayService *x11 = [X11DisplayService sharedService];
+    [x11 prefetchProperties:[NSArray arrayWithObjects:@"WM_CLASS", @"_NET_WM_PID", nil]
+                 forWindows:[NSArray arrayWithObject:[NSNumber numberWithUnsignedLong:windowId]]];
+    
+    NSString *wmClass = nil;
+    NSArray *classHint = [x11 classHintForWindow:windowId];
+    if (classHint) {
+        wmClass = [NSString stringWithFormat:@"%@.%@",
+                   [classHint objectAtIndex:0], [classHint objectAtIndex:1]];
     }
     
-    XWindowAttributes attrs;
-    BOOL valid = (XGetWindowAttributes(display, (Window)windowId, &attrs) == Success);
+    unsigned long pid = 0;
+    NSArray *pidValue = [x11 cardinalListProperty:@"_NET_WM_PID" ofWindow:windowId];
+    if ([pidValue count] > 0) {
+        pid = [[pidValue objectAtIndex:0] unsignedLongValue];
+    }
     
-    XCloseDisplay(display);
-    return valid;
+    NSString *executablePath = nil;
+    if (pid > 0) {
+        NSString *exeLink = [NSString stringWithFormat:@"/proc/%lu/exe", pid];
+        executablePath = [[NSFileManager defaultManager] destinationOfSymbolicLinkAtPath:exeLink error:NULL];
+    }
+    
+    if (!wmClass && !executablePath) {
+        return nil;
+    }
+    return [NSString stringWithFormat:@"%@|%@", wmClass ?: @"", executablePath ?: @""];
+}
+
++ (BOOL)isWindowValid:(unsigned long)windowId
+{
+    return [[X11DisplayService sharedService] isWindowValid:windowId];
 }
 
 + (NSArray *)getAllWindows
 {
-    Display *display = XOpenDisplay(NULL);
-    if (!display) {
-        return [NSArray array];
-    }
-    
-    Window root = DefaultRootWindow(display);
-    Window parent, *children;
-    unsigned int nchildren;
-    
-    NSMutableArray *windows = [NSMutableArray array];
-    
-    if (XQueryTree(display, root, &root, &parent, &children, &nchildren) == Success) {
-        for (unsigned int i = 0; i < nchildren; i++) {
-            XWindowAttributes attrs;
-            if (XGetWindowAttributes(display, children[i], &attrs) == Success) {
-                if (attrs.map_state == IsViewable && attrs.class == InputOutput) {
-                    [windows addObject:[NSNumber numberWithUnsignedLong:children[i]]];
-                }
-            }
-        }
-        XFree(children);
-    }
-    
-    XCloseDisplay(display);
-    return windows;
+    return [[X11DisplayService sharedService] viewableTopLevelWindows];
 }
 
 + (unsigned long)getActiveWindow
 {
-    Display *display = XOpenDisplay(NULL);
-    if (!display) {
-        return 0;
-    }
-    
-    Window root = DefaultRootWindow(display);
-    Window activeWindow = 0;
-    Atom actualType;
-    int actualFormat;
-    unsigned long nitems, bytesAfter;
-    unsigned char *prop = NULL;
-    
-    Atom activeWindowAtom = XInternAtom(display, "_NET_ACTIVE_WINDOW", False);
-    if (XGetWindowProperty(display, root, activeWindowAtom,
-                          0, 1, False, AnyPropertyType,
-                          &actualType, &actualFormat, &nitems, &bytesAfter,
-                          &prop) == Success && prop) {
-        activeWindow = *(Window*)prop;
-        XFree(prop);
-    }
-    
-    XCloseDisplay(display);
-    return activeWindow;
+    return [[X11DisplayService sharedService] activeWindow];
 }
 
 + (NSString *)getWindowProperty:(unsigned long)windowId atomName:(NSString *)atomName
 {
-    Display *display = XOpenDisplay(NULL);
-    if (!display) {
-        return nil;
-    }
-    
-    Atom atom = XInternAtom(display, [atomName UTF8String], False);
-    if (atom == None) {
-        XCloseDisplay(display);
-        return nil;
-    }
-    
-    Atom actualType;
-    int actualFormat;
-    unsigned long nitems, bytesAfter;
-    unsigned char *prop = NULL;
-    
-    if (XGetWindowProperty(display, (Window)windowId, atom,
-                          0, 1024, False, AnyPropertyType,
-                          &actualType, &actualFormat, &nitems, &bytesAfter,
-                          &prop) == Success && prop) {
-        
-        NSString *result = nil;
-        if (actualType == XA_STRING || actualFormat == 8) {
-            result = [NSString stringWithUTF8String:(char *)prop];
-        }
-        
-        XFree(prop);
-        XCloseDisplay(display);
-        return result;
-    }
-    
-    XCloseDisplay(display);
-    return nil;
+    return [[X11DisplayService sharedService] stringProperty:atomName ofWindow:windowId];
 }
 
 + (NSString*)getWindowMenuService:(unsigned long)windowId
@@ -192,17 +117,19 @@
 
 + (BOOL)setWindowMenuService:(NSString*)service path:(NSString*)path forWindow:(unsigned long)windowId
 {
-    Display *display = XOpenDisplay(NULL);
+    X11DisplayService *x11 = [X11DisplayService sharedService];
+    Display *display = [x11 display];
     if (!display) {
         NSLog(@"MenuUtils: Failed to open X11 display");
         return NO;
     }
     
     BOOL success = YES;
+    [x11 lock];
     
     // Set the service name property
     if (service) {
-        Atom serviceAtom = XInternAtom(display, "_KDE_NET_WM_APPMENU_SERVICE_NAME", False);
+        Atom serviceAtom = [x11 atomForName:@"_KDE_NET_WM_APPMENU_SERVICE_NAME"];
         const char *serviceStr = [service UTF8String];
         int result = XChangeProperty(display, (Window)windowId, serviceAtom, XA_STRING, 8,
                                    PropModeReplace, (unsigned char*)serviceStr, strlen(serviceStr));
@@ -216,7 +143,7 @@
     
     // Set the object path property
     if (path) {
-        Atom pathAtom = XInternAtom(display, "_KDE_NET_WM_APPMENU_OBJECT_PATH", False);
+        Atom pathAtom = [x11 atomForName:@"_KDE_NET_WM_APPMENU_OBJECT_PATH"];
         const char *pathStr = [path UTF8String];
         int result = XChangeProperty(display, (Window)windowId, pathAtom, XA_STRING, 8,
                                    PropModeReplace, (unsigned char*)pathStr, strlen(pathStr));
@@ -229,20 +156,23 @@
     }
     
     XFlush(display);
-    XCloseDisplay(display);
+    [x11 invalidateWindow:windowId];
+    [x11 unlock];
     return success;
 }
 
 + (BOOL)advertiseGlobalMenuSupport
 {
-    Display *display = XOpenDisplay(NULL);
+    X11DisplayService *x11 = [X11DisplayService sharedService];
+    Display *display = [x11 display];
     if (!display) {
         NSLog(@"MenuUtils: Failed to open X11 display for advertising global menu support");
         return NO;
     }
     
-    Window root = DefaultRootWindow(display);
+    Window root = [x11 rootWindow];
     BOOL success = YES;
+    [x11 lock];
     
     // Set _NET_SUPPORTING_WM_CHECK to advertise window manager support
     Atom supportingWmAtom = XInternAtom(display, "_NET_SUPPORTING_WM_CHECK", False);
@@ -302,7 +232,7 @@
     
     XFlush(display);
     XSync(display, False);
-    XCloseDisplay(display);
+    [x11 unlock];
     
     NSLog(@"MenuUtils: Successfully advertised global menu support on root window");
     return success;
@@ -310,12 +240,14 @@
 
 + (void)removeGlobalMenuSupport
 {
-    Display *display = XOpenDisplay(NULL);
+    X11DisplayService *x11 = [X11DisplayService sharedService];
+    Display *display = [x11 display];
     if (!display) {
         return;
     }
     
-    Window root = DefaultRootWindow(display);
+    Window root = [x11 rootWindow];
+    [x11 lock];
     
     // Remove the global menu properties
     Atom kdeMenuAtom = XInternAtom(display, "_KDE_GLOBAL_MENU_AVAILABLE", False);
@@ -329,7 +261,7 @@
     }
     
     XFlush(display);
-    XCloseDisplay(display);
+    [x11 unlock];
     
     NSLog(@"MenuUtils: Removed global menu support properties from root window");
 }
@@ -0,0 +1,75 @@
+#import <Foundation/Foundation.h>
+#import <X11/Xlib.h>
+
+/**
+ * X11DisplayService
+ *
+ * One long-lived X11 connection shared by MenuUtils, AppMenuWidget and the
+ * protocol importers, instead of an XOpenDisplay/XCloseDisplay pair (socket
+ * connect plus setup handshake) per query.
+ *
+ * Well-known atoms are interned once at startup. Window properties read
+ * through the service are cached per window; the service selects
+ * PropertyChangeMask/StructureNotifyMask on every window it caches and drops
+ * entries on PropertyNotify/DestroyNotify, so repeated reads of WM_CLASS,
+ * _NET_ACTIVE_WINDOW and friends cost no round-trip until they change.
+ * Batch queries (-prefetchProperties:forWindows:) are pipelined over XCB:
+ * all requests are issued before the first reply is read.
+ *
+ * -setCachesProperties:NO turns the cache and the batching off for
+ * comparison: every read then waits for its own reply, as the per-call
+ * XGetWindowProperty and XGetWindowAttributes reads it replaced did.
+ *
+ * All methods are thread-safe. Callers that need the raw Display (to change
+ * properties or send events) must bracket their use with -lock/-unlock.
+ */
+@interface X11DisplayService : NSObject
+{
+    Display *_display;
+    Window _rootWindow;
+    NSRecursiveLock *_lock;
+    NSMutableDictionary *_atoms;            // atom name -> NSNumber (Atom)
+    NSMutableDictionary *_windowProperties; // windowId -> NSMutableDictionary (atom -> NSData, NSArray or NSNull)
+    NSUInteger _roundTrips;                 // Blocking requests or pipelined batches
+    NSUInteger _propertyHits;
+    NSUInteger _propertyMisses;
+    NSUInteger _invalidations;
+    BOOL _cachesProperties;                 // NO: one blocking request per read (Menu.app --uncached-x11)
+}
+
++ (X11DisplayService *)sharedService;
+
+// Raw access for property writes and synthetic events
+- (void)lock;
+- (void)unlock;
+- (Display *)display;
+- (Window)rootWindow;
+
+- (Atom)atomForName:(NSString *)name;
+
+// Cached property reads (nil if the window or property does not exist)
+- (NSString *)stringProperty:(NSString *)atomName ofWindow:(unsigned long)windowId;
+- (NSArray *)cardinalListProperty:(NSString *)atomName ofWindow:(unsigned long)windowId;
+
+// WM_CLASS as [res_name, res_class], or nil
+- (NSArray *)classHintForWindow:(unsigned long)windowId;
+
+- (unsigned long)activeWindow;
+- (NSArray *)clientWindows;                 // _NET_CLIENT_LIST, or nil without an EWMH window manager
+- (NSArray *)topLevelWindows;               // All children of the root window
+- (NSArray *)viewableTopLevelWindows;       // Mapped InputOutput children of the root window
+- (BOOL)isWindowValid:(unsigned long)windowId;
+
+// Fetch the given properties of all windows in one pipelined batch,
+// skipping values that are already cached
+- (void)prefetchProperties:(NSArray *)atomNames forWindows:(NSArray *)windows;
+
+// Drop cached properties of a window after writing to it
+- (void)invalidateWindow:(unsigned long)windowId;
+
+- (void)setCachesProperties:(BOOL)cachesProperties;
+
+- (NSUInteger)roundTrips;
+- (NSDictionary *)statistics;
+
+@end
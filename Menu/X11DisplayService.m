@@ -0,0 +1,509 @@
+#import "X11DisplayService.h"
+#import <X11/Xatom.h>
+#import <X11/Xlib-xcb.h>
+#import <xcb/xcb.h>
+
+// Property values longer than this (in 32-bit units) are truncated
+static const uint32_t kMaxPropertyLength = 1024;
+
+static X11DisplayService *sharedService = nil;
+
+@interface X11DisplayService (Private)
+- (void)processPendingEvents;
+- (void)fetchAtoms:(NSArray *)atomKeys forWindows:(NSArray *)windowKeys;
+- (id)valueForAtom:(Atom)atom ofWindow:(unsigned long)windowId;
+@end
+
+@implementation X11DisplayService
+
++ (X11DisplayService *)sharedService
+{
+    @synchronized(self) {
+        if (!sharedService) {
+            sharedService = [[X11DisplayService alloc] init];
+        }
+    }
+    return sharedService;
+}
+
+- (id)init
+{
+    self = [super init];
+    if (self) {
+        _lock = [[NSRecursiveLock alloc] init];
+        _atoms = [[NSMutableDictionary alloc] init];
+        _windowProperties = [[NSMutableDictionary alloc] init];
+        _cachesProperties = YES;
+
+        _display = XOpenDisplay(NULL);
+        if (!_display) {
+            NSLog(@"X11DisplayService: Cannot open X11 display");
+            return self;
+        }
+        _rootWindow = DefaultRootWindow(_display);
+
+        // Intern the atoms every call site needs in a single round-trip
+        char *names[] = {
+            "_NET_ACTIVE_WINDOW",
+            "_NET_CLIENT_LIST",
+            "_NET_WM_PID",
+            "_NET_WM_NAME",
+            "UTF8_STRING",
+            "_GTK_UNIQUE_BUS_NAME",
+            "_GTK_MENUBAR_OBJECT_PATH",
+            "_KDE_NET_WM_APPMENU_SERVICE_NAME",
+            "_KDE_NET_WM_APPMENU_OBJECT_PATH"
+        };
+        int count = sizeof(names) / sizeof(names[0]);
+        Atom atoms[sizeof(names) / sizeof(names[0])];
+        if (XInternAtoms(_display, names, count, False, atoms)) {
+            for (int i = 0; i < count; i++) {
+                [_atoms setObject:[NSNumber numberWithUnsignedLong:atoms[i]]
+                           forKey:[NSString stringWithUTF8String:names[i]]];
+            }
+        }
+        [_atoms setObject:[NSNumber numberWithUnsignedLong:XA_WM_CLASS] forKey:@"WM_CLASS"];
+        [_atoms setObject:[NSNumber numberWithUnsignedLong:XA_WM_NAME] forKey:@"WM_NAME"];
+        _roundTrips++;
+
+        // Root properties (_NET_ACTIVE_WINDOW, _NET_CLIENT_LIST) are cached like any other window's
+        XSelectInput(_display, _rootWindow, PropertyChangeMask);
+        [_windowProperties setObject:[NSMutableDictionary dictionary]
+                              forKey:[NSNumber numberWithUnsignedLong:_rootWindow]];
+        XFlush(_display);
+
+        NSLog(@"X11DisplayService: Opened shared X11 connection with %lu cached atoms",
+              (unsigned long)[_atoms count]);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    if (_display) {
+        XCloseDisplay(_display);
+        _display = NULL;
+    }
+    [_windowProperties release];
+    [_atoms release];
+    [_lock release];
+    [super dealloc];
+}
+
+#pragma mark - Raw Access
+
+- (void)lock
+{
+    [_lock lock];
+}
+
+- (void)unlock
+{
+    [_lock unlock];
+}
+
+- (Display *)display
+{
+    return _display;
+}
+
+- (Window)rootWindow
+{
+    return _rootWindow;
+}
+
+- (Atom)atomForName:(NSString *)name
+{
+    if (!_display || !name) {
+        return None;
+    }
+
+    [_lock lock];
+    NSNumber *atomNumber = [_atoms objectForKey:name];
+    Atom atom = None;
+    if (atomNumber) {
+        atom = (Atom)[atomNumber unsignedLongValue];
+    } else {
+        atom = XInternAtom(_display, [name UTF8String], False);
+        _roundTrips++;
+        if (atom != None) {
+            [_atoms setObject:[NSNumber numberWithUnsignedLong:atom] forKey:name];
+        }
+    }
+    [_lock unlock];
+    return atom;
+}
+
+#pragma mark - Cached Property Reads
+
+- (NSString *)stringProperty:(NSString *)atomName ofWindow:(unsigned long)windowId
+{
+    id value = [self valueForAtom:[self atomForName:atomName] ofWindow:windowId];
+    if (![value isKindOfClass:[NSData class]] || [value length] == 0) {
+        return nil;
+    }
+
+    // Stop at the first NUL, like the C-string reads this replaces
+    const char *bytes = [value bytes];
+    NSUInteger length = strnlen(bytes, [value length]);
+    NSString *string = [[NSString alloc] initWithBytes:bytes length:length encoding:NSUTF8StringEncoding];
+    if (!string) {
+        string = [[NSString alloc] initWithBytes:bytes length:length encoding:NSISOLatin1StringEncoding];
+    }
+    return [string autorelease];
+}
+
+- (NSArray *)cardinalListProperty:(NSString *)atomName ofWindow:(unsigned long)windowId
+{
+    id value = [self valueForAtom:[self atomForName:atomName] ofWindow:windowId];
+    return [value isKindOfClass:[NSArray class]] ? value : nil;
+}
+
+- (NSArray *)classHintForWindow:(unsigned long)windowId
+{
+    id value = [self valueForAtom:XA_WM_CLASS ofWindow:windowId];
+    if (![value isKindOfClass:[NSData class]] || [value length] == 0) {
+        return nil;
+    }
+
+    // WM_CLASS is "res_name\0res_class\0"
+    const char *bytes = [value bytes];
+    NSUInteger length = [value length];
+    NSUInteger nameLength = strnlen(bytes, length);
+    NSString *resName = [[[NSString alloc] initWithBytes:bytes length:nameLength
+                                                encoding:NSISOLatin1StringEncoding] autorelease];
+    NSString *resClass = @"";
+    if (nameLength + 1 < length) {
+        const char *classBytes = bytes + nameLength + 1;
+        resClass = [[[NSString alloc] initWithBytes:classBytes
+                                             length:strnlen(classBytes, length - nameLength - 1)
+                                           encoding:NSISOLatin1StringEncoding] autorelease];
+    }
+    return [NSArray arrayWithObjects:resName ?: @"", resClass ?: @"", nil];
+}
+
+- (unsigned long)activeWindow
+{
+    NSArray *value = [self cardinalListProperty:@"_NET_ACTIVE_WINDOW" ofWindow:_rootWindow];
+    return [value count] > 0 ? [[value objectAtIndex:0] unsignedLongValue] : 0;
+}
+
+- (NSArray *)clientWindows
+{
+    return [self cardinalListProperty:@"_NET_CLIENT_LIST" ofWindow:_rootWindow];
+}
+
+- (NSArray *)topLevelWindows
+{
+    if (!_display) {
+        return [NSArray array];
+    }
+
+    [_lock lock];
+    xcb_connection_t *conn = XGetXCBConnection(_display);
+    xcb_query_tree_reply_t *reply = xcb_query_tree_reply(conn, xcb_query_tree(conn, (xcb_window_t)_rootWindow), NULL);
+    _roundTrips++;
+
+    NSMutableArray *windows = [NSMutableArray array];
+    if (reply) {
+        xcb_window_t *children = xcb_query_tree_children(reply);
+        int count = xcb_query_tree_children_length(reply);
+        for (int i = 0; i < count; i++) {
+            [windows addObject:[NSNumber numberWithUnsignedLong:children[i]]];
+        }
+        free(reply);
+    }
+    [_lock unlock];
+    return windows;
+}
+
+- (NSArray *)viewableTopLevelWindows
+{
+    NSArray *children = [self topLevelWindows];
+    NSUInteger count = [children count];
+    if (count == 0) {
+        return children;
+    }
+
+    [_lock lock];
+    xcb_connection_t *conn = XGetXCBConnection(_display);
+    xcb_get_window_attributes_cookie_t *cookies = malloc(sizeof(xcb_get_window_attributes_cookie_t) * count);
+    NSMutableArray *windows = [NSMutableArray array];
+    if (cookies) {
+        for (NSUInteger i = 0; i < count && _cachesProperties; i++) {
+            cookies[i] = xcb_get_window_attributes(conn, (xcb_window_t)[[children objectAtIndex:i] unsignedLongValue]);
+        }
+        _roundTrips += _cachesProperties ? 1 : count;
+
+        for (NSUInteger i = 0; i < count; i++) {
+            if (!_cachesProperties) {
+                cookies[i] = xcb_get_window_attributes(conn, (xcb_window_t)[[children objectAtIndex:i] unsignedLongValue]);
+            }
+            xcb_get_window_attributes_reply_t *reply = xcb_get_window_attributes_reply(conn, cookies[i], NULL);
+            if (!reply) {
+                continue;
+            }
+            if (reply->map_state == XCB_MAP_STATE_VIEWABLE && reply->_class == XCB_WINDOW_CLASS_INPUT_OUTPUT) {
+                [windows addObject:[children objectAtIndex:i]];
+            }
+            free(reply);
+        }
+        free(cookies);
+    }
+    [_lock unlock];
+    return windows;
+}
+
+- (BOOL)isWindowValid:(unsigned long)windowId
+{
+    if (!_display || windowId == 0) {
+        return NO;
+    }
+
+    [_lock lock];
+    [self processPendingEvents];
+
+    // Cached windows are watched for DestroyNotify, so an entry means it still exists
+    BOOL valid = _cachesProperties && ([_windowProperties objectForKey:[NSNumber numberWithUnsignedLong:windowId]] != nil);
+    if (!valid) {
+        xcb_connection_t *conn = XGetXCBConnection(_display);
+        xcb_get_window_attributes_reply_t *reply =
+            xcb_get_window_attributes_reply(conn, xcb_get_window_attributes(conn, (xcb_window_t)windowId), NULL);
+        _roundTrips++;
+        if (reply) {
+            valid = YES;
+            free(reply);
+        }
+    }
+    [_lock unlock];
+    return valid;
+}
+
+- (void)prefetchProperties:(NSArray *)atomNames forWindows:(NSArray *)windows
+{
+    // Uncached, each property is fetched when it is read
+    if (!_display || !_cachesProperties || [atomNames count] == 0 || [windows count] == 0) {
+        return;
+    }
+
+    NSMutableArray *atomKeys = [NSMutableArray arrayWithCapacity:[atomNames count]];
+    for (NSString *name in atomNames) {
+        Atom atom = [self atomForName:name];
+        if (atom != None) {
+            [atomKeys addObject:[NSNumber numberWithUnsignedLong:atom]];
+        }
+    }
+
+    [_lock lock];
+    [self processPendingEvents];
+    [self fetchAtoms:atomKeys forWindows:windows];
+    [_lock unlock];
+}
+
+- (void)invalidateWindow:(unsigned long)windowId
+{
+    [_lock lock];
+    NSMutableDictionary *properties = [_windowProperties objectForKey:[NSNumber numberWithUnsignedLong:windowId]];
+    if ([properties count] > 0) {
+        [properties removeAllObjects];
+        _invalidations++;
+    }
+    [_lock unlock];
+}
+
+- (void)setCachesProperties:(BOOL)cachesProperties
+{
+    [_lock lock];
+    _cachesProperties = cachesProperties;
+    if (!cachesProperties) {
+        for (NSMutableDictionary *properties in [_windowProperties allValues]) {
+            [properties removeAllObjects];
+        }
+    }
+    [_lock unlock];
+}
+
+#pragma mark - Statistics
+
+- (NSUInteger)roundTrips
+{
+    [_lock lock];
+    NSUInteger roundTrips = _roundTrips;
+    [_lock unlock];
+    return roundTrips;
+}
+
+- (NSDictionary *)statistics
+{
+    [_lock lock];
+    NSDictionary *stats = [NSDictionary dictionaryWithObjectsAndKeys:
+        [NSNumber numberWithUnsignedInteger:_roundTrips], @"roundTrips",
+        [NSNumber numberWithUnsignedInteger:_propertyHits], @"propertyHits",
+        [NSNumber numberWithUnsignedInteger:_propertyMisses], @"propertyMisses",
+        [NSNumber numberWithUnsignedInteger:_invalidations], @"invalidations",
+        [NSNumber numberWithUnsignedInteger:[_windowProperties count]], @"cachedWindows",
+        nil];
+    [_lock unlock];
+    return stats;
+}
+
+@end
+
+@implementation X11DisplayService (Private)
+
+// Called with the lock held: apply queued PropertyNotify/DestroyNotify
+// events to the cache. XPending only reads what the server already sent.
+- (void)processPendingEvents
+{
+    while (XPending(_display) > 0) {
+        XEvent event;
+        XNextEvent(_display, &event);
+
+        if (event.type == PropertyNotify) {
+            NSMutableDictionary *properties =
+                [_windowProperties objectForKey:[NSNumber numberWithUnsignedLong:event.xproperty.window]];
+            NSNumber *atomKey = [NSNumber numberWithUnsignedLong:event.xproperty.atom];
+            if ([properties objectForKey:atomKey]) {
+                [properties removeObjectForKey:atomKey];
+                _invalidations++;
+            }
+        } else if (event.type == DestroyNotify) {
+            [_windowProperties removeObjectForKey:[NSNumber numberWithUnsignedLong:event.xdestroywindow.window]];
+        }
+    }
+}
+
+// Called with the lock held: fetch every (window, atom) pair that is not
+// cached yet, issuing all requests before waiting for the first reply
+- (void)fetchAtoms:(NSArray *)atomKeys forWindows:(NSArray *)windowKeys
+{
+    NSUInteger atomCount = [atomKeys count];
+    NSUInteger windowCount = [windowKeys count];
+    if (atomCount == 0 || windowCount == 0) {
+        return;
+    }
+
+    xcb_connection_t *conn = XGetXCBConnection(_display);
+    xcb_get_property_cookie_t *cookies = malloc(sizeof(xcb_get_property_cookie_t) * atomCount * windowCount);
+    BOOL *issued = calloc(atomCount * windowCount, sizeof(BOOL));
+    if (!cookies || !issued) {
+        free(cookies);
+        free(issued);
+        return;
+    }
+
+    NSUInteger issuedCount = 0;
+    uint32_t mask = XCB_EVENT_MASK_PROPERTY_CHANGE | XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+    for (NSUInteger w = 0; w < windowCount; w++) {
+        NSNumber *windowKey = [windowKeys objectAtIndex:w];
+        xcb_window_t window = (xcb_window_t)[windowKey unsignedLongValue];
+        NSMutableDictionary *properties = [_windowProperties objectForKey:windowKey];
+
+        // Select events before reading so no change can slip in between.
+        // The check is discarded: a vanished window must not reach the
+        // Xlib error handler, its property replies report the error instead.
+        if (!properties && _cachesProperties) {
+            xcb_void_cookie_t selectCookie = xcb_change_window_attributes_checked(conn, window,
+                                                                                  XCB_CW_EVENT_MASK, &mask);
+            xcb_discard_reply(conn, selectCookie.sequence);
+        }
+
+        for (NSUInteger a = 0; a < atomCount; a++) {
+            NSNumber *atomKey = [atomKeys objectAtIndex:a];
+            if ([properties objectForKey:atomKey]) {
+                _propertyHits++;
+                continue;
+            }
+            cookies[w * atomCount + a] = xcb_get_property(conn, 0, window, (xcb_atom_t)[atomKey unsignedLongValue],
+                                                          XCB_GET_PROPERTY_TYPE_ANY, 0, kMaxPropertyLength);
+            issued[w * atomCount + a] = YES;
+            issuedCount++;
+        }
+    }
+
+    if (issuedCount > 0) {
+        _roundTrips++;
+        _propertyMisses += issuedCount;
+    }
+
+    for (NSUInteger w = 0; w < windowCount && issuedCount > 0; w++) {
+        NSNumber *windowKey = [windowKeys objectAtIndex:w];
+        BOOL windowGone = NO;
+
+        for (NSUInteger a = 0; a < atomCount; a++) {
+            if (!issued[w * atomCount + a]) {
+                continue;
+            }
+
+            xcb_generic_error_t *error = NULL;
+            xcb_get_property_reply_t *reply = xcb_get_property_reply(conn, cookies[w * atomCount + a], &error);
+            if (error) {
+                windowGone = YES;
+                free(error);
+            }
+            if (!reply) {
+                continue;
+            }
+
+            id value = [NSNull null];
+            int length = xcb_get_property_value_length(reply);
+            if (reply->type != XCB_NONE && reply->format == 8) {
+                value = [NSData dataWithBytes:xcb_get_property_value(reply) length:length];
+            } else if (reply->type != XCB_NONE && reply->format == 32) {
+                uint32_t *items = (uint32_t *)xcb_get_property_value(reply);
+                int itemCount = length / sizeof(uint32_t);
+                NSMutableArray *list = [NSMutableArray arrayWithCapacity:itemCount];
+                for (int i = 0; i < itemCount; i++) {
+                    [list addObject:[NSNumber numberWithUnsignedLong:items[i]]];
+                }
+                value = list;
+            }
+            free(reply);
+
+            NSMutableDictionary *properties = [_windowProperties objectForKey:windowKey];
+            if (!properties) {
+                properties = [NSMutableDictionary dictionary];
+                [_windowProperties setObject:properties forKey:windowKey];
+            }
+            [properties setObject:value forKey:[atomKeys objectAtIndex:a]];
+        }
+
+        if (windowGone) {
+            [_windowProperties removeObjectForKey:windowKey];
+        }
+    }
+
+    free(cookies);
+    free(issued);
+}
+
+- (id)valueForAtom:(Atom)atom ofWindow:(unsigned long)windowId
+{
+    if (!_display || atom == None || windowId == 0) {
+        return nil;
+    }
+
+    NSNumber *windowKey = [NSNumber numberWithUnsignedLong:windowId];
+    NSNumber *atomKey = [NSNumber numberWithUnsignedLong:atom];
+
+    [_lock lock];
+    [self processPendingEvents];
+
+    id value = [[_windowProperties objectForKey:windowKey] objectForKey:atomKey];
+    if (value) {
+        _propertyHits++;
+    } else {
+        [self fetchAtoms:[NSArray arrayWithObject:atomKey] forWindows:[NSArray arrayWithObject:windowKey]];
+        value = [[_windowProperties objectForKey:windowKey] objectForKey:atomKey];
+        if (!_cachesProperties) {
+            [[value retain] autorelease];
+            [[_windowProperties objectForKey:windowKey] removeObjectForKey:atomKey];
+        }
+    }
+    [[value retain] autorelease];
+    [_lock unlock];
+
+    return (value == [NSNull null]) ? nil : value;
+}
+
+@end
@@ -9,7 +9,8 @@
 /**
  * X11ShortcutManager handles registration and monitoring of global keyboard shortcuts
  * in X11 environments. It manages the mapping between X11 key events and NSMenuItem
- * actions, with support for Ctrl/Alt modifier swapping.
+ * actions, with support for Ctrl/Alt modifier swapping. Shortcuts are looked up by
+ * packed (keycode, modifier mask) in an open-addressing table.
  */
 @interface X11ShortcutManager : NSObject
 
@@ -56,9 +57,32 @@
 
 /**
  * Unregister all global shortcuts
+ *
+ * Registration changes are batched: keys are grabbed or released by the
+ * event thread when the main run loop next turns, so unregistering the old
+ * menu and registering the new one only re-grabs keys that actually differ.
  */
 - (void)unregisterAllShortcuts;
 
+/**
+ * Hand queued registration changes to the event thread, which applies them
+ * to the X server in one round-trip
+ */
+- (void)applyPendingShortcutChanges;
+
+/**
+ * Wait until the event thread has applied every change handed to it so far
+ * @param timeout The longest to wait, in seconds
+ * @return NO if the changes were not applied in time
+ */
+- (BOOL)waitForShortcutChangesWithTimeout:(NSTimeInterval)timeout;
+
+/**
+ * Ignore registration calls made from the current thread, for threads that
+ * load menus which are not being shown (e.g. background pre-warming)
+ */
+- (void)ignoreRegistrationsFromCurrentThread;
+
 /**
  * Check if Ctrl/Alt swapping is enabled
  */
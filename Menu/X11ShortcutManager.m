@@ -1,16 +1,41 @@
 #import "X11ShortcutManager.h"
 #import "DBusConnection.h"
+#import "MenuAcceleratorCache.h"
+#import "MenuTrace.h"
 #import <Foundation/Foundation.h>
 #import <X11/Xlib.h>
 #import <X11/keysym.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+
 // Global variable to track X11 errors during key grabbing
 static BOOL x11_grab_error_occurred = NO;
 
+// Serials of failed requests while a batched grab pass is in flight
+static NSMutableIndexSet *x11_failed_grab_serials = nil;
+
+// The connection whose grabs are being checked, and the handler ours replaced
+static Display *x11_grab_display = NULL;
+static int (*x11_previous_error_handler)(Display *, XErrorEvent *) = NULL;
+
+// Thread dictionary key marking threads whose shortcut registrations are ignored
+static NSString * const X11ShortcutIgnoreRegistrationsKey = @"X11ShortcutIgnoreRegistrations";
+
 // X11 error handler for key grabbing
 static int handleX11GrabError(Display *display, XErrorEvent *event)
 {
-    (void)display;  // Suppress unused parameter warning
+    // Error handlers are process-wide; errors on any other connection (the
+    // AppKit backend's) go to the handler that was there before
+    if (display != x11_grab_display) {
+        return x11_previous_error_handler ? x11_previous_error_handler(display, event) : 0;
+    }
+    
+    if (x11_failed_grab_serials) {
+        [x11_failed_grab_serials addIndex:(NSUInteger)event->serial];
+    }
     
     if (event->error_code == BadAccess) {
         x11_grab_error_occurred = YES;
@@ -23,21 +48,206 @@ static int handleX11GrabError(Display *display, XErrorEvent *event)
     return 0;
 }
 
+// Errors on display go to handleX11GrabError until endGrabErrorCapture
+static void beginGrabErrorCapture(Display *display)
+{
+    x11_grab_display = display;
+    x11_grab_error_occurred = NO;
+    x11_previous_error_handler = XSetErrorHandler(handleX11GrabError);
+}
+
+static void endGrabErrorCapture(void)
+{
+    XSetErrorHandler(x11_previous_error_handler);
+    x11_previous_error_handler = NULL;
+    x11_grab_display = NULL;
+}
+
+#pragma mark - Shortcut table
+
+// A shortcut is packed as (keycode << 8 | core modifier bits). Keycodes start
+// at 8, so a packed key is never 0 and 0 marks an empty slot.
+static inline uint32_t packShortcut(unsigned int keycode, unsigned int modifiers)
+{
+    return ((uint32_t)(keycode & 0xff) << 8) | (modifiers & 0xff);
+}
+
+// Open-addressing (linear probing) map from packed shortcut to binding
+typedef struct {
+    uint32_t *keys;
+    id *values;             // Retained
+    NSUInteger capacity;    // Power of two
+    NSUInteger count;
+} X11ShortcutTable;
+
+static inline NSUInteger shortcutHomeSlot(uint32_t key, NSUInteger capacity)
+{
+    return (NSUInteger)(key * 2654435761u) & (capacity - 1);
+}
+
+static void shortcutTableInit(X11ShortcutTable *table, NSUInteger capacity)
+{
+    table->keys = calloc(capacity, sizeof(uint32_t));
+    table->values = calloc(capacity, sizeof(id));
+    table->capacity = capacity;
+    table->count = 0;
+}
+
+static void shortcutTableClear(X11ShortcutTable *table)
+{
+    for (NSUInteger i = 0; i < table->capacity; i++) {
+        if (table->keys[i]) {
+            [table->values[i] release];
+            table->values[i] = nil;
+            table->keys[i] = 0;
+        }
+    }
+    table->count = 0;
+}
+
+static void shortcutTableFree(X11ShortcutTable *table)
+{
+    shortcutTableClear(table);
+    free(table->keys);
+    free(table->values);
+    table->keys = NULL;
+    table->values = NULL;
+    table->capacity = 0;
+}
+
+static id shortcutTableGet(X11ShortcutTable *table, uint32_t key)
+{
+    NSUInteger mask = table->capacity - 1;
+    for (NSUInteger i = shortcutHomeSlot(key, table->capacity); table->keys[i]; i = (i + 1) & mask) {
+        if (table->keys[i] == key) {
+            return table->values[i];
+        }
+    }
+    return nil;
+}
+
+static void shortcutTableSet(X11ShortcutTable *table, uint32_t key, id value);
+
+static void shortcutTableGrow(X11ShortcutTable *table)
+{
+    X11ShortcutTable old = *table;
+    shortcutTableInit(table, old.capacity * 2);
+    for (NSUInteger i = 0; i < old.capacity; i++) {
+        if (old.keys[i]) {
+            shortcutTableSet(table, old.keys[i], old.values[i]);
+            [old.values[i] release];
+        }
+    }
+    free(old.keys);
+    free(old.values);
+}
+
+static void shortcutTableSet(X11ShortcutTable *table, uint32_t key, id value)
+{
+    if ((table->count + 1) * 2 > table->capacity) {
+        shortcutTableGrow(table);
+    }
+
+    NSUInteger mask = table->capacity - 1;
+    NSUInteger i = shortcutHomeSlot(key, table->capacity);
+    while (table->keys[i] && table->keys[i] != key) {
+        i = (i + 1) & mask;
+    }
+    [value retain];
+    if (table->keys[i]) {
+        [table->values[i] release];
+    } else {
+        table->keys[i] = key;
+        table->count++;
+    }
+    table->values[i] = value;
+}
+
+static void shortcutTableRemove(X11ShortcutTable *table, uint32_t key)
+{
+    NSUInteger mask = table->capacity - 1;
+    NSUInteger i = shortcutHomeSlot(key, table->capacity);
+    while (table->keys[i] && table->keys[i] != key) {
+        i = (i + 1) & mask;
+    }
+    if (!table->keys[i]) {
+        return;
+    }
+    [table->values[i] release];
+    table->count--;
+
+    // Backward-shift deletion keeps probe chains intact without tombstones
+    NSUInteger hole = i;
+    for (NSUInteger j = (hole + 1) & mask; table->keys[j]; j = (j + 1) & mask) {
+        NSUInteger home = shortcutHomeSlot(table->keys[j], table->capacity);
+        BOOL movable = (hole <= j) ? (home <= hole || home > j) : (home <= hole && home > j);
+        if (movable) {
+            table->keys[hole] = table->keys[j];
+            table->values[hole] = table->values[j];
+            hole = j;
+        }
+    }
+    table->keys[hole] = 0;
+    table->values[hole] = nil;
+}
+
+/**
+ * What a grabbed shortcut triggers: a dbusmenu item / GTK action over DBus,
+ * or a direct target/action pair (e.g. Alt+W on fallback menus)
+ */
+@interface X11ShortcutBinding : NSObject
+{
+@public
+    NSString *_serviceName;
+    NSString *_objectPath;
+    NSString *_actionName;              // GTK action name, nil for dbusmenu items
+    GNUDBusConnection *_dbusConnection;
+    NSInteger _tag;                     // dbusmenu item ID
+    id _target;                         // Direct shortcuts only
+    SEL _action;
+    NSString *_windowIdString;          // Direct shortcuts only
+    NSString *_title;                   // For logging
+}
+@end
+
+@implementation X11ShortcutBinding
+
+- (void)dealloc
+{
+    [_serviceName release];
+    [_objectPath release];
+    [_actionName release];
+    [_dbusConnection release];
+    [_target release];
+    [_windowIdString release];
+    [_title release];
+    [super dealloc];
+}
+
+@end
+
 @implementation X11ShortcutManager {
-    // X11 globals for shortcut handling
+    // X11 globals for shortcut handling. Xlib is not initialised for threads,
+    // so every call on _display is made with _displayLock held: the event
+    // thread takes it to grab keys and read events, and releases it while it
+    // waits in poll(); other threads only take it for keycode lookups and
+    // availability checks.
     Display *_display;
-    NSMutableDictionary *_grabbedKeys;          // maps "keycode_modifier" -> menuItem key
-    NSMutableDictionary *_menuItemKeyToTag;     // maps menuItem key -> tag
-    NSMutableArray *_registeredShortcuts;       // array of shortcut strings
-    NSMutableDictionary *_shortcutToMenuItemMap; // maps keycodeModifierKey -> menuItemKey
+    NSLock *_displayLock;
     
-    // DBus connection info for menu actions
-    NSMutableDictionary *_menuItemToServiceMap;
-    NSMutableDictionary *_menuItemToObjectPathMap;
-    NSMutableDictionary *_menuItemToConnectionMap;
-    NSMutableDictionary *_menuItemToActionNameMap;  // maps menuItemKey -> action name
+    // Wanted shortcuts (as registered by the importers) and those actually grabbed.
+    // Changes to _desiredShortcuts are handed to the event thread once per main
+    // run loop turn, so a menu switch costs it a single round-trip.
+    X11ShortcutTable _desiredShortcuts;
+    X11ShortcutTable _activeShortcuts;     // Read by the event monitor thread
+    NSLock *_tableLock;                    // Guards both tables and _applyScheduled
+    BOOL _applyScheduled;
     
     NSThread *_eventMonitorThread;
+    int _wakePipe[2];                      // Wakes the event thread to apply changes or stop
+    NSCondition *_applyCondition;          // Guards the two counts below
+    NSUInteger _applyRequests;             // Hand-offs to the event thread so far
+    NSUInteger _appliedRequests;           // How many of them it has applied
     BOOL _shouldStopEventMonitoring;
     BOOL _swapCtrlAlt;
     
@@ -45,13 +255,18 @@ static int handleX11GrabError(Display *display, XErrorEvent *event)
     unsigned int _numlock_mask;
     unsigned int _capslock_mask;
     unsigned int _scrolllock_mask;
+    unsigned int _lockVariants[8];         // Every combination of the lock masks, 0 first
+    NSUInteger _lockVariantCount;
 }
 
 + (instancetype)sharedManager
 {
     static X11ShortcutManager *sharedInstance = nil;
-    if (!sharedInstance) {
-        sharedInstance = [[X11ShortcutManager alloc] init];
+    // Also reached from the pre-warm worker thread
+    @synchronized(self) {
+        if (!sharedInstance) {
+            sharedInstance = [[X11ShortcutManager alloc] init];
+        }
     }
     return sharedInstance;
 }
@@ -60,20 +275,29 @@ static int handleX11GrabError(Display *display, XErrorEvent *event)
 {
     self = [super init];
     if (self) {
-        _grabbedKeys = [[NSMutableDictionary alloc] init];
-        _menuItemKeyToTag = [[NSMutableDictionary alloc] init];
-        _registeredShortcuts = [[NSMutableArray alloc] init];
-        _shortcutToMenuItemMap = [[NSMutableDictionary alloc] init];
-        _menuItemToServiceMap = [[NSMutableDictionary alloc] init];
-        _menuItemToObjectPathMap = [[NSMutableDictionary alloc] init];
-        _menuItemToConnectionMap = [[NSMutableDictionary alloc] init];
-        _menuItemToActionNameMap = [[NSMutableDictionary alloc] init];
+        shortcutTableInit(&_desiredShortcuts, 64);
+        shortcutTableInit(&_activeShortcuts, 64);
+        _tableLock = [[NSLock alloc] init];
+        _displayLock = [[NSLock alloc] init];
+        _applyCondition = [[NSCondition alloc] init];
+        _lockVariants[0] = 0;
+        _lockVariantCount = 1;
+        _wakePipe[0] = _wakePipe[1] = -1;
         
         // Initialize X11 display for shortcuts
         _display = XOpenDisplay(NULL);
         if (!_display) {
             NSLog(@"X11ShortcutManager: Warning: Failed to open X11 display for shortcuts");
+        } else if (pipe(_wakePipe) != 0) {
+            NSLog(@"X11ShortcutManager: Warning: Cannot create wake pipe: %s", strerror(errno));
+            XCloseDisplay(_display);
+            _display = NULL;
+            _wakePipe[0] = _wakePipe[1] = -1;
         } else {
+            // A full pipe already holds a wake-up, so neither end ever blocks
+            fcntl(_wakePipe[0], F_SETFL, fcntl(_wakePipe[0], F_GETFL) | O_NONBLOCK);
+            fcntl(_wakePipe[1], F_SETFL, fcntl(_wakePipe[1], F_GETFL) | O_NONBLOCK);
+            
             // Initialize lock masks for comprehensive key grabbing
             [self detectLockMasks];
         }
@@ -92,14 +316,11 @@ static int handleX11GrabError(Display *display, XErrorEvent *event)
 - (void)dealloc
 {
     [self cleanup];
-    [_grabbedKeys release];
-    [_menuItemKeyToTag release];
-    [_registeredShortcuts release];
-    [_shortcutToMenuItemMap release];
-    [_menuItemToServiceMap release];
-    [_menuItemToObjectPathMap release];
-    [_menuItemToConnectionMap release];
-    [_menuItemToActionNameMap release];
+    shortcutTableFree(&_desiredShortcuts);
+    shortcutTableFree(&_activeShortcuts);
+    [_tableLock release];
+    [_displayLock release];
+    [_applyCondition release];
     [super dealloc];
 }
 
@@ -107,11 +328,27 @@ static int handleX11GrabError(Display *display, XErrorEvent *event)
                         serviceName:(NSString *)serviceName
                          objectPath:(NSString *)objectPath
                      dbusConnection:(GNUDBusConnection *)dbusConnection
+{
+    [self registerShortcutForMenuItem:menuItem
+                          serviceName:serviceName
+                           objectPath:objectPath
+                           actionName:nil
+                       dbusConnection:dbusConnection];
+}
+
+- (void)registerShortcutForMenuItem:(NSMenuItem *)menuItem
+                        serviceName:(NSString *)serviceName
+                         objectPath:(NSString *)objectPath
+                         actionName:(NSString *)actionName
+                     dbusConnection:(GNUDBusConnection *)dbusConnection
 {
     if (!_display) {
         NSLog(@"X11ShortcutManager: Cannot register shortcut - no X11 display");
         return;
     }
+    if ([self isIgnoringCurrentThread]) {
+        return;
+    }
     
     NSString *keyEquivalent = [menuItem keyEquivalent];
     NSUInteger modifierMask = [menuItem keyEquivalentModifierMask];
@@ -120,170 +357,275 @@ static int handleX11GrabError(Display *display, XErrorEvent *event)
         return;
     }
     
-    // Create a stable key based on menu item properties instead of memory address
-    // This ensures cached menus work correctly when shortcuts are re-registered
-    // Include tag to ensure uniqueness since many items may have same service/title
-    NSString *menuItemKey = [NSString stringWithFormat:@"%@_%@_%@_%ld", 
-                            serviceName ?: @"unknown", 
-                            [menuItem title] ?: @"untitled",
-                            [menuItem keyEquivalent] ?: @"none",
-                            [menuItem tag]];
-    
-    // Store the menu item tag and DBus connection info
-    [_menuItemKeyToTag setObject:[NSNumber numberWithLong:[menuItem tag]] forKey:menuItemKey];
-    [_menuItemToServiceMap setObject:serviceName forKey:menuItemKey];
-    [_menuItemToObjectPathMap setObject:objectPath forKey:menuItemKey];
-    [_menuItemToConnectionMap setObject:dbusConnection forKey:menuItemKey];
-    
-    // Convert key to X11 KeySym and KeyCode
+    // Convert key to X11 KeySym and KeyCode (both client-side lookups)
     KeySym keysym = [self parseKeyString:keyEquivalent];
     if (keysym == NoSymbol) {
         NSLog(@"X11ShortcutManager: Failed to convert key '%@' to X11 KeySym", keyEquivalent);
         return;
     }
     
-    KeyCode keycode = XKeysymToKeycode(_display, keysym);
+    KeyCode keycode = [self keycodeForKeysym:keysym];
     if (keycode == 0) {
         NSLog(@"X11ShortcutManager: Failed to convert KeySym to KeyCode for '%@'", keyEquivalent);
         return;
     }
     
-    // Prepare shortcut strings and modifiers
-    NSString *originalShortcut = [self createShortcutStringFromKey:keyEquivalent modifiers:modifierMask];
-    unsigned int originalX11Modifier = [self convertToX11Modifier:modifierMask];
+    X11ShortcutBinding *binding = [[X11ShortcutBinding alloc] init];
+    binding->_serviceName = [serviceName copy];
+    binding->_objectPath = [objectPath copy];
+    binding->_actionName = [actionName copy];
+    binding->_dbusConnection = [dbusConnection retain];
+    binding->_tag = [menuItem tag];
+    binding->_title = [[menuItem title] copy];
     
     // For <Primary> shortcuts (which now map to Control), skip the original
     // and only register Alt+key for cross-platform menu access
     BOOL isControlShortcut = (modifierMask & NSControlKeyMask) != 0;
-    BOOL registeredOriginal = NO;
-    BOOL registeredAlt = NO;
-    
-    if (!isControlShortcut) {
-        // Not a Control shortcut - register normally
-        registeredOriginal = [self registerSingleShortcut:keycode 
-                                                  modifier:originalX11Modifier 
-                                               menuItemKey:menuItemKey 
-                                            shortcutString:originalShortcut];
-    } else {
-        NSLog(@"X11ShortcutManager: Skipping %@ (preserving app's internal shortcut)", originalShortcut);
-    }
     
-    // For Control shortcuts, register Alt+key for our menu system
-    if (isControlShortcut) {
-        // Replace Control with Alt
-        NSUInteger altModifierMask = (modifierMask & ~NSControlKeyMask) | NSAlternateKeyMask;
-        NSString *altShortcut = [self createShortcutStringFromKey:keyEquivalent modifiers:altModifierMask];
-        unsigned int altX11Modifier = [self convertToX11Modifier:altModifierMask];
-        
-        registeredAlt = [self registerSingleShortcut:keycode 
-                                             modifier:altX11Modifier 
-                                          menuItemKey:menuItemKey 
-                                       shortcutString:altShortcut];
-        
-        if (registeredAlt) {
-            NSLog(@"X11ShortcutManager: Registered Alt+%@ for cross-platform menu access", keyEquivalent);
-        }
-    }
+    // Control is replaced with Alt; the app keeps its own Ctrl shortcut
+    NSUInteger globalModifierMask = isControlShortcut
+        ? (modifierMask & ~NSControlKeyMask) | NSAlternateKeyMask
+        : modifierMask;
+    
+    [_tableLock lock];
+    shortcutTableSet(&_desiredShortcuts, packShortcut(keycode, [self convertToX11Modifier:globalModifierMask]), binding);
     
     // Legacy: If Ctrl/Alt swapping is enabled for other shortcuts
     if (_swapCtrlAlt && !isControlShortcut && (modifierMask & (NSControlKeyMask | NSAlternateKeyMask))) {
         NSUInteger swappedModifierMask = [self getSwappedModifierMask:modifierMask];
-        NSString *swappedShortcut = [self createShortcutStringFromKey:keyEquivalent modifiers:swappedModifierMask];
-        unsigned int swappedX11Modifier = [self convertToX11Modifier:swappedModifierMask];
-        
-        BOOL registeredSwapped = [self registerSingleShortcut:keycode 
-                                                      modifier:swappedX11Modifier 
-                                                   menuItemKey:menuItemKey 
-                                                shortcutString:swappedShortcut];
-        
-        if (registeredOriginal || registeredSwapped) {
-            NSLog(@"X11ShortcutManager: Registered swapped shortcuts for menu item '%@': original=%@(%s), swapped=%@(%s)", 
-                  [menuItem title], originalShortcut, registeredOriginal ? "OK" : "FAILED",
-                  swappedShortcut, registeredSwapped ? "OK" : "FAILED");
-        }
-    } else if (registeredOriginal || registeredAlt) {
-        NSString *registeredShortcuts = registeredOriginal ? originalShortcut : 
-                                       registeredAlt ? [self createShortcutStringFromKey:keyEquivalent 
-                                                                               modifiers:(modifierMask & ~NSControlKeyMask) | NSAlternateKeyMask] : @"none";
-        NSLog(@"X11ShortcutManager: Registered shortcut for menu item '%@': %@", 
-              [menuItem title], registeredShortcuts);
-    }
-    
-    // Debug: Check the state after registration
-    NSLog(@"X11ShortcutManager: After registration - _grabbedKeys count: %lu, _eventMonitorThread: %@", 
-          (unsigned long)[_grabbedKeys count], _eventMonitorThread ? @"EXISTS" : @"nil");
-    
-    // Start X11 event monitoring if this is the first shortcut
-    if ([_grabbedKeys count] > 0 && !_eventMonitorThread) {
-        NSLog(@"X11ShortcutManager: Starting event monitoring - have %lu grabbed keys", 
-              (unsigned long)[_grabbedKeys count]);
-        [self startX11EventMonitoring];
-    } else {
-        NSLog(@"X11ShortcutManager: Not starting event monitoring - count: %lu, thread: %@", 
-              (unsigned long)[_grabbedKeys count], _eventMonitorThread ? @"EXISTS" : @"nil");
+        shortcutTableSet(&_desiredShortcuts, packShortcut(keycode, [self convertToX11Modifier:swappedModifierMask]), binding);
     }
+    [self scheduleApplyLocked];
+    [_tableLock unlock];
+    
+    NSLog(@"X11ShortcutManager: Queued shortcut %@ for menu item '%@'",
+          [self createShortcutStringFromKey:keyEquivalent modifiers:globalModifierMask], [menuItem title]);
+    [binding release];
 }
 
-- (void)registerShortcutForMenuItem:(NSMenuItem *)menuItem
-                        serviceName:(NSString *)serviceName
-                         objectPath:(NSString *)objectPath
-                         actionName:(NSString *)actionName
-                     dbusConnection:(GNUDBusConnection *)dbusConnection
+- (void)registerDirectShortcutForMenuItem:(NSMenuItem *)menuItem
+                                   target:(id)target
+                                   action:(SEL)action
 {
-    // Call the original method to handle key registration
-    [self registerShortcutForMenuItem:menuItem
-                          serviceName:serviceName
-                           objectPath:objectPath
-                       dbusConnection:dbusConnection];
+    if (!_display) {
+        NSLog(@"X11ShortcutManager: Cannot register direct shortcut - no X11 display");
+        return;
+    }
+    if ([self isIgnoringCurrentThread]) {
+        return;
+    }
+    
+    NSString *keyEquivalent = [menuItem keyEquivalent];
+    NSUInteger modifierMask = [menuItem keyEquivalentModifierMask];
     
-    // Additionally store the action name for protocol detection
-    // Create a stable key based on menu item properties - must be truly unique per menu item
-    // Include tag to match the format used in registerShortcut methods
-    NSString *menuItemKey = [NSString stringWithFormat:@"%@_%@_%@_%ld", 
-                            serviceName ?: @"unknown",
-                            [menuItem title] ?: @"untitled",
-                            [menuItem keyEquivalent] ?: @"none",
-                            (long)[menuItem tag]];
-    if (actionName) {
-        [_menuItemToActionNameMap setObject:actionName forKey:menuItemKey];
-        NSLog(@"X11ShortcutManager: Stored action name '%@' for menu item '%@' with key '%@'", 
-              actionName, [menuItem title], menuItemKey);
+    if ([keyEquivalent length] == 0 || modifierMask == 0) {
+        NSLog(@"X11ShortcutManager: Cannot register direct shortcut - no key equivalent or modifier");
+        return;
+    }
+    
+    // Convert key to X11 KeySym and KeyCode
+    KeySym keysym = [self parseKeyString:keyEquivalent];
+    if (keysym == NoSymbol) {
+        NSLog(@"X11ShortcutManager: Failed to convert key '%@' to X11 KeySym", keyEquivalent);
+        return;
+    }
+    
+    KeyCode keycode = [self keycodeForKeysym:keysym];
+    if (keycode == 0) {
+        NSLog(@"X11ShortcutManager: Failed to convert KeySym to KeyCode for '%@'", keyEquivalent);
+        return;
     }
+    
+    NSNumber *windowId = [menuItem representedObject];
+    X11ShortcutBinding *binding = [[X11ShortcutBinding alloc] init];
+    binding->_target = [target retain];
+    binding->_action = action;
+    binding->_windowIdString = [(windowId ? [windowId stringValue] : @"0") copy];
+    binding->_title = [[menuItem title] copy];
+    
+    unsigned int x11_modifier = [self convertToX11Modifier:modifierMask];
+    NSLog(@"X11ShortcutManager: Registering direct shortcut %@ with modifier 0x%x (keycode %d) for window %@",
+          keyEquivalent, x11_modifier, keycode, binding->_windowIdString);
+    
+    [_tableLock lock];
+    shortcutTableSet(&_desiredShortcuts, packShortcut(keycode, x11_modifier), binding);
+    [self scheduleApplyLocked];
+    [_tableLock unlock];
+    
+    [binding release];
 }
 
 - (void)unregisterAllShortcuts
 {
-    if ([_registeredShortcuts count] == 0) {
+    if ([self isIgnoringCurrentThread]) {
         return;
     }
     
-    NSLog(@"X11ShortcutManager: Unregistering %lu X11 hotkeys", 
-          (unsigned long)[_registeredShortcuts count]);
+    [_tableLock lock];
+    if (_desiredShortcuts.count > 0) {
+        NSLog(@"X11ShortcutManager: Releasing %lu shortcuts (applied with the next menu's shortcuts)",
+              (unsigned long)_desiredShortcuts.count);
+        shortcutTableClear(&_desiredShortcuts);
+        [self scheduleApplyLocked];
+    }
+    [_tableLock unlock];
+}
+
+- (void)ignoreRegistrationsFromCurrentThread
+{
+    [[[NSThread currentThread] threadDictionary] setObject:[NSNumber numberWithBool:YES]
+                                                    forKey:X11ShortcutIgnoreRegistrationsKey];
+}
+
+- (void)applyPendingShortcutChanges
+{
+    if (![NSThread isMainThread]) {
+        [self performSelectorOnMainThread:@selector(applyPendingShortcutChanges)
+                               withObject:nil
+                            waitUntilDone:NO];
+        return;
+    }
     
-    // Stop event monitoring
-    if (_eventMonitorThread && !_shouldStopEventMonitoring) {
-        _shouldStopEventMonitoring = YES;
-        // Wait for thread to finish
-        while (_eventMonitorThread && ![_eventMonitorThread isFinished]) {
-            [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    [_tableLock lock];
+    _applyScheduled = NO;
+    [_tableLock unlock];
+    if (!_display) {
+        return;
+    }
+    
+    // The event thread owns the grabs and applies the changes when it wakes
+    [_applyCondition lock];
+    _applyRequests++;
+    [_applyCondition unlock];
+    if (!_eventMonitorThread) {
+        [self startX11EventMonitoring];
+    } else {
+        [self wakeEventMonitor];
+    }
+}
+
+- (BOOL)waitForShortcutChangesWithTimeout:(NSTimeInterval)timeout
+{
+    NSDate *limit = [NSDate dateWithTimeIntervalSinceNow:timeout];
+    [_applyCondition lock];
+    NSUInteger wanted = _applyRequests;
+    while (_appliedRequests < wanted && [_applyCondition waitUntilDate:limit]) {
+    }
+    BOOL applied = _appliedRequests >= wanted;
+    [_applyCondition unlock];
+    return applied;
+}
+
+// Event thread only, with _displayLock held
+- (void)applyShortcutChangesOnEventThread
+{
+    [_tableLock lock];
+    
+    // Diff wanted against grabbed; shortcuts present in both only get their binding updated
+    uint32_t *toGrab = malloc(MAX(_desiredShortcuts.count, (NSUInteger)1) * sizeof(uint32_t));
+    uint32_t *toRelease = malloc(MAX(_activeShortcuts.count, (NSUInteger)1) * sizeof(uint32_t));
+    NSUInteger grabCount = 0, releaseCount = 0, unchangedCount = 0;
+    
+    for (NSUInteger i = 0; i < _activeShortcuts.capacity; i++) {
+        uint32_t key = _activeShortcuts.keys[i];
+        if (key && !shortcutTableGet(&_desiredShortcuts, key)) {
+            toRelease[releaseCount++] = key;
+        }
+    }
+    for (NSUInteger i = 0; i < _desiredShortcuts.capacity; i++) {
+        uint32_t key = _desiredShortcuts.keys[i];
+        if (!key) {
+            continue;
+        }
+        if (shortcutTableGet(&_activeShortcuts, key)) {
+            shortcutTableSet(&_activeShortcuts, key, _desiredShortcuts.values[i]);
+            unchangedCount++;
+        } else {
+            toGrab[grabCount++] = key;
         }
-        _eventMonitorThread = nil;
     }
+    [_tableLock unlock];
     
-    // Unregister all X11 hotkeys
-    if (_display) {
-        XUngrabKey(_display, AnyKey, AnyModifier, DefaultRootWindow(_display));
-        XSync(_display, False);
+    if (grabCount == 0 && releaseCount == 0) {
+        free(toGrab);
+        free(toRelease);
+        return;
     }
     
-    [_registeredShortcuts removeAllObjects];
-    [_shortcutToMenuItemMap removeAllObjects];
-    [_grabbedKeys removeAllObjects];
-    [_menuItemKeyToTag removeAllObjects];
-    [_menuItemToServiceMap removeAllObjects];
-    [_menuItemToObjectPathMap removeAllObjects];
-    [_menuItemToConnectionMap removeAllObjects];
-    [_menuItemToActionNameMap removeAllObjects];
+    NSDate *start = [NSDate date];
+    MenuTraceTime traceStart = MenuTraceBegin();
+    Window root = DefaultRootWindow(_display);
+    
+    for (NSUInteger i = 0; i < releaseCount; i++) {
+        unsigned int keycode = toRelease[i] >> 8;
+        unsigned int modifier = toRelease[i] & 0xff;
+        for (NSUInteger v = 0; v < _lockVariantCount; v++) {
+            XUngrabKey(_display, keycode, modifier | _lockVariants[v], root);
+        }
+    }
+    
+    // Issue every grab (all lock variants) back to back and sync once; a failed
+    // request is matched to its shortcut through the request serial
+    unsigned long *firstSerials = malloc(MAX(grabCount, (NSUInteger)1) * sizeof(unsigned long));
+    NSMutableIndexSet *failedSerials = [NSMutableIndexSet indexSet];
+    x11_failed_grab_serials = failedSerials;
+    beginGrabErrorCapture(_display);
+    
+    for (NSUInteger i = 0; i < grabCount; i++) {
+        unsigned int keycode = toGrab[i] >> 8;
+        unsigned int modifier = toGrab[i] & 0xff;
+        firstSerials[i] = NextRequest(_display);
+        for (NSUInteger v = 0; v < _lockVariantCount; v++) {
+            XGrabKey(_display, keycode, modifier | _lockVariants[v], root, False, GrabModeAsync, GrabModeAsync);
+        }
+    }
+    XSync(_display, False);
+    
+    endGrabErrorCapture();
+    x11_failed_grab_serials = nil;
+    
+    // Roll back partially grabbed shortcuts that another client already owns
+    NSUInteger takenCount = 0;
+    for (NSUInteger i = 0; i < grabCount; i++) {
+        if ([failedSerials intersectsIndexesInRange:NSMakeRange(firstSerials[i], _lockVariantCount)]) {
+            unsigned int keycode = toGrab[i] >> 8;
+            unsigned int modifier = toGrab[i] & 0xff;
+            for (NSUInteger v = 0; v < _lockVariantCount; v++) {
+                XUngrabKey(_display, keycode, modifier | _lockVariants[v], root);
+            }
+            NSLog(@"X11ShortcutManager: Shortcut keycode=%u modifier=0x%x is already taken - skipping", keycode, modifier);
+            toGrab[i] = 0;
+            takenCount++;
+        }
+    }
+    if (takenCount > 0) {
+        XFlush(_display);
+    }
+    
+    [_tableLock lock];
+    for (NSUInteger i = 0; i < releaseCount; i++) {
+        shortcutTableRemove(&_activeShortcuts, toRelease[i]);
+    }
+    for (NSUInteger i = 0; i < grabCount; i++) {
+        id binding = toGrab[i] ? shortcutTableGet(&_desiredShortcuts, toGrab[i]) : nil;
+        // The desired set may have changed while we were talking to the server;
+        // anything still pending is picked up by the next scheduled pass
+        if (binding) {
+            shortcutTableSet(&_activeShortcuts, toGrab[i], binding);
+        }
+    }
+    NSUInteger activeCount = _activeShortcuts.count;
+    [_tableLock unlock];
+    
+    free(toGrab);
+    free(toRelease);
+    free(firstSerials);
+    MenuTraceEnd("X11ShortcutManager.applyGrabs", "x11", traceStart, 0);
+    
+    NSLog(@"X11ShortcutManager: Applied shortcut changes in %.1f ms: %lu grabbed, %lu released, %lu unchanged, %lu taken (%lu active)",
+          -[start timeIntervalSinceNow] * 1000.0, (unsigned long)(grabCount - takenCount),
+          (unsigned long)releaseCount, (unsigned long)unchangedCount, (unsigned long)takenCount,
+          (unsigned long)activeCount);
 }
 
 - (BOOL)shouldSwapCtrlAlt
@@ -304,12 +646,39 @@ static int handleX11GrabError(Display *display, XErrorEvent *event)
 - (void)cleanup
 {
     NSLog(@"X11ShortcutManager: Performing cleanup...");
-    [self unregisterAllShortcuts];
+    
+    // Stop event monitoring
+    if (_eventMonitorThread && !_shouldStopEventMonitoring) {
+        _shouldStopEventMonitoring = YES;
+        [self wakeEventMonitor];
+        // Wait for thread to finish
+        while (_eventMonitorThread && ![_eventMonitorThread isFinished]) {
+            [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+        }
+        [_eventMonitorThread release];
+        _eventMonitorThread = nil;
+    }
+    
+    [_tableLock lock];
+    NSUInteger activeCount = _activeShortcuts.count;
+    shortcutTableClear(&_desiredShortcuts);
+    shortcutTableClear(&_activeShortcuts);
+    [_tableLock unlock];
     
     if (_display) {
+        if (activeCount > 0) {
+            NSLog(@"X11ShortcutManager: Unregistering %lu X11 hotkeys", (unsigned long)activeCount);
+            XUngrabKey(_display, AnyKey, AnyModifier, DefaultRootWindow(_display));
+            XSync(_display, False);
+        }
         XCloseDisplay(_display);
         _display = NULL;
     }
+    if (_wakePipe[0] >= 0) {
+        close(_wakePipe[0]);
+        close(_wakePipe[1]);
+        _wakePipe[0] = _wakePipe[1] = -1;
+    }
 }
 
 - (BOOL)isShortcutAlreadyTaken:(NSString *)shortcutString
@@ -338,7 +707,7 @@ static int handleX11GrabError(Display *display, XErrorEvent *event)
         return YES;
     }
     
-    KeyCode keycode = XKeysymToKeycode(_display, keysym);
+    KeyCode keycode = [self keycodeForKeysym:keysym];
     if (keycode == 0) {
         NSLog(@"X11ShortcutManager: Cannot convert key '%@' to keycode in shortcut: %@", keyString, shortcutString);
         return YES;
@@ -359,11 +728,11 @@ static int handleX11GrabError(Display *display, XErrorEvent *event)
     }
     
     // Try to temporarily grab the key to see if it's available
+    [_displayLock lock];
     Window root = DefaultRootWindow(_display);
     
     // Set up error handling
-    x11_grab_error_occurred = NO;
-    int (*oldHandler)(Display *, XErrorEvent *) = XSetErrorHandler(handleX11GrabError);
+    beginGrabErrorCapture(_display);
     
     // Attempt to grab the key
     XGrabKey(_display, keycode, modifierMask, root, False, GrabModeAsync, GrabModeAsync);
@@ -388,7 +757,9 @@ static int handleX11GrabError(Display *display, XErrorEvent *event)
     }
     
     // Restore error handler
-    XSetErrorHandler(oldHandler);
+    endGrabErrorCapture();
+    [self wakeEventMonitorIfEventsQueuedLocked];
+    [_displayLock unlock];
     
     return !isAvailable; // Return YES if taken, NO if available
 }
@@ -424,11 +795,11 @@ static int handleX11GrabError(Display *display, XErrorEvent *event)
     }
     
     // Try to temporarily grab the key to see if it's available
+    [_displayLock lock];
     Window root = DefaultRootWindow(_display);
     
     // Set up error handling
-    x11_grab_error_occurred = NO;
-    int (*oldHandler)(Display *, XErrorEvent *) = XSetErrorHandler(handleX11GrabError);
+    beginGrabErrorCapture(_display);
     
     // Attempt to grab the key - try the base combination first
     BOOL grabbed_successfully = NO;
@@ -472,7 +843,9 @@ static int handleX11GrabError(Display *display, XErrorEvent *event)
     }
     
     // Restore error handler
-    XSetErrorHandler(oldHandler);
+    endGrabErrorCapture();
+    [self wakeEventMonitorIfEventsQueuedLocked];
+    [_displayLock unlock];
     
     NSLog(@"X11ShortcutManager: Availability check for keycode=%d modifier=%u: %s", 
           keycode, x11_modifier, grabbed_successfully ? "AVAILABLE" : "TAKEN");
@@ -482,6 +855,51 @@ static int handleX11GrabError(Display *display, XErrorEvent *event)
 
 #pragma mark - Private Methods
 
+- (BOOL)isIgnoringCurrentThread
+{
+    return [[[NSThread currentThread] threadDictionary] objectForKey:X11ShortcutIgnoreRegistrationsKey] != nil;
+}
+
+// Xlib's keysym lookup is client-side, but it can fetch a keyboard mapping
+// the event thread was told has changed
+- (KeyCode)keycodeForKeysym:(KeySym)keysym
+{
+    [_displayLock lock];
+    KeyCode keycode = XKeysymToKeycode(_display, keysym);
+    [self wakeEventMonitorIfEventsQueuedLocked];
+    [_displayLock unlock];
+    return keycode;
+}
+
+- (void)wakeEventMonitor
+{
+    char byte = 0;
+    if (_wakePipe[1] >= 0) {
+        (void)write(_wakePipe[1], &byte, 1);
+    }
+}
+
+// With _displayLock held, off the event thread: a reply may have pulled
+// events into Xlib's queue, where the event thread's poll() cannot see them
+- (void)wakeEventMonitorIfEventsQueuedLocked
+{
+    if (QLength(_display) > 0) {
+        [self wakeEventMonitor];
+    }
+}
+
+// Called with _tableLock held: coalesce all changes of this run loop turn into one pass
+- (void)scheduleApplyLocked
+{
+    if (_applyScheduled) {
+        return;
+    }
+    _applyScheduled = YES;
+    [self performSelectorOnMainThread:@selector(applyPendingShortcutChanges)
+                           withObject:nil
+                        waitUntilDone:NO];
+}
+
 - (NSUInteger)getSwappedModifierMask:(NSUInteger)modifierMask
 {
     NSUInteger swappedMask = modifierMask;
@@ -506,35 +924,6 @@ static int handleX11GrabError(Display *display, XErrorEvent *event)
     return swappedMask;
 }
 
-- (BOOL)registerSingleShortcut:(KeyCode)keycode 
-                      modifier:(unsigned int)x11_modifier 
-                   menuItemKey:(NSString *)menuItemKey 
-                shortcutString:(NSString *)shortcutString
-{
-    // Check if this shortcut is already taken
-    if ([self isShortcutAlreadyTaken:keycode modifier:x11_modifier]) {
-        NSLog(@"X11ShortcutManager: Shortcut %@ is already taken - skipping", shortcutString);
-        return NO;
-    }
-    
-    // Try to grab the key
-    if (![self grabX11Key:keycode modifier:x11_modifier]) {
-        NSLog(@"X11ShortcutManager: Failed to grab X11 key for shortcut %@", shortcutString);
-        return NO;
-    }
-    
-    // Store the mapping from keycode+modifier to menu item
-    NSString *keycodeModifierKey = [NSString stringWithFormat:@"%d_%u", keycode, x11_modifier];
-    [_shortcutToMenuItemMap setObject:menuItemKey forKey:keycodeModifierKey];
-    [_grabbedKeys setObject:menuItemKey forKey:keycodeModifierKey];
-    [_registeredShortcuts addObject:shortcutString];
-    
-    NSLog(@"X11ShortcutManager: Successfully registered shortcut: %@ (keycode=%d, modifier=%u)", 
-          shortcutString, keycode, x11_modifier);
-    
-    return YES;
-}
-
 - (NSString *)createShortcutStringFromKey:(NSString *)key modifiers:(NSUInteger)modifiers
 {
     if ([key length] == 0) {
@@ -601,36 +990,8 @@ static int handleX11GrabError(Display *display, XErrorEvent *event)
 
 - (KeySym)parseKeyString:(NSString *)keyStr
 {
-    if ([keyStr length] == 0) {
-        return NoSymbol;
-    }
-    
-    const char *cStr = [keyStr UTF8String];
-    
-    // Handle special keys based on globalshortcutsd implementation
-    if ([keyStr length] == 1) {
-        // Single character - try lowercase for X11
-        return XStringToKeysym([keyStr UTF8String]);
-    }
-    
-    // Handle named keys
-    if ([keyStr isEqualToString:@"space"]) return XK_space;
-    if ([keyStr isEqualToString:@"return"] || [keyStr isEqualToString:@"enter"]) return XK_Return;
-    if ([keyStr isEqualToString:@"tab"]) return XK_Tab;
-    if ([keyStr isEqualToString:@"escape"] || [keyStr isEqualToString:@"esc"]) return XK_Escape;
-    if ([keyStr isEqualToString:@"backspace"]) return XK_BackSpace;
-    if ([keyStr isEqualToString:@"delete"]) return XK_Delete;
-    
-    // Function keys
-    if ([keyStr hasPrefix:@"f"] && [keyStr length] <= 3) {
-        int fNum = [[keyStr substringFromIndex:1] intValue];
-        if (fNum >= 1 && fNum <= 24) {
-            return XK_F1 + (fNum - 1);
-        }
-    }
-    
-    // Try direct keysym lookup
-    return XStringToKeysym(cStr);
+    // Looked up once per key equivalent, see MenuAcceleratorCache
+    return (KeySym)MenuAcceleratorKeysym(keyStr);
 }
 
 - (unsigned int)convertToX11Modifier:(NSUInteger)modifierMask
@@ -653,87 +1014,6 @@ static int handleX11GrabError(Display *display, XErrorEvent *event)
     return x11_modifier;
 }
 
-- (BOOL)grabX11Key:(KeyCode)keycode modifier:(unsigned int)modifier
-{
-    if (!_display) {
-        return NO;
-    }
-
-    Window root = DefaultRootWindow(_display);
-    BOOL success = YES;
-    
-    // Set up error handling
-    x11_grab_error_occurred = NO;
-    int (*oldHandler)(Display *, XErrorEvent *) = XSetErrorHandler(handleX11GrabError);
-    
-    // Base combination
-    XGrabKey(_display, keycode, modifier, root, False, GrabModeAsync, GrabModeAsync);
-    XSync(_display, False);
-    if (x11_grab_error_occurred) success = NO;
-    
-    // With numlock
-    if (_numlock_mask && !x11_grab_error_occurred) {
-        XGrabKey(_display, keycode, modifier | _numlock_mask, root, False, GrabModeAsync, GrabModeAsync);
-        XSync(_display, False);
-    }
-    
-    // With capslock
-    if (_capslock_mask && !x11_grab_error_occurred) {
-        XGrabKey(_display, keycode, modifier | _capslock_mask, root, False, GrabModeAsync, GrabModeAsync);
-        XSync(_display, False);
-    }
-    
-    // With scrolllock
-    if (_scrolllock_mask && !x11_grab_error_occurred) {
-        XGrabKey(_display, keycode, modifier | _scrolllock_mask, root, False, GrabModeAsync, GrabModeAsync);
-        XSync(_display, False);
-    }
-    
-    // With numlock + capslock
-    if (_numlock_mask && _capslock_mask && !x11_grab_error_occurred) {
-        XGrabKey(_display, keycode, modifier | _numlock_mask | _capslock_mask, root, False, GrabModeAsync, GrabModeAsync);
-        XSync(_display, False);
-    }
-    
-    // With numlock + scrolllock
-    if (_numlock_mask && _scrolllock_mask && !x11_grab_error_occurred) {
-        XGrabKey(_display, keycode, modifier | _numlock_mask | _scrolllock_mask, root, False, GrabModeAsync, GrabModeAsync);
-        XSync(_display, False);
-    }
-    
-    // With capslock + scrolllock
-    if (_capslock_mask && _scrolllock_mask && !x11_grab_error_occurred) {
-        XGrabKey(_display, keycode, modifier | _capslock_mask | _scrolllock_mask, root, False, GrabModeAsync, GrabModeAsync);
-        XSync(_display, False);
-    }
-    
-    // With all locks
-    if (_numlock_mask && _capslock_mask && _scrolllock_mask && !x11_grab_error_occurred) {
-        XGrabKey(_display, keycode, modifier | _numlock_mask | _capslock_mask | _scrolllock_mask, root, False, GrabModeAsync, GrabModeAsync);
-        XSync(_display, False);
-    }
-    
-    // Restore error handler
-    XSetErrorHandler(oldHandler);
-    
-    NSLog(@"X11ShortcutManager: Key grab result for keycode=%d modifier=0x%x: %s", 
-          keycode, modifier, (success && !x11_grab_error_occurred) ? "SUCCESS" : "FAILED");
-    
-    // Additional debug: Check if the key grab worked by testing it
-    if (success && !x11_grab_error_occurred) {
-        NSLog(@"X11ShortcutManager: Verifying key grab by checking connection and display");
-        int fd = ConnectionNumber(_display);
-        NSLog(@"X11ShortcutManager: X11 connection file descriptor: %d", fd);
-        
-        // Try to get the current keyboard mapping as a health check
-        int min_keycode, max_keycode;
-        XDisplayKeycodes(_display, &min_keycode, &max_keycode);
-        NSLog(@"X11ShortcutManager: X11 keyboard range: %d-%d", min_keycode, max_keycode);
-    }
-    
-    return success && !x11_grab_error_occurred;
-}
-
 - (void)startX11EventMonitoring
 {
     if (!_display) {
@@ -748,18 +1028,18 @@ static int handleX11GrabError(Display *display, XErrorEvent *event)
     
     // Select KeyPress events on the root window - THIS IS CRITICAL!
     // Without this, XGrabKey won't deliver events to us
+    [_displayLock lock];
     Window root = DefaultRootWindow(_display);
     
     // Use KeyPressMask and also StructureNotifyMask for better event handling
     XSelectInput(_display, root, KeyPressMask | StructureNotifyMask);
     XSync(_display, False);
-    
-    // Make sure the X11 connection is flushed
-    XFlush(_display);
+    [_displayLock unlock];
     
     NSLog(@"X11ShortcutManager: Selected KeyPress events on root window (window ID: %lu)", root);
     
-    // Start the event monitoring thread
+    // Start the event monitoring thread; it keeps running across menu switches
+    // and applies the pending shortcut changes as soon as it starts
     _shouldStopEventMonitoring = NO;
     _eventMonitorThread = [[NSThread alloc] initWithTarget:self
                                                   selector:@selector(eventMonitorThreadMain)
@@ -775,118 +1055,125 @@ static int handleX11GrabError(Display *display, XErrorEvent *event)
     
     NSLog(@"X11ShortcutManager: Event monitoring thread started");
     
-    while (!_shouldStopEventMonitoring && _display) {
-        // Process all pending X11 events
-        int eventCount = 0;
+    struct pollfd fds[2];
+    fds[0].fd = ConnectionNumber(_display);
+    fds[0].events = POLLIN;
+    fds[1].fd = _wakePipe[0];
+    fds[1].events = POLLIN;
+    BOOL applyChanges = YES;    // The first wake-up is the thread starting
+    
+    while (!_shouldStopEventMonitoring) {
+        NSAutoreleasePool *passPool = [[NSAutoreleasePool alloc] init];
+        [_displayLock lock];
+        if (applyChanges) {
+            [_applyCondition lock];
+            NSUInteger requests = _applyRequests;
+            [_applyCondition unlock];
+            
+            [self applyShortcutChangesOnEventThread];
+            applyChanges = NO;
+            
+            [_applyCondition lock];
+            _appliedRequests = requests;
+            [_applyCondition broadcast];
+            [_applyCondition unlock];
+        }
+        // XPending flushes requests and reads whatever has arrived, so once the
+        // queue is empty the connection is only readable again for new events
         while (XPending(_display) && !_shouldStopEventMonitoring) {
             XEvent event;
             XNextEvent(_display, &event);
-            eventCount++;
             
             if (event.type == KeyPress) {
-                XKeyEvent *keyEvent = &event.xkey;
-                
-                // Filter out lock key masks like globalshortcutsd does
-                unsigned int filteredState = keyEvent->state;
-                filteredState &= ~(_numlock_mask | _capslock_mask | _scrolllock_mask);
-                
-                NSLog(@"X11ShortcutManager: KeyPress event - keycode=%d, state=%u (filtered from %u), window=%lu", 
-                      keyEvent->keycode, filteredState, keyEvent->state, keyEvent->window);
-                
-                // Create key for lookup using the filtered state (no swapping needed)
-                NSString *keycodeModifierKey = [NSString stringWithFormat:@"%d_%u", 
-                                              keyEvent->keycode, filteredState];
-                
-                // Find the menu item for this shortcut
-                NSString *menuItemKey = [_grabbedKeys objectForKey:keycodeModifierKey];
-                if (menuItemKey) {
-                    NSLog(@"X11ShortcutManager: Found matching shortcut for key: %@", keycodeModifierKey);
-                    // Trigger the menu action on the main thread
-                    [self performSelectorOnMainThread:@selector(triggerMenuActionForKey:)
-                                           withObject:menuItemKey
-                                        waitUntilDone:NO];
-                } else {
-                    NSLog(@"X11ShortcutManager: No matching shortcut found for key: %@", keycodeModifierKey);
-                    
-                    // Debug: Log all registered shortcuts
-                    NSLog(@"X11ShortcutManager: Currently have %lu registered shortcuts:", (unsigned long)[_grabbedKeys count]);
-                    for (NSString *key in [_grabbedKeys allKeys]) {
-                        NSLog(@"X11ShortcutManager:   %@ -> %@", key, [_grabbedKeys objectForKey:key]);
-                    }
-                }
-            } else {
-                // Log other event types occasionally for debugging
-                static int otherEventCounter = 0;
-                if (++otherEventCounter % 100 == 0) {
-                    NSLog(@"X11ShortcutManager: Received non-KeyPress event type: %d (count: %d)", event.type, otherEventCounter);
-                }
+                [self dispatchKeyPress:&event.xkey];
             }
         }
+        [_displayLock unlock];
+        [passPool release];
         
-        // Only log thread activity when there are events or occasionally for debug
-        static int debugCounter = 0;
-        if (eventCount > 0 || ++debugCounter % 1000 == 0) { // Log every 10 seconds (1000 * 0.01s) or when events occur
-            if (eventCount > 0) {
-                NSLog(@"X11ShortcutManager: Processed %d events this cycle", eventCount);
-            } else {
-                NSLog(@"X11ShortcutManager: Event thread running (%d iterations, %lu grabbed keys, no events)", 
-                      debugCounter, (unsigned long)[_grabbedKeys count]);
+        if (_shouldStopEventMonitoring) {
+            break;
+        }
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            NSLog(@"X11ShortcutManager: poll failed: %s", strerror(errno));
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            char buffer[64];
+            while (read(_wakePipe[0], buffer, sizeof(buffer)) > 0) {
+            }
+            applyChanges = YES;
         }
-        
-        // Small sleep to prevent busy waiting and allow other threads to run
-        usleep(10000); // 10ms, similar to globalshortcutsd
     }
     
     NSLog(@"X11ShortcutManager: Event monitoring thread terminated");
     [pool release];
 }
 
-- (void)triggerMenuActionForKey:(NSString *)menuItemKey
+- (void)dispatchKeyPress:(XKeyEvent *)keyEvent
+{
+    // Filter out lock key masks like globalshortcutsd does
+    unsigned int filteredState = keyEvent->state & ~(_numlock_mask | _capslock_mask | _scrolllock_mask);
+    uint32_t key = packShortcut(keyEvent->keycode, filteredState);
+    
+    [_tableLock lock];
+    X11ShortcutBinding *binding = [shortcutTableGet(&_activeShortcuts, key) retain];
+    [_tableLock unlock];
+    
+    if (binding) {
+        // Trigger the menu action on the main thread
+        [self performSelectorOnMainThread:@selector(triggerBinding:)
+                               withObject:binding
+                            waitUntilDone:NO];
+        [binding release];
+    } else {
+        NSLog(@"X11ShortcutManager: No matching shortcut for keycode=%u state=0x%x",
+              keyEvent->keycode, filteredState);
+    }
+}
+
+- (void)triggerBinding:(X11ShortcutBinding *)binding
 {
-    // Find the menu item using the stored mappings
-    NSString *serviceName = [_menuItemToServiceMap objectForKey:menuItemKey];
-    NSString *objectPath = [_menuItemToObjectPathMap objectForKey:menuItemKey];
-    id connectionOrTarget = [_menuItemToConnectionMap objectForKey:menuItemKey];
-    NSNumber *tagNumber = [_menuItemKeyToTag objectForKey:menuItemKey];
-    NSString *actionName = [_menuItemToActionNameMap objectForKey:menuItemKey];
-    
     // Check if this is a direct action (target/action pattern)
-    if (connectionOrTarget && ![connectionOrTarget isKindOfClass:[GNUDBusConnection class]]) {
-        // This is a direct target/action call
-        id target = connectionOrTarget;
-        SEL action = NSSelectorFromString(objectPath); // objectPath stores the selector string
+    if (binding->_target) {
+        id target = binding->_target;
+        SEL action = binding->_action;
         
-        NSLog(@"X11ShortcutManager: Triggering direct action %@ on target %@", objectPath, [target class]);
+        NSLog(@"X11ShortcutManager: Triggering direct action %@ on target %@", NSStringFromSelector(action), [target class]);
         
         if ([target respondsToSelector:action]) {
             // We need to create a temporary menu item to pass the window ID
             NSMenuItem *tempMenuItem = [[NSMenuItem alloc] initWithTitle:@"Close" action:action keyEquivalent:@""];
-            // The window ID should be stored in the service name field for direct actions
-            NSNumber *windowId = [NSNumber numberWithUnsignedLong:(unsigned long)[serviceName longLongValue]];
+            NSNumber *windowId = [NSNumber numberWithUnsignedLong:(unsigned long)[binding->_windowIdString longLongValue]];
             [tempMenuItem setRepresentedObject:windowId];
             
             [target performSelector:action withObject:tempMenuItem];
             [tempMenuItem release];
             NSLog(@"X11ShortcutManager: Direct action succeeded");
         } else {
-            NSLog(@"X11ShortcutManager: ERROR: Target %@ does not respond to selector %@", [target class], objectPath);
+            NSLog(@"X11ShortcutManager: ERROR: Target %@ does not respond to selector %@", [target class], NSStringFromSelector(action));
         }
         return;
     }
     
     // Continue with DBus handling for regular menu items
-    GNUDBusConnection *dbusConnection = (GNUDBusConnection *)connectionOrTarget;
-    
-    if (!serviceName || !objectPath || !dbusConnection || !tagNumber) {
-        NSLog(@"X11ShortcutManager: ERROR: Missing DBus info for shortcut trigger (service=%@, path=%@, tag=%@)", 
-              serviceName, objectPath, tagNumber);
+    NSString *serviceName = binding->_serviceName;
+    NSString *objectPath = binding->_objectPath;
+    NSString *actionName = binding->_actionName;
+    GNUDBusConnection *dbusConnection = binding->_dbusConnection;
+    
+    if (!serviceName || !objectPath || !dbusConnection) {
+        NSLog(@"X11ShortcutManager: ERROR: Missing DBus info for shortcut '%@' (service=%@, path=%@)", 
+              binding->_title, serviceName, objectPath);
         return;
     }
     
-    int menuItemId = [tagNumber intValue];
-    NSLog(@"X11ShortcutManager: Shortcut triggered for menu item ID=%d (service=%@, path=%@)", 
-          menuItemId, serviceName, objectPath);
+    int menuItemId = (int)binding->_tag;
+    NSLog(@"X11ShortcutManager: Shortcut triggered for menu item '%@' ID=%d (service=%@, path=%@)", 
+          binding->_title, menuItemId, serviceName, objectPath);
     
     // Try GTK Actions protocol first (modern apps like gedit)
     if (actionName && [self tryGTKAction:actionName 
@@ -1037,83 +1324,25 @@ static int handleX11GrabError(Display *display, XErrorEvent *event)
     if (modmap)
         XFreeModifiermap(modmap);
     
-    NSLog(@"X11ShortcutManager: Detected lock masks - NumLock: 0x%x, CapsLock: 0x%x, ScrollLock: 0x%x",
-          _numlock_mask, _capslock_mask, _scrolllock_mask);
-}
-
-- (void)registerDirectShortcutForMenuItem:(NSMenuItem *)menuItem
-                                   target:(id)target
-                                   action:(SEL)action
-{
-    if (!_display) {
-        NSLog(@"X11ShortcutManager: Cannot register direct shortcut - no X11 display");
-        return;
-    }
-    
-    NSString *keyEquivalent = [menuItem keyEquivalent];
-    NSUInteger modifierMask = [menuItem keyEquivalentModifierMask];
-    
-    if ([keyEquivalent length] == 0 || modifierMask == 0) {
-        NSLog(@"X11ShortcutManager: Cannot register direct shortcut - no key equivalent or modifier");
-        return;
-    }
-    
-    // Create a stable key for direct shortcuts using window ID, title, and key
-    NSNumber *windowId = [menuItem representedObject];
-    NSString *windowIdString = windowId ? [windowId stringValue] : @"0";
-    NSString *menuItemKey = [NSString stringWithFormat:@"direct_%@_%@_%@", 
-                            windowIdString,
-                            [menuItem title] ?: @"untitled",
-                            [menuItem keyEquivalent] ?: @"none"];
-    
-    [_menuItemToServiceMap setObject:windowIdString forKey:menuItemKey]; // Store window ID
-    [_menuItemToObjectPathMap setObject:NSStringFromSelector(action) forKey:menuItemKey]; // Store action selector
-    [_menuItemToConnectionMap setObject:target forKey:menuItemKey]; // Store target
-    
-    // Convert key to X11 KeySym and KeyCode
-    KeySym keysym = [self parseKeyString:keyEquivalent];
-    if (keysym == NoSymbol) {
-        NSLog(@"X11ShortcutManager: Failed to convert key '%@' to X11 KeySym", keyEquivalent);
-        return;
-    }
-    
-    KeyCode keycode = XKeysymToKeycode(_display, keysym);
-    if (keycode == 0) {
-        NSLog(@"X11ShortcutManager: Failed to convert KeySym to KeyCode for '%@'", keyEquivalent);
-        return;
-    }
-    
-    unsigned int x11_modifier = [self convertToX11Modifier:modifierMask];
-    
-    NSLog(@"X11ShortcutManager: Registering direct shortcut %@ with modifier 0x%x (keycode %d) for window %@",
-          keyEquivalent, x11_modifier, keycode, windowIdString);
-    
-    // Register the shortcut with X11 using the same method as existing shortcuts
-    if (![self grabX11Key:keycode modifier:x11_modifier]) {
-        NSLog(@"X11ShortcutManager: Failed to grab X11 key for direct shortcut %@", keyEquivalent);
-        return;
+    // Every lock combination has to be grabbed for a shortcut to work regardless of lock state
+    unsigned int locks[3] = {_numlock_mask, _capslock_mask, _scrolllock_mask};
+    _lockVariantCount = 0;
+    for (unsigned int combination = 0; combination < 8; combination++) {
+        unsigned int variant = 0;
+        BOOL valid = YES;
+        for (int bit = 0; bit < 3; bit++) {
+            if (combination & (1u << bit)) {
+                valid = valid && locks[bit] != 0;
+                variant |= locks[bit];
+            }
+        }
+        if (valid) {
+            _lockVariants[_lockVariantCount++] = variant;
+        }
     }
     
-    // Store the mapping for later lookup using the same format as existing shortcuts
-    NSString *keycodeModifierKey = [NSString stringWithFormat:@"%d_%u", keycode, x11_modifier];
-    [_shortcutToMenuItemMap setObject:menuItemKey forKey:keycodeModifierKey];
-    [_grabbedKeys setObject:menuItemKey forKey:keycodeModifierKey];
-    
-    NSLog(@"X11ShortcutManager: Successfully registered direct shortcut for %@", keyEquivalent);
-    
-    // Debug: Check the state after registration
-    NSLog(@"X11ShortcutManager: After registration - _grabbedKeys count: %lu, _eventMonitorThread: %@", 
-          (unsigned long)[_grabbedKeys count], _eventMonitorThread ? @"EXISTS" : @"nil");
-    
-    // Start X11 event monitoring if this is the first shortcut
-    if ([_grabbedKeys count] > 0 && !_eventMonitorThread) {
-        NSLog(@"X11ShortcutManager: Starting event monitoring for direct shortcuts - have %lu grabbed keys", 
-              (unsigned long)[_grabbedKeys count]);
-        [self startX11EventMonitoring];
-    } else {
-        NSLog(@"X11ShortcutManager: Not starting event monitoring - count: %lu, thread: %@", 
-              (unsigned long)[_grabbedKeys count], _eventMonitorThread ? @"EXISTS" : @"nil");
-    }
+    NSLog(@"X11ShortcutManager: Detected lock masks - NumLock: 0x%x, CapsLock: 0x%x, ScrollLock: 0x%x",
+          _numlock_mask, _capslock_mask, _scrolllock_mask);
 }
 
 @end
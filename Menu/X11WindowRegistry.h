@@ -0,0 +1,54 @@
+#import <Foundation/Foundation.h>
+#import <X11/Xlib.h>
+
+/**
+ * X11WindowRegistry
+ *
+ * Keeps the window -> menu service mapping up to date from X11 property
+ * changes instead of rescanning every window whenever _NET_CLIENT_LIST
+ * changes. The registry diffs the client list against the windows it already
+ * knows, selects PropertyChangeMask on new client windows and fetches the
+ * GTK (_GTK_UNIQUE_BUS_NAME/_GTK_MENUBAR_OBJECT_PATH) and KDE
+ * (_KDE_NET_WM_APPMENU_*) menu properties of all added windows in a single
+ * pipelined XCB batch. Later property changes on a client window refetch
+ * only that window.
+ *
+ * All methods must be called on the thread that owns the display (the
+ * MenuController X11 monitor thread). +setRescansClientList:YES (Menu.app
+ * --rescan-windows) makes the monitor thread go without a registry and
+ * rescan every window on each client list change, for comparison.
+ */
+@interface X11WindowRegistry : NSObject
+{
+    Display *_display;                  // Shared with the monitor thread, not owned
+    Window _rootWindow;
+    Atom _clientListAtom;
+    Atom _menuAtoms[4];                 // GTK bus name, GTK menubar path, KDE service, KDE path
+    NSMutableSet *_clientWindows;       // NSNumber windowId of windows in _NET_CLIENT_LIST
+    NSMutableDictionary *_windowMenus;  // windowId -> NSArray (protocol type, service, path)
+    NSUInteger _roundTrips;             // Requests (or pipelined batches) that waited for a reply
+    NSUInteger _propertyRefreshes;
+}
+
++ (void)setRescansClientList:(BOOL)rescans;
++ (BOOL)rescansClientList;
+
+- (id)initWithDisplay:(Display *)display rootWindow:(Window)rootWindow;
+
+// Record the current client list and select property events on every client
+// window without registering anything (used right after a full scan)
+- (BOOL)seedFromClientList;
+
+// Diff _NET_CLIENT_LIST against the known windows and register/unregister
+// only the windows that were added or removed. Returns NO if the client list
+// could not be read (no EWMH window manager), so the caller can fall back to
+// a full scan.
+- (BOOL)synchronizeClientList;
+
+// Handle a PropertyNotify event. Returns YES if the event concerned a menu
+// property of a known client window (and was consumed).
+- (BOOL)handlePropertyEvent:(XPropertyEvent *)event;
+
+- (NSUInteger)roundTrips;
+
+@end
@@ -0,0 +1,302 @@
+#import "X11WindowRegistry.h"
+#import "MenuProtocolManager.h"
+#import <X11/Xlib-xcb.h>
+#import <xcb/xcb.h>
+
+enum {
+    kMenuAtomGTKBusName = 0,
+    kMenuAtomGTKMenubarPath,
+    kMenuAtomKDEService,
+    kMenuAtomKDEPath,
+    kMenuAtomCount
+};
+
+// Property values longer than this (in 32-bit units) are not menu names/paths
+static const uint32_t kMaxPropertyLength = 1024;
+
+static BOOL rescansClientList = NO;
+
+@interface X11WindowRegistry (Private)
+- (xcb_connection_t *)xcbConnection;
+- (NSSet *)fetchClientList;
+- (void)selectPropertyEventsOnWindows:(NSArray *)windows;
+- (void)fetchMenuPropertiesForWindows:(NSArray *)windows registering:(BOOL)registering;
+- (void)applyMenuEntry:(NSArray *)entry forWindow:(NSNumber *)windowKey registering:(BOOL)registering;
+- (void)forgetWindow:(NSNumber *)windowKey;
+@end
+
+@implementation X11WindowRegistry
+
++ (void)setRescansClientList:(BOOL)rescans
+{
+    rescansClientList = rescans;
+}
+
++ (BOOL)rescansClientList
+{
+    return rescansClientList;
+}
+
+- (id)initWithDisplay:(Display *)display rootWindow:(Window)rootWindow
+{
+    self = [super init];
+    if (self) {
+        _display = display;
+        _rootWindow = rootWindow;
+        _clientWindows = [[NSMutableSet alloc] init];
+        _windowMenus = [[NSMutableDictionary alloc] init];
+
+        // Intern everything in one round-trip
+        char *names[kMenuAtomCount + 1] = {
+            "_GTK_UNIQUE_BUS_NAME",
+            "_GTK_MENUBAR_OBJECT_PATH",
+            "_KDE_NET_WM_APPMENU_SERVICE_NAME",
+            "_KDE_NET_WM_APPMENU_OBJECT_PATH",
+            "_NET_CLIENT_LIST"
+        };
+        Atom atoms[kMenuAtomCount + 1];
+        XInternAtoms(_display, names, kMenuAtomCount + 1, False, atoms);
+        _roundTrips++;
+
+        for (int i = 0; i < kMenuAtomCount; i++) {
+            _menuAtoms[i] = atoms[i];
+        }
+        _clientListAtom = atoms[kMenuAtomCount];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [_clientWindows release];
+    [_windowMenus release];
+    [super dealloc];
+}
+
+- (BOOL)seedFromClientList
+{
+    NSSet *clients = [self fetchClientList];
+    if (!clients) {
+        return NO;
+    }
+
+    NSArray *windows = [clients allObjects];
+    [_clientWindows setSet:clients];
+    [self selectPropertyEventsOnWindows:windows];
+    [self fetchMenuPropertiesForWindows:windows registering:NO];
+
+    NSLog(@"X11WindowRegistry: Seeded %lu client windows (%lu with menus, %lu round-trips so far)",
+          (unsigned long)[_clientWindows count], (unsigned long)[_windowMenus count],
+          (unsigned long)_roundTrips);
+    return YES;
+}
+
+- (BOOL)synchronizeClientList
+{
+    NSUInteger roundTripsBefore = _roundTrips;
+    NSSet *clients = [self fetchClientList];
+    if (!clients) {
+        return NO;
+    }
+
+    NSMutableSet *added = [NSMutableSet setWithSet:clients];
+    [added minusSet:_clientWindows];
+    NSMutableSet *removed = [NSMutableSet setWithSet:_clientWindows];
+    [removed minusSet:clients];
+
+    NSEnumerator *enumerator = [removed objectEnumerator];
+    NSNumber *windowKey;
+    while ((windowKey = [enumerator nextObject]) != nil) {
+        [self forgetWindow:windowKey];
+    }
+    [_clientWindows setSet:clients];
+
+    if ([added count] > 0) {
+        NSArray *windows = [added allObjects];
+        [self selectPropertyEventsOnWindows:windows];
+        [self fetchMenuPropertiesForWindows:windows registering:YES];
+    }
+
+    NSLog(@"X11WindowRegistry: Client list changed: +%lu -%lu windows (%lu round-trips)",
+          (unsigned long)[added count], (unsigned long)[removed count],
+          (unsigned long)(_roundTrips - roundTripsBefore));
+    return YES;
+}
+
+- (BOOL)handlePropertyEvent:(XPropertyEvent *)event
+{
+    BOOL isMenuAtom = NO;
+    for (int i = 0; i < kMenuAtomCount; i++) {
+        if (event->atom == _menuAtoms[i]) {
+            isMenuAtom = YES;
+            break;
+        }
+    }
+    if (!isMenuAtom) {
+        return NO;
+    }
+
+    NSNumber *windowKey = [NSNumber numberWithUnsignedLong:event->window];
+    if (![_clientWindows containsObject:windowKey]) {
+        return NO;
+    }
+
+    // GTK and KDE properties are usually set back to back; both land in the
+    // same refetch when the events are already queued, the rest are no-ops
+    _propertyRefreshes++;
+    [self fetchMenuPropertiesForWindows:[NSArray arrayWithObject:windowKey] registering:YES];
+    return YES;
+}
+
+- (NSUInteger)roundTrips
+{
+    return _roundTrips;
+}
+
+@end
+
+@implementation X11WindowRegistry (Private)
+
+- (xcb_connection_t *)xcbConnection
+{
+    return XGetXCBConnection(_display);
+}
+
+- (NSSet *)fetchClientList
+{
+    xcb_connection_t *conn = [self xcbConnection];
+    xcb_get_property_cookie_t cookie = xcb_get_property(conn, 0, (xcb_window_t)_rootWindow,
+                                                        (xcb_atom_t)_clientListAtom, XCB_ATOM_WINDOW,
+                                                        0, UINT32_MAX / 4);
+    xcb_get_property_reply_t *reply = xcb_get_property_reply(conn, cookie, NULL);
+    _roundTrips++;
+
+    if (!reply) {
+        return nil;
+    }
+    if (reply->type != XCB_ATOM_WINDOW || reply->format != 32) {
+        free(reply);
+        return nil;
+    }
+
+    int count = xcb_get_property_value_length(reply) / sizeof(xcb_window_t);
+    xcb_window_t *windows = (xcb_window_t *)xcb_get_property_value(reply);
+
+    NSMutableSet *clients = [NSMutableSet setWithCapacity:count];
+    for (int i = 0; i < count; i++) {
+        [clients addObject:[NSNumber numberWithUnsignedLong:windows[i]]];
+    }
+    free(reply);
+    return clients;
+}
+
+- (void)selectPropertyEventsOnWindows:(NSArray *)windows
+{
+    xcb_connection_t *conn = [self xcbConnection];
+    uint32_t mask = XCB_EVENT_MASK_PROPERTY_CHANGE;
+
+    // Checked requests with discarded replies: a window that vanished in the
+    // meantime produces a BadWindow that is dropped instead of reaching the
+    // Xlib error handler. No reply is waited for.
+    NSUInteger count = [windows count];
+    for (NSUInteger i = 0; i < count; i++) {
+        xcb_window_t window = (xcb_window_t)[[windows objectAtIndex:i] unsignedLongValue];
+        xcb_void_cookie_t cookie = xcb_change_window_attributes_checked(conn, window,
+                                                                        XCB_CW_EVENT_MASK, &mask);
+        xcb_discard_reply(conn, cookie.sequence);
+    }
+    xcb_flush(conn);
+}
+
+- (void)fetchMenuPropertiesForWindows:(NSArray *)windows registering:(BOOL)registering
+{
+    NSUInteger count = [windows count];
+    if (count == 0) {
+        return;
+    }
+
+    xcb_connection_t *conn = [self xcbConnection];
+    xcb_get_property_cookie_t *cookies = malloc(sizeof(xcb_get_property_cookie_t) * count * kMenuAtomCount);
+    if (!cookies) {
+        NSLog(@"X11WindowRegistry: Failed to allocate property cookies for %lu windows", (unsigned long)count);
+        return;
+    }
+
+    // Issue every request first, then collect the replies: the whole batch
+    // costs a single round-trip regardless of the number of windows
+    for (NSUInteger i = 0; i < count; i++) {
+        xcb_window_t window = (xcb_window_t)[[windows objectAtIndex:i] unsignedLongValue];
+        for (int a = 0; a < kMenuAtomCount; a++) {
+            cookies[i * kMenuAtomCount + a] = xcb_get_property(conn, 0, window, (xcb_atom_t)_menuAtoms[a],
+                                                               XCB_GET_PROPERTY_TYPE_ANY, 0, kMaxPropertyLength);
+        }
+    }
+    _roundTrips++;
+
+    for (NSUInteger i = 0; i < count; i++) {
+        NSString *values[kMenuAtomCount];
+        for (int a = 0; a < kMenuAtomCount; a++) {
+            values[a] = nil;
+            xcb_generic_error_t *error = NULL;
+            xcb_get_property_reply_t *reply = xcb_get_property_reply(conn, cookies[i * kMenuAtomCount + a], &error);
+            if (error) {
+                free(error);
+            }
+            if (!reply) {
+                continue;
+            }
+            int length = xcb_get_property_value_length(reply);
+            if (reply->format == 8 && length > 0) {
+                NSString *value = [[NSString alloc] initWithBytes:xcb_get_property_value(reply)
+                                                           length:length
+                                                         encoding:NSUTF8StringEncoding];
+                values[a] = [value autorelease];
+            }
+            free(reply);
+        }
+
+        NSArray *entry = nil;
+        if ([values[kMenuAtomGTKBusName] length] > 0 && [values[kMenuAtomGTKMenubarPath] length] > 0) {
+            entry = [NSArray arrayWithObjects:[NSNumber numberWithInteger:MenuProtocolTypeGTK],
+                     values[kMenuAtomGTKBusName], values[kMenuAtomGTKMenubarPath], nil];
+        } else if ([values[kMenuAtomKDEService] length] > 0 && [values[kMenuAtomKDEPath] length] > 0) {
+            entry = [NSArray arrayWithObjects:[NSNumber numberWithInteger:MenuProtocolTypeCanonical],
+                     values[kMenuAtomKDEService], values[kMenuAtomKDEPath], nil];
+        }
+
+        [self applyMenuEntry:entry forWindow:[windows objectAtIndex:i] registering:registering];
+    }
+
+    free(cookies);
+}
+
+- (void)applyMenuEntry:(NSArray *)entry forWindow:(NSNumber *)windowKey registering:(BOOL)registering
+{
+    NSArray *previous = [_windowMenus objectForKey:windowKey];
+    if ((!entry && !previous) || [entry isEqualToArray:previous]) {
+        return;
+    }
+
+    if (!entry) {
+        [self forgetWindow:windowKey];
+        return;
+    }
+
+    [_windowMenus setObject:entry forKey:windowKey];
+    if (registering) {
+        [[MenuProtocolManager sharedManager] registerWindow:[windowKey unsignedLongValue]
+                                                serviceName:[entry objectAtIndex:1]
+                                                 objectPath:[entry objectAtIndex:2]
+                                               protocolType:[[entry objectAtIndex:0] integerValue]];
+    }
+}
+
+- (void)forgetWindow:(NSNumber *)windowKey
+{
+    if ([_windowMenus objectForKey:windowKey]) {
+        [[MenuProtocolManager sharedManager] unregisterWindow:[windowKey unsignedLongValue]];
+        [_windowMenus removeObjectForKey:windowKey];
+    }
+}
+
+@end
@@ -0,0 +1,168 @@
+/*
+ * control-bench - time to apply configuration changes to globalshortcutsd
+ *
+ *   control-bench [-n COUNT] SOCKET
+ *       Connects to the daemon's control socket and times COUNT round trips
+ *       of a single-binding "replace" (the delta path) and of "reload" (the
+ *       full reread and regrab that SIGHUP does), then restores the
+ *       configuration it started with.
+ *
+ * A round trip ends when the daemon has updated its table and grabs and
+ * answered, so it is the time an edit in the preference pane takes to apply.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Not in the benchmark configuration, which uses ctrl, alt, shift and mod4
+#define BENCH_COMBO_A "mod5+ctrl+a"
+#define BENCH_COMBO_B "mod5+ctrl+b"
+
+static char replyBuffer[65536];
+static size_t replyLength;
+
+static long long nowNanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: control-bench [-n COUNT] SOCKET\n");
+    exit(2);
+}
+
+static int compareLongLong(const void *a, const void *b)
+{
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Sends one request line and reads up to its ok or error line; returns 0 on ok
+static int request(int fd, const char *line)
+{
+    size_t length = strlen(line);
+    while (length > 0) {
+        ssize_t written = write(fd, line, length);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return -1;
+        }
+        line += written;
+        length -= written;
+    }
+
+    for (;;) {
+        char *newline;
+        while ((newline = memchr(replyBuffer, '\n', replyLength)) != NULL) {
+            size_t lineLength = newline - replyBuffer + 1;
+            int isOk = strncmp(replyBuffer, "ok", 2) == 0;
+            int isError = strncmp(replyBuffer, "error", 5) == 0;
+            if (isError) {
+                fprintf(stderr, "control-bench: %.*s", (int)lineLength, replyBuffer);
+            }
+            memmove(replyBuffer, newline + 1, replyLength - lineLength);
+            replyLength -= lineLength;
+            if (isOk || isError) {
+                return isOk ? 0 : -1;
+            }
+        }
+        if (replyLength == sizeof(replyBuffer)) {
+            return -1;
+        }
+        ssize_t count = read(fd, replyBuffer + replyLength, sizeof(replyBuffer) - replyLength);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return -1;
+        }
+        replyLength += count;
+    }
+}
+
+static void report(const char *name, long long *times, int count)
+{
+    qsort(times, count, sizeof(long long), compareLongLong);
+    printf("%-8s n=%-4d p50=%8.3f ms  p95=%8.3f ms  max=%8.3f ms\n", name, count,
+           times[(count - 1) / 2] / 1e6,
+           times[(count * 95 + 99) / 100 - 1] / 1e6,
+           times[count - 1] / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    int count = 100;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n') {
+            count = atoi(optarg);
+        } else {
+            usage();
+        }
+    }
+    if (argc - optind != 1 || count <= 0) {
+        usage();
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(argv[optind]) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "control-bench: socket path too long\n");
+        return 1;
+    }
+    strncpy(address.sun_path, argv[optind], sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        fprintf(stderr, "control-bench: cannot connect to %s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+
+    if (request(fd, "status\n") != 0 || request(fd, "add\t" BENCH_COMBO_A "\ttrue\n") != 0) {
+        return 1;
+    }
+
+    long long *replaceTimes = malloc(sizeof(long long) * count);
+    long long *reloadTimes = malloc(sizeof(long long) * count);
+    int status = 0;
+
+    // Move the benchmark binding between two keys, so every replace regrabs
+    for (int i = 0; i < count && status == 0; i++) {
+        const char *line = (i % 2 == 0) ? "replace\t" BENCH_COMBO_A "\t" BENCH_COMBO_B "\ttrue\n"
+                                        : "replace\t" BENCH_COMBO_B "\t" BENCH_COMBO_A "\ttrue\n";
+        long long start = nowNanoseconds();
+        status = request(fd, line);
+        replaceTimes[i] = nowNanoseconds() - start;
+    }
+
+    // The reload rereads the defaults, which drops the benchmark binding
+    for (int i = 0; i < count && status == 0; i++) {
+        long long start = nowNanoseconds();
+        status = request(fd, "reload\n");
+        reloadTimes[i] = nowNanoseconds() - start;
+    }
+
+    if (status == 0) {
+        report("replace", replaceTimes, count);
+        report("reload", reloadTimes, count);
+    }
+
+    free(replaceTimes);
+    free(reloadTimes);
+    close(fd);
+    return status == 0 ? 0 : 1;
+}
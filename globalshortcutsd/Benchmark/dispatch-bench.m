@@ -0,0 +1,275 @@
+/*
+ * dispatch-bench - times globalshortcutsd's KeyPress dispatch against the
+ * per-keypress combo matching it replaced
+ *
+ *   dispatch-bench [-t SECONDS] [COUNT ...]
+ *
+ * For each COUNT (default 10 100 1000) a configuration of that many distinct
+ * shortcuts is generated, compiled into a ShortcutTable and resolved against
+ * the display's keyboard mapping, then every bound key is pressed in turn.
+ * The legacy matcher enumerates the configuration and reparses each combo
+ * until one matches, as eventLoop used to. Both must pick the same command.
+ *
+ * Needs an X display for the keyboard mapping; Xvfb is enough.
+ */
+
+#import <Foundation/Foundation.h>
+#include "../ShortcutTable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static double nowSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: dispatch-bench [-t SECONDS] [COUNT ...]\n");
+    exit(2);
+}
+
+// The matcher eventLoop ran for every configured combo on every KeyPress
+static NSString *legacyDispatch(Display *display, NSDictionary *shortcuts, KeyCode keycode, unsigned int state)
+{
+    NSEnumerator *enumerator = [shortcuts keyEnumerator];
+    NSString *keyCombo;
+
+    while ((keyCombo = [enumerator nextObject])) {
+        NSArray *parts = ShortcutComboComponents(keyCombo);
+        unsigned int modifier = 0;
+        NSString *keyString = nil;
+
+        for (NSUInteger i = 0; i < [parts count]; i++) {
+            NSString *part = [[parts objectAtIndex:i] lowercaseString];
+            if ([part isEqualToString:@"ctrl"] || [part isEqualToString:@"control"]) {
+                modifier |= ControlMask;
+            } else if ([part isEqualToString:@"shift"]) {
+                modifier |= ShiftMask;
+            } else if ([part isEqualToString:@"alt"] || [part isEqualToString:@"mod1"]) {
+                modifier |= Mod1Mask;
+            } else if ([part isEqualToString:@"mod2"]) {
+                modifier |= Mod2Mask;
+            } else if ([part isEqualToString:@"mod3"]) {
+                modifier |= Mod3Mask;
+            } else if ([part isEqualToString:@"mod4"]) {
+                modifier |= Mod4Mask;
+            } else if ([part isEqualToString:@"mod5"]) {
+                modifier |= Mod5Mask;
+            } else {
+                keyString = part;
+            }
+        }
+        if (!keyString) {
+            continue;
+        }
+
+        KeyCode comboKeycode;
+        if ([keyString hasPrefix:@"code:"]) {
+            comboKeycode = [[keyString substringFromIndex:5] intValue];
+        } else {
+            comboKeycode = XKeysymToKeycode(display, ShortcutKeysymForName(keyString));
+        }
+
+        if (comboKeycode == keycode && modifier == state) {
+            return [shortcuts objectForKey:keyCombo];
+        }
+    }
+    return nil;
+}
+
+// Distinct combos in the order they are handed out: named keys under every
+// mix of ctrl, shift, alt and mod4, then raw keycodes under mod3
+static NSArray *generateCombos(Display *display, NSUInteger count)
+{
+    static const char *keys[] = {
+        "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m",
+        "n", "o", "p", "q", "r", "s", "t", "u", "v", "w", "x", "y", "z",
+        "0", "1", "2", "3", "4", "5", "6", "7", "8", "9",
+        "f1", "f2", "f3", "f4", "f5", "f6", "f7", "f8", "f9", "f10", "f11", "f12",
+        "space", "return", "tab", "escape", "backspace", "delete", "home", "end",
+        "page_up", "page_down", "up", "down", "left", "right",
+        "minus", "equal", "comma", "period", "slash", "semicolon", "apostrophe",
+        "bracketleft", "bracketright", "backslash", "grave",
+        "volume_up", "volume_down", "volume_mute", "play_pause", "next", "prev"
+    };
+    static const char *modifiers[] = { "ctrl", "shift", "alt", "mod4" };
+
+    NSMutableArray *combos = [NSMutableArray arrayWithCapacity:count];
+    NSMutableSet *seen = [NSMutableSet set];
+
+    for (unsigned int set = 1; set < 16 && [combos count] < count; set++) {
+        NSMutableString *prefix = [NSMutableString string];
+        for (int m = 0; m < 4; m++) {
+            if (set & (1u << m)) {
+                [prefix appendFormat:@"%s+", modifiers[m]];
+            }
+        }
+        for (size_t k = 0; k < sizeof(keys) / sizeof(keys[0]) && [combos count] < count; k++) {
+            NSString *combo = [NSString stringWithFormat:@"%@%s", prefix, keys[k]];
+            ShortcutCombo parsed;
+            if (ShortcutComboParse(combo, &parsed, NULL) != ShortcutComboValid) {
+                continue;
+            }
+            KeyCode keycode = XKeysymToKeycode(display, parsed.keysym);
+            NSNumber *key = [NSNumber numberWithUnsignedInt:(keycode << 8) | parsed.modifiers];
+            if (keycode == 0 || [seen containsObject:key]) {
+                continue;
+            }
+            [seen addObject:key];
+            [combos addObject:combo];
+        }
+    }
+
+    for (int code = 8; code < 256 && [combos count] < count; code++) {
+        [combos addObject:[NSString stringWithFormat:@"ctrl+mod3+code:%d", code]];
+    }
+    for (int code = 8; code < 256 && [combos count] < count; code++) {
+        [combos addObject:[NSString stringWithFormat:@"shift+mod3+code:%d", code]];
+    }
+    for (int code = 8; code < 256 && [combos count] < count; code++) {
+        [combos addObject:[NSString stringWithFormat:@"alt+mod3+code:%d", code]];
+    }
+
+    return combos;
+}
+
+static int runBenchmark(Display *display, NSUInteger count, double budget)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSArray *combos = generateCombos(display, count);
+    NSMutableDictionary *shortcuts = [NSMutableDictionary dictionary];
+    for (NSUInteger i = 0; i < [combos count]; i++) {
+        [shortcuts setObject:[NSString stringWithFormat:@"command-%lu", (unsigned long)i]
+                      forKey:[combos objectAtIndex:i]];
+    }
+
+    // Compile the way globalshortcutsd does on load, then resolve as on grab
+    double start = nowSeconds();
+    ShortcutTable *table = [[ShortcutTable alloc] init];
+    for (NSString *combo in shortcuts) {
+        ShortcutCombo parsed;
+        if (ShortcutComboParse(combo, &parsed, NULL) == ShortcutComboValid) {
+            [table addCombo:&parsed string:combo command:[shortcuts objectForKey:combo]];
+        }
+    }
+    [table resolveKeycodesForDisplay:display];
+    double buildSeconds = nowSeconds() - start;
+
+    // Press every bound key once per round, in a fixed shuffled order
+    NSUInteger presses = [table bindingCount];
+    KeyCode *keycodes = malloc(sizeof(KeyCode) * presses);
+    unsigned int *states = malloc(sizeof(unsigned int) * presses);
+    for (NSUInteger i = 0; i < presses; i++) {
+        const ShortcutBinding *binding = [table bindingAtIndex:i];
+        keycodes[i] = binding->keycode;
+        states[i] = binding->combo.modifiers;
+    }
+    srandom(1);
+    for (NSUInteger i = presses; i > 1; i--) {
+        NSUInteger j = random() % i;
+        KeyCode keycode = keycodes[i - 1];
+        unsigned int state = states[i - 1];
+        keycodes[i - 1] = keycodes[j];
+        states[i - 1] = states[j];
+        keycodes[j] = keycode;
+        states[j] = state;
+    }
+
+    unsigned long mismatches = 0;
+    for (NSUInteger i = 0; i < presses; i++) {
+        NSAutoreleasePool *checkPool = [[NSAutoreleasePool alloc] init];
+        const ShortcutBinding *binding = [table bindingForKeycode:keycodes[i] state:states[i]];
+        NSString *legacy = legacyDispatch(display, shortcuts, keycodes[i], states[i]);
+        if (!binding || ![binding->command isEqualToString:legacy]) {
+            fprintf(stderr, "dispatch-bench: dispatch differs for keycode=%d state=0x%x\n",
+                    keycodes[i], states[i]);
+            mismatches++;
+        }
+        [checkPool release];
+    }
+
+    unsigned long legacyPresses = 0;
+    start = nowSeconds();
+    double legacySeconds;
+    do {
+        NSAutoreleasePool *roundPool = [[NSAutoreleasePool alloc] init];
+        for (NSUInteger i = 0; i < presses; i++) {
+            legacyDispatch(display, shortcuts, keycodes[i], states[i]);
+        }
+        legacyPresses += presses;
+        [roundPool release];
+        legacySeconds = nowSeconds() - start;
+    } while (legacySeconds < budget);
+
+    unsigned long tablePresses = 0;
+    unsigned long found = 0;
+    start = nowSeconds();
+    double tableSeconds;
+    do {
+        for (NSUInteger i = 0; i < presses; i++) {
+            if ([table bindingForKeycode:keycodes[i] state:states[i]]) {
+                found++;
+            }
+        }
+        tablePresses += presses;
+        tableSeconds = nowSeconds() - start;
+    } while (tableSeconds < budget);
+
+    double legacyNs = legacySeconds * 1e9 / legacyPresses;
+    double tableNs = tableSeconds * 1e9 / tablePresses;
+    printf("%6lu shortcuts  build %8.1f us  legacy %10.1f ns/keypress  table %6.1f ns/keypress  %8.0fx\n",
+           (unsigned long)presses, buildSeconds * 1e6, legacyNs, tableNs, legacyNs / tableNs);
+
+    free(keycodes);
+    free(states);
+    [table release];
+    [pool release];
+    return (mismatches || found != tablePresses) ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    double budget = 0.5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        if (opt == 't') {
+            budget = atof(optarg);
+        } else {
+            usage();
+        }
+    }
+    if (budget <= 0) {
+        usage();
+    }
+
+    Display *display = XOpenDisplay(NULL);
+    if (!display) {
+        fprintf(stderr, "dispatch-bench: cannot open display (run under Xvfb)\n");
+        return 1;
+    }
+
+    int failed = 0;
+    if (optind == argc) {
+        failed |= runBenchmark(display, 10, budget);
+        failed |= runBenchmark(display, 100, budget);
+        failed |= runBenchmark(display, 1000, budget);
+    }
+    for (int i = optind; i < argc; i++) {
+        int count = atoi(argv[i]);
+        if (count <= 0) {
+            usage();
+        }
+        failed |= runBenchmark(display, count, budget);
+    }
+
+    XCloseDisplay(display);
+    [pool release];
+    return failed;
+}
@@ -0,0 +1,195 @@
+/*
+ * latency-probe - keypress-to-exec latency of globalshortcutsd
+ *
+ *   latency-probe stamp FILE
+ *       Writes the current CLOCK_MONOTONIC time to FILE. Bind it to a
+ *       shortcut; it is the command globalshortcutsd runs.
+ *   latency-probe press [-n COUNT] [-i INTERVAL_MS] [-s KEYSYM] KEYSYM STAMP
+ *       Presses Control+Alt+KEYSYM through XTest COUNT times and reports how
+ *       long each press took to reach the stamp command. With -s, each press
+ *       is followed by the -s key on its own, for a key sequence such as
+ *       "ctrl+alt+f12 t"; the time is measured from that second stroke.
+ *
+ * Both modes run on the same machine, so the monotonic clocks agree.
+ */
+
+#include <X11/Xlib.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XTest.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static long long nowNanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: latency-probe stamp FILE\n"
+                    "       latency-probe press [-n COUNT] [-i INTERVAL_MS] [-s KEYSYM] KEYSYM STAMP\n");
+    exit(2);
+}
+
+static int stamp(const char *path)
+{
+    long long now = nowNanoseconds();
+    char temp[4096];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+
+    // Written aside and renamed, so the presser never reads half a stamp
+    FILE *file = fopen(temp, "w");
+    if (!file) {
+        return 1;
+    }
+    fprintf(file, "%lld\n", now);
+    if (fclose(file) != 0 || rename(temp, path) != 0) {
+        return 1;
+    }
+    return 0;
+}
+
+static int compareLongLong(const void *a, const void *b)
+{
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static void fakeKey(Display *display, KeyCode keycode, Bool press)
+{
+    XTestFakeKeyEvent(display, keycode, press, CurrentTime);
+}
+
+static int press(int argc, char **argv)
+{
+    int count = 50;
+    int interval = 200;
+    const char *secondName = NULL;
+    int opt;
+
+    optind = 2;
+    while ((opt = getopt(argc, argv, "n:i:s:")) != -1) {
+        if (opt == 'n') {
+            count = atoi(optarg);
+        } else if (opt == 'i') {
+            interval = atoi(optarg);
+        } else if (opt == 's') {
+            secondName = optarg;
+        } else {
+            usage();
+        }
+    }
+    if (argc - optind != 2 || count <= 0 || interval < 0) {
+        usage();
+    }
+    const char *keyName = argv[optind];
+    const char *stampPath = argv[optind + 1];
+
+    Display *display = XOpenDisplay(NULL);
+    if (!display) {
+        fprintf(stderr, "latency-probe: cannot open display\n");
+        return 1;
+    }
+    int eventBase, errorBase, major, minor;
+    if (!XTestQueryExtension(display, &eventBase, &errorBase, &major, &minor)) {
+        fprintf(stderr, "latency-probe: the X server has no XTest extension\n");
+        return 1;
+    }
+
+    KeyCode control = XKeysymToKeycode(display, XK_Control_L);
+    KeyCode alt = XKeysymToKeycode(display, XK_Alt_L);
+    KeyCode key = XKeysymToKeycode(display, XStringToKeysym(keyName));
+    if (!control || !alt || !key) {
+        fprintf(stderr, "latency-probe: no keycode for Control_L, Alt_L or %s\n", keyName);
+        return 1;
+    }
+    KeyCode second = secondName ? XKeysymToKeycode(display, XStringToKeysym(secondName)) : 0;
+    if (secondName && !second) {
+        fprintf(stderr, "latency-probe: no keycode for %s\n", secondName);
+        return 1;
+    }
+
+    long long *latencies = malloc(sizeof(long long) * count);
+    int measured = 0;
+
+    for (int i = 0; i < count; i++) {
+        unlink(stampPath);
+
+        fakeKey(display, control, True);
+        fakeKey(display, alt, True);
+        XSync(display, False);
+
+        long long pressed = nowNanoseconds();
+        fakeKey(display, key, True);
+        fakeKey(display, key, False);
+        fakeKey(display, alt, False);
+        fakeKey(display, control, False);
+        XFlush(display);
+
+        if (second) {
+            // Let the daemon take the keyboard for the rest of the sequence
+            XSync(display, False);
+            usleep(20000);
+            pressed = nowNanoseconds();
+            fakeKey(display, second, True);
+            fakeKey(display, second, False);
+            XFlush(display);
+        }
+
+        // Wait up to two seconds for the command to run
+        long long ran = 0;
+        while (nowNanoseconds() - pressed < 2000000000LL) {
+            FILE *file = fopen(stampPath, "r");
+            if (file) {
+                if (fscanf(file, "%lld", &ran) != 1) {
+                    ran = 0;
+                }
+                fclose(file);
+                if (ran) {
+                    break;
+                }
+            }
+            usleep(100);
+        }
+
+        if (ran) {
+            latencies[measured++] = ran - pressed;
+        } else {
+            fprintf(stderr, "latency-probe: press %d did not run the command\n", i + 1);
+        }
+        usleep(interval * 1000);
+    }
+
+    XCloseDisplay(display);
+
+    if (measured == 0) {
+        free(latencies);
+        return 1;
+    }
+    qsort(latencies, measured, sizeof(long long), compareLongLong);
+    printf("keypress-to-exec n=%-4d p50=%8.2f ms  p95=%8.2f ms  max=%8.2f ms\n", measured,
+           latencies[(measured - 1) / 2] / 1e6,
+           latencies[(measured * 95 + 99) / 100 - 1] / 1e6,
+           latencies[measured - 1] / 1e6);
+    free(latencies);
+    return measured == count ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 3 && strcmp(argv[1], "stamp") == 0) {
+        return stamp(argv[2]);
+    }
+    if (argc >= 2 && strcmp(argv[1], "press") == 0) {
+        return press(argc, argv);
+    }
+    usage();
+    return 2;
+}
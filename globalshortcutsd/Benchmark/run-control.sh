@@ -0,0 +1,91 @@
+#!/bin/sh
+# Headless globalshortcutsd benchmark: runs the daemon on a private Xvfb
+# display with a generated configuration and times single-binding edits over
+# its control socket against full reloads.
+#
+# Usage: run-control.sh [-c shortcuts] [-n edits] [-d display]
+#
+# globalshortcutsd refuses to start while another instance runs, so stop the
+# session's daemon first.
+
+SHORTCUTS=500
+EDITS=100
+XDISPLAY=:97
+
+while getopts "c:n:d:" opt; do
+    case $opt in
+        c) SHORTCUTS=$OPTARG ;;
+        n) EDITS=$OPTARG ;;
+        d) XDISPLAY=$OPTARG ;;
+        *) echo "Usage: $0 [-c shortcuts] [-n edits] [-d display]"; exit 2 ;;
+    esac
+done
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+DAEMON=${DAEMON:-$HERE/../obj/globalshortcutsd}
+BENCH=${BENCH:-$HERE/obj/control-bench}
+
+for tool in Xvfb defaults "$DAEMON" "$BENCH"; do
+    if ! command -v "$tool" >/dev/null 2>&1; then
+        echo "Missing $tool (build globalshortcutsd and Benchmark with gmake first)"
+        exit 1
+    fi
+done
+
+# Fresh HOME and runtime directory, so only the generated shortcuts are
+# configured and the socket is our own
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/globalshortcuts-bench.XXXXXX")
+mkdir -p "$WORK/home" "$WORK/run"
+chmod 700 "$WORK/run"
+export HOME=$WORK/home
+export XDG_RUNTIME_DIR=$WORK/run
+export DISPLAY=$XDISPLAY
+
+echo "Starting Xvfb on $XDISPLAY..."
+Xvfb "$XDISPLAY" -screen 0 1024x768x24 -nolisten tcp >"$WORK/xvfb.log" 2>&1 &
+XVFB_PID=$!
+sleep 1
+
+# Every non-empty subset of four modifiers times 48 keys: up to 720 distinct
+# combos, written as one dictionary
+CONFIG=$(awk -v count="$SHORTCUTS" 'BEGIN {
+    split("ctrl alt shift mod4", mods, " ")
+    keys = "a b c d e f g h i j k l m n o p q r s t u v w x y z 0 1 2 3 4 5 6 7 8 9"
+    for (f = 1; f <= 12; f++) keys = keys " f" f
+    nkeys = split(keys, key, " ")
+    printf "{"
+    n = 0
+    for (m = 1; m < 16 && n < count; m++) {
+        prefix = ""
+        for (b = 0; b < 4; b++) if (int(m / 2 ^ b) % 2) prefix = prefix mods[b + 1] "+"
+        for (k = 1; k <= nkeys && n < count; k++) {
+            printf "\"%s%s\" = \"true\"; ", prefix, key[k]
+            n++
+        }
+    }
+    printf "}"
+}')
+defaults write GlobalShortcuts "$CONFIG"
+
+"$DAEMON" >"$WORK/daemon.log" 2>&1 &
+DAEMON_PID=$!
+sleep 2
+
+STATUS=0
+if kill -0 $DAEMON_PID 2>/dev/null; then
+    echo "Configured shortcuts: $SHORTCUTS"
+    "$BENCH" -n "$EDITS" "$XDG_RUNTIME_DIR/globalshortcutsd.sock" || STATUS=1
+else
+    STATUS=1
+fi
+
+kill -TERM $DAEMON_PID 2>/dev/null
+wait $DAEMON_PID 2>/dev/null
+kill $XVFB_PID 2>/dev/null
+wait $XVFB_PID 2>/dev/null
+
+if [ $STATUS -ne 0 ]; then
+    echo "Benchmark failed; logs are in $WORK"
+    exit 1
+fi
+rm -rf "$WORK"
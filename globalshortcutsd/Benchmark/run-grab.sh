@@ -0,0 +1,120 @@
+#!/bin/sh
+# Headless globalshortcutsd benchmark: time to grab the keys of a generated
+# configuration, with core grabs and with XInput2, for single combos and for
+# key sequences sharing a few prefixes.
+#
+# Usage: run-grab.sh [-c bindings] [-r runs] [-d display]
+#
+# globalshortcutsd refuses to start while another instance runs, so stop the
+# session's daemon first.
+
+BINDINGS=300
+RUNS=5
+XDISPLAY=:98
+
+while getopts "c:r:d:" opt; do
+    case $opt in
+        c) BINDINGS=$OPTARG ;;
+        r) RUNS=$OPTARG ;;
+        d) XDISPLAY=$OPTARG ;;
+        *) echo "Usage: $0 [-c bindings] [-r runs] [-d display]"; exit 2 ;;
+    esac
+done
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+DAEMON=${DAEMON:-$HERE/../obj/globalshortcutsd}
+
+for tool in Xvfb defaults "$DAEMON"; do
+    if ! command -v "$tool" >/dev/null 2>&1; then
+        echo "Missing $tool (build globalshortcutsd with gmake first)"
+        exit 1
+    fi
+done
+
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/globalshortcuts-bench.XXXXXX")
+mkdir -p "$WORK/home" "$WORK/run"
+chmod 700 "$WORK/run"
+export HOME=$WORK/home
+export XDG_RUNTIME_DIR=$WORK/run
+export DISPLAY=$XDISPLAY
+
+echo "Starting Xvfb on $XDISPLAY..."
+Xvfb "$XDISPLAY" -screen 0 1024x768x24 -nolisten tcp >"$WORK/xvfb.log" 2>&1 &
+XVFB_PID=$!
+sleep 1
+
+# singles: every non-empty subset of four modifiers times 48 keys
+# sequences: ctrl+alt+f1 .. ctrl+alt+f12 as prefixes, each followed by a-z
+generate() {
+    awk -v count="$BINDINGS" -v kind="$1" 'BEGIN {
+        split("ctrl alt shift mod4", mods, " ")
+        keys = "a b c d e f g h i j k l m n o p q r s t u v w x y z 0 1 2 3 4 5 6 7 8 9"
+        for (f = 1; f <= 12; f++) keys = keys " f" f
+        nkeys = split(keys, key, " ")
+        printf "{"
+        n = 0
+        if (kind == "sequences") {
+            for (k = 1; k <= 26 && n < count; k++) {
+                for (p = 1; p <= 12 && n < count; p++) {
+                    printf "\"ctrl+alt+f%d %s\" = \"true\"; ", p, key[k]
+                    n++
+                }
+            }
+        } else {
+            for (m = 1; m < 16 && n < count; m++) {
+                prefix = ""
+                for (b = 0; b < 4; b++) if (int(m / 2 ^ b) % 2) prefix = prefix mods[b + 1] "+"
+                for (k = 1; k <= nkeys && n < count; k++) {
+                    printf "\"%s%s\" = \"true\"; ", prefix, key[k]
+                    n++
+                }
+            }
+        }
+        printf "}"
+    }'
+}
+
+# Prints the daemon's "Successfully grabbed N keys for M shortcuts in T ms" line
+grab() {
+    "$DAEMON" $1 >"$WORK/daemon.log" 2>&1 &
+    DAEMON_PID=$!
+    for i in 1 2 3 4 5 6 7 8 9 10; do
+        grep -q "Successfully grabbed" "$WORK/daemon.log" && break
+        sleep 0.5
+    done
+    kill -TERM $DAEMON_PID 2>/dev/null
+    wait $DAEMON_PID 2>/dev/null
+    sed -n 's/.*Successfully grabbed \([0-9]*\) keys for \([0-9]*\) shortcuts in \([0-9.]*\) ms.*/\1 \2 \3/p' "$WORK/daemon.log"
+}
+
+STATUS=0
+for kind in singles sequences; do
+    defaults write GlobalShortcuts "$(generate $kind)"
+    for mode in core xinput2; do
+        OPTIONS=
+        [ $mode = xinput2 ] && OPTIONS=--xinput2
+        TIMES=
+        RESULT=
+        for run in $(seq "$RUNS"); do
+            RESULT=$(grab "$OPTIONS")
+            if [ -z "$RESULT" ]; then
+                STATUS=1
+                break
+            fi
+            TIMES="$TIMES $(echo "$RESULT" | cut -d' ' -f3)"
+        done
+        [ -z "$RESULT" ] && continue
+        set -- $RESULT
+        MEDIAN=$(printf '%s\n' $TIMES | sort -g | awk '{ t[NR] = $1 } END { print t[int((NR + 1) / 2)] }')
+        printf '%-9s %-7s shortcuts=%-4s grabbed keys=%-4s median=%s ms\n' "$kind" "$mode" "$2" "$1" "$MEDIAN"
+    done
+done
+
+kill $XVFB_PID 2>/dev/null
+wait $XVFB_PID 2>/dev/null
+
+if [ $STATUS -ne 0 ]; then
+    echo "Benchmark failed; logs are in $WORK"
+    exit 1
+fi
+rm -rf "$WORK"
@@ -0,0 +1,97 @@
+#!/bin/sh
+# Headless globalshortcutsd benchmark: runs the daemon on a private Xvfb
+# display with one shortcut bound to "latency-probe stamp", counts its
+# wakeups while idle and measures keypress-to-exec latency with XTest.
+#
+# Usage: run-latency.sh [-n presses] [-i interval_ms] [-s idle_seconds] [-W] [-X] [-S] [-d display]
+#
+# -W starts the daemon with --warm-helper, so commands are spawned by its
+# pre-forked helper; compare the latencies with and without it.
+# -X starts it with --xinput2, so keys are grabbed and read through XInput2.
+# -S binds the key sequence "ctrl+alt+f12 t" instead of ctrl+alt+f12 and
+# presses both strokes; the probe fails if the sequence does not run.
+#
+# globalshortcutsd refuses to start while another instance runs, so stop the
+# session's daemon first.
+
+PRESSES=50
+INTERVAL=200
+IDLE=10
+WARM=
+XINPUT2=
+COMBO=ctrl+alt+f12
+SECOND=
+XDISPLAY=:96
+
+while getopts "n:i:s:WXSd:" opt; do
+    case $opt in
+        n) PRESSES=$OPTARG ;;
+        i) INTERVAL=$OPTARG ;;
+        s) IDLE=$OPTARG ;;
+        W) WARM=--warm-helper ;;
+        X) XINPUT2=--xinput2 ;;
+        S) COMBO="ctrl+alt+f12 t"; SECOND="-s t" ;;
+        d) XDISPLAY=$OPTARG ;;
+        *) echo "Usage: $0 [-n presses] [-i interval_ms] [-s idle_seconds] [-W] [-X] [-S] [-d display]"; exit 2 ;;
+    esac
+done
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+DAEMON=${DAEMON:-$HERE/../obj/globalshortcutsd}
+PROBE=${PROBE:-$HERE/obj/latency-probe}
+
+for tool in Xvfb defaults "$DAEMON" "$PROBE"; do
+    if ! command -v "$tool" >/dev/null 2>&1; then
+        echo "Missing $tool (build globalshortcutsd and Benchmark with gmake first)"
+        exit 1
+    fi
+done
+
+# Voluntary + involuntary context switches: one per wakeup of an idle process
+wakeups() {
+    if [ -r "/proc/$1/status" ]; then
+        awk '/ctxt_switches/ { n += $2 } END { print n }' "/proc/$1/status"
+    else
+        procstat -r "$1" | awk '/context switches/ { n += $NF } END { print n }'
+    fi
+}
+
+# Fresh HOME so only the benchmark shortcut is configured
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/globalshortcuts-bench.XXXXXX")
+mkdir -p "$WORK/home"
+export HOME=$WORK/home
+export DISPLAY=$XDISPLAY
+
+echo "Starting Xvfb on $XDISPLAY..."
+Xvfb "$XDISPLAY" -screen 0 1024x768x24 -nolisten tcp >"$WORK/xvfb.log" 2>&1 &
+XVFB_PID=$!
+sleep 1
+
+defaults write GlobalShortcuts "$COMBO" "$PROBE stamp $WORK/stamp"
+
+"$DAEMON" $WARM $XINPUT2 >"$WORK/daemon.log" 2>&1 &
+DAEMON_PID=$!
+sleep 2
+
+STATUS=0
+if kill -0 $DAEMON_PID 2>/dev/null; then
+    BEFORE=$(wakeups $DAEMON_PID)
+    sleep "$IDLE"
+    AFTER=$(wakeups $DAEMON_PID)
+    echo "Idle wakeups: $((AFTER - BEFORE)) in ${IDLE} s"
+
+    "$PROBE" press -n "$PRESSES" -i "$INTERVAL" $SECOND F12 "$WORK/stamp" || STATUS=1
+else
+    STATUS=1
+fi
+
+kill -TERM $DAEMON_PID 2>/dev/null
+wait $DAEMON_PID 2>/dev/null
+kill $XVFB_PID 2>/dev/null
+wait $XVFB_PID 2>/dev/null
+
+if [ $STATUS -ne 0 ]; then
+    echo "Benchmark failed; logs are in $WORK"
+    exit 1
+fi
+rm -rf "$WORK"
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2005 Simon Peter
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <Foundation/Foundation.h>
+#include <sys/types.h>
+#include <time.h>
+
+/*
+ * CommandLauncher
+ *
+ * Starts shortcut commands for globalshortcutsd.
+ *
+ * Executables are looked up in $PATH once and cached. The cache is warmed
+ * when the configuration is loaded. It is dropped when the modification time
+ * of any $PATH directory changes; those are checked at most once a second.
+ *
+ * Commands are started with posix_spawn, which uses vfork-style process
+ * creation where the system supports it, instead of forking the whole
+ * GNUstep process twice. A command with no shell syntax runs its executable
+ * directly; anything else runs through $SHELL -c as before. Children get a
+ * new session, /dev/null as stdio, and default signal dispositions. They are
+ * reaped when the daemon handles SIGCHLD.
+ *
+ * In warm helper mode a small process is forked before the daemon loads its
+ * configuration or connects to X. It receives spawn requests over a socket
+ * and starts the commands itself, so a launch never copies the daemon's
+ * address space. If the helper dies, commands are spawned directly again.
+ */
+
+@interface CommandLauncher : NSObject
+{
+    NSMutableDictionary *_resolvedPaths;    // Executable name -> full path, or NSNull if not in $PATH
+    NSArray *_searchPath;                   // $PATH directories
+    time_t *_directoryMTimes;               // Per _searchPath entry, -1 if it could not be read
+    time_t _lastValidation;
+    int _helperSocket;                      // -1 unless in warm helper mode
+    pid_t _helperPid;
+    BOOL _verbose;
+}
+
+- (void)setVerbose:(BOOL)verbose;
+
+// Forks the warm helper; call before the process has grown
+- (BOOL)startWarmHelper;
+
+// Resolves the command's executable so the first key press finds it cached
+- (void)warmCommand:(NSString *)command;
+
+// Full path of a command name in $PATH (or of a path containing a slash), nil if not executable
+- (NSString *)resolveExecutable:(NSString *)name;
+
+// Starts command with the already resolved executable; returns the child's pid or -1
+- (pid_t)launchCommand:(NSString *)command executable:(NSString *)executablePath;
+
+// Collects exited children; call on SIGCHLD
+- (void)reapChildren;
+
+@end
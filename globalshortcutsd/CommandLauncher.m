@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2005 Simon Peter
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include "CommandLauncher.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// Warm helper requests: a uint32_t length, then the executable path and
+// each argument, NUL-terminated. The reply is an int32_t pid or -errno.
+#define HelperRequestMax 8192
+#define HelperArgumentMax 256
+
+#pragma mark - Spawning
+
+// Characters that need $SHELL -c; anything else is split on spaces and run directly
+static BOOL needsShell(const char *command)
+{
+    return strpbrk(command, "\"'`$\\;|&<>(){}[]*?~#=!\t\n") != NULL;
+}
+
+static pid_t spawnProcess(const char *path, char *const argv[])
+{
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    sigset_t mask, defaults;
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+    pid_t pid = -1;
+    int error;
+
+    if ((error = posix_spawnattr_init(&attr)) != 0) {
+        errno = error;
+        return -1;
+    }
+    if ((error = posix_spawn_file_actions_init(&actions)) != 0) {
+        posix_spawnattr_destroy(&attr);
+        errno = error;
+        return -1;
+    }
+
+    // The daemon ignores SIGPIPE and SIGCHLD and handles the termination
+    // signals; commands start with nothing blocked and the defaults
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGCHLD);
+    sigaddset(&defaults, SIGPIPE);
+    sigaddset(&defaults, SIGHUP);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGQUIT);
+    sigaddset(&defaults, SIGTERM);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+
+    // Detach from the daemon's session, like the setsid() of the old double fork
+#ifdef POSIX_SPAWN_SETSID
+    flags |= POSIX_SPAWN_SETSID;
+#else
+    flags |= POSIX_SPAWN_SETPGROUP;
+    posix_spawnattr_setpgroup(&attr, 0);
+#endif
+    posix_spawnattr_setflags(&attr, flags);
+
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDWR, 0);
+    posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO, STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO, STDERR_FILENO);
+
+    error = posix_spawn(&pid, path, &actions, &attr, argv, environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return pid;
+}
+
+#pragma mark - Warm helper
+
+static int readFully(int fd, void *buffer, size_t length)
+{
+    char *bytes = buffer;
+    while (length > 0) {
+        ssize_t count = read(fd, bytes, length);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return -1;
+        }
+        bytes += count;
+        length -= count;
+    }
+    return 0;
+}
+
+static int writeFully(int fd, const void *buffer, size_t length)
+{
+    const char *bytes = buffer;
+    while (length > 0) {
+        ssize_t count = write(fd, bytes, length);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return -1;
+        }
+        bytes += count;
+        length -= count;
+    }
+    return 0;
+}
+
+// Runs in the forked helper; plain C only, the helper never touches the runtime
+static void helperMain(int sock)
+{
+    static char request[HelperRequestMax + 1];
+    char *argv[HelperArgumentMax + 1];
+
+    // The helper's children are collected by the kernel; they get the
+    // default SIGCHLD back when spawned
+    signal(SIGCHLD, SIG_IGN);
+
+    for (;;) {
+        uint32_t length;
+        if (readFully(sock, &length, sizeof(length)) != 0 || length == 0 || length > HelperRequestMax ||
+            readFully(sock, request, length) != 0) {
+            _exit(0);
+        }
+        request[length] = '\0';
+
+        char *end = request + length;
+        char *argument = request + strlen(request) + 1;
+        int argc = 0;
+        while (argument < end && argc < HelperArgumentMax) {
+            argv[argc++] = argument;
+            argument += strlen(argument) + 1;
+        }
+        argv[argc] = NULL;
+
+        int32_t result = -EINVAL;
+        if (argc > 0) {
+            pid_t pid = spawnProcess(request, argv);
+            result = pid > 0 ? (int32_t)pid : -errno;
+        }
+        if (writeFully(sock, &result, sizeof(result)) != 0) {
+            _exit(0);
+        }
+    }
+}
+
+@interface CommandLauncher (Private)
+- (void)validateCache;
+- (pid_t)spawnWithHelper:(NSString *)path arguments:(NSArray *)arguments;
+@end
+
+@implementation CommandLauncher
+
+- (id)init
+{
+    self = [super init];
+    if (self) {
+        _resolvedPaths = [[NSMutableDictionary alloc] init];
+        _helperSocket = -1;
+        _helperPid = -1;
+        _verbose = NO;
+
+        NSString *pathEnv = [[[NSProcessInfo processInfo] environment] objectForKey:@"PATH"];
+        if (!pathEnv) {
+            pathEnv = @"/usr/local/bin:/usr/bin:/bin";
+        }
+        NSMutableArray *directories = [NSMutableArray array];
+        for (NSString *directory in [pathEnv componentsSeparatedByString:@":"]) {
+            if ([directory length] > 0) {
+                [directories addObject:directory];
+            }
+        }
+        _searchPath = [directories copy];
+        _directoryMTimes = calloc([_searchPath count] + 1, sizeof(time_t));
+        _lastValidation = 0;
+        [self validateCache];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    // The helper exits when it reads end of file
+    if (_helperSocket >= 0) {
+        close(_helperSocket);
+    }
+    free(_directoryMTimes);
+    [_searchPath release];
+    [_resolvedPaths release];
+    [super dealloc];
+}
+
+- (void)setVerbose:(BOOL)verbose
+{
+    _verbose = verbose;
+}
+
+- (BOOL)startWarmHelper
+{
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) < 0) {
+        NSLog(@"CommandLauncher: Could not create helper socket: %s", strerror(errno));
+        return NO;
+    }
+    // Neither end may leak into the commands
+    fcntl(sockets[0], F_SETFD, FD_CLOEXEC);
+    fcntl(sockets[1], F_SETFD, FD_CLOEXEC);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        NSLog(@"CommandLauncher: Could not fork warm helper: %s", strerror(errno));
+        close(sockets[0]);
+        close(sockets[1]);
+        return NO;
+    }
+    if (pid == 0) {
+        close(sockets[0]);
+        helperMain(sockets[1]);
+        _exit(0);
+    }
+
+    close(sockets[1]);
+    _helperSocket = sockets[0];
+    _helperPid = pid;
+    NSLog(@"CommandLauncher: Warm helper started (pid %d)", pid);
+    return YES;
+}
+
+- (void)warmCommand:(NSString *)command
+{
+    if (![command isKindOfClass:[NSString class]] || [command length] == 0) {
+        return;
+    }
+    [self resolveExecutable:[[command componentsSeparatedByString:@" "] objectAtIndex:0]];
+}
+
+- (NSString *)resolveExecutable:(NSString *)name
+{
+    struct stat statbuf;
+
+    if ([name length] == 0) {
+        return nil;
+    }
+
+    // An absolute or relative path costs a single stat, so it is not cached
+    if ([name containsString:@"/"]) {
+        if (stat([name UTF8String], &statbuf) == 0 && (statbuf.st_mode & S_IXUSR)) {
+            return name;
+        }
+        return nil;
+    }
+
+    [self validateCache];
+
+    id cached = [_resolvedPaths objectForKey:name];
+    if (cached) {
+        return cached == [NSNull null] ? nil : cached;
+    }
+
+    NSString *found = nil;
+    for (NSString *directory in _searchPath) {
+        NSString *fullPath = [directory stringByAppendingPathComponent:name];
+        if (stat([fullPath UTF8String], &statbuf) == 0 && (statbuf.st_mode & S_IXUSR)) {
+            found = fullPath;
+            break;
+        }
+    }
+
+    // Misses are cached too; installing the program changes a directory's mtime
+    [_resolvedPaths setObject:(found ? (id)found : (id)[NSNull null]) forKey:name];
+    return found;
+}
+
+- (pid_t)launchCommand:(NSString *)command executable:(NSString *)executablePath
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSString *path = executablePath;
+    NSMutableArray *arguments = [NSMutableArray array];
+
+    if (!needsShell([command UTF8String])) {
+        for (NSString *word in [command componentsSeparatedByString:@" "]) {
+            if ([word length] > 0) {
+                [arguments addObject:word];
+            }
+        }
+    }
+    if ([arguments count] == 0 || [arguments count] > HelperArgumentMax) {
+        const char *shell = getenv("SHELL");
+        if (!shell || !*shell) {
+            shell = "/bin/sh";
+        }
+        path = [NSString stringWithUTF8String:shell];
+        [arguments setArray:[NSArray arrayWithObjects:path, @"-c", command, nil]];
+    }
+
+    // Whatever went wrong with the helper (request too long, helper gone, its
+    // posix_spawn failed), the command is still started directly
+    pid_t pid = -1;
+    BOOL spawnedByHelper = NO;
+    if (_helperSocket >= 0) {
+        pid = [self spawnWithHelper:path arguments:arguments];
+        spawnedByHelper = (pid >= 0);
+        if (pid < 0) {
+            NSLog(@"CommandLauncher: Warm helper could not start %@ (%s), spawning it directly", path, strerror(errno));
+        }
+    }
+    if (pid < 0) {
+        char *argv[HelperArgumentMax + 1];
+        NSUInteger argc = 0;
+        for (NSString *argument in arguments) {
+            argv[argc++] = (char *)[argument UTF8String];
+        }
+        argv[argc] = NULL;
+        pid = spawnProcess([path UTF8String], argv);
+    }
+
+    if (pid < 0) {
+        NSLog(@"CommandLauncher: Could not start %@: %s", path, strerror(errno));
+    } else if (_verbose) {
+        NSLog(@"CommandLauncher: Started %@ (pid %d%@)", path, pid, spawnedByHelper ? @", warm helper" : @"");
+    }
+
+    [pool release];
+    return pid;
+}
+
+- (void)reapChildren
+{
+    int status;
+    pid_t pid;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        if (pid == _helperPid) {
+            NSLog(@"CommandLauncher: Warm helper (pid %d) exited, spawning commands directly", pid);
+            close(_helperSocket);
+            _helperSocket = -1;
+            _helperPid = -1;
+        } else if (_verbose && WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+            NSLog(@"CommandLauncher: Command (pid %d) exited with status %d", pid, WEXITSTATUS(status));
+        }
+    }
+}
+
+@end
+
+@implementation CommandLauncher (Private)
+
+- (void)validateCache
+{
+    time_t now = time(NULL);
+    if (now == _lastValidation) {
+        return;
+    }
+
+    // A directory modified within the second of the last check may have
+    // changed again without its mtime moving, so that check never counts as clean
+    BOOL changed = NO;
+    for (NSUInteger i = 0; i < [_searchPath count]; i++) {
+        struct stat statbuf;
+        time_t mtime = -1;
+        if (stat([[_searchPath objectAtIndex:i] UTF8String], &statbuf) == 0) {
+            mtime = statbuf.st_mtime;
+        }
+        if (mtime != _directoryMTimes[i] || mtime >= _lastValidation) {
+            changed = YES;
+        }
+        _directoryMTimes[i] = mtime;
+    }
+    _lastValidation = now;
+
+    if (changed && [_resolvedPaths count] > 0) {
+        if (_verbose) {
+            NSLog(@"CommandLauncher: $PATH changed, dropping %lu cached executables",
+                  (unsigned long)[_resolvedPaths count]);
+        }
+        [_resolvedPaths removeAllObjects];
+    }
+}
+
+- (pid_t)spawnWithHelper:(NSString *)path arguments:(NSArray *)arguments
+{
+    NSMutableData *request = [NSMutableData data];
+    uint32_t length = 0;
+    [request appendBytes:&length length:sizeof(length)];
+
+    const char *cPath = [path UTF8String];
+    [request appendBytes:cPath length:strlen(cPath) + 1];
+    for (NSString *argument in arguments) {
+        const char *cArgument = [argument UTF8String];
+        [request appendBytes:cArgument length:strlen(cArgument) + 1];
+    }
+
+    length = (uint32_t)([request length] - sizeof(length));
+    if (length > HelperRequestMax) {
+        errno = E2BIG;
+        return -1;
+    }
+    [request replaceBytesInRange:NSMakeRange(0, sizeof(length)) withBytes:&length];
+
+    int32_t result;
+    if (writeFully(_helperSocket, [request bytes], [request length]) != 0 ||
+        readFully(_helperSocket, &result, sizeof(result)) != 0) {
+        NSLog(@"CommandLauncher: Warm helper is not answering, spawning commands directly");
+        close(_helperSocket);
+        _helperSocket = -1;
+        return -1;
+    }
+
+    if (result < 0) {
+        errno = -result;
+        return -1;
+    }
+    return (pid_t)result;
+}
+
+@end
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2005 Simon Peter
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <Foundation/Foundation.h>
+#include <poll.h>
+
+/*
+ * ControlSocket
+ *
+ * globalshortcutsd's control protocol: a Unix stream socket that only the
+ * daemon's own user may connect to. Requests and replies are lines of
+ * tab-separated fields:
+ *
+ *   status                          ok <pid> <shortcuts> <bindings>
+ *   list                            binding <combo> <command> ... then ok <count>
+ *   add <combo> <command>           ok | error <message>
+ *   remove <combo>                  ok | error <message>
+ *   replace <old> <combo> <command> ok | error <message>
+ *   reload                          ok <shortcuts>   (rereads the defaults, like SIGHUP)
+ *   subscribe                       ok, then events as the configuration changes:
+ *                                   event added <combo> <command>
+ *                                   event removed <combo>
+ *                                   event reloaded <shortcuts>
+ *
+ * The socket lives in $XDG_RUNTIME_DIR, or in /tmp with the user id in its
+ * name. The daemon polls it together with the X connection. Client sockets
+ * are non-blocking: what a client's socket does not take at once is kept
+ * and sent as the socket drains, and a client that lets more than
+ * ControlSocketMaxPending bytes pile up is disconnected, so one that stops
+ * reading never holds up the daemon.
+ */
+
+#define ControlSocketMaxClients 16
+#define ControlSocketMaxPending (256 * 1024)
+
+@class ControlSocket;
+
+@protocol ControlSocketDelegate
+// Returns the reply lines, each an array of fields; the last one is the ok or error line
+- (NSArray *)controlSocket:(ControlSocket *)controlSocket handleRequest:(NSArray *)fields;
+@end
+
+@interface ControlSocket : NSObject
+{
+    id<ControlSocketDelegate> _delegate;                    // Not retained
+    NSString *_path;
+    int _listenFd;
+    int _clientFds[ControlSocketMaxClients];                // -1 for a free slot
+    NSMutableData *_clientBuffers[ControlSocketMaxClients]; // Bytes of an incomplete request line
+    NSMutableData *_clientOutput[ControlSocketMaxClients];  // Reply and event bytes the socket has not taken yet
+    BOOL _subscribed[ControlSocketMaxClients];
+}
+
++ (NSString *)defaultPath;
+
+- (id)initWithPath:(NSString *)path delegate:(id<ControlSocketDelegate>)delegate;
+
+// Binds and listens, replacing a stale socket file
+- (BOOL)open;
+- (void)close;
+
+// Adds the listening socket and every client, asking for POLLOUT where output
+// is pending; returns the number of entries written
+- (NSUInteger)addPollDescriptors:(struct pollfd *)fds;
+
+// Accepts, reads, answers and sends pending output; fds and count as filled
+// in by addPollDescriptors:
+- (void)handlePollDescriptors:(const struct pollfd *)fds count:(NSUInteger)count;
+
+// Sends "event" followed by fields to every subscribed client
+- (void)broadcastEvent:(NSArray *)fields;
+
+@end
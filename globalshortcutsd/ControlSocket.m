@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2005 Simon Peter
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // struct ucred
+#endif
+
+#include "ControlSocket.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Longest request line; a client that sends more without a newline is dropped
+#define ControlSocketMaxLine 4096
+
+static BOOL peerIsCurrentUser(int fd)
+{
+#ifdef SO_PEERCRED
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0) {
+        return NO;
+    }
+    return credentials.uid == getuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    if (getpeereid(fd, &uid, &gid) != 0) {
+        return NO;
+    }
+    return uid == getuid();
+#endif
+}
+
+@interface ControlSocket (Private)
+- (void)acceptClient;
+- (void)readClientAtSlot:(int)slot;
+- (BOOL)queueLine:(NSArray *)fields forSlot:(int)slot;
+- (BOOL)flushClientAtSlot:(int)slot;
+- (void)dropClientAtSlot:(int)slot;
+@end
+
+@implementation ControlSocket
+
++ (NSString *)defaultPath
+{
+    const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+    if (runtimeDir && *runtimeDir) {
+        return [[NSString stringWithUTF8String:runtimeDir] stringByAppendingPathComponent:@"globalshortcutsd.sock"];
+    }
+    return [NSString stringWithFormat:@"/tmp/globalshortcutsd-%u.sock", (unsigned int)getuid()];
+}
+
+- (id)initWithPath:(NSString *)path delegate:(id<ControlSocketDelegate>)delegate
+{
+    self = [super init];
+    if (self) {
+        _path = [path copy];
+        _delegate = delegate;
+        _listenFd = -1;
+        for (int i = 0; i < ControlSocketMaxClients; i++) {
+            _clientFds[i] = -1;
+            _clientBuffers[i] = nil;
+            _clientOutput[i] = nil;
+            _subscribed[i] = NO;
+        }
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [self close];
+    [_path release];
+    [super dealloc];
+}
+
+- (BOOL)open
+{
+    struct sockaddr_un address;
+    const char *cPath = [_path fileSystemRepresentation];
+
+    if (strlen(cPath) >= sizeof(address.sun_path)) {
+        NSLog(@"ControlSocket: Socket path too long: %@", _path);
+        return NO;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, cPath, sizeof(address.sun_path) - 1);
+
+    _listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (_listenFd < 0) {
+        NSLog(@"ControlSocket: Could not create socket: %s", strerror(errno));
+        return NO;
+    }
+    fcntl(_listenFd, F_SETFD, FD_CLOEXEC);
+    fcntl(_listenFd, F_SETFL, fcntl(_listenFd, F_GETFL) | O_NONBLOCK);
+
+    // Only one daemon runs per user, so an existing socket is left from a crash
+    unlink(cPath);
+
+    mode_t oldMask = umask(0077);
+    int bound = bind(_listenFd, (struct sockaddr *)&address, sizeof(address));
+    umask(oldMask);
+
+    if (bound < 0 || listen(_listenFd, 8) < 0) {
+        NSLog(@"ControlSocket: Could not listen on %@: %s", _path, strerror(errno));
+        close(_listenFd);
+        _listenFd = -1;
+        return NO;
+    }
+
+    NSLog(@"ControlSocket: Listening on %@", _path);
+    return YES;
+}
+
+- (void)close
+{
+    for (int i = 0; i < ControlSocketMaxClients; i++) {
+        [self dropClientAtSlot:i];
+    }
+    if (_listenFd >= 0) {
+        close(_listenFd);
+        _listenFd = -1;
+        unlink([_path fileSystemRepresentation]);
+    }
+}
+
+- (NSUInteger)addPollDescriptors:(struct pollfd *)fds
+{
+    NSUInteger count = 0;
+    if (_listenFd < 0) {
+        return 0;
+    }
+
+    fds[count].fd = _listenFd;
+    fds[count].events = POLLIN;
+    fds[count].revents = 0;
+    count++;
+
+    for (int i = 0; i < ControlSocketMaxClients; i++) {
+        if (_clientFds[i] >= 0) {
+            fds[count].fd = _clientFds[i];
+            fds[count].events = POLLIN | ([_clientOutput[i] length] > 0 ? POLLOUT : 0);
+            fds[count].revents = 0;
+            count++;
+        }
+    }
+    return count;
+}
+
+- (void)handlePollDescriptors:(const struct pollfd *)fds count:(NSUInteger)count
+{
+    for (NSUInteger i = 0; i < count; i++) {
+        if (fds[i].revents == 0) {
+            continue;
+        }
+        if (fds[i].fd == _listenFd) {
+            [self acceptClient];
+            continue;
+        }
+        for (int slot = 0; slot < ControlSocketMaxClients; slot++) {
+            if (_clientFds[slot] != fds[i].fd) {
+                continue;
+            }
+            if ((fds[i].revents & POLLOUT) && ![self flushClientAtSlot:slot]) {
+                [self dropClientAtSlot:slot];
+                break;
+            }
+            if (fds[i].revents & ~POLLOUT) {
+                [self readClientAtSlot:slot];
+            }
+            break;
+        }
+    }
+}
+
+- (void)broadcastEvent:(NSArray *)fields
+{
+    NSArray *line = [[NSArray arrayWithObject:@"event"] arrayByAddingObjectsFromArray:fields];
+    for (int i = 0; i < ControlSocketMaxClients; i++) {
+        if (_clientFds[i] >= 0 && _subscribed[i] && ![self queueLine:line forSlot:i]) {
+            [self dropClientAtSlot:i];
+        }
+    }
+}
+
+@end
+
+@implementation ControlSocket (Private)
+
+- (void)acceptClient
+{
+    int fd = accept(_listenFd, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    if (!peerIsCurrentUser(fd)) {
+        NSLog(@"ControlSocket: Rejected a client of another user");
+        close(fd);
+        return;
+    }
+
+    int slot = 0;
+    while (slot < ControlSocketMaxClients && _clientFds[slot] >= 0) {
+        slot++;
+    }
+    if (slot == ControlSocketMaxClients) {
+        NSLog(@"ControlSocket: Too many clients, rejecting one");
+        close(fd);
+        return;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    _clientFds[slot] = fd;
+    _clientBuffers[slot] = [[NSMutableData alloc] init];
+    _clientOutput[slot] = [[NSMutableData alloc] init];
+    _subscribed[slot] = NO;
+}
+
+- (void)readClientAtSlot:(int)slot
+{
+    char buffer[ControlSocketMaxLine];
+    ssize_t count = read(_clientFds[slot], buffer, sizeof(buffer));
+    if (count <= 0) {
+        if (count < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        [self dropClientAtSlot:slot];
+        return;
+    }
+
+    NSMutableData *pending = _clientBuffers[slot];
+    [pending appendBytes:buffer length:count];
+
+    for (;;) {
+        const char *bytes = [pending bytes];
+        const char *newline = memchr(bytes, '\n', [pending length]);
+        if (!newline) {
+            if ([pending length] > ControlSocketMaxLine) {
+                NSLog(@"ControlSocket: Request line too long, dropping client");
+                [self dropClientAtSlot:slot];
+            }
+            return;
+        }
+
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        NSUInteger lineLength = newline - bytes;
+        NSString *line = [[[NSString alloc] initWithBytes:bytes length:lineLength
+                                                 encoding:NSUTF8StringEncoding] autorelease];
+        [pending replaceBytesInRange:NSMakeRange(0, lineLength + 1) withBytes:NULL length:0];
+
+        NSArray *replies;
+        NSArray *fields = [line componentsSeparatedByString:@"\t"];
+        if (!line || [line length] == 0) {
+            replies = [NSArray arrayWithObject:[NSArray arrayWithObjects:@"error", @"malformed request", nil]];
+        } else if ([[fields objectAtIndex:0] isEqualToString:@"subscribe"]) {
+            _subscribed[slot] = YES;
+            replies = [NSArray arrayWithObject:[NSArray arrayWithObject:@"ok"]];
+        } else {
+            replies = [_delegate controlSocket:self handleRequest:fields];
+        }
+
+        // The request may have dropped this client (a failed broadcast)
+        BOOL alive = (_clientFds[slot] >= 0);
+        for (NSArray *reply in replies) {
+            if (alive && ![self queueLine:reply forSlot:slot]) {
+                alive = NO;
+            }
+        }
+        [pool release];
+
+        if (!alive) {
+            [self dropClientAtSlot:slot];
+            return;
+        }
+    }
+}
+
+- (void)dropClientAtSlot:(int)slot
+{
+    if (_clientFds[slot] < 0) {
+        return;
+    }
+    close(_clientFds[slot]);
+    _clientFds[slot] = -1;
+    [_clientBuffers[slot] release];
+    _clientBuffers[slot] = nil;
+    [_clientOutput[slot] release];
+    _clientOutput[slot] = nil;
+    _subscribed[slot] = NO;
+}
+
+// Appends a line to the client's output and sends what the socket takes.
+// Returns NO if the client has to be dropped: its socket failed, or it has
+// let more than ControlSocketMaxPending bytes pile up.
+- (BOOL)queueLine:(NSArray *)fields forSlot:(int)slot
+{
+    NSString *line = [[fields componentsJoinedByString:@"\t"] stringByAppendingString:@"\n"];
+    const char *bytes = [line UTF8String];
+    NSMutableData *output = _clientOutput[slot];
+
+    [output appendBytes:bytes length:strlen(bytes)];
+    if (![self flushClientAtSlot:slot]) {
+        return NO;
+    }
+    if ([output length] > ControlSocketMaxPending) {
+        NSLog(@"ControlSocket: Client is not reading, %lu bytes pending, dropping it",
+              (unsigned long)[output length]);
+        return NO;
+    }
+    return YES;
+}
+
+// Writes pending output until it is all sent or the socket is full (the
+// rest goes when poll reports POLLOUT); NO if the socket failed
+- (BOOL)flushClientAtSlot:(int)slot
+{
+    NSMutableData *output = _clientOutput[slot];
+    NSUInteger sent = 0;
+    NSUInteger length = [output length];
+    BOOL ok = YES;
+
+    while (sent < length) {
+        ssize_t written = write(_clientFds[slot], (const char *)[output bytes] + sent, length - sent);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (written <= 0) {
+            ok = NO;
+            break;
+        }
+        sent += written;
+    }
+    [output replaceBytesInRange:NSMakeRange(0, sent) withBytes:NULL length:0];
+    return ok;
+}
+
+@end
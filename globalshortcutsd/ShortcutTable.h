@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2005 Simon Peter
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <Foundation/Foundation.h>
+#include <X11/Xlib.h>
+#include <stdint.h>
+
+/*
+ * ShortcutTable
+ *
+ * The compiled form of the GlobalShortcuts domain. Every combo is parsed once,
+ * when the configuration is loaded, into a modifier mask and a keysym (or a
+ * raw keycode). The keysyms are then resolved against the display's keyboard
+ * mapping into a hash table keyed by (keycode, modifier mask), so a KeyPress
+ * is dispatched with a single probe.
+ *
+ * The parsed keysyms are kept, so a keyboard mapping change (MappingNotify,
+ * XkbMapNotify) only re-resolves keycodes and never reparses a combo.
+ *
+ * Key sequences ("mod4+x t", strokes separated by spaces) form a trie: every
+ * stroke but the last is a prefix binding without a command, whose sequel
+ * table holds the strokes that may follow it. Only the root table's keys
+ * are grabbed, so sequences sharing a prefix share its grab.
+ */
+
+// Modifiers a combo can name; everything else in an event state is ignored
+#define ShortcutModifierMask (ShiftMask | ControlMask | Mod1Mask | Mod2Mask | Mod3Mask | Mod4Mask | Mod5Mask)
+
+// Longest key sequence a binding may have
+#define ShortcutSequenceMaxStrokes 8
+
+@class ShortcutTable;
+
+typedef enum {
+    ShortcutComboValid,
+    ShortcutComboMissingKey,        // Only modifiers
+    ShortcutComboUnknownKey,        // Key name without a keysym
+    ShortcutComboInvalidKeycode     // code:NN outside 1-255
+} ShortcutComboStatus;
+
+typedef struct {
+    unsigned int modifiers;         // X11 modifier mask, within ShortcutModifierMask
+    KeySym keysym;                  // NoSymbol for raw keycodes
+    KeyCode rawKeycode;             // code:NN, 0 if the key is a keysym
+} ShortcutCombo;
+
+typedef struct {
+    ShortcutCombo combo;
+    KeyCode keycode;                // In the current keyboard mapping, 0 if the keysym has no key
+    NSString *comboString;          // As configured; for a prefix, the strokes up to it
+    NSString *command;              // nil for a sequence prefix
+    ShortcutTable *sequel;          // What may follow a prefix, nil for a binding with a command
+} ShortcutBinding;
+
+// Splits a key sequence ("mod4+x t") into its strokes at whitespace
+NSArray *ShortcutSequenceStrokes(NSString *sequence);
+
+// Splits "ctrl+shift+t" or "ctrl-shift-t" into its parts
+NSArray *ShortcutComboComponents(NSString *combo);
+
+// Parses a combo; keyName, if not NULL, is set to the (lowercased) key part
+ShortcutComboStatus ShortcutComboParse(NSString *combo, ShortcutCombo *result, NSString **keyName);
+
+// Key name as written in combos ("t", "f5", "volume_up") to keysym, NoSymbol if unknown
+KeySym ShortcutKeysymForName(NSString *keyName);
+
+@interface ShortcutTable : NSObject
+{
+    ShortcutBinding *_bindings;     // In the order they were added
+    NSUInteger _count;
+    NSUInteger _capacity;
+    uint32_t *_slots;               // Open addressing; 1-based binding index, 0 = empty
+    uint32_t _slotMask;
+}
+
+- (void)addCombo:(const ShortcutCombo *)combo string:(NSString *)comboString command:(NSString *)command;
+
+// Adds a binding of one or more strokes, creating the prefixes it needs.
+// Returns NO and adds nothing if a prefix is already bound to a command or
+// the last stroke is already a prefix.
+- (BOOL)addSequence:(const ShortcutCombo *)strokes count:(NSUInteger)count
+             string:(NSString *)sequenceString command:(NSString *)command;
+
+// Rebuilds the dispatch table from the display's current keyboard mapping and
+// returns the number of bindings that resolved to a keycode. When two bindings
+// resolve to the same key and modifiers the one added first wins.
+- (NSUInteger)resolveKeycodesForDisplay:(Display *)display;
+
+// Adds one binding to a resolved table, resolving only its own key. Returns
+// the binding, which has keycode 0 if its keysym has no key.
+- (const ShortcutBinding *)insertCombo:(const ShortcutCombo *)combo string:(NSString *)comboString
+                               command:(NSString *)command display:(Display *)display;
+
+// Removes the binding configured as comboString, which may be a sequence,
+// and any prefix it leaves without a sequel; returns NO if there is none
+- (BOOL)removeBindingForCombo:(NSString *)comboString;
+
+- (const ShortcutBinding *)bindingForCombo:(NSString *)comboString;
+
+// The first binding in this table (not its sequels) for the same keys and modifiers
+- (const ShortcutBinding *)bindingWithCombo:(const ShortcutCombo *)combo;
+
+- (NSUInteger)bindingCount;
+- (const ShortcutBinding *)bindingAtIndex:(NSUInteger)index;
+
+// state must already be reduced to ShortcutModifierMask without lock modifiers
+- (const ShortcutBinding *)bindingForKeycode:(KeyCode)keycode state:(unsigned int)state;
+
+@end
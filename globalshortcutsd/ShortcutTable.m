@@ -0,0 +1,420 @@
+/*
+ * Copyright (c) 2005 Simon Peter
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include "ShortcutTable.h"
+#include <X11/keysym.h>
+#include <stdlib.h>
+#include <string.h>
+
+#pragma mark - Combo parsing
+
+NSArray *ShortcutSequenceStrokes(NSString *sequence)
+{
+    NSMutableArray *strokes = [NSMutableArray array];
+    NSArray *parts = [sequence componentsSeparatedByCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+
+    for (NSString *part in parts) {
+        if ([part length] > 0) {
+            [strokes addObject:part];
+        }
+    }
+    return strokes;
+}
+
+NSArray *ShortcutComboComponents(NSString *combo)
+{
+    if (!combo || [combo length] == 0) {
+        return nil;
+    }
+
+    // First try + separator
+    NSArray *parts = [combo componentsSeparatedByString:@"+"];
+    if ([parts count] > 1) {
+        return parts;
+    }
+
+    // Then try - separator
+    parts = [combo componentsSeparatedByString:@"-"];
+    if ([parts count] > 1) {
+        return parts;
+    }
+
+    // Single part, return as is
+    return [NSArray arrayWithObject:combo];
+}
+
+ShortcutComboStatus ShortcutComboParse(NSString *combo, ShortcutCombo *result, NSString **keyName)
+{
+    NSArray *parts = ShortcutComboComponents(combo);
+    unsigned int modifier = 0;
+    NSString *keyString = nil;
+
+    for (NSString *rawPart in parts) {
+        NSString *part = [rawPart lowercaseString];
+        if ([part isEqualToString:@"ctrl"] || [part isEqualToString:@"control"]) {
+            modifier |= ControlMask;
+        } else if ([part isEqualToString:@"shift"]) {
+            modifier |= ShiftMask;
+        } else if ([part isEqualToString:@"alt"] || [part isEqualToString:@"mod1"]) {
+            modifier |= Mod1Mask;
+        } else if ([part isEqualToString:@"mod2"]) {
+            modifier |= Mod2Mask;
+        } else if ([part isEqualToString:@"mod3"]) {
+            modifier |= Mod3Mask;
+        } else if ([part isEqualToString:@"mod4"]) {
+            modifier |= Mod4Mask;
+        } else if ([part isEqualToString:@"mod5"]) {
+            modifier |= Mod5Mask;
+        } else {
+            // This should be the key
+            keyString = part;
+        }
+    }
+
+    if (keyName) {
+        *keyName = keyString;
+    }
+    if (!keyString) {
+        return ShortcutComboMissingKey;
+    }
+
+    result->modifiers = modifier;
+    result->keysym = NoSymbol;
+    result->rawKeycode = 0;
+
+    // Raw keycode (format: "code:28")
+    if ([keyString hasPrefix:@"code:"]) {
+        int code = [[keyString substringFromIndex:5] intValue];
+        if (code <= 0 || code > 255) {
+            return ShortcutComboInvalidKeycode;
+        }
+        result->rawKeycode = (KeyCode)code;
+        return ShortcutComboValid;
+    }
+
+    result->keysym = ShortcutKeysymForName(keyString);
+    return result->keysym == NoSymbol ? ShortcutComboUnknownKey : ShortcutComboValid;
+}
+
+KeySym ShortcutKeysymForName(NSString *keyStr)
+{
+    const char *cStr = [keyStr UTF8String];
+
+    // Handle special keys
+    if ([keyStr length] == 1) {
+        // Single character
+        return XStringToKeysym(cStr);
+    }
+
+    // Handle named keys
+    if ([keyStr isEqualToString:@"space"]) return XK_space;
+    if ([keyStr isEqualToString:@"return"] || [keyStr isEqualToString:@"enter"]) return XK_Return;
+    if ([keyStr isEqualToString:@"tab"]) return XK_Tab;
+    if ([keyStr isEqualToString:@"escape"] || [keyStr isEqualToString:@"esc"]) return XK_Escape;
+    if ([keyStr isEqualToString:@"backspace"]) return XK_BackSpace;
+    if ([keyStr isEqualToString:@"delete"]) return XK_Delete;
+    if ([keyStr isEqualToString:@"home"]) return XK_Home;
+    if ([keyStr isEqualToString:@"end"]) return XK_End;
+    if ([keyStr isEqualToString:@"page_up"]) return XK_Page_Up;
+    if ([keyStr isEqualToString:@"page_down"]) return XK_Page_Down;
+    if ([keyStr isEqualToString:@"up"]) return XK_Up;
+    if ([keyStr isEqualToString:@"down"]) return XK_Down;
+    if ([keyStr isEqualToString:@"left"]) return XK_Left;
+    if ([keyStr isEqualToString:@"right"]) return XK_Right;
+
+    // Function keys
+    if ([keyStr hasPrefix:@"f"] && [keyStr length] <= 3) {
+        int fNum = [[keyStr substringFromIndex:1] intValue];
+        if (fNum >= 1 && fNum <= 24) {
+            return XK_F1 + (fNum - 1);
+        }
+    }
+
+    // Multimedia keys - XF86 symbols
+    if ([keyStr isEqualToString:@"volume_up"]) return 0x1008FF13;     // XF86AudioRaiseVolume
+    if ([keyStr isEqualToString:@"volume_down"]) return 0x1008FF11;   // XF86AudioLowerVolume
+    if ([keyStr isEqualToString:@"volume_mute"]) return 0x1008FF12;   // XF86AudioMute
+    if ([keyStr isEqualToString:@"play_pause"]) return 0x1008FF14;    // XF86AudioPlay
+    if ([keyStr isEqualToString:@"stop"]) return 0x1008FF15;          // XF86AudioStop
+    if ([keyStr isEqualToString:@"prev"]) return 0x1008FF16;          // XF86AudioPrev
+    if ([keyStr isEqualToString:@"next"]) return 0x1008FF17;          // XF86AudioNext
+    if ([keyStr isEqualToString:@"rewind"]) return 0x1008FF3E;        // XF86AudioRewind
+    if ([keyStr isEqualToString:@"forward"]) return 0x1008FF40;       // XF86AudioForward
+
+    // Brightness controls
+    if ([keyStr isEqualToString:@"brightness_up"]) return 0x1008FF02;   // XF86MonBrightnessUp
+    if ([keyStr isEqualToString:@"brightness_down"]) return 0x1008FF03; // XF86MonBrightnessDown
+
+    // Other multimedia keys
+    if ([keyStr isEqualToString:@"mail"]) return 0x1008FF19;          // XF86Mail
+    if ([keyStr isEqualToString:@"www"]) return 0x1008FF2E;           // XF86WWW
+    if ([keyStr isEqualToString:@"homepage"]) return 0x1008FF18;      // XF86HomePage
+    if ([keyStr isEqualToString:@"search"]) return 0x1008FF1B;        // XF86Search
+    if ([keyStr isEqualToString:@"calculator"]) return 0x1008FF1D;    // XF86Calculator
+    if ([keyStr isEqualToString:@"sleep"]) return 0x1008FF2F;         // XF86Sleep
+    if ([keyStr isEqualToString:@"wakeup"]) return 0x1008FF2B;        // XF86WakeUp
+    if ([keyStr isEqualToString:@"power"]) return 0x1008FF2A;         // XF86PowerOff
+
+    // Screen controls
+    if ([keyStr isEqualToString:@"screensaver"]) return 0x1008FF2D;   // XF86ScreenSaver
+    if ([keyStr isEqualToString:@"standby"]) return 0x1008FF10;       // XF86Standby
+
+    // Media controls
+    if ([keyStr isEqualToString:@"record"]) return 0x1008FF1C;        // XF86AudioRecord
+    if ([keyStr isEqualToString:@"eject"]) return 0x1008FF2C;         // XF86Eject
+
+    // Try direct keysym lookup
+    return XStringToKeysym(cStr);
+}
+
+#pragma mark - Dispatch table
+
+// Keycodes fit in 8 bits and ShortcutModifierMask in the low 8 bits of the state
+static inline uint32_t slotKey(KeyCode keycode, unsigned int modifiers)
+{
+    return ((uint32_t)keycode << 8) | (modifiers & 0xff);
+}
+
+static inline uint32_t slotHash(uint32_t key)
+{
+    uint32_t h = key * 2654435761u;
+    return h ^ (h >> 16);
+}
+
+static inline BOOL combosEqual(const ShortcutCombo *a, const ShortcutCombo *b)
+{
+    return a->modifiers == b->modifiers && a->keysym == b->keysym && a->rawKeycode == b->rawKeycode;
+}
+
+@interface ShortcutTable (Private)
+- (void)rebuildSlots;
+- (void)insertSlotForBindingAtIndex:(NSUInteger)index;
+- (void)removeBindingAtIndex:(NSUInteger)index;
+@end
+
+@implementation ShortcutTable
+
+- (void)dealloc
+{
+    for (NSUInteger i = 0; i < _count; i++) {
+        [_bindings[i].comboString release];
+        [_bindings[i].command release];
+        [_bindings[i].sequel release];
+    }
+    free(_bindings);
+    free(_slots);
+    [super dealloc];
+}
+
+- (void)addCombo:(const ShortcutCombo *)combo string:(NSString *)comboString command:(NSString *)command
+{
+    if (_count == _capacity) {
+        _capacity = _capacity ? _capacity * 2 : 16;
+        _bindings = realloc(_bindings, _capacity * sizeof(ShortcutBinding));
+    }
+
+    ShortcutBinding *binding = &_bindings[_count++];
+    binding->combo = *combo;
+    binding->keycode = combo->rawKeycode;
+    binding->comboString = [comboString copy];
+    binding->command = [command copy];
+    binding->sequel = nil;
+}
+
+- (BOOL)addSequence:(const ShortcutCombo *)strokes count:(NSUInteger)count
+             string:(NSString *)sequenceString command:(NSString *)command
+{
+    // Walk the existing path first, so a conflict leaves the trie untouched.
+    // A repeated command binding is allowed: the one added first wins.
+    ShortcutTable *table = self;
+    for (NSUInteger i = 0; i < count && table; i++) {
+        const ShortcutBinding *existing = [table bindingWithCombo:&strokes[i]];
+        if (!existing) {
+            break;
+        }
+        BOOL isLast = (i == count - 1);
+        if (isLast ? existing->sequel != nil : existing->sequel == nil) {
+            return NO;
+        }
+        table = existing->sequel;
+    }
+
+    NSArray *strokeStrings = ShortcutSequenceStrokes(sequenceString);
+    table = self;
+    for (NSUInteger i = 0; i + 1 < count; i++) {
+        const ShortcutBinding *prefix = [table bindingWithCombo:&strokes[i]];
+        ShortcutTable *sequel = prefix ? prefix->sequel : nil;
+        if (!prefix) {
+            NSString *prefixString = [[strokeStrings subarrayWithRange:NSMakeRange(0, i + 1)]
+                componentsJoinedByString:@" "];
+            [table addCombo:&strokes[i] string:prefixString command:nil];
+            sequel = [[ShortcutTable alloc] init];
+            table->_bindings[table->_count - 1].sequel = sequel;
+        }
+        table = sequel;
+    }
+    [table addCombo:&strokes[count - 1] string:sequenceString command:command];
+    return YES;
+}
+
+- (NSUInteger)resolveKeycodesForDisplay:(Display *)display
+{
+    NSUInteger resolved = 0;
+    for (NSUInteger i = 0; i < _count; i++) {
+        ShortcutBinding *binding = &_bindings[i];
+        if (binding->combo.rawKeycode == 0) {
+            binding->keycode = display ? XKeysymToKeycode(display, binding->combo.keysym) : 0;
+        }
+        if (binding->keycode != 0) {
+            resolved++;
+        }
+        [binding->sequel resolveKeycodesForDisplay:display];
+    }
+
+    [self rebuildSlots];
+    return resolved;
+}
+
+- (const ShortcutBinding *)insertCombo:(const ShortcutCombo *)combo string:(NSString *)comboString
+                               command:(NSString *)command display:(Display *)display
+{
+    [self addCombo:combo string:comboString command:command];
+
+    ShortcutBinding *binding = &_bindings[_count - 1];
+    if (combo->rawKeycode == 0) {
+        binding->keycode = display ? XKeysymToKeycode(display, combo->keysym) : 0;
+    }
+
+    // Grow rather than let the table get more than half full
+    if (!_slots || _count * 2 > (NSUInteger)_slotMask + 1) {
+        [self rebuildSlots];
+    } else if (binding->keycode != 0) {
+        [self insertSlotForBindingAtIndex:_count - 1];
+    }
+    return binding;
+}
+
+- (BOOL)removeBindingForCombo:(NSString *)comboString
+{
+    const ShortcutBinding *binding = [self bindingForCombo:comboString];
+    if (binding) {
+        [self removeBindingAtIndex:binding - _bindings];
+        return YES;
+    }
+
+    for (NSUInteger i = 0; i < _count; i++) {
+        ShortcutTable *sequel = _bindings[i].sequel;
+        if (sequel && [sequel removeBindingForCombo:comboString]) {
+            if ([sequel bindingCount] == 0) {
+                [self removeBindingAtIndex:i];
+            }
+            return YES;
+        }
+    }
+    return NO;
+}
+
+- (const ShortcutBinding *)bindingForCombo:(NSString *)comboString
+{
+    for (NSUInteger i = 0; i < _count; i++) {
+        // Prefixes are named after their strokes but are not configured bindings
+        if (_bindings[i].command && [_bindings[i].comboString isEqualToString:comboString]) {
+            return &_bindings[i];
+        }
+    }
+    return NULL;
+}
+
+- (const ShortcutBinding *)bindingWithCombo:(const ShortcutCombo *)combo
+{
+    for (NSUInteger i = 0; i < _count; i++) {
+        if (combosEqual(&_bindings[i].combo, combo)) {
+            return &_bindings[i];
+        }
+    }
+    return NULL;
+}
+
+- (NSUInteger)bindingCount
+{
+    return _count;
+}
+
+- (const ShortcutBinding *)bindingAtIndex:(NSUInteger)index
+{
+    return index < _count ? &_bindings[index] : NULL;
+}
+
+- (const ShortcutBinding *)bindingForKeycode:(KeyCode)keycode state:(unsigned int)state
+{
+    if (!_slots) {
+        return NULL;
+    }
+
+    uint32_t key = slotKey(keycode, state);
+    uint32_t slot = slotHash(key) & _slotMask;
+    while (_slots[slot] != 0) {
+        const ShortcutBinding *binding = &_bindings[_slots[slot] - 1];
+        if (slotKey(binding->keycode, binding->combo.modifiers) == key) {
+            return binding;
+        }
+        slot = (slot + 1) & _slotMask;
+    }
+    return NULL;
+}
+
+@end
+
+@implementation ShortcutTable (Private)
+
+- (void)rebuildSlots
+{
+    // At most half full, so probes stay short
+    uint32_t slotCount = 16;
+    while (slotCount < _count * 2) {
+        slotCount *= 2;
+    }
+    free(_slots);
+    _slots = calloc(slotCount, sizeof(uint32_t));
+    _slotMask = slotCount - 1;
+
+    for (NSUInteger i = 0; i < _count; i++) {
+        if (_bindings[i].keycode != 0) {
+            [self insertSlotForBindingAtIndex:i];
+        }
+    }
+}
+
+// Bindings added earlier keep their slot when a later one has the same key and modifiers
+- (void)insertSlotForBindingAtIndex:(NSUInteger)index
+{
+    const ShortcutBinding *binding = &_bindings[index];
+    uint32_t key = slotKey(binding->keycode, binding->combo.modifiers);
+    uint32_t slot = slotHash(key) & _slotMask;
+
+    while (_slots[slot] != 0) {
+        const ShortcutBinding *other = &_bindings[_slots[slot] - 1];
+        if (slotKey(other->keycode, other->combo.modifiers) == key) {
+            return;
+        }
+        slot = (slot + 1) & _slotMask;
+    }
+    _slots[slot] = (uint32_t)index + 1;
+}
+
+- (void)removeBindingAtIndex:(NSUInteger)index
+{
+    [_bindings[index].comboString release];
+    [_bindings[index].command release];
+    [_bindings[index].sequel release];
+    memmove(&_bindings[index], &_bindings[index + 1], (_count - index - 1) * sizeof(ShortcutBinding));
+    _count--;
+
+    // Slots hold binding indexes, and a binding this one shadowed may now win
+    [self rebuildSlots];
+}
+
+@end
@@ -7,9 +7,12 @@
 #include <Foundation/Foundation.h>
 #include <AppKit/AppKit.h>
 #include <X11/Xlib.h>
+#include <X11/Xutil.h>
 #include <X11/keysym.h>
 #include <X11/XKBlib.h>
+#include <X11/extensions/XInput2.h>
 #include <signal.h>
+#include <poll.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
@@ -19,42 +22,34 @@
 #include <errno.h>
 #include <string.h>
 
+#include "ShortcutTable.h"
+#include "CommandLauncher.h"
+#include "ControlSocket.h"
+
 // Forward declarations
 @class globalshortcutsd;
 
-// Helper function to parse key combinations with both + and - separators
-NSArray *parseKeyCombo(NSString *keyCombo) {
-    if (!keyCombo || [keyCombo length] == 0) {
-        return nil;
-    }
-    
-    // First try + separator
-    NSArray *parts = [keyCombo componentsSeparatedByString:@"+"];
-    if ([parts count] > 1) {
-        return parts;
-    }
-    
-    // Then try - separator
-    parts = [keyCombo componentsSeparatedByString:@"-"];
-    if ([parts count] > 1) {
-        return parts;
-    }
-    
-    // Single part, return as is
-    return [NSArray arrayWithObject:keyCombo];
-}
-
 // Global variables
-static BOOL x11_error_occurred = NO;
+static NSMutableIndexSet *x11_failed_serials = nil;     // Serials of failed requests during a batch of grabs
 static globalshortcutsd *globalInstance = nil;
-static BOOL signal_received = NO;
-static int last_signal = 0;
+static int signal_pipe[2] = { -1, -1 };
 
-@interface globalshortcutsd : NSObject
+@interface globalshortcutsd : NSObject <ControlSocketDelegate>
 {
 @public
     Display *display;
-    NSDictionary *shortcuts;
+    NSMutableDictionary *shortcuts;
+    ShortcutTable *shortcutTable;
+    CommandLauncher *launcher;
+    ControlSocket *controlSocket;
+    int xkb_event_base;
+    BOOL use_xinput2;                   // Grab and read keys through XInput2 (-x)
+    int xi_opcode;
+    ShortcutTable *sequenceTable;       // What may follow the prefix just pressed, nil outside a sequence
+    KeyCode sequence_keycode;           // Key of that prefix, which may autorepeat
+    int sequence_device;                // XInput2 keyboard grabbed for the sequence
+    long long sequence_deadline;        // Monotonic milliseconds
+    int sequence_timeout;               // Milliseconds to wait for the next stroke
     unsigned int numlock_mask;
     unsigned int capslock_mask;
     unsigned int scrolllock_mask;
@@ -72,14 +67,27 @@ static int last_signal = 0;
 - (BOOL)grabKeys;
 - (void)ungrabKeys;
 - (void)eventLoop;
+- (BOOL)setupSignalPipe;
+- (void)handlePendingSignals;
 - (BOOL)runCommand:(NSString *)command;
 - (void)handleSignal:(int)sig;
-- (KeySym)parseKeyString:(NSString *)keyStr;
 - (void)terminate;
 - (NSString *)findExecutableInPath:(NSString *)command;
 - (void)logWithFormat:(NSString *)format, ...;
 - (BOOL)grabKey:(KeyCode)keycode modifier:(unsigned int)modifier forCombo:(NSString *)combo;
-- (BOOL)matchesEvent:(XKeyEvent *)keyEvent withKeyCombo:(NSString *)keyCombo;
+- (BOOL)grabKeyWithXInput2:(KeyCode)keycode modifier:(unsigned int)modifier;
+- (unsigned long)issueCoreGrabsForKey:(KeyCode)keycode modifier:(unsigned int)modifier;
+- (void)ungrabKey:(KeyCode)keycode modifier:(unsigned int)modifier;
+- (BOOL)parseSequence:(NSString *)keyCombo strokes:(ShortcutCombo *)strokes count:(NSUInteger *)count
+                error:(NSString **)error;
+- (void)handleKeycode:(KeyCode)keycode state:(unsigned int)state device:(int)deviceid time:(Time)time;
+- (void)beginSequence:(ShortcutTable *)sequel keycode:(KeyCode)keycode device:(int)deviceid time:(Time)time;
+- (void)endSequence;
+- (void)reloadConfiguration;
+- (NSString *)addShortcut:(NSString *)keyCombo command:(NSString *)command;
+- (NSString *)removeShortcut:(NSString *)keyCombo;
+- (void)compileShortcuts;
+- (void)keyboardMappingChanged;
 - (BOOL)isValidKeyCombo:(NSString *)keyCombo;
 - (void)validateConfiguration;
 
@@ -88,7 +96,9 @@ static int last_signal = 0;
 // C function for X11 error handling
 static int x11ErrorHandler(Display *dpy __attribute__((unused)), XErrorEvent *error)
 {
-    x11_error_occurred = YES;
+    if (x11_failed_serials) {
+        [x11_failed_serials addIndex:(NSUInteger)error->serial];
+    }
     
     if (error->error_code == BadAccess && error->request_code == 33) {
         // BadAccess on X_GrabKey - key already grabbed
@@ -107,16 +117,55 @@ static int x11ErrorHandler(Display *dpy __attribute__((unused)), XErrorEvent *er
     return 0;
 }
 
+static long long monotonicMilliseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// The modifier masks a key is grabbed with: modifier plus every combination
+// of the lock modifiers the keyboard has; returns how many
+static int lockVariants(unsigned int modifier, unsigned int numlock, unsigned int capslock,
+                        unsigned int scrolllock, unsigned int variants[8])
+{
+    unsigned int locks[3] = { numlock, capslock, scrolllock };
+    int count = 0;
+    
+    for (int i = 0; i < 8; i++) {
+        unsigned int mask = modifier;
+        BOOL present = YES;
+        for (int j = 0; j < 3; j++) {
+            if (i & (1 << j)) {
+                present = present && locks[j] != 0;
+                mask |= locks[j];
+            }
+        }
+        if (present) {
+            variants[count++] = mask;
+        }
+    }
+    return count;
+}
+
 // Signal handler
 static void signalHandler(int sig)
 {
-    signal_received = YES;
-    last_signal = sig;
+    int saved_errno = errno;
+    unsigned char byte = (unsigned char)sig;
+    
+    // Wake the event loop; if the pipe is full, a wakeup is already pending
+    if (signal_pipe[1] >= 0) {
+        ssize_t written = write(signal_pipe[1], &byte, 1);
+        (void)written;
+    }
     
     // For immediate termination signals, also call the instance handler
     if (globalInstance && (sig == SIGTERM || sig == SIGINT || sig == SIGQUIT)) {
         globalInstance->running = NO;
     }
+    
+    errno = saved_errno;
 }
 
 @implementation globalshortcutsd
@@ -127,6 +176,17 @@ static void signalHandler(int sig)
     if (self) {
         display = NULL;
         shortcuts = nil;
+        shortcutTable = nil;
+        launcher = [[CommandLauncher alloc] init];
+        controlSocket = nil;
+        xkb_event_base = -1;
+        use_xinput2 = NO;
+        xi_opcode = -1;
+        sequenceTable = nil;
+        sequence_keycode = 0;
+        sequence_device = 0;
+        sequence_deadline = 0;
+        sequence_timeout = 1500;
         defaultsDomain = [@"GlobalShortcuts" retain];
         lastDefaultsModTime = 0;
         numlock_mask = 0;
@@ -148,6 +208,12 @@ static void signalHandler(int sig)
     }
     [shortcuts release];
     shortcuts = nil;
+    [sequenceTable release];
+    sequenceTable = nil;
+    [shortcutTable release];
+    shortcutTable = nil;
+    [launcher release];
+    launcher = nil;
     [defaultsDomain release];
     defaultsDomain = nil;
     
@@ -188,7 +254,8 @@ static void signalHandler(int sig)
         
         // Create empty shortcuts dictionary
         [shortcuts release];
-        shortcuts = [[NSDictionary alloc] init];
+        shortcuts = [[NSMutableDictionary alloc] init];
+        [self compileShortcuts];
         lastDefaultsModTime = time(NULL);
         
         [self logWithFormat:@"Loaded 0 shortcuts from GNUstep defaults domain '%@'", defaultsDomain];
@@ -201,7 +268,7 @@ static void signalHandler(int sig)
     }
     
     [shortcuts release];
-    shortcuts = [config retain];
+    shortcuts = [config mutableCopy];
     
     // Update modification time for change detection
     lastDefaultsModTime = time(NULL);
@@ -209,6 +276,7 @@ static void signalHandler(int sig)
     [self logWithFormat:@"Loaded %lu shortcuts from defaults domain '%@'", 
         (unsigned long)[shortcuts count], defaultsDomain];
     [self validateConfiguration];
+    [self compileShortcuts];
     
     if (verbose) {
         NSEnumerator *enumerator = [shortcuts keyEnumerator];
@@ -265,6 +333,28 @@ static void signalHandler(int sig)
         XSelectInput(display, root, KeyPressMask | KeyReleaseMask);
     }
     
+    // Core MappingNotify is delivered unasked; with XKB, layout switches
+    // (setxkbmap, a new keyboard) arrive as XKB events instead
+    int xkb_opcode, xkb_error_base;
+    int xkb_major = XkbMajorVersion, xkb_minor = XkbMinorVersion;
+    if (XkbQueryExtension(display, &xkb_opcode, &xkb_event_base, &xkb_error_base, &xkb_major, &xkb_minor)) {
+        XkbSelectEvents(display, XkbUseCoreKbd, XkbMapNotifyMask | XkbNewKeyboardNotifyMask,
+                        XkbMapNotifyMask | XkbNewKeyboardNotifyMask);
+    } else {
+        xkb_event_base = -1;
+    }
+    
+    // XInput2 grabs a key with all its lock combinations in one request
+    if (use_xinput2) {
+        int xi_event_base, xi_error_base;
+        int xi_major = 2, xi_minor = 0;
+        if (!XQueryExtension(display, "XInputExtension", &xi_opcode, &xi_event_base, &xi_error_base) ||
+            XIQueryVersion(display, &xi_major, &xi_minor) != Success) {
+            [self logWithFormat:@"Warning: X server has no XInput2, using core key grabs"];
+            use_xinput2 = NO;
+        }
+    }
+    
     [self getOffendingModifiers];
     
     if (verbose) {
@@ -283,6 +373,9 @@ static void signalHandler(int sig)
         Mod2Mask, Mod3Mask, Mod4Mask, Mod5Mask
     };
     
+    numlock_mask = 0;
+    scrolllock_mask = 0;
+    
     nlock = XKeysymToKeycode(display, XK_Num_Lock);
     slock = XKeysymToKeycode(display, XK_Scroll_Lock);
     
@@ -303,6 +396,75 @@ static void signalHandler(int sig)
         XFreeModifiermap(modmap);
 }
 
+- (BOOL)parseSequence:(NSString *)keyCombo strokes:(ShortcutCombo *)strokes count:(NSUInteger *)count
+                error:(NSString **)error
+{
+    NSArray *strokeStrings = ShortcutSequenceStrokes(keyCombo);
+    if ([strokeStrings count] == 0 || [strokeStrings count] > ShortcutSequenceMaxStrokes) {
+        *error = [NSString stringWithFormat:@"more than %d strokes", ShortcutSequenceMaxStrokes];
+        return NO;
+    }
+    
+    // Each stroke is a combo like "ctrl+shift+t", "ctrl-shift-t", or "ctrl+shift+code:28"
+    for (NSUInteger i = 0; i < [strokeStrings count]; i++) {
+        NSString *keyString = nil;
+        switch (ShortcutComboParse([strokeStrings objectAtIndex:i], &strokes[i], &keyString)) {
+            case ShortcutComboValid:
+                break;
+            case ShortcutComboMissingKey:
+                *error = @"no key specified";
+                return NO;
+            case ShortcutComboUnknownKey:
+                *error = [NSString stringWithFormat:@"unknown key '%@'", keyString];
+                return NO;
+            case ShortcutComboInvalidKeycode:
+                *error = [NSString stringWithFormat:@"invalid keycode '%@' (must be 1-255)", keyString];
+                return NO;
+        }
+    }
+    
+    *count = [strokeStrings count];
+    return YES;
+}
+
+- (void)compileShortcuts
+{
+    ShortcutTable *table = [[ShortcutTable alloc] init];
+    
+    // Sorted, so which of two conflicting shortcuts wins does not depend on hashing
+    NSArray *keys = [[shortcuts allKeys] sortedArrayUsingSelector:@selector(compare:)];
+    
+    for (NSString *keyCombo in keys) {
+        if (![self isValidKeyCombo:keyCombo]) {
+            continue;
+        }
+        
+        ShortcutCombo strokes[ShortcutSequenceMaxStrokes];
+        NSUInteger count = 0;
+        NSString *error = nil;
+        if (![self parseSequence:keyCombo strokes:strokes count:&count error:&error]) {
+            [self logWithFormat:@"Warning: %@ in combination '%@'", error, keyCombo];
+            continue;
+        }
+        
+        NSString *command = [shortcuts objectForKey:keyCombo];
+        if (![table addSequence:strokes count:count string:keyCombo command:command]) {
+            [self logWithFormat:@"Warning: '%@' conflicts with a key sequence starting with the same keys", keyCombo];
+            continue;
+        }
+        [launcher warmCommand:command];
+    }
+    
+    // The sequence in progress belongs to the old table
+    [self endSequence];
+    [shortcutTable release];
+    shortcutTable = table;
+    
+    if (verbose) {
+        [self logWithFormat:@"Compiled %lu shortcuts", (unsigned long)[shortcutTable bindingCount]];
+    }
+}
+
 - (BOOL)grabKeys
 {
     if (!display) {
@@ -315,162 +477,177 @@ static void signalHandler(int sig)
         return YES;
     }
     
-    NSEnumerator *enumerator = [shortcuts keyEnumerator];
-    NSString *keyCombo;
+    // Keycodes depend on the current keyboard mapping, so resolve them on every grab
+    [shortcutTable resolveKeycodesForDisplay:display];
+    
     int successful_grabs = 0;
     int total_shortcuts = [shortcuts count];
-    
-    while ((keyCombo = [enumerator nextObject])) {
-        if (![self isValidKeyCombo:keyCombo]) {
-            [self logWithFormat:@"Warning: Invalid key combination format: %@", keyCombo];
-            continue;
-        }
+    NSTimeInterval started = [NSDate timeIntervalSinceReferenceDate];
+    
+    // Only the first stroke of a sequence is grabbed, once for all the
+    // sequences that share it
+    NSUInteger bindingCount = [shortcutTable bindingCount];
+    const ShortcutBinding **toGrab = malloc(MAX(bindingCount, (NSUInteger)1) * sizeof(*toGrab));
+    NSUInteger grabCount = 0;
+    for (NSUInteger i = 0; i < bindingCount; i++) {
+        const ShortcutBinding *binding = [shortcutTable bindingAtIndex:i];
         
-        // Parse key combination like "ctrl+shift+t", "ctrl-shift-t", or "ctrl+shift+code:28"
-        NSArray *parts = parseKeyCombo(keyCombo);
-        if (!parts || [parts count] < 1) continue;
-        
-        unsigned int modifier = 0;
-        NSString *keyString = nil;
-        
-        for (NSUInteger i = 0; i < [parts count]; i++) {
-            NSString *part = [[parts objectAtIndex:i] lowercaseString];
-            if ([part isEqualToString:@"ctrl"] || [part isEqualToString:@"control"]) {
-                modifier |= ControlMask;
-            } else if ([part isEqualToString:@"shift"]) {
-                modifier |= ShiftMask;
-            } else if ([part isEqualToString:@"alt"] || [part isEqualToString:@"mod1"]) {
-                modifier |= Mod1Mask;
-            } else if ([part isEqualToString:@"mod2"]) {
-                modifier |= Mod2Mask;
-            } else if ([part isEqualToString:@"mod3"]) {
-                modifier |= Mod3Mask;
-            } else if ([part isEqualToString:@"mod4"]) {
-                modifier |= Mod4Mask;
-            } else if ([part isEqualToString:@"mod5"]) {
-                modifier |= Mod5Mask;
-            } else {
-                // This should be the key
-                keyString = part;
-            }
+        if (binding->keycode == 0) {
+            [self logWithFormat:@"Warning: no keycode mapping for key in '%@'", binding->comboString];
+            continue;
         }
         
-        if (!keyString) {
-            [self logWithFormat:@"Warning: No key specified in combination: %@", keyCombo];
+        // An earlier binding for the same key and modifiers already has the grab
+        if ([shortcutTable bindingForKeycode:binding->keycode state:binding->combo.modifiers] != binding) {
             continue;
         }
+        toGrab[grabCount++] = binding;
+    }
+    
+    BOOL *grabbed = calloc(MAX(grabCount, (NSUInteger)1), sizeof(BOOL));
+    if (use_xinput2) {
+        for (NSUInteger i = 0; i < grabCount; i++) {
+            grabbed[i] = [self grabKeyWithXInput2:toGrab[i]->keycode modifier:toGrab[i]->combo.modifiers];
+        }
+    } else {
+        // Issue every lock variant of every key back to back and sync once; a
+        // failed request is matched to its key through the request serial
+        unsigned int variants[8];
+        int variantCount = lockVariants(0, numlock_mask, capslock_mask, scrolllock_mask, variants);
+        unsigned long *firstSerials = malloc(MAX(grabCount, (NSUInteger)1) * sizeof(unsigned long));
+        NSMutableIndexSet *failedSerials = [[NSMutableIndexSet alloc] init];
         
-        KeyCode keycode = 0;
+        x11_failed_serials = failedSerials;
+        for (NSUInteger i = 0; i < grabCount; i++) {
+            firstSerials[i] = [self issueCoreGrabsForKey:toGrab[i]->keycode modifier:toGrab[i]->combo.modifiers];
+        }
+        XSync(display, False);
+        x11_failed_serials = nil;
         
-        // Check if it's a raw keycode (format: "code:28")
-        if ([keyString hasPrefix:@"code:"]) {
-            NSString *codeStr = [keyString substringFromIndex:5];
-            int code = [codeStr intValue];
-            if (code <= 0 || code > 255) {
-                [self logWithFormat:@"Warning: invalid keycode '%@' in combination '%@' (must be 1-255)", 
-                    keyString, keyCombo];
-                continue;
-            }
-            keycode = code;
-        } else {
-            // Parse as keysym
-            KeySym keysym = [self parseKeyString:keyString];
-            if (keysym == NoSymbol) {
-                [self logWithFormat:@"Warning: unknown key '%@' in combination '%@'", keyString, keyCombo];
-                continue;
-            }
-            
-            keycode = XKeysymToKeycode(display, keysym);
-            if (keycode == 0) {
-                [self logWithFormat:@"Warning: no keycode mapping for key '%@'", keyString];
-                continue;
+        for (NSUInteger i = 0; i < grabCount; i++) {
+            grabbed[i] = ![failedSerials intersectsIndexesInRange:NSMakeRange(firstSerials[i], variantCount)];
+            if (!grabbed[i]) {
+                // Release the variants that did succeed; the key belongs to someone else
+                [self ungrabKey:toGrab[i]->keycode modifier:toGrab[i]->combo.modifiers];
+                [self logWithFormat:@"Warning: '%@' is already grabbed by another application", toGrab[i]->comboString];
             }
         }
-        
-        // Grab the key with all possible lock combinations
-        BOOL success = [self grabKey:keycode modifier:modifier forCombo:keyCombo];
-        
-        if (success) {
+        [failedSerials release];
+        free(firstSerials);
+    }
+    
+    for (NSUInteger i = 0; i < grabCount; i++) {
+        if (grabbed[i]) {
             successful_grabs++;
             if (verbose) {
-                [self logWithFormat:@"Grabbed key combination: %@ (keycode=%d, modifier=0x%x)", 
-                      keyCombo, keycode, modifier];
+                [self logWithFormat:@"Grabbed key combination: %@ (keycode=%d, modifier=0x%x)",
+                      toGrab[i]->comboString, toGrab[i]->keycode, toGrab[i]->combo.modifiers];
             }
         }
     }
+    free(grabbed);
+    free(toGrab);
     
-    [self logWithFormat:@"Successfully grabbed %d of %d shortcuts", successful_grabs, total_shortcuts];
+    [self logWithFormat:@"Successfully grabbed %d keys for %d shortcuts in %.2f ms (%@)", successful_grabs,
+        total_shortcuts, ([NSDate timeIntervalSinceReferenceDate] - started) * 1000.0,
+        use_xinput2 ? @"XInput2" : @"core"];
     return successful_grabs > 0;
 }
 
 - (BOOL)grabKey:(KeyCode)keycode modifier:(unsigned int)modifier forCombo:(NSString *)combo
 {
-    Window root = DefaultRootWindow(display);
-    BOOL success = YES;
-    
-    // Set up X11 error handler
-    XErrorHandler oldHandler = XSetErrorHandler(x11ErrorHandler);
+    if (use_xinput2) {
+        return [self grabKeyWithXInput2:keycode modifier:modifier];
+    }
     
-    // Reset error flag
-    x11_error_occurred = NO;
+    unsigned int variants[8];
+    int variantCount = lockVariants(modifier, numlock_mask, capslock_mask, scrolllock_mask, variants);
+    NSMutableIndexSet *failedSerials = [[NSMutableIndexSet alloc] init];
     
-    // Base combination
-    XGrabKey(display, keycode, modifier, root, False, GrabModeAsync, GrabModeAsync);
+    // All lock variants in one round trip, as in grabKeys
+    x11_failed_serials = failedSerials;
+    unsigned long firstSerial = [self issueCoreGrabsForKey:keycode modifier:modifier];
     XSync(display, False);
-    if (x11_error_occurred) success = NO;
+    x11_failed_serials = nil;
     
-    // With numlock
-    if (numlock_mask && !x11_error_occurred) {
-        XGrabKey(display, keycode, modifier | numlock_mask, root, False, GrabModeAsync, GrabModeAsync);
-        XSync(display, False);
-    }
-    
-    // With capslock
-    if (capslock_mask && !x11_error_occurred) {
-        XGrabKey(display, keycode, modifier | capslock_mask, root, False, GrabModeAsync, GrabModeAsync);
-        XSync(display, False);
-    }
-    
-    // With scrolllock
-    if (scrolllock_mask && !x11_error_occurred) {
-        XGrabKey(display, keycode, modifier | scrolllock_mask, root, False, GrabModeAsync, GrabModeAsync);
-        XSync(display, False);
-    }
+    BOOL success = ![failedSerials intersectsIndexesInRange:NSMakeRange(firstSerial, variantCount)];
+    [failedSerials release];
+    return success;
+}
+
+// Queues a core grab of every lock variant without waiting for the server;
+// returns the serial of the first, the others follow it consecutively
+- (unsigned long)issueCoreGrabsForKey:(KeyCode)keycode modifier:(unsigned int)modifier
+{
+    Window root = DefaultRootWindow(display);
+    unsigned int variants[8];
+    int count = lockVariants(modifier, numlock_mask, capslock_mask, scrolllock_mask, variants);
+    unsigned long firstSerial = NextRequest(display);
     
-    // With numlock + capslock
-    if (numlock_mask && capslock_mask && !x11_error_occurred) {
-        XGrabKey(display, keycode, modifier | numlock_mask | capslock_mask, root, False, GrabModeAsync, GrabModeAsync);
-        XSync(display, False);
+    for (int i = 0; i < count; i++) {
+        XGrabKey(display, keycode, variants[i], root, False, GrabModeAsync, GrabModeAsync);
     }
+    return firstSerial;
+}
+
+- (BOOL)grabKeyWithXInput2:(KeyCode)keycode modifier:(unsigned int)modifier
+{
+    unsigned int variants[8];
+    XIGrabModifiers modifiers[8];
+    int count = lockVariants(modifier, numlock_mask, capslock_mask, scrolllock_mask, variants);
     
-    // With numlock + scrolllock
-    if (numlock_mask && scrolllock_mask && !x11_error_occurred) {
-        XGrabKey(display, keycode, modifier | numlock_mask | scrolllock_mask, root, False, GrabModeAsync, GrabModeAsync);
-        XSync(display, False);
+    for (int i = 0; i < count; i++) {
+        modifiers[i].modifiers = variants[i];
+        modifiers[i].status = 0;
     }
     
-    // With capslock + scrolllock
-    if (capslock_mask && scrolllock_mask && !x11_error_occurred) {
-        XGrabKey(display, keycode, modifier | capslock_mask | scrolllock_mask, root, False, GrabModeAsync, GrabModeAsync);
-        XSync(display, False);
+    unsigned char bits[XIMaskLen(XI_LASTEVENT)];
+    memset(bits, 0, sizeof(bits));
+    XISetMask(bits, XI_KeyPress);
+    XIEventMask mask = { XIAllMasterDevices, sizeof(bits), bits };
+    
+    // One request, answered with the variants that failed, instead of a grab
+    // and a round trip per lock combination
+    int failed = XIGrabKeycode(display, XIAllMasterDevices, keycode, DefaultRootWindow(display),
+                               GrabModeAsync, GrabModeAsync, False, &mask, count, modifiers);
+    if (failed != 0 && verbose) {
+        [self logWithFormat:@"Warning: key combination already grabbed by another application (keycode=%d)", keycode];
     }
-    
-    // With all locks
-    if (numlock_mask && capslock_mask && scrolllock_mask && !x11_error_occurred) {
-        XGrabKey(display, keycode, modifier | numlock_mask | capslock_mask | scrolllock_mask, root, False, GrabModeAsync, GrabModeAsync);
-        XSync(display, False);
+    return failed == 0;
+}
+
+- (void)ungrabKey:(KeyCode)keycode modifier:(unsigned int)modifier
+{
+    Window root = DefaultRootWindow(display);
+    unsigned int variants[8];
+    int count = lockVariants(modifier, numlock_mask, capslock_mask, scrolllock_mask, variants);
+    
+    // Every lock combination grabKey:modifier:forCombo: may have grabbed
+    if (use_xinput2) {
+        XIGrabModifiers modifiers[8];
+        for (int i = 0; i < count; i++) {
+            modifiers[i].modifiers = variants[i];
+            modifiers[i].status = 0;
+        }
+        XIUngrabKeycode(display, XIAllMasterDevices, keycode, root, count, modifiers);
+    } else {
+        for (int i = 0; i < count; i++) {
+            XUngrabKey(display, keycode, variants[i], root);
+        }
     }
-    
-    // Restore previous error handler
-    XSetErrorHandler(oldHandler);
-    
-    return success && !x11_error_occurred;
+    XSync(display, False);
 }
 
 - (void)ungrabKeys
 {
     if (display) {
-        XUngrabKey(display, AnyKey, AnyModifier, DefaultRootWindow(display));
+        [self endSequence];
+        if (use_xinput2) {
+            XIGrabModifiers any = { (int)XIAnyModifier, 0 };
+            XIUngrabKeycode(display, XIAllMasterDevices, XIAnyKeycode, DefaultRootWindow(display), 1, &any);
+        } else {
+            XUngrabKey(display, AnyKey, AnyModifier, DefaultRootWindow(display));
+        }
         XSync(display, False);
         if (verbose) {
             [self logWithFormat:@"Ungrabbed all keys"];
@@ -478,99 +655,31 @@ static void signalHandler(int sig)
     }
 }
 
-- (KeySym)parseKeyString:(NSString *)keyStr
-{
-    const char *cStr = [keyStr UTF8String];
-    
-    // Handle special keys
-    if ([keyStr length] == 1) {
-        // Single character
-        return XStringToKeysym(cStr);
-    }
-    
-    // Handle named keys
-    if ([keyStr isEqualToString:@"space"]) return XK_space;
-    if ([keyStr isEqualToString:@"return"] || [keyStr isEqualToString:@"enter"]) return XK_Return;
-    if ([keyStr isEqualToString:@"tab"]) return XK_Tab;
-    if ([keyStr isEqualToString:@"escape"] || [keyStr isEqualToString:@"esc"]) return XK_Escape;
-    if ([keyStr isEqualToString:@"backspace"]) return XK_BackSpace;
-    if ([keyStr isEqualToString:@"delete"]) return XK_Delete;
-    if ([keyStr isEqualToString:@"home"]) return XK_Home;
-    if ([keyStr isEqualToString:@"end"]) return XK_End;
-    if ([keyStr isEqualToString:@"page_up"]) return XK_Page_Up;
-    if ([keyStr isEqualToString:@"page_down"]) return XK_Page_Down;
-    if ([keyStr isEqualToString:@"up"]) return XK_Up;
-    if ([keyStr isEqualToString:@"down"]) return XK_Down;
-    if ([keyStr isEqualToString:@"left"]) return XK_Left;
-    if ([keyStr isEqualToString:@"right"]) return XK_Right;
-    
-    // Function keys
-    if ([keyStr hasPrefix:@"f"] && [keyStr length] <= 3) {
-        int fNum = [[keyStr substringFromIndex:1] intValue];
-        if (fNum >= 1 && fNum <= 24) {
-            return XK_F1 + (fNum - 1);
-        }
-    }
-    
-    // Multimedia keys - XF86 symbols
-    if ([keyStr isEqualToString:@"volume_up"]) return 0x1008FF13;     // XF86AudioRaiseVolume
-    if ([keyStr isEqualToString:@"volume_down"]) return 0x1008FF11;   // XF86AudioLowerVolume
-    if ([keyStr isEqualToString:@"volume_mute"]) return 0x1008FF12;   // XF86AudioMute
-    if ([keyStr isEqualToString:@"play_pause"]) return 0x1008FF14;    // XF86AudioPlay
-    if ([keyStr isEqualToString:@"stop"]) return 0x1008FF15;          // XF86AudioStop
-    if ([keyStr isEqualToString:@"prev"]) return 0x1008FF16;          // XF86AudioPrev
-    if ([keyStr isEqualToString:@"next"]) return 0x1008FF17;          // XF86AudioNext
-    if ([keyStr isEqualToString:@"rewind"]) return 0x1008FF3E;        // XF86AudioRewind
-    if ([keyStr isEqualToString:@"forward"]) return 0x1008FF40;       // XF86AudioForward
-    
-    // Brightness controls
-    if ([keyStr isEqualToString:@"brightness_up"]) return 0x1008FF02;   // XF86MonBrightnessUp
-    if ([keyStr isEqualToString:@"brightness_down"]) return 0x1008FF03; // XF86MonBrightnessDown
-    
-    // Other multimedia keys
-    if ([keyStr isEqualToString:@"mail"]) return 0x1008FF19;          // XF86Mail
-    if ([keyStr isEqualToString:@"www"]) return 0x1008FF2E;           // XF86WWW
-    if ([keyStr isEqualToString:@"homepage"]) return 0x1008FF18;      // XF86HomePage
-    if ([keyStr isEqualToString:@"search"]) return 0x1008FF1B;        // XF86Search
-    if ([keyStr isEqualToString:@"calculator"]) return 0x1008FF1D;    // XF86Calculator
-    if ([keyStr isEqualToString:@"sleep"]) return 0x1008FF2F;         // XF86Sleep
-    if ([keyStr isEqualToString:@"wakeup"]) return 0x1008FF2B;        // XF86WakeUp
-    if ([keyStr isEqualToString:@"power"]) return 0x1008FF2A;         // XF86PowerOff
-    
-    // Screen controls
-    if ([keyStr isEqualToString:@"screensaver"]) return 0x1008FF2D;   // XF86ScreenSaver
-    if ([keyStr isEqualToString:@"standby"]) return 0x1008FF10;       // XF86Standby
-    
-    // Media controls
-    if ([keyStr isEqualToString:@"record"]) return 0x1008FF1C;        // XF86AudioRecord
-    if ([keyStr isEqualToString:@"eject"]) return 0x1008FF2C;         // XF86Eject
-    
-    // Try direct keysym lookup
-    return XStringToKeysym(cStr);
-}
-
 - (void)eventLoop
 {
     XEvent event;
     int consecutive_errors = 0;
     const int MAX_CONSECUTIVE_ERRORS = 10;
     
-    // Set up signal handlers for graceful shutdown
-    signal(SIGTERM, signalHandler);
-    signal(SIGINT, signalHandler);  // Ctrl+C
-    signal(SIGQUIT, signalHandler); // Ctrl+D equivalent
-    signal(SIGHUP, signalHandler);
-    signal(SIGCHLD, SIG_IGN); // Ignore child signals
-    signal(SIGPIPE, SIG_IGN); // Ignore pipe signals
+    if (![self setupSignalPipe]) {
+        running = NO;
+        return;
+    }
+    
+    controlSocket = [[ControlSocket alloc] initWithPath:[ControlSocket defaultPath] delegate:self];
+    if (![controlSocket open]) {
+        [self logWithFormat:@"Warning: No control socket, configuration changes need SIGHUP"];
+        [controlSocket release];
+        controlSocket = nil;
+    }
     
     [self logWithFormat:@"Starting event loop..."];
     
     while (running) {
         // Handle signals
-        if (signal_received) {
-            [self handleSignal:last_signal];
-            signal_received = NO;
-            last_signal = 0;
+        [self handlePendingSignals];
+        if (!running) {
+            break;
         }
         
         // Check X11 connection
@@ -584,6 +693,8 @@ static void signalHandler(int sig)
             [self grabKeys];
         }
         
+        BOOL mapping_changed = NO;
+        
         // Use XPending to check for events without blocking
         while (XPending(display) && running) {
             int result = XNextEvent(display, &event);
@@ -605,91 +716,260 @@ static void signalHandler(int sig)
             consecutive_errors = 0; // Reset error counter on success
             
             if (event.type == KeyPress) {
-                if (verbose) {
-                    [self logWithFormat:@"Key press: keycode=%d, state=0x%x", 
-                          event.xkey.keycode, event.xkey.state];
-                }
-                
-                // Mask out lock keys
-                event.xkey.state &= ~(numlock_mask | capslock_mask | scrolllock_mask);
-                
-                // Find matching shortcut
-                NSEnumerator *enumerator = [shortcuts keyEnumerator];
-                NSString *keyCombo;
-                BOOL found_match = NO;
-                
-                while ((keyCombo = [enumerator nextObject])) {
-                    if ([self matchesEvent:&event.xkey withKeyCombo:keyCombo]) {
-                        NSString *command = [shortcuts objectForKey:keyCombo];
-                        [self logWithFormat:@"Executing command for %@: %@", keyCombo, command];
-                        
-                        if (![self runCommand:command]) {
-                            [self logWithFormat:@"Warning: Failed to execute command: %@", command];
-                        }
-                        
-                        found_match = YES;
-                        break;
+                [self handleKeycode:event.xkey.keycode state:event.xkey.state device:0 time:event.xkey.time];
+            } else if (use_xinput2 && event.type == GenericEvent && event.xcookie.extension == xi_opcode) {
+                if (XGetEventData(display, &event.xcookie)) {
+                    if (event.xcookie.evtype == XI_KeyPress) {
+                        XIDeviceEvent *device_event = event.xcookie.data;
+                        [self handleKeycode:device_event->detail state:device_event->mods.effective
+                                     device:device_event->deviceid time:device_event->time];
                     }
+                    XFreeEventData(display, &event.xcookie);
                 }
-                
-                if (verbose && !found_match) {
-                    [self logWithFormat:@"No matching shortcut for keycode=%d, state=0x%x", 
-                        event.xkey.keycode, event.xkey.state];
+            } else if (event.type == MappingNotify) {
+                if (event.xmapping.request == MappingKeyboard || event.xmapping.request == MappingModifier) {
+                    XRefreshKeyboardMapping(&event.xmapping);
+                    mapping_changed = YES;
+                }
+            } else if (xkb_event_base >= 0 && event.type == xkb_event_base) {
+                XkbEvent *xkb_event = (XkbEvent *)&event;
+                if (xkb_event->any.xkb_type == XkbMapNotify) {
+                    XkbRefreshKeyboardMapping(&xkb_event->map);
+                    mapping_changed = YES;
+                } else if (xkb_event->any.xkb_type == XkbNewKeyboardNotify) {
+                    mapping_changed = YES;
                 }
             }
         }
         
-        // Small sleep to prevent busy waiting and allow signal processing
-        usleep(10000); // 10ms
+        // A layout switch sends a burst of notifications; rebuild once for all of them
+        if (mapping_changed && running) {
+            [self keyboardMappingChanged];
+        }
+        
+        // Regrabbing and signal handling may have read more events into
+        // Xlib's queue; poll() would not see those
+        if (!running || XPending(display)) {
+            continue;
+        }
+        
+        // Inside a key sequence, wake up in time to give up on the next stroke
+        int timeout = -1;
+        if (sequenceTable) {
+            long long remaining = sequence_deadline - monotonicMilliseconds();
+            if (remaining <= 0) {
+                if (verbose) {
+                    [self logWithFormat:@"Key sequence timed out"];
+                }
+                [self endSequence];
+                continue;
+            }
+            timeout = (int)remaining;
+        }
+        
+        // Sleep until the X server, a signal or a control client has something for us
+        struct pollfd fds[3 + ControlSocketMaxClients];
+        fds[0].fd = ConnectionNumber(display);
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = signal_pipe[0];
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+        NSUInteger control_count = [controlSocket addPollDescriptors:&fds[2]];
+        
+        int ready = poll(fds, 2 + control_count, timeout);
+        if (ready < 0 && errno != EINTR) {
+            [self logWithFormat:@"Error: poll failed: %s", strerror(errno)];
+            running = NO;
+        } else if (ready > 0 && control_count > 0) {
+            NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+            [controlSocket handlePollDescriptors:&fds[2] count:control_count];
+            [pool release];
+        }
     }
     
+    [controlSocket close];
+    [controlSocket release];
+    controlSocket = nil;
+    
+    int read_end = signal_pipe[0];
+    int write_end = signal_pipe[1];
+    signal_pipe[0] = signal_pipe[1] = -1;
+    close(read_end);
+    close(write_end);
+    
     [self logWithFormat:@"Event loop terminated"];
 }
 
-- (BOOL)matchesEvent:(XKeyEvent *)keyEvent withKeyCombo:(NSString *)keyCombo
+- (BOOL)setupSignalPipe
 {
-    NSArray *parts = parseKeyCombo(keyCombo);
-    if (!parts || [parts count] < 1) return NO;
-    
-    unsigned int modifier = 0;
-    NSString *keyString = nil;
-    
-    for (NSUInteger i = 0; i < [parts count]; i++) {
-        NSString *part = [[parts objectAtIndex:i] lowercaseString];
-        if ([part isEqualToString:@"ctrl"] || [part isEqualToString:@"control"]) {
-            modifier |= ControlMask;
-        } else if ([part isEqualToString:@"shift"]) {
-            modifier |= ShiftMask;
-        } else if ([part isEqualToString:@"alt"] || [part isEqualToString:@"mod1"]) {
-            modifier |= Mod1Mask;
-        } else if ([part isEqualToString:@"mod2"]) {
-            modifier |= Mod2Mask;
-        } else if ([part isEqualToString:@"mod3"]) {
-            modifier |= Mod3Mask;
-        } else if ([part isEqualToString:@"mod4"]) {
-            modifier |= Mod4Mask;
-        } else if ([part isEqualToString:@"mod5"]) {
-            modifier |= Mod5Mask;
+    if (signal_pipe[0] < 0) {
+        if (pipe(signal_pipe) < 0) {
+            [self logWithFormat:@"Error: Could not create signal pipe: %s", strerror(errno)];
+            return NO;
+        }
+        
+        // Neither end may block, and commands must not inherit them
+        for (int i = 0; i < 2; i++) {
+            fcntl(signal_pipe[i], F_SETFL, fcntl(signal_pipe[i], F_GETFL) | O_NONBLOCK);
+            fcntl(signal_pipe[i], F_SETFD, FD_CLOEXEC);
+        }
+    }
+    
+    // Set up signal handlers for graceful shutdown
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = signalHandler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);  // Ctrl+C
+    sigaction(SIGQUIT, &action, NULL); // Ctrl+D equivalent
+    sigaction(SIGHUP, &action, NULL);
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &action, NULL); // Reap launched commands
+    signal(SIGPIPE, SIG_IGN); // Ignore pipe signals
+    
+    return YES;
+}
+
+- (void)handlePendingSignals
+{
+    unsigned char pending[64];
+    BOOL reload = NO;
+    BOOL reap = NO;
+    ssize_t count;
+    
+    while ((count = read(signal_pipe[0], pending, sizeof(pending))) > 0) {
+        for (ssize_t i = 0; i < count; i++) {
+            if (pending[i] == SIGHUP) {
+                // Several HUPs in a row (e.g. a burst of edits) need one reload
+                reload = YES;
+            } else if (pending[i] == SIGCHLD) {
+                reap = YES;
+            } else {
+                [self handleSignal:pending[i]];
+            }
+        }
+    }
+    
+    if (reap) {
+        [launcher reapChildren];
+    }
+    
+    if (reload && running) {
+        [self handleSignal:SIGHUP];
+    }
+}
+
+- (void)handleKeycode:(KeyCode)keycode state:(unsigned int)state device:(int)deviceid time:(Time)time
+{
+    if (verbose) {
+        [self logWithFormat:@"Key press: keycode=%d, state=0x%x", keycode, state];
+    }
+    
+    // Mask out lock keys and pointer buttons
+    state &= ShortcutModifierMask & ~(numlock_mask | capslock_mask | scrolllock_mask);
+    
+    // Find matching shortcut, or the next stroke of the sequence in progress
+    ShortcutTable *table = sequenceTable ? sequenceTable : shortcutTable;
+    const ShortcutBinding *binding = [table bindingForKeycode:keycode state:state];
+    
+    if (!binding) {
+        if (sequenceTable) {
+            // Modifiers for the next stroke and the prefix key repeating do not end the sequence
+            if (keycode == sequence_keycode || IsModifierKey(XkbKeycodeToKeysym(display, keycode, 0, 0))) {
+                return;
+            }
+            if (verbose) {
+                [self logWithFormat:@"Key sequence ended by keycode=%d, state=0x%x", keycode, state];
+            }
+            [self endSequence];
+        } else if (verbose) {
+            [self logWithFormat:@"No matching shortcut for keycode=%d, state=0x%x", keycode, state];
+        }
+        return;
+    }
+    
+    if (binding->sequel) {
+        [self beginSequence:binding->sequel keycode:keycode device:deviceid time:time];
+        return;
+    }
+    
+    // Ending the sequence may free the table the binding is in
+    NSString *comboString = [[binding->comboString retain] autorelease];
+    NSString *command = [[binding->command retain] autorelease];
+    [self endSequence];
+    
+    [self logWithFormat:@"Executing command for %@: %@", comboString, command];
+    if (![self runCommand:command]) {
+        [self logWithFormat:@"Warning: Failed to execute command: %@", command];
+    }
+}
+
+- (void)beginSequence:(ShortcutTable *)sequel keycode:(KeyCode)keycode device:(int)deviceid time:(Time)time
+{
+    // The next stroke must not reach the focused window, so hold the whole
+    // keyboard until it comes; the passive grab only covers the prefix key
+    if (!sequenceTable) {
+        Window root = DefaultRootWindow(display);
+        BOOL grabbed;
+        
+        if (use_xinput2) {
+            unsigned char bits[XIMaskLen(XI_LASTEVENT)];
+            memset(bits, 0, sizeof(bits));
+            XISetMask(bits, XI_KeyPress);
+            XIEventMask mask = { deviceid, sizeof(bits), bits };
+            grabbed = (XIGrabDevice(display, deviceid, root, time, None, GrabModeAsync, GrabModeAsync,
+                                    False, &mask) == Success);
         } else {
-            keyString = part;
+            grabbed = (XGrabKeyboard(display, root, False, GrabModeAsync, GrabModeAsync, time) == GrabSuccess);
         }
+        
+        if (!grabbed) {
+            [self logWithFormat:@"Warning: Could not grab the keyboard for a key sequence"];
+            return;
+        }
+        sequence_device = deviceid;
     }
     
-    if (!keyString) return NO;
+    [sequel retain];
+    [sequenceTable release];
+    sequenceTable = sequel;
+    sequence_keycode = keycode;
+    sequence_deadline = monotonicMilliseconds() + sequence_timeout;
     
-    KeyCode keycode = 0;
+    if (verbose) {
+        [self logWithFormat:@"Waiting %d ms for the next stroke (%lu continuations)",
+            sequence_timeout, (unsigned long)[sequel bindingCount]];
+    }
+}
+
+- (void)endSequence
+{
+    if (!sequenceTable) {
+        return;
+    }
     
-    // Check if it's a raw keycode (format: "code:28")
-    if ([keyString hasPrefix:@"code:"]) {
-        NSString *codeStr = [keyString substringFromIndex:5];
-        keycode = [codeStr intValue];
+    if (use_xinput2) {
+        XIUngrabDevice(display, sequence_device, CurrentTime);
     } else {
-        // Parse as keysym
-        KeySym keysym = [self parseKeyString:keyString];
-        keycode = XKeysymToKeycode(display, keysym);
+        XUngrabKeyboard(display, CurrentTime);
     }
+    XFlush(display);
     
-    return (keyEvent->keycode == keycode && keyEvent->state == modifier);
+    [sequenceTable release];
+    sequenceTable = nil;
+}
+
+- (void)keyboardMappingChanged
+{
+    [self logWithFormat:@"Keyboard mapping changed, rebuilding shortcut table..."];
+    
+    // Keycodes and the lock modifiers may both have moved
+    [self ungrabKeys];
+    [self getOffendingModifiers];
+    [self grabKeys];
 }
 
 - (BOOL)runCommand:(NSString *)command
@@ -715,7 +995,10 @@ static void signalHandler(int sig)
     NSString *executable = [components objectAtIndex:0];
     
     // Security check - reject commands with dangerous characters
-    NSCharacterSet *dangerousChars = [NSCharacterSet characterSetWithCharactersInString:@"`$;|&<>"];
+    static NSCharacterSet *dangerousChars = nil;
+    if (!dangerousChars) {
+        dangerousChars = [[NSCharacterSet characterSetWithCharactersInString:@"`$;|&<>"] retain];
+    }
     if ([command rangeOfCharacterFromSet:dangerousChars].location != NSNotFound) {
         [self logWithFormat:@"Warning: Command contains potentially dangerous characters: %@", command];
     }
@@ -731,59 +1014,12 @@ static void signalHandler(int sig)
         [self logWithFormat:@"Found executable: %@ -> %@", executable, fullPath];
     }
     
-    pid_t pid = fork();
-    if (pid == 0) {
-        // Child process
-        setsid();
-        
-        // Close file descriptors to avoid inheriting them
-        close(STDIN_FILENO);
-        close(STDOUT_FILENO);
-        close(STDERR_FILENO);
-        
-        // Redirect to /dev/null
-        int devnull = open("/dev/null", O_RDWR);
-        if (devnull >= 0) {
-            dup2(devnull, STDIN_FILENO);
-            dup2(devnull, STDOUT_FILENO);
-            dup2(devnull, STDERR_FILENO);
-            if (devnull > STDERR_FILENO) {
-                close(devnull);
-            }
-        }
-        
-        pid_t grandchild = fork();
-        if (grandchild == 0) {
-            // Grandchild process - execute command
-            const char *shell = getenv("SHELL");
-            if (!shell) shell = "/bin/sh";
-            
-            execl(shell, shell, "-c", [command UTF8String], (char *)NULL);
-            _exit(127); // exec failed
-        } else if (grandchild > 0) {
-            _exit(0); // Child exits immediately
-        } else {
-            _exit(1); // Fork failed
-        }
-    } else if (pid > 0) {
-        // Parent process - wait for child to exit
-        int status;
-        if (waitpid(pid, &status, 0) < 0) {
-            [self logWithFormat:@"Warning: waitpid failed for command: %@", command];
-            return NO;
-        }
-        
-        if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
-            [self logWithFormat:@"Warning: child process exited with status %d for command: %@", 
-                WEXITSTATUS(status), command];
-            return NO;
-        }
-        
-        return YES;
-    } else {
-        [self logWithFormat:@"Error: failed to fork process for command: %@", command];
+    // Children are collected on SIGCHLD (see handlePendingSignals)
+    if ([launcher launchCommand:command executable:fullPath] < 0) {
         return NO;
     }
+    
+    return YES;
 }
 
 - (void)handleSignal:(int)sig
@@ -797,13 +1033,7 @@ static void signalHandler(int sig)
             break;
         case SIGHUP:
             [self logWithFormat:@"Received HUP signal, reloading configuration..."];
-            [self ungrabKeys];
-            if ([self loadShortcuts]) {
-                [self logWithFormat:@"Configuration reloaded successfully, grabbing keys..."];
-                [self grabKeys];
-            } else {
-                [self logWithFormat:@"Warning: Failed to reload configuration"];
-            }
+            [self reloadConfiguration];
             break;
         default:
             [self logWithFormat:@"Received unexpected signal: %d", sig];
@@ -811,6 +1041,19 @@ static void signalHandler(int sig)
     }
 }
 
+- (void)reloadConfiguration
+{
+    [self ungrabKeys];
+    if ([self loadShortcuts]) {
+        [self logWithFormat:@"Configuration reloaded successfully, grabbing keys..."];
+        [self grabKeys];
+        [controlSocket broadcastEvent:[NSArray arrayWithObjects:@"reloaded",
+            [NSString stringWithFormat:@"%lu", (unsigned long)[shortcuts count]], nil]];
+    } else {
+        [self logWithFormat:@"Warning: Failed to reload configuration"];
+    }
+}
+
 - (void)terminate
 {
     running = NO;
@@ -818,39 +1061,8 @@ static void signalHandler(int sig)
 
 - (NSString *)findExecutableInPath:(NSString *)command
 {
-    // If command contains a slash, treat it as an absolute or relative path
-    if ([command containsString:@"/"]) {
-        struct stat statbuf;
-        const char *cPath = [command UTF8String];
-        if (stat(cPath, &statbuf) == 0 && (statbuf.st_mode & S_IXUSR)) {
-            return command;
-        }
-        return nil;
-    }
-    
-    // Search in PATH
-    NSString *pathEnv = [[[NSProcessInfo processInfo] environment] objectForKey:@"PATH"];
-    if (!pathEnv) {
-        pathEnv = @"/usr/local/bin:/usr/bin:/bin";
-    }
-    
-    NSArray *pathComponents = [pathEnv componentsSeparatedByString:@":"];
-    NSEnumerator *enumerator = [pathComponents objectEnumerator];
-    NSString *pathDir;
-    
-    while ((pathDir = [enumerator nextObject])) {
-        if ([pathDir length] == 0) continue;
-        
-        NSString *fullPath = [pathDir stringByAppendingPathComponent:command];
-        struct stat statbuf;
-        const char *cPath = [fullPath UTF8String];
-        
-        if (stat(cPath, &statbuf) == 0 && (statbuf.st_mode & S_IXUSR)) {
-            return fullPath;
-        }
-    }
-    
-    return nil;
+    // Cached by the launcher and dropped when a $PATH directory changes
+    return [launcher resolveExecutable:command];
 }
 
 - (void)logWithFormat:(NSString *)format, ...
@@ -872,34 +1084,47 @@ static void signalHandler(int sig)
         return NO;
     }
     
-    NSArray *parts = parseKeyCombo(keyCombo);
-    if (!parts || [parts count] < 1) {
+    NSArray *strokes = ShortcutSequenceStrokes(keyCombo);
+    if ([strokes count] < 1) {
         return NO;
     }
     
-    BOOL hasModifier = NO;
-    BOOL hasKey = NO;
-    
-    for (NSString *part in parts) {
-        NSString *cleanPart = [[part stringByTrimmingCharactersInSet:
-            [NSCharacterSet whitespaceCharacterSet]] lowercaseString];
-        
-        if ([cleanPart length] == 0) {
+    for (NSUInteger i = 0; i < [strokes count]; i++) {
+        NSArray *parts = ShortcutComboComponents([strokes objectAtIndex:i]);
+        if (!parts || [parts count] < 1) {
             return NO;
         }
         
-        if ([cleanPart isEqualToString:@"ctrl"] || [cleanPart isEqualToString:@"control"] ||
-            [cleanPart isEqualToString:@"shift"] || [cleanPart isEqualToString:@"alt"] ||
-            [cleanPart isEqualToString:@"mod1"] || [cleanPart isEqualToString:@"mod2"] ||
-            [cleanPart isEqualToString:@"mod3"] || [cleanPart isEqualToString:@"mod4"] ||
-            [cleanPart isEqualToString:@"mod5"]) {
-            hasModifier = YES;
-        } else {
-            hasKey = YES;
+        BOOL hasModifier = NO;
+        BOOL hasKey = NO;
+        
+        for (NSString *part in parts) {
+            NSString *cleanPart = [[part stringByTrimmingCharactersInSet:
+                [NSCharacterSet whitespaceCharacterSet]] lowercaseString];
+            
+            if ([cleanPart length] == 0) {
+                return NO;
+            }
+            
+            if ([cleanPart isEqualToString:@"ctrl"] || [cleanPart isEqualToString:@"control"] ||
+                [cleanPart isEqualToString:@"shift"] || [cleanPart isEqualToString:@"alt"] ||
+                [cleanPart isEqualToString:@"mod1"] || [cleanPart isEqualToString:@"mod2"] ||
+                [cleanPart isEqualToString:@"mod3"] || [cleanPart isEqualToString:@"mod4"] ||
+                [cleanPart isEqualToString:@"mod5"]) {
+                hasModifier = YES;
+            } else {
+                hasKey = YES;
+            }
+        }
+        
+        // Only the first stroke is grabbed globally, so only it needs a
+        // modifier; later strokes may be plain keys
+        if (!hasKey || (i == 0 && !hasModifier)) {
+            return NO;
         }
     }
     
-    return hasModifier && hasKey;
+    return YES;
 }
 
 - (void)validateConfiguration
@@ -932,6 +1157,183 @@ static void signalHandler(int sig)
     [self logWithFormat:@"Configuration validation: %d valid, %d invalid shortcuts", 
         valid_shortcuts, invalid_shortcuts];
 }
+
+#pragma mark - Control socket
+
+// Applies one new shortcut to the table and the grabs; returns nil or an error message
+- (NSString *)addShortcut:(NSString *)keyCombo command:(NSString *)command
+{
+    if (![self isValidKeyCombo:keyCombo]) {
+        return @"invalid key combination";
+    }
+    if ([command length] == 0) {
+        return @"empty command";
+    }
+    if ([shortcuts objectForKey:keyCombo]) {
+        return @"key combination already configured";
+    }
+    
+    ShortcutCombo strokes[ShortcutSequenceMaxStrokes];
+    NSUInteger count = 0;
+    NSString *error = nil;
+    if (![self parseSequence:keyCombo strokes:strokes count:&count error:&error]) {
+        return error;
+    }
+    
+    // Only a new first stroke needs a grab; an existing prefix already has one
+    const ShortcutBinding *existing = [shortcutTable bindingWithCombo:&strokes[0]];
+    const ShortcutBinding *binding;
+    
+    [self endSequence];
+    if (count == 1) {
+        if (existing && existing->sequel) {
+            return @"key combination starts a key sequence";
+        }
+        binding = [shortcutTable insertCombo:&strokes[0] string:keyCombo command:command display:display];
+    } else {
+        if (![shortcutTable addSequence:strokes count:count string:keyCombo command:command]) {
+            return @"key sequence conflicts with an existing shortcut";
+        }
+        // Resolving keycodes makes no requests; this places the new strokes
+        [shortcutTable resolveKeycodesForDisplay:display];
+        binding = [shortcutTable bindingWithCombo:&strokes[0]];
+    }
+    KeyCode keycode = binding->keycode;
+    unsigned int modifiers = strokes[0].modifiers;
+    [shortcuts setObject:command forKey:keyCombo];
+    [launcher warmCommand:command];
+    
+    if (keycode == 0) {
+        [self logWithFormat:@"Warning: no keycode mapping for key in '%@'", keyCombo];
+        return nil;
+    }
+    
+    // An earlier binding for the same key and modifiers already holds the grab
+    if (existing || [shortcutTable bindingForKeycode:keycode state:modifiers] != binding) {
+        return nil;
+    }
+    
+    if (![self grabKey:keycode modifier:modifiers forCombo:keyCombo]) {
+        [self ungrabKey:keycode modifier:modifiers];
+        [shortcutTable removeBindingForCombo:keyCombo];
+        [shortcuts removeObjectForKey:keyCombo];
+        return @"key combination already grabbed by another application";
+    }
+    
+    if (verbose) {
+        [self logWithFormat:@"Grabbed key combination: %@ (keycode=%d, modifier=0x%x)",
+              keyCombo, keycode, modifiers];
+    }
+    return nil;
+}
+
+- (NSString *)removeShortcut:(NSString *)keyCombo
+{
+    if (![shortcuts objectForKey:keyCombo]) {
+        return @"key combination not configured";
+    }
+    
+    // The grab is on the first stroke; combos that failed to compile are
+    // configured but have no binding
+    ShortcutCombo strokes[ShortcutSequenceMaxStrokes];
+    NSUInteger count = 0;
+    NSString *error = nil;
+    const ShortcutBinding *binding = NULL;
+    if ([self parseSequence:keyCombo strokes:strokes count:&count error:&error]) {
+        binding = [shortcutTable bindingWithCombo:&strokes[0]];
+    }
+    KeyCode keycode = binding ? binding->keycode : 0;
+    unsigned int modifiers = binding ? binding->combo.modifiers : 0;
+    
+    [self endSequence];
+    [shortcutTable removeBindingForCombo:keyCombo];
+    [shortcuts removeObjectForKey:keyCombo];
+    
+    // Keep the grab if a binding this one shadowed, or another sequence with
+    // the same prefix, still uses the key
+    if (keycode != 0 && ![shortcutTable bindingForKeycode:keycode state:modifiers]) {
+        [self ungrabKey:keycode modifier:modifiers];
+    }
+    return nil;
+}
+
+- (NSArray *)controlSocket:(ControlSocket *)control handleRequest:(NSArray *)fields
+{
+    NSString *request = [fields objectAtIndex:0];
+    NSUInteger argc = [fields count] - 1;
+    NSString *error = nil;
+    
+    if (verbose) {
+        [self logWithFormat:@"Control request: %@", [fields componentsJoinedByString:@" "]];
+    }
+    
+    if ([request isEqualToString:@"status"] && argc == 0) {
+        return [NSArray arrayWithObject:[NSArray arrayWithObjects:@"ok",
+            [NSString stringWithFormat:@"%d", getpid()],
+            [NSString stringWithFormat:@"%lu", (unsigned long)[shortcuts count]],
+            [NSString stringWithFormat:@"%lu", (unsigned long)[shortcutTable bindingCount]], nil]];
+    }
+    
+    if ([request isEqualToString:@"list"] && argc == 0) {
+        NSMutableArray *replies = [NSMutableArray arrayWithCapacity:[shortcuts count] + 1];
+        NSArray *keys = [[shortcuts allKeys] sortedArrayUsingSelector:@selector(compare:)];
+        for (NSString *keyCombo in keys) {
+            [replies addObject:[NSArray arrayWithObjects:@"binding", keyCombo,
+                [shortcuts objectForKey:keyCombo], nil]];
+        }
+        [replies addObject:[NSArray arrayWithObjects:@"ok",
+            [NSString stringWithFormat:@"%lu", (unsigned long)[keys count]], nil]];
+        return replies;
+    }
+    
+    if ([request isEqualToString:@"add"] && argc == 2) {
+        NSString *keyCombo = [fields objectAtIndex:1];
+        NSString *command = [fields objectAtIndex:2];
+        error = [self addShortcut:keyCombo command:command];
+        if (!error) {
+            [self logWithFormat:@"Added shortcut %@ -> %@", keyCombo, command];
+            [control broadcastEvent:[NSArray arrayWithObjects:@"added", keyCombo, command, nil]];
+        }
+    } else if ([request isEqualToString:@"remove"] && argc == 1) {
+        NSString *keyCombo = [fields objectAtIndex:1];
+        error = [self removeShortcut:keyCombo];
+        if (!error) {
+            [self logWithFormat:@"Removed shortcut %@", keyCombo];
+            [control broadcastEvent:[NSArray arrayWithObjects:@"removed", keyCombo, nil]];
+        }
+    } else if ([request isEqualToString:@"replace"] && argc == 3) {
+        NSString *oldCombo = [fields objectAtIndex:1];
+        NSString *keyCombo = [fields objectAtIndex:2];
+        NSString *command = [fields objectAtIndex:3];
+        NSString *oldCommand = [[[shortcuts objectForKey:oldCombo] retain] autorelease];
+        
+        error = [self removeShortcut:oldCombo];
+        if (!error) {
+            error = [self addShortcut:keyCombo command:command];
+            if (error) {
+                // Put the old shortcut back, so a failed replace changes nothing
+                [self addShortcut:oldCombo command:oldCommand];
+            } else {
+                [self logWithFormat:@"Replaced shortcut %@ with %@ -> %@", oldCombo, keyCombo, command];
+                [control broadcastEvent:[NSArray arrayWithObjects:@"removed", oldCombo, nil]];
+                [control broadcastEvent:[NSArray arrayWithObjects:@"added", keyCombo, command, nil]];
+            }
+        }
+    } else if ([request isEqualToString:@"reload"] && argc == 0) {
+        [self logWithFormat:@"Reload requested over the control socket..."];
+        [self reloadConfiguration];
+        return [NSArray arrayWithObject:[NSArray arrayWithObjects:@"ok",
+            [NSString stringWithFormat:@"%lu", (unsigned long)[shortcuts count]], nil]];
+    } else {
+        error = [NSString stringWithFormat:@"unknown request '%@' with %lu arguments",
+            request, (unsigned long)argc];
+    }
+    
+    if (error) {
+        return [NSArray arrayWithObject:[NSArray arrayWithObjects:@"error", error, nil]];
+    }
+    return [NSArray arrayWithObject:[NSArray arrayWithObject:@"ok"]];
+}
 @end
 
 // Usage function
@@ -939,8 +1341,12 @@ void showUsage(const char *progname)
 {
     printf("Usage: %s [options]\n", progname);
     printf("Options:\n");
-    printf("  -v, --verbose    Enable verbose output\n");
-    printf("  -h, --help       Show this help\n");
+    printf("  -v, --verbose      Enable verbose output\n");
+    printf("  -w, --warm-helper  Start commands from a small pre-forked helper process\n");
+    printf("  -x, --xinput2      Grab and read keys through XInput2\n");
+    printf("  -t, --sequence-timeout ms\n");
+    printf("                     Time to wait for the next stroke of a key sequence (default 1500)\n");
+    printf("  -h, --help         Show this help\n");
     printf("\n");
     printf("Configuration:\n");
     printf("Uses GNUstep defaults system for configuration.\n");
@@ -955,6 +1361,7 @@ void showUsage(const char *progname)
     printf("Modifiers: ctrl, shift, alt, mod2, mod3, mod4, mod5\n");
     printf("Keys: a-z, 0-9, f1-f24, space, return, tab, escape, etc.\n");
     printf("Raw keycodes: code:28 (where 28 is the keycode number)\n");
+    printf("Key sequences: strokes separated by spaces, e.g. 'mod4+x t'\n");
     printf("\n");
     printf("Multimedia keys:\n");
     printf("  volume_up, volume_down, volume_mute\n");
@@ -970,6 +1377,10 @@ void showUsage(const char *progname)
     printf("Delete configuration:\n");
     printf("  defaults delete GlobalShortcuts\n");
     printf("\n");
+    printf("Control socket:\n");
+    printf("  %s\n", [[ControlSocket defaultPath] fileSystemRepresentation]);
+    printf("  Requests: status, list, add, remove, replace, reload, subscribe\n");
+    printf("\n");
     printf("Signals:\n");
     printf("  SIGHUP  - Reload configuration\n");
     printf("  SIGTERM - Graceful shutdown\n");
@@ -981,12 +1392,26 @@ int main(int argc, char *argv[])
     NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
     
     BOOL verbose = NO;
+    BOOL warm_helper = NO;
+    BOOL xinput2 = NO;
+    int sequence_timeout = 1500;
     int exit_code = 0;
     
     // Parse command line arguments
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "--verbose") == 0) {
             verbose = YES;
+        } else if (strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "--warm-helper") == 0) {
+            warm_helper = YES;
+        } else if (strcmp(argv[i], "-x") == 0 || strcmp(argv[i], "--xinput2") == 0) {
+            xinput2 = YES;
+        } else if ((strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--sequence-timeout") == 0) && i + 1 < argc) {
+            sequence_timeout = atoi(argv[++i]);
+            if (sequence_timeout <= 0) {
+                fprintf(stderr, "Invalid sequence timeout: %s\n", argv[i]);
+                [pool release];
+                return 1;
+            }
         } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
             showUsage(argv[0]);
             [pool release];
@@ -1027,6 +1452,15 @@ int main(int argc, char *argv[])
     }
     
     daemon->verbose = verbose;
+    daemon->use_xinput2 = xinput2;
+    daemon->sequence_timeout = sequence_timeout;
+    [daemon->launcher setVerbose:verbose];
+    
+    // Fork the helper while the process is still small: before the X
+    // connection and the configuration exist
+    if (warm_helper && ![daemon->launcher startWarmHelper]) {
+        [daemon logWithFormat:@"Warning: Failed to start warm helper, launching commands directly"];
+    }
     
     [daemon logWithFormat:@"globalshortcutsd starting (verbose=%@, pid=%d)...", 
         verbose ? @"YES" : @"NO", getpid()];
@@ -0,0 +1,329 @@
+/*
+ * dsstore-gen - writes a synthetic .DS_Store with a given number of records
+ *
+ *   dsstore-gen [-1] -n COUNT OUTPUT
+ *       Writes COUNT records: an Iloc for each of COUNT - 3 files with a mix
+ *       of name styles, plus bwsp, icvp and vSrn for the directory itself.
+ *       Prints the file names, one per line, for open-bench to query.
+ *
+ *       By default the records are bulk-loaded into 4 KiB pages under as
+ *       many levels of internal nodes as they need, as Finder lays out a
+ *       large directory. With -1 they go into a single leaf block as big as
+ *       they need, the only shape -[DSStore save] used to write.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#define PAGE_SIZE 4096
+#define PAGE_SHIFT 12
+#define FIRST_NODE_OFFSET 0x1000
+
+typedef struct {
+    char name[64];
+    char code[5];
+    uint8_t *bytes;             // The whole record as stored
+    size_t length;
+} Record;
+
+typedef struct {
+    uint8_t *bytes;
+    size_t length;              // PAGE_SIZE, or the single leaf's block size
+    uint32_t shift;             // log2 of length
+} Block;
+
+static Block *nodes;
+static size_t nodeCount;
+static size_t nodeCapacity;
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: dsstore-gen [-1] -n COUNT OUTPUT\n");
+    exit(2);
+}
+
+static void putBigEndian32(uint8_t *bytes, uint32_t value)
+{
+    bytes[0] = value >> 24;
+    bytes[1] = value >> 16;
+    bytes[2] = value >> 8;
+    bytes[3] = value;
+}
+
+// Finder's order, for the ASCII names used here: case-insensitive, then code
+static int compareRecords(const void *a, const void *b)
+{
+    const Record *x = a;
+    const Record *y = b;
+    int order = strcasecmp(x->name, y->name);
+    if (order != 0) {
+        return order;
+    }
+    return memcmp(x->code, y->code, 4);
+}
+
+static void makeRecord(Record *record, const char *name, const char *code, const char *type,
+                       const uint8_t *value, size_t valueLength)
+{
+    size_t nameLength = strlen(name);
+
+    snprintf(record->name, sizeof(record->name), "%s", name);
+    memcpy(record->code, code, 5);
+    record->length = 4 + 2 * nameLength + 8 + valueLength;
+    record->bytes = malloc(record->length);
+
+    uint8_t *at = record->bytes;
+    putBigEndian32(at, (uint32_t)nameLength);
+    at += 4;
+    for (size_t i = 0; i < nameLength; i++) {
+        *at++ = 0;
+        *at++ = (uint8_t)name[i];
+    }
+    memcpy(at, code, 4);
+    memcpy(at + 4, type, 4);
+    memcpy(at + 8, value, valueLength);
+}
+
+static void makeBlobRecord(Record *record, const char *name, const char *code, const uint8_t *blob, size_t blobLength)
+{
+    uint8_t value[256];
+    putBigEndian32(value, (uint32_t)blobLength);
+    memcpy(value + 4, blob, blobLength);
+    makeRecord(record, name, code, "blob", value, 4 + blobLength);
+}
+
+static Block *newNode(size_t length, uint32_t shift)
+{
+    if (nodeCount == nodeCapacity) {
+        nodeCapacity = nodeCapacity ? nodeCapacity * 2 : 64;
+        nodes = realloc(nodes, nodeCapacity * sizeof(Block));
+    }
+    Block *node = &nodes[nodeCount++];
+    node->bytes = calloc(1, length);
+    node->length = length;
+    node->shift = shift;
+    return node;
+}
+
+/*
+ * Packs one level of the tree into full pages. records[i] sorts between
+ * children[i] and children[i + 1]; children is NULL for the leaf level. The
+ * record that does not fit in a page moves up to separate it from the next,
+ * and the level above is built from those separators and the new pages.
+ */
+static void buildLevel(Record *records, size_t count, uint32_t *children,
+                       Record **upRecords, size_t *upCount, uint32_t **upChildren)
+{
+    *upRecords = malloc(sizeof(Record) * (count + 1));
+    *upChildren = malloc(sizeof(uint32_t) * (count + 2));
+    *upCount = 0;
+
+    size_t i = 0;
+    size_t pages = 0;
+    for (;;) {
+        uint32_t blockNumber = 2 + (uint32_t)nodeCount;
+        Block *node = newNode(PAGE_SIZE, PAGE_SHIFT);
+        size_t used = 8;
+        size_t inNode = 0;
+        size_t lastStart = 0;
+
+        while (i < count) {
+            size_t need = records[i].length + (children ? 4 : 0);
+            if (used + need > PAGE_SIZE && inNode > 0) {
+                break;
+            }
+            lastStart = used;
+            if (children) {
+                putBigEndian32(node->bytes + used, children[i]);
+                used += 4;
+            }
+            memcpy(node->bytes + used, records[i].bytes, records[i].length);
+            used += records[i].length;
+            inNode++;
+            i++;
+        }
+
+        // A lone last record would leave the next page empty; move one back
+        if (i == count - 1 && inNode > 1) {
+            memset(node->bytes + lastStart, 0, used - lastStart);
+            inNode--;
+            i--;
+        }
+
+        putBigEndian32(node->bytes, children ? children[i] : 0);
+        putBigEndian32(node->bytes + 4, (uint32_t)inNode);
+        (*upChildren)[pages++] = blockNumber;
+
+        if (i >= count) {
+            break;
+        }
+        (*upRecords)[(*upCount)++] = records[i++];
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long count = 0;
+    int singleLeaf = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "1n:")) != -1) {
+        if (opt == '1') {
+            singleLeaf = 1;
+        } else if (opt == 'n') {
+            count = atol(optarg);
+        } else {
+            usage();
+        }
+    }
+    if (argc - optind != 1 || count < 3) {
+        usage();
+    }
+
+    // The directory's own records, then one Iloc per file
+    Record *records = calloc(count, sizeof(Record));
+    static const uint8_t bwsp[] = "bplist00 window state";
+    static const uint8_t icvp[] = "bplist00 icon view settings";
+    static const uint8_t vSrn[4] = { 0, 0, 0, 1 };
+    makeBlobRecord(&records[0], ".", "bwsp", bwsp, sizeof(bwsp) - 1);
+    makeBlobRecord(&records[1], ".", "icvp", icvp, sizeof(icvp) - 1);
+    makeRecord(&records[2], ".", "vSrn", "long", vSrn, sizeof(vSrn));
+
+    for (long i = 3; i < count; i++) {
+        char name[64];
+        long n = i - 3;
+        switch (n % 4) {
+            case 0: snprintf(name, sizeof(name), "IMG_%05ld.JPG", n); break;
+            case 1: snprintf(name, sizeof(name), "document %ld.pdf", n); break;
+            case 2: snprintf(name, sizeof(name), "Notes-%ld.txt", n); break;
+            default: snprintf(name, sizeof(name), "src_%ld", n); break;
+        }
+        uint8_t iloc[16];
+        putBigEndian32(iloc, (uint32_t)(40 + (n % 10) * 100));
+        putBigEndian32(iloc + 4, (uint32_t)(40 + (n / 10) * 100));
+        memset(iloc + 8, 0xFF, 6);
+        iloc[14] = iloc[15] = 0;
+        makeBlobRecord(&records[i], name, "Iloc", iloc, sizeof(iloc));
+    }
+    qsort(records, count, sizeof(Record), compareRecords);
+
+    uint32_t rootNode;
+    uint32_t levels = 0;    // Internal levels above the leaves
+    if (singleLeaf) {
+        size_t total = 8;
+        for (long i = 0; i < count; i++) {
+            total += records[i].length;
+        }
+        uint32_t shift = PAGE_SHIFT;
+        while (((size_t)1 << shift) < total) {
+            shift++;
+        }
+        Block *leaf = newNode((size_t)1 << shift, shift);
+        size_t used = 8;
+        for (long i = 0; i < count; i++) {
+            memcpy(leaf->bytes + used, records[i].bytes, records[i].length);
+            used += records[i].length;
+        }
+        putBigEndian32(leaf->bytes + 4, (uint32_t)count);
+        rootNode = 2;
+    } else {
+        Record *level = records;
+        size_t levelCount = count;
+        uint32_t *children = NULL;
+        for (;;) {
+            Record *upRecords;
+            size_t upCount;
+            uint32_t *upChildren;
+            size_t firstNode = nodeCount;
+            buildLevel(level, levelCount, children, &upRecords, &upCount, &upChildren);
+            if (level != records) {
+                free(level);
+            }
+            free(children);
+            if (nodeCount - firstNode == 1) {
+                rootNode = 2 + (uint32_t)firstNode;
+                free(upRecords);
+                free(upChildren);
+                break;
+            }
+            level = upRecords;
+            levelCount = upCount;
+            children = upChildren;
+            levels++;
+        }
+    }
+
+    // Place every node at an offset aligned to its size, as the buddy allocator does
+    uint32_t blockCount = 2 + (uint32_t)nodeCount;
+    uint32_t *addresses = calloc(blockCount, sizeof(uint32_t));
+    size_t offset = FIRST_NODE_OFFSET;
+    for (size_t i = 0; i < nodeCount; i++) {
+        size_t size = nodes[i].length;
+        offset = (offset + size - 1) & ~(size - 1);
+        addresses[2 + i] = (uint32_t)offset | nodes[i].shift;
+        offset += size;
+    }
+
+    // Root block: block count, an unknown word, the offset table padded to
+    // 256 entries, the table of contents and 32 empty free lists
+    size_t tableEntries = (blockCount + 255) & ~(size_t)255;
+    size_t rootLength = 8 + 4 * tableEntries + 4 + 9 + 32 * 4;
+    uint32_t rootShift = 11;
+    while (((size_t)1 << rootShift) < rootLength) {
+        rootShift++;
+    }
+    size_t rootSize = (size_t)1 << rootShift;
+    size_t rootOffset = (offset + rootSize - 1) & ~(rootSize - 1);
+    addresses[0] = (uint32_t)rootOffset | rootShift;
+    addresses[1] = 0x20 | 5;
+
+    size_t fileLength = 4 + rootOffset + rootSize;
+    uint8_t *file = calloc(1, fileLength);
+
+    putBigEndian32(file, 1);
+    memcpy(file + 4, "Bud1", 4);
+    putBigEndian32(file + 8, (uint32_t)rootOffset);
+    putBigEndian32(file + 12, (uint32_t)rootSize);
+    putBigEndian32(file + 16, (uint32_t)rootOffset);
+
+    uint8_t *superblock = file + 4 + 0x20;
+    putBigEndian32(superblock, rootNode);
+    putBigEndian32(superblock + 4, levels);
+    putBigEndian32(superblock + 8, (uint32_t)count);
+    putBigEndian32(superblock + 12, (uint32_t)nodeCount);
+    putBigEndian32(superblock + 16, PAGE_SIZE);
+
+    for (size_t i = 0; i < nodeCount; i++) {
+        memcpy(file + 4 + (addresses[2 + i] & ~0x1Fu), nodes[i].bytes, nodes[i].length);
+    }
+
+    uint8_t *root = file + 4 + rootOffset;
+    putBigEndian32(root, blockCount);
+    for (uint32_t i = 0; i < blockCount; i++) {
+        putBigEndian32(root + 8 + 4 * i, addresses[i]);
+    }
+    uint8_t *toc = root + 8 + 4 * tableEntries;
+    putBigEndian32(toc, 1);
+    toc[4] = 4;
+    memcpy(toc + 5, "DSDB", 4);
+    putBigEndian32(toc + 9, 1);
+
+    FILE *out = fopen(argv[optind], "wb");
+    if (!out || fwrite(file, 1, fileLength, out) != fileLength || fclose(out) != 0) {
+        fprintf(stderr, "dsstore-gen: cannot write %s\n", argv[optind]);
+        return 1;
+    }
+
+    for (long i = 0; i < count; i++) {
+        if (strcmp(records[i].code, "Iloc") == 0) {
+            printf("%s\n", records[i].name);
+        }
+    }
+    fprintf(stderr, "dsstore-gen: %ld records, %u internal levels, %zu nodes, %zu bytes\n",
+            count, levels, nodeCount, fileLength);
+    return 0;
+}
@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+"""
+Writes the .DS_Store fixtures that write-bench -f checks.
+
+The B-trees are grown the way the Python ds_store module grows them: each
+record is inserted on its own, in shuffled order, into 4 KiB pages, and a
+page that overflows is split in two at the record that best balances them,
+the record moving up into the parent. A root that splits gains a new root
+above it, and the superblock's levels count goes up by one, so a lone leaf
+has 0 levels. The pages end up part full and in allocation order rather
+than key order, unlike the bulk-loaded ones -[DSStore save] and dsstore-gen
+write, so they are an independent reference.
+
+    make-fixtures.py [DIRECTORY]
+"""
+
+import os
+import random
+import struct
+import sys
+
+PAGE_SIZE = 4096
+
+
+def record(name, code, kind, value):
+    encoded = name.encode('utf-16-be')
+    head = struct.pack('>I', len(name)) + encoded + code + kind
+    if kind == b'blob':
+        return head + struct.pack('>I', len(value)) + value
+    if kind == b'ustr':
+        text = value.encode('utf-16-be')
+        return head + struct.pack('>I', len(value)) + text
+    if kind == b'long' or kind == b'shor':
+        return head + struct.pack('>I', value)
+    if kind == b'bool':
+        return head + struct.pack('>B', value)
+    if kind == b'comp' or kind == b'dutc':
+        return head + struct.pack('>Q', value)
+    raise ValueError(kind)
+
+
+def entries(count, padding):
+    result = [(('.', b'bwsp'), record('.', b'bwsp', b'blob', b'bplist00 window state')),
+              (('.', b'vSrn'), record('.', b'vSrn', b'long', 1))]
+    n = 0
+    while len(result) < count:
+        name = ('IMG_%05d.JPG', 'document %d.pdf', 'Notes-%d.txt', 'src_%d')[n % 4] % n
+        kind = n % 5
+        if kind == 0 or kind == 3:
+            iloc = struct.pack('>II', 40 + (n % 10) * 100, 40 + (n // 10) * 100) + b'\xff' * 6 + b'\0\0'
+            result.append(((name, b'Iloc'), record(name, b'Iloc', b'blob', iloc)))
+        elif kind == 1:
+            text = 'comment %d' % n
+            result.append(((name, b'cmmt'), record(name, b'cmmt', b'ustr', text + ' ' * padding)))
+        elif kind == 2:
+            result.append(((name, b'lg1S'), record(name, b'lg1S', b'comp', 1000 * n)))
+        else:
+            result.append(((name, b'dscl'), record(name, b'dscl', b'bool', n % 2)))
+        n += 1
+    return result
+
+
+def sort_key(key):
+    return (key[0].lower(), key[1])
+
+
+class Tree:
+    # Nodes are [records, children], children None for a leaf; a record is
+    # (sort key, bytes) and children[i] is the node left of records[i], with
+    # the last one the rightmost child
+    def __init__(self):
+        self.blocks = [[[], None]]
+        self.root = 0
+        self.levels = 0
+
+    def size(self, node):
+        total = 8 + sum(len(data) for _, data in node[0])
+        if node[1] is not None:
+            total += 4 * len(node[0])
+        return total
+
+    def insert(self, key, data):
+        split = self.insert_into(self.root, (sort_key(key), data))
+        if split:
+            pivot, right = split
+            self.blocks.append([[pivot], [self.root, right]])
+            self.root = len(self.blocks) - 1
+            self.levels += 1
+
+    def insert_into(self, block, entry):
+        node = self.blocks[block]
+        records, children = node
+        at = 0
+        while at < len(records) and records[at][0] < entry[0]:
+            at += 1
+        if children is None:
+            records.insert(at, entry)
+        else:
+            split = self.insert_into(children[at], entry)
+            if not split:
+                return None
+            pivot, right = split
+            records.insert(at, pivot)
+            children.insert(at + 1, right)
+        if self.size(node) <= PAGE_SIZE:
+            return None
+        return self.split(block)
+
+    # Keeps the left half in the block and moves the right half to a new one
+    def split(self, block):
+        records, children = self.blocks[block]
+        pointer = 4 if children is not None else 0
+        before = [0]
+        for _, data in records:
+            before.append(before[-1] + pointer + len(data))
+        best = None
+        for n in range(1, len(records) - 1):
+            left = 8 + before[n]
+            right = 8 + before[-1] - before[n + 1]
+            if left > PAGE_SIZE:
+                break
+            if right > PAGE_SIZE:
+                continue
+            if best is None or abs(left - right) < best[1]:
+                best = (n, abs(left - right))
+        n = best[0]
+        pivot = records[n]
+        right = [records[n + 1:], children[n + 1:] if children is not None else None]
+        self.blocks[block] = [records[:n], children[:n + 1] if children is not None else None]
+        self.blocks.append(right)
+        return pivot, len(self.blocks) - 1
+
+    def page(self, block):
+        records, children = self.blocks[block]
+        page = bytearray(PAGE_SIZE)
+        struct.pack_into('>II', page, 0, 0 if children is None else children[-1] + 2, len(records))
+        at = 8
+        for i, (_, data) in enumerate(records):
+            if children is not None:
+                struct.pack_into('>I', page, at, children[i] + 2)
+                at += 4
+            page[at:at + len(data)] = data
+            at += len(data)
+        return bytes(page)
+
+    def count(self, block):
+        records, children = self.blocks[block]
+        if children is None:
+            return len(records)
+        return len(records) + sum(self.count(child) for child in children)
+
+
+def write_store(path, count, padding, seed):
+    tree = Tree()
+    items = entries(count, padding)
+    random.Random(seed).shuffle(items)
+    for key, data in items:
+        tree.insert(key, data)
+    assert tree.count(tree.root) == count
+
+    # Block 0 is the allocator's root block and 1 the DSDB superblock, as
+    # ds_store allocates them; the nodes follow in the order they were made
+    nodes = len(tree.blocks)
+    addresses = [0, 0x20 | 5] + [PAGE_SIZE * (1 + i) | 12 for i in range(nodes)]
+    root_offset = PAGE_SIZE * (1 + nodes)
+    addresses[0] = root_offset | 11
+    table = (len(addresses) + 255) // 256 * 256
+
+    rootblock = struct.pack('>II', len(addresses), 0)
+    rootblock += b''.join(struct.pack('>I', a) for a in addresses)
+    rootblock += b'\0' * 4 * (table - len(addresses))
+    rootblock += struct.pack('>IB4sI', 1, 4, b'DSDB', 1)
+    rootblock += b'\0' * 4 * 32
+    assert len(rootblock) <= 2048
+
+    data = bytearray(4 + root_offset + 2048)
+    struct.pack_into('>I4sIII', data, 0, 1, b'Bud1', root_offset, 2048, root_offset)
+    struct.pack_into('>IIIII', data, 4 + 0x20, tree.root + 2, tree.levels, count, nodes, PAGE_SIZE)
+    for block in range(nodes):
+        data[4 + PAGE_SIZE * (1 + block):4 + PAGE_SIZE * (2 + block)] = tree.page(block)
+    data[4 + root_offset:4 + root_offset + len(rootblock)] = rootblock
+
+    with open(path, 'wb') as out:
+        out.write(data)
+    print('%s: %d records, %d levels, %d nodes' % (os.path.basename(path), count, tree.levels, nodes))
+
+
+def main():
+    directory = sys.argv[1] if len(sys.argv) > 1 else os.path.dirname(os.path.abspath(__file__))
+    write_store(os.path.join(directory, 'inserted-40.DS_Store'), 40, 0, 1)
+    write_store(os.path.join(directory, 'inserted-1000.DS_Store'), 1000, 0, 2)
+    # Long comments leave a few records per page, for a deeper tree
+    write_store(os.path.join(directory, 'inserted-comments-500.DS_Store'), 500, 200, 3)
+
+
+if __name__ == '__main__':
+    main()
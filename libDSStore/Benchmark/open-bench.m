@@ -0,0 +1,123 @@
+/*
+ * open-bench - time to open a .DS_Store and read a handful of records
+ *
+ *   open-bench [-e] [-r ROUNDS] [-q QUERIES] STORE NAMES
+ *       Every round opens STORE, looks up the directory's bwsp and icvp and
+ *       the icon locations of QUERIES files spread through NAMES (one file
+ *       name per line, as dsstore-gen prints them), and closes it again,
+ *       which is what a file manager does to show a window.
+ *
+ *       By default the store is opened read-only, mapped, and only the
+ *       B-tree pages on the way to each record are read. With -e it is
+ *       opened the way it always was, reading and decoding every record.
+ */
+
+#import <Foundation/Foundation.h>
+#import "../DSStore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static double nowMilliseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: open-bench [-e] [-r ROUNDS] [-q QUERIES] STORE NAMES\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    BOOL eager = NO;
+    int rounds = 20;
+    int queries = 50;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "er:q:")) != -1) {
+        if (opt == 'e') {
+            eager = YES;
+        } else if (opt == 'r') {
+            rounds = atoi(optarg);
+        } else if (opt == 'q') {
+            queries = atoi(optarg);
+        } else {
+            usage();
+        }
+    }
+    if (argc - optind != 2 || rounds <= 0 || queries <= 0) {
+        usage();
+    }
+
+    NSString *storePath = [NSString stringWithUTF8String:argv[optind]];
+    NSString *list = [NSString stringWithContentsOfFile:[NSString stringWithUTF8String:argv[optind + 1]]
+                                               encoding:NSUTF8StringEncoding error:NULL];
+    NSMutableArray *names = [NSMutableArray array];
+    for (NSString *line in [list componentsSeparatedByString:@"\n"]) {
+        if ([line length] > 0) {
+            [names addObject:line];
+        }
+    }
+    if ([names count] == 0) {
+        fprintf(stderr, "open-bench: no file names in %s\n", argv[optind + 1]);
+        return 1;
+    }
+
+    NSMutableArray *queried = [NSMutableArray array];
+    for (int i = 0; i < queries; i++) {
+        [queried addObject:[names objectAtIndex:(NSUInteger)i * [names count] / queries]];
+    }
+
+    double *openTimes = malloc(sizeof(double) * rounds);
+    double *totalTimes = malloc(sizeof(double) * rounds);
+    int found = 0;
+
+    for (int round = 0; round < rounds; round++) {
+        NSAutoreleasePool *roundPool = [[NSAutoreleasePool alloc] init];
+        double start = nowMilliseconds();
+
+        DSStore *store = [[DSStore alloc] initWithPath:storePath readOnly:!eager];
+        if (![store load]) {
+            fprintf(stderr, "open-bench: cannot load %s\n", [storePath UTF8String]);
+            return 1;
+        }
+        openTimes[round] = nowMilliseconds() - start;
+
+        [store entryForFilename:@"." code:@"bwsp"];
+        [store entryForFilename:@"." code:@"icvp"];
+        found = 0;
+        for (NSString *name in queried) {
+            NSPoint location = [store iconLocationForFilename:name];
+            if (location.x != 0 || location.y != 0) {
+                found++;
+            }
+        }
+        [store release];
+        totalTimes[round] = nowMilliseconds() - start;
+        [roundPool release];
+    }
+
+    qsort(openTimes, rounds, sizeof(double), compareDoubles);
+    qsort(totalTimes, rounds, sizeof(double), compareDoubles);
+    printf("%-6s %-24s open p50=%9.3f ms  open+%d queries p50=%9.3f ms  found=%d/%d\n",
+           eager ? "eager" : "mapped", [[storePath lastPathComponent] UTF8String],
+           openTimes[(rounds - 1) / 2], queries, totalTimes[(rounds - 1) / 2], found, queries);
+
+    free(openTimes);
+    free(totalTimes);
+    [pool release];
+    return 0;
+}
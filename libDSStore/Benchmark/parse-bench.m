@@ -0,0 +1,359 @@
+/*
+ * parse-bench - records parsed per second when a store is loaded
+ *
+ *   parse-bench [-n RECORDS] [-r ROUNDS]
+ *       Writes a store of RECORDS records holding every value type and
+ *       loads it ROUNDS times: with the reader -[DSStore load] used to have,
+ *       which read every field through DSBuddyBlock messages and NSData
+ *       copies and made strings of each code and type; with today's load,
+ *       which parses records in place; and read-only, faulting in every
+ *       entry. The old reader's two log lines per record are left out, so
+ *       only parsing is compared. Each run is checked against the records
+ *       written.
+ */
+
+#import <Foundation/Foundation.h>
+#import "../DSStore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MaxTreeDepth 32
+
+static double nowMilliseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: parse-bench [-n RECORDS] [-r ROUNDS]\n");
+    exit(2);
+}
+
+static uint32_t swap32(uint32_t x)
+{
+    return ((x & 0xFF000000) >> 24) | ((x & 0x00FF0000) >> 8) |
+           ((x & 0x0000FF00) << 8)  | ((x & 0x000000FF) << 24);
+}
+
+static uint64_t swap64(uint64_t x)
+{
+    return ((uint64_t)swap32((uint32_t)x) << 32) | swap32((uint32_t)(x >> 32));
+}
+
+// DSBuddyBlock's reads as they were: a copy of the block, and a message
+// and -getBytes:range: for every field
+@interface OldBlock : NSObject
+{
+    NSMutableData *_data;
+    NSUInteger _size;
+    NSUInteger _position;
+}
+- (id)initWithData:(NSData *)data;
+- (NSData *)readBytes:(NSUInteger)length;
+- (uint8_t)readUInt8;
+- (uint32_t)readUInt32;
+- (uint64_t)readUInt64;
+@end
+
+@implementation OldBlock
+
+- (id)initWithData:(NSData *)data
+{
+    if ((self = [super init])) {
+        _data = [[NSMutableData dataWithData:data] retain];
+        _size = [data length];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [_data release];
+    [super dealloc];
+}
+
+- (NSData *)readBytes:(NSUInteger)length
+{
+    if (_position + length > _size) {
+        length = _size - _position;
+    }
+    NSData *result = [_data subdataWithRange:NSMakeRange(_position, length)];
+    _position += length;
+    return result;
+}
+
+- (uint8_t)readUInt8
+{
+    if (_position + 1 > _size) {
+        return 0;
+    }
+    uint8_t value;
+    [_data getBytes:&value range:NSMakeRange(_position, 1)];
+    _position += 1;
+    return value;
+}
+
+- (uint32_t)readUInt32
+{
+    if (_position + 4 > _size) {
+        return 0;
+    }
+    uint32_t value;
+    [_data getBytes:&value range:NSMakeRange(_position, 4)];
+    _position += 4;
+    return swap32(value);
+}
+
+- (uint64_t)readUInt64
+{
+    if (_position + 8 > _size) {
+        return 0;
+    }
+    uint64_t value;
+    [_data getBytes:&value range:NSMakeRange(_position, 8)];
+    _position += 8;
+    return swap64(value);
+}
+
+@end
+
+static OldBlock *oldBlockForNode(DSBuddyAllocator *allocator, uint32_t blockNumber)
+{
+    uint32_t address;
+    if (![allocator getAddress:&address ofBlock:blockNumber]) {
+        return nil;
+    }
+    NSUInteger offset = (address & ~0x1F) + 4;
+    NSUInteger size = (NSUInteger)1 << (address & 0x1F);
+    if (offset + 8 > [allocator fileSize]) {
+        return nil;
+    }
+    NSData *bytes = [allocator readAtOffset:offset length:MIN(size, [allocator fileSize] - offset)];
+    return bytes ? [[[OldBlock alloc] initWithData:bytes] autorelease] : nil;
+}
+
+// -[DSStore readRecordFromBlock:] as it was
+static DSStoreEntry *oldReadRecord(OldBlock *block)
+{
+    uint32_t filenameLength = [block readUInt32];
+    if (filenameLength == 0 || filenameLength > 1024) {
+        return nil;
+    }
+
+    NSData *unicodeData = [block readBytes:filenameLength * 2];
+    NSData *codeData = [block readBytes:4];
+    NSData *typeData = [block readBytes:4];
+    if ([typeData length] != 4) {
+        return nil;
+    }
+    NSString *filename = [[[NSString alloc] initWithData:unicodeData encoding:NSUTF16BigEndianStringEncoding] autorelease];
+    NSString *code = [[[NSString alloc] initWithData:codeData encoding:NSASCIIStringEncoding] autorelease];
+    NSString *type = [[[NSString alloc] initWithData:typeData encoding:NSASCIIStringEncoding] autorelease];
+
+    id value = nil;
+    NSUInteger wanted = 0;
+    if ([type isEqualToString:@"bool"]) {
+        value = [NSNumber numberWithBool:([block readUInt8] != 0)];
+    } else if ([type isEqualToString:@"long"] || [type isEqualToString:@"shor"]) {
+        value = [NSNumber numberWithUnsignedInt:[block readUInt32]];
+    } else if ([type isEqualToString:@"ustr"]) {
+        wanted = 2 * (NSUInteger)[block readUInt32];
+        NSData *strData = [block readBytes:wanted];
+        if ([strData length] == wanted) {
+            value = [[[NSString alloc] initWithData:strData encoding:NSUTF16BigEndianStringEncoding] autorelease];
+        }
+    } else if ([type isEqualToString:@"type"]) {
+        NSData *typeValue = [block readBytes:4];
+        value = [[[NSString alloc] initWithData:typeValue encoding:NSASCIIStringEncoding] autorelease];
+    } else if ([type isEqualToString:@"comp"] || [type isEqualToString:@"dutc"]) {
+        value = [NSNumber numberWithUnsignedLongLong:[block readUInt64]];
+    } else {
+        wanted = [block readUInt32];
+        value = [block readBytes:wanted];
+        if ([value length] != wanted) {
+            value = nil;
+        }
+    }
+    if (!value) {
+        return nil;
+    }
+    return [[[DSStoreEntry alloc] initWithFilename:filename code:code type:type value:value] autorelease];
+}
+
+// -[DSStore readNode:address:depth:] as it was
+static BOOL oldReadNode(DSBuddyAllocator *allocator, uint32_t blockNumber, int depth, NSMutableArray *entries)
+{
+    OldBlock *block = oldBlockForNode(allocator, blockNumber);
+    if (!block || depth >= MaxTreeDepth) {
+        return NO;
+    }
+    uint32_t rightmost = [block readUInt32];
+    uint32_t count = [block readUInt32];
+    for (uint32_t i = 0; i < count; i++) {
+        if (rightmost && !oldReadNode(allocator, [block readUInt32], depth + 1, entries)) {
+            return NO;
+        }
+        DSStoreEntry *entry = oldReadRecord(block);
+        if (!entry) {
+            return NO;
+        }
+        [entries addObject:entry];
+    }
+    return !rightmost || oldReadNode(allocator, rightmost, depth + 1, entries);
+}
+
+// Opens the file and reads the tree as -[DSStore load] did, then indexes the entries as load does
+static DSStore *oldLoad(NSString *path)
+{
+    DSBuddyAllocator *allocator = [[[DSBuddyAllocator alloc] initWithFile:path] autorelease];
+    uint32_t dsdb;
+    uint32_t address;
+    if (![allocator open] || ![allocator getBlockNumber:&dsdb forDirectory:@"DSDB"] ||
+        ![allocator getAddress:&address ofBlock:dsdb]) {
+        return nil;
+    }
+    OldBlock *superblock = [[[OldBlock alloc] initWithData:
+                               [allocator readAtOffset:(address & ~0x1F) + 4 length:20]] autorelease];
+    uint32_t root = [superblock readUInt32];
+
+    NSMutableArray *entries = [NSMutableArray array];
+    if (!oldReadNode(allocator, root, 0, entries)) {
+        return nil;
+    }
+    return [DSStore createStoreAtPath:path withEntries:entries];
+}
+
+static DSStoreEntry *entryForFile(long n)
+{
+    NSString *name;
+    switch (n % 4) {
+        case 0: name = [NSString stringWithFormat:@"IMG_%05ld.JPG", n]; break;
+        case 1: name = [NSString stringWithFormat:@"document %ld.pdf", n]; break;
+        case 2: name = [NSString stringWithFormat:@"Notes-%ld.txt", n]; break;
+        default: name = [NSString stringWithFormat:@"src_%ld", n]; break;
+    }
+
+    switch (n % 8) {
+        case 0:
+            return [DSStoreEntry iconLocationEntryForFile:name x:40 + (n % 10) * 100 y:40 + (n / 10) * 100];
+        case 1:
+            return [DSStoreEntry commentsEntryForFile:name comments:[NSString stringWithFormat:@"comment %ld", n]];
+        case 2:
+            return [[[DSStoreEntry alloc] initWithFilename:name code:@"lg1S" type:@"comp"
+                                                     value:[NSNumber numberWithUnsignedLongLong:1000ULL * n]] autorelease];
+        case 3:
+            return [[[DSStoreEntry alloc] initWithFilename:name code:@"modD" type:@"dutc"
+                                                     value:[NSNumber numberWithUnsignedLongLong:0xD0000000ULL << 16 | n]] autorelease];
+        case 4:
+            return [DSStoreEntry booleanEntryForFile:name code:@"dscl" value:(n / 8) % 2];
+        case 5:
+            return [DSStoreEntry longEntryForFile:name code:@"vSrn" value:(int32_t)n];
+        case 6:
+            return [[[DSStoreEntry alloc] initWithFilename:name code:@"fwvh" type:@"shor"
+                                                     value:[NSNumber numberWithUnsignedInt:(unsigned)(n % 1000)]] autorelease];
+        default:
+            return [DSStoreEntry viewStyleEntryForFile:name style:@"Nlsv"];
+    }
+}
+
+static BOOL sameRecords(NSArray *expected, NSArray *actual, const char *what)
+{
+    if ([expected count] != [actual count]) {
+        fprintf(stderr, "parse-bench: %s read %lu records, expected %lu\n", what,
+                (unsigned long)[actual count], (unsigned long)[expected count]);
+        return NO;
+    }
+    for (NSUInteger i = 0; i < [expected count]; i++) {
+        if (![[[expected objectAtIndex:i] encode] isEqualToData:[[actual objectAtIndex:i] encode]]) {
+            fprintf(stderr, "parse-bench: %s read record %lu wrong\n", what, (unsigned long)i);
+            return NO;
+        }
+    }
+    return YES;
+}
+
+enum { OldReader, Load, ReadOnly, Readers };
+static const char *readerNames[Readers] = { "before", "load", "mapped" };
+
+int main(int argc, char **argv)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    int records = 100000;
+    int rounds = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+        if (opt == 'n') {
+            records = atoi(optarg);
+        } else if (opt == 'r') {
+            rounds = atoi(optarg);
+        } else {
+            usage();
+        }
+    }
+    if (argc - optind != 0 || records <= 0 || rounds <= 0) {
+        usage();
+    }
+
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:
+                         [NSString stringWithFormat:@"parse-bench-%d.DS_Store", (int)getpid()]];
+    NSMutableArray *entries = [NSMutableArray arrayWithCapacity:records];
+    for (long n = 0; n < records; n++) {
+        [entries addObject:entryForFile(n)];
+    }
+    DSStore *written = [DSStore createStoreAtPath:path withEntries:entries];
+    NSArray *expected = [written entries];
+    if (![written save]) {
+        fprintf(stderr, "parse-bench: cannot write %s\n", [path UTF8String]);
+        return 1;
+    }
+
+    int status = 0;
+    double *times = malloc(sizeof(double) * rounds);
+    for (int reader = 0; reader < Readers && status == 0; reader++) {
+        for (int round = 0; round < rounds && status == 0; round++) {
+            NSAutoreleasePool *roundPool = [[NSAutoreleasePool alloc] init];
+            double start = nowMilliseconds();
+            DSStore *store;
+            NSArray *read = nil;
+            if (reader == OldReader) {
+                store = oldLoad(path);
+                read = [store entries];
+            } else {
+                store = (reader == Load) ? [DSStore storeWithPath:path] : [DSStore readOnlyStoreWithPath:path];
+                if ([store load]) {
+                    read = [store entries];
+                }
+            }
+            times[round] = nowMilliseconds() - start;
+
+            if (!read || !sameRecords(expected, read, readerNames[reader])) {
+                status = 1;
+            }
+            [roundPool release];
+        }
+        if (status == 0) {
+            qsort(times, rounds, sizeof(double), compareDoubles);
+            double p50 = times[(rounds - 1) / 2];
+            printf("%-7s records=%-7lu p50=%9.3f ms  %10.0f records/s\n", readerNames[reader],
+                   (unsigned long)[expected count], p50, [expected count] / (p50 / 1e3));
+        }
+    }
+    free(times);
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+
+    [pool release];
+    return status;
+}
@@ -0,0 +1,55 @@
+#!/bin/sh
+# libDSStore open-and-query benchmark: generates stores of 100, 10,000 and
+# 100,000 records and times opening each and reading the records a file
+# manager window needs, then reports records parsed per second by a full
+# load against the reader it replaced.
+#
+# Usage: run-open.sh [-r rounds] [-q queries]
+#
+# Both a full load and the read-only mapped store run on the single-leaf
+# store and on the paged tree. A full load reads every record, so its rounds
+# are few.
+
+ROUNDS=20
+QUERIES=50
+
+while getopts "r:q:" opt; do
+    case $opt in
+        r) ROUNDS=$OPTARG ;;
+        q) QUERIES=$OPTARG ;;
+        *) echo "Usage: $0 [-r rounds] [-q queries]"; exit 2 ;;
+    esac
+done
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+GEN=$HERE/obj/dsstore-gen
+BENCH=$HERE/obj/open-bench
+PARSE=$HERE/obj/parse-bench
+
+for tool in "$GEN" "$BENCH" "$PARSE"; do
+    if [ ! -x "$tool" ]; then
+        echo "Missing $tool (run gmake in $HERE first)"
+        exit 1
+    fi
+done
+
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/dsstore-bench.XXXXXX")
+EAGER_ROUNDS=$(( ROUNDS < 3 ? ROUNDS : 3 ))
+
+STATUS=0
+for count in 100 10000 100000; do
+    "$GEN" -n $count "$WORK/paged-$count.DS_Store" >"$WORK/names-$count" 2>/dev/null || STATUS=1
+    "$GEN" -1 -n $count "$WORK/leaf-$count.DS_Store" >/dev/null 2>&1 || STATUS=1
+
+    "$BENCH" -e -r $EAGER_ROUNDS -q $QUERIES "$WORK/leaf-$count.DS_Store" "$WORK/names-$count" 2>/dev/null || STATUS=1
+    "$BENCH" -e -r $EAGER_ROUNDS -q $QUERIES "$WORK/paged-$count.DS_Store" "$WORK/names-$count" 2>/dev/null || STATUS=1
+    "$BENCH" -r $ROUNDS -q $QUERIES "$WORK/leaf-$count.DS_Store" "$WORK/names-$count" 2>/dev/null || STATUS=1
+    "$BENCH" -r $ROUNDS -q $QUERIES "$WORK/paged-$count.DS_Store" "$WORK/names-$count" 2>/dev/null || STATUS=1
+done
+"$PARSE" -n 100000 -r $EAGER_ROUNDS 2>"$WORK/log" || { grep '^parse-bench' "$WORK/log"; STATUS=1; }
+
+if [ $STATUS -ne 0 ]; then
+    echo "Benchmark failed; stores are in $WORK"
+    exit 1
+fi
+rm -rf "$WORK"
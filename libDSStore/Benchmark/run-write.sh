@@ -0,0 +1,55 @@
+#!/bin/sh
+# libDSStore save benchmark: checks the DSDB superblocks of the fixtures,
+# trees grown by insertion as the Python ds_store module grows them, against
+# their nodes and against copies saved from them. Checks that stores of 3,
+# 100, 10,000 and 100,000 records from dsstore-gen load and save back to the
+# same B-tree pages, then times saving a 100,000-record store holding every
+# value type and reads it back. Then times saving single moves and inserts
+# into a 50,000-record store, in place and atomically.
+#
+# Usage: run-write.sh [-n records] [-r rounds] [-u updates]
+
+RECORDS=100000
+ROUNDS=5
+UPDATES=100
+
+while getopts "n:r:u:" opt; do
+    case $opt in
+        n) RECORDS=$OPTARG ;;
+        r) ROUNDS=$OPTARG ;;
+        u) UPDATES=$OPTARG ;;
+        *) echo "Usage: $0 [-n records] [-r rounds] [-u updates]"; exit 2 ;;
+    esac
+done
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+GEN=$HERE/obj/dsstore-gen
+BENCH=$HERE/obj/write-bench
+UPDATE=$HERE/obj/update-bench
+
+for tool in "$GEN" "$BENCH" "$UPDATE"; do
+    if [ ! -x "$tool" ]; then
+        echo "Missing $tool (run gmake in $HERE first)"
+        exit 1
+    fi
+done
+
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/dsstore-bench.XXXXXX")
+
+# -[DSStore load] and save log as they go, so stderr is dropped unless a check fails
+STATUS=0
+for fixture in "$HERE"/fixtures/*.DS_Store; do
+    "$BENCH" -f "$fixture" 2>"$WORK/log" || { grep '^write-bench' "$WORK/log"; STATUS=1; }
+done
+for count in 3 100 10000 100000; do
+    "$GEN" -n $count "$WORK/paged-$count.DS_Store" >/dev/null 2>&1 || STATUS=1
+    "$BENCH" -c "$WORK/paged-$count.DS_Store" 2>"$WORK/log" || { grep '^write-bench' "$WORK/log"; STATUS=1; }
+done
+"$BENCH" -n $RECORDS -r $ROUNDS 2>"$WORK/log" || { grep '^write-bench' "$WORK/log"; STATUS=1; }
+"$UPDATE" -n 50000 -u $UPDATES 2>"$WORK/log" || { grep '^update-bench' "$WORK/log"; STATUS=1; }
+
+if [ $STATUS -ne 0 ]; then
+    echo "Benchmark failed; stores are in $WORK"
+    exit 1
+fi
+rm -rf "$WORK"
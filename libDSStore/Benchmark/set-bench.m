@@ -0,0 +1,141 @@
+/*
+ * set-bench - times setting icon locations for every file in a directory
+ *
+ *   set-bench [-n FILES] [-r ROUNDS]
+ *       Sets the icon location of FILES files (in shuffled order) in a new
+ *       store, moves every one of them once more, and orders the entries for
+ *       saving. The same is done with the list DSStore used to keep, found
+ *       by a linear scan comparing filename and code and sorted on save
+ *       (with today's compare:, which no longer lowercases on every call).
+ */
+
+#import <Foundation/Foundation.h>
+#import "../DSStore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static double nowMilliseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: set-bench [-n FILES] [-r ROUNDS]\n");
+    exit(2);
+}
+
+// -entryForFilename:code: and -setEntry: as they were before the index
+static DSStoreEntry *linearEntry(NSArray *entries, NSString *filename, NSString *code)
+{
+    for (DSStoreEntry *entry in entries) {
+        if ([[entry filename] isEqualToString:filename] &&
+            [[entry code] isEqualToString:code]) {
+            return entry;
+        }
+    }
+    return nil;
+}
+
+static void linearSetEntry(NSMutableArray *entries, DSStoreEntry *entry)
+{
+    DSStoreEntry *existing = linearEntry(entries, [entry filename], [entry code]);
+    if (existing) {
+        [entries removeObject:existing];
+    }
+    [entries addObject:entry];
+}
+
+static void report(const char *name, double *times, int rounds, NSUInteger entries)
+{
+    qsort(times, rounds, sizeof(double), compareDoubles);
+    printf("%-7s entries=%-6lu p50=%10.3f ms  max=%10.3f ms\n", name, (unsigned long)entries,
+           times[(rounds - 1) / 2], times[rounds - 1]);
+}
+
+int main(int argc, char **argv)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    int files = 10000;
+    int rounds = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+        if (opt == 'n') {
+            files = atoi(optarg);
+        } else if (opt == 'r') {
+            rounds = atoi(optarg);
+        } else {
+            usage();
+        }
+    }
+    if (argc - optind != 0 || files <= 0 || rounds <= 0) {
+        usage();
+    }
+
+    // Shuffled, so the sorted insertions land all over the list
+    NSMutableArray *names = [NSMutableArray arrayWithCapacity:files];
+    for (int i = 0; i < files; i++) {
+        [names addObject:[NSString stringWithFormat:(i % 2) ? @"IMG_%05d.JPG" : @"document %d.pdf", i]];
+    }
+    srandom(1);
+    for (int i = files - 1; i > 0; i--) {
+        [names exchangeObjectAtIndex:i withObjectAtIndex:random() % (i + 1)];
+    }
+
+    double *indexedTimes = malloc(sizeof(double) * rounds);
+    double *linearTimes = malloc(sizeof(double) * rounds);
+    NSUInteger indexedCount = 0;
+    NSUInteger linearCount = 0;
+
+    for (int round = 0; round < rounds; round++) {
+        NSAutoreleasePool *roundPool = [[NSAutoreleasePool alloc] init];
+
+        double start = nowMilliseconds();
+        DSStore *store = [DSStore createStoreAtPath:@"/dev/null" withEntries:nil];
+        for (int pass = 0; pass < 2; pass++) {
+            int i = 0;
+            for (NSString *name in names) {
+                [store setIconLocationForFilename:name x:40 + (i % 10) * 100 + pass y:40 + (i / 10) * 100];
+                i++;
+            }
+        }
+        indexedCount = [[store entries] count];
+        indexedTimes[round] = nowMilliseconds() - start;
+
+        start = nowMilliseconds();
+        NSMutableArray *entries = [NSMutableArray array];
+        for (int pass = 0; pass < 2; pass++) {
+            int i = 0;
+            for (NSString *name in names) {
+                linearSetEntry(entries, [DSStoreEntry iconLocationEntryForFile:name
+                                                                              x:40 + (i % 10) * 100 + pass
+                                                                              y:40 + (i / 10) * 100]);
+                i++;
+            }
+        }
+        linearCount = [[entries sortedArrayUsingSelector:@selector(compare:)] count];
+        linearTimes[round] = nowMilliseconds() - start;
+
+        [roundPool release];
+    }
+
+    report("indexed", indexedTimes, rounds, indexedCount);
+    report("linear", linearTimes, rounds, linearCount);
+
+    free(indexedTimes);
+    free(linearTimes);
+    [pool release];
+    return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * update-bench - cost of saving a small change to a large store
+ *
+ *   update-bench [-n RECORDS] [-u UPDATES]
+ *       Writes a store of RECORDS icon locations, loads it, and UPDATES times
+ *       moves one icon and saves; then UPDATES times adds the icon of a new
+ *       file and saves. Both are run with in-place saves and with atomic
+ *       ones, reporting the time and bytes written per save, and the file
+ *       is read back after each run to check it holds every record.
+ */
+
+#import <Foundation/Foundation.h>
+#import "../DSStore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static double nowMilliseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: update-bench [-n RECORDS] [-u UPDATES]\n");
+    exit(2);
+}
+
+static NSString *fileName(long n)
+{
+    return [NSString stringWithFormat:(n % 2) ? @"IMG_%06ld.JPG" : @"document %ld.pdf", n];
+}
+
+static BOOL sameRecords(NSArray *expected, NSString *path, const char *what)
+{
+    DSStore *reread = [DSStore storeWithPath:path];
+    if (![reread load]) {
+        fprintf(stderr, "update-bench: cannot reload %s after %s\n", [path UTF8String], what);
+        return NO;
+    }
+    NSArray *actual = [reread entries];
+    if ([expected count] != [actual count]) {
+        fprintf(stderr, "update-bench: %s left %lu records, expected %lu\n", what,
+                (unsigned long)[actual count], (unsigned long)[expected count]);
+        return NO;
+    }
+    for (NSUInteger i = 0; i < [expected count]; i++) {
+        if (![[[expected objectAtIndex:i] encode] isEqualToData:[[actual objectAtIndex:i] encode]]) {
+            fprintf(stderr, "update-bench: %s changed record %lu ('%s')\n", what, (unsigned long)i,
+                    [[[expected objectAtIndex:i] filename] UTF8String]);
+            return NO;
+        }
+    }
+    return YES;
+}
+
+// Moves an icon (or adds a new file's) and saves, UPDATES times
+static int run(NSString *path, int records, int updates, BOOL atomically, BOOL insert)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSMutableArray *entries = [NSMutableArray arrayWithCapacity:records];
+    for (long n = 0; n < records; n++) {
+        [entries addObject:[DSStoreEntry iconLocationEntryForFile:fileName(n)
+                                                                x:40 + (n % 10) * 100
+                                                                y:40 + (n / 10) * 100]];
+    }
+    if (![[DSStore createStoreAtPath:path withEntries:entries] save]) {
+        fprintf(stderr, "update-bench: cannot write %s\n", [path UTF8String]);
+        [pool release];
+        return 1;
+    }
+
+    DSStore *store = [DSStore storeWithPath:path];
+    if (![store load]) {
+        fprintf(stderr, "update-bench: cannot load %s\n", [path UTF8String]);
+        [pool release];
+        return 1;
+    }
+    [store setSavesAtomically:atomically];
+
+    double *times = malloc(sizeof(double) * updates);
+    unsigned long long *bytes = malloc(sizeof(unsigned long long) * updates);
+    srandom(1);
+    for (int i = 0; i < updates; i++) {
+        NSAutoreleasePool *updatePool = [[NSAutoreleasePool alloc] init];
+        long n = insert ? records + i : random() % records;
+        [store setIconLocationForFilename:fileName(n) x:(int)(random() % 1000) y:(int)(random() % 1000)];
+
+        unsigned long long before = [store bytesWritten];
+        double start = nowMilliseconds();
+        if (![store save]) {
+            fprintf(stderr, "update-bench: cannot save %s\n", [path UTF8String]);
+            [updatePool release];
+            [pool release];
+            return 1;
+        }
+        times[i] = nowMilliseconds() - start;
+        bytes[i] = [store bytesWritten] - before;
+        [updatePool release];
+    }
+
+    double total = 0;
+    for (int i = 0; i < updates; i++) {
+        total += bytes[i];
+    }
+    qsort(times, updates, sizeof(double), compareDoubles);
+    const char *what = insert ? "insert" : "move";
+    unsigned long long size = [[[NSFileManager defaultManager] attributesOfItemAtPath:path error:NULL] fileSize];
+    BOOL ok = sameRecords([store entries], path, what);
+    if (ok) {
+        printf("%-6s %-8s records=%-7d file=%-9llu p50=%9.3f ms  max=%9.3f ms  %10.0f bytes/save  reload ok\n",
+               what, atomically ? "atomic" : "in-place", records, size,
+               times[(updates - 1) / 2], times[updates - 1], total / updates);
+    }
+    free(times);
+    free(bytes);
+    [pool release];
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    int records = 50000;
+    int updates = 100;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:u:")) != -1) {
+        if (opt == 'n') {
+            records = atoi(optarg);
+        } else if (opt == 'u') {
+            updates = atoi(optarg);
+        } else {
+            usage();
+        }
+    }
+    if (argc - optind != 0 || records <= 0 || updates <= 0) {
+        usage();
+    }
+
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:
+                         [NSString stringWithFormat:@"update-bench-%d.DS_Store", (int)getpid()]];
+    int status = 0;
+    for (int atomically = 0; atomically < 2 && status == 0; atomically++) {
+        for (int insert = 0; insert < 2 && status == 0; insert++) {
+            status = run(path, records, updates, atomically, insert);
+        }
+    }
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+
+    [pool release];
+    return status;
+}
@@ -0,0 +1,410 @@
+/*
+ * write-bench - save throughput and round trips of multi-level B-trees
+ *
+ *   write-bench [-n RECORDS] [-r ROUNDS]
+ *       Builds a store of RECORDS records holding every value type, times
+ *       writing it as a new file over ROUNDS rounds, then reads it back with a
+ *       full load and read-only and checks each record is the one written.
+ *
+ *   write-bench -c REFERENCE
+ *       Loads REFERENCE (written by dsstore-gen, which packs pages the same
+ *       way) in full, saves it to a new file and checks the copy holds the
+ *       same records, the same DSDB superblock and byte-identical B-tree nodes.
+ *
+ *   write-bench -f FIXTURE
+ *       Walks the B-tree of FIXTURE, a store written by another writer (the
+ *       ones in fixtures/ are grown by insertion, as the Python ds_store
+ *       module grows them), and checks its DSDB superblock against it: levels
+ *       is the height less one, and records, nodes and the page size are what
+ *       the tree holds. Then looks up every record read-only, saves a copy and
+ *       checks the copy's records and superblock the same way.
+ */
+
+#import <Foundation/Foundation.h>
+#import "../DSStore.h"
+#import "../DSByteCursor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double nowMilliseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: write-bench [-n RECORDS] [-r ROUNDS]\n"
+                    "       write-bench -c REFERENCE\n"
+                    "       write-bench -f FIXTURE\n");
+    exit(2);
+}
+
+static uint32_t readBigEndian32(const uint8_t *bytes)
+{
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) |
+           ((uint32_t)bytes[2] << 8)  | (uint32_t)bytes[3];
+}
+
+// One record per file, cycling through the value types
+static DSStoreEntry *entryForFile(long n)
+{
+    NSString *name;
+    switch (n % 4) {
+        case 0: name = [NSString stringWithFormat:@"IMG_%05ld.JPG", n]; break;
+        case 1: name = [NSString stringWithFormat:@"document %ld.pdf", n]; break;
+        case 2: name = [NSString stringWithFormat:@"Notes-%ld.txt", n]; break;
+        default: name = [NSString stringWithFormat:@"src_%ld", n]; break;
+    }
+
+    switch (n % 8) {
+        case 0:
+            return [DSStoreEntry iconLocationEntryForFile:name x:40 + (n % 10) * 100 y:40 + (n / 10) * 100];
+        case 1:
+            return [DSStoreEntry commentsEntryForFile:name comments:[NSString stringWithFormat:@"comment %ld", n]];
+        case 2:
+            return [[[DSStoreEntry alloc] initWithFilename:name code:@"lg1S" type:@"comp"
+                                                     value:[NSNumber numberWithUnsignedLongLong:1000ULL * n]] autorelease];
+        case 3:
+            return [[[DSStoreEntry alloc] initWithFilename:name code:@"modD" type:@"dutc"
+                                                     value:[NSNumber numberWithUnsignedLongLong:0xD0000000ULL << 16 | n]] autorelease];
+        case 4:
+            return [DSStoreEntry booleanEntryForFile:name code:@"dscl" value:(n / 8) % 2];
+        case 5:
+            return [DSStoreEntry longEntryForFile:name code:@"vSrn" value:(int32_t)n];
+        case 6:
+            return [[[DSStoreEntry alloc] initWithFilename:name code:@"fwvh" type:@"shor"
+                                                     value:[NSNumber numberWithUnsignedInt:(unsigned)(n % 1000)]] autorelease];
+        default:
+            return [DSStoreEntry viewStyleEntryForFile:name style:@"Nlsv"];
+    }
+}
+
+// Both lists are in B-tree order; reports the first record that differs
+static BOOL sameRecords(NSArray *expected, NSArray *actual, const char *what)
+{
+    if ([expected count] != [actual count]) {
+        fprintf(stderr, "write-bench: %s has %lu records, expected %lu\n", what,
+                (unsigned long)[actual count], (unsigned long)[expected count]);
+        return NO;
+    }
+    for (NSUInteger i = 0; i < [expected count]; i++) {
+        DSStoreEntry *a = [expected objectAtIndex:i];
+        DSStoreEntry *b = [actual objectAtIndex:i];
+        if (![[a encode] isEqualToData:[b encode]]) {
+            fprintf(stderr, "write-bench: %s record %lu is '%s' %s, expected '%s' %s\n", what, (unsigned long)i,
+                    [[b filename] UTF8String], [[b code] UTF8String],
+                    [[a filename] UTF8String], [[a code] UTF8String]);
+            return NO;
+        }
+    }
+    return YES;
+}
+
+static BOOL superblock(DSBuddyAllocator *allocator, uint32_t words[5])
+{
+    uint32_t block;
+    uint32_t address;
+    if (![allocator getBlockNumber:&block forDirectory:@"DSDB"] ||
+        ![allocator getAddress:&address ofBlock:block] ||
+        (address & ~0x1Fu) + 4 + 20 > [allocator fileSize]) {
+        return NO;
+    }
+    const uint8_t *bytes = [allocator bytes] + (address & ~0x1Fu) + 4;
+    for (int i = 0; i < 5; i++) {
+        words[i] = readBigEndian32(bytes + 4 * i);
+    }
+    return YES;
+}
+
+// The nodes are blocks 2 and up in both writers, in the order they were packed
+static BOOL sameTree(NSString *referencePath, NSString *copyPath)
+{
+    DSBuddyAllocator *reference = [[[DSBuddyAllocator alloc] initReadOnlyWithFile:referencePath] autorelease];
+    DSBuddyAllocator *copy = [[[DSBuddyAllocator alloc] initReadOnlyWithFile:copyPath] autorelease];
+    uint32_t expected[5];
+    uint32_t actual[5];
+    if (![reference open] || ![copy open] || !superblock(reference, expected) || !superblock(copy, actual)) {
+        fprintf(stderr, "write-bench: cannot read the superblocks\n");
+        return NO;
+    }
+    if (memcmp(expected, actual, sizeof(expected)) != 0) {
+        fprintf(stderr, "write-bench: superblock root=%u levels=%u records=%u nodes=%u page=%u, "
+                "expected root=%u levels=%u records=%u nodes=%u page=%u\n",
+                actual[0], actual[1], actual[2], actual[3], actual[4],
+                expected[0], expected[1], expected[2], expected[3], expected[4]);
+        return NO;
+    }
+
+    for (uint32_t block = 2; block < 2 + expected[3]; block++) {
+        uint32_t a;
+        uint32_t b;
+        if (![reference getAddress:&a ofBlock:block] || ![copy getAddress:&b ofBlock:block]) {
+            fprintf(stderr, "write-bench: node %u is missing\n", block);
+            return NO;
+        }
+        NSData *x = [reference readAtOffset:(a & ~0x1Fu) + 4 length:(NSUInteger)1 << (a & 0x1F)];
+        NSData *y = [copy readAtOffset:(b & ~0x1Fu) + 4 length:(NSUInteger)1 << (b & 0x1F)];
+        if (!x || !y || ![x isEqualToData:y]) {
+            fprintf(stderr, "write-bench: node %u differs from the reference\n", block);
+            return NO;
+        }
+    }
+    return YES;
+}
+
+static int checkReference(NSString *referencePath, NSString *copyPath)
+{
+    DSStore *reference = [DSStore storeWithPath:referencePath];
+    if (![reference load]) {
+        fprintf(stderr, "write-bench: cannot load %s\n", [referencePath UTF8String]);
+        return 1;
+    }
+    NSArray *expected = [reference entries];
+
+    DSStore *copy = [DSStore createStoreAtPath:copyPath withEntries:expected];
+    DSStore *reread = [DSStore storeWithPath:copyPath];
+    if (![copy save] || ![reread load]) {
+        fprintf(stderr, "write-bench: cannot save and reload %s\n", [copyPath UTF8String]);
+        return 1;
+    }
+    if (!sameRecords(expected, [reread entries], "copy") || !sameTree(referencePath, copyPath)) {
+        return 1;
+    }
+
+    printf("roundtrip %-24s records=%-7lu ok\n", [[referencePath lastPathComponent] UTF8String],
+           (unsigned long)[expected count]);
+    return 0;
+}
+
+// The tree as its nodes hold it, whatever the superblock says
+typedef struct {
+    uint32_t height;
+    uint32_t records;
+    uint32_t nodes;
+} TreeShape;
+
+static BOOL skipRecord(DSByteCursor *cursor)
+{
+    uint32_t nameLength = DSByteCursorReadUInt32(cursor);
+    DSByteCursorReadBytes(cursor, 2 * (size_t)nameLength);
+    DSByteCursorReadFourCharCode(cursor);
+    const uint8_t *type = DSByteCursorReadBytes(cursor, 4);
+    if (!type) {
+        return NO;
+    }
+    if (memcmp(type, "bool", 4) == 0) {
+        DSByteCursorReadBytes(cursor, 1);
+    } else if (memcmp(type, "long", 4) == 0 || memcmp(type, "shor", 4) == 0 || memcmp(type, "type", 4) == 0) {
+        DSByteCursorReadBytes(cursor, 4);
+    } else if (memcmp(type, "comp", 4) == 0 || memcmp(type, "dutc", 4) == 0) {
+        DSByteCursorReadBytes(cursor, 8);
+    } else if (memcmp(type, "ustr", 4) == 0) {
+        DSByteCursorReadBytes(cursor, 2 * (size_t)DSByteCursorReadUInt32(cursor));
+    } else {
+        DSByteCursorReadBytes(cursor, DSByteCursorReadUInt32(cursor));
+    }
+    return !cursor->overrun;
+}
+
+// Fails on a node it cannot read or a leaf that is not as deep as the first one
+static BOOL walkNode(DSBuddyAllocator *allocator, uint32_t block, uint32_t depth, TreeShape *shape)
+{
+    uint32_t address;
+    if (depth >= 32 || ![allocator getAddress:&address ofBlock:block]) {
+        return NO;
+    }
+    size_t offset = (address & ~0x1Fu) + 4;
+    size_t size = (size_t)1 << (address & 0x1F);
+    if (offset + size > [allocator fileSize]) {
+        return NO;
+    }
+    DSByteCursor cursor = DSByteCursorMake([allocator bytes] + offset, size);
+    uint32_t rightmost = DSByteCursorReadUInt32(&cursor);
+    uint32_t count = DSByteCursorReadUInt32(&cursor);
+    shape->nodes++;
+    shape->records += count;
+
+    if (!rightmost) {
+        if (shape->height == 0) {
+            shape->height = depth + 1;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            if (!skipRecord(&cursor)) {
+                return NO;
+            }
+        }
+        return shape->height == depth + 1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t child = DSByteCursorReadUInt32(&cursor);
+        if (cursor.overrun || !walkNode(allocator, child, depth + 1, shape) || !skipRecord(&cursor)) {
+            return NO;
+        }
+    }
+    return walkNode(allocator, rightmost, depth + 1, shape);
+}
+
+// Reads the superblock of path and checks it describes the tree under its root
+static BOOL checkSuperblock(NSString *path, uint32_t words[5])
+{
+    DSBuddyAllocator *allocator = [[[DSBuddyAllocator alloc] initReadOnlyWithFile:path] autorelease];
+    TreeShape shape = { 0, 0, 0 };
+    if (![allocator open] || !superblock(allocator, words) || !walkNode(allocator, words[0], 0, &shape)) {
+        fprintf(stderr, "write-bench: cannot walk the B-tree of %s\n", [path UTF8String]);
+        return NO;
+    }
+    if (words[1] != shape.height - 1 || words[2] != shape.records || words[3] != shape.nodes || words[4] != 4096) {
+        fprintf(stderr, "write-bench: %s superblock levels=%u records=%u nodes=%u page=%u, "
+                "tree has levels=%u records=%u nodes=%u page=4096\n", [[path lastPathComponent] UTF8String],
+                words[1], words[2], words[3], words[4], shape.height - 1, shape.records, shape.nodes);
+        return NO;
+    }
+    return YES;
+}
+
+static int checkFixture(NSString *fixturePath, NSString *copyPath)
+{
+    uint32_t expected[5];
+    uint32_t actual[5];
+    if (!checkSuperblock(fixturePath, expected)) {
+        return 1;
+    }
+
+    DSStore *fixture = [DSStore storeWithPath:fixturePath];
+    if (![fixture load] || [[fixture entries] count] != expected[2]) {
+        fprintf(stderr, "write-bench: cannot load the %u records of %s\n", expected[2], [fixturePath UTF8String]);
+        return 1;
+    }
+    NSArray *entries = [fixture entries];
+    DSStore *mapped = [DSStore readOnlyStoreWithPath:fixturePath];
+    if (![mapped load]) {
+        fprintf(stderr, "write-bench: cannot map %s\n", [fixturePath UTF8String]);
+        return 1;
+    }
+    for (DSStoreEntry *entry in entries) {
+        DSStoreEntry *found = [mapped entryForFilename:[entry filename] code:[entry code]];
+        if (!found || ![[found encode] isEqualToData:[entry encode]]) {
+            fprintf(stderr, "write-bench: read-only lookup of '%s' %s in %s failed\n", [[entry filename] UTF8String],
+                    [[entry code] UTF8String], [[fixturePath lastPathComponent] UTF8String]);
+            return 1;
+        }
+    }
+
+    DSStore *copy = [DSStore createStoreAtPath:copyPath withEntries:entries];
+    DSStore *reread = [DSStore storeWithPath:copyPath];
+    if (![copy save] || ![reread load]) {
+        fprintf(stderr, "write-bench: cannot save and reload %s\n", [copyPath UTF8String]);
+        return 1;
+    }
+    if (!sameRecords(entries, [reread entries], "copy") || !checkSuperblock(copyPath, actual)) {
+        return 1;
+    }
+
+    printf("fixture   %-30s records=%-6u levels=%u nodes=%-4u copy levels=%u nodes=%-4u ok\n",
+           [[fixturePath lastPathComponent] UTF8String], expected[2], expected[1], expected[3], actual[1], actual[3]);
+    return 0;
+}
+
+static int benchmark(int records, int rounds, NSString *path)
+{
+    NSMutableArray *entries = [NSMutableArray arrayWithCapacity:records];
+    [entries addObject:[DSStoreEntry viewStyleEntryForFile:@"." style:@"icnv"]];
+    [entries addObject:[DSStoreEntry iconSizeEntryForFile:@"." size:64]];
+    for (long n = 0; (long)[entries count] < records; n++) {
+        [entries addObject:entryForFile(n)];
+    }
+    NSArray *expected = [[DSStore createStoreAtPath:path withEntries:entries] entries];
+
+    // A new store every round: saving one again only writes what changed
+    double *times = malloc(sizeof(double) * rounds);
+    for (int round = 0; round < rounds; round++) {
+        DSStore *store = [DSStore createStoreAtPath:path withEntries:entries];
+        double start = nowMilliseconds();
+        if (![store save]) {
+            fprintf(stderr, "write-bench: cannot save %s\n", [path UTF8String]);
+            return 1;
+        }
+        times[round] = nowMilliseconds() - start;
+    }
+    qsort(times, rounds, sizeof(double), compareDoubles);
+    double p50 = times[(rounds - 1) / 2];
+    unsigned long long bytes = [[[NSFileManager defaultManager] attributesOfItemAtPath:path error:NULL] fileSize];
+    free(times);
+
+    DSStore *eager = [DSStore storeWithPath:path];
+    if (![eager load] || !sameRecords(expected, [eager entries], "full load")) {
+        return 1;
+    }
+    DSStore *mapped = [DSStore readOnlyStoreWithPath:path];
+    if (![mapped load]) {
+        fprintf(stderr, "write-bench: cannot map %s\n", [path UTF8String]);
+        return 1;
+    }
+    for (NSUInteger i = 0; i < [expected count]; i += 97) {
+        DSStoreEntry *entry = [expected objectAtIndex:i];
+        DSStoreEntry *found = [mapped entryForFilename:[entry filename] code:[entry code]];
+        if (!found || ![[found encode] isEqualToData:[entry encode]]) {
+            fprintf(stderr, "write-bench: read-only lookup of '%s' %s failed\n",
+                    [[entry filename] UTF8String], [[entry code] UTF8String]);
+            return 1;
+        }
+    }
+
+    printf("save   records=%-7lu bytes=%-9llu p50=%9.3f ms  %10.0f records/s  %7.1f MB/s  roundtrip ok\n",
+           (unsigned long)[expected count], bytes, p50, [expected count] / (p50 / 1e3), bytes / (p50 * 1e3));
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    const char *reference = NULL;
+    const char *fixture = NULL;
+    int records = 100000;
+    int rounds = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:f:n:r:")) != -1) {
+        if (opt == 'c') {
+            reference = optarg;
+        } else if (opt == 'f') {
+            fixture = optarg;
+        } else if (opt == 'n') {
+            records = atoi(optarg);
+        } else if (opt == 'r') {
+            rounds = atoi(optarg);
+        } else {
+            usage();
+        }
+    }
+    if (argc - optind != 0 || records < 2 || rounds <= 0) {
+        usage();
+    }
+
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:
+                         [NSString stringWithFormat:@"write-bench-%d.DS_Store", (int)getpid()]];
+    int status;
+    if (reference) {
+        status = checkReference([NSString stringWithUTF8String:reference], path);
+    } else if (fixture) {
+        status = checkFixture([NSString stringWithUTF8String:fixture], path);
+    } else {
+        status = benchmark(records, rounds, path);
+    }
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+
+    [pool release];
+    return status;
+}
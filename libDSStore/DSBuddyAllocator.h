@@ -14,17 +14,53 @@
     NSMutableData *_data;
     NSString *_filePath;
     BOOL _dirty;
-    NSMutableArray *_freeBlocks;
-    NSMutableArray *_usedBlocks;
+    
+    // Allocation state of a read-write file, read from its root block on first use
+    NSMutableData *_blockAddresses;     // uint32_t per block number, 0 for none
+    NSMutableDictionary *_directories;  // Table of contents: name -> block number
+    NSMutableArray *_freeBlocks;        // Per log2(size), free offsets in ascending order
+    uint32_t _rootUnknown;              // Word after the block count, kept as read
+    uint8_t _headerUnknown[16];         // Header bytes after the root block's address
+    BOOL _allocationChanged;            // Root block and header need rewriting
+    
+    // Byte ranges written since the last flush, for writing in place
+    NSRange *_dirtyRanges;
+    NSUInteger _dirtyCount;
+    NSUInteger _dirtyCapacity;
+    NSUInteger _diskLength;             // File length as last read or written; 0 if never
+    unsigned long long _bytesWritten;   // Written to disk by all flushes
+    
+    // Read-only mode: the file is mapped instead of copied into _data
+    BOOL _readOnly;
+    const uint8_t *_mappedBytes;
+    NSUInteger _mappedLength;
+    
+    // Root block, parsed on first use of the offset table or table of contents
+    BOOL _rootParsed;
+    NSUInteger _offsetTable;    // File position of the first block address
+    uint32_t _blockCount;
+    NSUInteger _tocPosition;    // File position of the table of contents count
 }
 
 - (id)initWithFile:(NSString *)filePath;
 - (id)initWithData:(NSMutableData *)data;
 
+// Maps the file on open and refuses writes; nothing is read until a block is
+- (id)initReadOnlyWithFile:(NSString *)filePath;
+
 - (BOOL)open;
 - (void)close;
 - (void)flush;
 
+// Writes the root block if the allocation changed, then either only the
+// bytes written since the last flush, in place, or the whole file to a
+// temporary that is renamed over it. A file never written is written whole.
+- (BOOL)flushAtomically:(BOOL)atomically;
+- (unsigned long long)bytesWritten;
+
+// Starts a new file in memory with only the 32-byte header allocated
+- (void)resetToEmptyFile;
+
 - (NSData *)readAtOffset:(NSUInteger)offset length:(NSUInteger)length;
 - (void)writeAtOffset:(NSUInteger)offset data:(NSData *)data;
 
@@ -34,6 +70,23 @@
 
 - (NSUInteger)fileSize;
 - (BOOL)isDirty;
+- (BOOL)isReadOnly;
+
+// The whole file, mapped or in memory; valid until the allocator is released
+- (const uint8_t *)bytes;
+
+// Root block lookups, read in place from the file. Block addresses are
+// offset | log2(size), with offsets relative to the 4-byte file prefix.
+- (BOOL)getAddress:(uint32_t *)address ofBlock:(uint32_t)blockNumber;
+- (BOOL)getBlockNumber:(uint32_t *)blockNumber forDirectory:(NSString *)name;
+
+// Blocks by number, from power-of-two free lists: sizes round up to at
+// least 32 bytes and a free block merges with its free buddy. A block that
+// already has the size class asked for stays where it is; otherwise it moves.
+- (uint32_t)blockCount;
+- (BOOL)allocateBlock:(uint32_t)blockNumber size:(NSUInteger)size;
+- (void)releaseBlock:(uint32_t)blockNumber;
+- (void)setBlockNumber:(uint32_t)blockNumber forDirectory:(NSString *)name;
 
 @end
 
@@ -42,7 +95,7 @@
     DSBuddyAllocator *_allocator;
     NSUInteger _offset;
     NSUInteger _size;
-    NSMutableData *_data;
+    NSMutableData *_data;       // Copy made by the first write; reads use the allocator's bytes until then
     NSUInteger _position;
     BOOL _dirty;
 }
@@ -60,6 +113,11 @@
 - (void)seek:(NSUInteger)position whence:(int)whence;
 
 - (NSData *)readBytes:(NSUInteger)length;
+
+// The block's bytes where they lie in the allocator's file (or the block's
+// own copy once written); NULL if the file is shorter. Valid until the next
+// write to the block or the allocator.
+- (const uint8_t *)bytes;
 - (void)writeBytes:(NSData *)data;
 
 - (uint8_t)readUInt8;
@@ -6,7 +6,13 @@
 //
 
 #import "DSBuddyAllocator.h"
+#import "DSByteCursor.h"
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
 
 // Constants from buddy.py
 #define BUDDY_MAGIC 0x00000001
@@ -30,6 +36,99 @@ static uint64_t swap64(uint64_t x) {
            ((x & 0x000000000000FF00ULL) << 40) | ((x & 0x00000000000000FFULL) << 56);
 }
 
+static void putBigEndian32(uint8_t *bytes, uint32_t value) {
+    bytes[0] = value >> 24;
+    bytes[1] = value >> 16;
+    bytes[2] = value >> 8;
+    bytes[3] = value;
+}
+
+// Position of the first offset in an ascending free list not below offset
+static NSUInteger freeListPosition(NSArray *list, uint32_t offset) {
+    NSUInteger low = 0;
+    NSUInteger high = [list count];
+    while (low < high) {
+        NSUInteger middle = low + (high - low) / 2;
+        if ([[list objectAtIndex:middle] unsignedIntValue] < offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// A block in the file: its offset and log2 of its size
+typedef struct {
+    uint32_t offset;
+    uint32_t shift;
+} DSBlockSpan;
+
+static int compareBlockSpans(const void *a, const void *b) {
+    uint32_t x = ((const DSBlockSpan *)a)->offset;
+    uint32_t y = ((const DSBlockSpan *)b)->offset;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Appends the free blocks of the buddy region at offset, of size 2^shift, to
+ * the free list of their size. used holds the blocks inside the region,
+ * sorted; halves holding none of them are free whole, the others are split.
+ */
+static void collectFreeBlocks(uint32_t offset, uint32_t shift, const DSBlockSpan *used,
+                              NSUInteger count, NSArray *freeBlocks) {
+    if (count == 0) {
+        [[freeBlocks objectAtIndex:shift] addObject:[NSNumber numberWithUnsignedInt:offset]];
+        return;
+    }
+    if ((count == 1 && used[0].offset == offset && used[0].shift == shift) || shift == 0) {
+        return;
+    }
+    
+    uint32_t half = offset + (1u << (shift - 1));
+    NSUInteger split = 0;
+    while (split < count && used[split].offset < half) {
+        split++;
+    }
+    collectFreeBlocks(offset, shift - 1, used, split, freeBlocks);
+    collectFreeBlocks(half, shift - 1, used + split, count - split, freeBlocks);
+}
+
+static int compareRanges(const void *a, const void *b) {
+    NSUInteger x = ((const NSRange *)a)->location;
+    NSUInteger y = ((const NSRange *)b)->location;
+    return (x > y) - (x < y);
+}
+
+static BOOL writeFully(int fd, const uint8_t *bytes, NSUInteger length, NSUInteger offset) {
+    while (length > 0) {
+        ssize_t written = pwrite(fd, bytes, length, (off_t)offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return NO;
+        }
+        bytes += written;
+        offset += (NSUInteger)written;
+        length -= (NSUInteger)written;
+    }
+    return YES;
+}
+
+@interface DSBuddyAllocator (Private)
+- (BOOL)mapFile;
+- (BOOL)parseRootBlock;
+- (BOOL)loadAllocationState;
+- (void)rebuildFreeBlocks;
+- (NSUInteger)takeOffsetOfWidth:(uint32_t)width;
+- (void)releaseOffset:(uint32_t)offset width:(uint32_t)width;
+- (NSUInteger)rootBlockLength;
+- (BOOL)writeRootBlock;
+- (BOOL)writeDirtyRanges;
+- (void)noteDirtyRange:(NSRange)range;
+@end
+
 @implementation DSBuddyAllocator
 
 - (id)initWithFile:(NSString *)filePath {
@@ -38,7 +137,6 @@ static uint64_t swap64(uint64_t x) {
         _data = nil;
         _dirty = NO;
         _freeBlocks = [[NSMutableArray alloc] init];
-        _usedBlocks = [[NSMutableArray alloc] init];
     }
     return self;
 }
@@ -49,21 +147,40 @@ static uint64_t swap64(uint64_t x) {
         _data = [data retain];
         _dirty = NO;
         _freeBlocks = [[NSMutableArray alloc] init];
-        _usedBlocks = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (id)initReadOnlyWithFile:(NSString *)filePath {
+    if ((self = [self initWithFile:filePath])) {
+        _readOnly = YES;
     }
     return self;
 }
 
 - (void)dealloc {
     [self close];
+    if (_mappedBytes) {
+        munmap((void *)_mappedBytes, _mappedLength);
+    }
     [_filePath release];
     [_data release];
     [_freeBlocks release];
-    [_usedBlocks release];
+    [_blockAddresses release];
+    [_directories release];
+    free(_dirtyRanges);
     [super dealloc];
 }
 
 - (BOOL)open {
+    if (_mappedBytes) {
+        return YES;
+    }
+    
+    if (_readOnly) {
+        return [self mapFile];
+    }
+    
     if (_data) {
         NSLog(@"DEBUG: Allocator already opened with data");
         return YES; // Already opened with data
@@ -83,23 +200,98 @@ static uint64_t swap64(uint64_t x) {
     
     NSLog(@"DEBUG: Successfully read %lu bytes from file", (unsigned long)[fileData length]);
     _data = [[NSMutableData dataWithData:fileData] retain];
+    _diskLength = [_data length];
     return YES;
 }
 
 - (void)close {
-    if (_dirty) {
+    if (_dirty || _allocationChanged) {
         [self flush];
     }
 }
 
 - (void)flush {
-    if (_dirty && _filePath && _data) {
-        [_data writeToFile:_filePath atomically:YES];
-        _dirty = NO;
+    [self flushAtomically:YES];
+}
+
+- (BOOL)flushAtomically:(BOOL)atomically {
+    if (_readOnly) {
+        NSLog(@"DSBuddyAllocator: Refusing to write to read-only %@", _filePath);
+        return NO;
+    }
+    
+    if (_allocationChanged && ![self writeRootBlock]) {
+        return NO;
+    }
+    if (!_dirty) {
+        return YES;
+    }
+    if (!_filePath || !_data) {
+        return NO;
+    }
+    
+    BOOL written;
+    if (atomically || _diskLength == 0) {
+        written = [_data writeToFile:_filePath atomically:YES];
+        if (written) {
+            _bytesWritten += [_data length];
+        } else {
+            NSLog(@"DSBuddyAllocator: Cannot write %@", _filePath);
+        }
+    } else {
+        written = [self writeDirtyRanges];
+    }
+    if (!written) {
+        return NO;
+    }
+    
+    _dirtyCount = 0;
+    _diskLength = [_data length];
+    _dirty = NO;
+    return YES;
+}
+
+- (unsigned long long)bytesWritten {
+    return _bytesWritten;
+}
+
+- (void)resetToEmptyFile {
+    if (_readOnly) {
+        NSLog(@"DSBuddyAllocator: Refusing to write to read-only %@", _filePath);
+        return;
     }
+    
+    // The header is the first 32 bytes of the allocator's space, after the
+    // 4-byte prefix; its unknown words are the ones Finder writes
+    static const uint8_t finderUnknown[16] = {
+        0x00, 0x00, 0x10, 0x0C, 0x00, 0x00, 0x00, 0x87, 0x00, 0x00, 0x20, 0x0B, 0x00, 0x00, 0x00, 0x00
+    };
+    
+    [_data release];
+    _data = [[NSMutableData alloc] initWithLength:4 + BUDDY_HEADER_SIZE];
+    [_blockAddresses release];
+    _blockAddresses = [[NSMutableData alloc] init];
+    [_directories release];
+    _directories = [[NSMutableDictionary alloc] init];
+    [self rebuildFreeBlocks];
+    
+    _rootUnknown = 0;
+    memcpy(_headerUnknown, finderUnknown, sizeof(_headerUnknown));
+    _rootParsed = NO;
+    _dirtyCount = 0;
+    _diskLength = 0;
+    _allocationChanged = YES;
+    _dirty = YES;
 }
 
 - (NSData *)readAtOffset:(NSUInteger)offset length:(NSUInteger)length {
+    if (_mappedBytes) {
+        if (offset + length > _mappedLength) {
+            return nil;
+        }
+        return [NSData dataWithBytes:_mappedBytes + offset length:length];
+    }
+    
     if (!_data || offset + length > [_data length]) {
         return nil;
     }
@@ -108,6 +300,11 @@ static uint64_t swap64(uint64_t x) {
 }
 
 - (void)writeAtOffset:(NSUInteger)offset data:(NSData *)data {
+    if (_readOnly) {
+        NSLog(@"DSBuddyAllocator: Refusing to write to read-only %@", _filePath);
+        return;
+    }
+    
     if (!_data) {
         return;
     }
@@ -121,21 +318,37 @@ static uint64_t swap64(uint64_t x) {
     }
     
     [_data replaceBytesInRange:NSMakeRange(offset, dataLength) withBytes:[data bytes]];
+    [self noteDirtyRange:NSMakeRange(offset, dataLength)];
     _dirty = YES;
 }
 
 - (DSBuddyBlock *)allocateBlockWithSize:(NSUInteger)size {
-    // Simplified allocation - for full implementation, would need to track free blocks
-    NSUInteger offset = [_data length];
-    [_data setLength:offset + size];
+    if (_readOnly) {
+        NSLog(@"DSBuddyAllocator: Refusing to allocate in read-only %@", _filePath);
+        return nil;
+    }
     
-    DSBuddyBlock *block = [[DSBuddyBlock alloc] initWithAllocator:self offset:offset size:size];
-    [_usedBlocks addObject:block];
-    return [block autorelease];
+    if (![self loadAllocationState]) {
+        return nil;
+    }
+    
+    // The lowest unused block number; block 0 is always the root block
+    const uint32_t *table = [_blockAddresses bytes];
+    uint32_t count = [self blockCount];
+    uint32_t blockNumber = 1;
+    while (blockNumber < count && table[blockNumber] != 0) {
+        blockNumber++;
+    }
+    if (![self allocateBlock:blockNumber size:size]) {
+        return nil;
+    }
+    
+    uint32_t address = ((const uint32_t *)[_blockAddresses bytes])[blockNumber];
+    return [self blockAtOffset:(address & ~0x1F) + 4 size:(NSUInteger)1 << (address & 0x1F)];
 }
 
 - (DSBuddyBlock *)blockAtOffset:(NSUInteger)offset size:(NSUInteger)size {
-    if (!_data || offset + size > [_data length]) {
+    if (offset + size > [self fileSize]) {
         return nil;
     }
     
@@ -144,11 +357,25 @@ static uint64_t swap64(uint64_t x) {
 }
 
 - (void)deallocateBlock:(DSBuddyBlock *)block {
-    [_usedBlocks removeObject:block];
-    // In full implementation, would add to free blocks list
+    if (!block || ![self loadAllocationState]) {
+        return;
+    }
+    
+    const uint32_t *table = [_blockAddresses bytes];
+    uint32_t count = [self blockCount];
+    for (uint32_t blockNumber = 1; blockNumber < count; blockNumber++) {
+        if (table[blockNumber] != 0 && (table[blockNumber] & ~0x1F) + 4 == [block offset]) {
+            [block invalidate];
+            [self releaseBlock:blockNumber];
+            return;
+        }
+    }
 }
 
 - (NSUInteger)fileSize {
+    if (_mappedBytes) {
+        return _mappedLength;
+    }
     return _data ? [_data length] : 0;
 }
 
@@ -156,10 +383,522 @@ static uint64_t swap64(uint64_t x) {
     return _dirty;
 }
 
+- (BOOL)isReadOnly {
+    return _readOnly;
+}
+
+- (const uint8_t *)bytes {
+    if (_mappedBytes) {
+        return _mappedBytes;
+    }
+    return [_data bytes];
+}
+
+- (BOOL)getAddress:(uint32_t *)address ofBlock:(uint32_t)blockNumber {
+    if (!_readOnly) {
+        if (![self loadAllocationState] || blockNumber >= [self blockCount]) {
+            return NO;
+        }
+        *address = ((const uint32_t *)[_blockAddresses bytes])[blockNumber];
+        return *address != 0;
+    }
+    
+    if (![self parseRootBlock] || blockNumber >= _blockCount) {
+        return NO;
+    }
+    
+    *address = DSLoadBigEndian32([self bytes] + _offsetTable + 4 * blockNumber);
+    return YES;
+}
+
+- (BOOL)getBlockNumber:(uint32_t *)blockNumber forDirectory:(NSString *)name {
+    if (!_readOnly) {
+        NSNumber *number = [self loadAllocationState] ? [_directories objectForKey:name] : nil;
+        if (!number) {
+            return NO;
+        }
+        *blockNumber = [number unsignedIntValue];
+        return YES;
+    }
+    
+    if (![self parseRootBlock]) {
+        return NO;
+    }
+    
+    const char *wanted = [name UTF8String];
+    size_t wantedLength = strlen(wanted);
+    const uint8_t *bytes = [self bytes];
+    NSUInteger fileSize = [self fileSize];
+    NSUInteger position = _tocPosition;
+    
+    uint32_t tocCount = DSLoadBigEndian32(bytes + position);
+    position += 4;
+    
+    // Entries are a length byte, the name and a block number; usually just "DSDB"
+    for (uint32_t i = 0; i < tocCount; i++) {
+        if (position + 1 > fileSize) {
+            return NO;
+        }
+        uint8_t nameLength = bytes[position];
+        if (position + 1 + nameLength + 4 > fileSize) {
+            return NO;
+        }
+        
+        if (nameLength == wantedLength && memcmp(bytes + position + 1, wanted, nameLength) == 0) {
+            *blockNumber = DSLoadBigEndian32(bytes + position + 1 + nameLength);
+            return YES;
+        }
+        position += 1 + nameLength + 4;
+    }
+    return NO;
+}
+
+- (uint32_t)blockCount {
+    if (!_readOnly) {
+        return [self loadAllocationState] ? (uint32_t)([_blockAddresses length] / 4) : 0;
+    }
+    return [self parseRootBlock] ? _blockCount : 0;
+}
+
+- (BOOL)allocateBlock:(uint32_t)blockNumber size:(NSUInteger)size {
+    if (_readOnly) {
+        NSLog(@"DSBuddyAllocator: Refusing to allocate in read-only %@", _filePath);
+        return NO;
+    }
+    if (![self loadAllocationState]) {
+        return NO;
+    }
+    
+    uint32_t width = 5;
+    while (width < 31 && ((NSUInteger)1 << width) < size) {
+        width++;
+    }
+    
+    uint32_t count = [self blockCount];
+    if (blockNumber < count) {
+        uint32_t *table = [_blockAddresses mutableBytes];
+        uint32_t address = table[blockNumber];
+        if (address != 0 && (address & 0x1F) == width) {
+            return YES;
+        }
+        if (address != 0) {
+            [self releaseOffset:address & ~0x1Fu width:address & 0x1F];
+            table[blockNumber] = 0;
+            _allocationChanged = YES;
+        }
+    }
+    
+    NSUInteger offset = [self takeOffsetOfWidth:width];
+    if (offset == NSNotFound) {
+        NSLog(@"DSBuddyAllocator: No room for a block of %lu bytes in %@", (unsigned long)size, _filePath);
+        return NO;
+    }
+    if (blockNumber >= count) {
+        [_blockAddresses setLength:4 * ((NSUInteger)blockNumber + 1)];
+    }
+    ((uint32_t *)[_blockAddresses mutableBytes])[blockNumber] = (uint32_t)offset | width;
+    
+    // Blocks lie in the file in full, so a reader never runs off its end
+    NSUInteger end = 4 + offset + ((NSUInteger)1 << width);
+    if (end > [_data length]) {
+        [_data setLength:end];
+    }
+    _allocationChanged = YES;
+    return YES;
+}
+
+- (void)releaseBlock:(uint32_t)blockNumber {
+    if (_readOnly) {
+        NSLog(@"DSBuddyAllocator: Refusing to free a block of read-only %@", _filePath);
+        return;
+    }
+    
+    uint32_t count = [self blockCount];
+    if (blockNumber >= count) {
+        return;
+    }
+    uint32_t *table = [_blockAddresses mutableBytes];
+    if (table[blockNumber] == 0) {
+        return;
+    }
+    [self releaseOffset:table[blockNumber] & ~0x1Fu width:table[blockNumber] & 0x1F];
+    table[blockNumber] = 0;
+    
+    // Unused numbers at the end drop out of the offset table
+    while (count > 0 && table[count - 1] == 0) {
+        count--;
+    }
+    [_blockAddresses setLength:4 * (NSUInteger)count];
+    _allocationChanged = YES;
+}
+
+- (void)setBlockNumber:(uint32_t)blockNumber forDirectory:(NSString *)name {
+    if (_readOnly) {
+        NSLog(@"DSBuddyAllocator: Refusing to write to read-only %@", _filePath);
+        return;
+    }
+    if (![self loadAllocationState]) {
+        return;
+    }
+    [_directories setObject:[NSNumber numberWithUnsignedInt:blockNumber] forKey:name];
+    _allocationChanged = YES;
+}
+
+@end
+
+@implementation DSBuddyAllocator (Private)
+
+- (BOOL)mapFile {
+    if (!_filePath) {
+        return NO;
+    }
+    
+    int fd = open([_filePath fileSystemRepresentation], O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        NSLog(@"DSBuddyAllocator: Cannot open %@: %s", _filePath, strerror(errno));
+        return NO;
+    }
+    
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        NSLog(@"DSBuddyAllocator: Cannot map empty or unreadable %@", _filePath);
+        close(fd);
+        return NO;
+    }
+    
+    void *mapped = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        NSLog(@"DSBuddyAllocator: Cannot map %@: %s", _filePath, strerror(errno));
+        return NO;
+    }
+    
+#ifdef MADV_RANDOM
+    // A lookup touches one page per tree level, so read-ahead only wastes I/O
+    madvise(mapped, (size_t)info.st_size, MADV_RANDOM);
+#endif
+    
+    _mappedBytes = mapped;
+    _mappedLength = (NSUInteger)info.st_size;
+    return YES;
+}
+
+- (BOOL)parseRootBlock {
+    if (_rootParsed) {
+        return YES;
+    }
+    
+    const uint8_t *bytes = [self bytes];
+    NSUInteger fileSize = [self fileSize];
+    if (!bytes || fileSize < BUDDY_HEADER_SIZE) {
+        return NO;
+    }
+    
+    if (DSLoadBigEndian32(bytes) != BUDDY_MAGIC || DSLoadBigEndian32(bytes + 4) != BUDDY_VERSION) {
+        NSLog(@"DSBuddyAllocator: %@ is not a buddy allocator file", _filePath);
+        return NO;
+    }
+    
+    // Offsets in the file are relative to the 4-byte prefix before "Bud1"
+    NSUInteger rootOffset = DSLoadBigEndian32(bytes + 8);
+    NSUInteger rootSize = DSLoadBigEndian32(bytes + 12);
+    NSUInteger rootStart = rootOffset + 4;
+    if (rootStart + rootSize > fileSize || rootSize < 12) {
+        NSLog(@"DSBuddyAllocator: Root block of %@ lies outside the file", _filePath);
+        return NO;
+    }
+    
+    // The offset table holds the block count rounded up to 256 entries
+    uint32_t blockCount = DSLoadBigEndian32(bytes + rootStart);
+    NSUInteger tableEntries = ((NSUInteger)blockCount + 255) & ~(NSUInteger)255;
+    NSUInteger tocPosition = rootStart + 8 + 4 * tableEntries;
+    if (tocPosition + 4 > rootStart + rootSize) {
+        NSLog(@"DSBuddyAllocator: Offset table of %@ overflows its root block", _filePath);
+        return NO;
+    }
+    
+    _offsetTable = rootStart + 8;
+    _blockCount = blockCount;
+    _tocPosition = tocPosition;
+    _rootParsed = YES;
+    return YES;
+}
+
+- (BOOL)loadAllocationState {
+    if (_blockAddresses) {
+        return YES;
+    }
+    if (![self parseRootBlock] || [self fileSize] < 4 + BUDDY_HEADER_SIZE) {
+        return NO;
+    }
+    
+    const uint8_t *bytes = [self bytes];
+    NSUInteger fileSize = [self fileSize];
+    NSUInteger rootStart = _offsetTable - 8;
+    
+    NSMutableData *addresses = [NSMutableData dataWithLength:4 * (NSUInteger)_blockCount];
+    uint32_t *table = [addresses mutableBytes];
+    for (uint32_t i = 0; i < _blockCount; i++) {
+        table[i] = DSLoadBigEndian32(bytes + _offsetTable + 4 * i);
+    }
+    
+    NSMutableDictionary *directories = [NSMutableDictionary dictionary];
+    NSUInteger position = _tocPosition;
+    uint32_t tocCount = DSLoadBigEndian32(bytes + position);
+    position += 4;
+    for (uint32_t i = 0; i < tocCount; i++) {
+        if (position + 1 > fileSize || position + 1 + bytes[position] + 4 > fileSize) {
+            NSLog(@"DSBuddyAllocator: Table of contents of %@ runs off the file", _filePath);
+            return NO;
+        }
+        uint8_t nameLength = bytes[position];
+        NSString *name = [[NSString alloc] initWithBytes:bytes + position + 1
+                                                  length:nameLength
+                                                encoding:NSASCIIStringEncoding];
+        if (name) {
+            [directories setObject:[NSNumber numberWithUnsignedInt:DSLoadBigEndian32(bytes + position + 1 + nameLength)]
+                            forKey:name];
+            [name release];
+        }
+        position += 1 + nameLength + 4;
+    }
+    
+    _blockAddresses = [addresses retain];
+    _directories = [directories retain];
+    _rootUnknown = DSLoadBigEndian32(bytes + rootStart + 4);
+    memcpy(_headerUnknown, bytes + 20, sizeof(_headerUnknown));
+    
+    // The free lists are worked out from the blocks in use rather than read:
+    // the writer this library used to have stored a fixed list that overlaps
+    // the DSDB block, and for a sound file the two are the same
+    [self rebuildFreeBlocks];
+    return YES;
+}
+
+- (void)rebuildFreeBlocks {
+    [_freeBlocks removeAllObjects];
+    for (int i = 0; i < 32; i++) {
+        [_freeBlocks addObject:[NSMutableArray array]];
+    }
+    
+    // The header takes the first 32 bytes
+    NSUInteger count = [_blockAddresses length] / 4;
+    const uint32_t *table = [_blockAddresses bytes];
+    DSBlockSpan *used = malloc(sizeof(DSBlockSpan) * (count + 1));
+    NSUInteger usedCount = 0;
+    used[usedCount].offset = 0;
+    used[usedCount].shift = 5;
+    usedCount++;
+    for (NSUInteger i = 0; i < count; i++) {
+        if (table[i] != 0) {
+            used[usedCount].offset = table[i] & ~0x1Fu;
+            used[usedCount].shift = table[i] & 0x1F;
+            usedCount++;
+        }
+    }
+    
+    qsort(used, usedCount, sizeof(DSBlockSpan), compareBlockSpans);
+    collectFreeBlocks(0, 31, used, usedCount, _freeBlocks);
+    free(used);
+}
+
+- (NSUInteger)takeOffsetOfWidth:(uint32_t)width {
+    uint32_t w = width;
+    while (w < 32 && [[_freeBlocks objectAtIndex:w] count] == 0) {
+        w++;
+    }
+    if (w == 32) {
+        return NSNotFound;
+    }
+    
+    // Split the smallest larger block down; the lists in between were empty
+    while (w > width) {
+        NSMutableArray *list = [_freeBlocks objectAtIndex:w];
+        uint32_t offset = [[list objectAtIndex:0] unsignedIntValue];
+        [list removeObjectAtIndex:0];
+        w--;
+        [[_freeBlocks objectAtIndex:w] addObject:[NSNumber numberWithUnsignedInt:offset]];
+        [[_freeBlocks objectAtIndex:w] addObject:[NSNumber numberWithUnsignedInt:offset | (1u << w)]];
+    }
+    
+    NSMutableArray *list = [_freeBlocks objectAtIndex:width];
+    NSUInteger offset = [[list objectAtIndex:0] unsignedIntValue];
+    [list removeObjectAtIndex:0];
+    return offset;
+}
+
+- (void)releaseOffset:(uint32_t)offset width:(uint32_t)width {
+    // Merge with the buddy for as long as it is free too
+    while (width < 31) {
+        NSMutableArray *list = [_freeBlocks objectAtIndex:width];
+        uint32_t buddy = offset ^ (1u << width);
+        NSUInteger position = freeListPosition(list, buddy);
+        if (position == [list count] || [[list objectAtIndex:position] unsignedIntValue] != buddy) {
+            break;
+        }
+        [list removeObjectAtIndex:position];
+        offset &= ~(1u << width);
+        width++;
+    }
+    
+    NSMutableArray *list = [_freeBlocks objectAtIndex:width];
+    [list insertObject:[NSNumber numberWithUnsignedInt:offset] atIndex:freeListPosition(list, offset)];
+}
+
+- (NSUInteger)rootBlockLength {
+    NSUInteger count = [_blockAddresses length] / 4;
+    NSUInteger length = 8 + 4 * ((count + 255) & ~(NSUInteger)255) + 4;
+    for (NSString *name in _directories) {
+        length += 1 + [name lengthOfBytesUsingEncoding:NSASCIIStringEncoding] + 4;
+    }
+    for (NSArray *list in _freeBlocks) {
+        length += 4 + 4 * [list count];
+    }
+    return length;
+}
+
+- (BOOL)writeRootBlock {
+    // Moving the root block changes the free lists it holds, so size it
+    // until they fit; it only ever grows
+    for (;;) {
+        NSUInteger length = [self rootBlockLength];
+        uint32_t address = [self blockCount] > 0 ? ((const uint32_t *)[_blockAddresses bytes])[0] : 0;
+        if (address != 0 && ((NSUInteger)1 << (address & 0x1F)) >= length) {
+            break;
+        }
+        if (![self allocateBlock:0 size:MAX(length, (NSUInteger)2048)]) {
+            return NO;
+        }
+    }
+    
+    // Block count, an unknown word, the offset table padded to 256 entries,
+    // the table of contents sorted by name and the 32 free lists
+    NSUInteger count = [_blockAddresses length] / 4;
+    const uint32_t *table = [_blockAddresses bytes];
+    NSMutableData *root = [NSMutableData dataWithLength:[self rootBlockLength]];
+    uint8_t *at = [root mutableBytes];
+    putBigEndian32(at, (uint32_t)count);
+    putBigEndian32(at + 4, _rootUnknown);
+    for (NSUInteger i = 0; i < count; i++) {
+        putBigEndian32(at + 8 + 4 * i, table[i]);
+    }
+    at += 8 + 4 * ((count + 255) & ~(NSUInteger)255);
+    
+    NSArray *names = [[_directories allKeys] sortedArrayUsingSelector:@selector(compare:)];
+    putBigEndian32(at, (uint32_t)[names count]);
+    at += 4;
+    for (NSString *name in names) {
+        NSData *nameData = [name dataUsingEncoding:NSASCIIStringEncoding];
+        at[0] = (uint8_t)[nameData length];
+        memcpy(at + 1, [nameData bytes], [nameData length]);
+        putBigEndian32(at + 1 + [nameData length], [[_directories objectForKey:name] unsignedIntValue]);
+        at += 1 + [nameData length] + 4;
+    }
+    
+    for (NSArray *list in _freeBlocks) {
+        putBigEndian32(at, (uint32_t)[list count]);
+        at += 4;
+        for (NSNumber *offset in list) {
+            putBigEndian32(at, [offset unsignedIntValue]);
+            at += 4;
+        }
+    }
+    
+    uint32_t rootOffset = table[0] & ~0x1Fu;
+    [self writeAtOffset:rootOffset + 4 data:root];
+    
+    // The header names the root block twice, then the unknown bytes
+    uint8_t header[4 + BUDDY_HEADER_SIZE];
+    putBigEndian32(header, BUDDY_MAGIC);
+    putBigEndian32(header + 4, BUDDY_VERSION);
+    putBigEndian32(header + 8, rootOffset);
+    putBigEndian32(header + 12, 1u << (table[0] & 0x1F));
+    putBigEndian32(header + 16, rootOffset);
+    memcpy(header + 20, _headerUnknown, sizeof(_headerUnknown));
+    [self writeAtOffset:0 data:[NSData dataWithBytes:header length:sizeof(header)]];
+    
+    _allocationChanged = NO;
+    return YES;
+}
+
+- (BOOL)writeDirtyRanges {
+    int fd = open([_filePath fileSystemRepresentation], O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        NSLog(@"DSBuddyAllocator: Cannot open %@ for writing: %s", _filePath, strerror(errno));
+        return NO;
+    }
+    
+    const uint8_t *bytes = [_data bytes];
+    NSUInteger length = [_data length];
+    BOOL written = YES;
+    
+    // Overlapping and touching ranges go out as one write
+    qsort(_dirtyRanges, _dirtyCount, sizeof(NSRange), compareRanges);
+    NSUInteger i = 0;
+    while (written && i < _dirtyCount) {
+        NSUInteger start = _dirtyRanges[i].location;
+        NSUInteger end = NSMaxRange(_dirtyRanges[i]);
+        for (i++; i < _dirtyCount && _dirtyRanges[i].location <= end; i++) {
+            end = MAX(end, NSMaxRange(_dirtyRanges[i]));
+        }
+        end = MIN(end, length);
+        if (start < end) {
+            written = writeFully(fd, bytes + start, end - start, start);
+            if (written) {
+                _bytesWritten += end - start;
+            }
+        }
+    }
+    
+    if (written && length != _diskLength) {
+        written = ftruncate(fd, (off_t)length) == 0;
+    }
+    if (written) {
+        written = fsync(fd) == 0;
+    }
+    if (!written) {
+        NSLog(@"DSBuddyAllocator: Cannot write %@ in place: %s", _filePath, strerror(errno));
+    }
+    close(fd);
+    return written;
+}
+
+- (void)noteDirtyRange:(NSRange)range {
+    if (_dirtyCount == _dirtyCapacity) {
+        _dirtyCapacity = _dirtyCapacity ? 2 * _dirtyCapacity : 16;
+        _dirtyRanges = realloc(_dirtyRanges, sizeof(NSRange) * _dirtyCapacity);
+    }
+    _dirtyRanges[_dirtyCount++] = range;
+}
+
 @end
 
 @implementation DSBuddyBlock
 
+// The block's bytes: its own copy once written, otherwise where they lie in
+// the allocator's file, which may have moved since the last call. NULL if
+// the file no longer reaches the end of the block.
+static inline const uint8_t *blockBytes(DSBuddyBlock *block) {
+    if (block->_data) {
+        return [block->_data bytes];
+    }
+    if (block->_offset + block->_size > [block->_allocator fileSize]) {
+        return NULL;
+    }
+    return [block->_allocator bytes] + block->_offset;
+}
+
+// The next count bytes, advancing past them, or NULL if the block ends first
+static inline const uint8_t *consumeBytes(DSBuddyBlock *block, NSUInteger count) {
+    const uint8_t *bytes = blockBytes(block);
+    if (!bytes || block->_size - block->_position < count) {
+        return NULL;
+    }
+    bytes += block->_position;
+    block->_position += count;
+    return bytes;
+}
+
 - (id)initWithAllocator:(DSBuddyAllocator *)allocator 
                  offset:(NSUInteger)offset 
                    size:(NSUInteger)size {
@@ -169,13 +908,7 @@ static uint64_t swap64(uint64_t x) {
         _size = size;
         _position = 0;
         _dirty = NO;
-        
-        NSData *blockData = [allocator readAtOffset:offset length:size];
-        if (blockData) {
-            _data = [[NSMutableData dataWithData:blockData] retain];
-        } else {
-            _data = [[NSMutableData dataWithLength:size] retain];
-        }
+        _data = nil;
     }
     return self;
 }
@@ -231,13 +964,26 @@ static uint64_t swap64(uint64_t x) {
 }
 
 - (NSData *)readBytes:(NSUInteger)length {
-    if (_position + length > _size) {
+    if (length > _size - _position) {
         length = _size - _position;
     }
     
-    NSData *result = [_data subdataWithRange:NSMakeRange(_position, length)];
-    _position += length;
-    return result;
+    const uint8_t *bytes = consumeBytes(self, length);
+    return bytes ? [NSData dataWithBytes:bytes length:length] : [NSData data];
+}
+
+- (const uint8_t *)bytes {
+    return blockBytes(self);
+}
+
+// Bytes the block is about to change: the first write copies the block
+- (NSMutableData *)mutableData {
+    if (!_data) {
+        const uint8_t *bytes = blockBytes(self);
+        _data = bytes ? [[NSMutableData alloc] initWithBytes:bytes length:_size]
+                      : [[NSMutableData alloc] initWithLength:_size];
+    }
+    return _data;
 }
 
 - (void)writeBytes:(NSData *)data {
@@ -247,53 +993,30 @@ static uint64_t swap64(uint64_t x) {
         return;
     }
     
-    [_data replaceBytesInRange:NSMakeRange(_position, length) withBytes:[data bytes]];
+    [[self mutableData] replaceBytesInRange:NSMakeRange(_position, length) withBytes:[data bytes]];
     _position += length;
     _dirty = YES;
 }
 
+// Reads load from the block's bytes where they lie
 - (uint8_t)readUInt8 {
-    if (_position + 1 > _size) {
-        return 0;
-    }
-    
-    uint8_t value;
-    [_data getBytes:&value range:NSMakeRange(_position, 1)];
-    _position += 1;
-    return value;
+    const uint8_t *bytes = consumeBytes(self, 1);
+    return bytes ? *bytes : 0;
 }
 
 - (uint16_t)readUInt16 {
-    if (_position + 2 > _size) {
-        return 0;
-    }
-    
-    uint16_t value;
-    [_data getBytes:&value range:NSMakeRange(_position, 2)];
-    _position += 2;
-    return swap16(value); // Convert from big-endian
+    const uint8_t *bytes = consumeBytes(self, 2);
+    return bytes ? DSLoadBigEndian16(bytes) : 0;
 }
 
 - (uint32_t)readUInt32 {
-    if (_position + 4 > _size) {
-        return 0;
-    }
-    
-    uint32_t value;
-    [_data getBytes:&value range:NSMakeRange(_position, 4)];
-    _position += 4;
-    return swap32(value); // Convert from big-endian
+    const uint8_t *bytes = consumeBytes(self, 4);
+    return bytes ? DSLoadBigEndian32(bytes) : 0;
 }
 
 - (uint64_t)readUInt64 {
-    if (_position + 8 > _size) {
-        return 0;
-    }
-    
-    uint64_t value;
-    [_data getBytes:&value range:NSMakeRange(_position, 8)];
-    _position += 8;
-    return swap64(value); // Convert from big-endian
+    const uint8_t *bytes = consumeBytes(self, 8);
+    return bytes ? DSLoadBigEndian64(bytes) : 0;
 }
 
 - (void)writeUInt8:(uint8_t)value {
@@ -301,7 +1024,7 @@ static uint64_t swap64(uint64_t x) {
         return;
     }
     
-    [_data replaceBytesInRange:NSMakeRange(_position, 1) withBytes:&value];
+    [[self mutableData] replaceBytesInRange:NSMakeRange(_position, 1) withBytes:&value];
     _position += 1;
     _dirty = YES;
 }
@@ -312,7 +1035,7 @@ static uint64_t swap64(uint64_t x) {
     }
     
     uint16_t bigEndianValue = swap16(value);
-    [_data replaceBytesInRange:NSMakeRange(_position, 2) withBytes:&bigEndianValue];
+    [[self mutableData] replaceBytesInRange:NSMakeRange(_position, 2) withBytes:&bigEndianValue];
     _position += 2;
     _dirty = YES;
 }
@@ -323,7 +1046,7 @@ static uint64_t swap64(uint64_t x) {
     }
     
     uint32_t bigEndianValue = swap32(value);
-    [_data replaceBytesInRange:NSMakeRange(_position, 4) withBytes:&bigEndianValue];
+    [[self mutableData] replaceBytesInRange:NSMakeRange(_position, 4) withBytes:&bigEndianValue];
     _position += 4;
     _dirty = YES;
 }
@@ -334,7 +1057,7 @@ static uint64_t swap64(uint64_t x) {
     }
     
     uint64_t bigEndianValue = swap64(value);
-    [_data replaceBytesInRange:NSMakeRange(_position, 8) withBytes:&bigEndianValue];
+    [[self mutableData] replaceBytesInRange:NSMakeRange(_position, 8) withBytes:&bigEndianValue];
     _position += 8;
     _dirty = YES;
 }
@@ -345,13 +1068,13 @@ static uint64_t swap64(uint64_t x) {
         return @"";
     }
     
-    NSData *stringData = [self readBytes:length * 2];
-    if (!stringData) {
+    // As much of the string as the block holds, as before
+    NSUInteger count = MIN((NSUInteger)length, (_size - _position) / 2);
+    const uint8_t *bytes = consumeBytes(self, 2 * count);
+    if (!bytes) {
         return @"";
     }
-    
-    return [[[NSString alloc] initWithData:stringData 
-                                  encoding:NSUTF16BigEndianStringEncoding] autorelease];
+    return [DSCreateStringFromUTF16BigEndian(bytes, count) autorelease];
 }
 
 - (void)writeUTF16String:(NSString *)string {
@@ -0,0 +1,143 @@
+//
+//  DSByteCursor.h
+//  libDSStore
+//
+//  Bounds-checked reads of big-endian data where it lies
+//
+
+#import <Foundation/Foundation.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Unaligned loads; memcpy and the builtin compile to a load and a bswap
+static inline uint16_t DSLoadBigEndian16(const uint8_t *bytes) {
+    uint16_t value;
+    memcpy(&value, bytes, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    value = __builtin_bswap16(value);
+#endif
+    return value;
+}
+
+static inline uint32_t DSLoadBigEndian32(const uint8_t *bytes) {
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
+}
+
+static inline uint64_t DSLoadBigEndian64(const uint8_t *bytes) {
+    uint64_t value;
+    memcpy(&value, bytes, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+// A read position in bytes the cursor does not own. A read that would run
+// off the end returns 0 (or NULL) and marks the cursor overrun, and every
+// read after it fails too, so a parser can check once at the end.
+typedef struct {
+    const uint8_t *bytes;
+    size_t length;
+    size_t position;    // Never past length
+    BOOL overrun;
+} DSByteCursor;
+
+static inline DSByteCursor DSByteCursorMake(const uint8_t *bytes, size_t length) {
+    DSByteCursor cursor = { bytes, length, 0, NO };
+    return cursor;
+}
+
+static inline BOOL DSByteCursorHas(DSByteCursor *cursor, size_t count) {
+    if (cursor->overrun || cursor->length - cursor->position < count) {
+        cursor->overrun = YES;
+        return NO;
+    }
+    return YES;
+}
+
+static inline uint8_t DSByteCursorReadUInt8(DSByteCursor *cursor) {
+    if (!DSByteCursorHas(cursor, 1)) {
+        return 0;
+    }
+    return cursor->bytes[cursor->position++];
+}
+
+static inline uint16_t DSByteCursorReadUInt16(DSByteCursor *cursor) {
+    if (!DSByteCursorHas(cursor, 2)) {
+        return 0;
+    }
+    uint16_t value = DSLoadBigEndian16(cursor->bytes + cursor->position);
+    cursor->position += 2;
+    return value;
+}
+
+static inline uint32_t DSByteCursorReadUInt32(DSByteCursor *cursor) {
+    if (!DSByteCursorHas(cursor, 4)) {
+        return 0;
+    }
+    uint32_t value = DSLoadBigEndian32(cursor->bytes + cursor->position);
+    cursor->position += 4;
+    return value;
+}
+
+static inline uint64_t DSByteCursorReadUInt64(DSByteCursor *cursor) {
+    if (!DSByteCursorHas(cursor, 8)) {
+        return 0;
+    }
+    uint64_t value = DSLoadBigEndian64(cursor->bytes + cursor->position);
+    cursor->position += 8;
+    return value;
+}
+
+// Codes and types stay packed, first character in the high byte
+static inline uint32_t DSByteCursorReadFourCharCode(DSByteCursor *cursor) {
+    return DSByteCursorReadUInt32(cursor);
+}
+
+// The next count bytes, in place; NULL if there are not that many
+static inline const uint8_t *DSByteCursorReadBytes(DSByteCursor *cursor, size_t count) {
+    if (!DSByteCursorHas(cursor, count)) {
+        return NULL;
+    }
+    const uint8_t *bytes = cursor->bytes + cursor->position;
+    cursor->position += count;
+    return bytes;
+}
+
+/*
+ * A new (retained) string from count UTF-16BE code units. Names are almost
+ * always ASCII, which is copied down to bytes; anything else is swapped
+ * into unichars. Neither goes through an NSData or an encoding converter.
+ */
+static inline NSString *DSCreateStringFromUTF16BigEndian(const uint8_t *bytes, size_t count) {
+    unichar stackBuffer[256];
+    size_t i;
+
+    if (count <= 256) {
+        char *ascii = (char *)stackBuffer;
+        for (i = 0; i < count && bytes[2 * i] == 0 && bytes[2 * i + 1] < 0x80; i++) {
+            ascii[i] = (char)bytes[2 * i + 1];
+        }
+        if (i == count) {
+            return [[NSString alloc] initWithBytes:ascii length:count encoding:NSASCIIStringEncoding];
+        }
+    }
+
+    unichar *characters = (count <= 256) ? stackBuffer : malloc(count * sizeof(unichar));
+    if (!characters) {
+        return nil;
+    }
+    for (i = 0; i < count; i++) {
+        characters[i] = DSLoadBigEndian16(bytes + 2 * i);
+    }
+    NSString *string = [[NSString alloc] initWithCharacters:characters length:count];
+    if (characters != stackBuffer) {
+        free(characters);
+    }
+    return string;
+}
@@ -20,9 +20,13 @@ extern "C" {
 {
     NSString *_filePath;
     DSBuddyAllocator *_allocator;
-    NSMutableArray *_entries;
+    NSMutableArray *_entries;       // In B-tree order
+    NSMutableDictionary *_index;    // Filename -> packed code (NSNumber) -> entry
     BOOL _isLoaded;
     BOOL _dirty;  // Track if changes were made
+    BOOL _readOnly;  // Mapped, lookups descend the B-tree
+    BOOL _lazy;      // Read-only and _entries not read yet
+    BOOL _savesAtomically;  // save writes the whole file and renames it into place
     
     // B-tree structure fields
     uint32_t _rootNode;
@@ -35,15 +39,32 @@ extern "C" {
 + (id)storeWithPath:(NSString *)path;
 + (id)createStoreAtPath:(NSString *)path withEntries:(NSArray *)entries;
 
+// A store that maps its file and never writes it. load reads only the
+// allocator header and the DSDB superblock; entryForFilename:code: descends
+// the B-tree and decodes just the record it finds, and its value only when
+// asked for. entries and the other whole-store methods read every record.
++ (id)readOnlyStoreWithPath:(NSString *)path;
+
 - (id)initWithPath:(NSString *)path;
+- (id)initWithPath:(NSString *)path readOnly:(BOOL)readOnly;
 
 - (NSString *)filePath;
+- (BOOL)isReadOnly;
 - (NSArray *)entries;
 
 - (BOOL)load;
 - (BOOL)save;
 
-// Internal methods
+// save writes only the blocks that changed, in place, and the root block if
+// any moved; a new file is written whole. With atomic saves every save
+// writes the whole file to a temporary and renames it over the old one.
+- (void)setSavesAtomically:(BOOL)atomically;
+- (BOOL)savesAtomically;
+
+// Bytes saves have written to the file since it was loaded or created
+- (unsigned long long)bytesWritten;
+
+// Internal methods; whether a node is a leaf is read from the node itself
 - (void)readBTreeNode:(DSBuddyBlock *)block address:(uint32_t)address isLeaf:(BOOL)isLeaf;
 
 - (DSStoreEntry *)entryForFilename:(NSString *)filename code:(NSString *)code;
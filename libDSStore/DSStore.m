@@ -8,6 +8,8 @@
 
 #import "DSStore.h"
 #import "DSStoreCodecs.h"
+#import "DSByteCursor.h"
+#include <string.h>
 
 // Byte order conversion macros for GNUstep
 #define CFSwapInt32BigToHost(x) NSSwapBigIntToHost(x)
@@ -16,12 +18,319 @@
 // Constants from .DS_Store format specification
 #define DSDB_MAGIC 0x44534442  // "DSDB"
 
-// Byte swapping functions
-static uint32_t swapBytes32(uint32_t x) {
-    return ((x & 0xFF000000) >> 24) | ((x & 0x00FF0000) >> 8) |
-           ((x & 0x0000FF00) << 8)  | ((x & 0x000000FF) << 24);
+// Deeper than any real tree; stops a corrupt file from looping
+#define DSStoreMaxTreeDepth 32
+
+#define DSFourCharCode(a, b, c, d) \
+    (((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 8) | (uint32_t)(d))
+
+enum {
+    DSTypeBool = DSFourCharCode('b', 'o', 'o', 'l'),
+    DSTypeLong = DSFourCharCode('l', 'o', 'n', 'g'),
+    DSTypeShor = DSFourCharCode('s', 'h', 'o', 'r'),
+    DSTypeType = DSFourCharCode('t', 'y', 'p', 'e'),
+    DSTypeComp = DSFourCharCode('c', 'o', 'm', 'p'),
+    DSTypeDutc = DSFourCharCode('d', 'u', 't', 'c'),
+    DSTypeUstr = DSFourCharCode('u', 's', 't', 'r')
+};
+
+// A B-tree record as it lies in a node; nothing in it is decoded
+typedef struct {
+    const uint8_t *filename;    // UTF-16BE
+    uint32_t filenameLength;    // In UTF-16 code units
+    uint32_t code;
+    uint32_t type;
+    const uint8_t *value;       // As stored, with its length prefix if it has one
+    size_t valueLength;
+} DSRecordRef;
+
+// Codes are compared and stored as four bytes, shorter ones padded with zeros
+static uint32_t fourCharCode(NSString *string) {
+    uint32_t code = 0;
+    NSUInteger length = [string length];
+    for (NSUInteger i = 0; i < 4; i++) {
+        unichar c = (i < length) ? [string characterAtIndex:i] : 0;
+        code = (code << 8) | (c < 0x80 ? c : 0);
+    }
+    return code;
+}
+
+// The per-filename index is keyed by the packed code
+static NSNumber *codeKey(NSString *code) {
+    return [NSNumber numberWithUnsignedInt:fourCharCode(code)];
+}
+
+static NSString *stringForFourCharCode(uint32_t code) {
+    uint8_t bytes[4] = { code >> 24, code >> 16, code >> 8, code };
+    return [[[NSString alloc] initWithBytes:bytes length:4 encoding:NSASCIIStringEncoding] autorelease];
+}
+
+// Loading a store turns the same few dozen codes and types into strings
+// over and over; each is made once and shared by the entries that have it
+#define DSFourCharCodeCacheSize 64
+
+typedef struct {
+    uint32_t codes[DSFourCharCodeCacheSize];
+    NSString *strings[DSFourCharCodeCacheSize];
+} DSFourCharCodeCache;
+
+static NSString *cachedStringForFourCharCode(DSFourCharCodeCache *cache, uint32_t code) {
+    if (!cache) {
+        return stringForFourCharCode(code);
+    }
+    
+    NSUInteger slot = (uint32_t)(code * 2654435761u) >> 26;
+    if (cache->strings[slot] && cache->codes[slot] == code) {
+        return cache->strings[slot];
+    }
+    NSString *string = stringForFourCharCode(code);
+    [cache->strings[slot] release];
+    cache->strings[slot] = [string retain];
+    cache->codes[slot] = code;
+    return string;
+}
+
+static void releaseFourCharCodeCache(DSFourCharCodeCache *cache) {
+    for (NSUInteger i = 0; i < DSFourCharCodeCacheSize; i++) {
+        [cache->strings[i] release];
+        cache->strings[i] = nil;
+    }
+}
+
+static NSString *recordFilename(const DSRecordRef *record) {
+    return [DSCreateStringFromUTF16BigEndian(record->filename, record->filenameLength) autorelease];
+}
+
+// Parses the record at the cursor and moves past it; NO if it runs off the node
+static BOOL parseRecord(DSByteCursor *cursor, DSRecordRef *record) {
+    uint32_t filenameLength = DSByteCursorReadUInt32(cursor);
+    if (filenameLength > cursor->length / 2) {
+        return NO;
+    }
+    record->filename = DSByteCursorReadBytes(cursor, 2 * (size_t)filenameLength);
+    record->filenameLength = filenameLength;
+    record->code = DSByteCursorReadFourCharCode(cursor);
+    record->type = DSByteCursorReadFourCharCode(cursor);
+    if (cursor->overrun) {
+        return NO;
+    }
+    
+    // Where a value's length is stored, it is peeked at and read with the value
+    size_t valueLength;
+    switch (record->type) {
+        case DSTypeBool:
+            valueLength = 1;
+            break;
+        case DSTypeLong:
+        case DSTypeShor:
+        case DSTypeType:
+            valueLength = 4;
+            break;
+        case DSTypeComp:
+        case DSTypeDutc:
+            valueLength = 8;
+            break;
+        case DSTypeUstr:
+            if (!DSByteCursorHas(cursor, 4)) {
+                return NO;
+            }
+            valueLength = 4 + 2 * (size_t)DSLoadBigEndian32(cursor->bytes + cursor->position);
+            break;
+        default:
+            // blob, and anything unknown is read as a blob
+            if (!DSByteCursorHas(cursor, 4)) {
+                return NO;
+            }
+            valueLength = 4 + (size_t)DSLoadBigEndian32(cursor->bytes + cursor->position);
+            break;
+    }
+    
+    record->value = DSByteCursorReadBytes(cursor, valueLength);
+    record->valueLength = valueLength;
+    return record->value != NULL;
+}
+
+// The B-tree order that save writes: filenames compared case-insensitively,
+// then codes. ASCII is folded in place; anything else goes through
+// lowercaseString, as -[DSStoreEntry compare:] does.
+static int compareRecordKey(NSString *filename, const unichar *name, NSUInteger nameLength,
+                            uint32_t code, const DSRecordRef *record) {
+    NSUInteger common = MIN(nameLength, (NSUInteger)record->filenameLength);
+    BOOL lengthDecides = YES;
+    
+    for (NSUInteger i = 0; i < common; i++) {
+        unichar a = name[i];
+        unichar b = (unichar)((record->filename[2 * i] << 8) | record->filename[2 * i + 1]);
+        if (a >= 0x80 || b >= 0x80) {
+            NSComparisonResult order = [[filename lowercaseString] compare:[recordFilename(record) lowercaseString]];
+            if (order != NSOrderedSame) {
+                return order == NSOrderedAscending ? -1 : 1;
+            }
+            lengthDecides = NO;
+            break;
+        }
+        if (a >= 'A' && a <= 'Z') {
+            a += 'a' - 'A';
+        }
+        if (b >= 'A' && b <= 'Z') {
+            b += 'a' - 'A';
+        }
+        if (a != b) {
+            return a < b ? -1 : 1;
+        }
+    }
+    
+    if (lengthDecides && nameLength != record->filenameLength) {
+        return nameLength < record->filenameLength ? -1 : 1;
+    }
+    if (code != record->code) {
+        return code < record->code ? -1 : 1;
+    }
+    return 0;
+}
+
+// entryForFilename:code: matches filenames exactly, not just in B-tree order
+static BOOL recordHasFilename(const DSRecordRef *record, const unichar *name, NSUInteger nameLength) {
+    if (record->filenameLength != nameLength) {
+        return NO;
+    }
+    for (NSUInteger i = 0; i < nameLength; i++) {
+        if (name[i] != (unichar)((record->filename[2 * i] << 8) | record->filename[2 * i + 1])) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+// save packs the B-tree into pages of this size, as Finder does
+#define DSStorePageSize 4096
+
+static void putBigEndian32(uint8_t *bytes, uint32_t value) {
+    bytes[0] = value >> 24;
+    bytes[1] = value >> 16;
+    bytes[2] = value >> 8;
+    bytes[3] = value;
+}
+
+static void appendBigEndian32(NSMutableData *data, uint32_t value) {
+    uint8_t bytes[4];
+    putBigEndian32(bytes, value);
+    [data appendBytes:bytes length:4];
+}
+
+// A node gets a page, or the smallest power of two holding one huge record
+static uint32_t blockShiftForLength(NSUInteger length) {
+    uint32_t shift = 12;
+    while (((NSUInteger)1 << shift) < length) {
+        shift++;
+    }
+    return shift;
+}
+
+// The pages a save makes, and the block each one goes to
+typedef struct {
+    NSMutableArray *pages;          // NSData, in the order they were made
+    NSMutableData *blockNumbers;    // uint32_t for each page
+    NSMutableArray *reuse;          // Old internal nodes' blocks, handed out first
+    uint32_t nextBlock;             // Next number past the offset table
+} DSPageSet;
+
+static uint32_t addPage(DSPageSet *set, NSMutableData *page, uint32_t rightmost, NSUInteger count,
+                        uint32_t blockNumber) {
+    putBigEndian32([page mutableBytes], rightmost);
+    putBigEndian32((uint8_t *)[page mutableBytes] + 4, (uint32_t)count);
+    [set->pages addObject:page];
+    [set->blockNumbers appendBytes:&blockNumber length:4];
+    return blockNumber;
+}
+
+// The one place a save takes a block for a new page, leaf or internal, so
+// no two pages can be given the same number
+static uint32_t takeBlockNumber(DSPageSet *set) {
+    if ([set->reuse count] > 0) {
+        uint32_t blockNumber = [[set->reuse objectAtIndex:0] unsignedIntValue];
+        [set->reuse removeObjectAtIndex:0];
+        return blockNumber;
+    }
+    return set->nextBlock++;
 }
 
+/*
+ * Packs one level of the tree into full pages. records[i] sorts between
+ * children[i] and children[i + 1]; children is NULL for the leaf level. The
+ * record that does not fit in a page moves up to separate it from the next,
+ * and the level above is built from those separators and the blocks the
+ * new pages were given.
+ */
+static void packLevel(NSArray *records, const uint32_t *children, DSPageSet *set,
+                      NSMutableArray *upRecords, uint32_t *upChildren) {
+    NSUInteger count = [records count];
+    NSUInteger i = 0;
+    NSUInteger pages = 0;
+    
+    for (;;) {
+        NSMutableData *node = [NSMutableData dataWithLength:8];
+        NSUInteger inNode = 0;
+        NSUInteger lastStart = 0;
+        
+        while (i < count) {
+            NSData *record = [records objectAtIndex:i];
+            NSUInteger need = [record length] + (children ? 4 : 0);
+            if ([node length] + need > DSStorePageSize && inNode > 0) {
+                break;
+            }
+            lastStart = [node length];
+            if (children) {
+                appendBigEndian32(node, children[i]);
+            }
+            [node appendData:record];
+            inNode++;
+            i++;
+        }
+        
+        // A lone last record would leave the next page empty; move one back
+        if (i + 1 == count && inNode > 1) {
+            [node setLength:lastStart];
+            inNode--;
+            i--;
+        }
+        
+        upChildren[pages++] = addPage(set, node, children ? children[i] : 0, inNode, takeBlockNumber(set));
+        
+        if (i >= count) {
+            break;
+        }
+        [upRecords addObject:[records objectAtIndex:i++]];
+    }
+}
+
+@interface DSStore (Private)
+- (BOOL)loadMapped;
+- (BOOL)getNode:(uint32_t)blockNumber bytes:(const uint8_t **)bytes length:(size_t *)length;
+- (DSStoreEntry *)entryForRecord:(const DSRecordRef *)record filename:(NSString *)filename
+                           codes:(DSFourCharCodeCache *)codes;
+- (DSStoreEntry *)lookupFilename:(NSString *)filename code:(NSString *)code;
+- (void)collectEntriesInNode:(uint32_t)blockNumber depth:(int)depth codes:(DSFourCharCodeCache *)codes;
+- (void)collectEntriesFromNode:(const uint8_t *)node length:(size_t)length number:(uint32_t)blockNumber
+                         depth:(int)depth codes:(DSFourCharCodeCache *)codes;
+- (void)faultInEntries;
+- (BOOL)refuseReadOnlyChange;
+- (void)rebuildIndex;
+- (NSUInteger)sortedPositionOfEntry:(DSStoreEntry *)entry;
+- (void)indexEntry:(DSStoreEntry *)entry;
+- (void)unindexEntry:(DSStoreEntry *)entry;
+- (BOOL)getLayoutLeaves:(NSMutableArray *)leaves bounds:(NSMutableArray *)bounds
+         internalNodes:(NSMutableArray *)internal dsdbBlock:(uint32_t)dsdbBlock;
+- (BOOL)collectLayoutOfNode:(uint32_t)blockNumber depth:(int)depth leaves:(NSMutableArray *)leaves
+                     bounds:(NSMutableArray *)bounds levels:(NSMutableArray *)levels;
+- (void)packLeaves:(NSArray *)records into:(DSPageSet *)set oldLeaves:(NSArray *)leaves
+            bounds:(NSArray *)bounds separators:(NSMutableArray *)upRecords
+          children:(uint32_t *)upChildren released:(NSMutableArray *)released;
+- (NSUInteger)packNodes:(DSPageSet *)set levels:(uint32_t *)levels oldLeaves:(NSArray *)leaves
+                 bounds:(NSArray *)bounds released:(NSMutableArray *)released;
+- (BOOL)writeBlock:(uint32_t)blockNumber size:(NSUInteger)size bytes:(NSData *)bytes;
+@end
+
 @implementation DSStore
 
 + (id)storeWithPath:(NSString *)path {
@@ -37,18 +346,31 @@ static uint32_t swapBytes32(uint32_t x) {
     // Initialize with provided entries
     if (entries) {
         [store->_entries addObjectsFromArray:entries];
+        [store rebuildIndex];
     }
     
     store->_isLoaded = YES;
     return store;
 }
 
++ (id)readOnlyStoreWithPath:(NSString *)path {
+    return [[[self alloc] initWithPath:path readOnly:YES] autorelease];
+}
+
 - (id)initWithPath:(NSString *)path {
+    return [self initWithPath:path readOnly:NO];
+}
+
+- (id)initWithPath:(NSString *)path readOnly:(BOOL)readOnly {
     if ((self = [super init])) {
         _filePath = [path copy];
         _allocator = nil;
         _entries = [[NSMutableArray alloc] init];
+        _index = [[NSMutableDictionary alloc] init];
         _isLoaded = NO;
+        _readOnly = readOnly;
+        _lazy = NO;
+        _savesAtomically = NO;
     }
     return self;
 }
@@ -57,6 +379,7 @@ static uint32_t swapBytes32(uint32_t x) {
     [_filePath release];
     [_allocator release];
     [_entries release];
+    [_index release];
     [super dealloc];
 }
 
@@ -64,15 +387,25 @@ static uint32_t swapBytes32(uint32_t x) {
     return _filePath;
 }
 
+- (BOOL)isReadOnly {
+    return _readOnly;
+}
+
 - (NSArray *)entries {
     if (!_isLoaded) {
         [self load];
     }
+    [self faultInEntries];
     return [NSArray arrayWithArray:_entries];
 }
 
 - (BOOL)load {
+    if (_readOnly) {
+        return [self loadMapped];
+    }
+    
     // Initialize buddy allocator
+    [_allocator release];
     _allocator = [[DSBuddyAllocator alloc] initWithFile:_filePath];
     if (![_allocator open]) {
         return NO;
@@ -84,537 +417,232 @@ static uint32_t swapBytes32(uint32_t x) {
         return NO;
     }
     
-    // Read buddy allocator header (first 32 bytes)
-    DSBuddyBlock *headerBlock = [_allocator blockAtOffset:0 size:32];
-    if (!headerBlock) {
-        return NO;
-    }
-    
-    // Check buddy allocator magic
-    uint32_t magic1 = [headerBlock readUInt32];
-    uint32_t magic2 = [headerBlock readUInt32];
-    
-    if (magic1 != 0x00000001 || magic2 != 0x42756431) { // "Bud1"
-        [headerBlock close];
-        return NO;
-    }
-    
-    // Read offset and size of root block
-    uint32_t rootOffset = [headerBlock readUInt32];
-    uint32_t rootSize = [headerBlock readUInt32];
-    uint32_t rootOffset2 __attribute__((unused)) = [headerBlock readUInt32]; // Duplicate
-    
-    [headerBlock close];
-    
-    // Validate offsets
-    if (rootOffset >= fileSize || rootOffset + rootSize > fileSize) {
-        return NO;
-    }
-    
-    // Read root block (contains buddy allocator metadata)
-    // NOTE: Reference library skips first 4 bytes of root block
-    DSBuddyBlock *rootBlock = [_allocator blockAtOffset:rootOffset + 4 size:rootSize - 4];
-    if (!rootBlock) {
-        return NO;
-    }
-    
-    // Read block offsets count and unknown value
-    uint32_t offsetCount = [rootBlock readUInt32];
-    uint32_t unknown2 __attribute__((unused)) = [rootBlock readUInt32];
-    
-    NSLog(@"Root block: offsetCount=%u, unknown=%u", offsetCount, unknown2);
-    
-    // Read offset table (always 256 entries, padded with zeros)
-    NSMutableArray *offsets = [NSMutableArray arrayWithCapacity:offsetCount];
-    for (uint32_t i = 0; i < 256; i++) {
-        uint32_t offset = [rootBlock readUInt32];
-        if (i < offsetCount) {
-            [offsets addObject:[NSNumber numberWithUnsignedInt:offset]];
-            NSLog(@"Offset[%u]: 0x%08x", i, offset);
-        }
-    }
-    
-    // Read TOC count
-    uint32_t tocCount = [rootBlock readUInt32];
-    NSLog(@"TOC count: %u", tocCount);
-    
-    // Parse ALL directory entries robustly (not just DSDB)
-    NSMutableDictionary *directoryEntries = [NSMutableDictionary dictionaryWithCapacity:tocCount];
-    for (uint32_t i = 0; i < tocCount; i++) {
-        uint8_t nameLen = [rootBlock readUInt8];
-        NSData *nameData = [rootBlock readBytes:nameLen];
-        uint32_t blockNum = [rootBlock readUInt32];
-        
-        NSString *name = [[NSString alloc] initWithData:nameData encoding:NSASCIIStringEncoding];
-        NSLog(@"TOC[%u]: name='%@' -> block %u", i, name, blockNum);
-        
-        // Store ALL directory entries for future extensibility
-        [directoryEntries setObject:[NSNumber numberWithUnsignedInt:blockNum] forKey:name];
-        [name release];
-    }
-    
-    [rootBlock close];
-    
-    // Look for DSDB directory entry (robust approach)
-    NSNumber *dsdbBlockNumObj = [directoryEntries objectForKey:@"DSDB"];
-    if (!dsdbBlockNumObj) {
+    // The allocator checks the "Bud1" header and finds the offset table and
+    // table of contents in its root block
+    uint32_t dsdbBlockNum;
+    if (![_allocator getBlockNumber:&dsdbBlockNum forDirectory:@"DSDB"]) {
         NSLog(@"DSDB directory not found in TOC");
         return NO;
     }
     
-    uint32_t dsdbBlockNum = [dsdbBlockNumObj unsignedIntValue];
-    if (dsdbBlockNum >= [offsets count]) {
-        NSLog(@"DSDB block number %u exceeds offset table size %lu", dsdbBlockNum, (unsigned long)[offsets count]);
+    uint32_t dsdbAddr;
+    if (![_allocator getAddress:&dsdbAddr ofBlock:dsdbBlockNum]) {
+        NSLog(@"DSDB block number %u exceeds offset table", dsdbBlockNum);
         return NO;
     }
-    
-    // Get DSDB block address from offset table
-    uint32_t dsdbAddr = [[offsets objectAtIndex:dsdbBlockNum] unsignedIntValue];
     uint32_t dsdbOffset = dsdbAddr & ~0x1F;  // Remove size bits
     uint32_t dsdbSize = 1 << (dsdbAddr & 0x1F);  // Extract size bits
     
     NSLog(@"DSDB block %u: addr=0x%08x, offset=0x%x, size=%u", dsdbBlockNum, dsdbAddr, dsdbOffset, dsdbSize);
     
-    // Read DSDB superblock (NOTE: +4 for reference library file offset correction)
-    DSBuddyBlock *dsdbBlock = [_allocator blockAtOffset:dsdbOffset + 4 size:dsdbSize];
-    if (!dsdbBlock) {
+    // Read DSDB superblock in place (NOTE: +4 for reference library file offset correction)
+    if ((NSUInteger)dsdbOffset + 4 + 20 > fileSize) {
         NSLog(@"Failed to read DSDB block at offset %u", dsdbOffset + 4);
         return NO;
     }
     
-    // Read DSDB superblock header (5 uint32_t values)
-    uint32_t rootAddress = [dsdbBlock readUInt32];
-    uint32_t levelsNumber = [dsdbBlock readUInt32];
-    uint32_t recordsNumber = [dsdbBlock readUInt32];
-    uint32_t nodesNumber = [dsdbBlock readUInt32];
-    uint32_t pageSize = [dsdbBlock readUInt32];
+    // Superblock: root node, levels, records, nodes, page size
+    const uint8_t *superblock = [_allocator bytes] + dsdbOffset + 4;
+    _rootNode = DSLoadBigEndian32(superblock);
+    _levels = DSLoadBigEndian32(superblock + 4);
+    _records = DSLoadBigEndian32(superblock + 8);
+    _nodes = DSLoadBigEndian32(superblock + 12);
+    _pageSize = DSLoadBigEndian32(superblock + 16);
     
     NSLog(@"DSDB: rootAddr=%u levels=%u records=%u nodes=%u pageSize=%u",
-          rootAddress, levelsNumber, recordsNumber, nodesNumber, pageSize);
+          _rootNode, _levels, _records, _nodes, _pageSize);
     
     [_entries removeAllObjects];
     
-    if (recordsNumber == 0) {
+    if (_records == 0) {
         NSLog(@"Empty B-tree");
-        [dsdbBlock close];
+        [self rebuildIndex];
         _isLoaded = YES;
         return YES;
     }
     
-    [dsdbBlock close];
-    
-    // The B-tree root address points to another block in the offset table
-    // If rootAddress >= offsetCount, it's likely an offset relative to DSDB block
-    if (rootAddress < [offsets count]) {
-        // Root address is a block number
-        uint32_t btreeAddr = [[offsets objectAtIndex:rootAddress] unsignedIntValue];
-        uint32_t btreeOffset = btreeAddr & ~0x1F;
-        uint32_t btreeSize = 1 << (btreeAddr & 0x1F);
-        
-        NSLog(@"B-tree block %u: addr=0x%08x, offset=0x%x, size=%u", rootAddress, btreeAddr, btreeOffset, btreeSize);
-        
-        // Read B-tree data (+4 for file offset correction)
-        DSBuddyBlock *btreeBlock = [_allocator blockAtOffset:btreeOffset + 4 size:btreeSize - 4];
-        if (!btreeBlock) {
+    // The B-tree root is normally a block number in the offset table
+    const uint8_t *node;
+    size_t length;
+    if (![self getNode:_rootNode bytes:&node length:&length]) {
+        // Otherwise it's likely an offset relative to the DSDB block
+        NSUInteger btreeOffset = dsdbOffset + 4 + _rootNode;
+        if (btreeOffset + 8 > fileSize) {
             NSLog(@"Failed to read B-tree block");
             return NO;
         }
         
-        @try {
-            [self readBTreeNode:btreeBlock address:0 isLeaf:(levelsNumber <= 1)];
-            _isLoaded = YES;
-            [btreeBlock close];
-            return YES;
-        }
-        @catch (NSException *exception) {
-            NSLog(@"Error parsing B-tree: %@", [exception description]);
-            [btreeBlock close];
-            return NO;
-        }
-    } else {
-        // Root address is relative to DSDB block
-        // Seek to rootAddress within DSDB block data 
-        NSUInteger btreeOffset = dsdbOffset + 4 + rootAddress;
-        NSUInteger btreeSize = pageSize;  // Use pageSize from DSDB
-        
-        NSLog(@"B-tree at relative offset %u (absolute 0x%lx), size=%lu", rootAddress, (unsigned long)btreeOffset, (unsigned long)btreeSize);
-        
-        // Read B-tree data
-        DSBuddyBlock *btreeBlock = [_allocator blockAtOffset:btreeOffset size:btreeSize - 4];
-        if (!btreeBlock) {
-            NSLog(@"Failed to read B-tree block at relative offset");
-            return NO;
-        }
-        
-        @try {
-            [self readBTreeNode:btreeBlock address:0 isLeaf:(levelsNumber <= 1)];
-            _isLoaded = YES;
-            [btreeBlock close];
-            return YES;
-        }
-        @catch (NSException *exception) {
-            NSLog(@"Error parsing B-tree: %@", [exception description]);
-            [btreeBlock close];
-            return NO;
-        }
+        NSLog(@"B-tree at relative offset %u (absolute 0x%lx)", _rootNode, (unsigned long)btreeOffset);
+        node = [_allocator bytes] + btreeOffset;
+        length = MIN((NSUInteger)_pageSize, fileSize - btreeOffset);
     }
+    
+    // Records are parsed where they lie; each code and type becomes a string once
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    DSFourCharCodeCache codes;
+    memset(&codes, 0, sizeof(codes));
+    [self collectEntriesFromNode:node length:length number:_rootNode depth:0 codes:&codes];
+    releaseFourCharCodeCache(&codes);
+    [self rebuildIndex];
+    [pool release];
+    
+    _isLoaded = YES;
+    return YES;
 }
 
 - (void)readBTreeNode:(DSBuddyBlock *)block address:(uint32_t)address isLeaf:(BOOL)isLeaf {
-    NSLog(@"Reading B-tree node at address 0x%x, isLeaf: %@", address, isLeaf ? @"YES" : @"NO");
-    
-    uint32_t nodeId = [block readUInt32];
-    uint32_t recordsCount = [block readUInt32];
-    
-    NSLog(@"Node ID: 0x%x, Records count: %u", nodeId, recordsCount);
-    
-    if (isLeaf) {
-        // Read leaf records (actual DS_Store entries)
-        for (uint32_t i = 0; i < recordsCount; i++) {
-            NSLog(@"Reading leaf record %u", i);
-            
-            uint32_t filenameLength = [block readUInt32];
-            if (filenameLength == 0 || filenameLength > 1024) {
-                NSLog(@"Invalid filename length: %u", filenameLength);
-                break;
-            }
-            
-            NSData *unicodeData = [block readBytes:filenameLength * 2];
-            NSString *filename = [[NSString alloc] initWithData:unicodeData encoding:NSUTF16BigEndianStringEncoding];
-            
-            // Read code (4 bytes ASCII)
-            NSData *codeData = [block readBytes:4];
-            NSString *code = [[NSString alloc] initWithData:codeData encoding:NSASCIIStringEncoding];
-            
-            // Read type (4 bytes ASCII)  
-            NSData *typeData = [block readBytes:4];
-            NSString *type = [[NSString alloc] initWithData:typeData encoding:NSASCIIStringEncoding];
-            
-            NSLog(@"Entry: filename='%@', code='%@', type='%@'", filename, code, type);
-            
-            // Read value based on type
-            id value = nil;
-            if ([type isEqualToString:@"bool"]) {
-                uint8_t boolVal = [block readUInt8];
-                value = [NSNumber numberWithBool:(boolVal != 0)];
-            } else if ([type isEqualToString:@"long"]) {
-                uint32_t intVal = [block readUInt32];
-                value = [NSNumber numberWithUnsignedInt:intVal];
-            } else if ([type isEqualToString:@"shor"]) {
-                uint16_t shortVal = [block readUInt16];
-                value = [NSNumber numberWithUnsignedShort:shortVal];
-            } else if ([type isEqualToString:@"blob"]) {
-                uint32_t blobLen = [block readUInt32];
-                if (blobLen > 0 && blobLen < 65536) {
-                    value = [block readBytes:blobLen];
-                }
-            } else if ([type isEqualToString:@"ustr"]) {
-                uint32_t strLen = [block readUInt32];
-                if (strLen > 0 && strLen < 1024) {
-                    NSData *strData = [block readBytes:strLen * 2];
-                    value = [[NSString alloc] initWithData:strData encoding:NSUTF16BigEndianStringEncoding];
-                }
-            } else if ([type isEqualToString:@"type"]) {
-                NSData *typeValue = [block readBytes:4];
-                value = [[NSString alloc] initWithData:typeValue encoding:NSASCIIStringEncoding];
-            } else if ([type isEqualToString:@"comp"]) {
-                uint64_t longVal = [block readUInt64];
-                value = [NSNumber numberWithUnsignedLongLong:longVal];
-            } else if ([type isEqualToString:@"dutc"]) {
-                uint64_t longVal = [block readUInt64];
-                value = [NSNumber numberWithUnsignedLongLong:longVal];
-            } else {
-                // Unknown type - try to read as blob
-                uint32_t valueLen = [block readUInt32];
-                if (valueLen > 0 && valueLen < 65536) {
-                    value = [block readBytes:valueLen];
-                }
-            }
-            
-            DSStoreEntry *entry = [[DSStoreEntry alloc] initWithFilename:filename
-                                                                     code:code
-                                                                     type:type
-                                                                    value:value];
-            if (entry) {
-                [_entries addObject:entry];
-                [entry release];
-            }
-            [filename release];
-            [code release];
-            [type release];
-            if ([type isEqualToString:@"ustr"] || [type isEqualToString:@"type"]) {
-                [value release];
-            }
-        }
-    } else {
-        // Read internal node pointers
-        for (uint32_t i = 0; i < recordsCount; i++) {
-            NSLog(@"Reading internal record %u", i);
-            
-            uint32_t childAddress = [block readUInt32];
-            uint32_t filenameLength = [block readUInt32];
-            
-            if (filenameLength > 0 && filenameLength < 1024) {
-                NSData *unicodeData = [block readBytes:filenameLength * 2];
-                // Skip the filename for internal nodes
-            }
-            
-            // Recursively read child node
-            if (childAddress != 0) {
-                NSLog(@"Following child pointer to address 0x%x", childAddress);
-                
-                // Decode child address
-                uint32_t childOffset = childAddress & ~0x1F;
-                uint32_t childSizeBits = childAddress & 0x1F;
-                uint32_t childSize = 1 << childSizeBits;
-                
-                DSBuddyBlock *childBlock = [_allocator blockAtOffset:childOffset size:childSize];
-                if (childBlock) {
-                    [self readBTreeNode:childBlock address:childOffset isLeaf:YES]; // Assume next level is leaf for now
-                    [childBlock close];
-                }
-            }
-        }
-    }
+    // The rest of the block, parsed where it lies
+    const uint8_t *bytes = [block bytes];
+    if (!bytes) {
+        return;
+    }
+    NSUInteger position = [block tell];
+    DSFourCharCodeCache codes;
+    memset(&codes, 0, sizeof(codes));
+    [self collectEntriesFromNode:bytes + position length:[block size] - position number:address depth:0 codes:&codes];
+    releaseFourCharCodeCache(&codes);
+    [block seek:0 whence:2];
 }
 
 - (BOOL)save {
+    if ([self refuseReadOnlyChange]) {
+        return NO;
+    }
+    
     if (!_isLoaded) {
         NSLog(@"Cannot save unloaded store");
         return NO;
     }
     
-    NSMutableData *fileData = [NSMutableData data];
-    
-    // Write the buddy allocator header
-    struct {
-        uint32_t magic1;        // 1
-        uint32_t magic2;        // "Bud1"
-        uint32_t rootOffset;    // 2048
-        uint32_t headerSize;    // 1264  
-        uint32_t rootOffset2;   // 2048 (duplicate)
-        uint32_t padding[4];    // Padding to align
-    } header;
-    
-    header.magic1 = swapBytes32(1);
-    header.magic2 = swapBytes32(0x42756431);  // "Bud1"
-    header.rootOffset = swapBytes32(2048);
-    header.headerSize = swapBytes32(2048);  // Changed to 2048
-    header.rootOffset2 = swapBytes32(2048);
-    // Write padding values directly as they appear in reference file
-    header.padding[0] = 0x0C100000;  // Will be stored as: 00 00 10 0c
-    header.padding[1] = 0x87000000;  // Will be stored as: 00 00 00 87  
-    header.padding[2] = 0x0B200000;  // Will be stored as: 00 00 20 0b
-    header.padding[3] = 0;
-    
-    [fileData appendBytes:&header length:sizeof(header)];
-    
-    // Pad to 2048 bytes for root block
-    NSUInteger paddingSize = 2048 - [fileData length];
-    char *padding = calloc(paddingSize, 1);
-    [fileData appendBytes:padding length:paddingSize];
-    free(padding);
-    
-    // Write root block (buddy allocator metadata) 
-    // NOTE: The reference library skips the first 4 bytes of the root block!
-    // So we need to write 4 dummy bytes first
-    uint32_t dummy = 0;
-    [fileData appendBytes:&dummy length:4];
-    
-    // Now write the actual root block content that reference library will read
-    // Match reference implementation structure exactly:
-    // - offset count (3) - like reference
-    // - unknown (varies) 
-    // - offset entries (3 real entries + 253 padding)
-    // - ToC count (1 for DSDB)
-    // - ToC entry: "DSDB" -> block number 1
-    // - Free lists (32 entries with counts + offsets)
-    
-    uint32_t offsetCount = swapBytes32(3);  // Like reference - 3 allocated blocks
-    uint32_t unknown = swapBytes32(0);      
-    
-    // Block addresses like reference:
-    // Block 0: 0x80b (offset=0x800, size=2048) - root block
-    // Block 1: 0x25 (offset=0x20, size=32) - DSDB superblock  
-    // Block 2: 0x200d (offset=0x2000, size=8192) - B-tree data
-    uint32_t rootBlockAddr = 0x800 | 11;  // 2048 = 2^11
-    uint32_t dsdbBlockAddr = 0x20 | 5;    // 32 = 2^5  
-    uint32_t btreeBlockAddr = 0x2000 | 13; // 8192 = 2^13
-    
-    [fileData appendBytes:&offsetCount length:4];
-    [fileData appendBytes:&unknown length:4];
-    
-    // 3 real offset entries + 253 zeros
-    uint32_t offset0 = swapBytes32(rootBlockAddr);
-    uint32_t offset1 = swapBytes32(dsdbBlockAddr);
-    uint32_t offset2 = swapBytes32(btreeBlockAddr);
-    [fileData appendBytes:&offset0 length:4];
-    [fileData appendBytes:&offset1 length:4];
-    [fileData appendBytes:&offset2 length:4];
-    
-    // 253 padding entries
-    for (int i = 3; i < 256; i++) {
-        uint32_t zero = 0;
-        [fileData appendBytes:&zero length:4];
-    }
-    
-    // ToC: 1 entry for DSDB
-    uint32_t tocCount = swapBytes32(1);
-    [fileData appendBytes:&tocCount length:4];
-    
-    // ToC entry: length (4) + "DSDB" + block_number (1 - like reference)
-    uint8_t nameLen = 4;
-    [fileData appendBytes:&nameLen length:1];
-    [fileData appendBytes:"DSDB" length:4];
-    uint32_t dsdbBlockNum = swapBytes32(1); // Block 1 like reference
-    [fileData appendBytes:&dsdbBlockNum length:4];
-    
-    // Free lists (32 entries matching reference pattern)
-    // Reference has specific pattern for buddy allocator
-    for (int i = 0; i < 5; i++) {
-        uint32_t freeCount = 0;
-        [fileData appendBytes:&freeCount length:4];
-    }
-    // Free blocks of various sizes
-    for (int i = 5; i < 31; i++) {
-        uint32_t freeCount = swapBytes32(1);
-        [fileData appendBytes:&freeCount length:4];
-        uint32_t freeOffset = swapBytes32(1 << i);
-        [fileData appendBytes:&freeOffset length:4];
-    }
-    // Last entry
-    uint32_t freeCount = 0;
-    [fileData appendBytes:&freeCount length:4];
-    
-    // Pad to end of root block (2048 bytes total)
-    NSUInteger currentSize = [fileData length] - 2048;
-    if (currentSize < 2048) {
-        NSUInteger remaining = 2048 - currentSize;
-        char *rootPadding = calloc(remaining, 1);
-        [fileData appendBytes:rootPadding length:remaining];
-        free(rootPadding);
-    }
-    
-    // Rewind to write DSDB block at offset 0x20 (before root block!)
-    NSUInteger dsdbStart = 0x20;
-    NSMutableData *tempData = [NSMutableData dataWithData:fileData];
-    
-    // Create DSDB superblock (32 bytes at offset 0x20)
-    uint32_t btreeRoot = swapBytes32(2);   // B-tree is in block 2 (not offset 20!)
-    uint32_t levels = swapBytes32(1);      // Single level (leaf only)
-    uint32_t records = swapBytes32([_entries count]);
-    uint32_t nodes = swapBytes32(1);       // Single node
-    uint32_t pageSize = swapBytes32(4096);
-    
-    // Insert DSDB block data at position 0x24 (like reference file with +4 offset)
-    NSMutableData *dsdbData = [NSMutableData data];
-    [dsdbData appendBytes:&btreeRoot length:4];
-    [dsdbData appendBytes:&levels length:4];
-    [dsdbData appendBytes:&records length:4];
-    [dsdbData appendBytes:&nodes length:4];
-    [dsdbData appendBytes:&pageSize length:4];
-    
-    // Pad DSDB block to 32 bytes
-    while ([dsdbData length] < 32) {
-        char zero = 0;
-        [dsdbData appendBytes:&zero length:1];
-    }
-    
-    // Replace data at position 0x24 (0x20 + 4 offset)
-    [tempData replaceBytesInRange:NSMakeRange(dsdbStart + 4, 32) withBytes:[dsdbData bytes] length:32];
-    fileData = tempData;
-    
-    // Pad to B-tree block start (0x2000)
-    NSUInteger btreeStart = 0x2000;
-    while ([fileData length] < btreeStart) {
-        char zero = 0;
-        [fileData appendBytes:&zero length:1];
-    }
-    
-    // Write 4 dummy bytes first (for reference format compatibility)
-    uint32_t btreeDummy = 0;
-    [fileData appendBytes:&btreeDummy length:4];
-    
-    // Write B-tree leaf node at 0x2000+4
-    uint32_t nodeType = swapBytes32(0);              // Leaf node (big-endian)
-    uint32_t entryCount = [_entries count];
-    uint32_t recordCount = swapBytes32(entryCount);  // Convert to big-endian
-    
-    NSLog(@"DEBUG SAVE: Writing %u entries, swapped recordCount=0x%08x", entryCount, recordCount);
-    
-    [fileData appendBytes:&nodeType length:4];
-    [fileData appendBytes:&recordCount length:4];
-    
-    // Sort entries as required by .DS_Store format
-    NSArray *sortedEntries = [_entries sortedArrayUsingSelector:@selector(compare:)];
-    
-    // Write entries
-    for (DSStoreEntry *entry in sortedEntries) {
-        NSData *entryData = [entry encode];
-        if (entryData) {
-            [fileData appendData:entryData];
+    uint32_t dsdbBlock = 1;
+    NSMutableArray *leaves = [NSMutableArray array];
+    NSMutableArray *bounds = [NSMutableArray array];
+    NSMutableArray *internal = [NSMutableArray array];
+    
+    if (!_allocator) {
+        // A new file: block 0 is the root block and block 1 the DSDB superblock
+        _allocator = [[DSBuddyAllocator alloc] initWithFile:_filePath];
+        [_allocator resetToEmptyFile];
+        if (![_allocator allocateBlock:0 size:2048] || ![_allocator allocateBlock:dsdbBlock size:32]) {
+            return NO;
+        }
+        [_allocator setBlockNumber:dsdbBlock forDirectory:@"DSDB"];
+    } else if (![_allocator getBlockNumber:&dsdbBlock forDirectory:@"DSDB"]) {
+        NSLog(@"DSStore: No DSDB directory in %@", _filePath);
+        return NO;
+    } else if (![self getLayoutLeaves:leaves bounds:bounds internalNodes:internal dsdbBlock:dsdbBlock]) {
+        // Its blocks stay allocated; nothing is lost but the space
+        NSLog(@"DSStore: Cannot follow the B-tree of %@, writing a new one beside it", _filePath);
+    }
+    
+    // The new tree takes the old one's blocks: each leaf keeps the range of
+    // records it had, so unchanged ranges come out as the same pages
+    DSPageSet set;
+    set.pages = [NSMutableArray array];
+    set.blockNumbers = [NSMutableData data];
+    set.reuse = internal;
+    set.nextBlock = [_allocator blockCount];
+    NSMutableArray *released = [NSMutableArray array];
+    uint32_t levels = 0;
+    NSUInteger rootIndex = [self packNodes:&set levels:&levels oldLeaves:leaves bounds:bounds released:released];
+    [released addObjectsFromArray:set.reuse];
+    
+    // Free what the new tree no longer uses first, so its pages can go there
+    for (NSNumber *blockNumber in released) {
+        [_allocator releaseBlock:[blockNumber unsignedIntValue]];
+    }
+    
+    const uint32_t *blockNumbers = [set.blockNumbers bytes];
+    NSUInteger nodeCount = [set.pages count];
+    for (NSUInteger i = 0; i < nodeCount; i++) {
+        NSData *page = [set.pages objectAtIndex:i];
+        if (![self writeBlock:blockNumbers[i] size:(NSUInteger)1 << blockShiftForLength([page length]) bytes:page]) {
+            return NO;
         }
     }
     
-    // Pad to full B-tree block size (8192 bytes from 0x2000)
-    NSUInteger fullBtreeEnd = 0x2000 + 8192;
-    while ([fileData length] < fullBtreeEnd) {
-        char zero = 0;
-        [fileData appendBytes:&zero length:1];
+    // DSDB superblock: root node, levels, records, nodes, page size
+    uint8_t superblock[20];
+    putBigEndian32(superblock, blockNumbers[rootIndex]);
+    putBigEndian32(superblock + 4, levels);
+    putBigEndian32(superblock + 8, (uint32_t)[_entries count]);
+    putBigEndian32(superblock + 12, (uint32_t)nodeCount);
+    putBigEndian32(superblock + 16, DSStorePageSize);
+    if (![self writeBlock:dsdbBlock size:32 bytes:[NSData dataWithBytes:superblock length:sizeof(superblock)]]) {
+        return NO;
     }
     
-    // Write to file
-    NSError *error = nil;
-    BOOL success = [fileData writeToFile:_filePath 
-                                 options:NSDataWritingAtomic 
-                                   error:&error];
-    
-    if (!success) {
-        NSLog(@"Failed to write .DS_Store file: %@", [error localizedDescription]);
+    if (![_allocator flushAtomically:_savesAtomically]) {
+        NSLog(@"Failed to write .DS_Store file: %@", _filePath);
         return NO;
     }
     
-    NSLog(@"Saved .DS_Store file: %@ (%lu bytes)", _filePath, (unsigned long)[fileData length]);
+    _rootNode = blockNumbers[rootIndex];
+    _levels = levels;
+    _records = (uint32_t)[_entries count];
+    _nodes = (uint32_t)nodeCount;
+    _pageSize = DSStorePageSize;
+    
+    NSLog(@"Saved .DS_Store file: %@ (%u records in %u nodes, %u levels)", _filePath, _records, _nodes, _levels);
     return YES;
 }
 
+- (void)setSavesAtomically:(BOOL)atomically {
+    _savesAtomically = atomically;
+}
+
+- (BOOL)savesAtomically {
+    return _savesAtomically;
+}
+
+- (unsigned long long)bytesWritten {
+    return [_allocator bytesWritten];
+}
+
 - (DSStoreEntry *)entryForFilename:(NSString *)filename code:(NSString *)code {
     if (!_isLoaded) {
         [self load];
     }
     
-    for (DSStoreEntry *entry in _entries) {
-        if ([[entry filename] isEqualToString:filename] && 
-            [[entry code] isEqualToString:code]) {
-            return entry;
-        }
+    if (_lazy) {
+        return [self lookupFilename:filename code:code];
     }
-    return nil;
+    
+    return [[_index objectForKey:filename] objectForKey:codeKey(code)];
 }
 
 - (void)setEntry:(DSStoreEntry *)entry {
+    if ([self refuseReadOnlyChange]) {
+        return;
+    }
+    
     if (!_isLoaded) {
         [self load];
     }
     
-    // Remove existing entry with same filename and code
+    // Replace existing entry with same filename and code
     DSStoreEntry *existing = [self entryForFilename:[entry filename] code:[entry code]];
-    if (existing) {
-        [_entries removeObject:existing];
+    if (existing != entry) {
+        if (existing) {
+            [self unindexEntry:existing];
+        }
+        [self indexEntry:entry];
     }
-    
-    [_entries addObject:entry];
     _dirty = YES;  // Mark as modified
 }
 
 - (void)removeEntryForFilename:(NSString *)filename code:(NSString *)code {
+    if ([self refuseReadOnlyChange]) {
+        return;
+    }
+    
     if (!_isLoaded) {
         [self load];
     }
     
     DSStoreEntry *entry = [self entryForFilename:filename code:code];
     if (entry) {
-        [_entries removeObject:entry];
+        [self unindexEntry:entry];
         _dirty = YES;  // Mark as modified
     }
 }
@@ -912,37 +940,30 @@ static uint32_t swapBytes32(uint32_t x) {
 }
 
 - (void)removeAllEntriesForFilename:(NSString *)filename {
-    NSMutableArray *toRemove = [NSMutableArray array];
-    
-    for (DSStoreEntry *entry in _entries) {
-        if ([[entry filename] isEqualToString:filename]) {
-            [toRemove addObject:entry];
-        }
+    if ([self refuseReadOnlyChange]) {
+        return;
     }
     
+    NSArray *toRemove = [[_index objectForKey:filename] allValues];
+    
     for (DSStoreEntry *entry in toRemove) {
-        [_entries removeObject:entry];
+        [self unindexEntry:entry];
         _dirty = YES;
     }
 }
 
 - (NSArray *)allFilenames {
-    NSMutableSet *filenames = [NSMutableSet set];
-    
-    for (DSStoreEntry *entry in _entries) {
-        [filenames addObject:[entry filename]];
-    }
-    
-    return [filenames allObjects];
+    [self faultInEntries];
+    return [_index allKeys];
 }
 
 - (NSArray *)allCodesForFilename:(NSString *)filename {
     NSMutableArray *codes = [NSMutableArray array];
+    [self faultInEntries];
     
-    for (DSStoreEntry *entry in _entries) {
-        if ([[entry filename] isEqualToString:filename]) {
-            [codes addObject:[entry code]];
-        }
+    NSArray *entries = [[[_index objectForKey:filename] allValues] sortedArrayUsingSelector:@selector(compare:)];
+    for (DSStoreEntry *entry in entries) {
+        [codes addObject:[entry code]];
     }
     
     return codes;
@@ -954,3 +975,482 @@ static uint32_t swapBytes32(uint32_t x) {
 }
 
 @end
+
+@implementation DSStore (Private)
+
+- (BOOL)loadMapped {
+    [_allocator release];
+    _allocator = [[DSBuddyAllocator alloc] initReadOnlyWithFile:_filePath];
+    if (![_allocator open]) {
+        return NO;
+    }
+    
+    uint32_t dsdbBlock;
+    uint32_t dsdbAddress;
+    if (![_allocator getBlockNumber:&dsdbBlock forDirectory:@"DSDB"] ||
+        ![_allocator getAddress:&dsdbAddress ofBlock:dsdbBlock]) {
+        NSLog(@"DSStore: No DSDB directory in %@", _filePath);
+        return NO;
+    }
+    
+    // Superblock: root node, levels, records, nodes, page size
+    NSUInteger dsdbOffset = (dsdbAddress & ~0x1F) + 4;
+    if (dsdbOffset + 20 > [_allocator fileSize]) {
+        NSLog(@"DSStore: DSDB superblock of %@ lies outside the file", _filePath);
+        return NO;
+    }
+    const uint8_t *superblock = [_allocator bytes] + dsdbOffset;
+    _rootNode = DSLoadBigEndian32(superblock);
+    _levels = DSLoadBigEndian32(superblock + 4);
+    _records = DSLoadBigEndian32(superblock + 8);
+    _nodes = DSLoadBigEndian32(superblock + 12);
+    _pageSize = DSLoadBigEndian32(superblock + 16);
+    
+    [_entries removeAllObjects];
+    _lazy = YES;
+    _isLoaded = YES;
+    return YES;
+}
+
+- (BOOL)getNode:(uint32_t)blockNumber bytes:(const uint8_t **)bytes length:(size_t *)length {
+    uint32_t address;
+    if (![_allocator getAddress:&address ofBlock:blockNumber]) {
+        return NO;
+    }
+    
+    NSUInteger offset = (address & ~0x1F) + 4;
+    NSUInteger size = (NSUInteger)1 << (address & 0x1F);
+    NSUInteger fileSize = [_allocator fileSize];
+    if (offset + 8 > fileSize) {
+        return NO;
+    }
+    
+    // The block's last four bytes lie past the end of a file that was not padded
+    *bytes = [_allocator bytes] + offset;
+    *length = MIN(size, fileSize - offset);
+    return YES;
+}
+
+- (DSStoreEntry *)entryForRecord:(const DSRecordRef *)record filename:(NSString *)filename
+                           codes:(DSFourCharCodeCache *)codes {
+    NSString *name = filename ? [filename retain]
+                              : DSCreateStringFromUTF16BigEndian(record->filename, record->filenameLength);
+    
+    // Values are decoded when they are first asked for. The entry of a mapped
+    // store keeps the allocator, and with it the mapping, until then; a
+    // loaded store's bytes change when it is saved, so its values are copied.
+    NSData *stored;
+    if (_readOnly) {
+        stored = [[NSData alloc] initWithBytesNoCopy:(void *)record->value
+                                              length:record->valueLength
+                                        freeWhenDone:NO];
+    } else {
+        stored = [[NSData alloc] initWithBytes:record->value length:record->valueLength];
+    }
+    DSStoreEntry *entry = [[DSStoreEntry alloc] initWithFilename:name
+                                                            code:cachedStringForFourCharCode(codes, record->code)
+                                                            type:cachedStringForFourCharCode(codes, record->type)
+                                                    encodedValue:stored
+                                                           owner:_readOnly ? _allocator : nil];
+    [stored release];
+    [name release];
+    return [entry autorelease];
+}
+
+- (DSStoreEntry *)lookupFilename:(NSString *)filename code:(NSString *)code {
+    NSUInteger nameLength = [filename length];
+    unichar stackName[256];
+    unichar *name = (nameLength <= 256) ? stackName : malloc(nameLength * sizeof(unichar));
+    [filename getCharacters:name range:NSMakeRange(0, nameLength)];
+    uint32_t wantedCode = fourCharCode(code);
+    
+    DSStoreEntry *found = nil;
+    uint32_t blockNumber = _rootNode;
+    
+    // Internal nodes hold records too, each after the child that sorts before
+    // it; the node's first word is its rightmost child, or 0 for a leaf
+    for (int depth = 0; depth < DSStoreMaxTreeDepth && !found; depth++) {
+        const uint8_t *node;
+        size_t length;
+        if (![self getNode:blockNumber bytes:&node length:&length]) {
+            break;
+        }
+        
+        DSByteCursor cursor = DSByteCursorMake(node, length);
+        uint32_t rightmost = DSByteCursorReadUInt32(&cursor);
+        uint32_t count = DSByteCursorReadUInt32(&cursor);
+        uint32_t next = rightmost;
+        
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t child = rightmost ? DSByteCursorReadUInt32(&cursor) : 0;
+            DSRecordRef record;
+            if (!parseRecord(&cursor, &record)) {
+                next = 0;
+                break;
+            }
+            
+            int order = compareRecordKey(filename, name, nameLength, wantedCode, &record);
+            if (order == 0 && recordHasFilename(&record, name, nameLength)) {
+                found = [self entryForRecord:&record filename:filename codes:NULL];
+                break;
+            }
+            if (order < 0) {
+                next = child;
+                break;
+            }
+        }
+        
+        if (!rightmost || !next) {
+            break;
+        }
+        blockNumber = next;
+    }
+    
+    if (name != stackName) {
+        free(name);
+    }
+    return found;
+}
+
+- (void)collectEntriesInNode:(uint32_t)blockNumber depth:(int)depth codes:(DSFourCharCodeCache *)codes {
+    const uint8_t *node;
+    size_t length;
+    if (depth >= DSStoreMaxTreeDepth) {
+        NSLog(@"DSStore: B-tree of %@ is deeper than %d levels", _filePath, DSStoreMaxTreeDepth);
+        return;
+    }
+    if (![self getNode:blockNumber bytes:&node length:&length]) {
+        NSLog(@"DSStore: B-tree node %u of %@ is not in the file", blockNumber, _filePath);
+        return;
+    }
+    [self collectEntriesFromNode:node length:length number:blockNumber depth:depth codes:codes];
+}
+
+- (void)collectEntriesFromNode:(const uint8_t *)node length:(size_t)length number:(uint32_t)blockNumber
+                         depth:(int)depth codes:(DSFourCharCodeCache *)codes {
+    // The first word is the node's rightmost child, or 0 for a leaf
+    DSByteCursor cursor = DSByteCursorMake(node, length);
+    uint32_t rightmost = DSByteCursorReadUInt32(&cursor);
+    uint32_t count = DSByteCursorReadUInt32(&cursor);
+    BOOL truncated = cursor.overrun;
+    
+    // Internal nodes hold records too, each after the child that sorts before it
+    for (uint32_t i = 0; i < count && !truncated; i++) {
+        if (rightmost) {
+            uint32_t child = DSByteCursorReadUInt32(&cursor);
+            if (cursor.overrun) {
+                truncated = YES;
+                break;
+            }
+            [self collectEntriesInNode:child depth:depth + 1 codes:codes];
+        }
+        
+        DSRecordRef record;
+        if (!parseRecord(&cursor, &record)) {
+            truncated = YES;
+            break;
+        }
+        [_entries addObject:[self entryForRecord:&record filename:nil codes:codes]];
+    }
+    
+    if (truncated) {
+        NSLog(@"DSStore: Truncated record in node %u of %@", blockNumber, _filePath);
+    } else if (rightmost) {
+        [self collectEntriesInNode:rightmost depth:depth + 1 codes:codes];
+    }
+}
+
+- (void)faultInEntries {
+    if (!_lazy) {
+        return;
+    }
+    _lazy = NO;
+    
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    DSFourCharCodeCache codes;
+    memset(&codes, 0, sizeof(codes));
+    [self collectEntriesInNode:_rootNode depth:0 codes:&codes];
+    releaseFourCharCodeCache(&codes);
+    [self rebuildIndex];
+    [pool release];
+}
+
+- (BOOL)refuseReadOnlyChange {
+    if (_readOnly) {
+        NSLog(@"DSStore: %@ was opened read-only", _filePath);
+    }
+    return _readOnly;
+}
+
+// Indexes _entries as read or passed in; of two entries with the same
+// filename and code, the later one is kept, as if set with setEntry:
+- (void)rebuildIndex {
+    [_index removeAllObjects];
+    
+    for (DSStoreEntry *entry in _entries) {
+        NSMutableDictionary *codes = [_index objectForKey:[entry filename]];
+        if (!codes) {
+            codes = [[NSMutableDictionary alloc] init];
+            [_index setObject:codes forKey:[entry filename]];
+            [codes release];
+        }
+        [codes setObject:entry forKey:codeKey([entry code])];
+    }
+    
+    [_entries removeAllObjects];
+    for (NSDictionary *codes in [_index objectEnumerator]) {
+        [_entries addObjectsFromArray:[codes allValues]];
+    }
+    [_entries sortUsingSelector:@selector(compare:)];
+}
+
+// The first position in _entries whose entry does not sort before entry
+- (NSUInteger)sortedPositionOfEntry:(DSStoreEntry *)entry {
+    NSUInteger low = 0;
+    NSUInteger high = [_entries count];
+    
+    while (low < high) {
+        NSUInteger middle = low + (high - low) / 2;
+        if ([[_entries objectAtIndex:middle] compare:entry] == NSOrderedAscending) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+- (void)indexEntry:(DSStoreEntry *)entry {
+    NSMutableDictionary *codes = [_index objectForKey:[entry filename]];
+    if (!codes) {
+        codes = [[NSMutableDictionary alloc] init];
+        [_index setObject:codes forKey:[entry filename]];
+        [codes release];
+    }
+    [codes setObject:entry forKey:codeKey([entry code])];
+    [_entries insertObject:entry atIndex:[self sortedPositionOfEntry:entry]];
+}
+
+- (void)unindexEntry:(DSStoreEntry *)entry {
+    [entry retain];
+    
+    // Filenames differing only in case sort together, so look past them
+    NSUInteger count = [_entries count];
+    for (NSUInteger i = [self sortedPositionOfEntry:entry]; i < count; i++) {
+        if ([_entries objectAtIndex:i] == entry) {
+            [_entries removeObjectAtIndex:i];
+            break;
+        }
+    }
+    
+    NSString *filename = [entry filename];
+    NSMutableDictionary *codes = [_index objectForKey:filename];
+    [codes removeObjectForKey:codeKey([entry code])];
+    if ([codes count] == 0) {
+        [_index removeObjectForKey:filename];
+    }
+    
+    [entry release];
+}
+
+- (BOOL)getLayoutLeaves:(NSMutableArray *)leaves bounds:(NSMutableArray *)bounds
+         internalNodes:(NSMutableArray *)internal dsdbBlock:(uint32_t)dsdbBlock {
+    NSMutableArray *levels = [NSMutableArray array];
+    BOOL walked = [self collectLayoutOfNode:_rootNode depth:0 leaves:leaves bounds:bounds levels:levels] &&
+                  [bounds count] + 1 == [leaves count];
+    
+    // Pages are made a level at a time from the leaves up, so the old
+    // internal nodes are handed out in that order
+    for (NSArray *level in [levels reverseObjectEnumerator]) {
+        [internal addObjectsFromArray:level];
+    }
+    
+    // A block the tree uses twice, or one that is not the tree's, is not reused
+    NSMutableSet *seen = [NSMutableSet setWithObjects:[NSNumber numberWithUnsignedInt:0],
+                          [NSNumber numberWithUnsignedInt:dsdbBlock], nil];
+    NSUInteger blocks = [seen count] + [leaves count] + [internal count];
+    [seen addObjectsFromArray:leaves];
+    [seen addObjectsFromArray:internal];
+    
+    if (!walked || [seen count] != blocks) {
+        [leaves removeAllObjects];
+        [bounds removeAllObjects];
+        [internal removeAllObjects];
+        return NO;
+    }
+    return YES;
+}
+
+- (BOOL)collectLayoutOfNode:(uint32_t)blockNumber depth:(int)depth leaves:(NSMutableArray *)leaves
+                     bounds:(NSMutableArray *)bounds levels:(NSMutableArray *)levels {
+    const uint8_t *node;
+    size_t length;
+    if (depth >= DSStoreMaxTreeDepth || ![self getNode:blockNumber bytes:&node length:&length]) {
+        return NO;
+    }
+    
+    DSByteCursor cursor = DSByteCursorMake(node, length);
+    uint32_t rightmost = DSByteCursorReadUInt32(&cursor);
+    uint32_t count = DSByteCursorReadUInt32(&cursor);
+    if (rightmost == 0) {
+        [leaves addObject:[NSNumber numberWithUnsignedInt:blockNumber]];
+        return YES;
+    }
+    
+    while ((int)[levels count] <= depth) {
+        [levels addObject:[NSMutableArray array]];
+    }
+    [[levels objectAtIndex:depth] addObject:[NSNumber numberWithUnsignedInt:blockNumber]];
+    
+    // Each record separates the leaves on either side of it
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t child = DSByteCursorReadUInt32(&cursor);
+        if (cursor.overrun ||
+            ![self collectLayoutOfNode:child depth:depth + 1 leaves:leaves bounds:bounds levels:levels]) {
+            return NO;
+        }
+        
+        DSRecordRef record;
+        if (!parseRecord(&cursor, &record)) {
+            return NO;
+        }
+        DSStoreEntry *bound = [[DSStoreEntry alloc] initWithFilename:recordFilename(&record)
+                                                                code:stringForFourCharCode(record.code)
+                                                                type:stringForFourCharCode(record.type)
+                                                               value:nil];
+        [bounds addObject:bound];
+        [bound release];
+    }
+    return [self collectLayoutOfNode:rightmost depth:depth + 1 leaves:leaves bounds:bounds levels:levels];
+}
+
+/*
+ * Packs the leaves of an existing tree. Records go to the leaf whose range
+ * held them before, in that leaf's block; a leaf that overflows is split
+ * into a new block, and a record that now sorts first past an old boundary
+ * separates the leaves in place of the one that went away. Leaves whose
+ * range was emptied are released.
+ */
+- (void)packLeaves:(NSArray *)records into:(DSPageSet *)set oldLeaves:(NSArray *)leaves
+            bounds:(NSArray *)bounds separators:(NSMutableArray *)upRecords
+          children:(uint32_t *)upChildren released:(NSMutableArray *)released {
+    NSUInteger count = [records count];
+    NSUInteger leafCount = [leaves count];
+    NSUInteger leaf = 0;
+    uint32_t pageBlock = [[leaves objectAtIndex:0] unsignedIntValue];
+    NSMutableData *page = [NSMutableData dataWithLength:8];
+    NSUInteger inPage = 0;
+    NSUInteger lastStart = 0;
+    NSUInteger pages = 0;
+    
+    for (NSUInteger i = 0; i < count; i++) {
+        DSStoreEntry *entry = [_entries objectAtIndex:i];
+        NSData *record = [records objectAtIndex:i];
+        BOOL last = (i + 1 == count);
+        
+        if (leaf + 1 < leafCount && [entry compare:[bounds objectAtIndex:leaf]] != NSOrderedAscending) {
+            NSUInteger next = leaf + 1;
+            while (next + 1 < leafCount && [entry compare:[bounds objectAtIndex:next]] != NSOrderedAscending) {
+                [released addObject:[leaves objectAtIndex:next]];
+                next++;
+            }
+            if (inPage > 0 && !last) {
+                upChildren[pages++] = addPage(set, page, 0, inPage, pageBlock);
+                [upRecords addObject:record];
+                leaf = next;
+                pageBlock = [[leaves objectAtIndex:leaf] unsignedIntValue];
+                page = [NSMutableData dataWithLength:8];
+                inPage = 0;
+                continue;
+            }
+            
+            // Nothing before it to separate from, or nothing after it
+            [released addObject:[leaves objectAtIndex:next]];
+            leaf = next;
+        }
+        
+        if ([page length] + [record length] > DSStorePageSize && inPage > 0) {
+            // A lone last record would leave the new leaf empty; move one up instead
+            NSData *separator = record;
+            if (last && inPage > 1) {
+                separator = [page subdataWithRange:NSMakeRange(lastStart, [page length] - lastStart)];
+                [page setLength:lastStart];
+                inPage--;
+            }
+            upChildren[pages++] = addPage(set, page, 0, inPage, pageBlock);
+            [upRecords addObject:separator];
+            pageBlock = takeBlockNumber(set);
+            page = [NSMutableData dataWithLength:8];
+            inPage = 0;
+            if (separator == record) {
+                continue;
+            }
+        }
+        
+        lastStart = [page length];
+        [page appendData:record];
+        inPage++;
+    }
+    
+    upChildren[pages++] = addPage(set, page, 0, inPage, pageBlock);
+    for (NSUInteger i = leaf + 1; i < leafCount; i++) {
+        [released addObject:[leaves objectAtIndex:i]];
+    }
+}
+
+// Packs _entries, which are in B-tree order, from the leaves up: into the
+// old tree's leaves if there are any, or bulk-loaded into full pages.
+// Returns the index of the root in set's pages.
+- (NSUInteger)packNodes:(DSPageSet *)set levels:(uint32_t *)levels oldLeaves:(NSArray *)leaves
+                 bounds:(NSArray *)bounds released:(NSMutableArray *)released {
+    NSMutableArray *records = [NSMutableArray arrayWithCapacity:[_entries count]];
+    for (DSStoreEntry *entry in _entries) {
+        [records addObject:[entry encode]];
+    }
+    
+    // The superblock counts the internal levels: 0 when the root is a leaf
+    uint32_t *children = NULL;
+    *levels = 0;
+    for (;;) {
+        NSMutableArray *upRecords = [NSMutableArray array];
+        uint32_t *upChildren = malloc(sizeof(uint32_t) * ([records count] + 2));
+        NSUInteger firstNode = [set->pages count];
+        
+        if (children == NULL && [leaves count] > 0) {
+            [self packLeaves:records into:set oldLeaves:leaves bounds:bounds
+                  separators:upRecords children:upChildren released:released];
+        } else {
+            packLevel(records, children, set, upRecords, upChildren);
+        }
+        free(children);
+        
+        if ([set->pages count] - firstNode == 1) {
+            free(upChildren);
+            return firstNode;
+        }
+        (*levels)++;
+        records = upRecords;
+        children = upChildren;
+    }
+}
+
+- (BOOL)writeBlock:(uint32_t)blockNumber size:(NSUInteger)size bytes:(NSData *)bytes {
+    uint32_t address;
+    if (![_allocator allocateBlock:blockNumber size:size] || ![_allocator getAddress:&address ofBlock:blockNumber]) {
+        return NO;
+    }
+    
+    // Only a block whose contents changed is written
+    NSUInteger offset = (address & ~0x1F) + 4;
+    NSUInteger blockSize = (NSUInteger)1 << (address & 0x1F);
+    NSMutableData *block = [NSMutableData dataWithData:bytes];
+    [block setLength:blockSize];
+    if (offset + blockSize <= [_allocator fileSize] &&
+        memcmp([_allocator bytes] + offset, [block bytes], blockSize) == 0) {
+        return YES;
+    }
+    [_allocator writeAtOffset:offset data:block];
+    return YES;
+}
+
+@end
@@ -14,6 +14,9 @@
     NSString *_code;
     NSString *_type;
     id _value;
+    NSData *_encodedValue;  // Value as stored in the file, decoded into _value on first access
+    id _owner;              // Keeps the bytes under _encodedValue alive
+    NSString *_sortName;    // Lowercased filename for compare:, made on first use
 }
 
 @property (nonatomic, retain) NSString *filename;
@@ -22,6 +25,12 @@
 @property (nonatomic, retain) id value;
 
 - (id)initWithFilename:(NSString *)filename code:(NSString *)code type:(NSString *)type value:(id)value;
+
+// An entry read from a mapped file. encodedValue holds the value as on disk,
+// including any length prefix, and may point into memory that owner keeps.
+- (id)initWithFilename:(NSString *)filename code:(NSString *)code type:(NSString *)type
+          encodedValue:(NSData *)encodedValue owner:(id)owner;
+
 - (NSUInteger)byteLength;
 - (NSData *)encode;
 
@@ -6,6 +6,7 @@
 //
 
 #import "DSStoreEntry.h"
+#import "DSByteCursor.h"
 #include <arpa/inet.h>  // For htonl, ntohl, htons, ntohs
 
 // Byte swapping functions for portability
@@ -25,12 +26,47 @@ static inline uint16_t swapInt16BigToHost(uint16_t x) {
     return ntohs(x);
 }
 
+// Decodes a value as stored in a B-tree record; loaded and mapped stores'
+// entries keep their values encoded until they are first asked for
+static id decodeStoredValue(NSString *type, NSData *stored) {
+    const uint8_t *bytes = [stored bytes];
+    NSUInteger length = [stored length];
+    
+    if ([type isEqualToString:@"bool"]) {
+        return length >= 1 ? [NSNumber numberWithBool:(bytes[0] != 0)] : nil;
+    } else if ([type isEqualToString:@"long"]) {
+        return length >= 4 ? [NSNumber numberWithUnsignedInt:DSLoadBigEndian32(bytes)] : nil;
+    } else if ([type isEqualToString:@"shor"]) {
+        // Stored in four bytes like long
+        return length >= 4 ? [NSNumber numberWithUnsignedShort:(uint16_t)DSLoadBigEndian32(bytes)] : nil;
+    } else if ([type isEqualToString:@"ustr"]) {
+        if (length < 4 || length - 4 < 2 * (NSUInteger)DSLoadBigEndian32(bytes)) {
+            return nil;
+        }
+        return [DSCreateStringFromUTF16BigEndian(bytes + 4, DSLoadBigEndian32(bytes)) autorelease];
+    } else if ([type isEqualToString:@"type"]) {
+        return length >= 4 ? [[[NSString alloc] initWithBytes:bytes length:4
+                                                     encoding:NSASCIIStringEncoding] autorelease] : nil;
+    } else if ([type isEqualToString:@"comp"] || [type isEqualToString:@"dutc"]) {
+        return length >= 8 ? [NSNumber numberWithUnsignedLongLong:DSLoadBigEndian64(bytes)] : nil;
+    }
+    
+    // blob, and unknown types read as blobs; copied, since callers may outlive the mapping
+    if (length < 4 || length - 4 < DSLoadBigEndian32(bytes)) {
+        return nil;
+    }
+    return [NSData dataWithBytes:bytes + 4 length:DSLoadBigEndian32(bytes)];
+}
+
+@interface DSStoreEntry (Private)
+- (NSString *)sortName;
+@end
+
 @implementation DSStoreEntry
 
 @synthesize filename = _filename;
 @synthesize code = _code;
 @synthesize type = _type;
-@synthesize value = _value;
 
 - (id)initWithFilename:(NSString *)filename code:(NSString *)code type:(NSString *)type value:(id)value {
     self = [super init];
@@ -43,18 +79,67 @@ static inline uint16_t swapInt16BigToHost(uint16_t x) {
     return self;
 }
 
+- (id)initWithFilename:(NSString *)filename code:(NSString *)code type:(NSString *)type
+          encodedValue:(NSData *)encodedValue owner:(id)owner {
+    self = [super init];
+    if (self) {
+        self.filename = filename;
+        self.code = code;
+        self.type = type;
+        _encodedValue = [encodedValue retain];
+        _owner = [owner retain];
+    }
+    return self;
+}
+
 - (void)dealloc {
     [_filename release];
     [_code release];
     [_type release];
     [_value release];
+    [_encodedValue release];
+    [_owner release];
+    [_sortName release];
     [super dealloc];
 }
 
+- (void)setFilename:(NSString *)filename {
+    [filename retain];
+    [_filename release];
+    _filename = filename;
+    [_sortName release];
+    _sortName = nil;
+}
+
+- (id)value {
+    if (_encodedValue) {
+        _value = [decodeStoredValue(_type, _encodedValue) retain];
+        [_encodedValue release];
+        _encodedValue = nil;
+        [_owner release];
+        _owner = nil;
+    }
+    return _value;
+}
+
+- (void)setValue:(id)value {
+    [value retain];
+    [_value release];
+    _value = value;
+    [_encodedValue release];
+    _encodedValue = nil;
+    [_owner release];
+    _owner = nil;
+}
+
 - (NSUInteger)byteLength {
     NSData *utf16Data = [self.filename dataUsingEncoding:NSUTF16BigEndianStringEncoding];
     NSUInteger length = 4 + [utf16Data length] + 8; // 4 bytes for length + filename + 4 bytes code + 4 bytes type
     
+    if (_encodedValue) {
+        return length + [_encodedValue length];
+    }
+    
     NSString *entryType = self.type;
     
     if ([entryType isEqualToString:@"bool"]) {
@@ -128,6 +213,12 @@ static uint64_t swapBytes64(uint64_t value) {
         [data appendBytes:typeBuf length:4];
     }
     
+    // An entry that was never decoded is written back as it was read
+    if (_encodedValue) {
+        [data appendData:_encodedValue];
+        return data;
+    }
+    
     // Write value based on type
     if ([self.type isEqualToString:@"bool"]) {
         BOOL boolValue = [self.value boolValue];
@@ -170,10 +261,7 @@ static uint64_t swapBytes64(uint64_t value) {
 }
 
 - (NSComparisonResult)compare:(DSStoreEntry *)other {
-    NSString *selfLower = [self.filename lowercaseString];
-    NSString *otherLower = [other.filename lowercaseString];
-    
-    NSComparisonResult result = [selfLower compare:otherLower];
+    NSComparisonResult result = [[self sortName] compare:[other sortName]];
     if (result == NSOrderedSame) {
         return [self.code compare:other.code];
     }
@@ -291,7 +379,7 @@ static uint64_t swapBytes64(uint64_t value) {
         return NSMakePoint(0, 0);
     }
     
-    NSData *data = (NSData *)_value;
+    NSData *data = (NSData *)[self value];
     if ([data length] < 8) return NSMakePoint(0, 0);
     
     uint32_t x, y;
@@ -334,7 +422,7 @@ static uint64_t swapBytes64(uint64_t value) {
         return nil;
     }
     
-    NSData *data = (NSData *)_value;
+    NSData *data = (NSData *)[self value];
     if ([data length] < 4) return nil;
     
     char type[5] = {0};
@@ -351,7 +439,7 @@ static uint64_t swapBytes64(uint64_t value) {
         return nil;
     }
     
-    return (NSString *)_value;
+    return (NSString *)[self value];
 }
 
 - (int)iconSize {
@@ -359,7 +447,7 @@ static uint64_t swapBytes64(uint64_t value) {
         return 0;
     }
     
-    NSData *data = (NSData *)_value;
+    NSData *data = (NSData *)[self value];
     if ([data length] < 14) return 0;
     
     char type[5] = {0};
@@ -378,7 +466,7 @@ static uint64_t swapBytes64(uint64_t value) {
         return nil;
     }
     
-    return (NSString *)_value;
+    return (NSString *)[self value];
 }
 
 - (long long)logicalSize {
@@ -387,7 +475,7 @@ static uint64_t swapBytes64(uint64_t value) {
     }
     
     if ([_type isEqualToString:@"long"]) {
-        return [(NSNumber *)_value longLongValue];
+        return [(NSNumber *)[self value] longLongValue];
     }
     
     return 0;
@@ -399,7 +487,7 @@ static uint64_t swapBytes64(uint64_t value) {
     }
     
     if ([_type isEqualToString:@"long"]) {
-        return [(NSNumber *)_value longLongValue];
+        return [(NSNumber *)[self value] longLongValue];
     }
     
     return 0;
@@ -411,7 +499,7 @@ static uint64_t swapBytes64(uint64_t value) {
     }
     
     if ([_type isEqualToString:@"dutc"]) {
-        uint64_t dutcValue = [(NSNumber *)_value unsignedLongLongValue];
+        uint64_t dutcValue = [(NSNumber *)[self value] unsignedLongLongValue];
         NSTimeInterval secondsSince1904 = dutcValue / 65536.0;
         NSTimeInterval secondsSince1970 = secondsSince1904 - (66 * 365.25 * 24 * 3600);
         return [NSDate dateWithTimeIntervalSince1970:secondsSince1970];
@@ -425,7 +513,7 @@ static uint64_t swapBytes64(uint64_t value) {
         return NO;
     }
     
-    return [(NSNumber *)_value boolValue];
+    return [(NSNumber *)[self value] boolValue];
 }
 
 - (int32_t)longValue {
@@ -433,7 +521,19 @@ static uint64_t swapBytes64(uint64_t value) {
         return 0;
     }
     
-    return [(NSNumber *)_value intValue];
+    return [(NSNumber *)[self value] intValue];
+}
+
+@end
+
+@implementation DSStoreEntry (Private)
+
+// DSStore keeps its entries sorted, so compare: runs on every insertion
+- (NSString *)sortName {
+    if (!_sortName) {
+        _sortName = [[_filename lowercaseString] retain];
+    }
+    return _sortName;
 }
 
 @end